@@ -324,37 +324,30 @@ static void DotNetCore_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messag
         {
             DOTNET_CORE_HOST_HANDLE_DATA* result = (DOTNET_CORE_HOST_HANDLE_DATA*)moduleHandle;
 
-            /* Codes_SRS_DOTNET_CORE_04_020: [ DotNetCore_Receive shall call Message_ToByteArray to serialize message. ] */
-            int32_t size = Message_ToByteArray(messageHandle, NULL, 0); 
+            /* Codes_SRS_DOTNET_CORE_04_020: [ DotNetCore_Receive shall call Message_GetSerialization to get the serialization of message, so that a message received by several modules is serialized once. ] */
+            CONSTBUFFER_HANDLE serialization = Message_GetSerialization(messageHandle, GATEWAY_MESSAGE_VERSION_1);
 
-            if (size > 0)
+            if (serialization == NULL)
             {
-                unsigned char* buffer = (unsigned char*)malloc(size);
+                LogError("Unable to convert message to Byte Array");
+            }
+            else
+            {
+                const CONSTBUFFER* serialized = CONSTBUFFER_GetContent(serialization);
 
-                if (buffer != NULL)
+                try
                 {
-                    int32_t resultFromConversionToByteArray = Message_ToByteArray(messageHandle, buffer, size);
-
-                    if (resultFromConversionToByteArray > 0)
-                    {
-                        try
-                        {
-                            /* Codes_SRS_DOTNET_CORE_04_022: [ DotNetCore_Receive shall call Microsoft.Azure.Devices.Gateway.GatewayDelegatesGateway.Delegates_Receive C# method, implemented on Microsoft.Azure.Devices.Gateway.dll. ] */
-                            (*GatewayReceiveDelegate)(buffer, size, result->module_id);
-                        }
-                        catch (const std::exception& msgErr)
-                        {
-                            (void)msgErr;
-                            LogError("Exception Thrown. Error on calling Receive Delegate.");
-                        }
-                    }
-                    else
-                    {
-                        LogError("Unable to convert message to Byte Array");
-                    }
-
-                    delete(buffer);
+                    /* Codes_SRS_DOTNET_CORE_04_022: [ DotNetCore_Receive shall call Microsoft.Azure.Devices.Gateway.GatewayDelegatesGateway.Delegates_Receive C# method, implemented on Microsoft.Azure.Devices.Gateway.dll. ] */
+                    (*GatewayReceiveDelegate)((unsigned char*)serialized->buffer, (int32_t)serialized->size, result->module_id);
                 }
+                catch (const std::exception& msgErr)
+                {
+                    (void)msgErr;
+                    LogError("Exception Thrown. Error on calling Receive Delegate.");
+                }
+
+                /* Codes_SRS_DOTNET_CORE_30_001: [ DotNetCore_Receive shall release the serialization of message once Delegates_Receive returns. ] */
+                CONSTBUFFER_Destroy(serialization);
             }
         }
         else
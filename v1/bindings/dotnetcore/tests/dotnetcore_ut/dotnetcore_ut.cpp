@@ -49,6 +49,9 @@ extern PGatewayStartDelegate GatewayStartDelegate;
 static size_t gMessageSize;
 static const unsigned char * gMessageSource;
 
+static const unsigned char serializedMessageBytes[] = { 0xA1, 0x60 };
+static const CONSTBUFFER serializedMessage = { serializedMessageBytes, sizeof(serializedMessageBytes) };
+
 static size_t currentnew_call;
 static size_t whenShallnew_fail;
 static size_t currentnewarray_call;
@@ -261,8 +264,14 @@ public:
     MOCK_VOID_METHOD_END()
 
     //Message Mocks
-    MOCK_STATIC_METHOD_3(, int32_t, Message_ToByteArray, MESSAGE_HANDLE, messageHandle, unsigned char*, buf, int32_t , size)
-    MOCK_METHOD_END( int32_t, (int32_t)11);
+    MOCK_STATIC_METHOD_2(, CONSTBUFFER_HANDLE, Message_GetSerialization, MESSAGE_HANDLE, message, uint8_t, version)
+    MOCK_METHOD_END(CONSTBUFFER_HANDLE, (CONSTBUFFER_HANDLE)0x43);
+
+    MOCK_STATIC_METHOD_1(, const CONSTBUFFER*, CONSTBUFFER_GetContent, CONSTBUFFER_HANDLE, constbufferHandle)
+    MOCK_METHOD_END(const CONSTBUFFER*, &serializedMessage);
+
+    MOCK_STATIC_METHOD_1(, void, CONSTBUFFER_Destroy, CONSTBUFFER_HANDLE, constbufferHandle)
+    MOCK_VOID_METHOD_END()
 
     MOCK_STATIC_METHOD_2(, MESSAGE_HANDLE, Message_CreateFromByteArray, const unsigned char*, source, int32_t, size)
     MOCK_METHOD_END(MESSAGE_HANDLE, (MESSAGE_HANDLE)0x42);
@@ -386,7 +395,11 @@ extern "C"
 
         
     //Message Mocks
-    DECLARE_GLOBAL_MOCK_METHOD_3(CDOTNETCOREMocks, , int32_t, Message_ToByteArray, MESSAGE_HANDLE, messageHandle, unsigned char*, buf, int32_t, size);
+    DECLARE_GLOBAL_MOCK_METHOD_2(CDOTNETCOREMocks, , CONSTBUFFER_HANDLE, Message_GetSerialization, MESSAGE_HANDLE, message, uint8_t, version);
+
+    DECLARE_GLOBAL_MOCK_METHOD_1(CDOTNETCOREMocks, , const CONSTBUFFER*, CONSTBUFFER_GetContent, CONSTBUFFER_HANDLE, constbufferHandle);
+
+    DECLARE_GLOBAL_MOCK_METHOD_1(CDOTNETCOREMocks, , void, CONSTBUFFER_Destroy, CONSTBUFFER_HANDLE, constbufferHandle);
 
     DECLARE_GLOBAL_MOCK_METHOD_2(CDOTNETCOREMocks, , MESSAGE_HANDLE, Message_CreateFromByteArray, const unsigned char*, source, int32_t, size);
 
@@ -1106,8 +1119,9 @@ BEGIN_TEST_SUITE(dotnetcore_ut)
         ///cleanup
     }
 
-    /* Tests_SRS_DOTNET_CORE_04_020: [ DotNetCore_Receive shall call Message_ToByteArray to serialize message. ] */
+    /* Tests_SRS_DOTNET_CORE_04_020: [ DotNetCore_Receive shall call Message_GetSerialization to get the serialization of message, so that a message received by several modules is serialized once. ] */
     /* Tests_SRS_DOTNET_CORE_04_022: [ DotNetCore_Receive shall call Microsoft.Azure.Devices.Gateway.GatewayDelegatesGateway.Delegates_Receive C# method, implemented on Microsoft.Azure.Devices.Gateway.dll. ] */
+    /* Tests_SRS_DOTNET_CORE_30_001: [ DotNetCore_Receive shall release the serialization of message once Delegates_Receive returns. ] */
     TEST_FUNCTION(DotNetCore_Receive_succeed)
     {
         ///arrange
@@ -1127,10 +1141,11 @@ BEGIN_TEST_SUITE(dotnetcore_ut)
         auto result = MODULE_CREATE(theAPIS)((BROKER_HANDLE)0x42, &dotNetConfig);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_ToByteArray((MESSAGE_HANDLE)0x42, NULL, 0));
+        STRICT_EXPECTED_CALL(mocks, Message_GetSerialization((MESSAGE_HANDLE)0x42, GATEWAY_MESSAGE_VERSION_1));
+
+        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_GetContent((CONSTBUFFER_HANDLE)0x43));
 
-        STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Destroy((CONSTBUFFER_HANDLE)0x43));
 
 
         ///act
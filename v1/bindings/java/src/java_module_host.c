@@ -385,79 +385,73 @@ static void JavaModuleHost_Receive(MODULE_HANDLE module, MESSAGE_HANDLE message)
         JAVA_MODULE_HANDLE_DATA* moduleHandle = (JAVA_MODULE_HANDLE_DATA*)module;
 
         /*Codes_SRS_JAVA_MODULE_HOST_14_023: [This function shall serialize message.]*/
-        int32_t size = Message_ToByteArray(message, NULL, 0);
+        /*Codes_SRS_JAVA_MODULE_HOST_30_001: [This function shall use the serialization kept with message, so that a message received by several modules is serialized once.]*/
+        CONSTBUFFER_HANDLE serialization = Message_GetSerialization(message, GATEWAY_MESSAGE_VERSION_1);
 
-        if (size < 0)
+        if (serialization == NULL)
         {
             /*Codes_SRS_JAVA_MODULE_HOST_14_047: [This function shall exit if any underlying function fails.]*/
             LogError("Could not serialize the message to a byte array.");
         }
         else
         {
-            unsigned char* serialized_message = (unsigned char*)malloc(size);
-            if (serialized_message == NULL)
-            {
-                LogError("Could not allocate byte array for message.");
-            }
-            else
-            {
-                Message_ToByteArray(message, serialized_message, size);
+            const CONSTBUFFER* serialized_message = CONSTBUFFER_GetContent(serialization);
+            jsize size = (jsize)serialized_message->size;
 
-                JNIEnv* env;
-                /*Codes_SRS_JAVA_MODULE_HOST_14_042: [This function shall attach the JVM to the current thread.]*/
-                jint jni_result = JNIFunc(moduleHandle->jvm, AttachCurrentThread, (void**)(&env), NULL);
+            JNIEnv* env;
+            /*Codes_SRS_JAVA_MODULE_HOST_14_042: [This function shall attach the JVM to the current thread.]*/
+            jint jni_result = JNIFunc(moduleHandle->jvm, AttachCurrentThread, (void**)(&env), NULL);
 
-                if (jni_result == JNI_OK)
+            if (jni_result == JNI_OK)
+            {
+                /*Codes_SRS_JAVA_MODULE_HOST_14_043: [This function shall create a new jbyteArray for the serialized message.]*/
+                jbyteArray arr = JNIFunc(env, NewByteArray, size);
+                if (arr == NULL)
                 {
-                    /*Codes_SRS_JAVA_MODULE_HOST_14_043: [This function shall create a new jbyteArray for the serialized message.]*/
-                    jbyteArray arr = JNIFunc(env, NewByteArray, size);
-                    if (arr == NULL)
+                    /*Codes_SRS_JAVA_MODULE_HOST_14_047: [This function shall exit if any underlying function fails.]*/
+                    LogError("New jbyteArray could not be constructed.");
+                }
+                else
+                {
+                    /*Codes_SRS_JAVA_MODULE_HOST_14_044: [This function shall set the contents of the jbyteArray to the serialized_message.]*/
+                    JNIFunc(env, SetByteArrayRegion, arr, 0, size, (const jbyte*)serialized_message->buffer);
+                    jthrowable exception = JNIFunc(env, ExceptionOccurred);
+                    if (exception)
                     {
                         /*Codes_SRS_JAVA_MODULE_HOST_14_047: [This function shall exit if any underlying function fails.]*/
-                        LogError("New jbyteArray could not be constructed.");
+                        LogError("Exception occurred in SetByteArrayRegion.");
+                        JNIFunc(env, ExceptionDescribe);
+                        JNIFunc(env, ExceptionClear);
                     }
                     else
                     {
-                        /*Codes_SRS_JAVA_MODULE_HOST_14_044: [This function shall set the contents of the jbyteArray to the serialized_message.]*/
-                        JNIFunc(env, SetByteArrayRegion, arr, 0, size, (jbyte*)serialized_message);
-                        jthrowable exception = JNIFunc(env, ExceptionOccurred);
-                        if (exception)
+                        /*Codes_SRS_JAVA_MODULE_HOST_14_045: [This function shall get the user - defined Java module class using the module parameter and get the receive() method.]*/
+                        jmethodID jModule_receive = get_module_method(moduleHandle, env, MODULE_RECEIVE_METHOD_NAME, MODULE_RECEIVE_DESCRIPTOR);
+                        if (jModule_receive == NULL)
                         {
                             /*Codes_SRS_JAVA_MODULE_HOST_14_047: [This function shall exit if any underlying function fails.]*/
-                            LogError("Exception occurred in SetByteArrayRegion.");
-                            JNIFunc(env, ExceptionDescribe);
-                            JNIFunc(env, ExceptionClear);
+                            LogError("Failed to get the %s receive() method.", moduleHandle->moduleName);
                         }
                         else
                         {
-                            /*Codes_SRS_JAVA_MODULE_HOST_14_045: [This function shall get the user - defined Java module class using the module parameter and get the receive() method.]*/
-                            jmethodID jModule_receive = get_module_method(moduleHandle, env, MODULE_RECEIVE_METHOD_NAME, MODULE_RECEIVE_DESCRIPTOR);
-                            if (jModule_receive == NULL)
+                            /*Codes_SRS_JAVA_MODULE_HOST_14_024: [This function shall call the void receive(byte[] source) method of the Java module object passing the serialized message.]*/
+                            CallVoidMethodInternal(env, moduleHandle->module, jModule_receive, 1, arr);
+                            exception = JNIFunc(env, ExceptionOccurred);
+                            if (exception)
                             {
                                 /*Codes_SRS_JAVA_MODULE_HOST_14_047: [This function shall exit if any underlying function fails.]*/
-                                LogError("Failed to get the %s receive() method.", moduleHandle->moduleName);
-                            }
-                            else
-                            {
-                                /*Codes_SRS_JAVA_MODULE_HOST_14_024: [This function shall call the void receive(byte[] source) method of the Java module object passing the serialized message.]*/
-                                CallVoidMethodInternal(env, moduleHandle->module, jModule_receive, 1, arr);
-                                exception = JNIFunc(env, ExceptionOccurred);
-                                if (exception)
-                                {
-                                    /*Codes_SRS_JAVA_MODULE_HOST_14_047: [This function shall exit if any underlying function fails.]*/
-                                    LogError("Exception occurred in receive() of %s.", moduleHandle->moduleName);
-                                    JNIFunc(env, ExceptionDescribe);
-                                    JNIFunc(env, ExceptionClear);
-                                }
+                                LogError("Exception occurred in receive() of %s.", moduleHandle->moduleName);
+                                JNIFunc(env, ExceptionDescribe);
+                                JNIFunc(env, ExceptionClear);
                             }
                         }
-                        JNIFunc(env, DeleteLocalRef, arr);
                     }
-                    /*Codes_SRS_JAVA_MODULE_HOST_14_046: [This function shall detach the JVM from the current thread.]*/
-                    JNIFunc(moduleHandle->jvm, DetachCurrentThread);
+                    JNIFunc(env, DeleteLocalRef, arr);
                 }
-                free(serialized_message);
+                /*Codes_SRS_JAVA_MODULE_HOST_14_046: [This function shall detach the JVM from the current thread.]*/
+                JNIFunc(moduleHandle->jvm, DetachCurrentThread);
             }
+            CONSTBUFFER_Destroy(serialization);
         }
     }
 
@@ -120,6 +120,27 @@ int32_t my_MessageToByteArray(MESSAGE_HANDLE messageHandle, unsigned char* buf,
     return 1;
 }
 
+static const unsigned char serialized_message[] = { 0xA1 };
+static const CONSTBUFFER serialized_content = { serialized_message, sizeof(serialized_message) };
+
+CONSTBUFFER_HANDLE my_Message_GetSerialization(MESSAGE_HANDLE message, uint8_t version)
+{
+    (void)message;
+    (void)version;
+    return (CONSTBUFFER_HANDLE)malloc(1);
+}
+
+const CONSTBUFFER* my_CONSTBUFFER_GetContent(CONSTBUFFER_HANDLE constbufferHandle)
+{
+    (void)constbufferHandle;
+    return &serialized_content;
+}
+
+void my_CONSTBUFFER_Destroy(CONSTBUFFER_HANDLE constbufferHandle)
+{
+    free((void*)constbufferHandle);
+}
+
 void my_Message_Destroy(MESSAGE_HANDLE message)
 {
     if (message != NULL)
@@ -670,6 +691,9 @@ TEST_SUITE_INITIALIZE(TestClassInitialize)
     REGISTER_GLOBAL_MOCK_HOOK(Message_CreateFromByteArray, my_Message_CreateFromByteArray);
     REGISTER_GLOBAL_MOCK_HOOK(Message_ToByteArray, my_MessageToByteArray);
     REGISTER_GLOBAL_MOCK_HOOK(Message_Destroy, my_Message_Destroy);
+    REGISTER_GLOBAL_MOCK_HOOK(Message_GetSerialization, my_Message_GetSerialization);
+    REGISTER_GLOBAL_MOCK_HOOK(CONSTBUFFER_GetContent, my_CONSTBUFFER_GetContent);
+    REGISTER_GLOBAL_MOCK_HOOK(CONSTBUFFER_Destroy, my_CONSTBUFFER_Destroy);
 
     //JavaModuleHostManager Hooks
     REGISTER_GLOBAL_MOCK_HOOK(JavaModuleHostManager_Create, my_JavaModuleHostManager_Create);
@@ -689,6 +713,8 @@ TEST_SUITE_INITIALIZE(TestClassInitialize)
 
     REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_HANDLE, void*);
 
+    REGISTER_UMOCK_ALIAS_TYPE(CONSTBUFFER_HANDLE, void*);
+
     REGISTER_UMOCK_ALIAS_TYPE(STRING_HANDLE, void*);
 
     REGISTER_UMOCK_ALIAS_TYPE(VECTOR_HANDLE, void*);
@@ -2154,6 +2180,7 @@ TEST_FUNCTION(JavaModuleHost_Create_gets_previously_created_JVM_success)
 //=============================================================================
 
 /*Tests_SRS_JAVA_MODULE_HOST_14_023: [This function shall serialize message.]*/
+/*Tests_SRS_JAVA_MODULE_HOST_30_001: [This function shall use the serialization kept with message, so that a message received by several modules is serialized once.]*/
 /*Tests_SRS_JAVA_MODULE_HOST_14_042: [This function shall attach the JVM to the current thread.]*/
 /*Tests_SRS_JAVA_MODULE_HOST_14_043: [This function shall create a new jbyteArray for the serialized message.]*/
 /*Tests_SRS_JAVA_MODULE_HOST_14_044: [This function shall set the contents of the jbyteArray to the serialized_message.]*/
@@ -2175,12 +2202,9 @@ TEST_FUNCTION(JavaModuleHost_Receive_success)
     MESSAGE_HANDLE message = Message_CreateFromByteArray(msg, sizeof(msg));
     umock_c_reset_all_calls();
 
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_GetSerialization(message, GATEWAY_MESSAGE_VERSION_1));
+    STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
 
     STRICT_EXPECTED_CALL(AttachCurrentThread(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL))
         .IgnoreArgument(1)
@@ -2223,7 +2247,7 @@ TEST_FUNCTION(JavaModuleHost_Receive_success)
     STRICT_EXPECTED_CALL(DetachCurrentThread(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
-    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
     //Act
@@ -2280,7 +2304,7 @@ TEST_FUNCTION(JavaModuleHost_Receive_message_NULL_failure)
 }
 
 /*Tests_SRS_JAVA_MODULE_HOST_14_047: [This function shall exit if any underlying function fails.]*/
-TEST_FUNCTION(JavaModuleHost_Receive_Message_ToByteArray_failure)
+TEST_FUNCTION(JavaModuleHost_Receive_Message_GetSerialization_failure)
 {
     //Arrange
     const unsigned char msg[] =
@@ -2299,8 +2323,8 @@ TEST_FUNCTION(JavaModuleHost_Receive_Message_ToByteArray_failure)
     result = umock_c_negative_tests_init();
     ASSERT_ARE_EQUAL(int, 0, result);
 
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, NULL, 0))
-        .SetFailReturn(-1);
+    STRICT_EXPECTED_CALL(Message_GetSerialization(message, GATEWAY_MESSAGE_VERSION_1))
+        .SetFailReturn(NULL);
 
 
     umock_c_negative_tests_snapshot();
@@ -2320,47 +2344,6 @@ TEST_FUNCTION(JavaModuleHost_Receive_Message_ToByteArray_failure)
 
 }
 
-/*Tests_SRS_JAVA_MODULE_HOST_14_047: [This function shall exit if any underlying function fails.]*/
-TEST_FUNCTION(JavaModuleHost_Receive_Message_allocate_failure)
-{
-    //Arrange
-    const unsigned char msg[] =
-    {
-        0xA1, 0x60,             /*header*/
-        0x00, 0x00, 0x00, 14,   /*size of this array*/
-        0x00, 0x00, 0x00, 0x00, /*zero properties*/
-        0x00, 0x00, 0x00, 0x00  /*zero message content size*/
-    };
-
-    MODULE_HANDLE module = JavaModuleHost_Create((BROKER_HANDLE)0x42, &config);
-    MESSAGE_HANDLE message = Message_CreateFromByteArray(msg, sizeof(msg));
-    umock_c_reset_all_calls();
-
-    int result = 0;
-    result = umock_c_negative_tests_init();
-    ASSERT_ARE_EQUAL(int, 0, result);
-
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn(NULL);
-
-    umock_c_negative_tests_snapshot();
-
-    //Act
-    umock_c_negative_tests_fail_call(1);
-    JavaModuleHost_Receive(module, message);
-
-    //Assert
-    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-
-    //Cleanup
-    Message_Destroy(message);
-    JavaModuleHost_Destroy(module);
-
-    umock_c_negative_tests_deinit();
-
-}
 /*Tests_SRS_JAVA_MODULE_HOST_14_047: [This function shall exit if any underlying function fails.]*/
 TEST_FUNCTION(JavaModuleHost_Receive_AttachCurrentThread_failure)
 {
@@ -2381,21 +2364,18 @@ TEST_FUNCTION(JavaModuleHost_Receive_AttachCurrentThread_failure)
     result = umock_c_negative_tests_init();
     ASSERT_ARE_EQUAL(int, 0, result);
 
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_GetSerialization(message, GATEWAY_MESSAGE_VERSION_1));
+    STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
     STRICT_EXPECTED_CALL(AttachCurrentThread(global_vm, IGNORED_PTR_ARG, NULL))
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
     umock_c_negative_tests_snapshot();
 
     //Act
-    umock_c_negative_tests_fail_call(3);
+    umock_c_negative_tests_fail_call(2);
     JavaModuleHost_Receive(module, message);
 
     //Assert
@@ -2428,12 +2408,9 @@ TEST_FUNCTION(JavaModuleHost_Receive_NewByteArray_failure)
     result = umock_c_negative_tests_init();
     ASSERT_ARE_EQUAL(int, 0, result);
 
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_GetSerialization(message, GATEWAY_MESSAGE_VERSION_1));
+    STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
     STRICT_EXPECTED_CALL(AttachCurrentThread(global_vm, IGNORED_PTR_ARG, NULL))
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(NewByteArray(global_env, IGNORED_NUM_ARG))
@@ -2441,13 +2418,13 @@ TEST_FUNCTION(JavaModuleHost_Receive_NewByteArray_failure)
 
     STRICT_EXPECTED_CALL(DetachCurrentThread(global_vm));
 
-    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
     umock_c_negative_tests_snapshot();
 
     //Act
-    umock_c_negative_tests_fail_call(4);
+    umock_c_negative_tests_fail_call(3);
     JavaModuleHost_Receive(module, message);
 
     //Assert
@@ -2480,12 +2457,9 @@ TEST_FUNCTION(JavaModuleHost_Receive_SetByteArrayRegion_failure)
     result = umock_c_negative_tests_init();
     ASSERT_ARE_EQUAL(int, 0, result);
 
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_GetSerialization(message, GATEWAY_MESSAGE_VERSION_1));
+    STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
     STRICT_EXPECTED_CALL(AttachCurrentThread(global_vm, IGNORED_PTR_ARG, NULL))
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(NewByteArray(global_env, IGNORED_NUM_ARG))
@@ -2501,13 +2475,13 @@ TEST_FUNCTION(JavaModuleHost_Receive_SetByteArrayRegion_failure)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(DetachCurrentThread(global_vm));
 
-    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
     umock_c_negative_tests_snapshot();
 
     //Act
-    umock_c_negative_tests_fail_call(6);
+    umock_c_negative_tests_fail_call(5);
     JavaModuleHost_Receive(module, message);
 
     //Assert
@@ -2540,12 +2514,9 @@ TEST_FUNCTION(JavaModuleHost_Receive_GetObjectClass_failure)
     result = umock_c_negative_tests_init();
     ASSERT_ARE_EQUAL(int, 0, result);
 
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_GetSerialization(message, GATEWAY_MESSAGE_VERSION_1));
+    STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
     STRICT_EXPECTED_CALL(AttachCurrentThread(global_vm, IGNORED_PTR_ARG, NULL))
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(NewByteArray(global_env, IGNORED_NUM_ARG))
@@ -2561,13 +2532,13 @@ TEST_FUNCTION(JavaModuleHost_Receive_GetObjectClass_failure)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(DetachCurrentThread(global_vm));
 
-    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
     umock_c_negative_tests_snapshot();
 
     //Act
-    umock_c_negative_tests_fail_call(7);
+    umock_c_negative_tests_fail_call(6);
     JavaModuleHost_Receive(module, message);
 
     //Assert
@@ -2600,12 +2571,9 @@ TEST_FUNCTION(JavaModuleHost_Receive_GetMethodID_failure)
     result = umock_c_negative_tests_init();
     ASSERT_ARE_EQUAL(int, 0, result);
 
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_GetSerialization(message, GATEWAY_MESSAGE_VERSION_1));
+    STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
     STRICT_EXPECTED_CALL(AttachCurrentThread(global_vm, IGNORED_PTR_ARG, NULL))
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(NewByteArray(global_env, IGNORED_NUM_ARG))
@@ -2626,13 +2594,13 @@ TEST_FUNCTION(JavaModuleHost_Receive_GetMethodID_failure)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(DetachCurrentThread(global_vm));
 
-    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
     umock_c_negative_tests_snapshot();
 
     //Act
-    umock_c_negative_tests_fail_call(8);
+    umock_c_negative_tests_fail_call(7);
     JavaModuleHost_Receive(module, message);
 
     //Assert
@@ -2665,12 +2633,9 @@ TEST_FUNCTION(JavaModuleHost_Receive_CallVoidMethod_failure)
     result = umock_c_negative_tests_init();
     ASSERT_ARE_EQUAL(int, 0, result);
 
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_GetSerialization(message, GATEWAY_MESSAGE_VERSION_1));
+    STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(Message_ToByteArray(message, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
     STRICT_EXPECTED_CALL(AttachCurrentThread(global_vm, IGNORED_PTR_ARG, NULL))
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(NewByteArray(global_env, IGNORED_NUM_ARG))
@@ -2696,13 +2661,13 @@ TEST_FUNCTION(JavaModuleHost_Receive_CallVoidMethod_failure)
         .IgnoreArgument(2);
     STRICT_EXPECTED_CALL(DetachCurrentThread(global_vm));
 
-    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
 
     umock_c_negative_tests_snapshot();
 
     //Act
-    umock_c_negative_tests_fail_call(11);
+    umock_c_negative_tests_fail_call(10);
     JavaModuleHost_Receive(module, message);
 
     //Assert
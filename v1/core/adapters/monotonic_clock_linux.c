@@ -0,0 +1,25 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <time.h>
+
+#include "monotonic_clock.h"
+
+/*Codes_SRS_MONOTONIC_CLOCK_30_001: [ MonotonicClock_GetMicroseconds shall return the time, in microseconds, of a clock that never goes back, read with the OS system call for a monotonic clock. ]*/
+uint64_t MonotonicClock_GetMicroseconds(void)
+{
+    struct timespec now;
+    uint64_t result;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+    {
+        /*Codes_SRS_MONOTONIC_CLOCK_30_002: [ If the OS system call fails, MonotonicClock_GetMicroseconds shall return 0. ]*/
+        result = 0;
+    }
+    else
+    {
+        result = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+    }
+
+    return result;
+}
@@ -0,0 +1,29 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <windows.h>
+
+#include "monotonic_clock.h"
+
+/*Codes_SRS_MONOTONIC_CLOCK_30_001: [ MonotonicClock_GetMicroseconds shall return the time, in microseconds, of a clock that never goes back, read with the OS system call for a monotonic clock. ]*/
+uint64_t MonotonicClock_GetMicroseconds(void)
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+    uint64_t result;
+
+    if (!QueryPerformanceFrequency(&frequency) || !QueryPerformanceCounter(&now) || frequency.QuadPart == 0)
+    {
+        /*Codes_SRS_MONOTONIC_CLOCK_30_002: [ If the OS system call fails, MonotonicClock_GetMicroseconds shall return 0. ]*/
+        result = 0;
+    }
+    else
+    {
+        /*whole seconds first, so that the multiplication does not overflow*/
+        uint64_t ticks = (uint64_t)now.QuadPart;
+        uint64_t ticks_per_second = (uint64_t)frequency.QuadPart;
+        result = (ticks / ticks_per_second) * 1000000 + ((ticks % ticks_per_second) * 1000000) / ticks_per_second;
+    }
+
+    return result;
+}
@@ -0,0 +1,16 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <windows.h>
+
+#include "processor_count.h"
+
+/*Codes_SRS_PROCESSOR_COUNT_30_001: [ ProcessorCount_Get shall make the OS system call that returns the number of processors online. ]*/
+size_t ProcessorCount_Get(void)
+{
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+
+    /*Codes_SRS_PROCESSOR_COUNT_30_002: [ If the OS system call fails, ProcessorCount_Get shall return 1. ]*/
+    return (system_info.dwNumberOfProcessors < 1) ? 1 : (size_t)system_info.dwNumberOfProcessors;
+}
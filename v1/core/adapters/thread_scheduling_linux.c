@@ -0,0 +1,122 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "azure_c_shared_utility/xlogging.h"
+#include "thread_scheduling.h"
+
+static int apply_cpu_affinity(uint64_t cpu_affinity)
+{
+    int result;
+#ifdef __linux__
+    cpu_set_t cpus;
+    size_t cpu;
+
+    CPU_ZERO(&cpus);
+    for (cpu = 0; cpu < THREAD_SCHEDULING_MAX_CPUS; cpu++)
+    {
+        if ((cpu_affinity & ((uint64_t)1 << cpu)) != 0)
+        {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+    {
+        LogError("pthread_setaffinity_np failed for mask 0x%llx", (unsigned long long)cpu_affinity);
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+#else
+    (void)cpu_affinity;
+    LogError("CPU affinity is not supported on this platform");
+    result = __LINE__;
+#endif
+    return result;
+}
+
+static int apply_nice(int nice)
+{
+    int result;
+#ifdef __linux__
+    /*on Linux the nice value belongs to the thread, not to the process*/
+    if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) != 0)
+    {
+        LogError("setpriority failed for nice value %d", nice);
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+#else
+    (void)nice;
+    LogError("a nice value per thread is not supported on this platform");
+    result = __LINE__;
+#endif
+    return result;
+}
+
+static int apply_fifo_priority(int fifo_priority)
+{
+    int result;
+    struct sched_param param;
+
+    param.sched_priority = fifo_priority;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+    {
+        LogError("pthread_setschedparam failed for SCHED_FIFO priority %d", fifo_priority);
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+/*Codes_SRS_THREAD_SCHEDULING_30_001: [ ThreadScheduling_Apply shall apply each non-zero setting of config to the calling thread. ]*/
+int ThreadScheduling_Apply(const THREAD_SCHEDULING_CONFIG* config)
+{
+    int result;
+
+    /*Codes_SRS_THREAD_SCHEDULING_30_002: [ If config is NULL, ThreadScheduling_Apply shall fail and return a non-zero value. ]*/
+    if (config == NULL)
+    {
+        LogError("config is NULL");
+        result = __LINE__;
+    }
+    else
+    {
+        /*Codes_SRS_THREAD_SCHEDULING_30_003: [ ThreadScheduling_Apply shall attempt every setting even if an earlier one fails, and return a non-zero value if any of them failed. ]*/
+        result = 0;
+        if (config->cpu_affinity != 0 && apply_cpu_affinity(config->cpu_affinity) != 0)
+        {
+            result = __LINE__;
+        }
+        if (config->nice != 0 && apply_nice(config->nice) != 0)
+        {
+            result = __LINE__;
+        }
+        if (config->fifo_priority != 0 && apply_fifo_priority(config->fifo_priority) != 0)
+        {
+            result = __LINE__;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,79 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <windows.h>
+
+#include "azure_c_shared_utility/xlogging.h"
+#include "thread_scheduling.h"
+
+/*Windows has priority levels rather than nice values; the nice range is
+split evenly over the levels below and above normal*/
+static int thread_priority_from_nice(int nice)
+{
+    int result;
+    if (nice <= -14)
+    {
+        result = THREAD_PRIORITY_HIGHEST;
+    }
+    else if (nice <= -7)
+    {
+        result = THREAD_PRIORITY_ABOVE_NORMAL;
+    }
+    else if (nice < 7)
+    {
+        result = THREAD_PRIORITY_NORMAL;
+    }
+    else if (nice < 14)
+    {
+        result = THREAD_PRIORITY_BELOW_NORMAL;
+    }
+    else
+    {
+        result = THREAD_PRIORITY_LOWEST;
+    }
+    return result;
+}
+
+/*Codes_SRS_THREAD_SCHEDULING_30_001: [ ThreadScheduling_Apply shall apply each non-zero setting of config to the calling thread. ]*/
+int ThreadScheduling_Apply(const THREAD_SCHEDULING_CONFIG* config)
+{
+    int result;
+
+    /*Codes_SRS_THREAD_SCHEDULING_30_002: [ If config is NULL, ThreadScheduling_Apply shall fail and return a non-zero value. ]*/
+    if (config == NULL)
+    {
+        LogError("config is NULL");
+        result = __LINE__;
+    }
+    else
+    {
+        /*Codes_SRS_THREAD_SCHEDULING_30_003: [ ThreadScheduling_Apply shall attempt every setting even if an earlier one fails, and return a non-zero value if any of them failed. ]*/
+        result = 0;
+        if (config->cpu_affinity != 0 &&
+            SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)config->cpu_affinity) == 0)
+        {
+            LogError("SetThreadAffinityMask failed for mask 0x%llx", (unsigned long long)config->cpu_affinity);
+            result = __LINE__;
+        }
+
+        /*a real-time priority takes precedence over the nice value, as SCHED_FIFO does*/
+        if (config->fifo_priority != 0)
+        {
+            if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+            {
+                LogError("SetThreadPriority failed for real-time priority %d", config->fifo_priority);
+                result = __LINE__;
+            }
+        }
+        else if (config->nice != 0)
+        {
+            if (!SetThreadPriority(GetCurrentThread(), thread_priority_from_nice(config->nice)))
+            {
+                LogError("SetThreadPriority failed for nice value %d", config->nice);
+                result = __LINE__;
+            }
+        }
+    }
+
+    return result;
+}
@@ -20,16 +20,29 @@ typedef struct BROKER_HANDLE_DATA_TAG* BROKER_HANDLE;
 #include "azure_c_shared_utility/macro_utils.h"
 #include "message.h"
 #include "module.h"
+#include "thread_scheduling.h"
 #include "gateway_export.h"
 
 #ifdef __cplusplus
 #include <cstddef>
+#include <cstdint>
 extern "C"
 {
 #else
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
 #endif
 
+/** @brief    The number of priorities a link can have, see #BROKER_LINK_OPTIONS. 
+*/
+#define BROKER_LINK_PRIORITIES 4
+
+/** @brief    The largest number of property names in the coalesce key of a
+*            link.
+*/
+#define BROKER_COALESCE_MAX_NAMES 8
+
 /** @brief    Link Data with #MODULE_HANDLE for source and sink. 
 */
 typedef struct BROKER_LINK_DATA_TAG {
@@ -41,6 +54,37 @@ typedef struct BROKER_LINK_DATA_TAG {
     MODULE_HANDLE module_sink_handle;
 } BROKER_LINK_DATA;
 
+/** @brief    Options of a link that #BROKER_LINK_DATA does not carry, given
+*            to ::Broker_AddLinkWithOptions. A zero initialized
+*            #BROKER_LINK_OPTIONS describes the link ::Broker_AddLink adds.
+*/
+typedef struct BROKER_LINK_OPTIONS_TAG {
+    /** @brief    Filter on the properties of the messages that travel the
+    *             link, or NULL for every message. The broker only delivers
+    *             the messages the filter matches, for example
+    *             @c "deviceFunction == 'register' && exists(macAddress)".
+    *             The filter is compiled once, when the link is added; see
+    *             link_filter_requirements.md for its syntax.
+    */
+    const char* filter;
+    /** @brief    Priority of the messages that travel the link, from 0 (the
+    *             default, lowest) to #BROKER_LINK_PRIORITIES - 1. The sink
+    *             receives the messages of higher priority links first.
+    */
+    size_t priority;
+    /** @brief    Comma separated names of the message properties that tell
+    *             apart the state streams traveling the link, for example
+    *             @c "macAddress,characteristicUUID", or NULL. When set, a
+    *             message published on the link takes the place of the unread
+    *             message in the sink's inbox that has the same values for all
+    *             these properties, so that a sink that falls behind only sees
+    *             the latest value of each stream. A message that lacks one of
+    *             the properties is queued as usual. At most
+    *             #BROKER_COALESCE_MAX_NAMES names.
+    */
+    const char* coalesce_key;
+} BROKER_LINK_OPTIONS;
+
 #define BROKER_RESULT_VALUES \
     BROKER_OK, \
     BROKER_ERROR, \
@@ -53,12 +97,231 @@ typedef struct BROKER_LINK_DATA_TAG {
 */
 DEFINE_ENUM(BROKER_RESULT, BROKER_RESULT_VALUES);
 
+#define BROKER_OVERFLOW_POLICY_VALUES \
+    BROKER_OVERFLOW_BLOCK_PUBLISHER, \
+    BROKER_OVERFLOW_DROP_NEWEST, \
+    BROKER_OVERFLOW_DROP_OLDEST, \
+    BROKER_OVERFLOW_COALESCE_BY_KEY
+
+/** @brief    Enumeration describing what the broker does with a message
+*            published to a module whose inbox is full.
+*/
+DEFINE_ENUM(BROKER_OVERFLOW_POLICY, BROKER_OVERFLOW_POLICY_VALUES);
+
+/** @brief    Number of messages a module's inbox holds when no capacity is
+*            specified.
+*/
+#define BROKER_DEFAULT_INBOX_CAPACITY 1024
+
+/** @brief    Number of deliveries in a row that must take longer than the
+*            inbox's @c slow_receive_threshold for the module to be marked
+*            slow, and shorter for it to recover.
+*/
+#define BROKER_SLOW_DELIVERIES 3
+
+/** @brief    Function called when a module is marked slow or recovers, see
+*            #BROKER_INBOX_CONFIG.
+*
+*   @details  The function is called on the thread that delivered the
+*             module's messages, without any lock of the broker held. It
+*             must not add or remove modules or links.
+*/
+typedef void(*BROKER_MODULE_HEALTH_CALLBACK)(void* context, MODULE_HANDLE module, bool slow);
+
+/** @brief    Configuration of the inbox in which the broker queues the
+*            messages published to a module.
+*
+*   @details  A zero initialized #BROKER_INBOX_CONFIG describes the default
+*             inbox: #BROKER_DEFAULT_INBOX_CAPACITY messages and
+*             #BROKER_OVERFLOW_BLOCK_PUBLISHER.
+*/
+typedef struct BROKER_INBOX_CONFIG_TAG
+{
+    /** @brief    Maximum number of messages waiting to be delivered to the
+    *            module, or 0 for #BROKER_DEFAULT_INBOX_CAPACITY.
+    */
+    size_t capacity;
+
+    /** @brief    What to do with a message published while the inbox is full:
+    *            - #BROKER_OVERFLOW_BLOCK_PUBLISHER waits until the module has
+    *              taken a message out of the inbox.
+    *            - #BROKER_OVERFLOW_DROP_NEWEST drops the published message.
+    *            - #BROKER_OVERFLOW_DROP_OLDEST drops the oldest message queued
+    *              by the lowest priority links.
+    *            - #BROKER_OVERFLOW_COALESCE_BY_KEY replaces the message queued
+    *              by a link of the same priority whose @c coalesce_key
+    *              property has the same value as the published message, or
+    *              drops the published message if there is none.
+    */
+    BROKER_OVERFLOW_POLICY overflow_policy;
+
+    /** @brief    Name of the message property compared by
+    *            #BROKER_OVERFLOW_COALESCE_BY_KEY, ignored by the other policies.
+    */
+    const char* coalesce_key;
+
+    /** @brief    Deliver the module's messages on a thread of its own even when
+    *            the broker runs its modules on a worker pool. Modules that
+    *            block in their receive function should set this so that they
+    *            do not hold up a pool worker.
+    */
+    bool dedicated_thread;
+
+    /** @brief    CPU affinity and scheduling of the thread that delivers the
+    *            module's messages. A zero initialized value leaves the thread
+    *            as the broker's default; any other value gives the module a
+    *            thread of its own, as @c dedicated_thread does.
+    */
+    THREAD_SCHEDULING_CONFIG thread_scheduling;
+
+    /** @brief    Deliver a message published while the inbox is empty on the
+    *            publisher's thread, calling the module's receive function from
+    *            ::Broker_Publish instead of waking the module's thread. Meant
+    *            for modules whose receive function is short and does not
+    *            block, since the publisher waits for it to return. A message
+    *            that finds the module busy, or that is published from too deep
+    *            a chain of inline deliveries, is queued as usual.
+    */
+    bool inline_delivery;
+
+    /** @brief    Time in microseconds the module's receive function may take
+    *            per message before the module is considered slow, or 0 to
+    *            never consider it slow. A module that takes longer for
+    *            #BROKER_SLOW_DELIVERIES deliveries in a row is marked slow:
+    *            while it is, a full inbox drops its oldest message rather
+    *            than blocking the publisher and no message is delivered to
+    *            it inline. It recovers after as many deliveries in a row that
+    *            take less.
+    */
+    uint64_t slow_receive_threshold;
+
+    /** @brief    Called when the module is marked slow or recovers (optional,
+    *            may be NULL).
+    */
+    BROKER_MODULE_HEALTH_CALLBACK on_health_changed;
+
+    /** @brief    The @c context given to @c on_health_changed. */
+    void* health_context;
+} BROKER_INBOX_CONFIG;
+
+/** @brief    Configuration of the worker pool of a message broker.
+*
+*   @details  A broker with a worker pool delivers messages to its modules
+*             on a fixed number of threads rather than on one thread per
+*             module. A module's messages are still delivered one at a time.
+*/
+typedef struct BROKER_SCHEDULER_CONFIG_TAG
+{
+    /** @brief    Number of worker threads, or 0 for one per processor core. */
+    size_t worker_count;
+
+    /** @brief    CPU affinity and scheduling of the worker threads, also used
+    *            for the threads of modules that run on a thread of their own
+    *            without their own @c thread_scheduling.
+    */
+    THREAD_SCHEDULING_CONFIG thread_scheduling;
+} BROKER_SCHEDULER_CONFIG;
+
+/** @brief    The number of buckets of the histogram of the time a module
+*            takes to receive its messages, see #BROKER_MODULE_STATISTICS.
+*/
+#define BROKER_LATENCY_BUCKETS 16
+
+/** @brief    Counters the broker keeps for a module.
+*
+*   @details  The counters start at zero when the module is added to the
+*             broker. They are updated under the lock of the module's inbox,
+*             which publishing and delivering a message take anyway.
+*/
+typedef struct BROKER_MODULE_STATISTICS_TAG
+{
+    /** @brief    Messages published to the module, including the dropped ones. */
+    uint64_t messages_in;
+
+    /** @brief    Content bytes of the messages published to the module. */
+    uint64_t bytes_in;
+
+    /** @brief    Messages taken out of the inbox and handed to the module. */
+    uint64_t messages_out;
+
+    /** @brief    Messages dropped or replaced because the inbox was full. */
+    uint64_t drops;
+
+    /** @brief    Messages taken out of the inbox after their time to live had
+    *            passed, and destroyed instead of being handed to the module,
+    *            and the expired messages the module reported it dropped with
+    *            #Broker_ReportExpired. They are also counted in
+    *            @c messages_out.
+    */
+    uint64_t expired;
+
+    /** @brief    Messages waiting in the inbox. */
+    size_t queue_depth;
+
+    /** @brief    The largest number of messages that ever waited in the inbox. */
+    size_t max_queue_depth;
+
+    /** @brief    Histogram of the time the module's receive function took, per
+    *            call. Bucket 0 counts calls that took under a microsecond,
+    *            bucket @c i calls that took from 2^(i-1) to under 2^i
+    *            microseconds, and the last bucket every longer call.
+    */
+    uint64_t receive_latency[BROKER_LATENCY_BUCKETS];
+
+    /** @brief    Whether the module is currently marked slow, see
+    *            #BROKER_INBOX_CONFIG::slow_receive_threshold.
+    */
+    bool slow;
+} BROKER_MODULE_STATISTICS;
+
+/** @brief    Counters the broker keeps for the messages that travel from a
+*            source to a sink.
+*
+*   @details  The counters of a link are kept by its sink; they survive the
+*             removal of the link for as long as the sink is attached.
+*/
+typedef struct BROKER_LINK_STATISTICS_TAG
+{
+    /** @brief    Messages published to the sink on the link, including the
+    *            dropped ones.
+    */
+    uint64_t messages_in;
+
+    /** @brief    Content bytes of the messages published on the link. */
+    uint64_t bytes_in;
+
+    /** @brief    Messages published on the link while the sink's inbox was
+    *            full.
+    */
+    uint64_t overflows;
+
+    /** @brief    Messages published on the link that replaced an unread message
+    *            of the same coalesce key in the sink's inbox.
+    */
+    uint64_t coalesced;
+} BROKER_LINK_STATISTICS;
+
 /** @brief        Creates a new message broker.
 *   
 *    @return        A valid #BROKER_HANDLE upon success, or @c NULL upon failure.
 */
 GATEWAY_EXPORT BROKER_HANDLE Broker_Create(void);
 
+/** @brief        Creates a new message broker that delivers messages to its
+*                modules on a worker pool.
+*
+*    @details    Modules added with an inbox whose @c dedicated_thread or
+*                @c thread_scheduling is set still get a thread of their own.
+*
+*    @param        scheduler    The #BROKER_SCHEDULER_CONFIG of the worker pool
+*                            (optional, may be NULL for a broker that gives
+*                            every module a thread of its own, like
+*                            ::Broker_Create).
+*
+*    @return        A valid #BROKER_HANDLE upon success, or @c NULL upon failure.
+*/
+GATEWAY_EXPORT BROKER_HANDLE Broker_CreateWithScheduler(const BROKER_SCHEDULER_CONFIG* scheduler);
+
 /** @brief        Increments the reference count of a message broker.
 *
 *    @details    This function will simply increment the internal reference
@@ -96,6 +359,25 @@ GATEWAY_EXPORT void Broker_DecRef(BROKER_HANDLE broker);
 */
 GATEWAY_EXPORT BROKER_RESULT Broker_Publish(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE_HANDLE message);
 
+/** @brief        Publishes a batch of messages to the message broker.
+*
+*    @details    The broker routes the whole batch with one lookup of the
+*                links of @c source and queues it on each sink with one
+*                lock acquisition and one wakeup. Each sink receives the
+*                messages in the order of @p messages.
+*
+*    @param        broker    The #BROKER_HANDLE onto which the messages will be
+*                        published.
+*    @param        source    The #MODULE_HANDLE from which the messages will be
+*                        published.
+*    @param        messages  The #MESSAGE_HANDLE array of the messages to be
+*                        published. The caller keeps ownership of the messages.
+*    @param        count     The number of messages in @p messages.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_PublishBatch(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE_HANDLE* messages, size_t count);
+
 /** @brief        Adds a module to the message broker.
 *
 *    @details    For details about threading with regard to the message broker
@@ -111,6 +393,91 @@ GATEWAY_EXPORT BROKER_RESULT Broker_Publish(BROKER_HANDLE broker, MODULE_HANDLE
 */
 GATEWAY_EXPORT BROKER_RESULT Broker_AddModule(BROKER_HANDLE broker, const MODULE* module);
 
+/** @brief        Adds a module to the message broker with a configured inbox.
+*
+*    @details    Same as ::Broker_AddModule, except that the messages published
+*                to the module are queued in an inbox described by @p inbox
+*                rather than in the default inbox.
+*
+*    @param        broker          The #BROKER_HANDLE onto which the module will be
+*                                added.
+*    @param        module            The #MODULE for the module that will be added
+*                                to this message broker.
+*    @param        inbox            The #BROKER_INBOX_CONFIG of the module's inbox
+*                                (optional, may be NULL for the default inbox).
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_AddModuleWithInbox(BROKER_HANDLE broker, const MODULE* module, const BROKER_INBOX_CONFIG* inbox);
+
+/** @brief        Gets the number of messages published to a module that were
+*                dropped because the module's inbox was full.
+*
+*    @param        broker        The #BROKER_HANDLE to which the module is attached.
+*    @param        module        The #MODULE of the module.
+*    @param        drop_count    Receives the number of dropped messages.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_GetModuleDropCount(BROKER_HANDLE broker, const MODULE* module, size_t* drop_count);
+
+/** @brief        Gets a snapshot of the counters the broker keeps for a module.
+*
+*    @param        broker        The #BROKER_HANDLE to which the module is attached.
+*    @param        module        The #MODULE of the module.
+*    @param        statistics    Receives the #BROKER_MODULE_STATISTICS of the
+*                              module.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_GetStatistics(BROKER_HANDLE broker, const MODULE* module, BROKER_MODULE_STATISTICS* statistics);
+
+/** @brief        Counts messages a module dropped after the broker had handed
+*                them to it, because their time to live had passed.
+*
+*    @details      They are added to the @c expired counter of the module's
+*                  #BROKER_MODULE_STATISTICS, so that a module that queues the
+*                  messages it receives, such as the out of process module,
+*                  reports the expired messages it drops where the broker
+*                  reports its own.
+*
+*    @param        broker        The #BROKER_HANDLE to which the module is attached.
+*    @param        module        The #MODULE_HANDLE of the module.
+*    @param        count         The number of expired messages dropped.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_ReportExpired(BROKER_HANDLE broker, MODULE_HANDLE module, size_t count);
+
+/** @brief        Gets a snapshot of the counters the broker keeps for a link.
+*
+*    @param        broker        The #BROKER_HANDLE to which the link was added.
+*    @param        link          The #BROKER_LINK_DATA of the link.
+*    @param        statistics    Receives the #BROKER_LINK_STATISTICS of the link.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_GetLinkStatistics(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, BROKER_LINK_STATISTICS* statistics);
+
+/** @brief        Gets how many more messages a module can publish before one
+*                of the inboxes it publishes to is full.
+*
+*    @details    Producers that poll a device or a timer can use it to slow
+*                down, or to coalesce their readings, while the modules they
+*                publish to fall behind, rather than have ::Broker_Publish
+*                block or drop. The credit is a snapshot: it does not reserve
+*                room in the inboxes, and it ignores the link filters.
+*
+*    @param        broker    The #BROKER_HANDLE to which the module is attached.
+*    @param        source    The #MODULE_HANDLE of the publishing module.
+*    @param        credit    Receives the smallest number of free places among
+*                          the inboxes of the modules linked from @p source,
+*                          or @c SIZE_MAX if no module is.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_GetPublishCredit(BROKER_HANDLE broker, MODULE_HANDLE source, size_t* credit);
+
 /** @brief        Removes a module from the message broker.
 *   
 *    @param        broker    The #BROKER_HANDLE from which the module will be removed.
@@ -135,6 +502,20 @@ GATEWAY_EXPORT BROKER_RESULT Broker_RemoveModule(BROKER_HANDLE broker, const MOD
 */
 GATEWAY_EXPORT BROKER_RESULT Broker_AddLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link);
 
+/** @brief        Adds a route with options to the message broker.
+*
+*    @param        broker          The #BROKER_HANDLE onto which the module will be
+*                                added.
+*    @param        link            The #BROKER_LINK_DATA for the link that will be added
+*                                to this message broker.
+*    @param        options         The (possibly @c NULL) #BROKER_LINK_OPTIONS of the
+*                                link; when @c NULL the link is added as
+*                                ::Broker_AddLink adds it.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_AddLinkWithOptions(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, const BROKER_LINK_OPTIONS* options);
+
 /** @brief        Removes a route from the message broker.
 *
 *    @param        broker    The #BROKER_HANDLE from which the link will be removed.
@@ -144,6 +525,23 @@ GATEWAY_EXPORT BROKER_RESULT Broker_AddLink(BROKER_HANDLE broker, const BROKER_L
 */
 GATEWAY_EXPORT BROKER_RESULT Broker_RemoveLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link);
 
+/** @brief        Removes a route added with options from the message broker.
+*
+*    @details    Where ::Broker_RemoveLink removes any of the links between the
+*                source and the sink, this function only removes one that has
+*                the filter of @p options, so that a source linked to a sink
+*                more than once keeps the links it was not asked to remove.
+*
+*    @param        broker    The #BROKER_HANDLE from which the link will be removed.
+*    @param        link      The #BROKER_LINK_DATA of the link to be removed.
+*    @param        options   The (possibly @c NULL) #BROKER_LINK_OPTIONS the link
+*                          was added with; when @c NULL the link is removed as
+*                          ::Broker_RemoveLink removes it.
+*
+*    @return        A #BROKER_RESULT describing the result of the function.
+*/
+GATEWAY_EXPORT BROKER_RESULT Broker_RemoveLinkWithOptions(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, const BROKER_LINK_OPTIONS* options);
+
 /** @brief      Disposes of resources allocated by a message broker.
 *
 *    @param      broker  The #BROKER_HANDLE to be destroyed.
@@ -9,6 +9,7 @@
 #define EVENT_SYSTEM_H
 
 #include "gateway.h"
+#include "broker.h"
 #include "gateway_export.h"
 
 #ifdef __cplusplus
@@ -32,6 +33,18 @@ typedef struct GATEWAY_MODULE_INFO_TAG
     VECTOR_HANDLE module_sources;
 } GATEWAY_MODULE_INFO;
 
+/** @brief      Struct representing the broker statistics of a single module */
+typedef struct GATEWAY_MODULE_STATISTICS_TAG
+{
+    /** @brief  The name of the module */
+    const char* module_name;
+
+    /** @brief  The counters of the module, as returned by
+     *          #Broker_GetStatistics
+     */
+    BROKER_MODULE_STATISTICS statistics;
+} GATEWAY_MODULE_STATISTICS;
+
 /** @brief      Enum representing different gateway events that have support
  *              for callbacks.
  */
@@ -52,6 +65,21 @@ typedef enum GATEWAY_EVENT_TAG
     /** @brief  Called when the gateway is destroyed. */
     GATEWAY_DESTROYED,
 
+    /** @brief  Called every time #Gateway_ReportStatistics is called.
+     *
+     *  The VECTOR_HANDLE from #Gateway_GetStatistics will be provided as the
+     *  context to the callback, and be later cleaned-up automatically.
+     */
+    GATEWAY_STATISTICS_REPORTED,
+    /** @brief  Called every time the broker marks a module slow, because its
+     *          receive function takes longer than the
+     *          @c slow_receive_threshold of its inbox, or the module recovers.
+     *
+     *  No context is provided; the @c slow flag of the statistics returned
+     *  by #Gateway_GetStatistics tells which modules are slow.
+     */
+    GATEWAY_MODULE_HEALTH_CHANGED,
+
     /* @brief   Not an actual event, used to keep track of count of different
      *          events
      */
@@ -78,6 +106,17 @@ void EventSystem_AddEventCallback(EVENTSYSTEM_HANDLE event_system, GATEWAY_EVENT
 void EventSystem_ReportEvent(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gw, GATEWAY_EVENT event_type);
 void EventSystem_Destroy(EVENTSYSTEM_HANDLE event_system);
 
+/** @brief      Sets the CPU affinity and scheduling of the thread that calls
+ *              the registered callbacks.
+ *
+ *              It should be set before the first event is reported; the
+ *              callback thread applies it to itself each time it is started.
+ *
+ *  @param      event_system        The event system.
+ *  @param      thread_scheduling   The settings of the callback thread.
+ */
+void EventSystem_SetThreadScheduling(EVENTSYSTEM_HANDLE event_system, const THREAD_SCHEDULING_CONFIG* thread_scheduling);
+
 /** @brief      Registers a function to be called on a callback thread when_all
  *              #GATEWAY_EVENT happens
  *        
@@ -113,6 +152,36 @@ VECTOR_HANDLE Gateway_GetModuleList(GATEWAY_HANDLE gw);
  */
 void Gateway_DestroyModuleList(VECTOR_HANDLE module_list);
 
+/** @brief      Returns a snapshot copy of the broker statistics of every
+ *              module.
+ *
+ *              The vector handle should be later destroyed with
+ *              @c Gateway_DestroyStatistics. The module names it holds are
+ *              only valid while the modules are attached to the gateway.
+ *
+ *  @param      gw      Pointer to a #GATEWAY_HANDLE from which the statistics
+ *                      should be snapshoted
+ *
+ *  @return     A #VECTOR_HANDLE of #GATEWAY_MODULE_STATISTICS on success.
+ *              NULL on failure.
+ */
+VECTOR_HANDLE Gateway_GetStatistics(GATEWAY_HANDLE gw);
+
+/** @brief      Destroys the list returned by @c Gateway_GetStatistics
+ *
+ *  @param      statistics  A vector handle as returned from
+ *              @c Gateway_GetStatistics
+ */
+void Gateway_DestroyStatistics(VECTOR_HANDLE statistics);
+
+/** @brief      Reports a #GATEWAY_STATISTICS_REPORTED event, typically
+ *              called periodically by the host of the gateway
+ *
+ *  @param      gw      Pointer to a #GATEWAY_HANDLE whose statistics should
+ *                      be reported
+ */
+void Gateway_ReportStatistics(GATEWAY_HANDLE gw);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -27,6 +27,7 @@ extern "C"
 
 #define GATEWAY_CONNECTION_ID_MAX           NN_SOCKADDR_MAX
 #define GATEWAY_MESSAGE_VERSION_1           0x01
+#define GATEWAY_MESSAGE_VERSION_2           0x02
 #define GATEWAY_MESSAGE_VERSION_CURRENT     GATEWAY_MESSAGE_VERSION_1
 
 #define GATEWAY_ADD_LINK_RESULT_VALUES \
@@ -112,6 +113,28 @@ typedef struct GATEWAY_PROPERTIES_DATA_TAG
     VECTOR_HANDLE gateway_links;
 } GATEWAY_PROPERTIES;
 
+/** @brief      Struct representing the optional settings of a gateway that
+ *              are not part of #GATEWAY_PROPERTIES; a zero-initialized struct
+ *              gives the same gateway as ::Gateway_Create.
+ */
+typedef struct GATEWAY_OPTIONS_TAG
+{
+    /** @brief  The (possibly @c NULL) worker pool configuration of the
+     *          gateway's broker; when @c NULL every module gets a thread of
+     *          its own
+     */
+    const BROKER_SCHEDULER_CONFIG* broker_scheduler;
+
+    /** @brief  The (possibly @c NULL) default CPU affinity and scheduling of
+     *          the threads the broker creates for the gateway's modules; it
+     *          replaces the @c thread_scheduling of @c broker_scheduler, or
+     *          when there is no worker pool, is used by every module whose
+     *          inbox does not set a @c thread_scheduling of its own. It is
+     *          also applied to the thread that calls the event callbacks.
+     */
+    const THREAD_SCHEDULING_CONFIG* thread_scheduling;
+} GATEWAY_OPTIONS;
+
 /** @brief      Creates a gateway using a JSON configuration file as input
  *              which describes each module. Each module described in the
  *              configuration must support Module_CreateFromJson.
@@ -122,6 +145,9 @@ typedef struct GATEWAY_PROPERTIES_DATA_TAG
  *              Sample JSON configuration file:
  *
  *              {
+ *                  "scheduler": {
+ *                      "workers": 4
+ *                  },
  *                  "modules" :
  *                  [
  *                      {
@@ -147,6 +173,11 @@ typedef struct GATEWAY_PROPERTIES_DATA_TAG
                             },
                             "args": {
                                 "filename": "/var/logs/gateway-log.json"
+                            },
+                            "inbox": {
+                                "capacity": 256,
+                                "overflow": "drop-oldest",
+                                "dedicated.thread": true
                             }
                         }
  *                  ],
@@ -159,6 +190,24 @@ typedef struct GATEWAY_PROPERTIES_DATA_TAG
  *                  ]
  *              }
  *
+ *              The optional "inbox" object bounds the queue of messages
+ *              waiting to be delivered to a module. "overflow" is one of
+ *              "block-publisher" (the default), "drop-newest",
+ *              "drop-oldest" or "coalesce-by-key"; the last one also needs
+ *              "coalesce.key", the name of the message property whose
+ *              value identifies the messages that replace each other.
+ *              "slow.threshold" is the time in milliseconds the module may
+ *              take per message before it is considered slow: while it is,
+ *              its full inbox drops its oldest message instead of blocking
+ *              the publishers, until it recovers. The gateway reports each
+ *              change with a #GATEWAY_MODULE_HEALTH_CHANGED event.
+ *
+ *              The optional "scheduler" object runs the modules on a pool
+ *              of "workers" threads (one per processor core if "workers" is
+ *              missing) instead of on a thread per module. A module whose
+ *              "inbox" sets "dedicated.thread" still gets a thread of its
+ *              own, which modules that block while receiving should use.
+ *
  * @return      A non-NULL #GATEWAY_HANDLE that can be used to manage the
  *              gateway or @c NULL on failure.
  */
@@ -187,6 +236,20 @@ GATEWAY_EXPORT GATEWAY_UPDATE_FROM_JSON_RESULT Gateway_UpdateFromJson(GATEWAY_HA
  */
 GATEWAY_EXPORT GATEWAY_HANDLE Gateway_Create(const GATEWAY_PROPERTIES* properties);
 
+/** @brief      Creates a new gateway using the provided #GATEWAY_PROPERTIES
+ *              and #GATEWAY_OPTIONS.
+ *
+ *  @param      properties      #GATEWAY_PROPERTIES structure containing
+ *                              specific module properties and information.
+ *  @param      options         The (possibly @c NULL) #GATEWAY_OPTIONS of
+ *                              the gateway; when @c NULL the gateway is
+ *                              created as with ::Gateway_Create.
+ *
+ *  @return     A non-NULL #GATEWAY_HANDLE that can be used to manage the
+ *              gateway or @c NULL on failure.
+ */
+GATEWAY_EXPORT GATEWAY_HANDLE Gateway_CreateWithOptions(const GATEWAY_PROPERTIES* properties, const GATEWAY_OPTIONS* options);
+
 /** @brief      Tell the Gateway it's ready to start.
  *
  *  @param      gw      #GATEWAY_HANDLE to be destroyed.
@@ -212,6 +275,21 @@ GATEWAY_EXPORT void Gateway_Destroy(GATEWAY_HANDLE gw);
  */
 GATEWAY_EXPORT MODULE_HANDLE Gateway_AddModule(GATEWAY_HANDLE gw, const GATEWAY_MODULES_ENTRY* entry);
 
+/** @brief      Creates a new module based on the GATEWAY_MODULES_ENTRY* and
+ *              attaches it to the broker with the given inbox.
+ *
+ *  @param      gw      Pointer to a #GATEWAY_HANDLE to add the Module onto.
+ *  @param      entry   Pointer to a #GATEWAY_MODULES_ENTRY structure
+ *                      describing the module.
+ *  @param      inbox   The (possibly @c NULL) inbox configuration for the
+ *                      module; when @c NULL the module gets the broker's
+ *                      default inbox, as with ::Gateway_AddModule.
+ *
+ *  @return     A non-NULL #MODULE_HANDLE to the newly created and added
+ *              Module, or @c NULL on failure.
+ */
+GATEWAY_EXPORT MODULE_HANDLE Gateway_AddModuleWithInbox(GATEWAY_HANDLE gw, const GATEWAY_MODULES_ENTRY* entry, const BROKER_INBOX_CONFIG* inbox);
+
 /** @brief      Tells a module that the gateway is ready for it to start.
  *
  *  @param      gw      Pointer to a #GATEWAY_HANDLE from which to remove the
@@ -252,6 +330,21 @@ GATEWAY_EXPORT int Gateway_RemoveModuleByName(GATEWAY_HANDLE gw, const char *mod
  */
 GATEWAY_EXPORT GATEWAY_ADD_LINK_RESULT Gateway_AddLink(GATEWAY_HANDLE gw, const GATEWAY_LINK_ENTRY* entryLink);
 
+/** @brief      Adds a link with options to a gateway message broker.
+ *
+ *  @param      gw          Pointer to a #GATEWAY_HANDLE from which link is
+ *                          going to be added.
+ *
+ *  @param      entryLink   Pointer to a #GATEWAY_LINK_ENTRY to be added.
+ *
+ *  @param      options     The (possibly @c NULL) @c BROKER_LINK_OPTIONS of
+ *                          the link, which the gateway copies; when @c NULL
+ *                          the link is added as ::Gateway_AddLink adds it.
+ *
+ *  @return     A GATEWAY_ADD_LINK_RESULT with the operation result.
+ */
+GATEWAY_EXPORT GATEWAY_ADD_LINK_RESULT Gateway_AddLinkWithOptions(GATEWAY_HANDLE gw, const GATEWAY_LINK_ENTRY* entryLink, const BROKER_LINK_OPTIONS* options);
+
 /** @brief      Remove a link from a gateway message broker.
  *
  *  @param      gw          Pointer to a #GATEWAY_HANDLE from which link is
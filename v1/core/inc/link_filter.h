@@ -0,0 +1,40 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef LINK_FILTER_H
+#define LINK_FILTER_H
+
+#include "azure_c_shared_utility/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstdbool>
+extern "C"
+{
+#else
+#include <stdbool.h>
+#endif
+
+/* the deepest nesting of parentheses and negations in a filter expression */
+#define LINK_FILTER_MAX_DEPTH 16
+
+/* the largest number of comparisons and operators in a filter expression */
+#define LINK_FILTER_MAX_TERMS 64
+
+typedef struct LINK_FILTER_TAG* LINK_FILTER_HANDLE;
+
+/* returns the value of the property name of the message context, or NULL if it does not have it */
+typedef const char* (*LINK_FILTER_LOOKUP)(const void* context, const char* name);
+
+/* compiles a filter expression, see link_filter_requirements.md for its syntax */
+MOCKABLE_FUNCTION(, LINK_FILTER_HANDLE, LinkFilter_Create, const char*, expression);
+
+MOCKABLE_FUNCTION(, void, LinkFilter_Destroy, LINK_FILTER_HANDLE, filter);
+
+/* evaluates a compiled filter on the properties of a message, read with lookup */
+MOCKABLE_FUNCTION(, bool, LinkFilter_Matches, LINK_FILTER_HANDLE, filter, LINK_FILTER_LOOKUP, lookup, const void*, context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LINK_FILTER_H
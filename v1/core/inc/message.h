@@ -8,8 +8,9 @@
  *              message broker.
  *
  *  @details    A message essentially has two components:
- *              - Properties represented as key/value pairs where both the
- *                key and value are strings
+ *              - Properties represented as key/value pairs where the key is
+ *                a string and the value a string or, for the properties set
+ *                by #Message_CreateDerivedWithValues, a typed value
  *              - The content of the message which is simply a memory buffer
  *                (a @c BUFFER_HANDLE)
  *
@@ -35,13 +36,16 @@
 #ifdef __cplusplus
   #include <cstdint>
   #include <cstddef>
+  #include <cstdbool>
   extern "C" {
 #else
   #include <stdint.h>
   #include <stddef.h>
+  #include <stdbool.h>
 #endif
 
 #define GATEWAY_MESSAGE_VERSION_1           0x01
+#define GATEWAY_MESSAGE_VERSION_2           0x02
 #define GATEWAY_MESSAGE_VERSION_CURRENT     GATEWAY_MESSAGE_VERSION_1
 
 /** @brief  Struct representing a particular message. */
@@ -72,6 +76,28 @@ typedef struct MESSAGE_CONFIG_TAG
     MAP_HANDLE sourceProperties;
 }MESSAGE_CONFIG;
 
+/** @brief  Struct defining the configuration of a message that expires, see
+ *          #Message_CreateWithTimeToLive.
+ */
+typedef struct MESSAGE_TIME_TO_LIVE_CONFIG_TAG
+{
+    /** @brief  The content and properties of the message, as given to
+     *          #Message_Create.
+     */
+    MESSAGE_CONFIG messageConfig;
+
+    /** @brief  The time the data of this message was produced, in
+     *          microseconds on the clock of @c MonotonicClock_GetMicroseconds.
+     */
+    uint64_t creationTime;
+
+    /** @brief  The number of microseconds after @c creationTime at which this
+     *          message expires and is dropped instead of being delivered, or
+     *          zero if the message never expires.
+     */
+    uint64_t timeToLive;
+}MESSAGE_TIME_TO_LIVE_CONFIG;
+
 /** @brief  Struct defining the Message buffer configuration. */
 typedef struct MESSAGE_BUFFER_CONFIG_TAG
 {
@@ -87,6 +113,147 @@ typedef struct MESSAGE_BUFFER_CONFIG_TAG
     MAP_HANDLE sourceProperties;
 }MESSAGE_BUFFER_CONFIG;
 
+/** @brief  The largest number of segments the content of a message is made
+ *          of.
+ */
+#define MESSAGE_MAX_CONTENT_SEGMENTS 8
+
+/** @brief  Struct defining the configuration of a message whose content is
+ *          made of several buffers, see #Message_CreateFromSegments.
+ */
+typedef struct MESSAGE_SEGMENTS_CONFIG_TAG
+{
+    /** @brief  The buffers whose bytes, one after the other, are the content
+     *          of the message. Must not be @c NULL.
+     */
+    const CONSTBUFFER_HANDLE* segments;
+
+    /** @brief  The number of buffers in @c segments, from 1 to
+     *          #MESSAGE_MAX_CONTENT_SEGMENTS.
+     */
+    size_t segmentCount;
+
+    /** @brief  A collection of key/value pairs where both the key and value
+     *          are strings representing the properties of this message. This
+     *          field must not be @c NULL.
+     */
+    MAP_HANDLE sourceProperties;
+}MESSAGE_SEGMENTS_CONFIG;
+
+/** @brief  A property set by #Message_CreateDerived. */
+typedef struct MESSAGE_PROPERTY_TAG
+{
+    /** @brief  The name of the property. */
+    const char* key;
+
+    /** @brief  The value of the property. */
+    const char* value;
+}MESSAGE_PROPERTY;
+
+#define MESSAGE_VALUE_TYPE_VALUES \
+    MESSAGE_VALUE_STRING, \
+    MESSAGE_VALUE_INT64, \
+    MESSAGE_VALUE_DOUBLE, \
+    MESSAGE_VALUE_BOOL, \
+    MESSAGE_VALUE_BYTES, \
+    MESSAGE_VALUE_TIMESTAMP
+
+/** @brief  Enumeration specifying the type of the value of a property. */
+DEFINE_ENUM(MESSAGE_VALUE_TYPE, MESSAGE_VALUE_TYPE_VALUES);
+
+/** @brief  The value of a property, in its own type.
+ *
+ *  @details    Where a property is needed as a string, as by
+ *              #Message_GetPropertyValue, #Message_GetProperties and the
+ *              serializations, its value is converted without loss:
+ *              - #MESSAGE_VALUE_INT64 as a decimal number
+ *              - #MESSAGE_VALUE_DOUBLE with 17 significant digits
+ *              - #MESSAGE_VALUE_BOOL as @c true or @c false
+ *              - #MESSAGE_VALUE_BYTES in base64
+ *              - #MESSAGE_VALUE_TIMESTAMP in ISO 8601, in UTC with
+ *                microseconds, as in @c 2016-11-07T09:30:00.000250Z
+ */
+typedef struct MESSAGE_VALUE_TAG
+{
+    /** @brief  The type of the value, which tells the member of @c value
+     *          that holds it.
+     */
+    MESSAGE_VALUE_TYPE type;
+
+    union
+    {
+        /** @brief  A #MESSAGE_VALUE_STRING. */
+        const char* string;
+
+        /** @brief  A #MESSAGE_VALUE_INT64. */
+        int64_t integer;
+
+        /** @brief  A #MESSAGE_VALUE_DOUBLE. */
+        double real;
+
+        /** @brief  A #MESSAGE_VALUE_BOOL. */
+        bool boolean;
+
+        /** @brief  A #MESSAGE_VALUE_BYTES. */
+        struct
+        {
+            const unsigned char* buffer;
+            size_t size;
+        } bytes;
+
+        /** @brief  A #MESSAGE_VALUE_TIMESTAMP, in microseconds since
+         *          1970-01-01T00:00:00Z.
+         */
+        int64_t timestamp;
+    } value;
+}MESSAGE_VALUE;
+
+/** @brief  A property set by #Message_CreateDerivedWithValues. */
+typedef struct MESSAGE_TYPED_PROPERTY_TAG
+{
+    /** @brief  The name of the property. */
+    const char* key;
+
+    /** @brief  The value of the property. */
+    MESSAGE_VALUE value;
+}MESSAGE_TYPED_PROPERTY;
+
+/** @brief  A property key interned in the key table of the process by
+ *          #Message_InternKey. Two keys with the same name have the same
+ *          #MESSAGE_KEY, so that keys compare as integers. The keys of the
+ *          messages themselves are never interned.
+ */
+typedef uint32_t MESSAGE_KEY;
+
+/** @brief  Not a key, returned when a key cannot be interned. */
+#define MESSAGE_KEY_NONE                                ((MESSAGE_KEY)0)
+
+/** @brief  The well-known keys, interned in every process. */
+#define MESSAGE_KEY_SOURCE                              ((MESSAGE_KEY)1)
+#define MESSAGE_KEY_MAC_ADDRESS                         ((MESSAGE_KEY)2)
+#define MESSAGE_KEY_DEVICE_NAME                         ((MESSAGE_KEY)3)
+#define MESSAGE_KEY_DEVICE_KEY                          ((MESSAGE_KEY)4)
+#define MESSAGE_KEY_DEVICE_FUNCTION                     ((MESSAGE_KEY)5)
+#define MESSAGE_KEY_TIMESTAMP                           ((MESSAGE_KEY)6)
+#define MESSAGE_KEY_CHARACTERISTIC_UUID                 ((MESSAGE_KEY)7)
+#define MESSAGE_KEY_BLE_CONTROLLER_INDEX                ((MESSAGE_KEY)8)
+#define MESSAGE_KEY_IOTHUB_MESSAGE_ID                   ((MESSAGE_KEY)9)
+#define MESSAGE_KEY_IOTHUB_MESSAGE_DELIVERY_STATUS      ((MESSAGE_KEY)10)
+
+/** @brief  The largest number of keys interned besides the well-known ones. */
+#define MESSAGE_KEY_TABLE_SIZE                          4096
+
+/** @brief  The most keys of the key table a name is compared with to find or
+ *          intern it.
+ */
+#define MESSAGE_KEY_MAX_PROBES                          32
+
+/** @brief  Function releasing a byte array handed to
+ *          #Message_CreateFromByteArrayWithRelease, called with the byte array
+ *          once the message no longer needs it.
+ */
+typedef void(*MESSAGE_BUFFER_RELEASE)(void* buffer);
+
 #include "azure_c_shared_utility/umock_c_prod.h"
 
 /** @brief      Creates a new reference counted message from a #MESSAGE_CONFIG
@@ -105,6 +272,20 @@ typedef struct MESSAGE_BUFFER_CONFIG_TAG
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_Create, const MESSAGE_CONFIG *, cfg);
 
+/** @brief      Creates a new message that expires, from a
+ *              #MESSAGE_TIME_TO_LIVE_CONFIG structure.
+ *
+ *  @details    The message is created as #Message_Create creates it from
+ *              @c messageConfig, and keeps @c creationTime and @c timeToLive.
+ *              Messages made by the other constructors never expire.
+ *
+ *  @param      cfg     Pointer to a #MESSAGE_TIME_TO_LIVE_CONFIG structure.
+ *
+ *  @return     A non-NULL #MESSAGE_HANDLE for the newly created message, or
+ *              NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateWithTimeToLive, const MESSAGE_TIME_TO_LIVE_CONFIG *, cfg);
+
 /** @brief      Creates a new reference counted message from a byte array
  *              containing the serialized form of a message.
  *
@@ -119,6 +300,27 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_Create, const MESSAGE
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateFromByteArray, const unsigned char *, source, int32_t, size);
 
+/** @brief      Creates a new reference counted message from a byte array
+ *              containing the serialized form of a message, taking ownership
+ *              of the byte array.
+ *
+ *  @details    Unlike #Message_CreateFromByteArray, the content of the message
+ *              is not copied: it points into @c source, which the message
+ *              keeps until its reference count drops to zero and then hands
+ *              to @c release. This suits receive buffers, such as the ones
+ *              returned by @c nn_recv with @c NN_MSG. If this function fails,
+ *              @c source still belongs to the caller.
+ *
+ *  @param      source  Pointer to a byte array, which must not change while
+ *                      the message exists.
+ *  @param      size    size in bytes of the array
+ *  @param      release Function releasing @c source.
+ *
+ *  @return     A non-NULL #MESSAGE_HANDLE for the newly created message, or
+ *              NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateFromByteArrayWithRelease, unsigned char *, source, int32_t, size, MESSAGE_BUFFER_RELEASE, release);
+
 /** @brief      Creates a byte array representation of a MESSAGE_HANDLE. 
  *
  *  @details    The byte array created can be used with function
@@ -136,6 +338,65 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateFromByteArray,
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT int32_t, Message_ToByteArray, MESSAGE_HANDLE, messageHandle, unsigned char *, buf, int32_t, size);
 
+/** @brief      Creates a byte array representation of a MESSAGE_HANDLE in a
+ *              given version of the serialization.
+ *
+ *  @details    #GATEWAY_MESSAGE_VERSION_1 is the serialization of
+ *              #Message_ToByteArray, which every remote module understands.
+ *              #GATEWAY_MESSAGE_VERSION_2 is more compact and faster to write
+ *              and parse; it shall only be sent to a peer known to parse it.
+ *              Only version 2 carries the creation time and time to live of
+ *              a message that expires. #Message_CreateFromByteArray parses
+ *              both.
+ *
+ *  @param      messageHandle   A #MESSAGE_HANDLE. Must not be NULL.
+ *  @param      version         #GATEWAY_MESSAGE_VERSION_1 or
+ *                              #GATEWAY_MESSAGE_VERSION_2.
+ *  @param      buf             A pointer to a byte array in memory, or NULL.
+ *  @param      size            An int32_t that specifies the size of buf.
+ *
+ *  @return     As for #Message_ToByteArray; also a negative value if
+ *              @c version is unknown.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT int32_t, Message_ToByteArrayWithVersion, MESSAGE_HANDLE, messageHandle, uint8_t, version, unsigned char *, buf, int32_t, size);
+
+/** @brief      Gets the serialization of a message, as
+ *              #Message_ToByteArrayWithVersion writes it.
+ *
+ *  @details    Messages don't change once created, so a message is only
+ *              serialized the first time a version is asked for; the
+ *              serialization is then kept with the message and shared by all
+ *              the later callers, from any thread.
+ *
+ *  @param      message     A #MESSAGE_HANDLE. Must not be NULL.
+ *  @param      version     #GATEWAY_MESSAGE_VERSION_1 or
+ *                          #GATEWAY_MESSAGE_VERSION_2.
+ *
+ *  @return     A #CONSTBUFFER_HANDLE holding the serialization, which the
+ *              caller releases with @c CONSTBUFFER_Destroy, or @c NULL upon
+ *              failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT CONSTBUFFER_HANDLE, Message_GetSerialization, MESSAGE_HANDLE, message, uint8_t, version);
+
+/** @brief      Gets the serialization of a message without its content.
+ *
+ *  @details    The bytes returned are the ones #Message_GetSerialization
+ *              returns before the content; sending them, then each segment
+ *              returned by #Message_GetContentSegment, with a gather
+ *              write, sends the whole serialization without first copying
+ *              the content into one contiguous buffer. Like the
+ *              serialization, it is made once and kept with the message.
+ *
+ *  @param      message     A #MESSAGE_HANDLE. Must not be NULL.
+ *  @param      version     #GATEWAY_MESSAGE_VERSION_1 or
+ *                          #GATEWAY_MESSAGE_VERSION_2.
+ *
+ *  @return     A #CONSTBUFFER_HANDLE holding the bytes before the content,
+ *              which the caller releases with @c CONSTBUFFER_Destroy, or
+ *              @c NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT CONSTBUFFER_HANDLE, Message_GetSerializationHeader, MESSAGE_HANDLE, message, uint8_t, version);
+
 /** @brief      Creates a new message from a @c CONSTBUFFER source and
  *              @c MAP_HANDLE.
  *
@@ -153,6 +414,75 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT int32_t, Message_ToByteArray, MESSAGE_HANDLE,
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateFromBuffer, const MESSAGE_BUFFER_CONFIG *, cfg);
 
+/** @brief      Creates a new message whose content is made of several
+ *              @c CONSTBUFFER segments.
+ *
+ *  @details    The segments are cloned, not copied, so a message can be made
+ *              of a header and a payload kept in different buffers. They are
+ *              only copied into one buffer if #Message_GetContent or
+ *              #Message_GetContentHandle is called on a message of more than
+ *              one segment; #Message_ToByteArray and
+ *              #Message_GetContentSegment read them where they are. The
+ *              message never expires.
+ *
+ *  @param      cfg     Pointer to a #MESSAGE_SEGMENTS_CONFIG structure.
+ *
+ *  @return     A non-NULL #MESSAGE_HANDLE for the newly created message, or
+ *              @c NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateFromSegments, const MESSAGE_SEGMENTS_CONFIG *, cfg);
+
+/** @brief      Creates a new message from another one, with some of its
+ *              properties set or removed.
+ *
+ *  @details    The new message shares the content and the properties of
+ *              @c base, which it keeps a reference to, and only stores the
+ *              properties that differ from them. The removals are applied
+ *              before the additions, so a property both removed and added has
+ *              the added value. The message will be created with the
+ *              reference count initialized to 1.
+ *
+ *  @param      base        The #MESSAGE_HANDLE the new message is derived
+ *                          from.
+ *  @param      adds        The properties to set, or @c NULL if
+ *                          @c addCount is zero.
+ *  @param      addCount    The number of properties in @c adds.
+ *  @param      removes     The names of the properties to remove, or
+ *                          @c NULL if @c removeCount is zero.
+ *  @param      removeCount The number of names in @c removes.
+ *
+ *  @return     A non-NULL #MESSAGE_HANDLE for the newly created message, or
+ *              @c NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateDerived, MESSAGE_HANDLE, base, const MESSAGE_PROPERTY*, adds, size_t, addCount, const char* const*, removes, size_t, removeCount);
+
+/** @brief      Creates a new message from another one, with some of its
+ *              properties set to typed values or removed.
+ *
+ *  @details    As #Message_CreateDerived, but the values of the properties
+ *              set keep their type: they are only converted to strings the
+ *              first time a string is needed, and #Message_GetPropertyTypedValue
+ *              returns them as they were set. The strings and bytes of
+ *              @c adds are copied. This is the only way to give a property
+ *              a typed value: #Message_Create and the other functions that
+ *              create a message take the properties as strings, so a module
+ *              that publishes typed properties creates the message and then
+ *              derives it with them.
+ *
+ *  @param      base        The #MESSAGE_HANDLE the new message is derived
+ *                          from.
+ *  @param      adds        The properties to set, or @c NULL if
+ *                          @c addCount is zero.
+ *  @param      addCount    The number of properties in @c adds.
+ *  @param      removes     The names of the properties to remove, or
+ *                          @c NULL if @c removeCount is zero.
+ *  @param      removeCount The number of names in @c removes.
+ *
+ *  @return     A non-NULL #MESSAGE_HANDLE for the newly created message, or
+ *              @c NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_CreateDerivedWithValues, MESSAGE_HANDLE, base, const MESSAGE_TYPED_PROPERTY*, adds, size_t, addCount, const char* const*, removes, size_t, removeCount);
+
 /** @brief      Creates a clone of the message.
  *
  *  @details    Since messages are immutable, this function only increments the 
@@ -179,6 +509,74 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_HANDLE, Message_Clone, MESSAGE_HANDLE
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT CONSTMAP_HANDLE, Message_GetProperties, MESSAGE_HANDLE, message);
 
+/** @brief      Gets the value of a property of a message.
+ *
+ *  @details    Unlike #Message_GetProperties, this function does not clone
+ *              the properties of the message. The returned string is owned by
+ *              the message and is valid as long as the message is. The
+ *              first call builds a hash index over the property keys that
+ *              are well-known or were given to #Message_InternKey, kept with
+ *              the message and shared by its clones, so later lookups of
+ *              these keys take constant time. The other keys are compared by
+ *              name.
+ *
+ *  @param      message     The #MESSAGE_HANDLE from which the property will
+ *                          be fetched.
+ *  @param      key         The name of the property.
+ *
+ *  @return     The value of the property, or @c NULL if the message does not
+ *              have it or upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT const char*, Message_GetPropertyValue, MESSAGE_HANDLE, message, const char*, key);
+
+/** @brief      Interns a property key in the key table of the process.
+ *
+ *  @details    Keys are never removed from the table. Modules intern the
+ *              keys they look up once, when they are created, and use
+ *              #Message_GetPropertyValueByKey on every message. The keys
+ *              of a message are only indexed once interned this way.
+ *
+ *  @param      key         The name of the key.
+ *
+ *  @return     The #MESSAGE_KEY of @c key, or #MESSAGE_KEY_NONE upon failure,
+ *              including when the key table is full. A module that gets
+ *              #MESSAGE_KEY_NONE looks the property up by name with
+ *              #Message_GetPropertyValue instead.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT MESSAGE_KEY, Message_InternKey, const char*, key);
+
+/** @brief      Gets the value of a property of a message from its interned
+ *              key.
+ *
+ *  @details    Like #Message_GetPropertyValue, but the keys are compared as
+ *              integers.
+ *
+ *  @param      message     The #MESSAGE_HANDLE from which the property will
+ *                          be fetched.
+ *  @param      key         The #MESSAGE_KEY of the property.
+ *
+ *  @return     The value of the property, or @c NULL if the message does not
+ *              have it or upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT const char*, Message_GetPropertyValueByKey, MESSAGE_HANDLE, message, MESSAGE_KEY, key);
+
+/** @brief      Gets the value of a property of a message in its own type.
+ *
+ *  @details    Only a property set by #Message_CreateDerivedWithValues has
+ *              the type it was set with; any other property is a
+ *              #MESSAGE_VALUE_STRING. The strings and bytes of @c value are
+ *              owned by the message and are valid as long as the message is.
+ *
+ *  @param      message     The #MESSAGE_HANDLE from which the property will
+ *                          be fetched.
+ *  @param      key         The #MESSAGE_KEY of the property.
+ *  @param      value       The #MESSAGE_VALUE receiving the value.
+ *
+ *  @return     0 if the message has the property, a non-zero value if it
+ *              does not have it or upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT int, Message_GetPropertyTypedValue, MESSAGE_HANDLE, message, MESSAGE_KEY, key, MESSAGE_VALUE*, value);
+
 /** @brief      Gets the content of a message.
  *
  *  @details    The returned @c CONSTBUFFER need not be freed by the caller.
@@ -191,6 +589,31 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT CONSTMAP_HANDLE, Message_GetProperties, MESSA
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT const CONSTBUFFER *, Message_GetContent, MESSAGE_HANDLE, message);
 
+/** @brief      Gets the number of segments the content of a message is made
+ *              of.
+ *
+ *  @param      message     A #MESSAGE_HANDLE.
+ *
+ *  @return     The @c segmentCount of a message made by
+ *              #Message_CreateFromSegments, 1 for any other message, or 0 if
+ *              @c message is @c NULL.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT size_t, Message_GetContentSegmentCount, MESSAGE_HANDLE, message);
+
+/** @brief      Gets a segment of the content of a message.
+ *
+ *  @details    The returned @c CONSTBUFFER need not be freed by the caller.
+ *              The content of a message is its segments one after the other.
+ *
+ *  @param      message     A #MESSAGE_HANDLE.
+ *  @param      index       The index of the segment, less than
+ *                          #Message_GetContentSegmentCount.
+ *
+ *  @return     A pointer to a @c CONSTBUFFER representing the segment, or
+ *              @c NULL upon failure.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT const CONSTBUFFER *, Message_GetContentSegment, MESSAGE_HANDLE, message, size_t, index);
+
 /** @brief      Gets the @c CONSTBUFFER handle that may be used to access the 
  *              message content.
  *
@@ -204,12 +627,67 @@ MOCKABLE_FUNCTION(, GATEWAY_EXPORT const CONSTBUFFER *, Message_GetContent, MESS
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT CONSTBUFFER_HANDLE, Message_GetContentHandle, MESSAGE_HANDLE, message);
 
+/** @brief      Gets the creation time of a message.
+ *
+ *  @param      message     The #MESSAGE_HANDLE from which the creation time
+ *                          will be fetched.
+ *
+ *  @return     The @c creationTime the message was created with, or 0 if
+ *              @c message is @c NULL.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT uint64_t, Message_GetCreationTime, MESSAGE_HANDLE, message);
+
+/** @brief      Gets the time to live of a message.
+ *
+ *  @param      message     The #MESSAGE_HANDLE from which the time to live
+ *                          will be fetched.
+ *
+ *  @return     The @c timeToLive the message was created with, 0 if it never
+ *              expires or if @c message is @c NULL.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT uint64_t, Message_GetTimeToLive, MESSAGE_HANDLE, message);
+
+/** @brief      Tells whether a message has expired.
+ *
+ *  @details    A message with a time to live expires once @c now is at least
+ *              @c timeToLive microseconds past its @c creationTime.
+ *
+ *  @param      message     The #MESSAGE_HANDLE to check.
+ *  @param      now         The current time, as returned by
+ *                          @c MonotonicClock_GetMicroseconds.
+ *
+ *  @return     @c true if the message has expired, @c false if it has not,
+ *              never expires or is @c NULL.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT bool, Message_IsExpired, MESSAGE_HANDLE, message, uint64_t, now);
+
 /** @brief      Disposes of resources allocated by the message.
  *       
  *  @param      message     The #MESSAGE_HANDLE to be destroyed.
  */
 MOCKABLE_FUNCTION(, GATEWAY_EXPORT void, Message_Destroy, MESSAGE_HANDLE, message);
 
+/** @brief      The largest number of message headers a thread keeps in its
+ *              free list.
+ */
+#define MESSAGE_THREAD_CACHE_SIZE 64
+
+/** @brief      Makes the calling thread keep the headers of the messages it
+ *              destroys in a free list, for the next messages it creates.
+ *
+ *  @details    Only the header block of a message is reused. Its content and
+ *              properties are still allocated and freed each time by the
+ *              shared utility. The broker calls this on the threads that
+ *              deliver messages to modules. A thread that enabled its free
+ *              list shall call #Message_DisableThreadCache before it exits.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT void, Message_EnableThreadCache);
+
+/** @brief      Frees the message headers in the free list of the calling
+ *              thread and stops keeping them.
+ */
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT void, Message_DisableThreadCache);
+
 #ifdef __cplusplus
   }
 #else
@@ -19,8 +19,16 @@ extern "C"
 #include <stdbool.h>
 #endif
 
+/* the number of priority lanes of a queue, lane 0 has the lowest priority */
+#define MESSAGE_QUEUE_PRIORITIES 4
+
+/* the number of pops in a row that may pass over a lane that has messages for a higher lane */
+#define MESSAGE_QUEUE_STARVATION_LIMIT 8
+
 typedef struct MESSAGE_QUEUE_TAG* MESSAGE_QUEUE_HANDLE;
 
+typedef bool(*MESSAGE_QUEUE_PREDICATE)(MESSAGE_HANDLE message, const void* context);
+
 /* creation */
 MOCKABLE_FUNCTION(, MESSAGE_QUEUE_HANDLE, MESSAGE_QUEUE_create);
 
@@ -29,14 +37,23 @@ MOCKABLE_FUNCTION(, void, MESSAGE_QUEUE_destroy, MESSAGE_QUEUE_HANDLE, handle);
 
 /* insertion */
 MOCKABLE_FUNCTION(, int, MESSAGE_QUEUE_push, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_HANDLE, element);
+MOCKABLE_FUNCTION(, int, MESSAGE_QUEUE_push_with_priority, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_HANDLE, element, size_t, priority);
 
 /* removal */
 MOCKABLE_FUNCTION(, MESSAGE_HANDLE, MESSAGE_QUEUE_pop, MESSAGE_QUEUE_HANDLE, handle);
+MOCKABLE_FUNCTION(, MESSAGE_HANDLE, MESSAGE_QUEUE_evict, MESSAGE_QUEUE_HANDLE, handle);
+
+/* replacement */
+
+MOCKABLE_FUNCTION(, MESSAGE_HANDLE, MESSAGE_QUEUE_replace_if, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_QUEUE_PREDICATE, predicate, const void*, context, MESSAGE_HANDLE, element, size_t, priority);
 
 /* access */
 MOCKABLE_FUNCTION(, bool,  MESSAGE_QUEUE_is_empty, MESSAGE_QUEUE_HANDLE, handle);
 MOCKABLE_FUNCTION(, MESSAGE_HANDLE, MESSAGE_QUEUE_front, MESSAGE_QUEUE_HANDLE, handle);
 
+MOCKABLE_FUNCTION(, size_t, MESSAGE_QUEUE_size, MESSAGE_QUEUE_HANDLE, handle);
+MOCKABLE_FUNCTION(, size_t, MESSAGE_QUEUE_peak_size, MESSAGE_QUEUE_HANDLE, handle);
+
 #ifdef __cplusplus
 }
 #endif
@@ -107,6 +107,23 @@ extern "C"
      */
     typedef void(*pfModule_Receive)(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle);
 
+    /** @brief      Receives several messages from the broker at once.
+     *
+     *  @details    This function is optional. The broker calls it instead of
+     *              Module_Receive with the messages that are queued for the
+     *              module, oldest first. The messages are destroyed by the
+     *              broker when the function returns; a module that keeps one
+     *              must clone it.
+     *
+     *  @param      moduleHandle    The #MODULE_HANDLE of the module receiving
+     *                              the messages.
+     *  @param      messageHandles  The #MESSAGE_HANDLE array of the messages
+     *                              being sent to the module.
+     *  @param      count           The number of messages in @c messageHandles,
+     *                              never 0.
+     */
+    typedef void(*pfModule_ReceiveBatch)(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE* messageHandles, size_t count);
+
     /** @brief      Signals to the module that the broker is ready to send and
      *              receive messages.
      *
@@ -121,11 +138,12 @@ extern "C"
     /** @brief  Module API version. */
     typedef enum MODULE_API_VERSION_TAG
     {
-        MODULE_API_VERSION_1
+        MODULE_API_VERSION_1,
+        MODULE_API_VERSION_2
     } MODULE_API_VERSION;
 
     /** @brief  Current gateway module API version */
-    static const MODULE_API_VERSION Module_ApiGatewayVersion = MODULE_API_VERSION_1;
+    static const MODULE_API_VERSION Module_ApiGatewayVersion = MODULE_API_VERSION_2;
 
     /** @brief  Structure returned by ::Module_GetApi containing the API
      *          version. By convention, the module returns a compound structure 
@@ -171,6 +189,41 @@ extern "C"
         pfModule_Start Module_Start;
     } MODULE_API_1;
 
+    /** @brief  The module interface, version 2. It starts with the same
+     *          functions as version 1, so a version 2 module can be used
+     *          wherever a version 1 module can.
+     */
+    typedef struct MODULE_API_2_TAG
+    {
+        /** @brief  Always the first element on a Module's API*/
+        MODULE_API base;
+
+        /** @brief  Function pointer to the #Module_ParseConfigurationFromJson
+         *          function. */
+        pfModule_ParseConfigurationFromJson Module_ParseConfigurationFromJson;
+
+        /** @brief  Function pointer to the #Module_FreeConfiguration
+         *          function. */
+        pfModule_FreeConfiguration Module_FreeConfiguration;
+
+        /** @brief  Function pointer to the #Module_Create function. */
+        pfModule_Create Module_Create;
+
+        /** @brief  Function pointer to the #Module_Destroy function. */
+        pfModule_Destroy Module_Destroy;
+
+        /** @brief  Function pointer to the #Module_Receive function. */
+        pfModule_Receive Module_Receive;
+
+        /** @brief  Function pointer to the #Module_Start function (optional).
+         */
+        pfModule_Start Module_Start;
+
+        /** @brief  Function pointer to the #Module_ReceiveBatch function
+         *          (optional). */
+        pfModule_ReceiveBatch Module_ReceiveBatch;
+    } MODULE_API_2;
+
     /** @brief  This is the only function exported by a module. Using the
      *          exported function, the caller learns the functions for the 
      *          particular module.
@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MONOTONIC_CLOCK_H
+#define MONOTONIC_CLOCK_H
+
+#include "azure_c_shared_utility/macro_utils.h"
+#include "azure_c_shared_utility/umock_c_prod.h"
+
+#include "gateway_export.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+extern "C"
+{
+#else
+#include <stdint.h>
+#endif
+
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT uint64_t, MonotonicClock_GetMicroseconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MONOTONIC_CLOCK_H
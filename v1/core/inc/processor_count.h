@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef PROCESSOR_COUNT_H
+#define PROCESSOR_COUNT_H
+
+#include "azure_c_shared_utility/macro_utils.h"
+#include "azure_c_shared_utility/umock_c_prod.h"
+
+#include "gateway_export.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+extern "C"
+{
+#else
+#include <stddef.h>
+#endif
+
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT size_t, ProcessorCount_Get);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROCESSOR_COUNT_H
@@ -0,0 +1,87 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+/** @file       thread_scheduling.h
+*   @brief      Applies CPU affinity and scheduling settings to the threads the
+*               gateway creates.
+*/
+
+#ifndef THREAD_SCHEDULING_H
+#define THREAD_SCHEDULING_H
+
+#include "azure_c_shared_utility/macro_utils.h"
+#include "azure_c_shared_utility/umock_c_prod.h"
+
+#include "gateway_export.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+extern "C"
+{
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#endif
+
+/** @brief    Number of CPUs that can be named in a CPU affinity mask. */
+#define THREAD_SCHEDULING_MAX_CPUS 64
+
+/** @brief    Lowest (most favorable) nice value. */
+#define THREAD_SCHEDULING_MIN_NICE (-20)
+
+/** @brief    Highest (least favorable) nice value. */
+#define THREAD_SCHEDULING_MAX_NICE 19
+
+/** @brief    Highest real-time (first in, first out) priority. */
+#define THREAD_SCHEDULING_MAX_FIFO_PRIORITY 99
+
+/** @brief    CPU affinity and scheduling of a thread.
+*
+*   @details  Every field left 0 leaves that setting of the thread as it was
+*             created, so a zero initialized #THREAD_SCHEDULING_CONFIG
+*             changes nothing.
+*/
+typedef struct THREAD_SCHEDULING_CONFIG_TAG
+{
+    /** @brief    The CPUs the thread may run on, bit @c n standing for CPU
+    *            @c n, or 0 to let the thread run on any CPU.
+    */
+    uint64_t cpu_affinity;
+
+    /** @brief    The nice value of the thread, from
+    *            #THREAD_SCHEDULING_MIN_NICE to #THREAD_SCHEDULING_MAX_NICE.
+    */
+    int nice;
+
+    /** @brief    The real-time priority of the thread, from 1 to
+    *            #THREAD_SCHEDULING_MAX_FIFO_PRIORITY, or 0 to keep the
+    *            thread in the normal time-sharing class. A thread with a
+    *            real-time priority runs first in, first out (@c SCHED_FIFO)
+    *            and ignores its nice value.
+    */
+    int fifo_priority;
+} THREAD_SCHEDULING_CONFIG;
+
+/** @brief      Evaluates to @c true if the #THREAD_SCHEDULING_CONFIG pointed
+*               to by @p config changes any setting of a thread.
+*/
+#define THREAD_SCHEDULING_IS_SET(config) \
+    ((config)->cpu_affinity != 0 || (config)->nice != 0 || (config)->fifo_priority != 0)
+
+/** @brief      Applies @p config to the calling thread.
+*
+*   @details    Every setting is attempted even if an earlier one fails.
+*               Raising the priority of a thread usually requires privileges
+*               (@c CAP_SYS_NICE on Linux) that the gateway may not have.
+*
+*   @param      config  The settings to apply.
+*
+*   @return     0 if every setting was applied, non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, GATEWAY_EXPORT int, ThreadScheduling_Apply, const THREAD_SCHEDULING_CONFIG*, config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // THREAD_SCHEDULING_H
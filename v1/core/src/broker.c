@@ -3,94 +3,289 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "azure_c_shared_utility/gballoc.h"
 #include "azure_c_shared_utility/vector.h"
-#include "azure_c_shared_utility/strings.h"
 #include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
 #include "azure_c_shared_utility/threadapi.h"
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_c_shared_utility/refcount.h"
 #include "azure_c_shared_utility/singlylinkedlist.h"
-#include "azure_c_shared_utility/uniqueid.h"
-
-#include "nanomsg/nn.h"
-#include "nanomsg/pubsub.h"
 
 #include "message.h"
+#include "message_queue.h"
 #include "module.h"
 #include "module_access.h"
 #include "broker.h"
+#include "processor_count.h"
+#include "thread_scheduling.h"
+#include "monotonic_clock.h"
+#include "link_filter.h"
+
+/*Maximum number of messages a pool worker delivers to a module before it
+moves on to the next ready module*/
+#define BROKER_SCHEDULER_QUANTUM 16
+
+/*Maximum number of messages handed to a module's Module_ReceiveBatch at once*/
+#define BROKER_RECEIVE_BATCH_SIZE 16
+
+/*Maximum number of inline deliveries nested on one thread, when the receive
+function of a module delivered to inline publishes in turn*/
+#define BROKER_INLINE_MAX_DEPTH 8
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define BROKER_THREAD_LOCAL __declspec(thread)
+/*adds one to, or takes one from, a volatile long, as a full memory barrier*/
+#define BROKER_INCREMENT(counter) InterlockedIncrement((volatile LONG*)(counter))
+#define BROKER_DECREMENT(counter) InterlockedDecrement((volatile LONG*)(counter))
+#define BROKER_MEMORY_BARRIER() MemoryBarrier()
+#else
+#define BROKER_THREAD_LOCAL __thread
+#define BROKER_INCREMENT(counter) __sync_add_and_fetch((counter), 1)
+#define BROKER_DECREMENT(counter) __sync_sub_and_fetch((counter), 1)
+#define BROKER_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+/*the number of inline deliveries the calling thread is in*/
+static BROKER_THREAD_LOCAL size_t inline_depth = 0;
+
+/*the lanes of a module's mq hold the messages of the links of each priority*/
+#if BROKER_LINK_PRIORITIES > MESSAGE_QUEUE_PRIORITIES
+#error "a module's mq needs a lane per link priority"
+#endif
+
+/*A compiled link filter, shared by the link and by the routes built from it*/
+typedef struct BROKER_FILTER_TAG
+{
+    LINK_FILTER_HANDLE      compiled;
+    /** The broker's own copy of the filter expression */
+    char*                   expression;
+}BROKER_FILTER;
+
+DEFINE_REFCOUNT_TYPE(BROKER_FILTER);
+
+/*The coalesce key of a link, shared by the link and by the routes built from it*/
+typedef struct BROKER_COALESCE_TAG
+{
+    /** The broker's own copy of the coalesce key, followed by the buffer its
+     *  names are split in
+     */
+    char*                   key;
+    /** The interned property names of the key */
+    MESSAGE_KEY             keys[BROKER_COALESCE_MAX_NAMES];
+    size_t                  key_count;
+}BROKER_COALESCE;
+
+DEFINE_REFCOUNT_TYPE(BROKER_COALESCE);
+
+/*A link, as the sink keeps it in its sources*/
+typedef struct BROKER_SOURCE_TAG
+{
+    /** The link */
+    BROKER_LINK_DATA        link;
+    /** The priority of the link, the lane of the sink's mq its messages go to */
+    size_t                  priority;
+    /** The filter of the link, NULL if the link takes every message */
+    BROKER_FILTER*          filter;
+    /** The coalesce key of the link, NULL if the link queues every message */
+    BROKER_COALESCE*        coalesce;
+}BROKER_SOURCE;
 
-/* minimum size for a guid string, 36 characters + null terminator */
-#define BROKER_GUID_SIZE 37
-#define INPROC_URL_HEAD "inproc://"
-#define INPROC_URL_HEAD_SIZE 9
-#define URL_SIZE (INPROC_URL_HEAD_SIZE + BROKER_GUID_SIZE +1)
+/*An entry of the routing table: messages published by source are delivered to sink,
+on the lane of the link's priority*/
+typedef struct BROKER_ROUTE_TAG
+{
+    MODULE_HANDLE                   source;
+    struct BROKER_MODULEINFO_TAG*   sink;
+    size_t                          priority;
+    /** The filter of the link, NULL if the route takes every message */
+    BROKER_FILTER*                  filter;
+    /** The coalesce key of the link, NULL if the route queues every message */
+    BROKER_COALESCE*                coalesce;
+    /** Index of the counters of the link in the sink's link_statistics */
+    size_t                          statistics_index;
+}BROKER_ROUTE;
+
+/*An immutable snapshot of the routing table. Publishers hold a reference on
+the snapshot while they deliver a message; the broker never changes a snapshot
+once it is published, it builds a new one and swaps it in.*/
+typedef struct BROKER_TOPOLOGY_TAG
+{
+    /** Routing table built from the links, sorted by source */
+    BROKER_ROUTE*           routes;
+    size_t                  route_count;
+}BROKER_TOPOLOGY;
+
+DEFINE_REFCOUNT_TYPE(BROKER_TOPOLOGY);
+
+/*A worker thread of the broker's pool*/
+typedef struct BROKER_WORKER_TAG
+{
+    /** The pool the worker belongs to */
+    struct BROKER_SCHEDULER_TAG*    scheduler;
+    /** Handle to the worker's thread */
+    THREAD_HANDLE                   thread;
+    /** Modules that have messages to deliver, each one a BROKER_MODULEINFO*. The
+     *  worker runs them in order unless an idle worker steals them first
+     */
+    SINGLYLINKEDLIST_HANDLE         ready;
+    /** Lock guarding ready */
+    LOCK_HANDLE                     ready_lock;
+}BROKER_WORKER;
+
+/*The pool of workers that run the modules which do not have a thread of their own*/
+typedef struct BROKER_SCHEDULER_TAG
+{
+    BROKER_WORKER*  workers;
+    size_t          worker_count;
+    /** Lock guarding ready_count, idle_workers, next_worker and quit_workers */
+    LOCK_HANDLE     idle_lock;
+    /** Signaled when a module is made ready or when the workers should quit */
+    COND_HANDLE     idle_cond;
+    /** Number of modules in the ready lists that no worker has claimed yet */
+    size_t          ready_count;
+    /** Number of workers waiting on idle_cond */
+    size_t          idle_workers;
+    /** Index of the worker whose ready list gets the next module made ready
+     *  by a publisher
+     */
+    size_t          next_worker;
+    /** Set by Broker_Destroy to ask the workers to exit */
+    bool            quit_workers;
+    /** Applied by each worker before it runs any module */
+    THREAD_SCHEDULING_CONFIG thread_scheduling;
+}BROKER_SCHEDULER;
 
 /*The structure backing the message broker handle*/
 typedef struct BROKER_HANDLE_DATA_TAG
 {
     SINGLYLINKEDLIST_HANDLE modules;
     LOCK_HANDLE             modules_lock;
-    int                     publish_socket;
-    STRING_HANDLE           url;
+    /** The current topology snapshot, swapped in under modules_lock and
+     *  read without a lock (see topology_acquire)
+     */
+    BROKER_TOPOLOGY* volatile topology;
+    /** The epoch readers of topology count themselves in, 0 or 1 */
+    volatile long           topology_epoch;
+    /** Number of readers between loading topology and taking a reference on
+     *  it, per epoch
+     */
+    volatile long           topology_readers[2];
+    /** The worker pool, NULL if every module has a thread of its own */
+    BROKER_SCHEDULER*       scheduler;
 }BROKER_HANDLE_DATA;
 
 DEFINE_REFCOUNT_TYPE(BROKER_HANDLE_DATA);
 
+/*The counters a sink keeps for the links from one source*/
+typedef struct BROKER_SOURCE_STATISTICS_TAG
+{
+    MODULE_HANDLE           source;
+    BROKER_LINK_STATISTICS  statistics;
+}BROKER_SOURCE_STATISTICS;
+
 typedef struct BROKER_MODULEINFO_TAG
 {
     /** Handle to the module that's associated with the broker */
-    MODULE*         module;
+    MODULE*                 module;
     /** Handle to the thread on which this module's message processing loop is
-     *  running
+     *  running, unless the module runs on the worker pool
      */
-    THREAD_HANDLE   thread;
-    /** Socket this module will receive messages on */
-    int             receive_socket;
-    /** Lock to prevent nanomsg race condition */
-    LOCK_HANDLE     socket_lock;
-    /** Guid sent to module worker thread to close task */
-    STRING_HANDLE   quit_message_guid;
-
+    THREAD_HANDLE           thread;
+    /** The worker pool that runs the module, NULL if it has a thread of its own */
+    BROKER_SCHEDULER*       scheduler;
+    /** Set while the module is in a ready list or being run by a pool worker */
+    bool                    scheduled;
+    /** Messages published to this module that have not been delivered yet */
+    MESSAGE_QUEUE_HANDLE    mq;
+    /** Lock guarding mq, quit_worker, scheduled, receiving, blocked_publishers,
+     *  drop_count, statistics and link_statistics
+     */
+    LOCK_HANDLE             mq_lock;
+    /** Signaled when a message is queued or when the worker should quit; on
+     *  the worker pool, signaled when a module being removed leaves the pool
+     */
+    COND_HANDLE             mq_cond;
+    /** Signaled when a message is taken out of a full mq or when the worker
+     *  should quit
+     */
+    COND_HANDLE             space_cond;
+    /** Set by Broker_RemoveModule to ask the worker thread to exit */
+    bool                    quit_worker;
+    /** Set while a thread delivers messages to the module outside of mq_lock, be it
+     *  the module's worker or a publisher delivering inline. No other thread
+     *  delivers to the module meanwhile
+     */
+    bool                    receiving;
+    /** Whether Broker_Publish delivers to the module on the publisher's thread
+     *  when the module's mq is empty and the module is not receiving
+     */
+    bool                    inline_delivery;
+    /** Maximum number of messages in mq */
+    size_t                  inbox_capacity;
+    /** What Broker_Publish does with a message when mq is full */
+    BROKER_OVERFLOW_POLICY  overflow_policy;
+    /** Interned property compared by BROKER_OVERFLOW_COALESCE_BY_KEY, MESSAGE_KEY_NONE otherwise */
+    MESSAGE_KEY             coalesce_key;
+    /** Number of publishers waiting on space_cond */
+    size_t                  blocked_publishers;
+    /** Number of messages dropped because mq was full */
+    size_t                  drop_count;
+    /** Links whose source messages are delivered to this module, as BROKER_SOURCE */
+    VECTOR_HANDLE           sources;
+    /** Applied by the module's own thread before it delivers any message */
+    THREAD_SCHEDULING_CONFIG thread_scheduling;
+    /** Counters of the module; queue_depth, max_queue_depth and drops are only
+     *  filled in by Broker_GetStatistics
+     */
+    BROKER_MODULE_STATISTICS statistics;
+    /** Duration of the last call to the module's receive function, in microseconds,
+     *  not yet counted in statistics. Only the thread that set receiving touches
+     *  it, outside of mq_lock
+     */
+    uint64_t                pending_latency;
+    bool                    has_pending_latency;
+    /** Messages of the last delivery that had expired and were not handed to the
+     *  module, not yet counted in statistics. Touched like pending_latency
+     */
+    size_t                  pending_expired;
+    /** Time the module may take per message before it is considered slow, in
+     *  microseconds, 0 for never
+     */
+    uint64_t                slow_receive_threshold;
+    BROKER_MODULE_HEALTH_CALLBACK on_health_changed;
+    void*                   health_context;
+    /** Set while the module is marked slow. Only the thread that set receiving
+     *  changes it, with mq_lock held
+     */
+    bool                    slow;
+    /** Number of deliveries in a row that disagree with slow. Touched like
+     *  pending_latency
+     */
+    size_t                  slow_streak;
+    /** Counters of the links to this module, one entry per source. Entries are
+     *  added by Broker_AddLink and kept until the module is removed
+     */
+    BROKER_SOURCE_STATISTICS* link_statistics;
+    size_t                  link_statistics_count;
 }BROKER_MODULEINFO;
 
-static STRING_HANDLE construct_url()
-{
-    STRING_HANDLE result;
+DEFINE_REFCOUNT_TYPE(BROKER_MODULEINFO);
 
-    /*Codes_SRS_BROKER_17_002: [ Broker_Create shall create a unique id. ]*/
-    char uuid[BROKER_GUID_SIZE];
-    memset(uuid, 0, BROKER_GUID_SIZE);
-    if (UniqueId_Generate(uuid, BROKER_GUID_SIZE) != UNIQUEID_OK)
-    {
-        LogError("Unable to generate unique Id.");
-        result = NULL;
-    }
-    else
-    {
-        /*Codes_SRS_BROKER_17_003: [ Broker_Create shall initialize a url consisting of "inproc://" + unique id. ]*/
-        result = STRING_construct(INPROC_URL_HEAD);
-        if (result == NULL)
-        {
-            LogError("Unable to construct url.");
-        }
-        else
-        {
-            if (STRING_concat(result, uuid) != 0)
-            {
-                /*Codes_SRS_BROKER_13_003: [ This function shall return NULL if an underlying API call to the platform causes an error. ]*/
-                STRING_delete(result);
-                LogError("Unable to append uuid to url.");
-                result = NULL;
-            }
-        }
-    }
-    return result;
-}
+static BROKER_SCHEDULER* scheduler_create(const BROKER_SCHEDULER_CONFIG* config);
+static void scheduler_destroy(BROKER_SCHEDULER* scheduler);
 
 BROKER_HANDLE Broker_Create(void)
+{
+    /*Codes_SRS_BROKER_30_050: [ Broker_Create shall create a broker that gives every module a thread of its own, as Broker_CreateWithScheduler does when scheduler is NULL. ]*/
+    return Broker_CreateWithScheduler(NULL);
+}
+
+BROKER_HANDLE Broker_CreateWithScheduler(const BROKER_SCHEDULER_CONFIG* scheduler)
 {
     BROKER_HANDLE_DATA* result;
 
@@ -126,41 +321,39 @@ BROKER_HANDLE Broker_Create(void)
             }
             else
             {
-                /*Codes_SRS_BROKER_17_001: [ Broker_Create shall initialize a socket for publishing messages. ]*/
-                result->publish_socket = nn_socket(AF_SP, NN_PUB);
-                if (result->publish_socket < 0)
+                /*Codes_SRS_BROKER_30_027: [ Broker_Create shall set BROKER_HANDLE_DATA::topology_epoch and both BROKER_HANDLE_DATA::topology_readers to 0. ]*/
+                result->topology_epoch = 0;
+                result->topology_readers[0] = 0;
+                result->topology_readers[1] = 0;
+
+                /*Codes_SRS_BROKER_30_016: [ Broker_Create shall initialize BROKER_HANDLE_DATA::topology with an empty topology. ]*/
+                result->topology = REFCOUNT_TYPE_CREATE(BROKER_TOPOLOGY);
+                if (result->topology == NULL)
                 {
-                    /*Codes_SRS_BROKER_13_003: [ This function shall return NULL if an underlying API call to the platform causes an error. ]*/
-                    LogError("nanomsg puclish socket create failedL %d", result->publish_socket);
-                    singlylinkedlist_destroy(result->modules);
+                    /*Codes_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]*/
+                    LogError("unable to allocate the topology");
                     Lock_Deinit(result->modules_lock);
+                    singlylinkedlist_destroy(result->modules);
                     free(result);
                     result = NULL;
                 }
                 else
                 {
-                    result->url = construct_url();
-                    if (result->url == NULL)
-                    {
-                        /*Codes_SRS_BROKER_13_003: [ This function shall return NULL if an underlying API call to the platform causes an error. ]*/
-                        singlylinkedlist_destroy(result->modules);
-                        Lock_Deinit(result->modules_lock);
-                        nn_close(result->publish_socket);
-                        free(result);
-                        LogError("Unable to generate unique url.");
-                        result = NULL;
-                    }
-                    else
+                    result->topology->routes = NULL;
+                    result->topology->route_count = 0;
+                    result->scheduler = NULL;
+
+                    if (scheduler != NULL)
                     {
-                        /*Codes_SRS_BROKER_17_004: [ Broker_Create shall bind the socket to the BROKER_HANDLE_DATA::url. ]*/
-                        if (nn_bind(result->publish_socket, STRING_c_str(result->url)) < 0)
+                        /*Codes_SRS_BROKER_30_051: [ If scheduler is not NULL, Broker_CreateWithScheduler shall initialize BROKER_HANDLE_DATA::scheduler with a worker pool of scheduler->worker_count workers. ]*/
+                        result->scheduler = scheduler_create(scheduler);
+                        if (result->scheduler == NULL)
                         {
-                            /*Codes_SRS_BROKER_13_003: [ This function shall return NULL if an underlying API call to the platform causes an error. ]*/
-                            LogError("nanomsg bind failed");
-                            singlylinkedlist_destroy(result->modules);
+                            /*Codes_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]*/
+                            LogError("unable to create the worker pool");
+                            free(result->topology);
                             Lock_Deinit(result->modules_lock);
-                            nn_close(result->publish_socket);
-                            STRING_delete(result->url);                
+                            singlylinkedlist_destroy(result->modules);
                             free(result);
                             result = NULL;
                         }
@@ -188,6 +381,175 @@ void Broker_IncRef(BROKER_HANDLE broker)
     }
 }
 
+/*the number of messages delivered to the module at once: one, unless the module
+receives batches*/
+static size_t receive_batch_size(const BROKER_MODULEINFO* module_info)
+{
+    return (MODULE_RECEIVE_BATCH(module_info->module->module_apis) == NULL) ? 1 : BROKER_RECEIVE_BATCH_SIZE;
+}
+
+/*takes up to max_count messages out of the module's mq in the order MESSAGE_QUEUE_pop
+gives them: highest lane first, oldest first within a lane. The caller holds the
+module's mq_lock. Returns the number of messages taken*/
+static size_t dequeue_messages(BROKER_MODULEINFO* module_info, MESSAGE_HANDLE* messages, size_t max_count)
+{
+    size_t count = 0;
+
+    while (count < max_count &&
+        (messages[count] = MESSAGE_QUEUE_pop(module_info->mq)) != NULL)
+    {
+        if (module_info->blocked_publishers > 0)
+        {
+            /*Codes_SRS_BROKER_30_036: [ If publishers are waiting for room in module_info->mq, this function shall signal module_info->space_cond after dequeuing a message. ]*/
+            (void)Condition_Post(module_info->space_cond);
+        }
+        count++;
+    }
+
+    /*Codes_SRS_BROKER_30_085: [ The function shall add the number of messages dequeued to the module's messages_out counter. ]*/
+    module_info->statistics.messages_out += count;
+
+    return count;
+}
+
+/*moves the messages that have expired by now after the others, which keep their order.
+Returns the number of messages that have not expired*/
+static size_t partition_expired(MESSAGE_HANDLE* messages, size_t count, uint64_t now)
+{
+    size_t fresh = 0;
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        MESSAGE_HANDLE message = messages[i];
+        if (Message_IsExpired(message, now) == false)
+        {
+            messages[i] = messages[fresh];
+            messages[fresh] = message;
+            fresh++;
+        }
+    }
+    return fresh;
+}
+
+/*marks the module slow once it took longer than its slow_receive_threshold per message
+for BROKER_SLOW_DELIVERIES deliveries in a row, and healthy again once it took less for
+as many deliveries. Called by the thread delivering the module's messages, outside of
+mq_lock*/
+static void update_health(BROKER_MODULEINFO* module_info, uint64_t latency)
+{
+    if (module_info->slow_receive_threshold > 0)
+    {
+        bool slow = (latency > module_info->slow_receive_threshold);
+        if (slow == module_info->slow)
+        {
+            module_info->slow_streak = 0;
+        }
+        else if (++(module_info->slow_streak) >= BROKER_SLOW_DELIVERIES)
+        {
+            module_info->slow_streak = 0;
+            if (Lock(module_info->mq_lock) != LOCK_OK)
+            {
+                /*the module keeps its state until the next streak*/
+                LogError("Lock on module_info->mq_lock failed");
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_30_125: [ Once the module has taken longer than slow_receive_threshold per message for BROKER_SLOW_DELIVERIES deliveries in a row, the function shall mark it slow under module_info->mq_lock and signal module_info->space_cond if publishers are waiting for room in its mq. ]*/
+                /*Codes_SRS_BROKER_30_126: [ Once a slow module has taken no longer than slow_receive_threshold per message for BROKER_SLOW_DELIVERIES deliveries in a row, the function shall clear its slow mark under module_info->mq_lock. ]*/
+                module_info->slow = slow;
+                if (slow && module_info->blocked_publishers > 0)
+                {
+                    (void)Condition_Post(module_info->space_cond);
+                }
+                (void)Unlock(module_info->mq_lock);
+
+                /*Codes_SRS_BROKER_30_127: [ After marking the module slow or clearing the mark, the function shall call on_health_changed, if not NULL, with health_context, the module's handle and whether the module is slow, without holding any lock. ]*/
+                if (module_info->on_health_changed != NULL)
+                {
+                    module_info->on_health_changed(module_info->health_context, module_info->module->module_handle, slow);
+                }
+            }
+        }
+    }
+}
+
+/*hands the messages that have not expired to the module, in one call if the module
+receives batches. The messages may be reordered, the caller still owns all of them*/
+static void deliver_messages(BROKER_MODULEINFO* module_info, MESSAGE_HANDLE* messages, size_t count)
+{
+    pfModule_ReceiveBatch receive_batch = MODULE_RECEIVE_BATCH(module_info->module->module_apis);
+    /*Codes_SRS_BROKER_30_086: [ The function shall measure the time the module takes to receive the messages with MonotonicClock_GetMicroseconds, and count it in the module's receive_latency histogram the next time it holds module_info->mq_lock. ]*/
+    uint64_t start = MonotonicClock_GetMicroseconds();
+    /*Codes_SRS_BROKER_30_118: [ The function shall not deliver the messages that have expired, as told by Message_IsExpired, and shall count them in the module's expired counter the next time it holds module_info->mq_lock. ]*/
+    size_t fresh = partition_expired(messages, count, start);
+    if (fresh == 0)
+    {
+        /*nothing left to deliver*/
+    }
+    else if (receive_batch != NULL)
+    {
+        /*Codes_SRS_BROKER_30_068: [ If the module implements Module_ReceiveBatch, the function shall deliver all the dequeued messages, in the order they were dequeued, in one call to Module_ReceiveBatch. ]*/
+        receive_batch(module_info->module->module_handle, messages, fresh);
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; i < fresh; i++)
+        {
+            /*Codes_SRS_BROKER_13_092: [ The function shall deliver the message to the module's callback function via module_info->module_apis. ]*/
+            MODULE_RECEIVE(module_info->module->module_apis)(module_info->module->module_handle, messages[i]);
+        }
+    }
+    uint64_t end = MonotonicClock_GetMicroseconds();
+    module_info->pending_latency = (end > start) ? end - start : 0;
+    module_info->has_pending_latency = true;
+    module_info->pending_expired = count - fresh;
+    if (fresh > 0)
+    {
+        /*Codes_SRS_BROKER_30_124: [ If module_info->slow_receive_threshold is not 0, the function shall compare the time the module took per message delivered with it. ]*/
+        update_health(module_info, module_info->pending_latency / fresh);
+    }
+}
+
+/*counts the last delivery of the module in its receive_latency histogram and expired
+counter. Called by the thread delivering the module's messages, with the module's
+mq_lock held*/
+static void record_delivery(BROKER_MODULEINFO* module_info)
+{
+    if (module_info->has_pending_latency)
+    {
+        uint64_t latency = module_info->pending_latency;
+        size_t bucket = 0;
+        while (latency > 0 && bucket < BROKER_LATENCY_BUCKETS - 1)
+        {
+            latency >>= 1;
+            bucket++;
+        }
+        module_info->statistics.receive_latency[bucket]++;
+        module_info->statistics.expired += module_info->pending_expired;
+        module_info->has_pending_latency = false;
+        module_info->pending_expired = 0;
+    }
+}
+
+static void destroy_messages(MESSAGE_HANDLE* messages, size_t count)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        Message_Destroy(messages[i]);
+    }
+}
+
+static void apply_thread_scheduling(const THREAD_SCHEDULING_CONFIG* config)
+{
+    if (THREAD_SCHEDULING_IS_SET(config) && ThreadScheduling_Apply(config) != 0)
+    {
+        /*the thread still works, only not where or as fast as it was asked to*/
+        LogError("unable to apply the thread scheduling, the thread keeps its default scheduling");
+    }
+}
+
 /**
 * This function runs for each module. It receives a pointer to a MODULE_INFO
 * object that describes the module. Its job is to call the Receive function on
@@ -197,590 +559,2410 @@ static int module_worker(void * user_data)
 {
     /*Codes_SRS_BROKER_13_026: [This function shall assign `user_data` to a local variable called `module_info` of type `BROKER_MODULEINFO*`.]*/
     BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)user_data;
+    size_t batch_size = receive_batch_size(module_info);
+
+    /*Codes_SRS_BROKER_30_082: [ Before its loop, this function shall apply module_info->thread_scheduling to its thread by calling ThreadScheduling_Apply if it changes any setting; if that fails, the function shall continue. ]*/
+    apply_thread_scheduling(&(module_info->thread_scheduling));
+
+    /*Codes_SRS_BROKER_30_133: [ Before its loop, this function shall enable the message cache of its thread by calling Message_EnableThreadCache, and it shall call Message_DisableThreadCache before it returns. ]*/
+    Message_EnableThreadCache();
 
     int should_continue = 1;
+    /*whether this thread set module_info->receiving*/
+    bool receiving = false;
     while (should_continue)
     {
-        /*Codes_SRS_BROKER_13_089: [ This function shall acquire the lock on module_info->socket_lock. ]*/
-        if (Lock(module_info->socket_lock))
+        /*Codes_SRS_BROKER_30_001: [ This function shall acquire the lock on module_info->mq_lock. ]*/
+        if (Lock(module_info->mq_lock) != LOCK_OK)
         {
             /*Codes_SRS_BROKER_02_004: [ If acquiring the lock fails, then module_worker shall return. ]*/
             LogError("unable to Lock");
             should_continue = 0;
-            break;
         }
-        int nn_fd = module_info->receive_socket;
-        int nbytes;
-        unsigned char *buf = NULL;
-
-        /*Codes_SRS_BROKER_17_005: [ For every iteration of the loop, the function shall wait on the receive_socket for messages. ]*/
-        nbytes = nn_recv(nn_fd, (void *)&buf, NN_MSG, 0);
-        /*Codes_SRS_BROKER_13_091: [ The function shall unlock module_info->socket_lock. ]*/
-        if (Unlock(module_info->socket_lock) != LOCK_OK)
+        else
         {
-            /*Codes_SRS_BROKER_17_016: [ If releasing the lock fails, then module_worker shall return. ]*/
-            should_continue = 0;
-            if (nbytes > 0)
+            MESSAGE_HANDLE messages[BROKER_RECEIVE_BATCH_SIZE];
+            size_t count = 0;
+
+            if (receiving)
             {
-                /*Codes_SRS_BROKER_17_019: [ The function shall free the buffer received on the receive_socket. ]*/
-                nn_freemsg(buf);
+                record_delivery(module_info);
+                module_info->receiving = false;
+                receiving = false;
             }
-            break;
-        }
 
-        if (nbytes < 0)
-        {
-            /*Codes_SRS_BROKER_17_006: [ An error on receiving a message shall terminate the loop. ]*/
-            should_continue = 0;
-        }
-        else
-        {
-            if (nbytes == BROKER_GUID_SIZE &&
-                (strncmp(STRING_c_str(module_info->quit_message_guid), (const char *)buf, BROKER_GUID_SIZE-1)==0))
+            /*Codes_SRS_BROKER_30_002: [ If module_info->quit_worker is false and module_info->mq is empty, this function shall wait on module_info->mq_cond. ]*/
+            /*Codes_SRS_BROKER_30_111: [ A module's thread shall not dequeue messages while a publisher delivers to the module inline; it shall wait on module_info->mq_cond instead. ]*/
+            if (module_info->quit_worker == false &&
+                (MESSAGE_QUEUE_is_empty(module_info->mq) == true || module_info->receiving == true) &&
+                Condition_Wait(module_info->mq_cond, module_info->mq_lock, 0) != COND_OK)
             {
-                /*Codes_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_message_guid is sent to the thread. ]*/
-                /* received special quit message for this module */
+                /*Codes_SRS_BROKER_30_003: [ If waiting on module_info->mq_cond fails, then module_worker shall return. ]*/
+                LogError("Condition_Wait failed");
                 should_continue = 0;
             }
-            else
+            else if (module_info->quit_worker == true)
+            {
+                /*Codes_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_worker is set to true. ]*/
+                should_continue = 0;
+            }
+            else if (module_info->receiving == false)
+            {
+                /*Codes_SRS_BROKER_30_004: [ This function shall dequeue the oldest message from module_info->mq. ]*/
+                /*Codes_SRS_BROKER_30_067: [ If the module implements Module_ReceiveBatch, this function shall dequeue up to BROKER_RECEIVE_BATCH_SIZE messages instead. ]*/
+                count = dequeue_messages(module_info, messages, batch_size);
+                if (count > 0)
+                {
+                    module_info->receiving = true;
+                    receiving = true;
+                }
+            }
+
+            /*Codes_SRS_BROKER_13_091: [ The function shall unlock module_info->mq_lock before delivering the message. ]*/
+            if (Unlock(module_info->mq_lock) != LOCK_OK)
+            {
+                /*Codes_SRS_BROKER_17_016: [ If releasing the lock fails, then module_worker shall return. ]*/
+                LogError("unable to Unlock");
+                should_continue = 0;
+            }
+
+            /*Codes_SRS_BROKER_17_018: [ If no message was dequeued, the message loop shall continue. ]*/
+            if (count > 0)
             {
-                /*Codes_SRS_BROKER_17_024: [ The function shall strip off the topic from the message. ]*/
-                const unsigned char*buf_bytes = (const unsigned char*)buf;
-                buf_bytes += sizeof(MODULE_HANDLE);
-                /*Codes_SRS_BROKER_17_017: [ The function shall deserialize the message received. ]*/
-                MESSAGE_HANDLE msg = Message_CreateFromByteArray(buf_bytes, nbytes - sizeof(MODULE_HANDLE));
-                /*Codes_SRS_BROKER_17_018: [ If the deserialization is not successful, the message loop shall continue. ]*/
-                if (msg != NULL)
+                if (should_continue)
                 {
-                    /*Codes_SRS_BROKER_13_092: [The function shall deliver the message to the module's callback function via module_info->module_apis. ]*/
-                    MODULE_RECEIVE(module_info->module->module_apis)(module_info->module->module_handle, msg);
-                    /*Codes_SRS_BROKER_13_093: [ The function shall destroy the message that was dequeued by calling Message_Destroy. ]*/
-                    Message_Destroy(msg);
+                    deliver_messages(module_info, messages, count);
                 }
+                /*Codes_SRS_BROKER_13_093: [ The function shall destroy the message that was dequeued by calling Message_Destroy. ]*/
+                destroy_messages(messages, count);
             }
-            /*Codes_SRS_BROKER_17_019: [ The function shall free the buffer received on the receive_socket. ]*/
-            nn_freemsg(buf);
-        }    
+        }
     }
 
+    Message_DisableThreadCache();
     return 0;
 }
 
-static BROKER_RESULT init_module(BROKER_MODULEINFO* module_info, const MODULE* module)
+/*puts module_info at the end of a ready list and wakes an idle worker. worker is the
+worker whose ready list gets the module, or NULL to spread the modules made ready by
+publishers over all the workers. Returns 0 if success, otherwise __LINE__*/
+static int schedule_module(BROKER_SCHEDULER* scheduler, BROKER_WORKER* worker, BROKER_MODULEINFO* module_info)
 {
-    BROKER_RESULT result;
+    int result;
 
-    /*Codes_SRS_BROKER_13_107: The function shall assign the `module` handle to `BROKER_MODULEINFO::module`.*/
-    module_info->module = (MODULE*)malloc(sizeof(MODULE));
-    if (module_info->module == NULL)
+    if (Lock(scheduler->idle_lock) != LOCK_OK)
     {
-        LogError("Allocate module failed");
-        result = BROKER_ERROR;
+        LogError("Lock on scheduler->idle_lock failed");
+        result = __LINE__;
     }
     else
     {
-        module_info->module->module_apis = module->module_apis;
-        module_info->module->module_handle = module->module_handle;
+        if (worker == NULL)
+        {
+            /*Codes_SRS_BROKER_30_059: [ A module made ready by Broker_Publish shall be added to the ready lists of the workers in turn. ]*/
+            worker = &(scheduler->workers[scheduler->next_worker]);
+            scheduler->next_worker = (scheduler->next_worker + 1) % scheduler->worker_count;
+        }
 
-        /*Codes_SRS_BROKER_13_099: [The function shall initialize BROKER_MODULEINFO::socket_lock with a valid lock handle.]*/
-        module_info->socket_lock = Lock_Init();
-        if (module_info->socket_lock == NULL)
+        if (Lock(worker->ready_lock) != LOCK_OK)
         {
-            /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-            LogError("Lock_Init for socket lock failed");
-            result = BROKER_ERROR;
+            LogError("Lock on worker->ready_lock failed");
+            result = __LINE__;
         }
         else
         {
-            char uuid[BROKER_GUID_SIZE];
-            memset(uuid, 0, BROKER_GUID_SIZE);
-            /*Codes_SRS_BROKER_17_020: [ The function shall create a unique ID used as a quit signal. ]*/
-            if (UniqueId_Generate(uuid, BROKER_GUID_SIZE) != UNIQUEID_OK)
+            if (singlylinkedlist_add(worker->ready, module_info) == NULL)
             {
-                /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-                LogError("Lock_Init for socket lock failed");
-                Lock_Deinit(module_info->socket_lock);
-                result = BROKER_ERROR;
+                LogError("unable to add module [%p] to a ready list", module_info);
+                result = __LINE__;
             }
             else
             {
-                module_info->quit_message_guid = STRING_construct(uuid);
-                if (module_info->quit_message_guid == NULL)
+                /*Codes_SRS_BROKER_30_060: [ Adding a module to a ready list shall signal BROKER_SCHEDULER::idle_cond if a worker is idle. ]*/
+                scheduler->ready_count++;
+                if (scheduler->idle_workers > 0)
                 {
-                    /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-                    LogError("String construct failed for module guid");
-                    Lock_Deinit(module_info->socket_lock);
-                    result = BROKER_ERROR;
-                }
-                else
-                {
-                    result = BROKER_OK;
+                    (void)Condition_Post(scheduler->idle_cond);
                 }
+                result = 0;
             }
+            (void)Unlock(worker->ready_lock);
         }
+        (void)Unlock(scheduler->idle_lock);
     }
+
     return result;
 }
 
-static void deinit_module(BROKER_MODULEINFO* module_info)
+/*takes back a module that could not be added to a ready list; its messages are
+delivered once it is made ready again*/
+static void unschedule_module(BROKER_MODULEINFO* module_info)
 {
-    /*Codes_SRS_BROKER_13_057: [The function shall free all members of the MODULE_INFO object.]*/
-    Lock_Deinit(module_info->socket_lock);
-    STRING_delete(module_info->quit_message_guid);
-    free(module_info->module);
+    if (Lock(module_info->mq_lock) != LOCK_OK)
+    {
+        /* at the cost of a data race, clear the flag anyway so that the module can be removed */
+        LogError("Lock on module_info->mq_lock failed");
+        module_info->scheduled = false;
+    }
+    else
+    {
+        module_info->scheduled = false;
+        if (module_info->quit_worker == true)
+        {
+            (void)Condition_Post(module_info->mq_cond);
+        }
+        (void)Unlock(module_info->mq_lock);
+    }
 }
 
-static BROKER_RESULT start_module(BROKER_MODULEINFO* module_info, STRING_HANDLE url)
+/*takes a module out of the worker's own ready list or, when that one is empty,
+steals one from the ready list of another worker. The worker must have claimed a
+ready module, so there is one to find*/
+static BROKER_MODULEINFO* take_ready_module(BROKER_WORKER* worker)
 {
-    BROKER_RESULT result;
+    BROKER_SCHEDULER* scheduler = worker->scheduler;
+    size_t index = (size_t)(worker - scheduler->workers);
+    BROKER_MODULEINFO* result = NULL;
 
-    /* Connect to pub/sub */
-    /*Codes_SRS_BROKER_17_013: [ The function shall create a nanomsg socket for reception. ]*/
-    module_info->receive_socket = nn_socket(AF_SP, NN_SUB);
-    if (module_info->receive_socket < 0)
-    {
-        /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-        LogError("module receive socket create failed");
-        result = BROKER_ERROR;
-    }
-    else
+    while (result == NULL)
     {
-        /*Codes_SRS_BROKER_17_014: [ The function shall bind the socket to the the BROKER_HANDLE_DATA::url. ]*/
-        int connect_result = nn_connect(module_info->receive_socket, STRING_c_str(url));
-        if (connect_result < 0)
+        BROKER_WORKER* victim = &(scheduler->workers[index]);
+        if (Lock(victim->ready_lock) != LOCK_OK)
         {
-            /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-            LogError("nn_connect failed");
-            nn_close(module_info->receive_socket);
-            module_info->receive_socket = -1;
-            result = BROKER_ERROR;
+            LogError("Lock on victim->ready_lock failed");
         }
         else
         {
-            /* Codes_SRS_BROKER_17_028: [ The function shall subscribe BROKER_MODULEINFO::receive_socket to the quit signal GUID. ]*/
-            if (nn_setsockopt(
-                module_info->receive_socket, NN_SUB, NN_SUB_SUBSCRIBE, STRING_c_str(module_info->quit_message_guid), STRING_length(module_info->quit_message_guid)) < 0)
-            {
-                /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-                LogError("nn_setsockopt failed");
-                nn_close(module_info->receive_socket);
-                module_info->receive_socket = -1;
-                result = BROKER_ERROR;
-            }
-            else
+            LIST_ITEM_HANDLE ready_item = singlylinkedlist_get_head_item(victim->ready);
+            if (ready_item != NULL)
             {
-                /*Codes_SRS_BROKER_13_102: [The function shall create a new thread for the module by calling ThreadAPI_Create using module_worker as the thread callback and using the newly allocated BROKER_MODULEINFO object as the thread context.*/
-                if (ThreadAPI_Create(
-                    &(module_info->thread),
-                    module_worker,
-                    (void*)module_info
-                ) != THREADAPI_OK)
-                {
-                    /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
-                    LogError("ThreadAPI_Create failed");
-                    nn_close(module_info->receive_socket);
-                    result = BROKER_ERROR;
-                }
-                else
-                {
-                    result = BROKER_OK;
-                }
+                result = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(ready_item);
+                (void)singlylinkedlist_remove(victim->ready, ready_item);
             }
+            (void)Unlock(victim->ready_lock);
         }
+        index = (index + 1) % scheduler->worker_count;
     }
 
     return result;
 }
 
-/*stop module means: stop the thread that feeds messages to Module_Receive function + deletion of all queued messages */
-/*returns 0 if success, otherwise __LINE__*/
-static int stop_module(int publish_socket, BROKER_MODULEINFO* module_info)
+/*delivers messages to a module taken from a ready list, up to BROKER_SCHEDULER_QUANTUM
+times, then puts the module back at the end of the worker's own ready list if it still
+has messages, so that the other ready modules get their turn. The last turn only
+clears receiving*/
+static void run_module(BROKER_WORKER* worker, BROKER_MODULEINFO* module_info)
 {
-    int  quit_result, close_result, thread_result, result;
+    bool is_scheduled = true;
+    /*whether this worker set module_info->receiving*/
+    bool receiving = false;
+    size_t batch_size = receive_batch_size(module_info);
+    size_t turn = 0;
 
-    /*Codes_SRS_BROKER_17_021: [ This function shall send a quit signal to the worker thread by sending BROKER_MODULEINFO::quit_message_guid to the publish_socket. ]*/
-    /* send the unique quite id for this module */
-    if ((quit_result = nn_send(publish_socket, STRING_c_str(module_info->quit_message_guid), BROKER_GUID_SIZE, 0)) < 0)
+    while (is_scheduled && turn <= BROKER_SCHEDULER_QUANTUM)
     {
-        /*Codes_SRS_BROKER_17_015: [ This function shall close the BROKER_MODULEINFO::receive_socket. ]*/
-        /* at the cost of a data race, we will close the socket to terminate the thread */
-        nn_close(module_info->receive_socket);
-        LogError("unable to peacefully close thread for module [%p], nn_send error [%d], taking harsher methods", module_info, quit_result);
-    }
-    else
-    {
-        /*Codes_SRS_BROKER_02_001: [ Broker_RemoveModule shall lock BROKER_MODULEINFO::socket_lock. ]*/
-        if (Lock(module_info->socket_lock) != LOCK_OK)
+        if (Lock(module_info->mq_lock) != LOCK_OK)
         {
-            /*Codes_SRS_BROKER_17_015: [ This function shall close the BROKER_MODULEINFO::receive_socket. ]*/
-            /* at the cost of a data race, we will close the socket to terminate the thread */
-            nn_close(module_info->receive_socket);
-            LogError("unable to peacefully close thread for module [%p], Lock error, taking harsher methods", module_info );
+            /* at the cost of a data race, clear the flag anyway so that the module can be removed */
+            LogError("unable to Lock");
+            module_info->scheduled = false;
+            if (receiving)
+            {
+                module_info->receiving = false;
+            }
+            is_scheduled = false;
         }
         else
         {
-            /*Codes_SRS_BROKER_17_015: [ This function shall close the BROKER_MODULEINFO::receive_socket. ]*/
-            close_result = nn_close(module_info->receive_socket);
-            if (close_result < 0)
+            MESSAGE_HANDLE messages[BROKER_RECEIVE_BATCH_SIZE];
+            size_t count = 0;
+
+            if (receiving)
             {
-                LogError("Receive socket close failed for module at  item [%p] failed", module_info);
+                record_delivery(module_info);
+                module_info->receiving = false;
+                receiving = false;
             }
-            else
+
+            /*Codes_SRS_BROKER_30_112: [ A worker shall clear BROKER_MODULEINFO::scheduled without dequeuing if a publisher delivers to the module inline; the publisher makes the module ready again when it is done. ]*/
+            if (module_info->quit_worker == true ||
+                module_info->receiving == true ||
+                MESSAGE_QUEUE_is_empty(module_info->mq) == true)
+            {
+                /*Codes_SRS_BROKER_30_063: [ A worker shall clear BROKER_MODULEINFO::scheduled once the module's mq is empty or the module is being removed, and shall signal BROKER_MODULEINFO::mq_cond if it is being removed. ]*/
+                module_info->scheduled = false;
+                is_scheduled = false;
+                if (module_info->quit_worker == true)
+                {
+                    (void)Condition_Post(module_info->mq_cond);
+                }
+            }
+            else if (turn < BROKER_SCHEDULER_QUANTUM)
             {
-                /*all is fine, thread will eventually stop and be joined*/
+                /*Codes_SRS_BROKER_30_062: [ A worker shall dequeue the oldest message of the module's mq and deliver it to the module, as the module's own thread would, for up to BROKER_SCHEDULER_QUANTUM deliveries. ]*/
+                count = dequeue_messages(module_info, messages, batch_size);
+                if (count > 0)
+                {
+                    module_info->receiving = true;
+                    receiving = true;
+                }
             }
-            /*Codes_SRS_BROKER_02_003: [ After closing the socket, Broker_RemoveModule shall unlock BROKER_MODULEINFO::info_lock. ]*/
-            if (Unlock(module_info->socket_lock) != LOCK_OK)
+            (void)Unlock(module_info->mq_lock);
+
+            if (count > 0)
             {
-                LogError("unable to unlock socket lock");
+                deliver_messages(module_info, messages, count);
+                destroy_messages(messages, count);
             }
         }
+        turn++;
     }
-    /*Codes_SRS_BROKER_13_104: [The function shall wait for the module's thread to exit by joining BROKER_MODULEINFO::thread via ThreadAPI_Join. ]*/
-    if (ThreadAPI_Join(module_info->thread, &thread_result) != THREADAPI_OK)
-    {
-        result = __LINE__;
-        LogError("ThreadAPI_Join() returned an error.");
-    }
-    else
+
+    /*Codes_SRS_BROKER_30_064: [ If the module still has messages after BROKER_SCHEDULER_QUANTUM deliveries, the worker shall add it to the end of its own ready list. ]*/
+    if (is_scheduled && schedule_module(worker->scheduler, worker, module_info) != 0)
     {
-        result = 0;
+        unschedule_module(module_info);
     }
-    return result;
 }
 
-BROKER_RESULT Broker_AddModule(BROKER_HANDLE broker, const MODULE* module)
+/**
+* This function runs for each worker of the broker's pool. It receives a pointer to
+* the BROKER_WORKER object that describes the worker. Its job is to wait for modules
+* that have messages to deliver and to run them.
+*/
+static int pool_worker(void * user_data)
 {
-    BROKER_RESULT result;
+    BROKER_WORKER* worker = (BROKER_WORKER*)user_data;
+    BROKER_SCHEDULER* scheduler = worker->scheduler;
 
-    /*Codes_SRS_BROKER_99_013: [If `broker` or `module` is NULL the function shall return BROKER_INVALIDARG.]*/
-    if (broker == NULL || module == NULL)
+    /*Codes_SRS_BROKER_30_083: [ Before it runs any module, a worker shall apply scheduler->thread_scheduling to its thread by calling ThreadScheduling_Apply if it changes any setting; if that fails, the worker shall continue. ]*/
+    apply_thread_scheduling(&(scheduler->thread_scheduling));
+
+    /*Codes_SRS_BROKER_30_134: [ Before it runs any module, a worker shall enable the message cache of its thread by calling Message_EnableThreadCache, and it shall call Message_DisableThreadCache before it returns. ]*/
+    Message_EnableThreadCache();
+
+    int should_continue = 1;
+    while (should_continue)
+    {
+        if (Lock(scheduler->idle_lock) != LOCK_OK)
+        {
+            LogError("unable to Lock");
+            should_continue = 0;
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_30_061: [ A worker shall wait on BROKER_SCHEDULER::idle_cond while no module is ready and BROKER_SCHEDULER::quit_workers is false. ]*/
+            while (should_continue &&
+                scheduler->quit_workers == false &&
+                scheduler->ready_count == 0)
+            {
+                scheduler->idle_workers++;
+                if (Condition_Wait(scheduler->idle_cond, scheduler->idle_lock, 0) != COND_OK)
+                {
+                    LogError("Condition_Wait failed");
+                    should_continue = 0;
+                }
+                scheduler->idle_workers--;
+            }
+
+            if (scheduler->quit_workers == true)
+            {
+                /*Codes_SRS_BROKER_30_065: [ A worker shall return once BROKER_SCHEDULER::quit_workers is set, after signaling BROKER_SCHEDULER::idle_cond for the next worker. ]*/
+                (void)Condition_Post(scheduler->idle_cond);
+                should_continue = 0;
+            }
+            else if (should_continue)
+            {
+                /*claim one of the ready modules, take_ready_module finds it*/
+                scheduler->ready_count--;
+            }
+            (void)Unlock(scheduler->idle_lock);
+
+            if (should_continue)
+            {
+                run_module(worker, take_ready_module(worker));
+            }
+        }
+    }
+
+    Message_DisableThreadCache();
+    return 0;
+}
+
+static int start_worker(BROKER_SCHEDULER* scheduler, BROKER_WORKER* worker)
+{
+    int result;
+
+    worker->scheduler = scheduler;
+    worker->ready = singlylinkedlist_create();
+    if (worker->ready == NULL)
+    {
+        LogError("unable to create a ready list");
+        result = __LINE__;
+    }
+    else
+    {
+        worker->ready_lock = Lock_Init();
+        if (worker->ready_lock == NULL)
+        {
+            LogError("Lock_Init for ready lock failed");
+            singlylinkedlist_destroy(worker->ready);
+            result = __LINE__;
+        }
+        /*Codes_SRS_BROKER_30_053: [ Broker_CreateWithScheduler shall create a thread for each worker by calling ThreadAPI_Create using pool_worker as the thread callback. ]*/
+        else if (ThreadAPI_Create(&(worker->thread), pool_worker, (void*)worker) != THREADAPI_OK)
+        {
+            LogError("ThreadAPI_Create failed");
+            Lock_Deinit(worker->ready_lock);
+            singlylinkedlist_destroy(worker->ready);
+            result = __LINE__;
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+static BROKER_SCHEDULER* scheduler_create(const BROKER_SCHEDULER_CONFIG* config)
+{
+    BROKER_SCHEDULER* result = (BROKER_SCHEDULER*)malloc(sizeof(BROKER_SCHEDULER));
+    if (result == NULL)
+    {
+        LogError("unable to allocate the worker pool");
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_30_052: [ If scheduler->worker_count is 0, the pool shall have one worker per processor core, as returned by ProcessorCount_Get. ]*/
+        size_t worker_count = (config->worker_count == 0) ? ProcessorCount_Get() : config->worker_count;
+
+        result->worker_count = 0;
+        result->ready_count = 0;
+        result->idle_workers = 0;
+        result->next_worker = 0;
+        result->quit_workers = false;
+        result->thread_scheduling = config->thread_scheduling;
+        result->workers = (BROKER_WORKER*)malloc(worker_count * sizeof(BROKER_WORKER));
+        if (result->workers == NULL)
+        {
+            LogError("unable to allocate the workers");
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            result->idle_lock = Lock_Init();
+            if (result->idle_lock == NULL)
+            {
+                LogError("Lock_Init for idle lock failed");
+                free(result->workers);
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                result->idle_cond = Condition_Init();
+                if (result->idle_cond == NULL)
+                {
+                    LogError("Condition_Init for idle condition failed");
+                    Lock_Deinit(result->idle_lock);
+                    free(result->workers);
+                    free(result);
+                    result = NULL;
+                }
+                else
+                {
+                    while (result->worker_count < worker_count &&
+                        start_worker(result, &(result->workers[result->worker_count])) == 0)
+                    {
+                        result->worker_count++;
+                    }
+
+                    if (result->worker_count < worker_count)
+                    {
+                        /*stops the workers started so far*/
+                        scheduler_destroy(result);
+                        result = NULL;
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+static void scheduler_destroy(BROKER_SCHEDULER* scheduler)
+{
+    size_t i;
+
+    /*Codes_SRS_BROKER_30_066: [ Broker_Destroy shall set BROKER_SCHEDULER::quit_workers, signal BROKER_SCHEDULER::idle_cond and wait for every worker to exit by calling ThreadAPI_Join. ]*/
+    if (Lock(scheduler->idle_lock) != LOCK_OK)
+    {
+        /* at the cost of a data race, we will set the flag anyway to terminate the workers */
+        LogError("unable to peacefully stop the worker pool, Lock error, taking harsher methods");
+        scheduler->quit_workers = true;
+        (void)Condition_Post(scheduler->idle_cond);
+    }
+    else
+    {
+        scheduler->quit_workers = true;
+        (void)Condition_Post(scheduler->idle_cond);
+        (void)Unlock(scheduler->idle_lock);
+    }
+
+    for (i = 0; i < scheduler->worker_count; i++)
+    {
+        int thread_result;
+        if (ThreadAPI_Join(scheduler->workers[i].thread, &thread_result) != THREADAPI_OK)
+        {
+            LogError("ThreadAPI_Join() returned an error.");
+        }
+        singlylinkedlist_destroy(scheduler->workers[i].ready);
+        Lock_Deinit(scheduler->workers[i].ready_lock);
+    }
+
+    Condition_Deinit(scheduler->idle_cond);
+    Lock_Deinit(scheduler->idle_lock);
+    free(scheduler->workers);
+    free(scheduler);
+}
+
+/*compiles expression into *filter, or sets *filter to NULL if expression is NULL.
+Returns 0 if success, otherwise __LINE__*/
+static int filter_create(const char* expression, BROKER_FILTER** filter)
+{
+    int result;
+    if (expression == NULL)
+    {
+        *filter = NULL;
+        result = 0;
+    }
+    else if ((*filter = REFCOUNT_TYPE_CREATE(BROKER_FILTER)) == NULL)
+    {
+        LogError("unable to allocate a link filter");
+        result = __LINE__;
+    }
+    else
+    {
+        size_t length = strlen(expression) + 1;
+        (*filter)->expression = (char*)malloc(length);
+        if ((*filter)->expression == NULL)
+        {
+            LogError("unable to copy link filter \"%s\"", expression);
+            free(*filter);
+            result = __LINE__;
+        }
+        else
+        {
+            (void)memcpy((*filter)->expression, expression, length);
+            (*filter)->compiled = LinkFilter_Create(expression);
+            if ((*filter)->compiled == NULL)
+            {
+                LogError("unable to compile link filter \"%s\"", expression);
+                free((*filter)->expression);
+                free(*filter);
+                result = __LINE__;
+            }
+            else
+            {
+                result = 0;
+            }
+        }
+    }
+    return result;
+}
+
+/*drops a reference on filter, which may be NULL*/
+static void filter_release(BROKER_FILTER* filter)
+{
+    if (filter != NULL && DEC_REF(BROKER_FILTER, filter) == DEC_RETURN_ZERO)
+    {
+        LinkFilter_Destroy(filter->compiled);
+        free(filter->expression);
+        free(filter);
+    }
+}
+
+/*copies key into *coalesce and splits it into property names that it interns, or sets
+*coalesce to NULL if key is NULL. Returns 0 if success, otherwise __LINE__*/
+static int coalesce_create(const char* key, BROKER_COALESCE** coalesce)
+{
+    int result;
+    if (key == NULL)
+    {
+        *coalesce = NULL;
+        result = 0;
+    }
+    else if ((*coalesce = REFCOUNT_TYPE_CREATE(BROKER_COALESCE)) == NULL)
+    {
+        LogError("unable to allocate a coalesce key");
+        result = __LINE__;
+    }
+    else
+    {
+        size_t length = strlen(key) + 1;
+        (*coalesce)->key = (char*)malloc(2 * length);
+        if ((*coalesce)->key == NULL)
+        {
+            LogError("unable to copy coalesce key \"%s\"", key);
+            free(*coalesce);
+            result = __LINE__;
+        }
+        else
+        {
+            /*the names are split out of a second copy of the key, right after the first*/
+            char* name = (*coalesce)->key + length;
+            (void)memcpy((*coalesce)->key, key, length);
+            (void)memcpy(name, key, length);
+            (*coalesce)->key_count = 0;
+            result = 0;
+
+            while (result == 0 && name != NULL)
+            {
+                char* separator = strchr(name, ',');
+                char* end;
+                if (separator != NULL)
+                {
+                    *separator = '\0';
+                }
+                while (*name == ' ')
+                {
+                    name++;
+                }
+                end = name + strlen(name);
+                while (end > name && *(end - 1) == ' ')
+                {
+                    end--;
+                }
+                *end = '\0';
+
+                if (end == name || (*coalesce)->key_count == BROKER_COALESCE_MAX_NAMES)
+                {
+                    LogError("invalid coalesce key \"%s\"", key);
+                    result = __LINE__;
+                }
+                else if (((*coalesce)->keys[(*coalesce)->key_count] = Message_InternKey(name)) == MESSAGE_KEY_NONE)
+                {
+                    LogError("unable to intern the property \"%s\" of coalesce key \"%s\"", name, key);
+                    result = __LINE__;
+                }
+                else
+                {
+                    (*coalesce)->key_count++;
+                    name = (separator == NULL) ? NULL : separator + 1;
+                }
+            }
+
+            if (result != 0)
+            {
+                free((*coalesce)->key);
+                free(*coalesce);
+            }
+        }
+    }
+    return result;
+}
+
+/*drops a reference on coalesce, which may be NULL*/
+static void coalesce_release(BROKER_COALESCE* coalesce)
+{
+    if (coalesce != NULL && DEC_REF(BROKER_COALESCE, coalesce) == DEC_RETURN_ZERO)
+    {
+        free(coalesce->key);
+        free(coalesce);
+    }
+}
+
+static BROKER_RESULT init_module(BROKER_MODULEINFO* module_info, const MODULE* module, const BROKER_INBOX_CONFIG* inbox, BROKER_SCHEDULER* scheduler)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_13_107: The function shall assign the `module` handle to `BROKER_MODULEINFO::module`.*/
+    module_info->module = (MODULE*)malloc(sizeof(MODULE));
+    if (module_info->module == NULL)
+    {
+        LogError("Allocate module failed");
+        result = BROKER_ERROR;
+    }
+    else
+    {
+        module_info->module->module_apis = module->module_apis;
+        module_info->module->module_handle = module->module_handle;
+        module_info->quit_worker = false;
+        module_info->receiving = false;
+        /*Codes_SRS_BROKER_30_107: [ The function shall set BROKER_MODULEINFO::inline_delivery to inbox->inline_delivery, or to false if inbox is NULL. ]*/
+        module_info->inline_delivery = (inbox != NULL && inbox->inline_delivery);
+        module_info->blocked_publishers = 0;
+        module_info->drop_count = 0;
+        module_info->coalesce_key = MESSAGE_KEY_NONE;
+        module_info->scheduled = false;
+        /*Codes_SRS_BROKER_30_084: [ The function shall set every counter of BROKER_MODULEINFO::statistics to 0, and BROKER_MODULEINFO::link_statistics to an empty array. ]*/
+        memset(&(module_info->statistics), 0, sizeof(BROKER_MODULE_STATISTICS));
+        module_info->has_pending_latency = false;
+        module_info->pending_expired = 0;
+        module_info->link_statistics = NULL;
+        module_info->link_statistics_count = 0;
+        /*Codes_SRS_BROKER_30_128: [ The function shall copy inbox->slow_receive_threshold, inbox->on_health_changed and inbox->health_context into BROKER_MODULEINFO, or set them to 0 and NULL if inbox is NULL, and shall not mark the module slow. ]*/
+        module_info->slow_receive_threshold = (inbox == NULL) ? 0 : inbox->slow_receive_threshold;
+        module_info->on_health_changed = (inbox == NULL) ? NULL : inbox->on_health_changed;
+        module_info->health_context = (inbox == NULL) ? NULL : inbox->health_context;
+        module_info->slow = false;
+        module_info->slow_streak = 0;
+
+        /*Codes_SRS_BROKER_30_054: [ If the broker has a worker pool and inbox is NULL or inbox->dedicated_thread is false, the module shall run on the worker pool. ]*/
+        /*Codes_SRS_BROKER_30_080: [ A module whose inbox->thread_scheduling changes any setting shall not run on the worker pool. ]*/
+        bool own_scheduling = (inbox != NULL && THREAD_SCHEDULING_IS_SET(&(inbox->thread_scheduling)));
+        module_info->scheduler = (inbox == NULL || (inbox->dedicated_thread == false && own_scheduling == false)) ? scheduler : NULL;
+
+        /*Codes_SRS_BROKER_30_081: [ The function shall set BROKER_MODULEINFO::thread_scheduling to inbox->thread_scheduling if it changes any setting, otherwise to the thread scheduling of the worker pool, if any. ]*/
+        if (own_scheduling)
+        {
+            module_info->thread_scheduling = inbox->thread_scheduling;
+        }
+        else if (scheduler != NULL)
+        {
+            module_info->thread_scheduling = scheduler->thread_scheduling;
+        }
+        else
+        {
+            memset(&(module_info->thread_scheduling), 0, sizeof(THREAD_SCHEDULING_CONFIG));
+        }
+
+        /*Codes_SRS_BROKER_30_033: [ The function shall set BROKER_MODULEINFO::inbox_capacity to inbox->capacity, or to BROKER_DEFAULT_INBOX_CAPACITY if inbox is NULL or inbox->capacity is 0. ]*/
+        module_info->inbox_capacity = (inbox == NULL || inbox->capacity == 0) ? BROKER_DEFAULT_INBOX_CAPACITY : inbox->capacity;
+        /*Codes_SRS_BROKER_30_034: [ The function shall set BROKER_MODULEINFO::overflow_policy to inbox->overflow_policy, or to BROKER_OVERFLOW_BLOCK_PUBLISHER if inbox is NULL. ]*/
+        module_info->overflow_policy = (inbox == NULL) ? BROKER_OVERFLOW_BLOCK_PUBLISHER : inbox->overflow_policy;
+
+        /*Codes_SRS_BROKER_30_005: [ The function shall initialize BROKER_MODULEINFO::mq with a valid message queue. ]*/
+        module_info->mq = MESSAGE_QUEUE_create();
+        if (module_info->mq == NULL)
+        {
+            /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+            LogError("MESSAGE_QUEUE_create failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_13_099: [The function shall initialize BROKER_MODULEINFO::mq_lock with a valid lock handle.]*/
+            module_info->mq_lock = Lock_Init();
+            if (module_info->mq_lock == NULL)
+            {
+                /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+                LogError("Lock_Init for mq lock failed");
+                MESSAGE_QUEUE_destroy(module_info->mq);
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_30_006: [ The function shall initialize BROKER_MODULEINFO::mq_cond with a valid condition handle. ]*/
+                module_info->mq_cond = Condition_Init();
+                if (module_info->mq_cond == NULL)
+                {
+                    /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+                    LogError("Condition_Init failed");
+                    Lock_Deinit(module_info->mq_lock);
+                    MESSAGE_QUEUE_destroy(module_info->mq);
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_30_035: [ The function shall initialize BROKER_MODULEINFO::space_cond with a valid condition handle. ]*/
+                    module_info->space_cond = Condition_Init();
+                    if (module_info->space_cond == NULL)
+                    {
+                        /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+                        LogError("Condition_Init for space condition failed");
+                        Condition_Deinit(module_info->mq_cond);
+                        Lock_Deinit(module_info->mq_lock);
+                        MESSAGE_QUEUE_destroy(module_info->mq);
+                        result = BROKER_ERROR;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_BROKER_30_007: [ The function shall initialize BROKER_MODULEINFO::sources with an empty vector of BROKER_SOURCE. ]*/
+                        module_info->sources = VECTOR_create(sizeof(BROKER_SOURCE));
+                        if (module_info->sources == NULL)
+                        {
+                            /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+                            LogError("VECTOR_create failed for module sources");
+                            Condition_Deinit(module_info->space_cond);
+                            Condition_Deinit(module_info->mq_cond);
+                            Lock_Deinit(module_info->mq_lock);
+                            MESSAGE_QUEUE_destroy(module_info->mq);
+                            result = BROKER_ERROR;
+                        }
+                        else if (module_info->overflow_policy == BROKER_OVERFLOW_COALESCE_BY_KEY)
+                        {
+                            /*Codes_SRS_BROKER_30_037: [ If the overflow policy is BROKER_OVERFLOW_COALESCE_BY_KEY, the function shall intern inbox->coalesce_key with Message_InternKey and keep the result in BROKER_MODULEINFO::coalesce_key. ]*/
+                            module_info->coalesce_key = Message_InternKey(inbox->coalesce_key);
+                            if (module_info->coalesce_key == MESSAGE_KEY_NONE)
+                            {
+                                /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+                                LogError("unable to intern the coalesce key");
+                                VECTOR_destroy(module_info->sources);
+                                Condition_Deinit(module_info->space_cond);
+                                Condition_Deinit(module_info->mq_cond);
+                                Lock_Deinit(module_info->mq_lock);
+                                MESSAGE_QUEUE_destroy(module_info->mq);
+                                result = BROKER_ERROR;
+                            }
+                            else
+                            {
+                                result = BROKER_OK;
+                            }
+                        }
+                        else
+                        {
+                            result = BROKER_OK;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+static void deinit_module(BROKER_MODULEINFO* module_info)
+{
+    size_t i;
+    size_t source_count = VECTOR_size(module_info->sources);
+
+    /*Codes_SRS_BROKER_13_057: [The function shall free all members of the MODULE_INFO object.]*/
+    /*Codes_SRS_BROKER_30_008: [ The function shall destroy all messages that are still queued for the module. ]*/
+    MESSAGE_QUEUE_destroy(module_info->mq);
+    for (i = 0; i < source_count; i++)
+    {
+        BROKER_SOURCE* source = (BROKER_SOURCE*)VECTOR_element(module_info->sources, i);
+        filter_release(source->filter);
+        coalesce_release(source->coalesce);
+    }
+    VECTOR_destroy(module_info->sources);
+    Condition_Deinit(module_info->space_cond);
+    Condition_Deinit(module_info->mq_cond);
+    Lock_Deinit(module_info->mq_lock);
+    if (module_info->link_statistics != NULL)
+    {
+        free(module_info->link_statistics);
+    }
+    free(module_info->module);
+}
+
+static BROKER_RESULT start_module(BROKER_MODULEINFO* module_info)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_13_102: [The function shall create a new thread for the module by calling ThreadAPI_Create using module_worker as the thread callback and using the newly allocated BROKER_MODULEINFO object as the thread context.*/
+    if (ThreadAPI_Create(
+        &(module_info->thread),
+        module_worker,
+        (void*)module_info
+    ) != THREADAPI_OK)
+    {
+        /*Codes_SRS_BROKER_13_047: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+        LogError("ThreadAPI_Create failed");
+        result = BROKER_ERROR;
+    }
+    else
+    {
+        result = BROKER_OK;
+    }
+
+    return result;
+}
+
+/*waits until no publisher delivers a message to the module inline. Called once the
+module's thread has exited, so that publishers are the only ones to signal mq_cond.
+Returns 0 if success, otherwise __LINE__*/
+static int wait_for_inline_delivery(BROKER_MODULEINFO* module_info)
+{
+    int result;
+
+    if (Lock(module_info->mq_lock) != LOCK_OK)
+    {
+        LogError("unable to wait for the inline deliveries to module [%p], Lock error", module_info);
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+        /*Codes_SRS_BROKER_30_113: [ Broker_RemoveModule shall not return while a publisher delivers to the module inline; it shall wait on BROKER_MODULEINFO::mq_cond until BROKER_MODULEINFO::receiving is false. ]*/
+        while (result == 0 && module_info->receiving == true)
+        {
+            if (Condition_Wait(module_info->mq_cond, module_info->mq_lock, 0) != COND_OK)
+            {
+                LogError("Condition_Wait failed");
+                result = __LINE__;
+            }
+        }
+        (void)Unlock(module_info->mq_lock);
+    }
+
+    return result;
+}
+
+/*stop module means: stop the thread that feeds messages to Module_Receive function + deletion of all queued messages */
+/*returns 0 if success, otherwise __LINE__*/
+static int stop_module(BROKER_MODULEINFO* module_info)
+{
+    int thread_result, result;
+
+    /*Codes_SRS_BROKER_02_001: [ Broker_RemoveModule shall lock BROKER_MODULEINFO::mq_lock. ]*/
+    if (Lock(module_info->mq_lock) != LOCK_OK)
+    {
+        /*Codes_SRS_BROKER_30_009: [ If the lock cannot be acquired, Broker_RemoveModule shall still set BROKER_MODULEINFO::quit_worker and signal BROKER_MODULEINFO::mq_cond. ]*/
+        /* at the cost of a data race, we will set the flag anyway to terminate the thread */
+        module_info->quit_worker = true;
+        (void)Condition_Post(module_info->mq_cond);
+        if (module_info->blocked_publishers > 0)
+        {
+            (void)Condition_Post(module_info->space_cond);
+        }
+        LogError("unable to peacefully close thread for module [%p], Lock error, taking harsher methods", module_info);
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_17_021: [ This function shall send a quit signal to the worker thread by setting BROKER_MODULEINFO::quit_worker to true and signaling BROKER_MODULEINFO::mq_cond. ]*/
+        module_info->quit_worker = true;
+        if (Condition_Post(module_info->mq_cond) != COND_OK)
+        {
+            LogError("Condition_Post failed for module at item [%p]", module_info);
+        }
+        /*Codes_SRS_BROKER_30_038: [ If publishers are waiting for room in the module's inbox, Broker_RemoveModule shall signal BROKER_MODULEINFO::space_cond so that they stop waiting. ]*/
+        if (module_info->blocked_publishers > 0 &&
+            Condition_Post(module_info->space_cond) != COND_OK)
+        {
+            LogError("Condition_Post failed for blocked publishers of module [%p]", module_info);
+        }
+        /*Codes_SRS_BROKER_02_003: [ After signaling the worker, Broker_RemoveModule shall unlock BROKER_MODULEINFO::mq_lock. ]*/
+        if (Unlock(module_info->mq_lock) != LOCK_OK)
+        {
+            LogError("unable to unlock mq lock");
+        }
+    }
+    /*Codes_SRS_BROKER_13_104: [The function shall wait for the module's thread to exit by joining BROKER_MODULEINFO::thread via ThreadAPI_Join. ]*/
+    if (ThreadAPI_Join(module_info->thread, &thread_result) != THREADAPI_OK)
+    {
+        result = __LINE__;
+        LogError("ThreadAPI_Join() returned an error.");
+    }
+    else if (module_info->inline_delivery)
+    {
+        result = wait_for_inline_delivery(module_info);
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+/*takes a module that runs on the worker pool out of the pool: no worker runs it once this returns.
+returns 0 if success, otherwise __LINE__*/
+static int leave_pool(BROKER_MODULEINFO* module_info)
+{
+    int result;
+
+    if (Lock(module_info->mq_lock) != LOCK_OK)
+    {
+        LogError("unable to take module [%p] out of the worker pool, Lock error", module_info);
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+
+        /*Codes_SRS_BROKER_30_056: [ If the module runs on the worker pool, Broker_RemoveModule shall set BROKER_MODULEINFO::quit_worker under BROKER_MODULEINFO::mq_lock and wait on BROKER_MODULEINFO::mq_cond until BROKER_MODULEINFO::scheduled is false. ]*/
+        module_info->quit_worker = true;
+        /*Codes_SRS_BROKER_30_038: [ If publishers are waiting for room in the module's inbox, Broker_RemoveModule shall signal BROKER_MODULEINFO::space_cond so that they stop waiting. ]*/
+        if (module_info->blocked_publishers > 0 &&
+            Condition_Post(module_info->space_cond) != COND_OK)
+        {
+            LogError("Condition_Post failed for blocked publishers of module [%p]", module_info);
+        }
+        /*Codes_SRS_BROKER_30_113: [ Broker_RemoveModule shall not return while a publisher delivers to the module inline; it shall wait on BROKER_MODULEINFO::mq_cond until BROKER_MODULEINFO::receiving is false. ]*/
+        while (result == 0 &&
+            (module_info->scheduled == true || module_info->receiving == true))
+        {
+            if (Condition_Wait(module_info->mq_cond, module_info->mq_lock, 0) != COND_OK)
+            {
+                LogError("Condition_Wait failed");
+                result = __LINE__;
+            }
+        }
+        (void)Unlock(module_info->mq_lock);
+    }
+
+    return result;
+}
+
+BROKER_RESULT Broker_AddModuleWithInbox(BROKER_HANDLE broker, const MODULE* module, const BROKER_INBOX_CONFIG* inbox)
+{
+    BROKER_RESULT result;
+
+    /*Codes_SRS_BROKER_30_031: [ Broker_AddModuleWithInbox shall meet every requirement of Broker_AddModule. ]*/
+    /*Codes_SRS_BROKER_99_013: [If `broker` or `module` is NULL the function shall return BROKER_INVALIDARG.]*/
+    if (broker == NULL || module == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    /*Codes_SRS_BROKER_99_014: [If `module_handle` or `module_apis` are `NULL` the function shall return `BROKER_INVALIDARG`.]*/
+    else if (module->module_apis == NULL || module->module_handle == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    /*Codes_SRS_BROKER_30_032: [ If inbox->overflow_policy is not a BROKER_OVERFLOW_POLICY value, or is BROKER_OVERFLOW_COALESCE_BY_KEY and inbox->coalesce_key is NULL, the function shall return BROKER_INVALIDARG. ]*/
+    else if (inbox != NULL &&
+        (inbox->overflow_policy < BROKER_OVERFLOW_BLOCK_PUBLISHER ||
+         inbox->overflow_policy > BROKER_OVERFLOW_COALESCE_BY_KEY ||
+         (inbox->overflow_policy == BROKER_OVERFLOW_COALESCE_BY_KEY && inbox->coalesce_key == NULL)))
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid inbox configuration.");
+    }
+    else
+    {
+        BROKER_MODULEINFO* module_info = REFCOUNT_TYPE_CREATE(BROKER_MODULEINFO);
+        if (module_info == NULL)
+        {
+            LogError("Allocate module info failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+            if (init_module(module_info, module, inbox, broker_data->scheduler) != BROKER_OK)
+            {
+                /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+                LogError("init_module failed");
+                free(module_info->module);
+                free(module_info);
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_13_039: [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]*/
+                if (Lock(broker_data->modules_lock) != LOCK_OK)
+                {
+                    /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+                    LogError("Lock on broker_data->modules_lock failed");
+                    deinit_module(module_info);
+                    free(module_info);
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_13_045: [Broker_AddModule shall append the new instance of BROKER_MODULEINFO to BROKER_HANDLE_DATA::modules.]*/
+                    LIST_ITEM_HANDLE moduleListItem = singlylinkedlist_add(broker_data->modules, module_info);
+                    if (moduleListItem == NULL)
+                    {
+                        /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+                        LogError("singlylinkedlist_add failed");
+                        deinit_module(module_info);
+                        free(module_info);
+                        result = BROKER_ERROR;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_BROKER_30_055: [ A module that runs on the worker pool shall not get a thread of its own. ]*/
+                        if (module_info->scheduler == NULL && start_module(module_info) != BROKER_OK)
+                        {
+                            LogError("start_module failed");
+                            deinit_module(module_info);
+                            singlylinkedlist_remove(broker_data->modules, moduleListItem);
+                            free(module_info);
+                            result = BROKER_ERROR;
+                        }
+                        else
+                        {
+                            /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+                            result = BROKER_OK;
+                        }
+                    }
+
+                    /*Codes_SRS_BROKER_13_046: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]*/
+                    Unlock(broker_data->modules_lock);
+                }
+            }
+
+        }
+    }
+
+    return result;
+}
+
+BROKER_RESULT Broker_AddModule(BROKER_HANDLE broker, const MODULE* module)
+{
+    /*Codes_SRS_BROKER_30_030: [ Broker_AddModule shall add the module with the default inbox, as Broker_AddModuleWithInbox does when inbox is NULL. ]*/
+    return Broker_AddModuleWithInbox(broker, module, NULL);
+}
+
+static bool find_module_predicate(LIST_ITEM_HANDLE list_item, const void* value)
+{
+    BROKER_MODULEINFO* element = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(list_item);
+    return element->module->module_handle == ((MODULE*)value)->module_handle;
+}
+
+/*What Broker_RemoveLinkWithOptions looks for in the sources of the sink*/
+typedef struct BROKER_SOURCE_MATCH_TAG
+{
+    const BROKER_LINK_DATA*     link;
+    /** NULL to match any link from the source */
+    const BROKER_LINK_OPTIONS*  options;
+}BROKER_SOURCE_MATCH;
+
+static bool find_source_predicate(const void* element, const void* value)
+{
+    const BROKER_SOURCE* source = (const BROKER_SOURCE*)element;
+    const BROKER_SOURCE_MATCH* match = (const BROKER_SOURCE_MATCH*)value;
+    const char* filter = (source->filter == NULL) ? NULL : source->filter->expression;
+    return source->link.module_source_handle == match->link->module_source_handle &&
+        (match->options == NULL ||
+        (filter == NULL && match->options->filter == NULL) ||
+        (filter != NULL && match->options->filter != NULL && strcmp(filter, match->options->filter) == 0));
+}
+
+static int route_compare(const void* left, const void* right)
+{
+    const BROKER_ROUTE* left_route = (const BROKER_ROUTE*)left;
+    const BROKER_ROUTE* right_route = (const BROKER_ROUTE*)right;
+    int result;
+
+    if (left_route->source != right_route->source)
+    {
+        result = ((uintptr_t)left_route->source < (uintptr_t)right_route->source) ? -1 : 1;
+    }
+    else if (left_route->sink != right_route->sink)
+    {
+        result = ((uintptr_t)left_route->sink < (uintptr_t)right_route->sink) ? -1 : 1;
+    }
+    else if (left_route->priority != right_route->priority)
+    {
+        /*the highest priority link between a source and a sink comes first*/
+        result = (left_route->priority > right_route->priority) ? -1 : 1;
+    }
+    else if ((left_route->filter == NULL) != (right_route->filter == NULL))
+    {
+        /*of links of the same priority, the one without a filter comes first*/
+        result = (left_route->filter == NULL) ? -1 : 1;
+    }
+    else
+    {
+        result = 0;
+    }
+
+    return result;
+}
+
+/*drops a reference on module_info; the module is freed once it has been removed
+from the broker and no topology routes to it anymore*/
+static void module_info_release(BROKER_MODULEINFO* module_info)
+{
+    /*Codes_SRS_BROKER_30_028: [ A module shall stay allocated until it has been removed from the broker and no topology routes to it. ]*/
+    if (DEC_REF(BROKER_MODULEINFO, module_info) == DEC_RETURN_ZERO)
+    {
+        deinit_module(module_info);
+        free(module_info);
+    }
+}
+
+static void topology_release(BROKER_TOPOLOGY* topology)
+{
+    if (DEC_REF(BROKER_TOPOLOGY, topology) == DEC_RETURN_ZERO)
+    {
+        size_t i;
+        for (i = 0; i < topology->route_count; i++)
+        {
+            filter_release(topology->routes[i].filter);
+            coalesce_release(topology->routes[i].coalesce);
+            module_info_release(topology->routes[i].sink);
+        }
+        free(topology->routes);
+        free(topology);
+    }
+}
+
+/*returns the current topology, with a reference the caller releases with
+topology_release. Readers count themselves in the current epoch while they
+load the pointer and take the reference; update_topology flips the epoch after
+it swaps the pointer and waits for the readers of the previous epoch to leave
+before it drops its own reference on the previous topology. A reader that
+counted itself in an epoch that was flipped meanwhile starts over, so that the
+wait is only ever for the few instructions below*/
+static BROKER_TOPOLOGY* topology_acquire(BROKER_HANDLE_DATA* broker_data)
+{
+    BROKER_TOPOLOGY* result = NULL;
+    while (result == NULL)
+    {
+        long epoch = broker_data->topology_epoch;
+        (void)BROKER_INCREMENT(&(broker_data->topology_readers[epoch]));
+        if (broker_data->topology_epoch == epoch)
+        {
+            result = broker_data->topology;
+            INC_REF(BROKER_TOPOLOGY, result);
+        }
+        (void)BROKER_DECREMENT(&(broker_data->topology_readers[epoch]));
+    }
+    return result;
+}
+
+/*returns the index of the counters module_info keeps for the links from source, or
+module_info->link_statistics_count if it has none*/
+static size_t find_link_statistics(const BROKER_MODULEINFO* module_info, MODULE_HANDLE source)
+{
+    size_t i = 0;
+    while (i < module_info->link_statistics_count &&
+        module_info->link_statistics[i].source != source)
+    {
+        i++;
+    }
+    return i;
+}
+
+/*builds a new topology out of the sources of every module.
+excluded_source, when not NULL, points to an element of some module's sources that is left out.
+excluded_module, when not NULL, is a module that gets no route at all.
+Returns NULL if the topology cannot be built*/
+static BROKER_TOPOLOGY* topology_create(BROKER_HANDLE_DATA* broker_data, const BROKER_SOURCE* excluded_source, const BROKER_MODULEINFO* excluded_module)
+{
+    BROKER_TOPOLOGY* result;
+    size_t route_count = 0;
+    LIST_ITEM_HANDLE module_info_item = singlylinkedlist_get_head_item(broker_data->modules);
+    while (module_info_item != NULL)
+    {
+        BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+        if (module_info != excluded_module)
+        {
+            route_count += VECTOR_size(module_info->sources);
+        }
+        module_info_item = singlylinkedlist_get_next_item(module_info_item);
+    }
+    if (excluded_source != NULL)
+    {
+        route_count--;
+    }
+
+    result = REFCOUNT_TYPE_CREATE(BROKER_TOPOLOGY);
+    if (result == NULL)
+    {
+        /*Codes_SRS_BROKER_30_018: [ If the new topology cannot be built, the current topology shall be kept. ]*/
+        LogError("unable to allocate the topology");
+    }
+    else if (route_count == 0)
+    {
+        result->routes = NULL;
+        result->route_count = 0;
+    }
+    else
+    {
+        result->routes = (BROKER_ROUTE*)malloc(route_count * sizeof(BROKER_ROUTE));
+        if (result->routes == NULL)
+        {
+            /*Codes_SRS_BROKER_30_018: [ If the new topology cannot be built, the current topology shall be kept. ]*/
+            LogError("unable to allocate the routing table");
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            size_t route_index = 0;
+            size_t i;
+
+            module_info_item = singlylinkedlist_get_head_item(broker_data->modules);
+            while (module_info_item != NULL)
+            {
+                BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+                if (module_info != excluded_module)
+                {
+                    size_t source_count = VECTOR_size(module_info->sources);
+                    for (i = 0; i < source_count; i++)
+                    {
+                        BROKER_SOURCE* source = (BROKER_SOURCE*)VECTOR_element(module_info->sources, i);
+                        if (source != excluded_source)
+                        {
+                            result->routes[route_index].source = source->link.module_source_handle;
+                            result->routes[route_index].sink = module_info;
+                            result->routes[route_index].priority = source->priority;
+                            result->routes[route_index].filter = source->filter;
+                            result->routes[route_index].coalesce = source->coalesce;
+                            result->routes[route_index].statistics_index = find_link_statistics(module_info, source->link.module_source_handle);
+                            route_index++;
+                        }
+                    }
+                }
+                module_info_item = singlylinkedlist_get_next_item(module_info_item);
+            }
+
+            /*Codes_SRS_BROKER_30_017: [ The routing table shall hold one entry per distinct source and sink pair, sorted by source. ]*/
+            /*Codes_SRS_BROKER_30_078: [ If a source and a sink are linked more than once, the entry shall have the highest priority of these links. ]*/
+            /*Codes_SRS_BROKER_30_099: [ A link with a filter shall have an entry of its own, after the entries of the higher priority links between the same source and sink, unless one of these links has no filter. ]*/
+            qsort(result->routes, route_count, sizeof(BROKER_ROUTE), route_compare);
+            result->route_count = 1;
+            for (i = 1; i < route_count; i++)
+            {
+                if (result->routes[i].source != result->routes[result->route_count - 1].source ||
+                    result->routes[i].sink != result->routes[result->route_count - 1].sink ||
+                    result->routes[result->route_count - 1].filter != NULL)
+                {
+                    result->routes[result->route_count] = result->routes[i];
+                    result->route_count++;
+                }
+            }
+
+            /*every route keeps its sink, its filter and its coalesce key alive for as long as the topology is in use*/
+            for (i = 0; i < result->route_count; i++)
+            {
+                INC_REF(BROKER_MODULEINFO, result->routes[i].sink);
+                if (result->routes[i].filter != NULL)
+                {
+                    INC_REF(BROKER_FILTER, result->routes[i].filter);
+                }
+                if (result->routes[i].coalesce != NULL)
+                {
+                    INC_REF(BROKER_COALESCE, result->routes[i].coalesce);
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+/*builds a new topology (see topology_create) and swaps it in place of the current one.
+Must be called with modules_lock held. Returns 0 if success, otherwise __LINE__*/
+static int update_topology(BROKER_HANDLE_DATA* broker_data, const BROKER_SOURCE* excluded_source, const BROKER_MODULEINFO* excluded_module)
+{
+    int result;
+    BROKER_TOPOLOGY* topology = topology_create(broker_data, excluded_source, excluded_module);
+    if (topology == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_30_019: [ A new topology shall replace the current topology atomically, only once it is complete, without a lock that publishers take. ]*/
+        BROKER_TOPOLOGY* previous_topology = broker_data->topology;
+        long previous_epoch = broker_data->topology_epoch;
+        BROKER_MEMORY_BARRIER();
+        broker_data->topology = topology;
+        BROKER_MEMORY_BARRIER();
+        broker_data->topology_epoch = 1 - previous_epoch;
+        BROKER_MEMORY_BARRIER();
+
+        /*Codes_SRS_BROKER_30_026: [ The broker shall release its reference on the previous topology only once no publisher is between reading the topology pointer and taking a reference on it. ]*/
+        while (broker_data->topology_readers[previous_epoch] != 0)
+        {
+            ThreadAPI_Sleep(0);
+        }
+
+        /*publishers that still use the previous topology keep it alive until they are done*/
+        topology_release(previous_topology);
+        result = 0;
+    }
+    return result;
+}
+
+/*returns the index of the first route for source, or route_count if there is none*/
+static size_t find_first_route(const BROKER_TOPOLOGY* topology, MODULE_HANDLE source)
+{
+    size_t low = 0;
+    size_t high = topology->route_count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if ((uintptr_t)topology->routes[middle].source < (uintptr_t)source)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+BROKER_RESULT Broker_RemoveModule(BROKER_HANDLE broker, const MODULE* module)
+{
+    /*Codes_SRS_BROKER_13_048: [If `broker` or `module` is NULL the function shall return BROKER_INVALIDARG.]*/
+    BROKER_RESULT result;
+    if (broker == NULL || module == NULL)
+    {
+        /*Codes_SRS_BROKER_13_053: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_13_088: [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]*/
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_13_049: [Broker_RemoveModule shall perform a linear search for module in BROKER_HANDLE_DATA::modules.]*/
+            LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, module);
+
+            if (module_info_item == NULL)
+            {
+                /*Codes_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]*/
+                LogError("Supplied module is not attached to the broker");
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+
+                /*Codes_SRS_BROKER_30_020: [ Broker_RemoveModule shall replace the topology with one that has no route to the module before stopping the module. ]*/
+                if (update_topology(broker_data, NULL, module_info) != 0)
+                {
+                    /*Codes_SRS_BROKER_30_029: [ If the topology cannot be replaced, Broker_RemoveModule shall leave the module attached and return BROKER_ERROR. ]*/
+                    LogError("unable to remove the module from the topology");
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    int stop_result = (module_info->scheduler == NULL) ? stop_module(module_info) : leave_pool(module_info);
+
+                    /*Codes_SRS_BROKER_13_052: [The function shall remove the module from BROKER_HANDLE_DATA::modules.]*/
+                    singlylinkedlist_remove(broker_data->modules, module_info_item);
+
+                    if (stop_result == 0)
+                    {
+                        module_info_release(module_info);
+                    }
+                    else
+                    {
+                        LogError("unable to stop module, leaking module info [%p]", module_info);
+                    }
+
+                    /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
+                    result = BROKER_OK;
+                }
+            }
+
+            /*Codes_SRS_BROKER_13_054: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]*/
+            Unlock(broker_data->modules_lock);
+        }
+    }
+
+    return result;
+}
+
+BROKER_RESULT Broker_GetModuleDropCount(BROKER_HANDLE broker, const MODULE* module, size_t* drop_count)
+{
+    BROKER_RESULT result;
+    /*Codes_SRS_BROKER_30_046: [ If broker, module or drop_count is NULL, Broker_GetModuleDropCount shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || module == NULL || drop_count == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_30_047: [ Broker_GetModuleDropCount shall lock BROKER_HANDLE_DATA::modules_lock and find module in BROKER_HANDLE_DATA::modules. ]*/
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            /*Codes_SRS_BROKER_30_049: [ Broker_GetModuleDropCount shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]*/
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, module);
+            if (module_info_item == NULL)
+            {
+                /*Codes_SRS_BROKER_30_049: [ Broker_GetModuleDropCount shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]*/
+                LogError("Supplied module is not attached to the broker");
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+                if (Lock(module_info->mq_lock) != LOCK_OK)
+                {
+                    /*Codes_SRS_BROKER_30_049: [ Broker_GetModuleDropCount shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]*/
+                    LogError("Lock on module_info->mq_lock failed");
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_30_048: [ Broker_GetModuleDropCount shall read BROKER_MODULEINFO::drop_count under BROKER_MODULEINFO::mq_lock into drop_count and return BROKER_OK. ]*/
+                    *drop_count = module_info->drop_count;
+                    (void)Unlock(module_info->mq_lock);
+                    result = BROKER_OK;
+                }
+            }
+            (void)Unlock(broker_data->modules_lock);
+        }
+    }
+    return result;
+}
+
+BROKER_MODULEINFO* broker_locate_handle(BROKER_HANDLE_DATA* broker_data, MODULE_HANDLE handle)
+{
+    BROKER_MODULEINFO* result;
+    MODULE module;
+    module.module_apis = NULL;
+    module.module_handle = handle;
+
+    LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, &module);
+    if (module_info_item == NULL)
+    {
+        result = NULL;
+    }
+    else
+    {
+        result = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+    }
+    return result;
+}
+
+BROKER_RESULT Broker_GetStatistics(BROKER_HANDLE broker, const MODULE* module, BROKER_MODULE_STATISTICS* statistics)
+{
+    BROKER_RESULT result;
+    /*Codes_SRS_BROKER_30_091: [ If broker, module or statistics is NULL, Broker_GetStatistics shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || module == NULL || statistics == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_30_092: [ Broker_GetStatistics shall lock BROKER_HANDLE_DATA::modules_lock and find module in BROKER_HANDLE_DATA::modules. ]*/
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            /*Codes_SRS_BROKER_30_094: [ Broker_GetStatistics shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]*/
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, module);
+            if (module_info_item == NULL)
+            {
+                /*Codes_SRS_BROKER_30_094: [ Broker_GetStatistics shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]*/
+                LogError("Supplied module is not attached to the broker");
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+                if (Lock(module_info->mq_lock) != LOCK_OK)
+                {
+                    /*Codes_SRS_BROKER_30_094: [ Broker_GetStatistics shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]*/
+                    LogError("Lock on module_info->mq_lock failed");
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_30_093: [ Broker_GetStatistics shall copy BROKER_MODULEINFO::statistics under BROKER_MODULEINFO::mq_lock into statistics, fill in queue_depth and max_queue_depth from the module's mq and drops from BROKER_MODULEINFO::drop_count, and return BROKER_OK. ]*/
+                    *statistics = module_info->statistics;
+                    statistics->queue_depth = MESSAGE_QUEUE_size(module_info->mq);
+                    statistics->max_queue_depth = MESSAGE_QUEUE_peak_size(module_info->mq);
+                    statistics->drops = module_info->drop_count;
+                    /*Codes_SRS_BROKER_30_129: [ Broker_GetStatistics shall set slow to whether the module is marked slow. ]*/
+                    statistics->slow = module_info->slow;
+                    (void)Unlock(module_info->mq_lock);
+                    result = BROKER_OK;
+                }
+            }
+            (void)Unlock(broker_data->modules_lock);
+        }
+    }
+    return result;
+}
+
+BROKER_RESULT Broker_ReportExpired(BROKER_HANDLE broker, MODULE_HANDLE module, size_t count)
+{
+    BROKER_RESULT result;
+    /*Codes_SRS_BROKER_30_139: [ If broker or module is NULL, Broker_ReportExpired shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || module == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_30_140: [ Broker_ReportExpired shall lock BROKER_HANDLE_DATA::modules_lock and find module in BROKER_HANDLE_DATA::modules. ]*/
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            /*Codes_SRS_BROKER_30_142: [ Broker_ReportExpired shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]*/
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, module);
+            if (module_info == NULL)
+            {
+                /*Codes_SRS_BROKER_30_142: [ Broker_ReportExpired shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]*/
+                LogError("Supplied module is not attached to the broker");
+                result = BROKER_ERROR;
+            }
+            else if (Lock(module_info->mq_lock) != LOCK_OK)
+            {
+                /*Codes_SRS_BROKER_30_142: [ Broker_ReportExpired shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]*/
+                LogError("Lock on module_info->mq_lock failed");
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_30_141: [ Broker_ReportExpired shall add count to the expired counter of BROKER_MODULEINFO::statistics under BROKER_MODULEINFO::mq_lock and return BROKER_OK. ]*/
+                module_info->statistics.expired += count;
+                (void)Unlock(module_info->mq_lock);
+                result = BROKER_OK;
+            }
+            (void)Unlock(broker_data->modules_lock);
+        }
+    }
+    return result;
+}
+
+BROKER_RESULT Broker_GetLinkStatistics(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, BROKER_LINK_STATISTICS* statistics)
+{
+    BROKER_RESULT result;
+    /*Codes_SRS_BROKER_30_095: [ If broker, link, link->module_source_handle, link->module_sink_handle or statistics is NULL, Broker_GetLinkStatistics shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || link == NULL || link->module_source_handle == NULL || link->module_sink_handle == NULL || statistics == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    else
+    {
+        /*Codes_SRS_BROKER_30_096: [ Broker_GetLinkStatistics shall lock BROKER_HANDLE_DATA::modules_lock and find the BROKER_MODULEINFO for link->module_sink_handle. ]*/
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        {
+            /*Codes_SRS_BROKER_30_098: [ Broker_GetLinkStatistics shall return BROKER_ERROR if the sink is not attached to the broker, if it was never linked to the source, or if an underlying API call to the platform causes an error. ]*/
+            LogError("Lock on broker_data->modules_lock failed");
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, link->module_sink_handle);
+            if (module_info == NULL)
+            {
+                /*Codes_SRS_BROKER_30_098: [ Broker_GetLinkStatistics shall return BROKER_ERROR if the sink is not attached to the broker, if it was never linked to the source, or if an underlying API call to the platform causes an error. ]*/
+                LogError("Link->sink is not attached to the broker");
+                result = BROKER_ERROR;
+            }
+            else if (Lock(module_info->mq_lock) != LOCK_OK)
+            {
+                /*Codes_SRS_BROKER_30_098: [ Broker_GetLinkStatistics shall return BROKER_ERROR if the sink is not attached to the broker, if it was never linked to the source, or if an underlying API call to the platform causes an error. ]*/
+                LogError("Lock on module_info->mq_lock failed");
+                result = BROKER_ERROR;
+            }
+            else
+            {
+                size_t index = find_link_statistics(module_info, link->module_source_handle);
+                if (index == module_info->link_statistics_count)
+                {
+                    /*Codes_SRS_BROKER_30_098: [ Broker_GetLinkStatistics shall return BROKER_ERROR if the sink is not attached to the broker, if it was never linked to the source, or if an underlying API call to the platform causes an error. ]*/
+                    LogError("Link->sink was never linked to link->source");
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_30_097: [ Broker_GetLinkStatistics shall copy the counters the sink keeps for link->module_source_handle into statistics, under the sink's mq_lock, and return BROKER_OK. ]*/
+                    *statistics = module_info->link_statistics[index].statistics;
+                    result = BROKER_OK;
+                }
+                (void)Unlock(module_info->mq_lock);
+            }
+            (void)Unlock(broker_data->modules_lock);
+        }
+    }
+    return result;
+}
+
+BROKER_RESULT Broker_GetPublishCredit(BROKER_HANDLE broker, MODULE_HANDLE source, size_t* credit)
+{
+    BROKER_RESULT result;
+    /*Codes_SRS_BROKER_30_119: [ If broker, source or credit is NULL, Broker_GetPublishCredit shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || source == NULL || credit == NULL)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("invalid parameter (NULL).");
+    }
+    else
+    {
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        /*Codes_SRS_BROKER_30_120: [ Broker_GetPublishCredit shall take a reference on BROKER_HANDLE_DATA::topology with topology_acquire, without taking a lock, and shall not take BROKER_HANDLE_DATA::modules_lock. ]*/
+        BROKER_TOPOLOGY* topology = topology_acquire(broker_data);
+        /*Codes_SRS_BROKER_30_121: [ Broker_GetPublishCredit shall set credit to the smallest number of free places, inbox capacity minus queued messages, among the inboxes of the sinks routed from source, each read under the sink's mq_lock, or to SIZE_MAX if no sink is routed from source. ]*/
+        size_t smallest = SIZE_MAX;
+        size_t route_index = find_first_route(topology, source);
+        BROKER_MODULEINFO* last_sink = NULL;
+        result = BROKER_OK;
+        while (result == BROKER_OK &&
+            route_index < topology->route_count &&
+            topology->routes[route_index].source == source)
+        {
+            /*the routes of a source are sorted by sink, read each sink once*/
+            BROKER_MODULEINFO* sink = topology->routes[route_index].sink;
+            if (sink != last_sink)
+            {
+                if (Lock(sink->mq_lock) != LOCK_OK)
+                {
+                    /*Codes_SRS_BROKER_30_122: [ Broker_GetPublishCredit shall return BROKER_ERROR if an underlying API call to the platform causes an error. ]*/
+                    LogError("Lock on sink->mq_lock failed");
+                    result = BROKER_ERROR;
+                }
+                else
+                {
+                    size_t queued = MESSAGE_QUEUE_size(sink->mq);
+                    size_t free_places = (queued < sink->inbox_capacity) ? sink->inbox_capacity - queued : 0;
+                    if (free_places < smallest)
+                    {
+                        smallest = free_places;
+                    }
+                    (void)Unlock(sink->mq_lock);
+                }
+                last_sink = sink;
+            }
+            route_index++;
+        }
+
+        if (result == BROKER_OK)
+        {
+            *credit = smallest;
+        }
+
+        /*Codes_SRS_BROKER_30_123: [ Broker_GetPublishCredit shall release its reference on the topology. ]*/
+        topology_release(topology);
+    }
+    return result;
+}
+
+/*makes sure module_info keeps counters for the links from source. Called with
+modules_lock held. Returns 0 if success, otherwise __LINE__*/
+static int add_link_statistics(BROKER_MODULEINFO* module_info, MODULE_HANDLE source)
+{
+    int result;
+    size_t count = module_info->link_statistics_count;
+
+    if (find_link_statistics(module_info, source) < count)
+    {
+        result = 0;
+    }
+    else
+    {
+        BROKER_SOURCE_STATISTICS* link_statistics = (BROKER_SOURCE_STATISTICS*)malloc((count + 1) * sizeof(BROKER_SOURCE_STATISTICS));
+        if (link_statistics == NULL)
+        {
+            LogError("unable to allocate the link statistics");
+            result = __LINE__;
+        }
+        /*publishers update the counters under the sink's mq_lock*/
+        else if (Lock(module_info->mq_lock) != LOCK_OK)
+        {
+            LogError("Lock on module_info->mq_lock failed");
+            free(link_statistics);
+            result = __LINE__;
+        }
+        else
+        {
+            BROKER_SOURCE_STATISTICS* previous = module_info->link_statistics;
+            if (count > 0)
+            {
+                (void)memcpy(link_statistics, previous, count * sizeof(BROKER_SOURCE_STATISTICS));
+            }
+            memset(&(link_statistics[count]), 0, sizeof(BROKER_SOURCE_STATISTICS));
+            link_statistics[count].source = source;
+            module_info->link_statistics = link_statistics;
+            module_info->link_statistics_count = count + 1;
+            (void)Unlock(module_info->mq_lock);
+
+            if (previous != NULL)
+            {
+                free(previous);
+            }
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+BROKER_RESULT Broker_AddLinkWithOptions(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, const BROKER_LINK_OPTIONS* options)
+{
+    BROKER_RESULT result;
+    /*Codes_SRS_BROKER_17_029: [ If broker or link are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || link == NULL || link->module_sink_handle == NULL || link->module_source_handle == NULL)
     {
+        LogError("Broker_AddLink, input is NULL.");
         result = BROKER_INVALIDARG;
-        LogError("invalid parameter (NULL).");
     }
-    /*Codes_SRS_BROKER_99_014: [If `module_handle` or `module_apis` are `NULL` the function shall return `BROKER_INVALIDARG`.]*/
-    else if (module->module_apis == NULL || module->module_handle == NULL)
+    /*Codes_SRS_BROKER_30_077: [ If options->priority is not less than BROKER_LINK_PRIORITIES, Broker_AddLinkWithOptions shall return BROKER_INVALIDARG. ]*/
+    else if (options != NULL && options->priority >= BROKER_LINK_PRIORITIES)
     {
+        LogError("Broker_AddLink, link priority %zu is out of range.", options->priority);
         result = BROKER_INVALIDARG;
-        LogError("invalid parameter (NULL).");
     }
     else
     {
-        BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)malloc(sizeof(BROKER_MODULEINFO));
-        if (module_info == NULL)
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        BROKER_SOURCE source;
+        source.link = *link;
+        /*Codes_SRS_BROKER_30_136: [ If options is NULL, Broker_AddLinkWithOptions shall add the link with the options of a zero initialized BROKER_LINK_OPTIONS. ]*/
+        source.priority = (options == NULL) ? 0 : options->priority;
+        /*Codes_SRS_BROKER_30_100: [ If options->filter is not NULL, Broker_AddLinkWithOptions shall compile it with LinkFilter_Create and keep a copy of it. ]*/
+        if (filter_create((options == NULL) ? NULL : options->filter, &(source.filter)) != 0)
         {
-            LogError("Allocate module info failed");
-            result = BROKER_ERROR;
+            /*Codes_SRS_BROKER_30_101: [ If options->filter cannot be compiled or copied, Broker_AddLinkWithOptions shall return BROKER_ADD_LINK_ERROR. ]*/
+            LogError("Broker_AddLink, unable to create the link filter.");
+            result = BROKER_ADD_LINK_ERROR;
+        }
+        /*Codes_SRS_BROKER_30_115: [ If options->coalesce_key is not NULL, Broker_AddLinkWithOptions shall keep a copy of it and intern with Message_InternKey the property names it lists, separated by commas, ignoring the spaces around them. ]*/
+        else if (coalesce_create((options == NULL) ? NULL : options->coalesce_key, &(source.coalesce)) != 0)
+        {
+            /*Codes_SRS_BROKER_30_116: [ If options->coalesce_key has an empty name or more than BROKER_COALESCE_MAX_NAMES names, or cannot be copied or interned, Broker_AddLinkWithOptions shall return BROKER_ADD_LINK_ERROR. ]*/
+            LogError("Broker_AddLink, unable to create the link coalesce key.");
+            filter_release(source.filter);
+            result = BROKER_ADD_LINK_ERROR;
         }
         else
         {
-            if (init_module(module_info, module) != BROKER_OK)
+            /*Codes_SRS_BROKER_17_030: [ Broker_AddLink shall lock the modules_lock. ]*/
+            if (Lock(broker_data->modules_lock) != LOCK_OK)
             {
-                /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                LogError("start_module failed");
-                free(module_info->module);
-                free(module_info);
-                result = BROKER_ERROR;
+                /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
+                LogError("Broker_AddLink, Lock on broker_data->modules_lock failed");
+                result = BROKER_ADD_LINK_ERROR;
             }
             else
             {
-                /*Codes_SRS_BROKER_13_039: [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]*/
-                BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
-                if (Lock(broker_data->modules_lock) != LOCK_OK)
+                /*Codes_SRS_BROKER_17_031: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->sink. ]*/
+                BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, link->module_sink_handle);
+
+                if (module_info == NULL)
                 {
-                    /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                    LogError("Lock on broker_data->modules_lock failed");
-                    deinit_module(module_info);
-                    free(module_info);
-                    result = BROKER_ERROR;
+                    /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
+                    LogError("Link->sink is not attached to the broker");
+                    result = BROKER_ADD_LINK_ERROR;
                 }
                 else
                 {
-                    /*Codes_SRS_BROKER_13_045: [Broker_AddModule shall append the new instance of BROKER_MODULEINFO to BROKER_HANDLE_DATA::modules.]*/
-                    LIST_ITEM_HANDLE moduleListItem = singlylinkedlist_add(broker_data->modules, module_info);
-                    if (moduleListItem == NULL)
+                    /*Codes_SRS_BROKER_17_041: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_source_handle. ]*/
+                    BROKER_MODULEINFO* source_module = broker_locate_handle(broker_data, link->module_source_handle);
+
+                    if (source_module == NULL)
                     {
-                        /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                        LogError("singlylinkedlist_add failed");
-                        deinit_module(module_info);
-                        free(module_info);
-                        result = BROKER_ERROR;
+                        LogError("Link->source is not attached to the broker");
+                        result = BROKER_ADD_LINK_ERROR;
                     }
                     else
                     {
-                        if (start_module(module_info, broker_data->url) != BROKER_OK)
+                        /*Codes_SRS_BROKER_17_032: [ Broker_AddLink shall add link->module_source_handle to module_info->sources. ]*/
+                        if (VECTOR_push_back(module_info->sources, &source, 1) != 0)
                         {
-                            LogError("start_module failed");
-                            deinit_module(module_info);
-                            singlylinkedlist_remove(broker_data->modules, moduleListItem);
-                            free(module_info);
-                            result = BROKER_ERROR;
+                            /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
+                            LogError("Unable to make link in Broker");
+                            result = BROKER_ADD_LINK_ERROR;
+                        }
+                        /*Codes_SRS_BROKER_30_087: [ Broker_AddLink shall add counters for link->module_source_handle to module_info->link_statistics, under module_info->mq_lock, unless the sink already keeps counters for that source. ]*/
+                        else if (add_link_statistics(module_info, link->module_source_handle) != 0)
+                        {
+                            /*Codes_SRS_BROKER_30_088: [ If the counters cannot be added, Broker_AddLink shall remove link->module_source_handle from module_info->sources and return BROKER_ADD_LINK_ERROR. ]*/
+                            LogError("Unable to add the link statistics");
+                            VECTOR_erase(module_info->sources, VECTOR_back(module_info->sources), 1);
+                            result = BROKER_ADD_LINK_ERROR;
+                        }
+                        /*Codes_SRS_BROKER_30_021: [ Broker_AddLink shall replace the topology with one built from the updated links. ]*/
+                        else if (update_topology(broker_data, NULL, NULL) != 0)
+                        {
+                            /*Codes_SRS_BROKER_30_022: [ If the topology cannot be replaced, Broker_AddLink shall remove link->module_source_handle from module_info->sources and return BROKER_ADD_LINK_ERROR. ]*/
+                            LogError("Unable to update the topology");
+                            VECTOR_erase(module_info->sources, VECTOR_back(module_info->sources), 1);
+                            result = BROKER_ADD_LINK_ERROR;
                         }
                         else
                         {
-                            /*Codes_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
                             result = BROKER_OK;
                         }
                     }
-
-                    /*Codes_SRS_BROKER_13_046: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]*/
-                    Unlock(broker_data->modules_lock);
                 }
+                /*Codes_SRS_BROKER_17_033: [ Broker_AddLink shall unlock the modules_lock. ]*/
+                Unlock(broker_data->modules_lock);
             }
 
+            if (result != BROKER_OK)
+            {
+                filter_release(source.filter);
+                coalesce_release(source.coalesce);
+            }
         }
     }
-
     return result;
 }
 
-static bool find_module_predicate(LIST_ITEM_HANDLE list_item, const void* value)
+BROKER_RESULT Broker_AddLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link)
 {
-    BROKER_MODULEINFO* element = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(list_item);
-    return element->module->module_handle == ((MODULE*)value)->module_handle;
+    /*Codes_SRS_BROKER_30_137: [ Broker_AddLink shall add the link as Broker_AddLinkWithOptions does when options is NULL. ]*/
+    return Broker_AddLinkWithOptions(broker, link, NULL);
 }
 
-BROKER_RESULT Broker_RemoveModule(BROKER_HANDLE broker, const MODULE* module)
+BROKER_RESULT Broker_RemoveLinkWithOptions(BROKER_HANDLE broker, const BROKER_LINK_DATA* link, const BROKER_LINK_OPTIONS* options)
 {
-    /*Codes_SRS_BROKER_13_048: [If `broker` or `module` is NULL the function shall return BROKER_INVALIDARG.]*/
     BROKER_RESULT result;
-    if (broker == NULL || module == NULL)
+    /*Codes_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || link == NULL || link->module_sink_handle == NULL || link->module_source_handle == NULL)
     {
-        /*Codes_SRS_BROKER_13_053: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+        LogError("Broker_AddLink, input is NULL.");
         result = BROKER_INVALIDARG;
-        LogError("invalid parameter (NULL).");
     }
     else
     {
-        /*Codes_SRS_BROKER_13_088: [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]*/
         BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        /*Codes_SRS_BROKER_17_036: [ Broker_RemoveLink shall lock the modules_lock. ]*/
         if (Lock(broker_data->modules_lock) != LOCK_OK)
         {
-            /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-            LogError("Lock on broker_data->modules_lock failed");
-            result = BROKER_ERROR;
+            /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
+            LogError("Broker_AddLink, Lock on broker_data->modules_lock failed");
+            result = BROKER_REMOVE_LINK_ERROR;
         }
         else
         {
-            /*Codes_SRS_BROKER_13_049: [Broker_RemoveModule shall perform a linear search for module in BROKER_HANDLE_DATA::modules.]*/
-            LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, module);
+            /*Codes_SRS_BROKER_17_037: [ Broker_RemoveLink shall find the module_info for link->module_sink_handle. ]*/
+            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, link->module_sink_handle);
+
+            if (module_info == NULL)
+            {
+                /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
+                LogError("Link->sink is not attached to the broker");
+                result = BROKER_REMOVE_LINK_ERROR;
+            }
+            else
+            {
+                /*Codes_SRS_BROKER_17_042: [ Broker_RemoveLink shall find the module_info for link->module_source_handle. ]*/
+                BROKER_MODULEINFO* source_module_info = broker_locate_handle(broker_data, link->module_source_handle);
+                if (source_module_info == NULL)
+                {
+                    LogError("Link->source is not attached to the broker");
+                    result = BROKER_REMOVE_LINK_ERROR;
+                }
+                else
+                {
+                    /*Codes_SRS_BROKER_17_038: [ Broker_RemoveLink shall remove one occurrence of link->module_source_handle from module_info->sources. ]*/
+                    /*Codes_SRS_BROKER_30_102: [ If options is not NULL, Broker_RemoveLinkWithOptions shall only remove a link whose filter is the same expression as options->filter, or that has no filter if options->filter is NULL. ]*/
+                    BROKER_SOURCE_MATCH match = { link, options };
+                    BROKER_SOURCE* source = (BROKER_SOURCE*)VECTOR_find_if(module_info->sources, find_source_predicate, &match);
+                    if (source == NULL)
+                    {
+                        /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
+                        LogError("Unable to find link in Broker");
+                        result = BROKER_REMOVE_LINK_ERROR;
+                    }
+                    /*Codes_SRS_BROKER_30_023: [ Broker_RemoveLink shall replace the topology with one built without the link before removing it from module_info->sources. ]*/
+                    else if (update_topology(broker_data, source, NULL) != 0)
+                    {
+                        /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
+                        LogError("Unable to update the topology");
+                        result = BROKER_REMOVE_LINK_ERROR;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_BROKER_30_103: [ Broker_RemoveLink shall release the filter and the coalesce key of the link once no topology uses them. ]*/
+                        BROKER_FILTER* filter = source->filter;
+                        BROKER_COALESCE* coalesce = source->coalesce;
+                        VECTOR_erase(module_info->sources, source, 1);
+                        filter_release(filter);
+                        coalesce_release(coalesce);
+                        result = BROKER_OK;
+                    }
+                }
+            }
+            /*Codes_SRS_BROKER_17_039: [ Broker_RemoveLink shall unlock the modules_lock. ]*/
+            Unlock(broker_data->modules_lock);
+        }
+    }
+    return result;
+}
+
+BROKER_RESULT Broker_RemoveLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link)
+{
+    /*Codes_SRS_BROKER_30_138: [ Broker_RemoveLink shall remove the link as Broker_RemoveLinkWithOptions does when options is NULL. ]*/
+    return Broker_RemoveLinkWithOptions(broker, link, NULL);
+}
+
+static void broker_decrement_ref(BROKER_HANDLE broker)
+{
+    /*Codes_SRS_BROKER_13_058: [If `broker` is NULL the function shall do nothing.]*/
+    if (broker != NULL)
+    {
+        /*Codes_SRS_BROKER_13_111: [Otherwise, Broker_Destroy shall decrement the internal ref count of the message.]*/
+        /*Codes_SRS_BROKER_13_112: [If the ref count is zero then the allocated resources are freed.]*/
+        if (DEC_REF(BROKER_HANDLE_DATA, broker) == DEC_RETURN_ZERO)
+        {
+            BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker; 
+            if (singlylinkedlist_get_head_item(broker_data->modules) != NULL)
+            {
+                LogError("WARNING: There are still active modules attached to the broker and the broker is being destroyed.");
+            }
+            if (broker_data->scheduler != NULL)
+            {
+                scheduler_destroy(broker_data->scheduler);
+            }
+            topology_release(broker_data->topology);
+            singlylinkedlist_destroy(broker_data->modules);
+            Lock_Deinit(broker_data->modules_lock);
+            free(broker_data);
+        }
+    }
+    else
+    {
+        LogError("broker handle is NULL");
+    }
+}
+
+extern void Broker_Destroy(BROKER_HANDLE broker)
+{
+    broker_decrement_ref(broker);
+}
+
+extern void Broker_DecRef(BROKER_HANDLE broker)
+{
+    /*Codes_SRS_BROKER_13_113: [This function shall implement all the requirements of the Broker_Destroy API.]*/
+    broker_decrement_ref(broker);
+}
+
+/*the values of the coalesce key properties that queued messages are compared against*/
+typedef struct COALESCE_MATCH_TAG
+{
+    const MESSAGE_KEY*  keys;
+    size_t              key_count;
+    const char*         values[BROKER_COALESCE_MAX_NAMES];
+}COALESCE_MATCH;
+
+/*runs for every queued message of the lane under mq_lock, so it reads the properties
+in place rather than copying them*/
+static bool coalesce_match_predicate(MESSAGE_HANDLE message, const void* context)
+{
+    const COALESCE_MATCH* match = (const COALESCE_MATCH*)context;
+    bool result = true;
+    size_t i;
+    for (i = 0; result && i < match->key_count; i++)
+    {
+        const char* value = Message_GetPropertyValueByKey(message, match->keys[i]);
+        result = (value != NULL && strcmp(value, match->values[i]) == 0);
+    }
+    return result;
+}
+
+/*puts msg in place of the message queued on lane priority that has the same values for
+the key_count properties in keys; messages on other lanes are left alone so msg keeps
+the lane of its link. Called with mq_lock held. Returns the replaced message, or NULL if
+msg was not queued*/
+static MESSAGE_HANDLE coalesce_message(BROKER_MODULEINFO* module_info, const MESSAGE_KEY* keys, size_t key_count, MESSAGE_HANDLE msg, size_t priority)
+{
+    MESSAGE_HANDLE result;
+    COALESCE_MATCH match;
+    size_t i = 0;
+    match.keys = keys;
+    match.key_count = key_count;
+    while (i < key_count &&
+        (match.values[i] = Message_GetPropertyValueByKey(msg, keys[i])) != NULL)
+    {
+        i++;
+    }
+
+    if (i < key_count)
+    {
+        /*a message without the key has nothing to coalesce with*/
+        result = NULL;
+    }
+    else
+    {
+        result = MESSAGE_QUEUE_replace_if(module_info->mq, coalesce_match_predicate, &match, msg, priority);
+    }
+    return result;
+}
+
+/*waits until mq has room for a message, the module is marked slow or the worker is asked to quit.
+Called with mq_lock held. Returns 0 if success, otherwise __LINE__*/
+static int wait_for_room(BROKER_MODULEINFO* module_info)
+{
+    int result = 0;
+
+    module_info->blocked_publishers++;
+    while (result == 0 &&
+        module_info->quit_worker == false &&
+        module_info->slow == false &&
+        MESSAGE_QUEUE_size(module_info->mq) >= module_info->inbox_capacity)
+    {
+        if (Condition_Wait(module_info->space_cond, module_info->mq_lock, 0) != COND_OK)
+        {
+            LogError("Condition_Wait failed");
+            result = __LINE__;
+        }
+    }
+    module_info->blocked_publishers--;
+
+    if ((module_info->quit_worker == true || module_info->slow == true) && module_info->blocked_publishers > 0)
+    {
+        /*a signal wakes one waiter only, pass the quit or slow signal on to the next blocked publisher*/
+        (void)Condition_Post(module_info->space_cond);
+    }
+
+    return result;
+}
+
+/*makes sure that the messages queued so far are delivered while the publisher waits
+for room. Called with mq_lock held. Returns 0 if success, otherwise __LINE__*/
+static int wake_sink(BROKER_MODULEINFO* module_info, bool* post, bool* schedule)
+{
+    int result = 0;
+
+    if (*post)
+    {
+        (void)Condition_Post(module_info->mq_cond);
+        *post = false;
+    }
+    if (*schedule)
+    {
+        *schedule = false;
+        if (schedule_module(module_info->scheduler, NULL, module_info) != 0)
+        {
+            LogError("unable to add module [%p] to a ready list", module_info);
+            module_info->scheduled = false;
+            result = __LINE__;
+        }
+    }
+
+    return result;
+}
+
+/*queues the clones on the priority lane of the sink's mq, in order, under one acquisition
+of the sink's mq_lock and with one wakeup of the sink. bytes is the size of the content
+of the clones. dropped has room for 2 * count messages, it receives the messages that
+leave the inbox undelivered. Takes ownership of the clones*/
+static BROKER_RESULT enqueue_messages(const BROKER_ROUTE* route, MESSAGE_HANDLE* clones, size_t count, size_t bytes, MESSAGE_HANDLE* dropped)
+{
+    BROKER_RESULT result;
+    BROKER_MODULEINFO* module_info = route->sink;
+    size_t dropped_count = 0;
+    size_t i;
+
+    /*Codes_SRS_BROKER_30_010: [ Broker_Publish shall lock the sink's mq_lock. ]*/
+    if (Lock(module_info->mq_lock) != LOCK_OK)
+    {
+        LogError("Lock on module_info->mq_lock failed");
+        for (i = 0; i < count; i++)
+        {
+            dropped[dropped_count++] = clones[i];
+        }
+        result = BROKER_ERROR;
+    }
+    else
+    {
+        /*whether the sink has to be signaled or made ready for the messages queued so far*/
+        bool post = false;
+        bool schedule = false;
+        BROKER_LINK_STATISTICS* link_statistics = &(module_info->link_statistics[route->statistics_index].statistics);
+
+        result = BROKER_OK;
+
+        /*Codes_SRS_BROKER_30_089: [ Broker_Publish shall add the messages and the size of their content to the messages_in and bytes_in counters of the sink and of the link, under the sink's mq_lock. ]*/
+        module_info->statistics.messages_in += count;
+        module_info->statistics.bytes_in += bytes;
+        link_statistics->messages_in += count;
+        link_statistics->bytes_in += bytes;
+
+        for (i = 0; i < count; i++)
+        {
+            MESSAGE_HANDLE msg = clones[i];
+            MESSAGE_HANDLE evicted;
 
-            if (module_info_item == NULL)
+            /*Codes_SRS_BROKER_30_117: [ If the link has a coalesce key, Broker_Publish shall first put the clone in place of the most recently queued message of the link's priority lane of the sink's mq that has the same values for all the properties of the key, destroy that message and increment the coalesced counter of the link; the sink's mq does not grow and the overflow policy does not apply. ]*/
+            if (route->coalesce != NULL &&
+                module_info->quit_worker == false &&
+                (evicted = coalesce_message(module_info, route->coalesce->keys, route->coalesce->key_count, msg, route->priority)) != NULL)
             {
-                /*Codes_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]*/
-                LogError("Supplied module is not attached to the broker");
-                result = BROKER_ERROR;
+                dropped[dropped_count++] = evicted;
+                link_statistics->coalesced++;
+                msg = NULL;
             }
-            else
+            /*Codes_SRS_BROKER_30_040: [ If the sink's mq holds BROKER_MODULEINFO::inbox_capacity messages, Broker_Publish shall apply the sink's overflow policy. ]*/
+            else if (module_info->quit_worker == false &&
+                MESSAGE_QUEUE_size(module_info->mq) >= module_info->inbox_capacity)
             {
-                BROKER_MODULEINFO* module_info = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
-                if (stop_module(broker_data->publish_socket, module_info) == 0)
+                /*Codes_SRS_BROKER_30_090: [ Broker_Publish shall increment the overflows counter of the link every time it finds the sink's mq full. ]*/
+                link_statistics->overflows++;
+                if (module_info->overflow_policy == BROKER_OVERFLOW_BLOCK_PUBLISHER && module_info->slow == false)
                 {
-                    deinit_module(module_info);
+                    /*Codes_SRS_BROKER_30_041: [ For BROKER_OVERFLOW_BLOCK_PUBLISHER, Broker_Publish shall wait on the sink's space_cond until the sink's mq has room or the sink is being removed. ]*/
+                    /*Codes_SRS_BROKER_30_071: [ Before waiting for room, Broker_PublishBatch shall signal or make ready the sink for the messages of the batch it has already queued. ]*/
+                    if (wake_sink(module_info, &post, &schedule) != 0 ||
+                        wait_for_room(module_info) != 0)
+                    {
+                        /*Codes_SRS_BROKER_30_015: [ If delivery to a sink fails, Broker_Publish shall still deliver to the remaining sinks and return BROKER_ERROR. ]*/
+                        dropped[dropped_count++] = msg;
+                        msg = NULL;
+                        result = BROKER_ERROR;
+                    }
+                    else if (module_info->quit_worker == false &&
+                        MESSAGE_QUEUE_size(module_info->mq) >= module_info->inbox_capacity)
+                    {
+                        /*Codes_SRS_BROKER_30_131: [ If the sink is marked slow while Broker_Publish waits for room, Broker_Publish shall stop waiting and drop the oldest message of the sink's mq as BROKER_OVERFLOW_DROP_OLDEST does. ]*/
+                        dropped[dropped_count++] = MESSAGE_QUEUE_evict(module_info->mq);
+                        module_info->drop_count++;
+                    }
                 }
                 else
                 {
-                    LogError("unable to stop module");
+                    /*Codes_SRS_BROKER_30_130: [ If the sink is marked slow, Broker_Publish shall apply BROKER_OVERFLOW_DROP_OLDEST instead of BROKER_OVERFLOW_BLOCK_PUBLISHER. ]*/
+                    if (module_info->overflow_policy == BROKER_OVERFLOW_DROP_OLDEST ||
+                        module_info->overflow_policy == BROKER_OVERFLOW_BLOCK_PUBLISHER)
+                    {
+                        /*Codes_SRS_BROKER_30_043: [ For BROKER_OVERFLOW_DROP_OLDEST, Broker_Publish shall dequeue and destroy the oldest message of the lowest priority lane of the sink's mq, then queue the clone. ]*/
+                        dropped[dropped_count++] = MESSAGE_QUEUE_evict(module_info->mq);
+                    }
+                    else if (module_info->overflow_policy == BROKER_OVERFLOW_COALESCE_BY_KEY &&
+                        (evicted = coalesce_message(module_info, &(module_info->coalesce_key), 1, msg, route->priority)) != NULL)
+                    {
+                        /*Codes_SRS_BROKER_30_044: [ For BROKER_OVERFLOW_COALESCE_BY_KEY, Broker_Publish shall put the clone in place of the most recently queued message of the clone's priority lane whose coalesce_key property has the same value, and destroy that message. If there is no such message, Broker_Publish shall destroy the clone. ]*/
+                        dropped[dropped_count++] = evicted;
+                        msg = NULL;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_BROKER_30_042: [ For BROKER_OVERFLOW_DROP_NEWEST, Broker_Publish shall destroy the clone. ]*/
+                        dropped[dropped_count++] = msg;
+                        msg = NULL;
+                    }
+                    /*Codes_SRS_BROKER_30_045: [ Broker_Publish shall increment the sink's drop_count for every message that is dropped or replaced because the sink's mq is full. ]*/
+                    module_info->drop_count++;
                 }
+            }
 
-                /*Codes_SRS_BROKER_13_052: [The function shall remove the module from BROKER_HANDLE_DATA::modules.]*/
-                singlylinkedlist_remove(broker_data->modules, module_info_item);
-                free(module_info);
-
-                /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                result = BROKER_OK;
+            if (msg != NULL)
+            {
+                if (module_info->quit_worker == true)
+                {
+                    /*Codes_SRS_BROKER_30_039: [ If the sink is being removed from the broker, Broker_Publish shall destroy the clone instead of queuing it. ]*/
+                    dropped[dropped_count++] = msg;
+                }
+                /*Codes_SRS_BROKER_30_011: [ Broker_Publish shall push the cloned message on the sink's mq. ]*/
+                /*Codes_SRS_BROKER_30_079: [ Broker_Publish shall push the clone on the lane of the sink's mq given by the priority of the link. ]*/
+                else if (MESSAGE_QUEUE_push_with_priority(module_info->mq, msg, route->priority) != 0)
+                {
+                    LogError("unable to queue message [%p]", msg);
+                    dropped[dropped_count++] = msg;
+                    result = BROKER_ERROR;
+                }
+                else if (module_info->scheduler == NULL)
+                {
+                    post = true;
+                }
+                else if (module_info->scheduled == false)
+                {
+                    /*Codes_SRS_BROKER_30_057: [ If the sink runs on the worker pool and BROKER_MODULEINFO::scheduled is false, Broker_Publish shall set it and, once the sink's mq_lock is released, add the sink to a ready list. ]*/
+                    module_info->scheduled = true;
+                    schedule = true;
+                }
             }
+        }
 
-            /*Codes_SRS_BROKER_13_054: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]*/
-            Unlock(broker_data->modules_lock);
+        if (post)
+        {
+            /*Codes_SRS_BROKER_30_012: [ Broker_Publish shall signal the sink's mq_cond. ]*/
+            (void)Condition_Post(module_info->mq_cond);
+        }
+        /*Codes_SRS_BROKER_30_013: [ Broker_Publish shall unlock the sink's mq_lock. ]*/
+        (void)Unlock(module_info->mq_lock);
+
+        if (schedule && schedule_module(module_info->scheduler, NULL, module_info) != 0)
+        {
+            /*Codes_SRS_BROKER_30_058: [ If the sink cannot be added to a ready list, Broker_Publish shall clear BROKER_MODULEINFO::scheduled and return BROKER_ERROR; the message stays queued. ]*/
+            unschedule_module(module_info);
+            result = BROKER_ERROR;
         }
     }
 
+    /*messages that leave the inbox undelivered are destroyed once mq_lock is released*/
+    destroy_messages(dropped, dropped_count);
+
     return result;
 }
 
-BROKER_MODULEINFO* broker_locate_handle(BROKER_HANDLE_DATA* broker_data, MODULE_HANDLE handle)
+/*the size of the content of the message*/
+static size_t content_size(MESSAGE_HANDLE message)
 {
-    BROKER_MODULEINFO* result;
-    MODULE module;
-    module.module_apis = NULL;
-    module.module_handle = handle;
+    const CONSTBUFFER* content = Message_GetContent(message);
+    return (content == NULL) ? 0 : content->size;
+}
 
-    LIST_ITEM_HANDLE module_info_item = singlylinkedlist_find(broker_data->modules, find_module_predicate, &module);
-    if (module_info_item == NULL)
+/*the LINK_FILTER_LOOKUP of a message: reads its properties in place*/
+static const char* message_property_lookup(const void* context, const char* name)
+{
+    return Message_GetPropertyValue((MESSAGE_HANDLE)context, name);
+}
+
+/*returns true if filter, which may be NULL, lets the message through*/
+static bool filter_matches(const BROKER_FILTER* filter, MESSAGE_HANDLE message)
+{
+    bool result;
+    if (filter == NULL)
     {
-        result = NULL;
+        result = true;
     }
     else
     {
-        result = (BROKER_MODULEINFO*)singlylinkedlist_item_get_value(module_info_item);
+        result = LinkFilter_Matches(filter->compiled, message_property_lookup, message);
     }
     return result;
 }
 
-BROKER_RESULT Broker_AddLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link)
+/*returns true if the message travels the route at route_index. The routes from
+sink_route up to route_index are the routes to the same sink, highest priority
+first, and a message only travels the first of them whose filter it matches*/
+static bool route_accepts(const BROKER_ROUTE* routes, size_t sink_route, size_t route_index, MESSAGE_HANDLE message)
 {
-    BROKER_RESULT result;
-    /*Codes_SRS_BROKER_17_029: [ If broker or link are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]*/
-    if (broker == NULL || link == NULL || link->module_sink_handle == NULL || link->module_source_handle == NULL)
+    /*Codes_SRS_BROKER_30_104: [ Broker_Publish shall only deliver the message to a sink on the highest priority link whose filter matches the message properties, as told by LinkFilter_Matches; a link without a filter matches every message. ]*/
+    bool result = filter_matches(routes[route_index].filter, message);
+    while (result && sink_route < route_index)
     {
-        LogError("Broker_AddLink, input is NULL.");
-        result = BROKER_INVALIDARG;
+        result = !filter_matches(routes[sink_route].filter, message);
+        sink_route++;
+    }
+    return result;
+}
+
+/*clears receiving once a publisher is done delivering to the module inline, then
+wakes whoever waits on the module: its thread or a worker for the messages queued
+meanwhile, or Broker_RemoveModule*/
+static void end_inline_delivery(BROKER_MODULEINFO* module_info)
+{
+    bool schedule = false;
+
+    if (Lock(module_info->mq_lock) != LOCK_OK)
+    {
+        /* at the cost of a data race, clear the flag anyway so that the module can be removed */
+        LogError("Lock on module_info->mq_lock failed");
+        module_info->receiving = false;
+        (void)Condition_Post(module_info->mq_cond);
     }
     else
     {
-        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
-        /*Codes_SRS_BROKER_17_030: [ Broker_AddLink shall lock the modules_lock. ]*/
-        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        record_delivery(module_info);
+        module_info->receiving = false;
+        /*Codes_SRS_BROKER_30_110: [ Once the module returns, Broker_Publish shall clear BROKER_MODULEINFO::receiving and signal BROKER_MODULEINFO::mq_cond, or make the sink ready if it runs on the worker pool, if messages were queued for the sink meanwhile or the sink is being removed. ]*/
+        if (module_info->quit_worker == true)
         {
-            /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
-            LogError("Broker_AddLink, Lock on broker_data->modules_lock failed");
-            result = BROKER_ADD_LINK_ERROR;
+            (void)Condition_Post(module_info->mq_cond);
         }
-        else
+        else if (MESSAGE_QUEUE_is_empty(module_info->mq) == false)
         {
-            /*Codes_SRS_BROKER_17_031: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->sink. ]*/
-            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, link->module_sink_handle);
-
-            if (module_info == NULL)
+            if (module_info->scheduler == NULL)
             {
-                /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
-                LogError("Link->sink is not attached to the broker");
-                result = BROKER_ADD_LINK_ERROR;
+                (void)Condition_Post(module_info->mq_cond);
             }
-            else
+            else if (module_info->scheduled == false)
             {
-                /*Codes_SRS_BROKER_17_041: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_source_handle. ]*/
-                BROKER_MODULEINFO* source_module = broker_locate_handle(broker_data, link->module_source_handle);
-
-                if (source_module == NULL)
-                {
-                    LogError("Link->source is not attached to the broker");
-                    result = BROKER_ADD_LINK_ERROR;
-                }
-                else
-                {
-                    /*Codes_SRS_BROKER_17_032: [ Broker_AddLink shall subscribe module_info->receive_socket to the link->source module handle. ]*/
-                    if (nn_setsockopt(
-                        module_info->receive_socket, NN_SUB, NN_SUB_SUBSCRIBE, &(link->module_source_handle), sizeof(MODULE_HANDLE)) < 0)
-                    {
-                        /*Codes_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]*/
-                        LogError("Unable to make link in Broker");
-                        result = BROKER_ADD_LINK_ERROR;
-                    }
-                    else
-                    {
-                        result = BROKER_OK;
-                    }
-                }
+                module_info->scheduled = true;
+                schedule = true;
             }
-            /*Codes_SRS_BROKER_17_033: [ Broker_AddLink shall unlock the modules_lock. ]*/
-            Unlock(broker_data->modules_lock);
+        }
+        (void)Unlock(module_info->mq_lock);
+
+        if (schedule && schedule_module(module_info->scheduler, NULL, module_info) != 0)
+        {
+            LogError("unable to add module [%p] to a ready list", module_info);
+            unschedule_module(module_info);
         }
     }
-    return result;
 }
 
-BROKER_RESULT Broker_RemoveLink(BROKER_HANDLE broker, const BROKER_LINK_DATA* link)
+/*delivers the message to the sink on the calling thread, if the sink takes inline
+delivery and is idle. Returns 0 if the message was delivered, otherwise __LINE__
+and the message is left to be queued*/
+static int deliver_inline(const BROKER_ROUTE* route, MESSAGE_HANDLE message, size_t bytes)
 {
-    BROKER_RESULT result;
-    /*Codes_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]*/
-    if (broker == NULL || link == NULL || link->module_sink_handle == NULL || link->module_source_handle == NULL)
+    int result;
+    BROKER_MODULEINFO* module_info = route->sink;
+
+    if (inline_depth >= BROKER_INLINE_MAX_DEPTH)
     {
-        LogError("Broker_AddLink, input is NULL.");
-        result = BROKER_INVALIDARG;
+        /*Codes_SRS_BROKER_30_109: [ Broker_Publish shall queue the message instead if the calling thread is already in BROKER_INLINE_MAX_DEPTH inline deliveries. ]*/
+        result = __LINE__;
+    }
+    else if (Lock(module_info->mq_lock) != LOCK_OK)
+    {
+        LogError("Lock on module_info->mq_lock failed");
+        result = __LINE__;
     }
     else
     {
-        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
-        /*Codes_SRS_BROKER_17_036: [ Broker_RemoveLink shall lock the modules_lock. ]*/
-        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        /*Codes_SRS_BROKER_30_108: [ If the sink takes inline delivery, its mq is empty, BROKER_MODULEINFO::receiving is false and the sink is not being removed, Broker_Publish shall set BROKER_MODULEINFO::receiving, release the sink's mq_lock and deliver the message itself to the sink on the calling thread, without cloning or queuing it. ]*/
+        /*Codes_SRS_BROKER_30_132: [ Broker_Publish shall not deliver inline to a sink that is marked slow. ]*/
+        if (module_info->quit_worker == true ||
+            module_info->receiving == true ||
+            module_info->slow == true ||
+            MESSAGE_QUEUE_is_empty(module_info->mq) == false)
         {
-            /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
-            LogError("Broker_AddLink, Lock on broker_data->modules_lock failed");
-            result = BROKER_REMOVE_LINK_ERROR;
+            (void)Unlock(module_info->mq_lock);
+            result = __LINE__;
         }
         else
         {
-            /*Codes_SRS_BROKER_17_037: [ Broker_RemoveLink shall find the module_info for link->module_sink_handle. ]*/
-            BROKER_MODULEINFO* module_info = broker_locate_handle(broker_data, link->module_sink_handle);
+            BROKER_LINK_STATISTICS* link_statistics = &(module_info->link_statistics[route->statistics_index].statistics);
 
-            if (module_info == NULL)
-            {
-                /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
-                LogError("Link->sink is not attached to the broker");
-                result = BROKER_REMOVE_LINK_ERROR;
-            }
-            else
-            {
-                /*Codes_SRS_BROKER_17_042: [ Broker_RemoveLink shall find the module_info for link->module_source_handle. ]*/
-                BROKER_MODULEINFO* source_module_info = broker_locate_handle(broker_data, link->module_source_handle);
-                if (source_module_info == NULL)
-                {
-                    LogError("Link->source is not attached to the broker");
-                    result = BROKER_REMOVE_LINK_ERROR;
-                }
-                else
-                {
-                    /*Codes_SRS_BROKER_17_038: [ Broker_RemoveLink shall unsubscribe module_info->receive_socket from the link->module_source_handle module handle. ]*/
-                    if (nn_setsockopt(
-                        module_info->receive_socket, NN_SUB, NN_SUB_UNSUBSCRIBE, &(link->module_source_handle), sizeof(MODULE_HANDLE)) < 0)
-                    {
-                        /*Codes_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]*/
-                        LogError("Unable to make link in Broker");
-                        result = BROKER_REMOVE_LINK_ERROR;
-                    }
-                    else
-                    {
-                        result = BROKER_OK;
-                    }
-                }
-            }
-            /*Codes_SRS_BROKER_17_039: [ Broker_RemoveLink shall unlock the modules_lock. ]*/
-            Unlock(broker_data->modules_lock);
+            module_info->receiving = true;
+            /*Codes_SRS_BROKER_30_114: [ Broker_Publish shall count a message delivered inline in the messages_in, bytes_in and messages_out counters of the sink, in the counters of the link and in the sink's receive_latency histogram. ]*/
+            module_info->statistics.messages_in++;
+            module_info->statistics.bytes_in += bytes;
+            module_info->statistics.messages_out++;
+            link_statistics->messages_in++;
+            link_statistics->bytes_in += bytes;
+            (void)Unlock(module_info->mq_lock);
+
+            inline_depth++;
+            deliver_messages(module_info, &message, 1);
+            inline_depth--;
+
+            end_inline_delivery(module_info);
+            result = 0;
         }
     }
+
     return result;
 }
 
-static void broker_decrement_ref(BROKER_HANDLE broker)
+static BROKER_RESULT enqueue_message(const BROKER_ROUTE* route, MESSAGE_HANDLE message, size_t bytes)
 {
-    /*Codes_SRS_BROKER_13_058: [If `broker` is NULL the function shall do nothing.]*/
-    if (broker != NULL)
+    BROKER_RESULT result;
+    MESSAGE_HANDLE msg;
+
+    if (route->sink->inline_delivery && deliver_inline(route, message, bytes) == 0)
     {
-        /*Codes_SRS_BROKER_13_111: [Otherwise, Broker_Destroy shall decrement the internal ref count of the message.]*/
-        /*Codes_SRS_BROKER_13_112: [If the ref count is zero then the allocated resources are freed.]*/
-        if (DEC_REF(BROKER_HANDLE_DATA, broker) == DEC_RETURN_ZERO)
-        {
-            BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker; 
-            if (singlylinkedlist_get_head_item(broker_data->modules) != NULL)
-            {
-                LogError("WARNING: There are still active modules attached to the broker and the broker is being destroyed.");
-            }
-            /* May want to do nn_shutdown first for cleanliness. */
-            nn_close(broker_data->publish_socket);
-            STRING_delete(broker_data->url);
-            singlylinkedlist_destroy(broker_data->modules);
-            Lock_Deinit(broker_data->modules_lock);
-            free(broker_data);
-        }
+        result = BROKER_OK;
+    }
+    /*Codes_SRS_BROKER_17_007: [ Broker_Publish shall clone the message handle for each sink; the message content is shared, not copied. ]*/
+    else if ((msg = Message_Clone(message)) == NULL)
+    {
+        LogError("unable to clone message [%p]", message);
+        result = BROKER_ERROR;
     }
     else
     {
-        LogError("broker handle is NULL");
+        MESSAGE_HANDLE dropped[2];
+        result = enqueue_messages(route, &msg, 1, bytes, dropped);
     }
-}
-
-extern void Broker_Destroy(BROKER_HANDLE broker)
-{
-    broker_decrement_ref(broker);
-}
 
-extern void Broker_DecRef(BROKER_HANDLE broker)
-{
-    /*Codes_SRS_BROKER_13_113: [This function shall implement all the requirements of the Broker_Destroy API.]*/
-    broker_decrement_ref(broker);
+    return result;
 }
 
 BROKER_RESULT Broker_Publish(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE_HANDLE message)
@@ -795,72 +2977,148 @@ BROKER_RESULT Broker_Publish(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE
     else
     {
         BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
-        /*Codes_SRS_BROKER_17_022: [ Broker_Publish shall Lock the modules lock. ]*/
-        if (Lock(broker_data->modules_lock) != LOCK_OK)
+        /*Codes_SRS_BROKER_30_024: [ Broker_Publish shall take a reference on BROKER_HANDLE_DATA::topology with topology_acquire, without taking a lock, and shall not take BROKER_HANDLE_DATA::modules_lock. ]*/
+        BROKER_TOPOLOGY* topology = topology_acquire(broker_data);
+        result = BROKER_OK;
+
+        /*Codes_SRS_BROKER_30_014: [ Broker_Publish shall look up source in the routing table and enqueue the message for every sink routed from it. ]*/
+        size_t route_index = find_first_route(topology, source);
+        size_t sink_route = route_index;
+        size_t bytes = 0;
+        if (route_index < topology->route_count &&
+            topology->routes[route_index].source == source)
         {
-            /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-            LogError("Lock on broker_data->modules_lock failed");
-            result = BROKER_ERROR;
+            bytes = content_size(message);
         }
-        else
+        while (route_index < topology->route_count &&
+            topology->routes[route_index].source == source)
         {
-            int32_t msg_size;
-            int32_t buf_size;
-            /*Codes_SRS_BROKER_17_007: [ Broker_Publish shall clone the message. ]*/
-            MESSAGE_HANDLE msg = Message_Clone(message);
-            /*Codes_SRS_BROKER_17_008: [ Broker_Publish shall serialize the message. ]*/
-            msg_size = Message_ToByteArray(message, NULL, 0);
-            if (msg_size < 0)
-            {
-                /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                LogError("unable to serialize a message [%p]", msg);
-                Message_Destroy(msg);
+            if (topology->routes[route_index].sink != topology->routes[sink_route].sink)
+            {
+                sink_route = route_index;
+            }
+
+            /*Codes_SRS_BROKER_30_105: [ Broker_Publish shall evaluate the filters before it clones the message, reading the message properties with Message_GetPropertyValue rather than copying them. ]*/
+            if (route_accepts(topology->routes, sink_route, route_index, message) &&
+                enqueue_message(&(topology->routes[route_index]), message, bytes) != BROKER_OK)
+            {
+                /*Codes_SRS_BROKER_30_015: [ If delivery to a sink fails, Broker_Publish shall still deliver to the remaining sinks and return BROKER_ERROR. ]*/
                 result = BROKER_ERROR;
             }
-            else
+            route_index++;
+        }
+
+        /*Codes_SRS_BROKER_30_025: [ Broker_Publish shall release its reference on the topology. ]*/
+        topology_release(topology);
+    }
+    /*Codes_SRS_BROKER_13_037: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+    return result;
+}
+
+BROKER_RESULT Broker_PublishBatch(BROKER_HANDLE broker, MODULE_HANDLE source, MESSAGE_HANDLE* messages, size_t count)
+{
+    BROKER_RESULT result;
+    size_t i = 0;
+
+    if (broker != NULL && source != NULL && messages != NULL)
+    {
+        while (i < count && messages[i] != NULL)
+        {
+            i++;
+        }
+    }
+
+    /*Codes_SRS_BROKER_30_069: [ If broker, source or messages is NULL, or any of the count messages is NULL, Broker_PublishBatch shall return BROKER_INVALIDARG. ]*/
+    if (broker == NULL || source == NULL || messages == NULL || i < count)
+    {
+        result = BROKER_INVALIDARG;
+        LogError("Broker handle, source, messages and/or one of the message handles is NULL");
+    }
+    else if (count == 0)
+    {
+        /*Codes_SRS_BROKER_30_070: [ If count is 0, Broker_PublishBatch shall return BROKER_OK. ]*/
+        result = BROKER_OK;
+    }
+    else
+    {
+        BROKER_HANDLE_DATA* broker_data = (BROKER_HANDLE_DATA*)broker;
+        /*the clones for one sink, followed by room for the messages the sink drops*/
+        MESSAGE_HANDLE* clones = (MESSAGE_HANDLE*)malloc(sizeof(MESSAGE_HANDLE) * 3 * count);
+        if (clones == NULL)
+        {
+            /*Codes_SRS_BROKER_30_072: [ If any platform call fails, Broker_PublishBatch shall return BROKER_ERROR. ]*/
+            LogError("unable to allocate room for the clones of %zu messages", count);
+            result = BROKER_ERROR;
+        }
+        else
+        {
+            /*Codes_SRS_BROKER_30_073: [ Broker_PublishBatch shall take a reference on BROKER_HANDLE_DATA::topology once for the whole batch, and release it when done. ]*/
+            BROKER_TOPOLOGY* topology = topology_acquire(broker_data);
+            result = BROKER_OK;
+
+            size_t route_index = find_first_route(topology, source);
+            size_t bytes = 0;
+            if (route_index < topology->route_count &&
+                topology->routes[route_index].source == source)
             {
-                /*Codes_SRS_BROKER_17_025: [ Broker_Publish shall allocate a nanomsg buffer the size of the serialized message + sizeof(MODULE_HANDLE). ]*/
-                buf_size = msg_size + sizeof(MODULE_HANDLE);
-                void* nn_msg = nn_allocmsg(buf_size, 0);
-                if (nn_msg == NULL)
+                for (i = 0; i < count; i++)
                 {
-                    /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                    LogError("unable to serialize a message [%p]", msg);
-                    result = BROKER_ERROR;
+                    bytes += content_size(messages[i]);
                 }
-                else
+            }
+            size_t sink_route = route_index;
+            while (route_index < topology->route_count &&
+                topology->routes[route_index].source == source)
+            {
+                size_t clone_count = 0;
+                bool filtered;
+                size_t route_bytes;
+
+                if (topology->routes[route_index].sink != topology->routes[sink_route].sink)
                 {
-                    /*Codes_SRS_BROKER_17_026: [ Broker_Publish shall copy source into the beginning of the nanomsg buffer. ]*/
-                    unsigned char *nn_msg_bytes = (unsigned char *)nn_msg;
-                    memcpy(nn_msg_bytes, &source, sizeof(MODULE_HANDLE));
-                    /*Codes_SRS_BROKER_17_027: [ Broker_Publish shall serialize the message into the remainder of the nanomsg buffer. ]*/
-                    nn_msg_bytes += sizeof(MODULE_HANDLE);
-                    Message_ToByteArray(message, nn_msg_bytes, msg_size);
+                    sink_route = route_index;
+                }
+                /*a route to a sink that comes after another one only takes the messages that one does not*/
+                filtered = (topology->routes[route_index].filter != NULL || sink_route < route_index);
+                route_bytes = filtered ? 0 : bytes;
 
-                    /*Codes_SRS_BROKER_17_010: [ Broker_Publish shall send a message on the publish_socket. ]*/
-                    int nbytes = nn_send(broker_data->publish_socket, &nn_msg, NN_MSG, 0);
-                    if (nbytes != buf_size)
-                    {
-                        /*Codes_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]*/
-                        LogError("unable to send a message [%p]", msg);
-                        /*Codes_SRS_BROKER_17_012: [ Broker_Publish shall free the message. ]*/
-                        nn_freemsg(nn_msg);
-                        result = BROKER_ERROR;
-                    }
-                    else
+                for (i = 0; i < count; i++)
+                {
+                    /*Codes_SRS_BROKER_30_106: [ Broker_PublishBatch shall only deliver each message to a sink on the links that Broker_Publish would deliver it on. ]*/
+                    /*Codes_SRS_BROKER_30_135: [ Broker_PublishBatch shall evaluate the filters on the properties of the messages in place, as Broker_Publish does, without copying them for any message. ]*/
+                    if (route_accepts(topology->routes, sink_route, route_index, messages[i]))
                     {
-                        result = BROKER_OK;
+                        /*Codes_SRS_BROKER_30_074: [ Broker_PublishBatch shall clone every message for every sink routed from source. ]*/
+                        if ((clones[clone_count] = Message_Clone(messages[i])) == NULL)
+                        {
+                            LogError("unable to clone message [%p]", messages[i]);
+                            result = BROKER_ERROR;
+                        }
+                        else
+                        {
+                            clone_count++;
+                            if (filtered)
+                            {
+                                route_bytes += content_size(messages[i]);
+                            }
+                        }
                     }
                 }
-                /*Codes_SRS_BROKER_17_012: [ Broker_Publish shall free the message. ]*/
-                Message_Destroy(msg);
-                /*Codes_SRS_BROKER_17_011: [ Broker_Publish shall free the serialized message data. ]*/
+
+                /*Codes_SRS_BROKER_30_075: [ Broker_PublishBatch shall queue the clones for a sink in the order of messages, as Broker_Publish does, while holding the sink's mq_lock once, and shall signal the sink once. ]*/
+                if (clone_count > 0 &&
+                    enqueue_messages(&(topology->routes[route_index]), clones, clone_count, route_bytes, clones + count) != BROKER_OK)
+                {
+                    /*Codes_SRS_BROKER_30_076: [ If delivery to a sink fails, Broker_PublishBatch shall still deliver to the remaining sinks and return BROKER_ERROR. ]*/
+                    result = BROKER_ERROR;
+                }
+                route_index++;
             }
-            /*Codes_SRS_BROKER_17_023: [ Broker_Publish shall Unlock the modules lock. ]*/
-            Unlock(broker_data->modules_lock);
-        }
 
+            topology_release(topology);
+            free(clones);
+        }
     }
-    /*Codes_SRS_BROKER_13_037: [ This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise. ]*/
+
     return result;
-}
\ No newline at end of file
+}
@@ -134,6 +134,70 @@ void Gateway_DestroyModuleList(VECTOR_HANDLE module_list)
     VECTOR_destroy(module_list);
 }
 
+VECTOR_HANDLE Gateway_GetStatistics(GATEWAY_HANDLE gw)
+{
+    VECTOR_HANDLE result;
+
+    /*Codes_SRS_GATEWAY_30_007: [ If the `gw` parameter is NULL, the function shall return NULL handle and not allocate any data. ]*/
+    if (gw == NULL)
+    {
+        LogError("NULL gateway handle given to GetStatistics");
+        result = NULL;
+    }
+    else
+    {
+        result = VECTOR_create(sizeof(GATEWAY_MODULE_STATISTICS));
+        if (result == NULL)
+        {
+            /*Codes_SRS_GATEWAY_30_009: [ This function shall return a NULL handle should any internal callbacks fail. ]*/
+            LogError("Failed to init vector during GetStatistics");
+        }
+        else
+        {
+            size_t module_count = VECTOR_size(gw->modules);
+            for (size_t i = 0; i < module_count; i++)
+            {
+                MODULE_DATA *module_data = *(MODULE_DATA**)VECTOR_element(gw->modules, i);
+                MODULE module = { NULL, module_data->module };
+                GATEWAY_MODULE_STATISTICS module_statistics;
+                module_statistics.module_name = module_data->module_name;
+
+                /*Codes_SRS_GATEWAY_30_008: [ This function shall return a snapshot copy of the statistics `Broker_GetStatistics` returns for every module, in the order the modules were added. ]*/
+                if (Broker_GetStatistics(gw->broker, &module, &(module_statistics.statistics)) != BROKER_OK ||
+                    VECTOR_push_back(result, &module_statistics, 1) != 0)
+                {
+                    /*Codes_SRS_GATEWAY_30_009: [ This function shall return a NULL handle should any internal callbacks fail. ]*/
+                    LogError("Failed to get the statistics of module %s", module_data->module_name);
+                    VECTOR_destroy(result);
+                    result = NULL;
+                    break;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void Gateway_DestroyStatistics(VECTOR_HANDLE statistics)
+{
+    /*Codes_SRS_GATEWAY_30_010: [ This function shall destroy the list of `GATEWAY_MODULE_STATISTICS`. ]*/
+    VECTOR_destroy(statistics);
+}
+
+void Gateway_ReportStatistics(GATEWAY_HANDLE gw)
+{
+    /*Codes_SRS_GATEWAY_30_011: [ This function shall log a failure and do nothing else when `gw` parameter is NULL. ]*/
+    if (gw == NULL)
+    {
+        LogError("NULL gateway handle given to ReportStatistics");
+    }
+    else
+    {
+        /*Codes_SRS_GATEWAY_30_012: [ This function shall report `GATEWAY_STATISTICS_REPORTED` event. ]*/
+        EventSystem_ReportEvent(gw->event_system, gw, GATEWAY_STATISTICS_REPORTED);
+    }
+}
+
 void Gateway_AddEventCallback(GATEWAY_HANDLE gw, GATEWAY_EVENT event_type, GATEWAY_CALLBACK callback, void* user_param)
 {
     /* Codes_SRS_GATEWAY_26_006: [ This function shall log a failure and do nothing else when `gw` parameter is NULL. ] */
@@ -148,6 +212,12 @@ void Gateway_AddEventCallback(GATEWAY_HANDLE gw, GATEWAY_EVENT event_type, GATEW
 }
 
 GATEWAY_HANDLE Gateway_Create(const GATEWAY_PROPERTIES* properties)
+{
+    /*Codes_SRS_GATEWAY_30_023: [ Gateway_Create shall create the gateway as Gateway_CreateWithOptions does with NULL options. ]*/
+    return Gateway_CreateWithOptions(properties, NULL);
+}
+
+GATEWAY_HANDLE Gateway_CreateWithOptions(const GATEWAY_PROPERTIES* properties, const GATEWAY_OPTIONS* options)
 {
     GATEWAY_HANDLE result;
     /*Codes_SRS_GATEWAY_17_016: [ This function shall initialize the default module loaders. ] */
@@ -158,7 +228,7 @@ GATEWAY_HANDLE Gateway_Create(const GATEWAY_PROPERTIES* properties)
     }
     else
     {
-        result = gateway_create_internal(properties, false);
+        result = gateway_create_internal(properties, options, false);
         if (result == NULL)
         {
             /* Codes_SRS_GATEWAY_27_027: [ Launch - This function shall join any spawned threads upon any failure. ] */
@@ -210,13 +280,13 @@ void Gateway_Destroy(GATEWAY_HANDLE gw)
     ModuleLoader_Destroy();
 }
 
-MODULE_HANDLE Gateway_AddModule(GATEWAY_HANDLE gw, const GATEWAY_MODULES_ENTRY* entry)
+MODULE_HANDLE Gateway_AddModuleWithInbox(GATEWAY_HANDLE gw, const GATEWAY_MODULES_ENTRY* entry, const BROKER_INBOX_CONFIG* inbox)
 {
     MODULE_HANDLE module;
     /*Codes_SRS_GATEWAY_14_011: [ If gw, entry, or GATEWAY_MODULES_ENTRY's loader_configuration or loader_api is NULL the function shall return NULL. ]*/
     if (gw != NULL && entry != NULL)
     {
-        module = gateway_addmodule_internal(gw, entry, false);
+        module = gateway_addmodule_internal(gw, entry, inbox, false);
 
         if (module == NULL)
         {
@@ -237,6 +307,12 @@ MODULE_HANDLE Gateway_AddModule(GATEWAY_HANDLE gw, const GATEWAY_MODULES_ENTRY*
     return module;
 }
 
+MODULE_HANDLE Gateway_AddModule(GATEWAY_HANDLE gw, const GATEWAY_MODULES_ENTRY* entry)
+{
+    /*Codes_SRS_GATEWAY_30_022: [ Gateway_AddModule shall add the module as Gateway_AddModuleWithInbox does when inbox is NULL. ]*/
+    return Gateway_AddModuleWithInbox(gw, entry, NULL);
+}
+
 extern void Gateway_StartModule(GATEWAY_HANDLE gw, MODULE_HANDLE module)
 {
     if (gw != NULL)
@@ -322,7 +398,7 @@ int Gateway_RemoveModuleByName(GATEWAY_HANDLE gw, const char *module_name)
     return result;
 }
 
-GATEWAY_ADD_LINK_RESULT Gateway_AddLink(GATEWAY_HANDLE gw, const GATEWAY_LINK_ENTRY* entryLink)
+GATEWAY_ADD_LINK_RESULT Gateway_AddLinkWithOptions(GATEWAY_HANDLE gw, const GATEWAY_LINK_ENTRY* entryLink, const BROKER_LINK_OPTIONS* options)
 {
     GATEWAY_ADD_LINK_RESULT result;
 
@@ -334,7 +410,7 @@ GATEWAY_ADD_LINK_RESULT Gateway_AddLink(GATEWAY_HANDLE gw, const GATEWAY_LINK_EN
     }
     else
     {
-        if (!gateway_addlink_internal(gw, entryLink))
+        if (!gateway_addlink_internal(gw, entryLink, options))
         {
             /*Codes_SRS_GATEWAY_04_010: [ If the entryLink already exists it the function shall return GATEWAY_ADD_LINK_ERROR ] */
             /*Codes_SRS_GATEWAY_04_011: [ If the module referenced by the entryLink->module_source or entryLink->module_sink doesn't exists this function shall return GATEWAY_ADD_LINK_ERROR ] */
@@ -352,6 +428,12 @@ GATEWAY_ADD_LINK_RESULT Gateway_AddLink(GATEWAY_HANDLE gw, const GATEWAY_LINK_EN
     return result;
 }
 
+GATEWAY_ADD_LINK_RESULT Gateway_AddLink(GATEWAY_HANDLE gw, const GATEWAY_LINK_ENTRY* entryLink)
+{
+    /*Codes_SRS_GATEWAY_30_020: [ Gateway_AddLink shall add the link as Gateway_AddLinkWithOptions does when options is NULL. ]*/
+    return Gateway_AddLinkWithOptions(gw, entryLink, NULL);
+}
+
 void Gateway_RemoveLink(GATEWAY_HANDLE gw, const GATEWAY_LINK_ENTRY* entryLink)
 {
     /*Codes_SRS_GATEWAY_04_005: [ If gw or entryLink is NULL the function shall return. ]*/
@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <stdlib.h>
+#include <string.h>
 #include "azure_c_shared_utility/gballoc.h"
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_c_shared_utility/macro_utils.h"
@@ -20,10 +21,26 @@
 #define LOADER_ENTRYPOINT_KEY "entrypoint"
 #define MODULE_PATH_KEY "module.path"
 #define ARG_KEY "args"
+#define INBOX_KEY "inbox"
+#define INBOX_CAPACITY_KEY "capacity"
+#define INBOX_OVERFLOW_KEY "overflow"
+#define INBOX_COALESCE_KEY "coalesce.key"
+#define INBOX_DEDICATED_THREAD_KEY "dedicated.thread"
+#define INBOX_INLINE_KEY "inline"
+#define INBOX_SLOW_THRESHOLD_KEY "slow.threshold"
+#define SCHEDULER_KEY "scheduler"
+#define SCHEDULER_WORKERS_KEY "workers"
+#define THREAD_KEY "thread"
+#define THREAD_CPUS_KEY "cpus"
+#define THREAD_NICE_KEY "nice"
+#define THREAD_FIFO_PRIORITY_KEY "fifo.priority"
 
 #define LINKS_KEY "links"
 #define SOURCE_KEY "source"
 #define SINK_KEY "sink"
+#define PRIORITY_KEY "priority"
+#define FILTER_KEY "filter"
+#define COALESCE_KEY "coalesce.key"
 
 #define PARSE_JSON_RESULT_VALUES \
     PARSE_JSON_SUCCESS, \
@@ -34,8 +51,10 @@
 
 DEFINE_ENUM(PARSE_JSON_RESULT, PARSE_JSON_RESULT_VALUES);
 
-GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, bool use_json);
+GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, const GATEWAY_OPTIONS* options, bool use_json);
 static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties, JSON_Value *root);
+static PARSE_JSON_RESULT parse_scheduler(JSON_Value *root, BROKER_SCHEDULER_CONFIG* scheduler, const BROKER_SCHEDULER_CONFIG** out_scheduler);
+static PARSE_JSON_RESULT parse_default_thread(JSON_Value *root, THREAD_SCHEDULING_CONFIG* thread_scheduling, const THREAD_SCHEDULING_CONFIG** out_thread_scheduling);
 static void destroy_properties_internal(GATEWAY_PROPERTIES* properties);
 void gateway_destroy_internal(GATEWAY_HANDLE gw);
 
@@ -67,11 +86,18 @@ GATEWAY_HANDLE Gateway_CreateFromJson(const char* file_path)
                 {
                     properties->gateway_modules = NULL;
                     properties->gateway_links = NULL;
-                    if ((parse_json_internal(properties, root_value) == PARSE_JSON_SUCCESS) && properties->gateway_modules != NULL && properties->gateway_links != NULL)
+                    GATEWAY_OPTIONS options;
+                    options.broker_scheduler = NULL;
+                    options.thread_scheduling = NULL;
+                    BROKER_SCHEDULER_CONFIG scheduler;
+                    THREAD_SCHEDULING_CONFIG thread_scheduling;
+                    if ((parse_json_internal(properties, root_value) == PARSE_JSON_SUCCESS) && properties->gateway_modules != NULL && properties->gateway_links != NULL &&
+                        parse_scheduler(root_value, &scheduler, &options.broker_scheduler) == PARSE_JSON_SUCCESS &&
+                        parse_default_thread(root_value, &thread_scheduling, &options.thread_scheduling) == PARSE_JSON_SUCCESS)
                     {
                         /*Codes_SRS_GATEWAY_JSON_14_007: [The function shall use the GATEWAY_PROPERTIES instance to create and return a GATEWAY_HANDLE using the lower level API.]*/
                         /*Codes_SRS_GATEWAY_JSON_17_004: [ The function shall set the module loader to the default dynamically linked library module loader. ]*/
-                        gw = gateway_create_internal(properties, true);
+                        gw = gateway_create_internal(properties, &options, true);
 
                         if (gw == NULL)
                         {
@@ -138,10 +164,10 @@ static void rollbackModules(GATEWAY_HANDLE gw, VECTOR_HANDLE modules_added_succe
     {
         for (size_t properties_index = 0; properties_index < success_modules_entries_count; ++properties_index)
         {
-            GATEWAY_MODULES_ENTRY* entry = (GATEWAY_MODULES_ENTRY*)VECTOR_element(modules_added_successfully, properties_index);
-            if (Gateway_RemoveModuleByName(gw, entry->module_name) != 0)
+            GATEWAY_JSON_MODULES_ENTRY* json_entry = (GATEWAY_JSON_MODULES_ENTRY*)VECTOR_element(modules_added_successfully, properties_index);
+            if (Gateway_RemoveModuleByName(gw, json_entry->entry.module_name) != 0)
             {
-                LogError("Failed to remove module %s up failure.", entry->module_name);
+                LogError("Failed to remove module %s up failure.", json_entry->entry.module_name);
             }
         }
     }
@@ -197,7 +223,7 @@ GATEWAY_UPDATE_FROM_JSON_RESULT Gateway_UpdateFromJson(GATEWAY_HANDLE gw, const
                 else
                 {
                     
-                    VECTOR_HANDLE modules_added_successfully = VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY));
+                    VECTOR_HANDLE modules_added_successfully = VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY));
                     if (modules_added_successfully == NULL)
                     {
                         LogError("Failed to create Vector for successfully added modules.");
@@ -205,7 +231,7 @@ GATEWAY_UPDATE_FROM_JSON_RESULT Gateway_UpdateFromJson(GATEWAY_HANDLE gw, const
                     }
                     else
                     {
-                        VECTOR_HANDLE links_added_successfully = VECTOR_create(sizeof(GATEWAY_LINK_ENTRY));
+                        VECTOR_HANDLE links_added_successfully = VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY));
                         if (links_added_successfully == NULL)
                         {
                             LogError("Failed to create Vector for successfully added links.");
@@ -219,17 +245,17 @@ GATEWAY_UPDATE_FROM_JSON_RESULT Gateway_UpdateFromJson(GATEWAY_HANDLE gw, const
                                 if (entries_count > 0)
                                 {
                                     //Add the first module, if successful add others
-                                    GATEWAY_MODULES_ENTRY* entry = (GATEWAY_MODULES_ENTRY*)VECTOR_element(properties->gateway_modules, 0);
-                                    MODULE_HANDLE module = gateway_addmodule_internal(gw, entry, true);
+                                    GATEWAY_JSON_MODULES_ENTRY* entry = (GATEWAY_JSON_MODULES_ENTRY*)VECTOR_element(properties->gateway_modules, 0);
+                                    MODULE_HANDLE module = gateway_addmodule_internal(gw, &(entry->entry), entry->module_inbox, true);
 
                                     if (module != NULL)
                                     {
                                         if (VECTOR_push_back(modules_added_successfully, entry, 1) != 0)
                                         {
                                             LogError("Failed to save successfully added module.");
-                                            if (Gateway_RemoveModuleByName(gw, entry->module_name) != 0)
+                                            if (Gateway_RemoveModuleByName(gw, entry->entry.module_name) != 0)
                                             {
-                                                LogError("Failed to remove module %s upon failure.", entry->module_name);
+                                                LogError("Failed to remove module %s upon failure.", entry->entry.module_name);
                                             }
                                             module = NULL;
                                             result = GATEWAY_UPDATE_FROM_JSON_ERROR;
@@ -243,17 +269,17 @@ GATEWAY_UPDATE_FROM_JSON_RESULT Gateway_UpdateFromJson(GATEWAY_HANDLE gw, const
                                     //Continue adding modules until all are added or one fails
                                     for (size_t properties_index = 1; properties_index < entries_count && module != NULL; ++properties_index)
                                     {
-                                        entry = (GATEWAY_MODULES_ENTRY*)VECTOR_element(properties->gateway_modules, properties_index);
-                                        module = gateway_addmodule_internal(gw, entry, true);
+                                        entry = (GATEWAY_JSON_MODULES_ENTRY*)VECTOR_element(properties->gateway_modules, properties_index);
+                                        module = gateway_addmodule_internal(gw, &(entry->entry), entry->module_inbox, true);
 
                                         if (module != NULL)
                                         {
                                             if (VECTOR_push_back(modules_added_successfully, entry, 1) != 0)
                                             {
                                                 LogError("Failed to save successfully added module.");
-                                                if (Gateway_RemoveModuleByName(gw, entry->module_name) != 0)
+                                                if (Gateway_RemoveModuleByName(gw, entry->entry.module_name) != 0)
                                                 {
-                                                    LogError("Failed to remove module %s up failure.", entry->module_name);
+                                                    LogError("Failed to remove module %s up failure.", entry->entry.module_name);
                                                 }
                                                 module = NULL;
                                                 result = GATEWAY_UPDATE_FROM_JSON_ERROR;
@@ -297,15 +323,15 @@ GATEWAY_UPDATE_FROM_JSON_RESULT Gateway_UpdateFromJson(GATEWAY_HANDLE gw, const
                                 if (entries_count > 0)
                                 {
                                     //Add the first link, if successfull add others
-                                    GATEWAY_LINK_ENTRY* entry = (GATEWAY_LINK_ENTRY*)VECTOR_element(properties->gateway_links, 0);
-                                    bool linkAdded = gateway_addlink_internal(gw, entry);
+                                    GATEWAY_JSON_LINK_ENTRY* entry = (GATEWAY_JSON_LINK_ENTRY*)VECTOR_element(properties->gateway_links, 0);
+                                    bool linkAdded = gateway_addlink_internal(gw, &(entry->entry), &(entry->options));
 
                                     if (linkAdded)
                                     {
                                         if (VECTOR_push_back(links_added_successfully, entry, 1) != 0)
                                         {
                                             LogError("Failed to save successfully added link.");
-                                            Gateway_RemoveLink(gw, entry);
+                                            Gateway_RemoveLink(gw, &(entry->entry));
                                             linkAdded = false;
                                             result = GATEWAY_UPDATE_FROM_JSON_ERROR;
                                         }
@@ -319,14 +345,14 @@ GATEWAY_UPDATE_FROM_JSON_RESULT Gateway_UpdateFromJson(GATEWAY_HANDLE gw, const
                                     //Continue adding links until all are added or one fails
                                     for (size_t links_index = 1; links_index < entries_count && linkAdded; ++links_index)
                                     {
-                                        entry = (GATEWAY_LINK_ENTRY*)VECTOR_element(properties->gateway_links, links_index);
-                                        linkAdded = gateway_addlink_internal(gw, entry);
+                                        entry = (GATEWAY_JSON_LINK_ENTRY*)VECTOR_element(properties->gateway_links, links_index);
+                                        linkAdded = gateway_addlink_internal(gw, &(entry->entry), &(entry->options));
                                         if (linkAdded)
                                         {
                                             if (VECTOR_push_back(links_added_successfully, entry, 1) != 0)
                                             {
                                                 LogError("Failed to save successfully added link.");
-                                                Gateway_RemoveLink(gw, entry);
+                                                Gateway_RemoveLink(gw, &(entry->entry));
                                                 linkAdded = false;
                                                 result = GATEWAY_UPDATE_FROM_JSON_ERROR;
                                             }
@@ -348,8 +374,8 @@ GATEWAY_UPDATE_FROM_JSON_RESULT Gateway_UpdateFromJson(GATEWAY_HANDLE gw, const
                                         {
                                             for (size_t properties_index = 0; properties_index < success_link_entries_count; ++properties_index)
                                             {
-                                                GATEWAY_LINK_ENTRY* entry = (GATEWAY_LINK_ENTRY*)VECTOR_element(links_added_successfully, properties_index);
-                                                Gateway_RemoveLink(gw, entry);
+                                                GATEWAY_JSON_LINK_ENTRY* added_entry = (GATEWAY_JSON_LINK_ENTRY*)VECTOR_element(links_added_successfully, properties_index);
+                                                Gateway_RemoveLink(gw, &(added_entry->entry));
                                             }
                                         }
 
@@ -357,7 +383,7 @@ GATEWAY_UPDATE_FROM_JSON_RESULT Gateway_UpdateFromJson(GATEWAY_HANDLE gw, const
                                         /* Codes_SRS_GATEWAY_JSON_04_009: [ The function shall be able to roll back previous operation if any module or link fails to be added. ] */
                                         rollbackModules(gw, modules_added_successfully);
 
-                                        LogError("Unable to add link from '%s' to '%s'.Rolling back Update Operation.", entry->module_source, entry->module_sink);
+                                        LogError("Unable to add link from '%s' to '%s'.Rolling back Update Operation.", entry->entry.module_source, entry->entry.module_sink);
                                     }
                                 }
                             }
@@ -384,9 +410,13 @@ static void destroy_properties_internal(GATEWAY_PROPERTIES* properties)
         size_t vector_size = VECTOR_size(properties->gateway_modules);
         for (size_t element_index = 0; element_index < vector_size; ++element_index)
         {
-            GATEWAY_MODULES_ENTRY* element = (GATEWAY_MODULES_ENTRY*)VECTOR_element(properties->gateway_modules, element_index);
-            element->module_loader_info.loader->api->FreeEntrypoint(element->module_loader_info.loader, element->module_loader_info.entrypoint);
-            json_free_serialized_string((char*)(element->module_configuration));
+            GATEWAY_JSON_MODULES_ENTRY* element = (GATEWAY_JSON_MODULES_ENTRY*)VECTOR_element(properties->gateway_modules, element_index);
+            element->entry.module_loader_info.loader->api->FreeEntrypoint(element->entry.module_loader_info.loader, element->entry.module_loader_info.entrypoint);
+            json_free_serialized_string((char*)(element->entry.module_configuration));
+            if (element->module_inbox != NULL)
+            {
+                free(element->module_inbox);
+            }
         }
 
         VECTOR_destroy(properties->gateway_modules);
@@ -446,6 +476,206 @@ static PARSE_JSON_RESULT parse_loader(JSON_Object* loader_json, GATEWAY_MODULE_L
     return result;
 }
 
+static const struct
+{
+    const char* name;
+    BROKER_OVERFLOW_POLICY policy;
+} overflow_policies[] =
+{
+    { "block-publisher", BROKER_OVERFLOW_BLOCK_PUBLISHER },
+    { "drop-newest", BROKER_OVERFLOW_DROP_NEWEST },
+    { "drop-oldest", BROKER_OVERFLOW_DROP_OLDEST },
+    { "coalesce-by-key", BROKER_OVERFLOW_COALESCE_BY_KEY }
+};
+
+static PARSE_JSON_RESULT parse_inbox(JSON_Object* inbox_json, BROKER_INBOX_CONFIG** inbox)
+{
+    PARSE_JSON_RESULT result;
+
+    /*Codes_SRS_GATEWAY_JSON_30_002: [ The function shall read the inbox "capacity", "overflow", "coalesce.key" and "dedicated.thread" values; a missing "capacity" means the default capacity, a missing "overflow" means "block-publisher" and a missing "dedicated.thread" means false. ]*/
+    double capacity = json_object_get_number(inbox_json, INBOX_CAPACITY_KEY);
+    const char* overflow = json_object_get_string(inbox_json, INBOX_OVERFLOW_KEY);
+    const char* coalesce_key = json_object_get_string(inbox_json, INBOX_COALESCE_KEY);
+    int dedicated_thread = json_object_get_boolean(inbox_json, INBOX_DEDICATED_THREAD_KEY);
+    /*Codes_SRS_GATEWAY_JSON_30_013: [ The function shall set the inbox `inline_delivery` to the inbox "inline" value; a missing "inline" means false. ]*/
+    int inline_delivery = json_object_get_boolean(inbox_json, INBOX_INLINE_KEY);
+    /*Codes_SRS_GATEWAY_JSON_30_015: [ The function shall set the inbox `slow_receive_threshold` to the inbox "slow.threshold" value, in milliseconds, converted to microseconds; a missing "slow.threshold" means 0, and the inbox shall have no `on_health_changed`. ]*/
+    double slow_threshold = json_object_get_number(inbox_json, INBOX_SLOW_THRESHOLD_KEY);
+
+    size_t policy_index = 0;
+    if (overflow != NULL)
+    {
+        while (policy_index < sizeof(overflow_policies) / sizeof(overflow_policies[0]) &&
+            strcmp(overflow_policies[policy_index].name, overflow) != 0)
+        {
+            policy_index++;
+        }
+    }
+
+    /*Codes_SRS_GATEWAY_JSON_30_003: [ If "capacity" or "slow.threshold" is negative, "overflow" is not a known policy, or "overflow" is "coalesce-by-key" without a "coalesce.key", the function shall fail and return NULL. ]*/
+    if (capacity < 0 || slow_threshold < 0 || policy_index == sizeof(overflow_policies) / sizeof(overflow_policies[0]))
+    {
+        LogError("Module JSON has a misconfigured 'inbox'.");
+        result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+    }
+    else if (overflow_policies[policy_index].policy == BROKER_OVERFLOW_COALESCE_BY_KEY && coalesce_key == NULL)
+    {
+        LogError("Module JSON 'inbox' coalesces by key but has no 'coalesce.key'.");
+        result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+    }
+    else
+    {
+        *inbox = (BROKER_INBOX_CONFIG*)malloc(sizeof(BROKER_INBOX_CONFIG));
+        if (*inbox == NULL)
+        {
+            LogError("Failed to allocate the inbox configuration.");
+            result = PARSE_JSON_FAILURE;
+        }
+        else
+        {
+            /*the key points into the JSON document, which outlives the modules being added*/
+            (*inbox)->capacity = (size_t)capacity;
+            (*inbox)->overflow_policy = overflow_policies[policy_index].policy;
+            (*inbox)->coalesce_key = coalesce_key;
+            (*inbox)->dedicated_thread = (dedicated_thread == 1);
+            memset(&((*inbox)->thread_scheduling), 0, sizeof(THREAD_SCHEDULING_CONFIG));
+            (*inbox)->inline_delivery = (inline_delivery == 1);
+            (*inbox)->slow_receive_threshold = (uint64_t)(slow_threshold * 1000);
+            (*inbox)->on_health_changed = NULL;
+            (*inbox)->health_context = NULL;
+            result = PARSE_JSON_SUCCESS;
+        }
+    }
+
+    return result;
+}
+
+static PARSE_JSON_RESULT parse_thread_scheduling(JSON_Object* thread_json, THREAD_SCHEDULING_CONFIG* thread_scheduling)
+{
+    PARSE_JSON_RESULT result = PARSE_JSON_SUCCESS;
+
+    /*Codes_SRS_GATEWAY_JSON_30_008: [ The function shall read the "cpus", "nice" and "fifo.priority" values of a "thread" object; a missing value leaves that setting of the thread unchanged. ]*/
+    JSON_Array* cpus = json_object_get_array(thread_json, THREAD_CPUS_KEY);
+    double nice = json_object_get_number(thread_json, THREAD_NICE_KEY);
+    double fifo_priority = json_object_get_number(thread_json, THREAD_FIFO_PRIORITY_KEY);
+
+    thread_scheduling->cpu_affinity = 0;
+    if (cpus != NULL)
+    {
+        size_t cpu_count = json_array_get_count(cpus);
+        for (size_t cpu_index = 0; cpu_index < cpu_count; ++cpu_index)
+        {
+            double cpu = json_array_get_number(cpus, cpu_index);
+            if (cpu < 0 || cpu >= THREAD_SCHEDULING_MAX_CPUS || cpu != (double)(size_t)cpu)
+            {
+                result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+                break;
+            }
+            else
+            {
+                thread_scheduling->cpu_affinity |= ((uint64_t)1 << (size_t)cpu);
+            }
+        }
+    }
+
+    /*Codes_SRS_GATEWAY_JSON_30_009: [ If a "cpus" entry is not a CPU number below THREAD_SCHEDULING_MAX_CPUS, "nice" is not a whole number from THREAD_SCHEDULING_MIN_NICE to THREAD_SCHEDULING_MAX_NICE, or "fifo.priority" is not a whole number from 0 to THREAD_SCHEDULING_MAX_FIFO_PRIORITY, the function shall fail and return NULL. ]*/
+    if (result != PARSE_JSON_SUCCESS ||
+        nice < THREAD_SCHEDULING_MIN_NICE || nice > THREAD_SCHEDULING_MAX_NICE || nice != (double)(int)nice ||
+        fifo_priority < 0 || fifo_priority > THREAD_SCHEDULING_MAX_FIFO_PRIORITY || fifo_priority != (double)(int)fifo_priority)
+    {
+        LogError("JSON has a misconfigured 'thread'.");
+        result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+    }
+    else
+    {
+        thread_scheduling->nice = (int)nice;
+        thread_scheduling->fifo_priority = (int)fifo_priority;
+    }
+
+    return result;
+}
+
+static PARSE_JSON_RESULT parse_module_thread(JSON_Object* thread_json, BROKER_INBOX_CONFIG** inbox)
+{
+    PARSE_JSON_RESULT result;
+
+    /*Codes_SRS_GATEWAY_JSON_30_010: [ If a module has a "thread" object, the function shall set the thread_scheduling of the module's inbox configuration to the settings it describes, giving the module a default inbox configuration if it has no "inbox" object. ]*/
+    if (*inbox == NULL)
+    {
+        *inbox = (BROKER_INBOX_CONFIG*)malloc(sizeof(BROKER_INBOX_CONFIG));
+        if (*inbox != NULL)
+        {
+            memset(*inbox, 0, sizeof(BROKER_INBOX_CONFIG));
+        }
+    }
+
+    if (*inbox == NULL)
+    {
+        LogError("Failed to allocate the inbox configuration.");
+        result = PARSE_JSON_FAILURE;
+    }
+    else
+    {
+        result = parse_thread_scheduling(thread_json, &((*inbox)->thread_scheduling));
+    }
+
+    return result;
+}
+
+static PARSE_JSON_RESULT parse_scheduler(JSON_Value *root, BROKER_SCHEDULER_CONFIG* scheduler, const BROKER_SCHEDULER_CONFIG** out_scheduler)
+{
+    PARSE_JSON_RESULT result;
+
+    /*Codes_SRS_GATEWAY_JSON_30_004: [ If the JSON has a top level "scheduler" object, the function shall create the broker with a worker pool of "workers" threads; a missing or zero "workers" means one worker per processor. ]*/
+    JSON_Object *scheduler_json = json_object_get_object(json_value_get_object(root), SCHEDULER_KEY);
+    if (scheduler_json == NULL)
+    {
+        *out_scheduler = NULL;
+        result = PARSE_JSON_SUCCESS;
+    }
+    else
+    {
+        double workers = json_object_get_number(scheduler_json, SCHEDULER_WORKERS_KEY);
+        /*Codes_SRS_GATEWAY_JSON_30_005: [ If "workers" is negative, the function shall fail and return NULL. ]*/
+        if (workers < 0)
+        {
+            LogError("Gateway JSON has a misconfigured 'scheduler'.");
+            result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+        }
+        else
+        {
+            scheduler->worker_count = (size_t)workers;
+            *out_scheduler = scheduler;
+            result = PARSE_JSON_SUCCESS;
+        }
+    }
+
+    return result;
+}
+
+static PARSE_JSON_RESULT parse_default_thread(JSON_Value *root, THREAD_SCHEDULING_CONFIG* thread_scheduling, const THREAD_SCHEDULING_CONFIG** out_thread_scheduling)
+{
+    PARSE_JSON_RESULT result;
+
+    /*Codes_SRS_GATEWAY_JSON_30_011: [ If the JSON has a top level "thread" object, the function shall create the gateway with the settings it describes as the default thread scheduling of its modules and of its event callback thread. ]*/
+    JSON_Object *thread_json = json_object_get_object(json_value_get_object(root), THREAD_KEY);
+    if (thread_json == NULL)
+    {
+        *out_thread_scheduling = NULL;
+        result = PARSE_JSON_SUCCESS;
+    }
+    else
+    {
+        result = parse_thread_scheduling(thread_json, thread_scheduling);
+        if (result == PARSE_JSON_SUCCESS)
+        {
+            *out_thread_scheduling = thread_scheduling;
+        }
+    }
+
+    return result;
+}
+
 static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties, JSON_Value *root)
 {
     PARSE_JSON_RESULT result;
@@ -466,7 +696,7 @@ static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties,
             {
                 if (modules_array != NULL)
                 {
-                    out_properties->gateway_modules = VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY));
+                    out_properties->gateway_modules = VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY));
                     if (out_properties->gateway_modules != NULL)
                     {
                         /*Codes_SRS_GATEWAY_JSON_17_008: [ The function shall parse the "modules" JSON array for each module entry. ]*/
@@ -489,16 +719,41 @@ static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties,
                             else
                             {
                                 const char* module_name = json_object_get_string(module, MODULE_NAME_KEY);
-                                if (module_name != NULL)
+                                /*Codes_SRS_GATEWAY_JSON_30_001: [ If a module has an "inbox" object, the function shall keep the inbox configuration it describes with the module's GATEWAY_MODULES_ENTRY, otherwise NULL, and add the module with it. ]*/
+                                JSON_Object* inbox_json = (module_name == NULL) ? NULL : json_object_get_object(module, INBOX_KEY);
+                                JSON_Object* thread_json = (module_name == NULL) ? NULL : json_object_get_object(module, THREAD_KEY);
+                                BROKER_INBOX_CONFIG* inbox = NULL;
+                                if (inbox_json != NULL && parse_inbox(inbox_json, &inbox) != PARSE_JSON_SUCCESS)
+                                {
+                                    loader_info.loader->api->FreeEntrypoint(loader_info.loader, loader_info.entrypoint);
+                                    result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+                                    LogError("Failed to parse inbox configuration.");
+                                    break;
+                                }
+                                else if (thread_json != NULL && parse_module_thread(thread_json, &inbox) != PARSE_JSON_SUCCESS)
+                                {
+                                    loader_info.loader->api->FreeEntrypoint(loader_info.loader, loader_info.entrypoint);
+                                    if (inbox != NULL)
+                                    {
+                                        free(inbox);
+                                    }
+                                    result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+                                    LogError("Failed to parse thread configuration.");
+                                    break;
+                                }
+                                else if (module_name != NULL)
                                 {
                                     /*Codes_SRS_GATEWAY_JSON_14_005: [The function shall set the value of const void* module_properties in the GATEWAY_PROPERTIES instance to a char* representing the serialized args value for the particular module.]*/
                                     JSON_Value *args = json_object_get_value(module, ARG_KEY);
                                     char* args_str = json_serialize_to_string(args);
 
-                                    GATEWAY_MODULES_ENTRY entry = {
-                                        module_name,
-                                        loader_info,
-                                        args_str
+                                    GATEWAY_JSON_MODULES_ENTRY entry = {
+                                        {
+                                            module_name,
+                                            loader_info,
+                                            args_str
+                                        },
+                                        inbox
                                     };
 
                                     /*Codes_SRS_GATEWAY_JSON_14_006: [The function shall return NULL if the JSON_Value contains incomplete information.]*/
@@ -510,6 +765,10 @@ static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties,
                                     {
                                         loader_info.loader->api->FreeEntrypoint(loader_info.loader, loader_info.entrypoint);
                                         json_free_serialized_string(args_str);
+                                        if (inbox != NULL)
+                                        {
+                                            free(inbox);
+                                        }
                                         result = PARSE_JSON_VECTOR_FAILURE;
                                         LogError("Failed to push data into properties vector.");
                                         break;
@@ -545,7 +804,7 @@ static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties,
                     if (links_array != NULL)
                     {
                         /* Codes_SRS_GATEWAY_JSON_04_001: [ The function shall create a Vector to Store all links to this gateway. ] */
-                        out_properties->gateway_links = VECTOR_create(sizeof(GATEWAY_LINK_ENTRY));
+                        out_properties->gateway_links = VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY));
                         if (out_properties->gateway_links != NULL)
                         {
                             JSON_Object *route;
@@ -555,12 +814,32 @@ static PARSE_JSON_RESULT parse_json_internal(GATEWAY_PROPERTIES* out_properties,
                                 route = json_array_get_object(links_array, links_index);
                                 const char* module_source = json_object_get_string(route, SOURCE_KEY);
                                 const char* module_sink = json_object_get_string(route, SINK_KEY);
-
-                                if (module_source != NULL && module_sink != NULL)
+                                /*Codes_SRS_GATEWAY_JSON_30_006: [ The function shall set the `priority` of the link's options to the link's "priority" value; a missing "priority" means 0. ]*/
+                                double priority = json_object_get_number(route, PRIORITY_KEY);
+                                /*Codes_SRS_GATEWAY_JSON_30_012: [ The function shall set the `filter` of the link's options to the link's "filter" string; a missing "filter" means NULL. ]*/
+                                const char* filter = json_object_get_string(route, FILTER_KEY);
+                                /*Codes_SRS_GATEWAY_JSON_30_014: [ The function shall set the `coalesce_key` of the link's options to the link's "coalesce.key" string; a missing "coalesce.key" means NULL. ]*/
+                                const char* coalesce_key = json_object_get_string(route, COALESCE_KEY);
+
+                                /*Codes_SRS_GATEWAY_JSON_30_007: [ If "priority" is not a whole number less than `BROKER_LINK_PRIORITIES`, the function shall fail and return NULL. ]*/
+                                if (priority < 0 || priority >= BROKER_LINK_PRIORITIES || priority != (double)(size_t)priority)
+                                {
+                                    result = PARSE_JSON_MISSING_OR_MISCONFIGURED_CONFIG;
+                                    LogError("\"priority\" in input JSON configuration is misconfigured.");
+                                    break;
+                                }
+                                else if (module_source != NULL && module_sink != NULL)
                                 {
-                                    GATEWAY_LINK_ENTRY entry = {
-                                        module_source,
-                                        module_sink
+                                    GATEWAY_JSON_LINK_ENTRY entry = {
+                                        {
+                                            module_source,
+                                            module_sink
+                                        },
+                                        {
+                                            filter,
+                                            (size_t)priority,
+                                            coalesce_key
+                                        }
                                     };
 
                                     /* Codes_SRS_GATEWAY_JSON_04_002: [ The function shall add all modules source and sink to GATEWAY_PROPERTIES inside gateway_links. ] */
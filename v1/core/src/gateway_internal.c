@@ -44,7 +44,7 @@ static bool check_if_link_exists(GATEWAY_HANDLE_DATA* gateway_handle, const GATE
     return link_data == NULL ? false : true;
 }
 
-static int add_one_link_to_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_HANDLE source, MODULE_HANDLE sink)
+static int add_one_link_to_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_HANDLE source, MODULE_HANDLE sink, const LINK_DATA* link_data)
 {
     int result;
     BROKER_LINK_DATA broker_link_entry =
@@ -52,7 +52,16 @@ static int add_one_link_to_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_HA
         source,
         sink
     };
-    if (Broker_AddLink(gateway_handle->broker, &broker_link_entry) != BROKER_OK)
+    /*Codes_SRS_GATEWAY_30_013: [ The function shall add every broker link made for the entryLink with Broker_AddLinkWithOptions and `options->filter`. ]*/
+    /*Codes_SRS_GATEWAY_30_003: [ The function shall add every broker link made for the entryLink with `options->priority`. ]*/
+    /*Codes_SRS_GATEWAY_30_015: [ The function shall add every broker link made for the entryLink with `options->coalesce_key`. ]*/
+    BROKER_LINK_OPTIONS options =
+    {
+        link_data->filter,
+        link_data->priority,
+        link_data->coalesce_key
+    };
+    if (Broker_AddLinkWithOptions(gateway_handle->broker, &broker_link_entry, &options) != BROKER_OK)
     {
         LogError("Could not add link to broker [%p] -> [%p]", source, sink);
         result = __LINE__;
@@ -64,7 +73,7 @@ static int add_one_link_to_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_HA
     return result;
 }
 
-static int remove_one_link_from_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_HANDLE source, MODULE_HANDLE sink)
+static int remove_one_link_from_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_HANDLE source, MODULE_HANDLE sink, const LINK_DATA* link_data)
 {
     int result;
     BROKER_LINK_DATA broker_link_entry =
@@ -72,7 +81,13 @@ static int remove_one_link_from_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODU
         source,
         sink
     };
-    if (Broker_RemoveLink(gateway_handle->broker, &broker_link_entry) != BROKER_OK)
+    /*Codes_SRS_GATEWAY_30_021: [ The gateway shall remove every broker link made for a link with Broker_RemoveLinkWithOptions and the options the link was added with. ]*/
+    BROKER_LINK_OPTIONS options =
+    {
+        link_data->filter,
+        link_data->priority
+    };
+    if (Broker_RemoveLinkWithOptions(gateway_handle->broker, &broker_link_entry, &options) != BROKER_OK)
     {
         LogError("Could not remove link from broker [%p] -> [%p]", source, sink);
         result = __LINE__;
@@ -84,7 +99,30 @@ static int remove_one_link_from_broker(GATEWAY_HANDLE_DATA* gateway_handle, MODU
     return result;
 }
 
-static int add_regular_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry)
+/*copies value, a filter or a coalesce key which may be NULL, to *copy. Returns 0 if
+success, otherwise __LINE__*/
+static int copy_link_string(const char* value, char** copy)
+{
+    int result;
+    if (value == NULL)
+    {
+        *copy = NULL;
+        result = 0;
+    }
+    else if (mallocAndStrcpy_s(copy, value) != 0)
+    {
+        LogError("Unable to copy link string \"%s\"", value);
+        *copy = NULL;
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+static int add_regular_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry, const BROKER_LINK_OPTIONS* options)
 {
     int result;
     MODULE_DATA** module_source_handle = (MODULE_DATA**)VECTOR_find_if(gateway_handle->modules, module_name_find, link_entry->module_source);
@@ -107,38 +145,110 @@ static int add_regular_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_L
         }
         else
         {
-            if (add_one_link_to_broker(gateway_handle, (*module_source_handle)->module, (*module_sink_handle)->module) != 0)
+            LINK_DATA link_data =
+            {
+                false,
+                *module_source_handle,
+                *module_sink_handle,
+                (options == NULL) ? 0 : options->priority,
+                NULL,
+                NULL
+            };
+
+            /*Codes_SRS_GATEWAY_30_014: [ The function shall keep a copy of `options->filter` with the link. ]*/
+            /*Codes_SRS_GATEWAY_30_016: [ The function shall keep a copy of `options->coalesce_key` with the link. ]*/
+            if (copy_link_string((options == NULL) ? NULL : options->filter, &(link_data.filter)) != 0 ||
+                copy_link_string((options == NULL) ? NULL : options->coalesce_key, &(link_data.coalesce_key)) != 0)
+            {
+                LogError("Unable to copy the link filter or coalesce key.");
+                free(link_data.filter);
+                result = __LINE__;
+            }
+            else if (add_one_link_to_broker(gateway_handle, (*module_source_handle)->module, (*module_sink_handle)->module, &link_data) != 0)
             {
                 LogError("Unable to add link to Broker.");
+                free(link_data.filter);
+                free(link_data.coalesce_key);
+                result = __LINE__;
+            }
+            /*Codes_SRS_GATEWAY_04_012: [ This function shall add the entryLink to the gw->links ] */
+            else if (VECTOR_push_back(gateway_handle->links, &link_data, 1) != 0)
+            {
+                LogError("Unable to add LINK_DATA* to the gateway links vector.");
+                remove_one_link_from_broker(gateway_handle, (*module_source_handle)->module, (*module_sink_handle)->module, &link_data);
+                free(link_data.filter);
+                free(link_data.coalesce_key);
                 result = __LINE__;
             }
             else
             {
-                LINK_DATA link_data =
-                {
-                    false,
-                    *module_source_handle,
-                    *module_sink_handle
-                };
-
-                /*Codes_SRS_GATEWAY_04_012: [ This function shall add the entryLink to the gw->links ] */
-                if (VECTOR_push_back(gateway_handle->links, &link_data, 1) != 0)
-                {
-                    LogError("Unable to add LINK_DATA* to the gateway links vector.");
-                    remove_one_link_from_broker(gateway_handle, (*module_source_handle)->module, (*module_sink_handle)->module);
-                    result = __LINE__;
-                }
-                else
-                {
-                    result = 0;
-                }
+                result = 0;
             }
         }
     }
     return result;
 }
 
-GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, bool use_json)
+/*gets the element at index of the gateway_links of the properties, which are
+GATEWAY_JSON_LINK_ENTRY when the properties come from a JSON configuration, and
+the options of the link, NULL if the element has none*/
+static const GATEWAY_MODULES_ENTRY* get_module_entry(VECTOR_HANDLE gateway_modules, size_t index, bool use_json, const BROKER_INBOX_CONFIG** module_inbox)
+{
+    const GATEWAY_MODULES_ENTRY* result;
+    if (use_json)
+    {
+        const GATEWAY_JSON_MODULES_ENTRY* json_entry = (const GATEWAY_JSON_MODULES_ENTRY*)VECTOR_element(gateway_modules, index);
+        result = &(json_entry->entry);
+        *module_inbox = json_entry->module_inbox;
+    }
+    else
+    {
+        result = (const GATEWAY_MODULES_ENTRY*)VECTOR_element(gateway_modules, index);
+        *module_inbox = NULL;
+    }
+    return result;
+}
+
+static const GATEWAY_LINK_ENTRY* get_link_entry(VECTOR_HANDLE gateway_links, size_t index, bool use_json, const BROKER_LINK_OPTIONS** options)
+{
+    const GATEWAY_LINK_ENTRY* result;
+    if (use_json)
+    {
+        const GATEWAY_JSON_LINK_ENTRY* json_entry = (const GATEWAY_JSON_LINK_ENTRY*)VECTOR_element(gateway_links, index);
+        result = &(json_entry->entry);
+        *options = &(json_entry->options);
+    }
+    else
+    {
+        result = (const GATEWAY_LINK_ENTRY*)VECTOR_element(gateway_links, index);
+        *options = NULL;
+    }
+    return result;
+}
+
+/*called by the broker, on the thread that delivers to the module, when the module is marked slow or recovers*/
+static void gateway_module_health_changed(void* context, MODULE_HANDLE module, bool slow)
+{
+    GATEWAY_HANDLE_DATA* gateway_handle = (GATEWAY_HANDLE_DATA*)context;
+
+    if (slow)
+    {
+        LogInfo("module [%p] is slow, its inbox drops messages until it recovers", module);
+    }
+    else
+    {
+        LogInfo("module [%p] recovered", module);
+    }
+
+    /*Codes_SRS_GATEWAY_30_018: [ When the broker marks a module slow or the module recovers, the gateway shall report the GATEWAY_MODULE_HEALTH_CHANGED event. ]*/
+    /*the event system is created once the modules of the properties are added, none of which has been started yet*/
+    if (gateway_handle->event_system != NULL)
+    {
+        EventSystem_ReportEvent(gateway_handle->event_system, gateway_handle, GATEWAY_MODULE_HEALTH_CHANGED);
+    }
+}
+
+GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, const GATEWAY_OPTIONS* options, bool use_json)
 {
     GATEWAY_HANDLE_DATA* gateway;
     /*Codes_SRS_GATEWAY_14_001: [This function shall create a GATEWAY_HANDLE representing the newly created gateway.]*/
@@ -150,7 +260,30 @@ GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, boo
         memset(gateway, 0, sizeof(GATEWAY_HANDLE_DATA));
 
         /*Codes_SRS_GATEWAY_14_003: [This function shall create a new BROKER_HANDLE for the gateway representing this gateway's message broker. ]*/
-        gateway->broker = Broker_Create();
+        if (options == NULL || options->broker_scheduler == NULL)
+        {
+            gateway->broker = Broker_Create();
+            /*Codes_SRS_GATEWAY_30_005: [ If options->thread_scheduling is not NULL and options->broker_scheduler is NULL, the function shall keep a copy of options->thread_scheduling for the modules it adds. ]*/
+            if (options != NULL && options->thread_scheduling != NULL)
+            {
+                gateway->module_thread_scheduling = *(options->thread_scheduling);
+            }
+        }
+        else
+        {
+            /*Codes_SRS_GATEWAY_30_002: [ If options is not NULL and options->broker_scheduler is not NULL, the function shall create the BROKER_HANDLE with Broker_CreateWithScheduler instead. ]*/
+            /*Codes_SRS_GATEWAY_30_004: [ If options->thread_scheduling is not NULL, the function shall create the worker pool with options->thread_scheduling instead of options->broker_scheduler->thread_scheduling. ]*/
+            if (options->thread_scheduling == NULL)
+            {
+                gateway->broker = Broker_CreateWithScheduler(options->broker_scheduler);
+            }
+            else
+            {
+                BROKER_SCHEDULER_CONFIG scheduler = *(options->broker_scheduler);
+                scheduler.thread_scheduling = *(options->thread_scheduling);
+                gateway->broker = Broker_CreateWithScheduler(&scheduler);
+            }
+        }
         if (gateway->broker == NULL)
         {
             /*Codes_SRS_GATEWAY_14_004: [This function shall return NULL if a BROKER_HANDLE cannot be created.]*/
@@ -189,14 +322,15 @@ GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, boo
                         if (entries_count > 0)
                         {
                             //Add the first module, if successful add others
-                            GATEWAY_MODULES_ENTRY* entry = (GATEWAY_MODULES_ENTRY*)VECTOR_element(properties->gateway_modules, 0);
-                            MODULE_HANDLE module = gateway_addmodule_internal(gateway, entry, use_json);
+                            const BROKER_INBOX_CONFIG* module_inbox;
+                            const GATEWAY_MODULES_ENTRY* entry = get_module_entry(properties->gateway_modules, 0, use_json, &module_inbox);
+                            MODULE_HANDLE module = gateway_addmodule_internal(gateway, entry, module_inbox, use_json);
 
                             //Continue adding modules until all are added or one fails
                             for (size_t properties_index = 1; properties_index < entries_count && module != NULL; ++properties_index)
                             {
-                                entry = (GATEWAY_MODULES_ENTRY*)VECTOR_element(properties->gateway_modules, properties_index);
-                                module = gateway_addmodule_internal(gateway, entry, use_json);
+                                entry = get_module_entry(properties->gateway_modules, properties_index, use_json, &module_inbox);
+                                module = gateway_addmodule_internal(gateway, entry, module_inbox, use_json);
                             }
 
                             /*Codes_SRS_GATEWAY_14_036: [ If any MODULE_HANDLE is unable to be created from a GATEWAY_MODULES_ENTRY the GATEWAY_HANDLE will be destroyed. ]*/
@@ -217,14 +351,15 @@ GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, boo
                                 if (entries_count > 0)
                                 {
                                     //Add the first link, if successfull add others
-                                    GATEWAY_LINK_ENTRY* entry = (GATEWAY_LINK_ENTRY*)VECTOR_element(properties->gateway_links, 0);
-                                    bool linkAdded = gateway_addlink_internal(gateway, entry);
+                                    const BROKER_LINK_OPTIONS* options;
+                                    const GATEWAY_LINK_ENTRY* entry = get_link_entry(properties->gateway_links, 0, use_json, &options);
+                                    bool linkAdded = gateway_addlink_internal(gateway, entry, options);
 
                                     //Continue adding links until all are added or one fails
                                     for (size_t links_index = 1; links_index < entries_count && linkAdded; ++links_index)
                                     {
-                                        entry = (GATEWAY_LINK_ENTRY*)VECTOR_element(properties->gateway_links, links_index);
-                                        linkAdded = gateway_addlink_internal(gateway, entry);
+                                        entry = get_link_entry(properties->gateway_links, links_index, use_json, &options);
+                                        linkAdded = gateway_addlink_internal(gateway, entry, options);
                                     }
 
                                     /*Codes_SRS_GATEWAY_04_003: [If any GATEWAY_LINK_ENTRY is unable to be added to the broker the GATEWAY_HANDLE will be destroyed.]*/
@@ -254,6 +389,11 @@ GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, boo
                         }
                         else
                         {
+                            /*Codes_SRS_GATEWAY_30_024: [ If options->thread_scheduling is not NULL, the function shall give it to the event system with EventSystem_SetThreadScheduling before reporting any event. ]*/
+                            if (options != NULL && options->thread_scheduling != NULL)
+                            {
+                                EventSystem_SetThreadScheduling(gateway->event_system, options->thread_scheduling);
+                            }
                             /*Codes_SRS_GATEWAY_26_001: [ This function shall initialize attached Gateway Events callback system and report GATEWAY_STARTED event. ] */
                             EventSystem_ReportEvent(gateway->event_system, gateway, GATEWAY_CREATED);
                             /*Codes_SRS_GATEWAY_26_010: [ This function shall report `GATEWAY_MODULE_LIST_CHANGED` event. ] */
@@ -284,9 +424,6 @@ void gateway_destroy_internal(GATEWAY_HANDLE gw)
             /* event_system might be NULL here if destroying during failed creation, event system API should cleanly handle that */
             /* Codes_SRS_GATEWAY_26_003: [ If the Gateway Events module is initialized, this function shall report GATEWAY_DESTROYED event. ] */
             EventSystem_ReportEvent(gateway_handle->event_system, gateway_handle, GATEWAY_DESTROYED);
-            /* Codes_SRS_GATEWAY_26_004: [ This function shall destroy the attached Gateway Events callback system. ] */
-            EventSystem_Destroy(gateway_handle->event_system);
-            gateway_handle->event_system = NULL;
         }
 
         if (gateway_handle->links != NULL)
@@ -319,6 +456,14 @@ void gateway_destroy_internal(GATEWAY_HANDLE gw)
 #endif
         }
 
+        if (gateway_handle->event_system != NULL)
+        {
+            /* Codes_SRS_GATEWAY_26_004: [ This function shall destroy the attached Gateway Events callback system. ] */
+            /* Codes_SRS_GATEWAY_30_019: [ This function shall destroy the Gateway Events callback system only after removing the modules, which may report GATEWAY_MODULE_HEALTH_CHANGED until then. ] */
+            EventSystem_Destroy(gateway_handle->event_system);
+            gateway_handle->event_system = NULL;
+        }
+
         if (gateway_handle->broker != NULL)
         {
             /*Codes_SRS_GATEWAY_14_006: [The function shall destroy the GATEWAY_HANDLE_DATA's `broker` `BROKER_HANDLE`. ]*/
@@ -340,7 +485,7 @@ bool checkIfModuleExists(GATEWAY_HANDLE_DATA* gateway_handle, const char* module
     return module_data == NULL ? false : true;
 }
 
-MODULE_HANDLE gateway_addmodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_MODULES_ENTRY* module_entry, bool use_json)
+MODULE_HANDLE gateway_addmodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_MODULES_ENTRY* module_entry, const BROKER_INBOX_CONFIG* module_inbox, bool use_json)
 {
     MODULE_HANDLE module_result;
 
@@ -452,9 +597,45 @@ MODULE_HANDLE gateway_addmodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, co
                         module.module_apis = module_apis;
                         module.module_handle = module_handle;
 
+                        BROKER_INBOX_CONFIG gateway_inbox;
+
+                        /*Codes_SRS_GATEWAY_30_006: [ If the gateway keeps a thread scheduling for its modules and module_inbox is NULL or does not set a thread_scheduling, the function shall attach the module with a copy of module_inbox, or of the default inbox, whose thread_scheduling is the gateway's. ]*/
+                        if (THREAD_SCHEDULING_IS_SET(&(gateway_handle->module_thread_scheduling)) &&
+                            (module_inbox == NULL || !THREAD_SCHEDULING_IS_SET(&(module_inbox->thread_scheduling))))
+                        {
+                            if (module_inbox == NULL)
+                            {
+                                memset(&gateway_inbox, 0, sizeof(BROKER_INBOX_CONFIG));
+                            }
+                            else
+                            {
+                                gateway_inbox = *module_inbox;
+                            }
+                            gateway_inbox.thread_scheduling = gateway_handle->module_thread_scheduling;
+                            module_inbox = &gateway_inbox;
+                        }
+
+                        /*Codes_SRS_GATEWAY_30_017: [ If module_inbox has a slow_receive_threshold and no on_health_changed, the function shall attach the module with a copy of module_inbox whose on_health_changed reports GATEWAY_MODULE_HEALTH_CHANGED for the gateway. ]*/
+                        if (module_inbox != NULL &&
+                            module_inbox->slow_receive_threshold > 0 &&
+                            module_inbox->on_health_changed == NULL)
+                        {
+                            if (module_inbox != &gateway_inbox)
+                            {
+                                gateway_inbox = *module_inbox;
+                            }
+                            gateway_inbox.on_health_changed = gateway_module_health_changed;
+                            gateway_inbox.health_context = gateway_handle;
+                            module_inbox = &gateway_inbox;
+                        }
+
                         /*Codes_SRS_GATEWAY_14_017: [The function shall attach the module to the GATEWAY_HANDLE_DATA's broker using a call to Broker_AddModule. ]*/
+                        /*Codes_SRS_GATEWAY_30_001: [ If module_inbox is not NULL, the function shall attach the module using a call to Broker_AddModuleWithInbox with module_inbox instead. ]*/
                         /*Codes_SRS_GATEWAY_14_018: [If the function cannot attach the module to the message broker, the function shall return NULL.]*/
-                        if (Broker_AddModule(gateway_handle->broker, &module) != BROKER_OK)
+                        BROKER_RESULT add_result = (module_inbox == NULL) ?
+                            Broker_AddModule(gateway_handle->broker, &module) :
+                            Broker_AddModuleWithInbox(gateway_handle->broker, &module, module_inbox);
+                        if (add_result != BROKER_OK)
                         {
                             free(new_module_data);
                             module_result = NULL;
@@ -588,7 +769,7 @@ void gateway_removemodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_D
     free(module_data_ptr);
 }
 
-bool gateway_addlink_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry)
+bool gateway_addlink_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry, const BROKER_LINK_OPTIONS* options)
 {
     bool result;
 
@@ -601,7 +782,7 @@ bool gateway_addlink_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY
         if (strcmp(GATEWAY_ALL, link_entry->module_source) == 0)
         {
             /*Codes_SRS_GATEWAY_17_002: [ The gateway shall accept a link with a source of "*" and a sink of a valid module. ]*/
-            if (add_any_source_link(gateway_handle, link_entry) != 0)
+            if (add_any_source_link(gateway_handle, link_entry, options) != 0)
             {
                 LogError("Failed to add a any_source link sink = %s", link_entry->module_sink);
                 result = false;
@@ -613,7 +794,7 @@ bool gateway_addlink_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY
         }
         else
         {
-            if (add_regular_link(gateway_handle, link_entry) != 0)
+            if (add_regular_link(gateway_handle, link_entry, options) != 0)
             {
                 LogError("Failed to add a any_source link sink = %s", link_entry->module_sink);
                 result = false;
@@ -643,16 +824,11 @@ void gateway_removelink_internal(GATEWAY_HANDLE_DATA* gateway_handle, LINK_DATA*
     }
     else
     {
-
-        BROKER_LINK_DATA broker_data =
-        {
-            link_data->module_source->module,
-            link_data->module_sink->module
-        };
-
-        Broker_RemoveLink(gateway_handle->broker, &broker_data);
+        (void)remove_one_link_from_broker(gateway_handle, link_data->module_source->module, link_data->module_sink->module, link_data);
     }
 
+    free(link_data->filter);
+    free(link_data->coalesce_key);
     VECTOR_erase(gateway_handle->links, link_data, 1);
 }
 
@@ -675,7 +851,7 @@ int add_module_to_any_source(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_DATA* m
             }
             else
             {
-                if (add_one_link_to_broker(gateway_handle, module->module, (*module_sink)->module) != 0)
+                if (add_one_link_to_broker(gateway_handle, module->module, (*module_sink)->module, link_data) != 0)
                 {
                     result = __LINE__;
                     break;
@@ -709,7 +885,7 @@ void remove_module_from_any_source(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_D
                 }
                 else
                 {
-                    if (remove_one_link_from_broker(gateway_handle, module->module, (*module_sink)->module) != 0)
+                    if (remove_one_link_from_broker(gateway_handle, module->module, (*module_sink)->module, link_data) != 0)
                     {
                         LogError("Unable to remove link to Broker.");
                     }
@@ -719,7 +895,7 @@ void remove_module_from_any_source(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_D
     }
 }
 
-int add_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry)
+int add_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry, const BROKER_LINK_OPTIONS* options)
 {
     int result;
     MODULE_DATA** module_sink_data = (MODULE_DATA**)VECTOR_find_if(gateway_handle->modules, module_name_find, link_entry->module_sink);
@@ -737,13 +913,27 @@ int add_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_
         {
             true,
             no_module,
-            *module_sink_data
+            *module_sink_data,
+            (options == NULL) ? 0 : options->priority,
+            NULL,
+            NULL
         };
 
+        /*Codes_SRS_GATEWAY_30_014: [ The function shall keep a copy of `options->filter` with the link. ]*/
+        /*Codes_SRS_GATEWAY_30_016: [ The function shall keep a copy of `options->coalesce_key` with the link. ]*/
+        if (copy_link_string((options == NULL) ? NULL : options->filter, &(link_data.filter)) != 0 ||
+            copy_link_string((options == NULL) ? NULL : options->coalesce_key, &(link_data.coalesce_key)) != 0)
+        {
+            LogError("Unable to copy the link filter or coalesce key.");
+            free(link_data.filter);
+            result = __LINE__;
+        }
         /*Codes_SRS_GATEWAY_04_012: [ This function shall add the entryLink to the gw->links ] */
-        if (VECTOR_push_back(gateway_handle->links, &link_data, 1) != 0)
+        else if (VECTOR_push_back(gateway_handle->links, &link_data, 1) != 0)
         {
             LogError("Unable to add LINK_DATA* to the gateway links vector.");
+            free(link_data.filter);
+            free(link_data.coalesce_key);
             result = __LINE__;
         }
         else
@@ -757,7 +947,7 @@ int add_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_
                 MODULE_DATA **source_module_data = (MODULE_DATA **)VECTOR_element(gateway_handle->modules, m);
                 /*Codes_SRS_GATEWAY_17_005: [ For this link, the sink shall receive all messages publish by other modules. ]*/
                 if ((*source_module_data)->module != (*module_sink_data)->module &&
-                    add_one_link_to_broker(gateway_handle, (*source_module_data)->module, (*module_sink_data)->module) != 0)
+                    add_one_link_to_broker(gateway_handle, (*source_module_data)->module, (*module_sink_data)->module, &link_data) != 0)
                 {
                     result = __LINE__;
                     break;
@@ -767,6 +957,8 @@ int add_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_
             {
                 remove_any_source_link(gateway_handle, &link_data);
                 VECTOR_erase(gateway_handle->links, VECTOR_back(gateway_handle->links), 1);
+                free(link_data.filter);
+                free(link_data.coalesce_key);
             }
         }
     }
@@ -786,7 +978,7 @@ void remove_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, LINK_DATA* link
         {
             MODULE_DATA **source_module_data = (MODULE_DATA **)VECTOR_element(gateway_handle->modules, m);
             if ((*source_module_data)->module != (*module_sink_data)->module &&
-                remove_one_link_from_broker(gateway_handle, (*source_module_data)->module, (*module_sink_data)->module) != 0)
+                remove_one_link_from_broker(gateway_handle, (*source_module_data)->module, (*module_sink_data)->module, link_entry) != 0)
             {
                 LogError("Unable to remove link to Broker.");
             }
@@ -41,23 +41,51 @@ typedef struct GATEWAY_HANDLE_DATA_TAG {
 
     /** @brief  Vector of LINK_DATA links that the Gateway must track */
     VECTOR_HANDLE links;
+
+    /** @brief  Thread scheduling given to modules whose inbox does not set
+     *          one; zero when the broker has a worker pool, which applies the
+     *          gateway's default itself
+     */
+    THREAD_SCHEDULING_CONFIG module_thread_scheduling;
 } GATEWAY_HANDLE_DATA;
 
 typedef struct LINK_DATA_TAG {
     bool from_any_source;
     MODULE_DATA *module_source;
     MODULE_DATA *module_sink;
+    size_t priority;
+    /** @brief  The gateway's copy of the link filter, NULL for none */
+    char* filter;
+    /** @brief  The gateway's copy of the link coalesce key, NULL for none */
+    char* coalesce_key;
 } LINK_DATA;
 
-GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, bool use_json);
+/** @brief  An element of the gateway_modules of the GATEWAY_PROPERTIES read
+ *          from a JSON configuration, which also carries the module's inbox
+ */
+typedef struct GATEWAY_JSON_MODULES_ENTRY_TAG {
+    GATEWAY_MODULES_ENTRY entry;
+    /** @brief  The inbox configuration of the module, NULL for the default */
+    BROKER_INBOX_CONFIG* module_inbox;
+} GATEWAY_JSON_MODULES_ENTRY;
+
+/** @brief  An element of the gateway_links of the GATEWAY_PROPERTIES read from
+ *          a JSON configuration, which also carries the options of the link
+ */
+typedef struct GATEWAY_JSON_LINK_ENTRY_TAG {
+    GATEWAY_LINK_ENTRY entry;
+    BROKER_LINK_OPTIONS options;
+} GATEWAY_JSON_LINK_ENTRY;
+
+GATEWAY_HANDLE gateway_create_internal(const GATEWAY_PROPERTIES* properties, const GATEWAY_OPTIONS* options, bool use_json);
 void gateway_destroy_internal(GATEWAY_HANDLE gw);
-MODULE_HANDLE gateway_addmodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_MODULES_ENTRY* entry, bool use_json);
+MODULE_HANDLE gateway_addmodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_MODULES_ENTRY* entry, const BROKER_INBOX_CONFIG* module_inbox, bool use_json);
 void gateway_removemodule_internal(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_DATA** module);
-bool gateway_addlink_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry);
+bool gateway_addlink_internal(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry, const BROKER_LINK_OPTIONS* options);
 void gateway_removelink_internal(GATEWAY_HANDLE_DATA* gateway_handle, LINK_DATA* link_data);
 int add_module_to_any_source(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_DATA* module);
 void remove_module_from_any_source(GATEWAY_HANDLE_DATA* gateway_handle, MODULE_DATA* module);
-int add_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry);
+int add_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, const GATEWAY_LINK_ENTRY* link_entry, const BROKER_LINK_OPTIONS* options);
 void remove_any_source_link(GATEWAY_HANDLE_DATA* gateway_handle, LINK_DATA* link_entry);
 bool module_name_find(const void* element, const void* module_name);
 bool link_data_find(const void* element, const void* link_data);
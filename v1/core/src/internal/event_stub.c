@@ -48,6 +48,12 @@ void EventSystem_ReportEvent(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gw,
     (void)event_type;
 }
 
+void EventSystem_SetThreadScheduling(EVENTSYSTEM_HANDLE event_system, const THREAD_SCHEDULING_CONFIG* thread_scheduling)
+{
+    (void)event_system;
+    (void)thread_scheduling;
+}
+
 void EventSystem_Destroy(EVENTSYSTEM_HANDLE handle)
 {
     if (handle != NULL)
@@ -12,6 +12,7 @@
 #include "azure_c_shared_utility/singlylinkedlist.h"
 
 #include "gateway.h"
+#include "thread_scheduling.h"
 #include "experimental/event_system.h"
 
 #include <assert.h>
@@ -31,6 +32,8 @@ struct EVENTSYSTEM_DATA {
     LOCK_HANDLE thread_queue_lock;
     COND_HANDLE thread_queue_condition;
     SINGLYLINKEDLIST_HANDLE thread_queue;
+    /* CPU affinity and scheduling applied by the callback thread when it starts */
+    THREAD_SCHEDULING_CONFIG thread_scheduling;
 };
 
 typedef struct CALLBACK_CLOSURE_TAG {
@@ -55,9 +58,11 @@ static THREAD_QUEUE_ROW* get_from_thread_queue(EVENTSYSTEM_HANDLE event_system,
 static void destroy_thread_row(THREAD_QUEUE_ROW* row);
 static int callback_thread_main_func(void* event_system_param);
 static GATEWAY_EVENT_CTX handle_module_list_update(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gateway, VECTOR_HANDLE callbacks);
+static GATEWAY_EVENT_CTX handle_statistics_report(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gateway, VECTOR_HANDLE callbacks);
 
 /** @brief This function assumes that the context is a #VECTOR_HANDLE and destroys it */
 static void callback_destroy_modulelist(GATEWAY_HANDLE gateway, GATEWAY_EVENT event_type, GATEWAY_EVENT_CTX context, void* user_param);
+static void callback_destroy_statistics(GATEWAY_HANDLE gateway, GATEWAY_EVENT event_type, GATEWAY_EVENT_CTX context, void* user_param);
 
 EVENTSYSTEM_HANDLE EventSystem_Init(void)
 {
@@ -194,6 +199,9 @@ void EventSystem_ReportEvent(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gw,
                         case GATEWAY_MODULE_LIST_CHANGED:
                             context = handle_module_list_update(event_system, gw, call_queue);
                             break;
+                        case GATEWAY_STATISTICS_REPORTED:
+                            context = handle_statistics_report(event_system, gw, call_queue);
+                            break;
                         default:
                             break;
                         }
@@ -214,6 +222,20 @@ void EventSystem_Destroy(EVENTSYSTEM_HANDLE handle)
     destroy_event_system(handle);
 }
 
+void EventSystem_SetThreadScheduling(EVENTSYSTEM_HANDLE event_system, const THREAD_SCHEDULING_CONFIG* thread_scheduling)
+{
+    /* Codes_SRS_EVENTSYSTEM_30_003: [ This function shall log a failure and do nothing else when either `event_system` or `thread_scheduling` parameters are NULL. ] */
+    if (event_system == NULL || thread_scheduling == NULL)
+    {
+        LogError("invalid parameter (NULL) when setting the event system thread scheduling");
+    }
+    else
+    {
+        /* Codes_SRS_EVENTSYSTEM_30_004: [ This function shall keep a copy of `thread_scheduling` for the callback thread. ] */
+        event_system->thread_scheduling = *thread_scheduling;
+    }
+}
+
 /*********************
  * Private functions *
  *********************/
@@ -373,6 +395,14 @@ static int callback_thread_main_func(void* event_system_param)
 {
     EVENTSYSTEM_HANDLE event_system = (EVENTSYSTEM_HANDLE)event_system_param;
     THREAD_QUEUE_ROW* row;
+
+    /* Codes_SRS_EVENTSYSTEM_30_005: [ Before it calls any callback, the callback thread shall apply the thread scheduling of the event system to itself by calling ThreadScheduling_Apply if it changes any setting; if that fails, the thread shall continue. ] */
+    if (THREAD_SCHEDULING_IS_SET(&(event_system->thread_scheduling)) &&
+        ThreadScheduling_Apply(&(event_system->thread_scheduling)) != 0)
+    {
+        LogError("unable to apply the thread scheduling to the event system callback thread");
+    }
+
     while ((row = get_from_thread_queue(event_system, THREAD_EMPTY_QUEUE_TIMEOUT_MS)) != NULL)
     {
         size_t vector_size = VECTOR_size(row->callbacks);
@@ -430,4 +460,38 @@ static void callback_destroy_modulelist(GATEWAY_HANDLE gateway, GATEWAY_EVENT ev
     (void)event_type;
     (void)user_param;
     Gateway_DestroyModuleList((VECTOR_HANDLE)context);
-}
\ No newline at end of file
+}
+
+static GATEWAY_EVENT_CTX handle_statistics_report(EVENTSYSTEM_HANDLE event_system, GATEWAY_HANDLE gateway, VECTOR_HANDLE callbacks)
+{
+    /* Codes_SRS_EVENTSYSTEM_30_001: [ This event shall provide `VECTOR_HANDLE` as returned from #Gateway_GetStatistics as the event context in callbacks ] */
+    VECTOR_HANDLE statistics = Gateway_GetStatistics(gateway);
+    if (statistics == NULL)
+    {
+        event_system->is_errored = 1;
+    }
+    else
+    {
+        CALLBACK_CLOSURE closure = {
+            callback_destroy_statistics,
+            NULL
+        };
+        /* Codes_SRS_EVENTSYSTEM_30_002: [ This event shall clean up the `VECTOR_HANDLE` of #Gateway_GetStatistics after finishing all the callbacks ] */
+        if (VECTOR_push_back(callbacks, &closure, 1) != 0)
+        {
+            LogError("Failed to push back during handling statistics reported event");
+            Gateway_DestroyStatistics(statistics);
+            event_system->is_errored = 1;
+            statistics = NULL;
+        }
+    }
+    return statistics;
+}
+
+static void callback_destroy_statistics(GATEWAY_HANDLE gateway, GATEWAY_EVENT event_type, GATEWAY_EVENT_CTX context, void* user_param)
+{
+    (void)gateway;
+    (void)event_type;
+    (void)user_param;
+    Gateway_DestroyStatistics((VECTOR_HANDLE)context);
+}
@@ -0,0 +1,566 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/vector.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+#include "link_filter.h"
+
+typedef enum LINK_FILTER_OPERATION_TAG
+{
+    LINK_FILTER_EQUALS,
+    LINK_FILTER_NOT_EQUALS,
+    LINK_FILTER_PREFIX,
+    LINK_FILTER_EXISTS,
+    LINK_FILTER_NOT,
+    LINK_FILTER_AND,
+    LINK_FILTER_OR
+} LINK_FILTER_OPERATION;
+
+typedef struct LINK_FILTER_NODE_TAG
+{
+    LINK_FILTER_OPERATION operation;
+    /*the property a comparison looks at and the value it compares it with*/
+    char* name;
+    char* value;
+    size_t value_length;
+    /*the operands of a NOT (left only), an AND or an OR, as indexes of nodes*/
+    size_t left;
+    size_t right;
+} LINK_FILTER_NODE;
+
+typedef struct LINK_FILTER_TAG
+{
+    /*the expression tree, every node after its operands, so the root is the last node*/
+    LINK_FILTER_NODE* nodes;
+    size_t node_count;
+} LINK_FILTER;
+
+typedef struct LINK_FILTER_PARSER_TAG
+{
+    const char* expression;
+    const char* cursor;
+    /*vector of LINK_FILTER_NODE*/
+    VECTOR_HANDLE nodes;
+    size_t depth;
+} LINK_FILTER_PARSER;
+
+static int parse_or(LINK_FILTER_PARSER* parser, size_t* index);
+
+static void destroy_nodes(LINK_FILTER_NODE* nodes, size_t count)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        free(nodes[i].name);
+        free(nodes[i].value);
+    }
+}
+
+static void skip_spaces(LINK_FILTER_PARSER* parser)
+{
+    while (isspace((unsigned char)*(parser->cursor)))
+    {
+        parser->cursor++;
+    }
+}
+
+/*consumes token if the expression continues with it*/
+static bool accept(LINK_FILTER_PARSER* parser, const char* token)
+{
+    bool result;
+    size_t length = strlen(token);
+    skip_spaces(parser);
+    if (strncmp(parser->cursor, token, length) == 0)
+    {
+        parser->cursor += length;
+        result = true;
+    }
+    else
+    {
+        result = false;
+    }
+    return result;
+}
+
+static bool at_end(LINK_FILTER_PARSER* parser)
+{
+    skip_spaces(parser);
+    return *(parser->cursor) == '\0';
+}
+
+static bool is_name_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '-' || c == ':';
+}
+
+/*consumes "function(" if the expression continues with it*/
+static bool accept_function(LINK_FILTER_PARSER* parser, const char* function)
+{
+    bool result;
+    size_t length = strlen(function);
+    skip_spaces(parser);
+    if (strncmp(parser->cursor, function, length) == 0 &&
+        !is_name_char(parser->cursor[length]))
+    {
+        const char* start = parser->cursor;
+        parser->cursor += length;
+        result = accept(parser, "(");
+        if (!result)
+        {
+            parser->cursor = start;
+        }
+    }
+    else
+    {
+        result = false;
+    }
+    return result;
+}
+
+static int syntax_error(const LINK_FILTER_PARSER* parser, const char* expected)
+{
+    LogError("link filter \"%s\": expected %s at offset %d", parser->expression, expected, (int)(parser->cursor - parser->expression));
+    return __LINE__;
+}
+
+static char* copy_text(const char* text, size_t length)
+{
+    char* result = (char*)malloc(length + 1);
+    if (result == NULL)
+    {
+        LogError("unable to allocate %zu bytes for a link filter", length + 1);
+    }
+    else
+    {
+        (void)memcpy(result, text, length);
+        result[length] = '\0';
+    }
+    return result;
+}
+
+/*a string between single or double quotes, which has no escapes*/
+static int parse_string(LINK_FILTER_PARSER* parser, char** text, size_t* length)
+{
+    int result;
+    skip_spaces(parser);
+    if (*(parser->cursor) != '\'' && *(parser->cursor) != '"')
+    {
+        result = syntax_error(parser, "a quoted string");
+    }
+    else
+    {
+        const char* end = strchr(parser->cursor + 1, *(parser->cursor));
+        if (end == NULL)
+        {
+            result = syntax_error(parser, "a closing quote");
+        }
+        else
+        {
+            *length = (size_t)(end - (parser->cursor + 1));
+            *text = copy_text(parser->cursor + 1, *length);
+            if (*text == NULL)
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                parser->cursor = end + 1;
+                result = 0;
+            }
+        }
+    }
+    return result;
+}
+
+/*a property name, either bare or quoted*/
+static int parse_name(LINK_FILTER_PARSER* parser, char** name)
+{
+    int result;
+    skip_spaces(parser);
+    if (*(parser->cursor) == '\'' || *(parser->cursor) == '"')
+    {
+        size_t length;
+        result = parse_string(parser, name, &length);
+    }
+    else
+    {
+        const char* end = parser->cursor;
+        while (is_name_char(*end))
+        {
+            end++;
+        }
+        if (end == parser->cursor)
+        {
+            result = syntax_error(parser, "a property name");
+        }
+        else if ((*name = copy_text(parser->cursor, (size_t)(end - parser->cursor))) == NULL)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            parser->cursor = end;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+/*adds node to the tree; the tree owns the name and value of the node, even when it cannot be added*/
+static int push_node(LINK_FILTER_PARSER* parser, LINK_FILTER_NODE* node, size_t* index)
+{
+    int result;
+    if (VECTOR_size(parser->nodes) >= LINK_FILTER_MAX_TERMS)
+    {
+        LogError("link filter \"%s\" has more than %d terms", parser->expression, LINK_FILTER_MAX_TERMS);
+        free(node->name);
+        free(node->value);
+        result = __LINE__;
+    }
+    else if (VECTOR_push_back(parser->nodes, node, 1) != 0)
+    {
+        LogError("unable to add a term to link filter \"%s\"", parser->expression);
+        free(node->name);
+        free(node->value);
+        result = __LINE__;
+    }
+    else
+    {
+        *index = VECTOR_size(parser->nodes) - 1;
+        result = 0;
+    }
+    return result;
+}
+
+static void init_node(LINK_FILTER_NODE* node, LINK_FILTER_OPERATION operation)
+{
+    node->operation = operation;
+    node->name = NULL;
+    node->value = NULL;
+    node->value_length = 0;
+    node->left = 0;
+    node->right = 0;
+}
+
+/*a comparison, a function or an expression in parentheses*/
+static int parse_term(LINK_FILTER_PARSER* parser, size_t* index)
+{
+    int result;
+    LINK_FILTER_NODE node;
+
+    if (accept(parser, "("))
+    {
+        if (parser->depth == LINK_FILTER_MAX_DEPTH)
+        {
+            LogError("link filter \"%s\" nests deeper than %d", parser->expression, LINK_FILTER_MAX_DEPTH);
+            result = __LINE__;
+        }
+        else
+        {
+            parser->depth++;
+            result = parse_or(parser, index);
+            parser->depth--;
+            if (result == 0 && !accept(parser, ")"))
+            {
+                result = syntax_error(parser, "')'");
+            }
+        }
+    }
+    else if (accept_function(parser, "exists"))
+    {
+        init_node(&node, LINK_FILTER_EXISTS);
+        if (parse_name(parser, &(node.name)) != 0)
+        {
+            result = __LINE__;
+        }
+        else if (!accept(parser, ")"))
+        {
+            free(node.name);
+            result = syntax_error(parser, "')'");
+        }
+        else
+        {
+            result = push_node(parser, &node, index);
+        }
+    }
+    else if (accept_function(parser, "prefix"))
+    {
+        init_node(&node, LINK_FILTER_PREFIX);
+        if (parse_name(parser, &(node.name)) != 0)
+        {
+            result = __LINE__;
+        }
+        else if (!accept(parser, ","))
+        {
+            free(node.name);
+            result = syntax_error(parser, "','");
+        }
+        else if (parse_string(parser, &(node.value), &(node.value_length)) != 0)
+        {
+            free(node.name);
+            result = __LINE__;
+        }
+        else if (!accept(parser, ")"))
+        {
+            free(node.name);
+            free(node.value);
+            result = syntax_error(parser, "')'");
+        }
+        else
+        {
+            result = push_node(parser, &node, index);
+        }
+    }
+    else
+    {
+        init_node(&node, LINK_FILTER_EQUALS);
+        if (parse_name(parser, &(node.name)) != 0)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            if (accept(parser, "=="))
+            {
+                result = 0;
+            }
+            else if (accept(parser, "!="))
+            {
+                node.operation = LINK_FILTER_NOT_EQUALS;
+                result = 0;
+            }
+            else
+            {
+                result = syntax_error(parser, "'==' or '!='");
+            }
+
+            if (result != 0)
+            {
+                free(node.name);
+            }
+            else if (parse_string(parser, &(node.value), &(node.value_length)) != 0)
+            {
+                free(node.name);
+                result = __LINE__;
+            }
+            else
+            {
+                result = push_node(parser, &node, index);
+            }
+        }
+    }
+    return result;
+}
+
+static int parse_not(LINK_FILTER_PARSER* parser, size_t* index)
+{
+    int result;
+    if (accept(parser, "!"))
+    {
+        if (parser->depth == LINK_FILTER_MAX_DEPTH)
+        {
+            LogError("link filter \"%s\" nests deeper than %d", parser->expression, LINK_FILTER_MAX_DEPTH);
+            result = __LINE__;
+        }
+        else
+        {
+            LINK_FILTER_NODE node;
+            init_node(&node, LINK_FILTER_NOT);
+            parser->depth++;
+            result = parse_not(parser, &(node.left));
+            parser->depth--;
+            if (result == 0)
+            {
+                result = push_node(parser, &node, index);
+            }
+        }
+    }
+    else
+    {
+        result = parse_term(parser, index);
+    }
+    return result;
+}
+
+static int parse_and(LINK_FILTER_PARSER* parser, size_t* index)
+{
+    int result = parse_not(parser, index);
+    while (result == 0 && accept(parser, "&&"))
+    {
+        LINK_FILTER_NODE node;
+        init_node(&node, LINK_FILTER_AND);
+        node.left = *index;
+        result = parse_not(parser, &(node.right));
+        if (result == 0)
+        {
+            result = push_node(parser, &node, index);
+        }
+    }
+    return result;
+}
+
+static int parse_or(LINK_FILTER_PARSER* parser, size_t* index)
+{
+    int result = parse_and(parser, index);
+    while (result == 0 && accept(parser, "||"))
+    {
+        LINK_FILTER_NODE node;
+        init_node(&node, LINK_FILTER_OR);
+        node.left = *index;
+        result = parse_and(parser, &(node.right));
+        if (result == 0)
+        {
+            result = push_node(parser, &node, index);
+        }
+    }
+    return result;
+}
+
+LINK_FILTER_HANDLE LinkFilter_Create(const char* expression)
+{
+    LINK_FILTER* result;
+    /*Codes_SRS_LINK_FILTER_30_001: [ If expression is NULL, LinkFilter_Create shall return NULL. ]*/
+    if (expression == NULL)
+    {
+        LogError("invalid arg: expression is NULL");
+        result = NULL;
+    }
+    else
+    {
+        LINK_FILTER_PARSER parser;
+        parser.expression = expression;
+        parser.cursor = expression;
+        parser.depth = 0;
+        parser.nodes = VECTOR_create(sizeof(LINK_FILTER_NODE));
+        if (parser.nodes == NULL)
+        {
+            /*Codes_SRS_LINK_FILTER_30_005: [ If any allocation fails, LinkFilter_Create shall return NULL. ]*/
+            LogError("unable to create the vector of link filter terms");
+            result = NULL;
+        }
+        else
+        {
+            size_t root;
+            /*Codes_SRS_LINK_FILTER_30_002: [ LinkFilter_Create shall compile expression, made of the comparisons `name == 'value'`, `name != 'value'`, `prefix(name, 'value')` and `exists(name)`, combined with `!`, `&&`, `||` and parentheses, where `!` binds tighter than `&&`, which binds tighter than `||`. ]*/
+            /*Codes_SRS_LINK_FILTER_30_003: [ A property name shall be either a run of letters, digits, '_', '.', '-' and ':', or a quoted string; a value shall be a quoted string. Strings shall be enclosed in single or double quotes and have no escapes. ]*/
+            /*Codes_SRS_LINK_FILTER_30_004: [ If expression is not well formed, nests parentheses and negations deeper than LINK_FILTER_MAX_DEPTH or has more than LINK_FILTER_MAX_TERMS comparisons and operators, LinkFilter_Create shall return NULL. ]*/
+            if (parse_or(&parser, &root) != 0)
+            {
+                result = NULL;
+            }
+            else if (!at_end(&parser))
+            {
+                (void)syntax_error(&parser, "'&&', '||' or the end of the filter");
+                result = NULL;
+            }
+            /*Codes_SRS_LINK_FILTER_30_005: [ If any allocation fails, LinkFilter_Create shall return NULL. ]*/
+            else if ((result = (LINK_FILTER*)malloc(sizeof(LINK_FILTER))) == NULL)
+            {
+                LogError("unable to allocate a link filter");
+            }
+            else
+            {
+                result->node_count = VECTOR_size(parser.nodes);
+                result->nodes = (LINK_FILTER_NODE*)malloc(result->node_count * sizeof(LINK_FILTER_NODE));
+                if (result->nodes == NULL)
+                {
+                    LogError("unable to allocate the terms of a link filter");
+                    free(result);
+                    result = NULL;
+                }
+                else
+                {
+                    /*Codes_SRS_LINK_FILTER_30_006: [ Otherwise, LinkFilter_Create shall return a non-NULL handle. ]*/
+                    (void)memcpy(result->nodes, VECTOR_front(parser.nodes), result->node_count * sizeof(LINK_FILTER_NODE));
+                }
+            }
+
+            if (result == NULL)
+            {
+                destroy_nodes((LINK_FILTER_NODE*)VECTOR_front(parser.nodes), VECTOR_size(parser.nodes));
+            }
+            VECTOR_destroy(parser.nodes);
+        }
+    }
+    return result;
+}
+
+void LinkFilter_Destroy(LINK_FILTER_HANDLE filter)
+{
+    /*Codes_SRS_LINK_FILTER_30_007: [ If filter is NULL, LinkFilter_Destroy shall do nothing. ]*/
+    if (filter != NULL)
+    {
+        /*Codes_SRS_LINK_FILTER_30_008: [ LinkFilter_Destroy shall free all resources of filter. ]*/
+        destroy_nodes(filter->nodes, filter->node_count);
+        free(filter->nodes);
+        free(filter);
+    }
+}
+
+static bool evaluate(const LINK_FILTER_NODE* nodes, size_t index, LINK_FILTER_LOOKUP lookup, const void* context)
+{
+    bool result;
+    const LINK_FILTER_NODE* node = &(nodes[index]);
+    /*Codes_SRS_LINK_FILTER_30_014: [ `!`, `&&` and `||` shall be the boolean not, and and or of their operands; `&&` and `||` shall not evaluate their right operand when the left one decides the result. ]*/
+    if (node->operation == LINK_FILTER_NOT)
+    {
+        result = !evaluate(nodes, node->left, lookup, context);
+    }
+    else if (node->operation == LINK_FILTER_AND)
+    {
+        result = evaluate(nodes, node->left, lookup, context) && evaluate(nodes, node->right, lookup, context);
+    }
+    else if (node->operation == LINK_FILTER_OR)
+    {
+        result = evaluate(nodes, node->left, lookup, context) || evaluate(nodes, node->right, lookup, context);
+    }
+    else
+    {
+        /*Codes_SRS_LINK_FILTER_30_015: [ LinkFilter_Matches shall get the value of the property name by calling lookup with context and name; NULL shall mean that the message does not have the property. ]*/
+        const char* value = lookup(context, node->name);
+        switch (node->operation)
+        {
+        case LINK_FILTER_EQUALS:
+            /*Codes_SRS_LINK_FILTER_30_010: [ `name == 'value'` shall be true if the message has the property `name` and its value is `value`. ]*/
+            result = (value != NULL && strcmp(value, node->value) == 0);
+            break;
+        case LINK_FILTER_NOT_EQUALS:
+            /*Codes_SRS_LINK_FILTER_30_011: [ `name != 'value'` shall be true if the message does not have the property `name` or its value is not `value`. ]*/
+            result = (value == NULL || strcmp(value, node->value) != 0);
+            break;
+        case LINK_FILTER_PREFIX:
+            /*Codes_SRS_LINK_FILTER_30_012: [ `prefix(name, 'value')` shall be true if the message has the property `name` and its value starts with `value`. ]*/
+            result = (value != NULL && strncmp(value, node->value, node->value_length) == 0);
+            break;
+        default:
+            /*Codes_SRS_LINK_FILTER_30_013: [ `exists(name)` shall be true if the message has the property `name`. ]*/
+            result = (value != NULL);
+            break;
+        }
+    }
+    return result;
+}
+
+bool LinkFilter_Matches(LINK_FILTER_HANDLE filter, LINK_FILTER_LOOKUP lookup, const void* context)
+{
+    bool result;
+    /*Codes_SRS_LINK_FILTER_30_009: [ If filter or lookup is NULL, LinkFilter_Matches shall return false. ]*/
+    if (filter == NULL || lookup == NULL)
+    {
+        LogError("invalid arg: filter=%p, lookup=%p", filter, lookup);
+        result = false;
+    }
+    else
+    {
+        result = evaluate(filter->nodes, filter->node_count - 1, lookup, context);
+    }
+    return result;
+}
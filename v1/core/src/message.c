@@ -2,8 +2,11 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
 #include "azure_c_shared_utility/gballoc.h"
 
 #include "message.h"
@@ -16,215 +19,1676 @@
 
 #define FIRST_MESSAGE_BYTE 0xA1  /*0xA1 comes from (A)zure (I)oT*/
 #define SECOND_MESSAGE_BYTE 0x60 /*0x60 comes from (G)ateway*/
+#define SECOND_MESSAGE_BYTE_V2 0x62 /*the second byte of a GATEWAY_MESSAGE_VERSION_2 serialization*/
+#define SECOND_MESSAGE_BYTE_V2_EXPIRY 0x63 /*the second byte of a GATEWAY_MESSAGE_VERSION_2 serialization that carries the expiry of the message*/
 
 #define MIN_MESSAGE_BUFFER_LENGTH 14 /*14 is the minimum message length that is still valid*/
+#define MIN_MESSAGE_V2_BUFFER_LENGTH 8 /*header, size, no properties and no content in version 2*/
+
+#define MESSAGE_V2_CONTENT_ALIGNMENT 8 /*the content of a version 2 serialization starts at a multiple of 8*/
+#define MESSAGE_V2_MAX_VARINT_LENGTH 5 /*bytes needed for a varint of 32 bits*/
+
+/*an interned property key*/
+typedef struct MESSAGE_KEY_ENTRY_TAG
+{
+    const char* key;
+    size_t length;
+    MESSAGE_KEY id;
+}MESSAGE_KEY_ENTRY;
+
+#define MESSAGE_DICTIONARY_KEY(key, id) { key, sizeof(key) - 1, id }
+
+/*the key dictionary of GATEWAY_MESSAGE_VERSION_2, part of the format: entries
+are only ever appended, never removed or reordered. These are also the
+well-known keys, the entry at index i has the MESSAGE_KEY i + 1*/
+static const MESSAGE_KEY_ENTRY message_dictionary[] =
+{
+    MESSAGE_DICTIONARY_KEY("source", MESSAGE_KEY_SOURCE),
+    MESSAGE_DICTIONARY_KEY("macAddress", MESSAGE_KEY_MAC_ADDRESS),
+    MESSAGE_DICTIONARY_KEY("deviceName", MESSAGE_KEY_DEVICE_NAME),
+    MESSAGE_DICTIONARY_KEY("deviceKey", MESSAGE_KEY_DEVICE_KEY),
+    MESSAGE_DICTIONARY_KEY("deviceFunction", MESSAGE_KEY_DEVICE_FUNCTION),
+    MESSAGE_DICTIONARY_KEY("timestamp", MESSAGE_KEY_TIMESTAMP),
+    MESSAGE_DICTIONARY_KEY("characteristicUUID", MESSAGE_KEY_CHARACTERISTIC_UUID),
+    MESSAGE_DICTIONARY_KEY("bleControllerIndex", MESSAGE_KEY_BLE_CONTROLLER_INDEX),
+    MESSAGE_DICTIONARY_KEY("iotHubMessageId", MESSAGE_KEY_IOTHUB_MESSAGE_ID),
+    MESSAGE_DICTIONARY_KEY("iotHubMessageDeliveryStatus", MESSAGE_KEY_IOTHUB_MESSAGE_DELIVERY_STATUS)
+};
+
+#define MESSAGE_DICTIONARY_SIZE (sizeof(message_dictionary) / sizeof(message_dictionary[0]))
+
+#define MESSAGE_PROPERTY_INDEX_MIN_SLOTS 8 /*the smallest hash index, a power of 2*/
+
+/*an open addressing hash index over the interned keys of the properties of a
+message, keys and values point into the CONSTMAP of the message. A slot holds
+the position of its property plus one, 0 when it is empty. The properties whose
+keys were not interned when the index was built are listed in unindexed, after
+the slots, and compared by name*/
+typedef struct MESSAGE_PROPERTY_INDEX_SLOT_TAG
+{
+    MESSAGE_KEY key;
+    uint32_t position;
+}MESSAGE_PROPERTY_INDEX_SLOT;
+
+typedef struct MESSAGE_PROPERTY_INDEX_TAG
+{
+    const char* const* keys;
+    const char* const* values;
+    size_t mask;
+    uint32_t* unindexed;
+    size_t unindexedCount;
+    MESSAGE_PROPERTY_INDEX_SLOT slots[1];
+}MESSAGE_PROPERTY_INDEX;
+
+/*a property set or removed by a derived message*/
+typedef struct MESSAGE_OVERLAY_ENTRY_TAG
+{
+    const char* key;
+    /*the interned key, MESSAGE_KEY_NONE if it was not interned when the
+    message was made*/
+    MESSAGE_KEY id;
+    bool removed;
+    MESSAGE_VALUE value;
+    /*the value as a string: value.value.string for a string, converted by the
+    first call that needs it for the other types*/
+    char* volatile text;
+}MESSAGE_OVERLAY_ENTRY;
 
 typedef struct MESSAGE_HANDLE_DATA_TAG
 {
     CONSTMAP_HANDLE properties;
     CONSTBUFFER_HANDLE content;
+    uint64_t creationTime;
+    uint64_t timeToLive;
+    /*the serialization of the message in each version, made by the first
+    Message_GetSerialization that needs it*/
+    CONSTBUFFER_HANDLE volatile serializations[GATEWAY_MESSAGE_VERSION_2];
+    /*the same without the content, made by the first
+    Message_GetSerializationHeader that needs it*/
+    CONSTBUFFER_HANDLE volatile serializationHeaders[GATEWAY_MESSAGE_VERSION_2];
+    /*the content of a message made by Message_CreateFromSegments, content is
+    NULL then. A derived message shares the segments of its base, which frees
+    them. flatContent is the copy of more than one segment made by the first
+    Message_GetContent that needs it*/
+    CONSTBUFFER_HANDLE* segments;
+    size_t segmentCount;
+    CONSTBUFFER* volatile flatContent;
+    /*the byte array of a message made by Message_CreateFromByteArrayWithRelease,
+    released with the message. content is NULL then and ownedContent points
+    into ownedBuffer*/
+    void* ownedBuffer;
+    MESSAGE_BUFFER_RELEASE releaseOwnedBuffer;
+    CONSTBUFFER ownedContent;
+    /*a message made by Message_CreateDerived keeps a reference to its base and
+    only the properties it sets or removes in overlay. Its properties are NULL
+    and mergedProperties is made by the first call that needs all of them*/
+    struct MESSAGE_HANDLE_DATA_TAG* base;
+    MESSAGE_OVERLAY_ENTRY* overlay;
+    size_t overlayCount;
+    CONSTMAP_HANDLE volatile mergedProperties;
+    /*the index over properties, made by the first Message_GetPropertyValue
+    that needs it, or no_property_index if it cannot be made*/
+    MESSAGE_PROPERTY_INDEX* volatile propertyIndex;
 }MESSAGE_HANDLE_DATA;
 
 DEFINE_REFCOUNT_TYPE(MESSAGE_HANDLE_DATA);
 
-static MESSAGE_HANDLE_DATA* Message_CreateImpl(const MESSAGE_CONFIG * cfg)
+#if defined(_MSC_VER)
+#include <windows.h>
+#define MESSAGE_THREAD_LOCAL __declspec(thread)
+/*stores value in *destination if it is still NULL, true if it did*/
+#define MESSAGE_PUBLISH(destination, value) (InterlockedCompareExchangePointer((PVOID volatile*)(destination), (PVOID)(value), NULL) == NULL)
+#else
+#define MESSAGE_THREAD_LOCAL __thread
+#define MESSAGE_PUBLISH(destination, value) __sync_bool_compare_and_swap((destination), NULL, (value))
+#endif
+
+/*the key table of the process, an open addressing hash set of interned keys.
+Slots are only ever filled, with MESSAGE_PUBLISH, never emptied, so that it is
+read without a lock. The key in slot i has the MESSAGE_KEY
+MESSAGE_DICTIONARY_SIZE + 1 + i, unless it is one of the well-known keys. Only
+the well-known keys and the keys given to Message_InternKey are put in it, never
+the keys of the messages, and a key is looked for in at most
+MESSAGE_KEY_MAX_PROBES slots, so a full table cannot make lookups slow*/
+static const MESSAGE_KEY_ENTRY* volatile key_table[MESSAGE_KEY_TABLE_SIZE];
+static volatile bool key_table_initialized = false;
+
+/*kept as the index of a message whose index cannot be built, so that it is not
+tried again*/
+static MESSAGE_PROPERTY_INDEX no_property_index;
+
+/*a freed message block kept in the message cache of a thread, the block is
+reused for the link to the next cached block*/
+typedef struct MESSAGE_CACHE_ENTRY_TAG
+{
+    struct MESSAGE_CACHE_ENTRY_TAG* next;
+}MESSAGE_CACHE_ENTRY;
+
+/*the message cache of the calling thread, a free list of message headers, see
+Message_EnableThreadCache*/
+static MESSAGE_THREAD_LOCAL bool cache_enabled = false;
+static MESSAGE_THREAD_LOCAL MESSAGE_CACHE_ENTRY* cache_head = NULL;
+static MESSAGE_THREAD_LOCAL size_t cache_count = 0;
+
+/*returns a message block with its ref count set to 1*/
+static MESSAGE_HANDLE_DATA* message_block_create(void)
 {
     MESSAGE_HANDLE_DATA* result;
-    /*Codes_SRS_MESSAGE_02_006: [Otherwise, Message_Create shall return a non-NULL handle and shall set the internal ref count to "1".]*/
-    result = REFCOUNT_TYPE_CREATE(MESSAGE_HANDLE_DATA);
+    if (cache_head != NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_010: [ Message_Create, Message_CreateFromBuffer and Message_CreateFromByteArray shall take the block of the message from the message cache of the calling thread when it is not empty, instead of allocating it, and set its ref count to "1". ]*/
+        MESSAGE_CACHE_ENTRY* entry = cache_head;
+        cache_head = entry->next;
+        cache_count--;
+        result = (MESSAGE_HANDLE_DATA*)entry;
+        ((REFCOUNT_TYPE(MESSAGE_HANDLE_DATA)*)result)->count = 1;
+    }
+    else
+    {
+        result = REFCOUNT_TYPE_CREATE(MESSAGE_HANDLE_DATA);
+    }
+    return result;
+}
+
+static void message_block_destroy(MESSAGE_HANDLE_DATA* block)
+{
+    if (cache_enabled && cache_count < MESSAGE_THREAD_CACHE_SIZE)
+    {
+        /*Codes_SRS_MESSAGE_30_009: [ Message_EnableThreadCache shall make the calling thread keep the blocks of up to MESSAGE_THREAD_CACHE_SIZE messages it frees in its message cache instead of freeing them. ]*/
+        MESSAGE_CACHE_ENTRY* entry = (MESSAGE_CACHE_ENTRY*)block;
+        entry->next = cache_head;
+        cache_head = entry;
+        cache_count++;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_011: [ When the message cache of the calling thread is not enabled or is full, freeing a message shall free its block. ]*/
+        free(block);
+    }
+}
+
+/*the content of a message as the list of its segments*/
+typedef struct MESSAGE_CONTENT_GATHER_TAG
+{
+    const CONSTBUFFER* segments[MESSAGE_MAX_CONTENT_SEGMENTS];
+    size_t count;
+    size_t size;
+}MESSAGE_CONTENT_GATHER;
+
+/*returns the segments of a message, a message not made of segments having its
+content as the only one*/
+static void gather_content(MESSAGE_HANDLE_DATA* messageData, MESSAGE_CONTENT_GATHER* gather)
+{
+    if (messageData->segmentCount == 0)
+    {
+        gather->segments[0] = (messageData->content != NULL) ? CONSTBUFFER_GetContent(messageData->content) : &messageData->ownedContent;
+        gather->count = 1;
+        gather->size = gather->segments[0]->size;
+    }
+    else
+    {
+        size_t i;
+        gather->size = 0;
+        for (i = 0; i < messageData->segmentCount; i++)
+        {
+            gather->segments[i] = CONSTBUFFER_GetContent(messageData->segments[i]);
+            gather->size += gather->segments[i]->size;
+        }
+        gather->count = messageData->segmentCount;
+    }
+}
+
+/*returns the segments of a message copied one after the other, made the first
+time they are needed, or NULL if they cannot be copied*/
+static const CONSTBUFFER* flat_content(MESSAGE_HANDLE_DATA* messageData)
+{
+    CONSTBUFFER* result = messageData->flatContent;
+    if (result == NULL)
+    {
+        MESSAGE_CONTENT_GATHER gather;
+        gather_content(messageData, &gather);
+        /*the bytes follow the CONSTBUFFER in the same allocation*/
+        result = (CONSTBUFFER*)malloc(sizeof(CONSTBUFFER) + gather.size);
+        if (result == NULL)
+        {
+            LogError("unable to allocate %zu bytes for the content of the message", gather.size);
+        }
+        else
+        {
+            unsigned char* destination = (unsigned char*)(result + 1);
+            size_t i;
+            result->buffer = destination;
+            result->size = gather.size;
+            for (i = 0; i < gather.count; i++)
+            {
+                (void)memcpy(destination, gather.segments[i]->buffer, gather.segments[i]->size);
+                destination += gather.segments[i]->size;
+            }
+
+            if (!MESSAGE_PUBLISH(&messageData->flatContent, result))
+            {
+                /*Codes_SRS_MESSAGE_30_072: [ If another thread kept a copy first, the copy made shall be freed and the one kept used instead. ]*/
+                free(result);
+                result = messageData->flatContent;
+            }
+        }
+    }
+    return result;
+}
+
+/*returns the content of a message, wherever it is kept*/
+static const CONSTBUFFER* message_content(MESSAGE_HANDLE_DATA* messageData)
+{
+    const CONSTBUFFER* result;
+    if (messageData->segmentCount > 1)
+    {
+        /*Codes_SRS_MESSAGE_30_071: [ If message is made of more than one segment, Message_GetContent shall copy the segments one after the other into one buffer the first time it is called, keep the copy with the message and return it, or return NULL if the copy cannot be allocated. ]*/
+        result = flat_content(messageData);
+    }
+    else if (messageData->segmentCount == 1)
+    {
+        /*Codes_SRS_MESSAGE_30_070: [ If message is made of one segment, Message_GetContent shall return the content of that segment. ]*/
+        result = CONSTBUFFER_GetContent(messageData->segments[0]);
+    }
+    else
+    {
+        result = (messageData->content != NULL) ? CONSTBUFFER_GetContent(messageData->content) : &messageData->ownedContent;
+    }
+    return result;
+}
+
+#define MESSAGE_VALUE_TEXT_SIZE 40 /*enough for any int64, double with 17 digits or timestamp*/
+
+static const char base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static char* bytes_to_base64(const unsigned char* buffer, size_t size)
+{
+    char* result = (char*)malloc(((size + 2) / 3) * 4 + 1);
+    if (result != NULL)
+    {
+        char* destination = result;
+        size_t i;
+        for (i = 0; i < size; i += 3)
+        {
+            uint32_t triple = ((uint32_t)buffer[i] << 16) |
+                ((i + 1 < size) ? ((uint32_t)buffer[i + 1] << 8) : 0) |
+                ((i + 2 < size) ? (uint32_t)buffer[i + 2] : 0);
+            *destination++ = base64_alphabet[(triple >> 18) & 0x3F];
+            *destination++ = base64_alphabet[(triple >> 12) & 0x3F];
+            *destination++ = (i + 1 < size) ? base64_alphabet[(triple >> 6) & 0x3F] : '=';
+            *destination++ = (i + 2 < size) ? base64_alphabet[triple & 0x3F] : '=';
+        }
+        *destination = '\0';
+    }
+    return result;
+}
+
+/*divides rounding towards minus infinity, for the timestamps before 1970*/
+static int64_t floor_divide(int64_t numerator, int64_t denominator)
+{
+    int64_t result = numerator / denominator;
+    if ((numerator % denominator) < 0)
+    {
+        result--;
+    }
+    return result;
+}
+
+/*writes a timestamp in ISO 8601, in UTC with microseconds. The date is
+computed here, in the proleptic Gregorian calendar, as gmtime is neither
+reentrant nor able to take every int64_t*/
+static int format_timestamp(char* destination, size_t size, int64_t timestamp)
+{
+    int64_t seconds = floor_divide(timestamp, 1000000);
+    int64_t days = floor_divide(seconds, 86400);
+    int64_t secondOfDay = seconds - days * 86400;
+    int64_t microsecond = timestamp % 1000000;
+    int64_t shifted = days + 719468; /*days since 0000-03-01*/
+    int64_t era = floor_divide(shifted, 146097);
+    uint32_t dayOfEra = (uint32_t)(shifted - era * 146097);
+    uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    uint32_t shiftedMonth = (5 * dayOfYear + 2) / 153;
+    uint32_t day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+    uint32_t month = (shiftedMonth < 10) ? shiftedMonth + 3 : shiftedMonth - 9;
+    int64_t year = (int64_t)yearOfEra + era * 400 + ((month <= 2) ? 1 : 0);
+    int written = snprintf(destination, size, "%04" PRId64 "-%02" PRIu32 "-%02" PRIu32 "T%02d:%02d:%02d.%06dZ",
+        year, month, day,
+        (int)(secondOfDay / 3600), (int)((secondOfDay / 60) % 60), (int)(secondOfDay % 60),
+        (int)((microsecond < 0) ? microsecond + 1000000 : microsecond));
+    return ((written < 0) || ((size_t)written >= size)) ? __LINE__ : 0;
+}
+
+/*converts a typed value to a string, which the caller frees*/
+static char* value_to_string(const MESSAGE_VALUE* value)
+{
+    char* result;
+    if (value->type == MESSAGE_VALUE_BYTES)
+    {
+        result = bytes_to_base64(value->value.bytes.buffer, value->value.bytes.size);
+    }
+    else if ((result = (char*)malloc(MESSAGE_VALUE_TEXT_SIZE)) != NULL)
+    {
+        int written;
+        switch (value->type)
+        {
+        case MESSAGE_VALUE_INT64:
+            written = snprintf(result, MESSAGE_VALUE_TEXT_SIZE, "%" PRId64, value->value.integer);
+            break;
+        case MESSAGE_VALUE_DOUBLE:
+            written = snprintf(result, MESSAGE_VALUE_TEXT_SIZE, "%.17g", value->value.real);
+            break;
+        case MESSAGE_VALUE_BOOL:
+            written = snprintf(result, MESSAGE_VALUE_TEXT_SIZE, "%s", value->value.boolean ? "true" : "false");
+            break;
+        case MESSAGE_VALUE_TIMESTAMP:
+            written = (format_timestamp(result, MESSAGE_VALUE_TEXT_SIZE, value->value.timestamp) == 0) ? 0 : -1;
+            break;
+        default:
+            written = -1;
+            break;
+        }
+
+        if ((written < 0) || (written >= MESSAGE_VALUE_TEXT_SIZE))
+        {
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+/*returns the value of a property set by a derived message as a string*/
+static const char* overlay_entry_text(MESSAGE_OVERLAY_ENTRY* entry)
+{
+    const char* result = entry->text;
     if (result == NULL)
     {
-        LogError("malloc returned NULL");
-        /*return as is*/
+        /*Codes_SRS_MESSAGE_30_058: [ The first time a property set by Message_CreateDerivedWithValues is needed as a string, its value shall be converted to a string kept with the message: an int64 in decimal, a double with 17 significant digits, a bool as "true" or "false", bytes in base64 and a timestamp in ISO 8601 in UTC with microseconds, as in "2016-11-07T09:30:00.000250Z"; if another thread kept one first, the string converted shall be freed and the one kept used instead. ]*/
+        char* text = value_to_string(&entry->value);
+        if (text == NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_059: [ If the value cannot be converted, the property shall be missing from the strings of the message. ]*/
+            LogError("unable to convert the value of property %s to a string", entry->key);
+        }
+        else if (!MESSAGE_PUBLISH(&entry->text, text))
+        {
+            free(text);
+        }
+        result = entry->text;
+    }
+    return result;
+}
+
+static CONSTMAP_HANDLE message_properties(MESSAGE_HANDLE_DATA* messageData);
+
+/*applies the overlay of a derived message to a copy of the properties of its
+base, in order, so that removals come before additions*/
+static CONSTMAP_HANDLE merge_properties(MESSAGE_HANDLE_DATA* messageData)
+{
+    CONSTMAP_HANDLE result;
+    CONSTMAP_HANDLE baseProperties = message_properties(messageData->base);
+    MAP_HANDLE merged = (baseProperties == NULL) ? NULL : ConstMap_CloneWriteable(baseProperties);
+    if (merged == NULL)
+    {
+        LogError("unable to copy the properties of the base message");
+        result = NULL;
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; i < messageData->overlayCount; i++)
+        {
+            MESSAGE_OVERLAY_ENTRY* entry = &messageData->overlay[i];
+            const char* text = entry->removed ? NULL : overlay_entry_text(entry);
+            MAP_RESULT mapResult = entry->removed ?
+                Map_Delete(merged, entry->key) :
+                ((text == NULL) ? MAP_ERROR : Map_AddOrUpdate(merged, entry->key, text));
+            if ((mapResult != MAP_OK) && (mapResult != MAP_KEYNOTFOUND))
+            {
+                LogError("unable to apply property %s to the properties of the base message", entry->key);
+                break;
+            }
+        }
+
+        if (i < messageData->overlayCount)
+        {
+            result = NULL;
+        }
+        else
+        {
+            result = ConstMap_Create(merged);
+            if (result == NULL)
+            {
+                LogError("ConstMap_Create failed");
+            }
+        }
+        Map_Destroy(merged);
+    }
+    return result;
+}
+
+/*returns the properties of a message, merging the ones of a derived message
+the first time they are needed*/
+static CONSTMAP_HANDLE message_properties(MESSAGE_HANDLE_DATA* messageData)
+{
+    CONSTMAP_HANDLE result;
+    if (messageData->base == NULL)
+    {
+        result = messageData->properties;
+    }
+    else
+    {
+        result = messageData->mergedProperties;
+        if (result == NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_036: [ The first time all the properties of a message made by Message_CreateDerived are needed, they shall be merged into a new CONSTMAP kept with the message; if another thread kept one first, the merged CONSTMAP shall be destroyed and the one kept used instead. ]*/
+            result = merge_properties(messageData);
+            if (
+                (result != NULL) &&
+                !MESSAGE_PUBLISH(&messageData->mergedProperties, result)
+                )
+            {
+                ConstMap_Destroy(result);
+                result = messageData->mergedProperties;
+            }
+        }
+    }
+    return result;
+}
+
+/*FNV-1a*/
+static uint32_t hash_property_key(const char* key)
+{
+    uint32_t result = 2166136261u;
+    while (*key != '\0')
+    {
+        result ^= (unsigned char)*key;
+        result *= 16777619u;
+        key++;
+    }
+    return result;
+}
+
+/*finds key in the key table. When it is not there, *emptySlot is the slot
+where it would go, or MESSAGE_KEY_TABLE_SIZE if the MESSAGE_KEY_MAX_PROBES
+slots it may go in are all taken*/
+static const MESSAGE_KEY_ENTRY* find_key_entry(const char* key, uint32_t hash, size_t* emptySlot)
+{
+    const MESSAGE_KEY_ENTRY* result = NULL;
+    size_t slot = hash & (MESSAGE_KEY_TABLE_SIZE - 1);
+    size_t probes;
+    *emptySlot = MESSAGE_KEY_TABLE_SIZE;
+    /*Codes_SRS_MESSAGE_30_088: [ Looking a key up in the key table of the process shall compare it with at most MESSAGE_KEY_MAX_PROBES keys. ]*/
+    for (probes = 0; probes < MESSAGE_KEY_MAX_PROBES; probes++)
+    {
+        const MESSAGE_KEY_ENTRY* entry = key_table[slot];
+        if (entry == NULL)
+        {
+            *emptySlot = slot;
+            break;
+        }
+        else if (strcmp(entry->key, key) == 0)
+        {
+            result = entry;
+            break;
+        }
+        slot = (slot + 1) & (MESSAGE_KEY_TABLE_SIZE - 1);
+    }
+    return result;
+}
+
+/*puts entry in the key table, returns the entry for its key, which is another
+one when another thread put the same key first, or NULL if there is no room for
+it.
+The id of an entry that is not a well-known key is set from its slot*/
+static const MESSAGE_KEY_ENTRY* insert_key_entry(MESSAGE_KEY_ENTRY* entry, const MESSAGE_KEY_ENTRY* wellKnown)
+{
+    const MESSAGE_KEY_ENTRY* result = NULL;
+    const char* key = (wellKnown != NULL) ? wellKnown->key : entry->key;
+    uint32_t hash = hash_property_key(key);
+    bool done = false;
+    while (!done)
+    {
+        size_t slot;
+        result = find_key_entry(key, hash, &slot);
+        if (result != NULL)
+        {
+            done = true;
+        }
+        else if (slot == MESSAGE_KEY_TABLE_SIZE)
+        {
+            LogError("no free slot in the key table for key %s, unable to intern it", key);
+            done = true;
+        }
+        else
+        {
+            const MESSAGE_KEY_ENTRY* inserted;
+            if (wellKnown != NULL)
+            {
+                inserted = wellKnown;
+            }
+            else
+            {
+                entry->id = (MESSAGE_KEY)(MESSAGE_DICTIONARY_SIZE + 1 + slot);
+                inserted = entry;
+            }
+            if (MESSAGE_PUBLISH(&key_table[slot], inserted))
+            {
+                result = inserted;
+                done = true;
+            }
+            /*else another thread filled the slot first, look again*/
+        }
+    }
+    return result;
+}
+
+/*the well-known keys are put in the key table by the first thread using it,
+putting them twice is harmless*/
+static void intern_well_known_keys(void)
+{
+    if (!key_table_initialized)
+    {
+        size_t i;
+        for (i = 0; i < MESSAGE_DICTIONARY_SIZE; i++)
+        {
+            (void)insert_key_entry(NULL, &message_dictionary[i]);
+        }
+        key_table_initialized = true;
+    }
+}
+
+/*returns the MESSAGE_KEY of key, interning it when create is true, or
+MESSAGE_KEY_NONE*/
+static MESSAGE_KEY intern_key(const char* key, bool create)
+{
+    MESSAGE_KEY result;
+    size_t slot;
+    const MESSAGE_KEY_ENTRY* found;
+    intern_well_known_keys();
+    found = find_key_entry(key, hash_property_key(key), &slot);
+    if (found != NULL)
+    {
+        result = found->id;
+    }
+    else if (!create)
+    {
+        result = MESSAGE_KEY_NONE;
+    }
+    else if (slot == MESSAGE_KEY_TABLE_SIZE)
+    {
+        LogError("no free slot in the key table for key %s, unable to intern it", key);
+        result = MESSAGE_KEY_NONE;
+    }
+    else
+    {
+        size_t length = strlen(key);
+        MESSAGE_KEY_ENTRY* entry = (MESSAGE_KEY_ENTRY*)malloc(sizeof(MESSAGE_KEY_ENTRY) + length + 1);
+        if (entry == NULL)
+        {
+            LogError("unable to allocate key %s", key);
+            result = MESSAGE_KEY_NONE;
+        }
+        else
+        {
+            char* copy = (char*)(entry + 1);
+            (void)memcpy(copy, key, length + 1);
+            entry->key = copy;
+            entry->length = length;
+            found = insert_key_entry(entry, NULL);
+            if (found != entry)
+            {
+                free(entry);
+            }
+            result = (found == NULL) ? MESSAGE_KEY_NONE : found->id;
+        }
+    }
+    return result;
+}
+
+/*returns the name of an interned key, or NULL if key was never interned*/
+static const char* key_name(MESSAGE_KEY key)
+{
+    const char* result;
+    if ((key >= 1) && (key <= MESSAGE_DICTIONARY_SIZE))
+    {
+        result = message_dictionary[key - 1].key;
+    }
+    else if ((key > MESSAGE_DICTIONARY_SIZE) && (key - MESSAGE_DICTIONARY_SIZE - 1 < MESSAGE_KEY_TABLE_SIZE))
+    {
+        const MESSAGE_KEY_ENTRY* entry = key_table[key - MESSAGE_DICTIONARY_SIZE - 1];
+        result = (entry == NULL) ? NULL : entry->key;
+    }
+    else
+    {
+        result = NULL;
+    }
+    return result;
+}
+
+/*spreads the consecutive ids of the keys over the slots of an index*/
+static size_t index_slot_of(MESSAGE_KEY key, size_t mask)
+{
+    return (size_t)(key * 2654435761u) & mask;
+}
+
+/*returns the index of the properties of a message, or NULL if it cannot be
+built. Only the keys already interned are indexed: the keys of a message may
+come from another process, and interning them could fill the key table*/
+static MESSAGE_PROPERTY_INDEX* create_property_index(CONSTMAP_HANDLE properties)
+{
+    MESSAGE_PROPERTY_INDEX* result;
+    const char* const* keys;
+    const char* const* values;
+    size_t count;
+    if (ConstMap_GetInternals(properties, &keys, &values, &count) != CONSTMAP_OK)
+    {
+        LogError("unable to get the properties of the message");
+        result = NULL;
+    }
+    else
+    {
+        /*at most half of the slots are used, so that probes stay short*/
+        size_t slotCount = MESSAGE_PROPERTY_INDEX_MIN_SLOTS;
+        while (slotCount < count * 2)
+        {
+            slotCount *= 2;
+        }
+        /*the positions of the unindexed properties follow the slots*/
+        result = (MESSAGE_PROPERTY_INDEX*)malloc(sizeof(MESSAGE_PROPERTY_INDEX) + (slotCount - 1) * sizeof(MESSAGE_PROPERTY_INDEX_SLOT) + count * sizeof(uint32_t));
+        if (result == NULL)
+        {
+            LogError("unable to allocate the property index of the message");
+        }
+        else
+        {
+            size_t i;
+            result->keys = keys;
+            result->values = values;
+            result->mask = slotCount - 1;
+            result->unindexed = (uint32_t*)(result->slots + slotCount);
+            result->unindexedCount = 0;
+            (void)memset(result->slots, 0, slotCount * sizeof(MESSAGE_PROPERTY_INDEX_SLOT));
+            for (i = 0; i < count; i++)
+            {
+                /*Codes_SRS_MESSAGE_30_046: [ Building the index of a message shall index the keys of its properties that are in the key table of the process, without adding any key to it; the other properties shall be compared by name. ]*/
+                MESSAGE_KEY key = intern_key(keys[i], false);
+                if (key == MESSAGE_KEY_NONE)
+                {
+                    result->unindexed[result->unindexedCount] = (uint32_t)i;
+                    result->unindexedCount++;
+                }
+                else
+                {
+                    size_t slot = index_slot_of(key, result->mask);
+                    while (result->slots[slot].position != 0)
+                    {
+                        slot = (slot + 1) & result->mask;
+                    }
+                    result->slots[slot].key = key;
+                    result->slots[slot].position = (uint32_t)(i + 1);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/*returns the index over the properties of a message, made the first time it
+is needed, or NULL if it cannot be made*/
+static MESSAGE_PROPERTY_INDEX* message_property_index(MESSAGE_HANDLE_DATA* messageData)
+{
+    MESSAGE_PROPERTY_INDEX* result = messageData->propertyIndex;
+    if (result == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_042: [ The first time Message_GetPropertyValue looks up a property of a message, it shall build a hash index over the keys of its properties and keep it with the message; if another thread kept one first, the index built shall be freed and the one kept used instead. ]*/
+        result = create_property_index(messageData->properties);
+        if (result == NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_047: [ If the index of a message cannot be built, the message shall be marked as having no index, and the index shall not be built again. ]*/
+            (void)MESSAGE_PUBLISH(&messageData->propertyIndex, &no_property_index);
+            result = messageData->propertyIndex;
+        }
+        else if (!MESSAGE_PUBLISH(&messageData->propertyIndex, result))
+        {
+            free(result);
+            result = messageData->propertyIndex;
+        }
+    }
+    return (result == &no_property_index) ? NULL : result;
+}
+
+/*looks up a property of a message that is not derived*/
+static const char* indexed_property_value(MESSAGE_HANDLE_DATA* messageData, MESSAGE_KEY key, const char* name)
+{
+    const char* result;
+    MESSAGE_PROPERTY_INDEX* index = message_property_index(messageData);
+    if (index == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_044: [ If the index cannot be built, Message_GetPropertyValue shall look the property up in the CONSTMAP of the message. ]*/
+        result = ConstMap_GetValue(messageData->properties, name);
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_043: [ Message_GetPropertyValue shall find the property through the hash index of the message, comparing the interned keys as integers, and by name among the properties whose keys were not interned when the index was built. ]*/
+        size_t slot = index_slot_of(key, index->mask);
+        size_t i;
+        result = NULL;
+        while ((key != MESSAGE_KEY_NONE) && (index->slots[slot].position != 0))
+        {
+            if (index->slots[slot].key == key)
+            {
+                result = index->values[index->slots[slot].position - 1];
+                break;
+            }
+            slot = (slot + 1) & index->mask;
+        }
+        /*a key interned after the index was built is among the unindexed ones*/
+        for (i = 0; (result == NULL) && (i < index->unindexedCount); i++)
+        {
+            if (strcmp(index->keys[index->unindexed[i]], name) == 0)
+            {
+                result = index->values[index->unindexed[i]];
+            }
+        }
+    }
+    return result;
+}
+
+/*finds the entry of a property in the overlays of a derived message and of
+its bases, the nearest one winning. When no overlay has the property, returns
+NULL and sets *root to the first message that is not derived. key is
+MESSAGE_KEY_NONE when name was never interned*/
+static MESSAGE_OVERLAY_ENTRY* find_overlay_entry(MESSAGE_HANDLE_DATA* messageData, MESSAGE_KEY key, const char* name, MESSAGE_HANDLE_DATA** root)
+{
+    MESSAGE_OVERLAY_ENTRY* result = NULL;
+    while ((result == NULL) && (messageData->base != NULL))
+    {
+        /*the last entry for a key wins, and additions come after removals. A
+        key of the overlay that was not interned is compared by name*/
+        size_t i = messageData->overlayCount;
+        while (
+            (i > 0) &&
+            ((messageData->overlay[i - 1].id != MESSAGE_KEY_NONE) ?
+                (messageData->overlay[i - 1].id != key) :
+                (strcmp(messageData->overlay[i - 1].key, name) != 0))
+            )
+        {
+            i--;
+        }
+
+        if (i > 0)
+        {
+            result = &messageData->overlay[i - 1];
+        }
+        else
+        {
+            messageData = messageData->base;
+        }
+    }
+    *root = messageData;
+    return result;
+}
+
+/*looks up a property as a string, in the overlay of a derived message before
+its base*/
+static const char* message_property_value(MESSAGE_HANDLE_DATA* messageData, MESSAGE_KEY key, const char* name)
+{
+    const char* result;
+    MESSAGE_HANDLE_DATA* root;
+    MESSAGE_OVERLAY_ENTRY* entry = find_overlay_entry(messageData, key, name, &root);
+    if (entry == NULL)
+    {
+        result = indexed_property_value(root, key, name);
+    }
+    else
+    {
+        result = entry->removed ? NULL : overlay_entry_text(entry);
+    }
+    return result;
+}
+
+/*when copyContent is false, the content of the message points to cfg->source
+instead of a copy of it*/
+static MESSAGE_HANDLE_DATA* Message_CreateImpl(const MESSAGE_CONFIG * cfg, bool copyContent)
+{
+    MESSAGE_HANDLE_DATA* result;
+    /*Codes_SRS_MESSAGE_02_006: [Otherwise, Message_Create shall return a non-NULL handle and shall set the internal ref count to "1".]*/
+    result = message_block_create();
+    if (result == NULL)
+    {
+        LogError("malloc returned NULL");
+        /*return as is*/
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_02_004: [Mesages shall be allowed to be created from zero-size content.]*/
+        /*Codes_SRS_MESSAGE_02_015: [The MESSAGE_CONTENT's field size shall have the same value as the cfg's field size.]*/
+        /*Codes_SRS_MESSAGE_17_003: [Message_Create shall copy the source to a readonly CONSTBUFFER.]*/
+        if (copyContent)
+        {
+            result->content = CONSTBUFFER_Create(cfg->source, cfg->size);
+        }
+        else
+        {
+            result->content = NULL;
+            result->ownedContent.buffer = cfg->source;
+            result->ownedContent.size = cfg->size;
+        }
+        if (copyContent && (result->content == NULL))
+        {
+            LogError("CONSBUFFER_Create failed");
+            message_block_destroy(result);
+            result = NULL;
+        }
+        else
+        {
+            /*Codes_SRS_MESSAGE_02_019: [Message_Create shall clone the sourceProperties to a readonly CONSTMAP.]*/
+            result->properties = ConstMap_Create(cfg->sourceProperties);
+            if (result->properties == NULL)
+            {
+                /*Codes_SRS_MESSAGE_02_005: [If Message_Create encounters an error while building the internal structures of the message, then it shall return NULL.] */
+                LogError("ConstMap_Create failed");
+                if (result->content != NULL)
+                {
+                    CONSTBUFFER_Destroy(result->content);
+                }
+                message_block_destroy(result);
+                result = NULL;
+            }
+            else
+            {
+                /*Codes_SRS_MESSAGE_30_001: [ Message_Create shall create a message that never expires. ]*/
+                result->creationTime = 0;
+                result->timeToLive = 0;
+                result->serializations[0] = NULL;
+                result->serializations[1] = NULL;
+                result->serializationHeaders[0] = NULL;
+                result->serializationHeaders[1] = NULL;
+                result->segments = NULL;
+                result->segmentCount = 0;
+                result->flatContent = NULL;
+                result->ownedBuffer = NULL;
+                result->releaseOwnedBuffer = NULL;
+                result->base = NULL;
+                result->overlay = NULL;
+                result->overlayCount = 0;
+                result->mergedProperties = NULL;
+                result->propertyIndex = NULL;
+            }
+        }
+    }
+    return result;
+}
+
+MESSAGE_HANDLE Message_Create(const MESSAGE_CONFIG * cfg)
+{
+    MESSAGE_HANDLE_DATA* result;
+    /*Codes_SRS_MESSAGE_02_002: [If cfg is NULL then Message_Create shall return NULL.]*/
+    if (cfg == NULL)
+    {
+        result = NULL;
+        LogError("invalid parameter (NULL).");
+    }
+    /*Codes_SRS_MESSAGE_02_003: [If field source of cfg is NULL and size is not zero, then Message_Create shall fail and return NULL.] */
+    else if ((cfg->size > 0) && (cfg->source == NULL))
+    {
+        result = NULL;
+        LogError("invalid parameter combination cfg->size=%zd, cfg->source=%p", cfg->size, cfg->source);
+    }
+    else
+    {
+        /*delegate to internal function that does not do validation*/
+        result = Message_CreateImpl(cfg, true);
+    }
+    return (MESSAGE_HANDLE)result;
+}
+
+MESSAGE_HANDLE Message_CreateWithTimeToLive(const MESSAGE_TIME_TO_LIVE_CONFIG* cfg)
+{
+    MESSAGE_HANDLE_DATA* result;
+    if (cfg == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_085: [ If cfg is NULL then Message_CreateWithTimeToLive shall return NULL. ]*/
+        result = NULL;
+        LogError("invalid parameter (NULL).");
+    }
+    /*Codes_SRS_MESSAGE_30_086: [ Otherwise, Message_CreateWithTimeToLive shall create the message as Message_Create does from messageConfig, and fail the same way. ]*/
+    else if ((result = (MESSAGE_HANDLE_DATA*)Message_Create(&cfg->messageConfig)) == NULL)
+    {
+        LogError("unable to create the message");
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_087: [ Message_CreateWithTimeToLive shall keep the creationTime and timeToLive of cfg with the message. ]*/
+        result->creationTime = cfg->creationTime;
+        result->timeToLive = cfg->timeToLive;
+    }
+    return (MESSAGE_HANDLE)result;
+}
+
+MESSAGE_HANDLE Message_CreateFromBuffer(const MESSAGE_BUFFER_CONFIG* cfg)
+{
+    MESSAGE_HANDLE_DATA* result;
+    /*Codes_SRS_MESSAGE_17_008: [ If cfg is NULL then Message_CreateFromBuffer shall return NULL.] */
+    if (cfg == NULL)
+    {
+        result = NULL;
+        LogError("invalid parameter (NULL).");
+    }
+    /* Codes_SRS_MESSAGE_17_009: [If field sourceContent of cfg is NULL, then Message_CreateFromBuffer shall fail and return NULL.]*/
+    else if (cfg->sourceContent == NULL)
+    {
+        result = NULL;
+        LogError("invalid CONSTBUFFER (NULL)");
+    }
+    /*Codes_SRS_MESSAGE_17_010: [If field sourceProperties of cfg is NULL, then Message_CreateFromBuffer shall fail and return NULL.]*/
+    else if (cfg->sourceProperties == NULL)
+    {
+        result = NULL;
+        LogError("invalid properties (NULL)");
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_17_011: [If Message_CreateFromBuffer encounters an error while building the internal structures of the message, then it shall return NULL.]*/
+        /*Codes_SRS_MESSAGE_17_014: [On success, Message_CreateFromBuffer shall return a non-NULL handle and set the internal ref count to "1".]*/
+        result = message_block_create();
+        if (result == NULL)
+        {
+            LogError("malloc returned NULL");
+            /*return as is*/
+        }
+        else
+        {
+            /*Codes_SRS_MESSAGE_17_013: [Message_CreateFromBuffer shall clone the CONSTBUFFER sourceBuffer.]*/
+            result->content = CONSTBUFFER_Clone(cfg->sourceContent);
+            if (result->content == NULL)
+            {
+                LogError("CONSBUFFER Clone failed");
+                message_block_destroy(result);
+                result = NULL;
+            }
+            else
+            {
+                /*Codes_SRS_MESSAGE_17_012: [Message_CreateFromBuffer shall copy the sourceProperties to a readonly CONSTMAP.]*/
+                result->properties = ConstMap_Create(cfg->sourceProperties);
+                if (result->properties == NULL)
+                {
+                    LogError("ConstMap_Create failed");
+                    CONSTBUFFER_Destroy(result->content);
+                    message_block_destroy(result);
+                    result = NULL;
+                }
+                else
+                {
+                    /*Codes_SRS_MESSAGE_30_002: [ Message_CreateFromBuffer shall create a message that never expires. ]*/
+                    result->creationTime = 0;
+                    result->timeToLive = 0;
+                    result->serializations[0] = NULL;
+                    result->serializations[1] = NULL;
+                    result->serializationHeaders[0] = NULL;
+                    result->serializationHeaders[1] = NULL;
+                    result->segments = NULL;
+                    result->segmentCount = 0;
+                    result->flatContent = NULL;
+                    result->ownedBuffer = NULL;
+                    result->releaseOwnedBuffer = NULL;
+                    result->base = NULL;
+                    result->overlay = NULL;
+                    result->overlayCount = 0;
+                    result->mergedProperties = NULL;
+                    result->propertyIndex = NULL;
+				}
+            }
+        }
+    }
+    return (MESSAGE_HANDLE)result;
+}
+
+/*true if cfg has from 1 to MESSAGE_MAX_CONTENT_SEGMENTS segments, none NULL*/
+static bool valid_segments(const MESSAGE_SEGMENTS_CONFIG* cfg)
+{
+    bool result = (cfg->segments != NULL) && (cfg->segmentCount > 0) && (cfg->segmentCount <= MESSAGE_MAX_CONTENT_SEGMENTS);
+    size_t i;
+    for (i = 0; result && (i < cfg->segmentCount); i++)
+    {
+        result = (cfg->segments[i] != NULL);
+    }
+    return result;
+}
+
+MESSAGE_HANDLE Message_CreateFromSegments(const MESSAGE_SEGMENTS_CONFIG* cfg)
+{
+    MESSAGE_HANDLE_DATA* result;
+    if (
+        (cfg == NULL) ||
+        !valid_segments(cfg) ||
+        (cfg->sourceProperties == NULL)
+        )
+    {
+        /*Codes_SRS_MESSAGE_30_065: [ If cfg is NULL, if its field segments is NULL or holds a NULL segment, if its field segmentCount is zero or greater than MESSAGE_MAX_CONTENT_SEGMENTS, or if its field sourceProperties is NULL, Message_CreateFromSegments shall fail and return NULL. ]*/
+        LogError("invalid arg: cfg=[%p]", cfg);
+        result = NULL;
+    }
+    else if ((result = message_block_create()) == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_067: [ If any allocation fails, Message_CreateFromSegments shall fail and return NULL. ]*/
+        LogError("malloc returned NULL");
+    }
+    else if ((result->segments = (CONSTBUFFER_HANDLE*)malloc(cfg->segmentCount * sizeof(CONSTBUFFER_HANDLE))) == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_067: [ If any allocation fails, Message_CreateFromSegments shall fail and return NULL. ]*/
+        LogError("unable to allocate the segments of the message");
+        message_block_destroy(result);
+        result = NULL;
+    }
+    /*Codes_SRS_MESSAGE_30_066: [ Message_CreateFromSegments shall copy the sourceProperties to a readonly CONSTMAP. ]*/
+    else if ((result->properties = ConstMap_Create(cfg->sourceProperties)) == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_067: [ If any allocation fails, Message_CreateFromSegments shall fail and return NULL. ]*/
+        LogError("ConstMap_Create failed");
+        free(result->segments);
+        message_block_destroy(result);
+        result = NULL;
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; i < cfg->segmentCount; i++)
+        {
+            if ((result->segments[i] = CONSTBUFFER_Clone(cfg->segments[i])) == NULL)
+            {
+                break;
+            }
+        }
+
+        if (i < cfg->segmentCount)
+        {
+            LogError("CONSBUFFER Clone failed");
+            while (i > 0)
+            {
+                CONSTBUFFER_Destroy(result->segments[--i]);
+            }
+            free(result->segments);
+            ConstMap_Destroy(result->properties);
+            message_block_destroy(result);
+            result = NULL;
+        }
+        else
+        {
+            /*Codes_SRS_MESSAGE_30_068: [ Otherwise, Message_CreateFromSegments shall return a non-NULL handle with its ref count set to "1", which keeps a clone of each segment, the content of the message being the bytes of the segments one after the other. ]*/
+            /*Codes_SRS_MESSAGE_30_069: [ Message_CreateFromSegments shall create a message that never expires. ]*/
+            result->segmentCount = cfg->segmentCount;
+            result->flatContent = NULL;
+            result->content = NULL;
+            result->ownedContent.buffer = NULL;
+            result->ownedContent.size = 0;
+            result->creationTime = 0;
+            result->timeToLive = 0;
+            result->serializations[0] = NULL;
+            result->serializations[1] = NULL;
+            result->serializationHeaders[0] = NULL;
+            result->serializationHeaders[1] = NULL;
+            result->ownedBuffer = NULL;
+            result->releaseOwnedBuffer = NULL;
+            result->base = NULL;
+            result->overlay = NULL;
+            result->overlayCount = 0;
+            result->mergedProperties = NULL;
+            result->propertyIndex = NULL;
+        }
+    }
+    return (MESSAGE_HANDLE)result;
+}
+
+/*copies source to *destination and moves *destination past the copy*/
+static const char* copy_overlay_string(char** destination, const char* source)
+{
+    const char* result = *destination;
+    size_t size = strlen(source) + 1;
+    (void)memcpy(*destination, source, size);
+    *destination += size;
+    return result;
+}
+
+/*the property i of adds, or of typedAdds when it is not NULL, as a typed
+property*/
+static MESSAGE_TYPED_PROPERTY derived_property(const MESSAGE_PROPERTY* adds, const MESSAGE_TYPED_PROPERTY* typedAdds, size_t i)
+{
+    MESSAGE_TYPED_PROPERTY result;
+    if (typedAdds != NULL)
+    {
+        result = typedAdds[i];
+    }
+    else
+    {
+        result.key = adds[i].key;
+        result.value.type = MESSAGE_VALUE_STRING;
+        result.value.value.string = adds[i].value;
+    }
+    return result;
+}
+
+/*the number of bytes of the overlay holding a copy of value, or false if value
+is not valid*/
+static bool overlay_value_size(const MESSAGE_VALUE* value, size_t* size)
+{
+    bool result;
+    switch (value->type)
+    {
+    case MESSAGE_VALUE_STRING:
+        result = (value->value.string != NULL);
+        *size = result ? strlen(value->value.string) + 1 : 0;
+        break;
+    case MESSAGE_VALUE_BYTES:
+        result = (value->value.bytes.buffer != NULL) || (value->value.bytes.size == 0);
+        *size = result ? value->value.bytes.size : 0;
+        break;
+    case MESSAGE_VALUE_INT64:
+    case MESSAGE_VALUE_DOUBLE:
+    case MESSAGE_VALUE_BOOL:
+    case MESSAGE_VALUE_TIMESTAMP:
+        result = true;
+        *size = 0;
+        break;
+    default:
+        result = false;
+        *size = 0;
+        break;
+    }
+    return result;
+}
+
+/*makes a derived message, the properties set being in adds or, when it is not
+NULL, in typedAdds. The arguments have been checked but for the properties*/
+static MESSAGE_HANDLE_DATA* create_derived(MESSAGE_HANDLE base, const MESSAGE_PROPERTY* adds, const MESSAGE_TYPED_PROPERTY* typedAdds, size_t addCount, const char* const* removes, size_t removeCount)
+{
+    MESSAGE_HANDLE_DATA* result;
+    /*the overlay and the strings and bytes it points to are allocated together*/
+    size_t valuesSize = 0;
+    bool valid = true;
+    size_t i;
+    for (i = 0; valid && (i < removeCount); i++)
+    {
+        valid = (removes[i] != NULL);
+        valuesSize += valid ? strlen(removes[i]) + 1 : 0;
+    }
+    for (i = 0; valid && (i < addCount); i++)
+    {
+        MESSAGE_TYPED_PROPERTY property = derived_property(adds, typedAdds, i);
+        size_t valueSize;
+        valid = (property.key != NULL) && overlay_value_size(&property.value, &valueSize);
+        valuesSize += valid ? strlen(property.key) + 1 + valueSize : 0;
+    }
+
+    if (!valid)
+    {
+        /*Codes_SRS_MESSAGE_30_031: [ If base is NULL, if adds is NULL and addCount is not zero, if removes is NULL and removeCount is not zero, or if any key, value or name to remove is NULL, Message_CreateDerived shall fail and return NULL. ]*/
+        /*Codes_SRS_MESSAGE_30_055: [ If base is NULL, if adds is NULL and addCount is not zero, if removes is NULL and removeCount is not zero, if any key or name to remove is NULL, or if any value has an unknown type, is a NULL string or NULL bytes of non-zero size, Message_CreateDerivedWithValues shall fail and return NULL. ]*/
+        LogError("invalid arg: NULL property name or invalid value");
+        result = NULL;
+    }
+    else
+    {
+        size_t overlayCount = removeCount + addCount;
+        MESSAGE_OVERLAY_ENTRY* overlay;
+        if (overlayCount == 0)
+        {
+            overlay = NULL;
+        }
+        else if ((overlay = (MESSAGE_OVERLAY_ENTRY*)malloc(overlayCount * sizeof(MESSAGE_OVERLAY_ENTRY) + valuesSize)) == NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_034: [ If any allocation fails, Message_CreateDerived shall fail and return NULL. ]*/
+            /*Codes_SRS_MESSAGE_30_057: [ If any allocation fails, Message_CreateDerivedWithValues shall fail and return NULL. ]*/
+            LogError("unable to allocate the overlay of a derived message");
+        }
+
+        if ((overlayCount != 0) && (overlay == NULL))
+        {
+            result = NULL;
+        }
+        else if ((result = message_block_create()) == NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_034: [ If any allocation fails, Message_CreateDerived shall fail and return NULL. ]*/
+            /*Codes_SRS_MESSAGE_30_057: [ If any allocation fails, Message_CreateDerivedWithValues shall fail and return NULL. ]*/
+            LogError("malloc returned NULL");
+            free(overlay);
+        }
+        else
+        {
+            /*Codes_SRS_MESSAGE_30_035: [ The properties of the message shall be the ones of base, without the ones named in removes, and with the ones in adds, the last one winning when a key is added more than once. ]*/
+            char* values = (char*)(overlay + overlayCount);
+            for (i = 0; i < removeCount; i++)
+            {
+                overlay[i].key = copy_overlay_string(&values, removes[i]);
+                overlay[i].removed = true;
+                overlay[i].value.type = MESSAGE_VALUE_STRING;
+                overlay[i].value.value.string = NULL;
+                overlay[i].text = NULL;
+            }
+            for (i = 0; i < addCount; i++)
+            {
+                /*Codes_SRS_MESSAGE_30_056: [ Otherwise, Message_CreateDerivedWithValues shall create a message as Message_CreateDerived does, keeping the values of adds in their types, with copies of their strings and bytes. ]*/
+                MESSAGE_TYPED_PROPERTY property = derived_property(adds, typedAdds, i);
+                MESSAGE_OVERLAY_ENTRY* entry = &overlay[removeCount + i];
+                entry->key = copy_overlay_string(&values, property.key);
+                entry->removed = false;
+                entry->value = property.value;
+                entry->text = NULL;
+                if (property.value.type == MESSAGE_VALUE_STRING)
+                {
+                    entry->value.value.string = copy_overlay_string(&values, property.value.value.string);
+                    entry->text = (char*)entry->value.value.string;
+                }
+                else if (property.value.type == MESSAGE_VALUE_BYTES)
+                {
+                    if (property.value.value.bytes.size > 0)
+                    {
+                        (void)memcpy(values, property.value.value.bytes.buffer, property.value.value.bytes.size);
+                    }
+                    entry->value.value.bytes.buffer = (const unsigned char*)values;
+                    values += property.value.value.bytes.size;
+                }
+            }
+            for (i = 0; i < overlayCount; i++)
+            {
+                /*Codes_SRS_MESSAGE_30_048: [ Message_CreateDerived shall look the keys of adds and removes up in the key table of the process, without adding them to it; the keys that are not there shall be compared by name. ]*/
+                overlay[i].id = intern_key(overlay[i].key, false);
+            }
+
+            /*Codes_SRS_MESSAGE_30_032: [ Otherwise, Message_CreateDerived shall return a non-NULL handle with its ref count set to "1", which keeps a clone of base and shares its content and properties, storing only copies of adds and removes. ]*/
+            result->base = (MESSAGE_HANDLE_DATA*)Message_Clone(base);
+            result->overlay = overlay;
+            result->overlayCount = overlayCount;
+            result->mergedProperties = NULL;
+            result->propertyIndex = NULL;
+            result->properties = NULL;
+            result->content = NULL;
+            result->flatContent = NULL;
+            if (result->base->segmentCount > 0)
+            {
+                /*Codes_SRS_MESSAGE_30_073: [ A message derived from a message made of segments shall share its segments. ]*/
+                result->segments = result->base->segments;
+                result->segmentCount = result->base->segmentCount;
+                result->ownedContent.buffer = NULL;
+                result->ownedContent.size = 0;
+            }
+            else
+            {
+                result->segments = NULL;
+                result->segmentCount = 0;
+                result->ownedContent = *message_content(result->base);
+            }
+            /*Codes_SRS_MESSAGE_30_033: [ Message_CreateDerived shall give the message the creationTime and timeToLive of base. ]*/
+            result->creationTime = result->base->creationTime;
+            result->timeToLive = result->base->timeToLive;
+            result->serializations[0] = NULL;
+            result->serializations[1] = NULL;
+            result->serializationHeaders[0] = NULL;
+            result->serializationHeaders[1] = NULL;
+            result->ownedBuffer = NULL;
+            result->releaseOwnedBuffer = NULL;
+        }
+    }
+    return result;
+}
+
+MESSAGE_HANDLE Message_CreateDerived(MESSAGE_HANDLE base, const MESSAGE_PROPERTY* adds, size_t addCount, const char* const* removes, size_t removeCount)
+{
+    MESSAGE_HANDLE_DATA* result;
+    if (
+        (base == NULL) ||
+        ((adds == NULL) && (addCount > 0)) ||
+        ((removes == NULL) && (removeCount > 0))
+        )
+    {
+        /*Codes_SRS_MESSAGE_30_031: [ If base is NULL, if adds is NULL and addCount is not zero, if removes is NULL and removeCount is not zero, or if any key, value or name to remove is NULL, Message_CreateDerived shall fail and return NULL. ]*/
+        LogError("invalid arg: base=[%p], adds=[%p], addCount=%zu, removes=[%p], removeCount=%zu", base, adds, addCount, removes, removeCount);
+        result = NULL;
+    }
+    else
+    {
+        result = create_derived(base, adds, NULL, addCount, removes, removeCount);
+    }
+    return (MESSAGE_HANDLE)result;
+}
+
+MESSAGE_HANDLE Message_CreateDerivedWithValues(MESSAGE_HANDLE base, const MESSAGE_TYPED_PROPERTY* adds, size_t addCount, const char* const* removes, size_t removeCount)
+{
+    MESSAGE_HANDLE_DATA* result;
+    if (
+        (base == NULL) ||
+        ((adds == NULL) && (addCount > 0)) ||
+        ((removes == NULL) && (removeCount > 0))
+        )
+    {
+        /*Codes_SRS_MESSAGE_30_055: [ If base is NULL, if adds is NULL and addCount is not zero, if removes is NULL and removeCount is not zero, if any key or name to remove is NULL, or if any value has an unknown type, is a NULL string or NULL bytes of non-zero size, Message_CreateDerivedWithValues shall fail and return NULL. ]*/
+        LogError("invalid arg: base=[%p], adds=[%p], addCount=%zu, removes=[%p], removeCount=%zu", base, adds, addCount, removes, removeCount);
+        result = NULL;
+    }
+    else
+    {
+        result = create_derived(base, NULL, adds, addCount, removes, removeCount);
+    }
+    return (MESSAGE_HANDLE)result;
+}
+
+MESSAGE_HANDLE Message_Clone(MESSAGE_HANDLE message)
+{
+    if (message == NULL)
+    {
+        LogError("invalid arg: message is NULL");
+        /*Codes_SRS_MESSAGE_02_007: [If messageHandle is NULL then Message_Clone shall return NULL.] */
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_02_008: [Otherwise, Message_Clone shall increment the internal ref count.] */
+        INC_REF(MESSAGE_HANDLE_DATA, message);
+        MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
+        /*Codes_SRS_MESSAGE_17_001: [Message_Clone shall clone the CONSTMAP handle.]*/
+        if (messageData->properties != NULL)
+        {
+            (void)ConstMap_Clone(messageData->properties);
+        }
+        /*Codes_SRS_MESSAGE_17_004: [Message_Clone shall clone the CONSTBUFFER handle]*/
+        if (messageData->content != NULL)
+        {
+            (void)CONSTBUFFER_Clone(messageData->content);
+        }
+    }
+    /*Codes_SRS_MESSAGE_02_010: [Message_Clone shall return messageHandle.]*/
+    return message;
+}
+
+CONSTMAP_HANDLE Message_GetProperties(MESSAGE_HANDLE message)
+{
+    CONSTMAP_HANDLE result;
+    /*Codes_SRS_MESSAGE_02_011: [If message is NULL then Message_GetProperties shall return NULL.] */
+    if (message == NULL)
+    {
+        LogError("invalid arg: message is NULL");
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_02_012: [Otherwise, Message_GetProperties shall shall clone and return the CONSTMAP handle representing the properties of the message.]*/
+        CONSTMAP_HANDLE properties = message_properties((MESSAGE_HANDLE_DATA*)message);
+        if (properties == NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_037: [ If merging the properties fails, Message_GetProperties shall return NULL. ]*/
+            LogError("unable to merge the properties of the message");
+            result = NULL;
+        }
+        else
+        {
+            result = ConstMap_Clone(properties);
+        }
+    }
+    return result;
+}
+
+const char* Message_GetPropertyValue(MESSAGE_HANDLE message, const char* key)
+{
+    const char* result;
+    if ((message == NULL) || (key == NULL))
+    {
+        /*Codes_SRS_MESSAGE_30_040: [ If message or key is NULL then Message_GetPropertyValue shall return NULL. ]*/
+        LogError("invalid arg: message=[%p], key=[%p]", message, key);
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_041: [ Otherwise, Message_GetPropertyValue shall return the value of the property key of message, or NULL if it does not have it, without cloning its properties. ]*/
+        result = message_property_value((MESSAGE_HANDLE_DATA*)message, intern_key(key, false), key);
+    }
+    return result;
+}
+
+MESSAGE_KEY Message_InternKey(const char* key)
+{
+    MESSAGE_KEY result;
+    if (key == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_049: [ If key is NULL then Message_InternKey shall return MESSAGE_KEY_NONE. ]*/
+        LogError("invalid arg: key is NULL");
+        result = MESSAGE_KEY_NONE;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_050: [ Otherwise, Message_InternKey shall return the MESSAGE_KEY of key, the same for all the calls with the same name, adding key to the key table of the process if it is not there. ]*/
+        /*Codes_SRS_MESSAGE_30_051: [ The well-known keys shall have the MESSAGE_KEY_* values declared in message.h. ]*/
+        /*Codes_SRS_MESSAGE_30_052: [ If key cannot be allocated, or none of the MESSAGE_KEY_MAX_PROBES slots of the key table it may go in is free, Message_InternKey shall return MESSAGE_KEY_NONE. ]*/
+        result = intern_key(key, true);
+    }
+    return result;
+}
+
+const char* Message_GetPropertyValueByKey(MESSAGE_HANDLE message, MESSAGE_KEY key)
+{
+    const char* result;
+    const char* name;
+    if (message == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_053: [ If message is NULL or key was not returned by Message_InternKey then Message_GetPropertyValueByKey shall return NULL. ]*/
+        LogError("invalid arg: message is NULL");
+        result = NULL;
+    }
+    else if ((name = key_name(key)) == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_053: [ If message is NULL or key was not returned by Message_InternKey then Message_GetPropertyValueByKey shall return NULL. ]*/
+        LogError("invalid arg: key %" PRIu32 " was never interned", key);
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_054: [ Otherwise, Message_GetPropertyValueByKey shall return the value of the property key of message as Message_GetPropertyValue does. ]*/
+        result = message_property_value((MESSAGE_HANDLE_DATA*)message, key, name);
+    }
+    return result;
+}
+
+int Message_GetPropertyTypedValue(MESSAGE_HANDLE message, MESSAGE_KEY key, MESSAGE_VALUE* value)
+{
+    int result;
+    const char* name;
+    if ((message == NULL) || (value == NULL))
+    {
+        /*Codes_SRS_MESSAGE_30_060: [ If message or value is NULL, or if key was not returned by Message_InternKey, Message_GetPropertyTypedValue shall fail and return a non-zero value. ]*/
+        LogError("invalid arg: message=[%p], value=[%p]", message, value);
+        result = __LINE__;
+    }
+    else if ((name = key_name(key)) == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_060: [ If message or value is NULL, or if key was not returned by Message_InternKey, Message_GetPropertyTypedValue shall fail and return a non-zero value. ]*/
+        LogError("invalid arg: key %" PRIu32 " was never interned", key);
+        result = __LINE__;
     }
     else
     {
-        /*Codes_SRS_MESSAGE_02_004: [Mesages shall be allowed to be created from zero-size content.]*/
-        /*Codes_SRS_MESSAGE_02_015: [The MESSAGE_CONTENT's field size shall have the same value as the cfg's field size.]*/
-        /*Codes_SRS_MESSAGE_17_003: [Message_Create shall copy the source to a readonly CONSTBUFFER.]*/
-        result->content = CONSTBUFFER_Create(cfg->source, cfg->size);
-        if (result->content == NULL)
+        MESSAGE_HANDLE_DATA* root;
+        const MESSAGE_OVERLAY_ENTRY* entry = find_overlay_entry((MESSAGE_HANDLE_DATA*)message, key, name, &root);
+        if (entry != NULL)
         {
-            LogError("CONSBUFFER_Create failed");
-            free(result);
-            result = NULL;
+            if (entry->removed)
+            {
+                /*Codes_SRS_MESSAGE_30_061: [ If message does not have the property key, Message_GetPropertyTypedValue shall return a non-zero value. ]*/
+                result = __LINE__;
+            }
+            else
+            {
+                /*Codes_SRS_MESSAGE_30_062: [ If the property was set by Message_CreateDerivedWithValues, Message_GetPropertyTypedValue shall set value to its value, in the type it was set with, without converting it, and return 0. ]*/
+                *value = entry->value;
+                result = 0;
+            }
         }
         else
         {
-            /*Codes_SRS_MESSAGE_02_019: [Message_Create shall clone the sourceProperties to a readonly CONSTMAP.]*/
-            result->properties = ConstMap_Create(cfg->sourceProperties);
-            if (result->properties == NULL)
+            const char* string = indexed_property_value(root, key, name);
+            if (string == NULL)
             {
-                /*Codes_SRS_MESSAGE_02_005: [If Message_Create encounters an error while building the internal structures of the message, then it shall return NULL.] */
-                LogError("ConstMap_Create failed");
-                CONSTBUFFER_Destroy(result->content);
-                free(result);
-                result = NULL;
+                /*Codes_SRS_MESSAGE_30_061: [ If message does not have the property key, Message_GetPropertyTypedValue shall return a non-zero value. ]*/
+                result = __LINE__;
             }
             else
             {
-                /*all is fine, return as is.*/
+                /*Codes_SRS_MESSAGE_30_063: [ Otherwise, Message_GetPropertyTypedValue shall set value to a MESSAGE_VALUE_STRING holding the value of the property and return 0. ]*/
+                value->type = MESSAGE_VALUE_STRING;
+                value->value.string = string;
+                result = 0;
             }
         }
     }
     return result;
 }
 
-MESSAGE_HANDLE Message_Create(const MESSAGE_CONFIG * cfg)
+const CONSTBUFFER * Message_GetContent(MESSAGE_HANDLE message)
 {
-    MESSAGE_HANDLE_DATA* result;
-    /*Codes_SRS_MESSAGE_02_002: [If cfg is NULL then Message_Create shall return NULL.]*/
-    if (cfg == NULL)
-    {
-        result = NULL;
-        LogError("invalid parameter (NULL).");
-    }
-    /*Codes_SRS_MESSAGE_02_003: [If field source of cfg is NULL and size is not zero, then Message_Create shall fail and return NULL.] */
-    else if ((cfg->size > 0) && (cfg->source == NULL))
+    const CONSTBUFFER* result;
+    /*Codes_SRS_MESSAGE_02_013: [If message is NULL then Message_GetContent shall return NULL.] */
+    if (message == NULL)
     {
+        LogError("invalid argument, message is NULL");
         result = NULL;
-        LogError("invalid parameter combination cfg->size=%zd, cfg->source=%p", cfg->size, cfg->source);
     }
     else
     {
-        /*delegate to internal function that does not do validation*/
-        result = Message_CreateImpl(cfg);
+        /*Codes_SRS_MESSAGE_02_014: [Otherwise, Message_GetContent shall return a non-NULL const pointer to a structure of type MESSAGE_CONTENT.]*/
+        /*Codes_SRS_MESSAGE_02_016: [The CONSTBUFFER's field buffer shall compare equal byte-by-byte to the cfg's field source.]*/
+        result = message_content((MESSAGE_HANDLE_DATA*)message);
     }
-    return (MESSAGE_HANDLE)result;
+    return result;
 }
 
-MESSAGE_HANDLE Message_CreateFromBuffer(const MESSAGE_BUFFER_CONFIG* cfg)
+CONSTBUFFER_HANDLE Message_GetContentHandle(MESSAGE_HANDLE message) 
 {
-    MESSAGE_HANDLE_DATA* result;
-    /*Codes_SRS_MESSAGE_17_008: [ If cfg is NULL then Message_CreateFromBuffer shall return NULL.] */
-    if (cfg == NULL)
-    {
-        result = NULL;
-        LogError("invalid parameter (NULL).");
-    }
-    /* Codes_SRS_MESSAGE_17_009: [If field sourceContent of cfg is NULL, then Message_CreateFromBuffer shall fail and return NULL.]*/
-    else if (cfg->sourceContent == NULL)
-    {
-        result = NULL;
-        LogError("invalid CONSTBUFFER (NULL)");
-    }
-    /*Codes_SRS_MESSAGE_17_010: [If field sourceProperties of cfg is NULL, then Message_CreateFromBuffer shall fail and return NULL.]*/
-    else if (cfg->sourceProperties == NULL)
+    CONSTBUFFER_HANDLE result;
+    if (message == NULL)
     {
+        /*Codes_SRS_MESSAGE_17_006: [If message is NULL then Message_GetContentHandle shall return NULL.] */
+        LogError("invalid argument, message is NULL");
         result = NULL;
-        LogError("invalid properties (NULL)");
     }
     else
     {
-        /*Codes_SRS_MESSAGE_17_011: [If Message_CreateFromBuffer encounters an error while building the internal structures of the message, then it shall return NULL.]*/
-        /*Codes_SRS_MESSAGE_17_014: [On success, Message_CreateFromBuffer shall return a non-NULL handle and set the internal ref count to "1".]*/
-        result = REFCOUNT_TYPE_CREATE(MESSAGE_HANDLE_DATA);
-        if (result == NULL)
+        MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
+        if ((messageData->content == NULL) && (messageData->base != NULL))
         {
-            LogError("malloc returned NULL");
-            /*return as is*/
+            /*Codes_SRS_MESSAGE_30_038: [ If message was made by Message_CreateDerived, Message_GetContentHandle shall return the CONSTBUFFER_HANDLE of its base message. ]*/
+            result = Message_GetContentHandle((MESSAGE_HANDLE)messageData->base);
+        }
+        else if (messageData->segmentCount == 1)
+        {
+            /*Codes_SRS_MESSAGE_30_074: [ If message is made of one segment, Message_GetContentHandle shall return a clone of the CONSTBUFFER_HANDLE of that segment. ]*/
+            result = CONSTBUFFER_Clone(messageData->segments[0]);
+        }
+        else if (messageData->segmentCount > 1)
+        {
+            /*Codes_SRS_MESSAGE_30_075: [ If message is made of more than one segment, Message_GetContentHandle shall return a new CONSTBUFFER_HANDLE with a copy of the segments one after the other, or NULL if it cannot be made. ]*/
+            const CONSTBUFFER* content = flat_content(messageData);
+            result = (content == NULL) ? NULL : CONSTBUFFER_Create(content->buffer, content->size);
+        }
+        else if (messageData->content == NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_030: [ If the content of message points into a byte array it owns, Message_GetContentHandle shall return a new CONSTBUFFER_HANDLE with a copy of the content. ]*/
+            result = CONSTBUFFER_Create(messageData->ownedContent.buffer, messageData->ownedContent.size);
         }
         else
         {
-            /*Codes_SRS_MESSAGE_17_013: [Message_CreateFromBuffer shall clone the CONSTBUFFER sourceBuffer.]*/
-            result->content = CONSTBUFFER_Clone(cfg->sourceContent);
-            if (result->content == NULL)
-            {
-                LogError("CONSBUFFER Clone failed");
-                free(result);
-                result = NULL;
-            }
-            else
-            {
-                /*Codes_SRS_MESSAGE_17_012: [Message_CreateFromBuffer shall copy the sourceProperties to a readonly CONSTMAP.]*/
-                result->properties = ConstMap_Create(cfg->sourceProperties);
-                if (result->properties == NULL)
-                {
-                    LogError("ConstMap_Create failed");
-                    CONSTBUFFER_Destroy(result->content);
-                    free(result);
-                    result = NULL;
-                }
-                else
-                {
-                    /*all is fine, return as is.*/
-				}
-            }
+            /*Codes_SRS_MESSAGE_17_007: [Otherwise, Message_GetContentHandle shall shall clone and return the CONSTBUFFER_HANDLE representing the message content.]*/
+            result = CONSTBUFFER_Clone(messageData->content);
         }
     }
-    return (MESSAGE_HANDLE)result;
+    return result;
 }
 
-MESSAGE_HANDLE Message_Clone(MESSAGE_HANDLE message)
+size_t Message_GetContentSegmentCount(MESSAGE_HANDLE message)
 {
+    size_t result;
     if (message == NULL)
     {
-        LogError("invalid arg: message is NULL");
-        /*Codes_SRS_MESSAGE_02_007: [If messageHandle is NULL then Message_Clone shall return NULL.] */
+        /*Codes_SRS_MESSAGE_30_076: [ If message is NULL then Message_GetContentSegmentCount shall return 0. ]*/
+        LogError("invalid argument, message is NULL");
+        result = 0;
     }
     else
     {
-        /*Codes_SRS_MESSAGE_02_008: [Otherwise, Message_Clone shall increment the internal ref count.] */
-        INC_REF(MESSAGE_HANDLE_DATA, message);
+        /*Codes_SRS_MESSAGE_30_077: [ Otherwise, Message_GetContentSegmentCount shall return the number of segments of a message made by Message_CreateFromSegments, or of the message it was derived from, and 1 for any other message. ]*/
         MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
-        /*Codes_SRS_MESSAGE_17_001: [Message_Clone shall clone the CONSTMAP handle.]*/
-        (void)ConstMap_Clone(messageData->properties);
-        /*Codes_SRS_MESSAGE_17_004: [Message_Clone shall clone the CONSTBUFFER handle]*/
-        (void)CONSTBUFFER_Clone(messageData->content);
+        result = (messageData->segmentCount == 0) ? 1 : messageData->segmentCount;
     }
-    /*Codes_SRS_MESSAGE_02_010: [Message_Clone shall return messageHandle.]*/
-    return message;
+    return result;
 }
 
-CONSTMAP_HANDLE Message_GetProperties(MESSAGE_HANDLE message)
+const CONSTBUFFER* Message_GetContentSegment(MESSAGE_HANDLE message, size_t index)
 {
-    CONSTMAP_HANDLE result;
-    /*Codes_SRS_MESSAGE_02_011: [If message is NULL then Message_GetProperties shall return NULL.] */
-    if (message == NULL)
+    const CONSTBUFFER* result;
+    if ((message == NULL) || (index >= Message_GetContentSegmentCount(message)))
     {
-        LogError("invalid arg: message is NULL");
+        /*Codes_SRS_MESSAGE_30_078: [ If message is NULL or index is not less than the number of segments of message, Message_GetContentSegment shall return NULL. ]*/
+        LogError("invalid arg: message=[%p], index=%zu", message, index);
         result = NULL;
     }
     else
     {
-        /*Codes_SRS_MESSAGE_02_012: [Otherwise, Message_GetProperties shall shall clone and return the CONSTMAP handle representing the properties of the message.]*/
-        MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
-        result = ConstMap_Clone(messageData->properties);
+        /*Codes_SRS_MESSAGE_30_079: [ Otherwise, Message_GetContentSegment shall return the content of the segment index of message, without copying it, the content of a message not made of segments being its only segment. ]*/
+        MESSAGE_CONTENT_GATHER gather;
+        gather_content((MESSAGE_HANDLE_DATA*)message, &gather);
+        result = gather.segments[index];
     }
     return result;
 }
 
-const CONSTBUFFER * Message_GetContent(MESSAGE_HANDLE message)
+uint64_t Message_GetCreationTime(MESSAGE_HANDLE message)
 {
-    const CONSTBUFFER* result;
-    /*Codes_SRS_MESSAGE_02_013: [If message is NULL then Message_GetContent shall return NULL.] */
+    uint64_t result;
     if (message == NULL)
     {
+        /*Codes_SRS_MESSAGE_30_003: [ If message is NULL then Message_GetCreationTime shall return 0. ]*/
         LogError("invalid argument, message is NULL");
-        result = NULL;
+        result = 0;
     }
     else
     {
-        /*Codes_SRS_MESSAGE_02_014: [Otherwise, Message_GetContent shall return a non-NULL const pointer to a structure of type MESSAGE_CONTENT.]*/
-        /*Codes_SRS_MESSAGE_02_016: [The CONSTBUFFER's field buffer shall compare equal byte-by-byte to the cfg's field source.]*/
-        result = CONSTBUFFER_GetContent(((MESSAGE_HANDLE_DATA*)message)->content);
+        /*Codes_SRS_MESSAGE_30_004: [ Otherwise, Message_GetCreationTime shall return the creationTime the message was created with. ]*/
+        result = ((MESSAGE_HANDLE_DATA*)message)->creationTime;
     }
     return result;
 }
 
-CONSTBUFFER_HANDLE Message_GetContentHandle(MESSAGE_HANDLE message) 
+uint64_t Message_GetTimeToLive(MESSAGE_HANDLE message)
 {
-    CONSTBUFFER_HANDLE result;
+    uint64_t result;
     if (message == NULL)
     {
-        /*Codes_SRS_MESSAGE_17_006: [If message is NULL then Message_GetContentHandle shall return NULL.] */
+        /*Codes_SRS_MESSAGE_30_005: [ If message is NULL then Message_GetTimeToLive shall return 0. ]*/
         LogError("invalid argument, message is NULL");
-        result = NULL;
+        result = 0;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_006: [ Otherwise, Message_GetTimeToLive shall return the timeToLive the message was created with. ]*/
+        result = ((MESSAGE_HANDLE_DATA*)message)->timeToLive;
+    }
+    return result;
+}
+
+bool Message_IsExpired(MESSAGE_HANDLE message, uint64_t now)
+{
+    bool result;
+    if (message == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_007: [ If message is NULL then Message_IsExpired shall return false. ]*/
+        LogError("invalid argument, message is NULL");
+        result = false;
     }
     else
     {
-        /*Codes_SRS_MESSAGE_17_007: [Otherwise, Message_GetContentHandle shall shall clone and return the CONSTBUFFER_HANDLE representing the message content.]*/
-        result = CONSTBUFFER_Clone(((MESSAGE_HANDLE_DATA*)message)->content);
+        /*Codes_SRS_MESSAGE_30_008: [ Message_IsExpired shall return true if the timeToLive of the message is not 0 and now is at least timeToLive past its creationTime, and false otherwise. ]*/
+        MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
+        result = messageData->timeToLive != 0 &&
+            now >= messageData->creationTime &&
+            now - messageData->creationTime >= messageData->timeToLive;
     }
     return result;
 }
@@ -240,18 +1704,104 @@ void Message_Destroy(MESSAGE_HANDLE message)
     {
         MESSAGE_HANDLE_DATA* messageData = (MESSAGE_HANDLE_DATA*)message;
         /*Codes_SRS_MESSAGE_17_002: [Message_Destroy shall destroy the CONSTMAP properties.]*/
-        ConstMap_Destroy(messageData->properties);
+        if (messageData->properties != NULL)
+        {
+            ConstMap_Destroy(messageData->properties);
+        }
         /*Codes_SRS_MESSAGE_17_005: [Message_Destroy shall destroy the CONSTBUFFER.]*/
-        CONSTBUFFER_Destroy(messageData->content);
+        if (messageData->content != NULL)
+        {
+            CONSTBUFFER_Destroy(messageData->content);
+        }
         /*Codes_SRS_MESSAGE_02_020: [Otherwise, Message_Destroy shall decrement the internal ref count of the message.]*/
         if (DEC_REF(MESSAGE_HANDLE_DATA, message) == DEC_RETURN_ZERO)
         {
             /*Codes_SRS_MESSAGE_02_021: [If the ref count is zero then the allocated resources are freed.]*/
-            free(message);
+            /*Codes_SRS_MESSAGE_30_024: [ When the ref count of the message reaches zero, Message_Destroy shall destroy the serializations kept with the message. ]*/
+            if (messageData->serializations[0] != NULL)
+            {
+                CONSTBUFFER_Destroy(messageData->serializations[0]);
+            }
+            if (messageData->serializations[1] != NULL)
+            {
+                CONSTBUFFER_Destroy(messageData->serializations[1]);
+            }
+            /*Codes_SRS_MESSAGE_30_084: [ When the ref count of the message reaches zero, Message_Destroy shall destroy the serializations without content kept with the message. ]*/
+            if (messageData->serializationHeaders[0] != NULL)
+            {
+                CONSTBUFFER_Destroy(messageData->serializationHeaders[0]);
+            }
+            if (messageData->serializationHeaders[1] != NULL)
+            {
+                CONSTBUFFER_Destroy(messageData->serializationHeaders[1]);
+            }
+            /*Codes_SRS_MESSAGE_30_080: [ When the ref count of a message made by Message_CreateFromSegments reaches zero, Message_Destroy shall destroy its segments. When the ref count of a message made of more than one segment reaches zero, Message_Destroy shall free the copy of its segments. ]*/
+            if (messageData->flatContent != NULL)
+            {
+                free(messageData->flatContent);
+            }
+            if ((messageData->segments != NULL) && (messageData->base == NULL))
+            {
+                size_t i;
+                for (i = 0; i < messageData->segmentCount; i++)
+                {
+                    CONSTBUFFER_Destroy(messageData->segments[i]);
+                }
+                free(messageData->segments);
+            }
+            if (messageData->ownedBuffer != NULL)
+            {
+                /*Codes_SRS_MESSAGE_30_029: [ When the ref count of the message reaches zero, Message_Destroy shall call release with the byte array given to Message_CreateFromByteArrayWithRelease. ]*/
+                messageData->releaseOwnedBuffer(messageData->ownedBuffer);
+            }
+            /*Codes_SRS_MESSAGE_30_045: [ When the ref count of the message reaches zero, Message_Destroy shall free the property index kept with the message. ]*/
+            if ((messageData->propertyIndex != NULL) && (messageData->propertyIndex != &no_property_index))
+            {
+                free(messageData->propertyIndex);
+            }
+            if (messageData->base != NULL)
+            {
+                /*Codes_SRS_MESSAGE_30_039: [ When the ref count of a message made by Message_CreateDerived reaches zero, Message_Destroy shall destroy its merged properties, free its overlay and destroy its base message. ]*/
+                size_t i;
+                if (messageData->mergedProperties != NULL)
+                {
+                    ConstMap_Destroy(messageData->mergedProperties);
+                }
+                for (i = 0; i < messageData->overlayCount; i++)
+                {
+                    /*Codes_SRS_MESSAGE_30_064: [ When the ref count of a message made by Message_CreateDerivedWithValues reaches zero, Message_Destroy shall free the strings its typed values were converted to. ]*/
+                    if ((messageData->overlay[i].value.type != MESSAGE_VALUE_STRING) && (messageData->overlay[i].text != NULL))
+                    {
+                        free(messageData->overlay[i].text);
+                    }
+                }
+                free(messageData->overlay);
+                Message_Destroy((MESSAGE_HANDLE)messageData->base);
+            }
+            message_block_destroy(messageData);
         }
     }
 }
 
+void Message_EnableThreadCache(void)
+{
+    /*Codes_SRS_MESSAGE_30_009: [ Message_EnableThreadCache shall make the calling thread keep the blocks of up to MESSAGE_THREAD_CACHE_SIZE messages it frees in its message cache instead of freeing them. ]*/
+    cache_enabled = true;
+}
+
+void Message_DisableThreadCache(void)
+{
+    /*Codes_SRS_MESSAGE_30_012: [ Message_DisableThreadCache shall free the blocks in the message cache of the calling thread and stop keeping blocks in it. ]*/
+    cache_enabled = false;
+    while (cache_head != NULL)
+    {
+        MESSAGE_CACHE_ENTRY* entry = cache_head;
+        cache_head = entry->next;
+        free(entry);
+    }
+    cache_count = 0;
+}
+
 /*this function parses the buffer pointed to by source, having size sourceSize, starting at index position for a int32_t value*/
 /*if the parsing succeeds then *parsed is updated to reflect how many characters have been consumed*/
 /*and *value is updated to the parsed value and the function return 0*/
@@ -259,55 +1809,322 @@ void Message_Destroy(MESSAGE_HANDLE message)
 static int parse_int32_t(const unsigned char* source, int32_t sourceSize, int32_t position, int32_t *parsed, int32_t* value)
 {
     int result;
-    if (position + 4 > sourceSize)
+    if (position + 4 > sourceSize)
+    {
+        /*Codes_SRS_MESSAGE_02_025: [ If while parsing the message content, a read would occur past the end of the array (as indicated by size) then Message_CreateFromByteArray shall fail and return NULL. ]*/
+        LogError("unable to parse a int32_t because it would go past the end of the source");
+        result = __LINE__;
+    }
+    else
+    {
+        *parsed = 4;
+        *value = 
+            (source[position + 0] << 24) |
+            (source[position + 1] << 16) |
+            (source[position + 2] <<  8) |
+            (source[position + 3]);
+        result = 0;
+    }
+    return result;
+}
+
+static int parse_null_terminated_const_char(const unsigned char* source, int32_t sourceSize, int32_t position, int32_t *parsed, const char** value)
+{
+    int result;
+    const unsigned char* whereIsnull = (unsigned char*)memchr(source + position, '\0', sourceSize - position);
+    
+    if (whereIsnull == NULL)
+    {
+        /*Codes_SRS_MESSAGE_02_025: [ If while parsing the message content, a read would occur past the end of the array (as indicated by size) then Message_CreateFromByteArray shall fail and return NULL. ]*/
+        LogError("was not able to find the end of the string");
+        result = __LINE__;
+    }
+    else
+    {
+        *parsed = whereIsnull - ( source + position - 1);
+        *value = (const char*)source + position;
+        result = 0;
+    }
+    return result;
+}
+
+/*parses 8 bytes in MSB order at position*/
+static int parse_uint64_t(const unsigned char* source, int32_t sourceSize, int32_t position, int32_t *parsed, uint64_t* value)
+{
+    int result;
+    if (position + 8 > sourceSize)
+    {
+        /*Codes_SRS_MESSAGE_30_014: [ If the size embedded in a version 2 serialization is not size, if a read would occur past the end of the array, if a varint is longer than 5 bytes or does not fit in 32 bits, or if a key refers to an entry past the end of the key dictionary, Message_CreateFromByteArray shall fail and return NULL. ]*/
+        LogError("unable to parse a uint64_t because it would go past the end of the source");
+        result = __LINE__;
+    }
+    else
+    {
+        int32_t i;
+        *value = 0;
+        for (i = 0; i < 8; i++)
+        {
+            *value = (*value << 8) | source[position + i];
+        }
+        *parsed = 8;
+        result = 0;
+    }
+    return result;
+}
+
+/*parses a varint (7 bits per byte, least significant group first, the high bit
+set on all bytes but the last) of at most 32 bits*/
+static int parse_varint(const unsigned char* source, int32_t sourceSize, int32_t position, int32_t *parsed, uint32_t* value)
+{
+    int result = __LINE__;
+    uint32_t parsedValue = 0;
+    int32_t i;
+    for (i = 0; i < MESSAGE_V2_MAX_VARINT_LENGTH; i++)
+    {
+        if (position + i >= sourceSize)
+        {
+            /*Codes_SRS_MESSAGE_30_014: [ If the size embedded in a version 2 serialization is not size, if a read would occur past the end of the array, if a varint is longer than 5 bytes or does not fit in 32 bits, or if a key refers to an entry past the end of the key dictionary, Message_CreateFromByteArray shall fail and return NULL. ]*/
+            LogError("unable to parse a varint because it would go past the end of the source");
+            break;
+        }
+        else
+        {
+            unsigned char byte = source[position + i];
+            if ((i == MESSAGE_V2_MAX_VARINT_LENGTH - 1) && (byte > 0x0F))
+            {
+                LogError("varint does not fit in 32 bits");
+                break;
+            }
+            else
+            {
+                parsedValue |= (uint32_t)(byte & 0x7F) << (7 * i);
+                if ((byte & 0x80) == 0)
+                {
+                    *parsed = i + 1;
+                    *value = parsedValue;
+                    result = 0;
+                    break;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/*parses a run of length bytes at position into a null terminated string in scratch*/
+static int parse_v2_string(const unsigned char* source, int32_t sourceSize, int32_t position, uint32_t length, char* scratch)
+{
+    int result;
+    if (length > (uint32_t)(sourceSize - position))
     {
-        /*Codes_SRS_MESSAGE_02_025: [ If while parsing the message content, a read would occur past the end of the array (as indicated by size) then Message_CreateFromByteArray shall fail and return NULL. ]*/
-        LogError("unable to parse a int32_t because it would go past the end of the source");
+        /*Codes_SRS_MESSAGE_30_014: [ If the size embedded in a version 2 serialization is not size, if a read would occur past the end of the array, if a varint is longer than 5 bytes or does not fit in 32 bits, or if a key refers to an entry past the end of the key dictionary, Message_CreateFromByteArray shall fail and return NULL. ]*/
+        LogError("unable to parse a string because it would go past the end of the source");
         result = __LINE__;
     }
     else
     {
-        *parsed = 4;
-        *value = 
-            (source[position + 0] << 24) |
-            (source[position + 1] << 16) |
-            (source[position + 2] <<  8) |
-            (source[position + 3]);
+        (void)memcpy(scratch, source + position, length);
+        scratch[length] = '\0';
         result = 0;
     }
     return result;
 }
 
-static int parse_null_terminated_const_char(const unsigned char* source, int32_t sourceSize, int32_t position, int32_t *parsed, const char** value)
+/*adds the properties of a version 2 serialization to configMap, returns the
+position that follows them or -1*/
+static int32_t parse_v2_properties(const unsigned char* source, int32_t size, int32_t currentPosition, MAP_HANDLE configMap, char* scratch)
 {
-    int result;
-    const unsigned char* whereIsnull = (unsigned char*)memchr(source + position, '\0', sourceSize - position);
-    
-    if (whereIsnull == NULL)
+    int32_t result;
+    int32_t parsed;
+    uint32_t propertiesCount;
+    if (parse_varint(source, size, currentPosition, &parsed, &propertiesCount) != 0)
     {
-        /*Codes_SRS_MESSAGE_02_025: [ If while parsing the message content, a read would occur past the end of the array (as indicated by size) then Message_CreateFromByteArray shall fail and return NULL. ]*/
-        LogError("was not able to find the end of the string");
-        result = __LINE__;
+        LogError("unable to parse the number of properties");
+        result = -1;
     }
     else
     {
-        *parsed = whereIsnull - ( source + position - 1);
-        *value = (const char*)source + position;
-        result = 0;
+        uint32_t i;
+        currentPosition += parsed;
+        for (i = 0; i < propertiesCount; i++)
+        {
+            uint32_t keyCode;
+            uint32_t valueLength;
+            const char* keyName;
+            char* keyValue;
+            if (parse_varint(source, size, currentPosition, &parsed, &keyCode) != 0)
+            {
+                LogError("unable to parse the name of the property");
+                break;
+            }
+            currentPosition += parsed;
+            /*Codes_SRS_MESSAGE_30_015: [ A key whose varint k is odd shall be the entry k >> 1 of the key dictionary, otherwise the k >> 1 bytes that follow; values shall be a varint length followed by as many bytes. ]*/
+            if ((keyCode & 1) != 0)
+            {
+                if ((keyCode >> 1) >= MESSAGE_DICTIONARY_SIZE)
+                {
+                    /*Codes_SRS_MESSAGE_30_014: [ If the size embedded in a version 2 serialization is not size, if a read would occur past the end of the array, if a varint is longer than 5 bytes or does not fit in 32 bits, or if a key refers to an entry past the end of the key dictionary, Message_CreateFromByteArray shall fail and return NULL. ]*/
+                    LogError("unknown key dictionary entry %" PRIu32, keyCode >> 1);
+                    break;
+                }
+                keyName = message_dictionary[keyCode >> 1].key;
+                keyValue = scratch;
+            }
+            else if (parse_v2_string(source, size, currentPosition, keyCode >> 1, scratch) != 0)
+            {
+                LogError("unable to parse the name string of the property");
+                break;
+            }
+            else
+            {
+                currentPosition += (int32_t)(keyCode >> 1);
+                keyName = scratch;
+                keyValue = scratch + (keyCode >> 1) + 1;
+            }
+
+            if (parse_varint(source, size, currentPosition, &parsed, &valueLength) != 0)
+            {
+                LogError("unable to parse the value of the property");
+                break;
+            }
+            currentPosition += parsed;
+            if (parse_v2_string(source, size, currentPosition, valueLength, keyValue) != 0)
+            {
+                LogError("unable to parse the value string of the property");
+                break;
+            }
+            currentPosition += (int32_t)valueLength;
+
+            /*Codes_SRS_MESSAGE_02_027: [ All the properties of the byte array shall be added to the MAP_HANDLE. ]*/
+            if (Map_Add(configMap, keyName, keyValue) != MAP_OK)
+            {
+                LogError("Map_Add failed");
+                break;
+            }
+        }
+        result = (i == propertiesCount) ? currentPosition : -1;
     }
     return result;
 }
 
-/*creates a MESSAGE_HANDLE from a serialized byte array*/
-MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char* source, int32_t size)
+static MESSAGE_HANDLE_DATA* create_from_byte_array_v2(const unsigned char* source, int32_t size, bool copyContent)
+{
+    MESSAGE_HANDLE_DATA* result;
+    int32_t parsed;
+    int32_t messageSize;
+    /*the properties follow the header, the array size and the expiry when there is one*/
+    int32_t propertiesPosition = (source[1] == SECOND_MESSAGE_BYTE_V2_EXPIRY) ? 2 + 4 + 8 + 8 : 2 + 4;
+    uint64_t creationTime = 0;
+    uint64_t timeToLive = 0;
+    /*Codes_SRS_MESSAGE_30_014: [ If the size embedded in a version 2 serialization is not size, if a read would occur past the end of the array, if a varint is longer than 5 bytes or does not fit in 32 bits, or if a key refers to an entry past the end of the key dictionary, Message_CreateFromByteArray shall fail and return NULL. ]*/
+    if ((parse_int32_t(source, size, 2, &parsed, &messageSize) != 0) ||
+        (messageSize != size))
+    {
+        LogError("message size is inconsistent");
+        result = NULL;
+    }
+    /*Codes_SRS_MESSAGE_30_089: [ If the second byte of source is 0x63, the array size shall be followed by the creation time and the time to live of the message, 8 bytes each, most significant byte first. ]*/
+    else if ((source[1] == SECOND_MESSAGE_BYTE_V2_EXPIRY) &&
+        ((parse_uint64_t(source, size, 2 + 4, &parsed, &creationTime) != 0) ||
+        (parse_uint64_t(source, size, 2 + 4 + 8, &parsed, &timeToLive) != 0)))
+    {
+        LogError("unable to parse the expiry of the message");
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_02_026: [ A MAP_HANDLE shall be created. ]*/
+        MAP_HANDLE configMap = Map_Create(NULL);
+        if (configMap == NULL)
+        {
+            /*Codes_SRS_MESSAGE_02_030: [ If any of the above steps fails, then Message_CreateFromByteArray shall fail and return NULL. ]*/
+            LogError("failed to create a MAP_HANDLE");
+            result = NULL;
+        }
+        else
+        {
+            /*keys and values are copied here to be null terminated; a property
+            takes at least 2 bytes more than its key and value, so size bytes
+            always hold them*/
+            char* scratch = (char*)malloc(size);
+            if (scratch == NULL)
+            {
+                LogError("failed to allocate the property scratch buffer");
+                result = NULL;
+            }
+            else
+            {
+                int32_t currentPosition = parse_v2_properties(source, size, propertiesPosition, configMap, scratch);
+                uint32_t messageContentSize;
+                if (currentPosition < 0)
+                {
+                    result = NULL;
+                }
+                else if (parse_varint(source, size, currentPosition, &parsed, &messageContentSize) != 0)
+                {
+                    LogError("no space to read the number of bytes making the message");
+                    result = NULL;
+                }
+                else
+                {
+                    /*Codes_SRS_MESSAGE_30_016: [ The content shall start at the first position, after the content size, that is a multiple of 8 from the start of the array, and shall end at the end of the array. ]*/
+                    currentPosition += parsed;
+                    currentPosition += (MESSAGE_V2_CONTENT_ALIGNMENT - (currentPosition % MESSAGE_V2_CONTENT_ALIGNMENT)) % MESSAGE_V2_CONTENT_ALIGNMENT;
+                    if ((currentPosition > size) ||
+                        (messageContentSize != (uint32_t)(size - currentPosition)))
+                    {
+                        LogError("the message content doesn't add up to the message size %" PRId32, messageSize);
+                        result = NULL;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_MESSAGE_02_028: [ A structure of type MESSAGE_CONFIG shall be populated with the MAP_HANDLE previously constructed and the message content ]*/
+                        MESSAGE_CONFIG msgConfig = { (size_t)messageContentSize, source + currentPosition, configMap };
+
+                        /*Codes_SRS_MESSAGE_02_029: [ A MESSAGE_HANDLE shall be constructed from the MESSAGE_CONFIG. ]*/
+                        /*Codes_SRS_MESSAGE_02_031: [ Otherwise Message_CreateFromByteArray shall succeed and return a non-NULL handle. ]*/
+                        result = Message_CreateImpl(&msgConfig, copyContent);
+                        if (result != NULL)
+                        {
+                            /*Codes_SRS_MESSAGE_30_090: [ The message shall have the creation time and time to live of the serialization, and never expire when it has none. ]*/
+                            result->creationTime = creationTime;
+                            result->timeToLive = timeToLive;
+                        }
+                    }
+                }
+                free(scratch);
+            }
+            Map_Destroy(configMap);
+        }
+    }
+    return result;
+}
+
+/*creates a MESSAGE_HANDLE from a serialized byte array, the content of the
+message points into source when copyContent is false*/
+static MESSAGE_HANDLE_DATA* create_from_byte_array(const unsigned char* source, int32_t size, bool copyContent)
 {
     MESSAGE_HANDLE_DATA* result;
     /*Codes_SRS_MESSAGE_02_022: [ If source is NULL then Message_CreateFromByteArray shall fail and return NULL. ]*/
-    /*Codes_SRS_MESSAGE_02_023: [ If source is not NULL and and size parameter is smaller than 14 then Message_CreateFromByteArray shall fail and return NULL. ]*/
     if (
         (source == NULL) ||
-        (size < MIN_MESSAGE_BUFFER_LENGTH)
+        (size < MIN_MESSAGE_V2_BUFFER_LENGTH)
+        )
+    {
+        LogError("invalid parameter source=[%p] size=%" PRId32, source, size);
+        result = NULL;
+    }
+    else if (
+        (source[0] == FIRST_MESSAGE_BYTE) &&
+        ((source[1] == SECOND_MESSAGE_BYTE_V2) || (source[1] == SECOND_MESSAGE_BYTE_V2_EXPIRY))
         )
+    {
+        /*Codes_SRS_MESSAGE_30_013: [ If the first two bytes of source are 0xA1 0x62, Message_CreateFromByteArray shall parse source as a GATEWAY_MESSAGE_VERSION_2 serialization instead, and fail and return NULL if size is smaller than 8. ]*/
+        /*Codes_SRS_MESSAGE_30_089: [ If the second byte of source is 0x63, the array size shall be followed by the creation time and the time to live of the message, 8 bytes each, most significant byte first. ]*/
+        result = create_from_byte_array_v2(source, size, copyContent);
+    }
+    /*Codes_SRS_MESSAGE_02_023: [ If source is not NULL and and size parameter is smaller than 14 then Message_CreateFromByteArray shall fail and return NULL. ]*/
+    else if (size < MIN_MESSAGE_BUFFER_LENGTH)
     {
         LogError("invalid parameter source=[%p] size=%" PRId32, source, size);
         result = NULL;
@@ -441,7 +2258,7 @@ MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char* source, int32_t
 
 											/*Codes_SRS_MESSAGE_02_029: [ A MESSAGE_HANDLE shall be constructed from the MESSAGE_CONFIG. ]*/
 											/*Codes_SRS_MESSAGE_02_031: [ Otherwise Message_CreateFromByteArray shall succeed and return a non-NULL handle. ]*/
-											result = Message_CreateImpl(&msgConfig);
+											result = Message_CreateImpl(&msgConfig, copyContent);
 
 											/*return as is*/
 
@@ -456,11 +2273,206 @@ MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char* source, int32_t
 			}
         }
     }
+    return result;
+
+}
+
+MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char* source, int32_t size)
+{
+    return (MESSAGE_HANDLE)create_from_byte_array(source, size, true);
+}
+
+MESSAGE_HANDLE Message_CreateFromByteArrayWithRelease(unsigned char* source, int32_t size, MESSAGE_BUFFER_RELEASE release)
+{
+    MESSAGE_HANDLE_DATA* result;
+    if (release == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_026: [ If release is NULL, Message_CreateFromByteArrayWithRelease shall fail and return NULL. ]*/
+        LogError("invalid arg: release is NULL");
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_027: [ Message_CreateFromByteArrayWithRelease shall parse source as Message_CreateFromByteArray does, but the content of the message shall point into source instead of being copied, and fail and return NULL, leaving source to the caller, where Message_CreateFromByteArray would. ]*/
+        result = create_from_byte_array(source, size, false);
+        if (result != NULL)
+        {
+            /*Codes_SRS_MESSAGE_30_028: [ On success, the message shall own source. ]*/
+            result->ownedBuffer = source;
+            result->releaseOwnedBuffer = release;
+        }
+    }
     return (MESSAGE_HANDLE)result;
+}
+
+/*appends bytes to a serialization. The bytes are only written while they fit in
+buf, position keeps counting so that the needed size is known in one pass*/
+typedef struct BYTE_ARRAY_WRITER_TAG
+{
+    unsigned char* buf;
+    size_t size;
+    size_t position;
+}BYTE_ARRAY_WRITER;
+
+static void write_bytes(BYTE_ARRAY_WRITER* writer, const void* source, size_t length)
+{
+    if ((writer->buf != NULL) && (length <= writer->size) && (writer->position <= writer->size - length))
+    {
+        (void)memcpy(writer->buf + writer->position, source, length);
+    }
+    writer->position += length;
+}
+
+static void write_varint(BYTE_ARRAY_WRITER* writer, size_t value)
+{
+    unsigned char encoded[(sizeof(size_t) * 8 + 6) / 7]; /*7 bits per byte*/
+    size_t length = 0;
+    do
+    {
+        encoded[length] = (unsigned char)(value & 0x7F);
+        value >>= 7;
+        if (value != 0)
+        {
+            encoded[length] |= 0x80;
+        }
+        length++;
+    } while (value != 0);
+    write_bytes(writer, encoded, length);
+}
+
+static void write_uint64(BYTE_ARRAY_WRITER* writer, uint64_t value)
+{
+    unsigned char encoded[8];
+    size_t i;
+    for (i = 0; i < sizeof(encoded); i++)
+    {
+        encoded[i] = (unsigned char)(value >> (8 * (sizeof(encoded) - 1 - i)));
+    }
+    write_bytes(writer, encoded, sizeof(encoded));
+}
+
+/*returns the index of key in the key dictionary, or MESSAGE_DICTIONARY_SIZE*/
+static size_t find_dictionary_key(const char* key, size_t length)
+{
+    size_t i;
+    for (i = 0; i < MESSAGE_DICTIONARY_SIZE; i++)
+    {
+        if ((message_dictionary[i].length == length) &&
+            (memcmp(message_dictionary[i].key, key, length) == 0))
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+/*writes the GATEWAY_MESSAGE_VERSION_2 serialization of a message, see
+message_requirements.md, measuring each key and value once. Without content,
+only the bytes before the content are written*/
+static int32_t to_byte_array_v2(MESSAGE_HANDLE_DATA* messageHandleData, unsigned char* buf, int32_t size, bool withContent)
+{
+    int32_t result;
+    const char* const * keys;
+    const char* const * values;
+    size_t nProperties;
+
+    /*Codes_SRS_MESSAGE_02_035: [ If any of the above steps fails then Message_ToByteArray shall fail and return -1. ]*/
+    if (ConstMap_GetInternals(message_properties(messageHandleData), &keys, &values, &nProperties) != CONSTMAP_OK)
+    {
+        LogError("failed to get the keys and values from the message properties");
+        result = -1;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_019: [ For GATEWAY_MESSAGE_VERSION_2, Message_ToByteArrayWithVersion shall write the layout of a version 2 serialization, writing a key as its index in the key dictionary when the key is in it. ]*/
+        static const unsigned char header[] = { FIRST_MESSAGE_BYTE, SECOND_MESSAGE_BYTE_V2, 0, 0, 0, 0 }; /*the size is written last*/
+        static const unsigned char headerWithExpiry[] = { FIRST_MESSAGE_BYTE, SECOND_MESSAGE_BYTE_V2_EXPIRY, 0, 0, 0, 0 };
+        static const unsigned char padding[MESSAGE_V2_CONTENT_ALIGNMENT] = { 0 };
+        BYTE_ARRAY_WRITER writer = { (size == 0) ? NULL : buf, (size_t)size, 0 };
+        MESSAGE_CONTENT_GATHER gather;
+        size_t totalSize;
+        size_t i;
+
+        if (messageHandleData->timeToLive == 0)
+        {
+            write_bytes(&writer, header, sizeof(header));
+        }
+        else
+        {
+            /*Codes_SRS_MESSAGE_30_091: [ For GATEWAY_MESSAGE_VERSION_2, Message_ToByteArrayWithVersion shall write the creation time and time to live of a message that expires, starting the serialization with 0xA1 0x63. ]*/
+            write_bytes(&writer, headerWithExpiry, sizeof(headerWithExpiry));
+            write_uint64(&writer, messageHandleData->creationTime);
+            write_uint64(&writer, messageHandleData->timeToLive);
+        }
+        write_varint(&writer, nProperties);
+        for (i = 0; i < nProperties; i++)
+        {
+            size_t keyLength = strlen(keys[i]);
+            size_t valueLength = strlen(values[i]);
+            size_t dictionaryIndex = find_dictionary_key(keys[i], keyLength);
+            if (dictionaryIndex < MESSAGE_DICTIONARY_SIZE)
+            {
+                write_varint(&writer, (dictionaryIndex << 1) | 1);
+            }
+            else
+            {
+                write_varint(&writer, keyLength << 1);
+                write_bytes(&writer, keys[i], keyLength);
+            }
+            write_varint(&writer, valueLength);
+            write_bytes(&writer, values[i], valueLength);
+        }
+
+        gather_content(messageHandleData, &gather);
+        write_varint(&writer, gather.size);
+        write_bytes(&writer, padding, (MESSAGE_V2_CONTENT_ALIGNMENT - (writer.position % MESSAGE_V2_CONTENT_ALIGNMENT)) % MESSAGE_V2_CONTENT_ALIGNMENT);
+        totalSize = writer.position + gather.size;
+        for (i = 0; withContent && (i < gather.count); i++)
+        {
+            /*Codes_SRS_MESSAGE_30_081: [ Message_ToByteArrayWithVersion shall write the content of a message made of segments from each segment in turn, without copying them into one buffer first. ]*/
+            write_bytes(&writer, gather.segments[i]->buffer, gather.segments[i]->size);
+        }
+
+        if (totalSize > INT32_MAX)
+        {
+            LogError("message is %zu bytes, too large to serialize", totalSize);
+            result = -1;
+        }
+        else if (size == 0)
+        {
+            /*Codes_SRS_MESSAGE_17_016: [ If buf is NULL and size is equal to zero, Message_ToByteArray shall return the needed memory size. ]*/
+            result = (int32_t)writer.position;
+        }
+        else if (writer.position > (size_t)size)
+        {
+            /*Codes_SRS_MESSAGE_17_017: [ If buf is not NULL and size is less than the needed memory size, Message_ToByteArray shall return -1; ]*/
+            LogError("message is %zu bytes, won't fit in buffer of %" PRId32 " bytes", writer.position, size);
+            result = -1;
+        }
+        else
+        {
+            /*4 bytes in MSB order representing the total size of the byte array*/
+            buf[2] = (unsigned char)(totalSize >> 24);
+            buf[3] = (unsigned char)((totalSize >> 16) & 0xFF);
+            buf[4] = (unsigned char)((totalSize >> 8) & 0xFF);
+            buf[5] = (unsigned char)(totalSize & 0xFF);
+            /*Codes_SRS_MESSAGE_02_036: [ Otherwise Message_ToByteArray shall succeed, and return the byte array size. ]*/
+            result = (int32_t)writer.position;
+        }
+    }
+    return result;
+}
 
+int32_t Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char* buf, int32_t size)
+{
+    /*Codes_SRS_MESSAGE_30_017: [ Message_ToByteArray shall serialize messageHandle as Message_ToByteArrayWithVersion does with GATEWAY_MESSAGE_VERSION_1. ]*/
+    return Message_ToByteArrayWithVersion(messageHandle, GATEWAY_MESSAGE_VERSION_1, buf, size);
 }
 
-extern int32_t Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char* buf, int32_t size)
+/*serializes a message as Message_ToByteArrayWithVersion does. Without
+content, only the bytes before the content are written and their number
+returned*/
+static int32_t to_byte_array(MESSAGE_HANDLE messageHandle, uint8_t version, unsigned char* buf, int32_t size, bool withContent)
 {
     int32_t result;
     if (messageHandle == NULL) 
@@ -478,6 +2490,16 @@ extern int32_t Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char*
         LogError("Null buffer sent with a specific size buffer=[%p], size=[%d]", messageHandle, size);
         result = -1;
     }
+    else if (version == GATEWAY_MESSAGE_VERSION_2)
+    {
+        result = to_byte_array_v2((MESSAGE_HANDLE_DATA*)messageHandle, buf, size, withContent);
+    }
+    else if (version != GATEWAY_MESSAGE_VERSION_1)
+    {
+        /*Codes_SRS_MESSAGE_30_018: [ If version is neither GATEWAY_MESSAGE_VERSION_1 nor GATEWAY_MESSAGE_VERSION_2, Message_ToByteArrayWithVersion shall fail and return -1. ]*/
+        LogError("unknown gateway message version %u", (unsigned int)version);
+        result = -1;
+    }
     else
     {
         MESSAGE_HANDLE_DATA* messageHandleData = (MESSAGE_HANDLE_DATA*)messageHandle;
@@ -497,7 +2519,7 @@ extern int32_t Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char*
         size_t nProperties;
 
         /*Codes_SRS_MESSAGE_02_035: [ If any of the above steps fails then Message_ToByteArray shall fail and return -1. ]*/
-        if (ConstMap_GetInternals(messageHandleData->properties, &keys, &values, &nProperties) != CONSTMAP_OK)
+        if (ConstMap_GetInternals(message_properties(messageHandleData), &keys, &values, &nProperties) != CONSTMAP_OK)
         {
             LogError("failed to get the keys and values from the message properties");
             result = -1;
@@ -511,18 +2533,21 @@ extern int32_t Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char*
                 byteArraySize += (strlen(keys[i]) + 1) + (strlen(values[i]) + 1);
             }
 
-            const CONSTBUFFER* messageContent = CONSTBUFFER_GetContent(messageHandleData->content);
-            byteArraySize += messageContent->size;
+            MESSAGE_CONTENT_GATHER gather;
+            size_t neededSize;
+            gather_content(messageHandleData, &gather);
+            byteArraySize += gather.size;
+            neededSize = withContent ? byteArraySize : byteArraySize - gather.size;
             
             if (size == 0)
             {
                 /*Codes_SRS_MESSAGE_17_016: [ If buf is NULL and size is equal to zero, Message_ToByteArray shall return the needed memory size. ]*/
-                result = byteArraySize;
+                result = neededSize;
             }
-            else if (byteArraySize > (size_t)size)
+            else if (neededSize > (size_t)size)
             {
                 /*Codes_SRS_MESSAGE_17_017: [ If buf is not NULL and size is less than the needed memory size, Message_ToByteArray shall return -1; ]*/
-                LogError("message is %u bytes, won't fit in buffer of %u bytes", byteArraySize, size);
+                LogError("message is %zu bytes, won't fit in buffer of %" PRId32 " bytes", neededSize, size);
                 result = -1;
             }
             else
@@ -560,18 +2585,138 @@ extern int32_t Message_ToByteArray(MESSAGE_HANDLE messageHandle, unsigned char*
                 }
 
                 /*4 bytes in MSB order representing the number of bytes in the message content array*/
-                buf[currentPosition++] = (messageContent->size) >> 24;
-                buf[currentPosition++] = ((messageContent->size) >> 16) & 0xFF;
-                buf[currentPosition++] = ((messageContent->size) >> 8) & 0xFF;
-                buf[currentPosition++] = (messageContent->size) & 0xFF;
+                buf[currentPosition++] = (gather.size) >> 24;
+                buf[currentPosition++] = ((gather.size) >> 16) & 0xFF;
+                buf[currentPosition++] = ((gather.size) >> 8) & 0xFF;
+                buf[currentPosition++] = (gather.size) & 0xFF;
 
                 /*n bytes of message content follows.*/
-                memcpy(buf + currentPosition, messageContent->buffer, messageContent->size);
+                for (i = 0; withContent && (i < gather.count); i++)
+                {
+                    /*Codes_SRS_MESSAGE_30_081: [ Message_ToByteArrayWithVersion shall write the content of a message made of segments from each segment in turn, without copying them into one buffer first. ]*/
+                    memcpy(buf + currentPosition, gather.segments[i]->buffer, gather.segments[i]->size);
+                    currentPosition += gather.segments[i]->size;
+                }
 
                 /*Codes_SRS_MESSAGE_02_036: [ Otherwise Message_ToByteArray shall succeed, and return the byte array size. ]*/
-                result = byteArraySize;
+                result = neededSize;
+            }
+        }
+    }
+    return result;
+}
+
+int32_t Message_ToByteArrayWithVersion(MESSAGE_HANDLE messageHandle, uint8_t version, unsigned char* buf, int32_t size)
+{
+    return to_byte_array(messageHandle, version, buf, size, true);
+}
+
+/*serializes message, or only the bytes before its content, in a new
+CONSTBUFFER*/
+static CONSTBUFFER_HANDLE create_serialization(MESSAGE_HANDLE message, uint8_t version, bool withContent)
+{
+    CONSTBUFFER_HANDLE result;
+    int32_t size = to_byte_array(message, version, NULL, 0, withContent);
+    if (size < 0)
+    {
+        LogError("unable to get the size of the serialization of message [%p]", message);
+        result = NULL;
+    }
+    else
+    {
+        unsigned char* buf = (unsigned char*)malloc(size);
+        if (buf == NULL)
+        {
+            LogError("unable to allocate %" PRId32 " bytes for the serialization", size);
+            result = NULL;
+        }
+        else
+        {
+            if (to_byte_array(message, version, buf, size, withContent) != size)
+            {
+                LogError("unable to serialize message [%p]", message);
+                result = NULL;
             }
+            else
+            {
+                result = CONSTBUFFER_Create(buf, size);
+            }
+            free(buf);
+        }
+    }
+    return result;
+}
+
+/*returns a clone of the serialization of message, or of the bytes before its
+content, made the first time it is needed and kept with the message*/
+static CONSTBUFFER_HANDLE kept_serialization(MESSAGE_HANDLE_DATA* messageData, uint8_t version, bool withContent)
+{
+    CONSTBUFFER_HANDLE result;
+    CONSTBUFFER_HANDLE volatile* kept = withContent ? &messageData->serializations[version - 1] : &messageData->serializationHeaders[version - 1];
+    CONSTBUFFER_HANDLE serialization = *kept;
+    if (serialization == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_021: [ The first time a version is asked for, Message_GetSerialization shall serialize message as Message_ToByteArrayWithVersion does into a new CONSTBUFFER and keep it with the message. ]*/
+        /*Codes_SRS_MESSAGE_30_083: [ Otherwise, Message_GetSerializationHeader shall return the bytes that Message_GetSerialization returns before the content of message, made, kept with the message and cloned as Message_GetSerialization does the serialization. ]*/
+        serialization = create_serialization((MESSAGE_HANDLE)messageData, version, withContent);
+        if (
+            (serialization != NULL) &&
+            !MESSAGE_PUBLISH(kept, serialization)
+            )
+        {
+            /*Codes_SRS_MESSAGE_30_022: [ If another thread kept a serialization of the same version first, Message_GetSerialization shall destroy its own and use the one kept. ]*/
+            CONSTBUFFER_Destroy(serialization);
+            serialization = *kept;
         }
     }
+
+    if (serialization == NULL)
+    {
+        /*Codes_SRS_MESSAGE_30_023: [ If serializing message fails, Message_GetSerialization shall fail and return NULL. ]*/
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_30_025: [ Otherwise Message_GetSerialization shall return a clone of the serialization kept with the message, which the caller destroys with CONSTBUFFER_Destroy. ]*/
+        result = CONSTBUFFER_Clone(serialization);
+    }
+    return result;
+}
+
+CONSTBUFFER_HANDLE Message_GetSerialization(MESSAGE_HANDLE message, uint8_t version)
+{
+    CONSTBUFFER_HANDLE result;
+    if (
+        (message == NULL) ||
+        ((version != GATEWAY_MESSAGE_VERSION_1) && (version != GATEWAY_MESSAGE_VERSION_2))
+        )
+    {
+        /*Codes_SRS_MESSAGE_30_020: [ If message is NULL or version is neither GATEWAY_MESSAGE_VERSION_1 nor GATEWAY_MESSAGE_VERSION_2, Message_GetSerialization shall fail and return NULL. ]*/
+        LogError("invalid arg: message=[%p], version=%u", message, (unsigned int)version);
+        result = NULL;
+    }
+    else
+    {
+        result = kept_serialization((MESSAGE_HANDLE_DATA*)message, version, true);
+    }
+    return result;
+}
+
+CONSTBUFFER_HANDLE Message_GetSerializationHeader(MESSAGE_HANDLE message, uint8_t version)
+{
+    CONSTBUFFER_HANDLE result;
+    if (
+        (message == NULL) ||
+        ((version != GATEWAY_MESSAGE_VERSION_1) && (version != GATEWAY_MESSAGE_VERSION_2))
+        )
+    {
+        /*Codes_SRS_MESSAGE_30_082: [ If message is NULL or version is neither GATEWAY_MESSAGE_VERSION_1 nor GATEWAY_MESSAGE_VERSION_2, Message_GetSerializationHeader shall fail and return NULL. ]*/
+        LogError("invalid arg: message=[%p], version=%u", message, (unsigned int)version);
+        result = NULL;
+    }
+    else
+    {
+        result = kept_serialization((MESSAGE_HANDLE_DATA*)message, version, false);
+    }
     return result;
-}
\ No newline at end of file
+}
@@ -18,13 +18,87 @@ typedef struct MESSAGE_QUEUE_STORAGE_TAG
 
 typedef struct MESSAGE_QUEUE_TAG
 {
-    MESSAGE_QUEUE_STORAGE queue_head;
+    /*one list per priority lane, the lanes above 0 are initialized when first used*/
+    MESSAGE_QUEUE_STORAGE queue_head[MESSAGE_QUEUE_PRIORITIES];
+    size_t count;
+    /*the largest count the queue ever had*/
+    size_t peak_count;
+    /*number of messages on the lanes above 0*/
+    size_t priority_count;
+    size_t lane_count[MESSAGE_QUEUE_PRIORITIES];
+    /*number of pops in a row that passed over each lane while it had messages*/
+    size_t passed_over[MESSAGE_QUEUE_PRIORITIES];
+    bool lanes_initialized;
 } MESSAGE_QUEUE_HANDLE_DATA;
 
-static MESSAGE_HANDLE message_pop(MESSAGE_QUEUE_HANDLE_DATA* handle)
+/*returns the lane of the next message to pop. When take is true the next message is
+being popped, and the lanes passed over for it are accounted for*/
+static size_t select_lane(MESSAGE_QUEUE_HANDLE_DATA* handle, bool take)
+{
+    size_t result = 0;
+
+    /*a queue that only ever had messages of priority 0 never looks at the other lanes*/
+    if (handle->priority_count > 0)
+    {
+        size_t lane;
+
+        /*Codes_SRS_MESSAGE_QUEUE_30_009: [ MESSAGE_QUEUE_pop shall remove the oldest message of the highest priority lane that has messages. ]*/
+        result = MESSAGE_QUEUE_PRIORITIES - 1;
+        while (handle->lane_count[result] == 0)
+        {
+            result--;
+        }
+
+        /*Codes_SRS_MESSAGE_QUEUE_30_010: [ If a lower lane that has messages has been passed over MESSAGE_QUEUE_STARVATION_LIMIT times in a row, MESSAGE_QUEUE_pop shall remove the oldest message of the lowest such lane instead. ]*/
+        for (lane = 0; lane < result; lane++)
+        {
+            if (handle->lane_count[lane] > 0 &&
+                handle->passed_over[lane] >= MESSAGE_QUEUE_STARVATION_LIMIT)
+            {
+                result = lane;
+            }
+        }
+
+        if (take)
+        {
+            for (lane = 0; lane < result; lane++)
+            {
+                if (handle->lane_count[lane] > 0)
+                {
+                    handle->passed_over[lane]++;
+                }
+            }
+        }
+    }
+
+    if (take)
+    {
+        handle->passed_over[result] = 0;
+    }
+
+    return result;
+}
+
+/*the lowest lane that has messages, lane 0 if the queue is empty*/
+static size_t lowest_lane(MESSAGE_QUEUE_HANDLE_DATA* handle)
+{
+    size_t result = 0;
+
+    if (handle->priority_count > 0)
+    {
+        while (handle->lane_count[result] == 0)
+        {
+            result++;
+        }
+    }
+
+    return result;
+}
+
+static MESSAGE_HANDLE remove_head(MESSAGE_QUEUE_HANDLE_DATA* handle, size_t lane)
 {
     MESSAGE_HANDLE result;
-	if (DList_IsListEmpty((PDLIST_ENTRY)&(handle->queue_head)))
+	if (DList_IsListEmpty((PDLIST_ENTRY)&(handle->queue_head[lane])))
 	{
         /*Codes_SRS_MESSAGE_QUEUE_17_013: [ MESSAGE_QUEUE_pop shall return NULL on an empty message queue. ]*/
 		result = NULL;
@@ -34,15 +108,31 @@ static MESSAGE_HANDLE message_pop(MESSAGE_QUEUE_HANDLE_DATA* handle)
         /*Codes_SRS_MESSAGE_QUEUE_17_014: [ MESSAGE_QUEUE_pop shall remove messages from the queue in a first-in-first-out order. ]*/
         /*Codes_SRS_MESSAGE_QUEUE_17_015: [ A successful call to MESSAGE_QUEUE_pop on a queue with one message will cause the message queue to be empty. ]*/
 		MESSAGE_QUEUE_STORAGE* entry =
-		(MESSAGE_QUEUE_STORAGE*)DList_RemoveHeadList( (PDLIST_ENTRY)&(handle->queue_head));
+		(MESSAGE_QUEUE_STORAGE*)DList_RemoveHeadList( (PDLIST_ENTRY)&(handle->queue_head[lane]));
 
         result = ((MESSAGE_QUEUE_STORAGE*)entry)->message;
+        handle->count--;
+        handle->lane_count[lane]--;
+        if (lane > 0)
+        {
+            handle->priority_count--;
+        }
+        /*Codes_SRS_MESSAGE_QUEUE_30_018: [ When MESSAGE_QUEUE_pop or MESSAGE_QUEUE_evict removes the last message of a lane, the count of pops that passed over the lane shall start over at 0. ]*/
+        if (handle->lane_count[lane] == 0)
+        {
+            handle->passed_over[lane] = 0;
+        }
         /*Codes_SRS_MESSAGE_QUEUE_17_006: [ MESSAGE_QUEUE_destroy shall free all allocated resources. ]*/
         free(entry);
     }
     return result;
 }
 
+static MESSAGE_HANDLE message_pop(MESSAGE_QUEUE_HANDLE_DATA* handle)
+{
+    return remove_head(handle, select_lane(handle, true));
+}
+
 MESSAGE_QUEUE_HANDLE MESSAGE_QUEUE_create()
 {
 	MESSAGE_QUEUE_HANDLE_DATA* result;
@@ -57,8 +147,18 @@ MESSAGE_QUEUE_HANDLE MESSAGE_QUEUE_create()
     {
         /*Codes_SRS_MESSAGE_QUEUE_17_001: [ On a successful call, MESSAGE_QUEUE_create shall return a non-NULL value in MESSAGE_QUEUE_HANDLE. ]*/
         /*Codes_SRS_MESSAGE_QUEUE_17_002: [ A newly created message queue shall be empty. ]*/
-        DList_InitializeListHead((PDLIST_ENTRY)&(result->queue_head));
-        result->queue_head.message = NULL;
+        size_t lane;
+        DList_InitializeListHead((PDLIST_ENTRY)&(result->queue_head[0]));
+        result->queue_head[0].message = NULL;
+        result->count = 0;
+        result->peak_count = 0;
+        result->priority_count = 0;
+        for (lane = 0; lane < MESSAGE_QUEUE_PRIORITIES; lane++)
+        {
+            result->lane_count[lane] = 0;
+            result->passed_over[lane] = 0;
+        }
+        result->lanes_initialized = false;
     }
     return result;
 }
@@ -87,33 +187,79 @@ void MESSAGE_QUEUE_destroy(MESSAGE_QUEUE_HANDLE handle)
 
 /* insertion */
 
-int MESSAGE_QUEUE_push(MESSAGE_QUEUE_HANDLE handle, MESSAGE_HANDLE element)
+static int message_push(MESSAGE_QUEUE_HANDLE_DATA* handle, MESSAGE_HANDLE element, size_t priority)
 {
     int result;
-    if (handle == NULL || element == NULL)
+    MESSAGE_QUEUE_STORAGE* temp = (MESSAGE_QUEUE_STORAGE*)malloc(sizeof(MESSAGE_QUEUE_STORAGE));
+    if (temp == NULL)
     {
-        /*Codes_SRS_MESSAGE_QUEUE_17_007: [ MESSAGE_QUEUE_push shall return a non-zero value if handle or element are NULL. ]*/
-        LogError("invalid argument - handle(%p), element(%p).", handle, element);
+        /*Codes_SRS_MESSAGE_QUEUE_17_009: [ MESSAGE_QUEUE_push shall return a non-zero value if any system call fails. ]*/
+        LogError("malloc failed.");
         result = __LINE__;
     }
     else
     {
-		MESSAGE_QUEUE_STORAGE* temp = (MESSAGE_QUEUE_STORAGE*)malloc(sizeof(MESSAGE_QUEUE_STORAGE));
-        if (temp == NULL)
+        if (priority > 0 && handle->lanes_initialized == false)
         {
-            /*Codes_SRS_MESSAGE_QUEUE_17_009: [ MESSAGE_QUEUE_push shall return a non-zero value if any system call fails. ]*/
-            LogError("malloc failed.");
-            result = __LINE__;
+            size_t lane;
+            for (lane = 1; lane < MESSAGE_QUEUE_PRIORITIES; lane++)
+            {
+                DList_InitializeListHead((PDLIST_ENTRY)&(handle->queue_head[lane]));
+                handle->queue_head[lane].message = NULL;
+            }
+            handle->lanes_initialized = true;
         }
-        else
+
+        DList_InitializeListHead((PDLIST_ENTRY)temp);
+        temp->message = element;
+        /*Codes_SRS_MESSAGE_QUEUE_17_011: [ Messages shall be pushed into the queue in a first-in-first-out order. ]*/
+        DList_AppendTailList((PDLIST_ENTRY)&(handle->queue_head[priority]), (PDLIST_ENTRY)temp);
+        handle->count++;
+        if (handle->count > handle->peak_count)
         {
-            DList_InitializeListHead((PDLIST_ENTRY)temp);
-            temp->message = element;
-            /*Codes_SRS_MESSAGE_QUEUE_17_011: [ Messages shall be pushed into the queue in a first-in-first-out order. ]*/
-            DList_AppendTailList((PDLIST_ENTRY)&(handle->queue_head), (PDLIST_ENTRY)temp);
-            /*Codes_SRS_MESSAGE_QUEUE_17_008: [ MESSAGE_QUEUE_push shall return zero on success. ]*/
-            result = 0;
+            handle->peak_count = handle->count;
         }
+        handle->lane_count[priority]++;
+        if (priority > 0)
+        {
+            handle->priority_count++;
+        }
+        /*Codes_SRS_MESSAGE_QUEUE_17_008: [ MESSAGE_QUEUE_push shall return zero on success. ]*/
+        result = 0;
+    }
+    return result;
+}
+
+int MESSAGE_QUEUE_push(MESSAGE_QUEUE_HANDLE handle, MESSAGE_HANDLE element)
+{
+    int result;
+    if (handle == NULL || element == NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_17_007: [ MESSAGE_QUEUE_push shall return a non-zero value if handle or element are NULL. ]*/
+        LogError("invalid argument - handle(%p), element(%p).", handle, element);
+        result = __LINE__;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_007: [ MESSAGE_QUEUE_push shall push element on lane 0. ]*/
+        result = message_push(handle, element, 0);
+    }
+    return result;
+}
+
+int MESSAGE_QUEUE_push_with_priority(MESSAGE_QUEUE_HANDLE handle, MESSAGE_HANDLE element, size_t priority)
+{
+    int result;
+    if (handle == NULL || element == NULL || priority >= MESSAGE_QUEUE_PRIORITIES)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_008: [ MESSAGE_QUEUE_push_with_priority shall return a non-zero value if handle or element are NULL, or if priority is not less than MESSAGE_QUEUE_PRIORITIES. ]*/
+        LogError("invalid argument - handle(%p), element(%p), priority(%zu).", handle, element, priority);
+        result = __LINE__;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_011: [ MESSAGE_QUEUE_push_with_priority shall otherwise behave as MESSAGE_QUEUE_push, on lane priority. ]*/
+        result = message_push(handle, element, priority);
     }
     return result;
 }
@@ -134,11 +280,71 @@ MESSAGE_HANDLE MESSAGE_QUEUE_pop(MESSAGE_QUEUE_HANDLE handle)
         /*Codes_SRS_MESSAGE_QUEUE_17_013: [ MESSAGE_QUEUE_pop shall return NULL on an empty message queue. ]*/
         /*Codes_SRS_MESSAGE_QUEUE_17_014: [ MESSAGE_QUEUE_pop shall remove messages from the queue in a first-in-first-out order. ]*/
         /*Codes_SRS_MESSAGE_QUEUE_17_015: [ A successful call to MESSAGE_QUEUE_pop on a queue with one message will cause the message queue to be empty. ]*/
+        /*Codes_SRS_MESSAGE_QUEUE_30_009: [ MESSAGE_QUEUE_pop shall remove the oldest message of the highest priority lane that has messages. ]*/
         result = message_pop(handle);
     }
     return result;
 }
 
+MESSAGE_HANDLE MESSAGE_QUEUE_evict(MESSAGE_QUEUE_HANDLE handle)
+{
+    MESSAGE_HANDLE result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_015: [ MESSAGE_QUEUE_evict shall return NULL on a NULL or empty message queue. ]*/
+        LogError("invalid argument - handle(%p).", handle);
+        result = NULL;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_015: [ MESSAGE_QUEUE_evict shall return NULL on a NULL or empty message queue. ]*/
+        /*Codes_SRS_MESSAGE_QUEUE_30_016: [ MESSAGE_QUEUE_evict shall remove the oldest message of the lowest priority lane that has messages. ]*/
+        /*Codes_SRS_MESSAGE_QUEUE_30_017: [ MESSAGE_QUEUE_evict shall not change the order in which MESSAGE_QUEUE_pop removes the remaining messages. ]*/
+        result = remove_head(handle, lowest_lane(handle));
+    }
+    return result;
+}
+
+/* replacement */
+
+MESSAGE_HANDLE MESSAGE_QUEUE_replace_if(MESSAGE_QUEUE_HANDLE handle, MESSAGE_QUEUE_PREDICATE predicate, const void* context, MESSAGE_HANDLE element, size_t priority)
+{
+    MESSAGE_HANDLE result;
+    if (handle == NULL || predicate == NULL || element == NULL || priority >= MESSAGE_QUEUE_PRIORITIES)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_001: [ MESSAGE_QUEUE_replace_if shall return NULL if handle, predicate or element are NULL, or if priority is not less than MESSAGE_QUEUE_PRIORITIES. ]*/
+        LogError("invalid argument - handle(%p), predicate(%p), element(%p), priority(%zu).", handle, predicate, element, priority);
+        result = NULL;
+    }
+    else
+    {
+        result = NULL;
+        /*a lane above 0 that never had a message is not initialized*/
+        if (handle->lane_count[priority] > 0)
+        {
+            /*Codes_SRS_MESSAGE_QUEUE_30_002: [ MESSAGE_QUEUE_replace_if shall call predicate with each message queued on lane priority and context, starting with the most recently pushed one. ]*/
+            PDLIST_ENTRY head = (PDLIST_ENTRY)&(handle->queue_head[priority]);
+            PDLIST_ENTRY entry = head->Blink;
+            while (entry != head && result == NULL)
+            {
+                MESSAGE_QUEUE_STORAGE* storage = (MESSAGE_QUEUE_STORAGE*)entry;
+                if (predicate(storage->message, context))
+                {
+                    /*Codes_SRS_MESSAGE_QUEUE_30_003: [ MESSAGE_QUEUE_replace_if shall put element in place of the first message for which predicate returns true, and return that message. ]*/
+                    result = storage->message;
+                    storage->message = element;
+                }
+                else
+                {
+                    entry = entry->Blink;
+                }
+            }
+        }
+        /*Codes_SRS_MESSAGE_QUEUE_30_004: [ If predicate returns false for every message queued on lane priority, MESSAGE_QUEUE_replace_if shall leave the queue unchanged and return NULL. ]*/
+    }
+    return result;
+}
+
 /* access */
 bool MESSAGE_QUEUE_is_empty(MESSAGE_QUEUE_HANDLE handle)
 {
@@ -153,7 +359,7 @@ bool MESSAGE_QUEUE_is_empty(MESSAGE_QUEUE_HANDLE handle)
 	{
         /*Codes_SRS_MESSAGE_QUEUE_17_017: [ MESSAGE_QUEUE_is_empty shall return true if there are no messages on the queue. ]*/
         /*Codes_SRS_MESSAGE_QUEUE_17_018: [ MESSAGE_QUEUE_is_empty shall return false if one or more messages have been pushed on the queue. ]*/
-		result = (DList_IsListEmpty((PDLIST_ENTRY)&(handle->queue_head)));
+		result = (handle->priority_count == 0 && DList_IsListEmpty((PDLIST_ENTRY)&(handle->queue_head[0])));
 	}
 	return result;
 }
@@ -169,8 +375,10 @@ MESSAGE_HANDLE MESSAGE_QUEUE_front(MESSAGE_QUEUE_HANDLE handle)
     }
     else
     {
+        /*Codes_SRS_MESSAGE_QUEUE_30_012: [ MESSAGE_QUEUE_front shall look at the lane MESSAGE_QUEUE_pop would remove a message from. ]*/
+        size_t lane = select_lane(handle, false);
         /*Codes_SRS_MESSAGE_QUEUE_17_020: [ MESSAGE_QUEUE_front shall return NULL if the message queue is empty. ]*/
-        if (DList_IsListEmpty((PDLIST_ENTRY)&(handle->queue_head)))
+        if (DList_IsListEmpty((PDLIST_ENTRY)&(handle->queue_head[lane])))
         {
             result = NULL;
         }
@@ -178,12 +386,45 @@ MESSAGE_HANDLE MESSAGE_QUEUE_front(MESSAGE_QUEUE_HANDLE handle)
         {
             /*Codes_SRS_MESSAGE_QUEUE_17_021: [ On a non-empty queue, MESSAGE_QUEUE_front shall return the first remaining element that was pushed onto the message queue. ]*/
             
-            MESSAGE_QUEUE_STORAGE* entry = (MESSAGE_QUEUE_STORAGE*)DList_RemoveHeadList((PDLIST_ENTRY)&(handle->queue_head));
+            MESSAGE_QUEUE_STORAGE* entry = (MESSAGE_QUEUE_STORAGE*)DList_RemoveHeadList((PDLIST_ENTRY)&(handle->queue_head[lane]));
             result = entry->message;
             /*Codes_SRS_MESSAGE_QUEUE_17_022: [ The content of the message queue shall not be changed after calling MESSAGE_QUEUE_front. ]*/
-            DList_InsertHeadList((PDLIST_ENTRY)&(handle->queue_head), (PDLIST_ENTRY)entry);
+            DList_InsertHeadList((PDLIST_ENTRY)&(handle->queue_head[lane]), (PDLIST_ENTRY)entry);
         }
     }
     return result;
 }
 
+size_t MESSAGE_QUEUE_size(MESSAGE_QUEUE_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_005: [ MESSAGE_QUEUE_size shall return 0 if handle is NULL. ]*/
+        LogError("invalid argument handle (NULL).");
+        result = 0;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_006: [ MESSAGE_QUEUE_size shall return the number of messages on the queue. ]*/
+        result = handle->count;
+    }
+    return result;
+}
+
+size_t MESSAGE_QUEUE_peak_size(MESSAGE_QUEUE_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_013: [ MESSAGE_QUEUE_peak_size shall return 0 if handle is NULL. ]*/
+        LogError("invalid argument handle (NULL).");
+        result = 0;
+    }
+    else
+    {
+        /*Codes_SRS_MESSAGE_QUEUE_30_014: [ MESSAGE_QUEUE_peak_size shall return the largest number of messages the queue has held since it was created. ]*/
+        result = handle->peak_count;
+    }
+    return result;
+}
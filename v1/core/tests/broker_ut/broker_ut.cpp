@@ -3,20 +3,24 @@
 
 #include <cstdlib>
 #include <cstddef>
+#include <cstring>
 #include <cstdbool>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
 #include "testrunnerswitcher.h"
 #include "micromock.h"
 #include "micromockcharstararenullterminatedstrings.h"
 #include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
 #include "azure_c_shared_utility/vector.h"
 #include "azure_c_shared_utility/vector_types_internal.h"
 #include "azure_c_shared_utility/singlylinkedlist.h"
 #include "message.h"
+#include "message_queue.h"
 #include "azure_c_shared_utility/threadapi.h"
-#include "azure_c_shared_utility/uniqueid.h"
 #include "azure_c_shared_utility/xlogging.h"
-#include "nanomsg/nn.h"
-#include "nanomsg/pubsub.h"
 
 static MICROMOCK_MUTEX_HANDLE g_testByTest;
 static MICROMOCK_GLOBAL_SEMAPHORE_HANDLE g_dllByDll;
@@ -42,10 +46,12 @@ namespace BASEIMPLEMENTATION
 #undef Lock_Init
 #undef Lock_Deinit
 #include "vector.c"
-#include "strings.c"
 };
 
 #include "broker.h"
+#include "link_filter.h"
+#include "processor_count.h"
+#include "monotonic_clock.h"
 #include "azure_c_shared_utility/lock.h"
 
 DEFINE_MICROMOCK_ENUM_TO_STRING(BROKER_RESULT, BROKER_RESULT_VALUES);
@@ -80,17 +86,24 @@ static size_t whenShallLock_fail;
 
 static size_t currentUnlock_call;
 
-static size_t currentCond_Init_call;
-static size_t whenShallCond_Init_fail;
+static size_t currentCondition_Init_call;
+static size_t whenShallCondition_Init_fail;
 
-static size_t currentCond_Post_call;
-static size_t whenShallCond_Post_fail;
+static size_t currentCondition_Wait_call;
+static size_t whenShallCondition_Wait_fail;
+
+static size_t currentMESSAGE_QUEUE_create_call;
+static size_t whenShallMESSAGE_QUEUE_create_fail;
+
+static size_t currentMessage_InternKey_call;
+static size_t whenShallMessage_InternKey_fail;
+
+static size_t currentMESSAGE_QUEUE_push_call;
+static size_t whenShallMESSAGE_QUEUE_push_fail;
 
 static size_t currentThreadAPI_Create_call;
 static size_t whenShallThreadAPI_Create_fail;
 
-static size_t nn_current_msg_size;
-
 typedef struct LIST_ITEM_INSTANCE_TAG
 {
     const void* item;
@@ -102,17 +115,83 @@ typedef struct LIST_INSTANCE_TAG
     LIST_ITEM_INSTANCE* head;
 } LIST_INSTANCE;
 
+typedef struct BROKER_SOURCE_TAG
+{
+    BROKER_LINK_DATA link;
+    void* filter;
+} BROKER_SOURCE;
+
 struct ListNode
 {
     const void* item;
     ListNode *next, *prev;
 };
 
-static int current_nn_socket_index;
-static void* nn_socket_memory[10];
+/*a module's mq: the messages in the order they were pushed, and the lane each was pushed on*/
+struct FakeMessageQueue : public std::deque<MESSAGE_HANDLE>
+{
+    std::deque<size_t> lanes;
+
+    void push(MESSAGE_HANDLE message, size_t lane)
+    {
+        push_back(message);
+        lanes.push_back(lane);
+    }
+
+    MESSAGE_HANDLE take(size_t index)
+    {
+        MESSAGE_HANDLE message = (*this)[index];
+        erase(begin() + index);
+        lanes.erase(lanes.begin() + index);
+        return message;
+    }
+};
+
+/*the value of the coalesce key property of each fake message, messages not in here don't have it*/
+static std::map<MESSAGE_HANDLE, std::string> fake_message_keys;
+
+/*the MESSAGE_KEY Message_InternKey gives each name, the same for the whole run as in the real key table*/
+static std::map<std::string, MESSAGE_KEY> fake_interned_keys;
+
+static MESSAGE_KEY fake_key(const char* name)
+{
+    std::map<std::string, MESSAGE_KEY>::iterator found = fake_interned_keys.find(name);
+    MESSAGE_KEY result;
+    if (found == fake_interned_keys.end())
+    {
+        result = (MESSAGE_KEY)(100 + fake_interned_keys.size());
+        fake_interned_keys[name] = result;
+    }
+    else
+    {
+        result = found->second;
+    }
+    return result;
+}
+
+static const char* fake_property_value(MESSAGE_HANDLE message)
+{
+    std::map<MESSAGE_HANDLE, std::string>::iterator found = fake_message_keys.find(message);
+    return (found == fake_message_keys.end()) ? NULL : found->second.c_str();
+}
+
+/*the fake message Message_IsExpired says has expired, if any*/
+static MESSAGE_HANDLE fake_expired_message;
+
+/*the queue made by the last MESSAGE_QUEUE_create call, and whether Condition_Wait behaves
+like the worker and takes a message out of it*/
+static FakeMessageQueue* last_created_mq;
+static bool pop_on_Condition_Wait;
+
+/*the content of every fake message, and the time MonotonicClock_GetMicroseconds returns; the
+clock moves fake_clock_step microseconds forward at every call*/
+static const CONSTBUFFER fake_content = { NULL, 42 };
+static uint64_t fake_clock;
+static uint64_t fake_clock_step;
 
 static THREAD_START_FUNC thread_func_to_call;
 static void* thread_func_args;
+static bool run_worker_on_join;
 
 struct FakeModule_Receive_Call_Status
 {
@@ -123,6 +202,7 @@ struct FakeModule_Receive_Call_Status
 static FakeModule_Receive_Call_Status call_status_for_FakeModule_Receive;
 
 static MODULE_HANDLE fake_module_handle = (MODULE_HANDLE)0x42;
+static MODULE_HANDLE fake_module_handle2 = (MODULE_HANDLE)0x43;
 
 static MODULE_HANDLE FakeModule_Create(BROKER_HANDLE broker, const void* configuration)
 {
@@ -137,9 +217,9 @@ static void FakeModule_Destroy(MODULE_HANDLE module)
 
 static void FakeModule_Receive(MODULE_HANDLE module, MESSAGE_HANDLE messageHandle)
 {
-    (void)messageHandle;
     call_status_for_FakeModule_Receive.was_called = true;
     ASSERT_ARE_EQUAL(void_ptr, module, call_status_for_FakeModule_Receive.module);
+    ASSERT_ARE_EQUAL(void_ptr, messageHandle, call_status_for_FakeModule_Receive.messageHandle);
 }
 
 static MODULE_API_1 fake_module_apis =
@@ -159,6 +239,70 @@ MODULE fake_module =
     fake_module_handle
 };
 
+MODULE fake_module2 =
+{
+    (const MODULE_API *)&fake_module_apis,
+    fake_module_handle2
+};
+
+/*the batches received by FakeModule_ReceiveBatch*/
+static std::vector<std::vector<MESSAGE_HANDLE> > batches_for_FakeModule_ReceiveBatch;
+
+static void FakeModule_ReceiveBatch(MODULE_HANDLE module, MESSAGE_HANDLE* messageHandles, size_t count)
+{
+    ASSERT_ARE_EQUAL(void_ptr, module, fake_module_handle);
+    batches_for_FakeModule_ReceiveBatch.push_back(std::vector<MESSAGE_HANDLE>(messageHandles, messageHandles + count));
+}
+
+static MODULE_API_2 fake_batch_module_apis =
+{
+    { MODULE_API_VERSION_2 },
+    NULL,
+    NULL,
+    FakeModule_Create,
+    FakeModule_Destroy,
+    FakeModule_Receive,
+    NULL,
+    FakeModule_ReceiveBatch
+};
+
+MODULE fake_batch_module =
+{
+    (const MODULE_API *)&fake_batch_module_apis,
+    fake_module_handle
+};
+
+/*the broker FakeModule_ReceiveAndPublish publishes the message it receives to, once*/
+static BROKER_HANDLE broker_for_FakeModule_ReceiveAndPublish;
+
+static void FakeModule_ReceiveAndPublish(MODULE_HANDLE module, MESSAGE_HANDLE messageHandle)
+{
+    BROKER_HANDLE broker = broker_for_FakeModule_ReceiveAndPublish;
+    FakeModule_Receive(module, messageHandle);
+    broker_for_FakeModule_ReceiveAndPublish = NULL;
+    if (broker != NULL)
+    {
+        (void)Broker_Publish(broker, module, messageHandle);
+    }
+}
+
+static MODULE_API_1 fake_republishing_module_apis =
+{
+    { MODULE_API_VERSION_1 },
+    NULL,
+    NULL,
+    FakeModule_Create,
+    FakeModule_Destroy,
+    FakeModule_ReceiveAndPublish,
+    NULL
+};
+
+MODULE fake_republishing_module =
+{
+    (const MODULE_API *)&fake_republishing_module_apis,
+    fake_module_handle
+};
+
 class RefCountObject
 {
 private:
@@ -327,11 +471,29 @@ public:
         }
     MOCK_METHOD_END(THREADAPI_RESULT, result2)
 
+    MOCK_STATIC_METHOD_0(, size_t, ProcessorCount_Get)
+    MOCK_METHOD_END(size_t, 1)
+
+    MOCK_STATIC_METHOD_1(, int, ThreadScheduling_Apply, const THREAD_SCHEDULING_CONFIG*, config)
+    MOCK_METHOD_END(int, 0)
+
+    MOCK_STATIC_METHOD_0(, uint64_t, MonotonicClock_GetMicroseconds)
+        fake_clock += fake_clock_step;
+    MOCK_METHOD_END(uint64_t, fake_clock)
+
     MOCK_STATIC_METHOD_2(, THREADAPI_RESULT, ThreadAPI_Join, THREAD_HANDLE, threadHandle, int*, res)
+        if (run_worker_on_join)
+        {
+            /*the worker is expected to observe quit_worker and return*/
+            (void)thread_func_to_call(thread_func_args);
+        }
         free(threadHandle);
         auto result2 = THREADAPI_OK;
     MOCK_METHOD_END(THREADAPI_RESULT, result2)
 
+    MOCK_STATIC_METHOD_1(, void, ThreadAPI_Sleep, unsigned int, milliseconds)
+    MOCK_VOID_METHOD_END()
+
     MOCK_STATIC_METHOD_1(, MESSAGE_HANDLE, Message_Create, const MESSAGE_CONFIG*, cfg)
         MESSAGE_HANDLE result2 = (MESSAGE_HANDLE)(new RefCountObject());
     MOCK_METHOD_END(MESSAGE_HANDLE, result2)
@@ -350,6 +512,18 @@ public:
     MOCK_STATIC_METHOD_3(, int32_t, Message_ToByteArray, MESSAGE_HANDLE, messageHandle, unsigned char *, buffer, int32_t, size)
     MOCK_METHOD_END(int32_t, (int32_t)1)
 
+    MOCK_STATIC_METHOD_1(, const CONSTBUFFER*, Message_GetContent, MESSAGE_HANDLE, message)
+    MOCK_METHOD_END(const CONSTBUFFER*, &fake_content)
+
+    MOCK_STATIC_METHOD_2(, bool, Message_IsExpired, MESSAGE_HANDLE, message, uint64_t, now)
+    MOCK_METHOD_END(bool, (message == fake_expired_message))
+
+    MOCK_STATIC_METHOD_0(, void, Message_EnableThreadCache)
+    MOCK_VOID_METHOD_END()
+
+    MOCK_STATIC_METHOD_0(, void, Message_DisableThreadCache)
+    MOCK_VOID_METHOD_END()
+
     // list.h
 
     MOCK_STATIC_METHOD_0(, SINGLYLINKEDLIST_HANDLE, singlylinkedlist_create)
@@ -488,90 +662,203 @@ public:
         }
     MOCK_METHOD_END(const void*, result1)
 
-    MOCK_STATIC_METHOD_1(, void, STRING_delete, STRING_HANDLE, s)
-        BASEIMPLEMENTATION::STRING_delete(s);
+    // message_queue.h
+
+    MOCK_STATIC_METHOD_0(, MESSAGE_QUEUE_HANDLE, MESSAGE_QUEUE_create)
+        MESSAGE_QUEUE_HANDLE result2;
+        ++currentMESSAGE_QUEUE_create_call;
+        if ((whenShallMESSAGE_QUEUE_create_fail > 0) &&
+            (currentMESSAGE_QUEUE_create_call == whenShallMESSAGE_QUEUE_create_fail))
+        {
+            result2 = NULL;
+        }
+        else
+        {
+            last_created_mq = new FakeMessageQueue();
+            result2 = (MESSAGE_QUEUE_HANDLE)last_created_mq;
+        }
+    MOCK_METHOD_END(MESSAGE_QUEUE_HANDLE, result2)
+
+    MOCK_STATIC_METHOD_1(, void, MESSAGE_QUEUE_destroy, MESSAGE_QUEUE_HANDLE, handle)
+        FakeMessageQueue* mq = (FakeMessageQueue*)handle;
+        while (!mq->empty())
+        {
+            ((RefCountObject*)mq->take(0))->dec_ref();
+        }
+        delete mq;
     MOCK_VOID_METHOD_END()
 
-    MOCK_STATIC_METHOD_1(, STRING_HANDLE, STRING_construct, const char*, source)
-        STRING_HANDLE result2;
-        result2 = BASEIMPLEMENTATION::STRING_construct(source);
-    MOCK_METHOD_END(STRING_HANDLE, result2)
+    MOCK_STATIC_METHOD_3(, int, MESSAGE_QUEUE_push_with_priority, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_HANDLE, element, size_t, priority)
+        int result2;
+        ++currentMESSAGE_QUEUE_push_call;
+        if ((whenShallMESSAGE_QUEUE_push_fail > 0) &&
+            (currentMESSAGE_QUEUE_push_call == whenShallMESSAGE_QUEUE_push_fail))
+        {
+            result2 = __LINE__;
+        }
+        else
+        {
+            ((FakeMessageQueue*)handle)->push(element, priority);
+            result2 = 0;
+        }
+    MOCK_METHOD_END(int, result2)
+
+    MOCK_STATIC_METHOD_1(, MESSAGE_HANDLE, MESSAGE_QUEUE_pop, MESSAGE_QUEUE_HANDLE, handle)
+        MESSAGE_HANDLE result2;
+        FakeMessageQueue* mq = (FakeMessageQueue*)handle;
+        if (mq->empty())
+        {
+            result2 = NULL;
+        }
+        else
+        {
+            /*the oldest message of the highest lane*/
+            size_t index = 0;
+            for (size_t i = 1; i < mq->size(); i++)
+            {
+                if (mq->lanes[i] > mq->lanes[index])
+                {
+                    index = i;
+                }
+            }
+            result2 = mq->take(index);
+        }
+    MOCK_METHOD_END(MESSAGE_HANDLE, result2)
+
+    MOCK_STATIC_METHOD_1(, MESSAGE_HANDLE, MESSAGE_QUEUE_evict, MESSAGE_QUEUE_HANDLE, handle)
+        MESSAGE_HANDLE result2;
+        FakeMessageQueue* mq = (FakeMessageQueue*)handle;
+        if (mq->empty())
+        {
+            result2 = NULL;
+        }
+        else
+        {
+            /*the oldest message of the lowest lane*/
+            size_t index = 0;
+            for (size_t i = 1; i < mq->size(); i++)
+            {
+                if (mq->lanes[i] < mq->lanes[index])
+                {
+                    index = i;
+                }
+            }
+            result2 = mq->take(index);
+        }
+    MOCK_METHOD_END(MESSAGE_HANDLE, result2)
 
-    MOCK_STATIC_METHOD_2(, int, STRING_concat, STRING_HANDLE, s1, const char*, s2)
-        int result1 = BASEIMPLEMENTATION::STRING_concat(s1, s2);
-    MOCK_METHOD_END(int, result1);
+    MOCK_STATIC_METHOD_1(, bool, MESSAGE_QUEUE_is_empty, MESSAGE_QUEUE_HANDLE, handle)
+        bool result2 = ((FakeMessageQueue*)handle)->empty();
+    MOCK_METHOD_END(bool, result2)
 
-    MOCK_STATIC_METHOD_1(, const char*, STRING_c_str, STRING_HANDLE, s)
-    MOCK_METHOD_END(const char*, BASEIMPLEMENTATION::STRING_c_str(s))
+    MOCK_STATIC_METHOD_1(, size_t, MESSAGE_QUEUE_size, MESSAGE_QUEUE_HANDLE, handle)
+        size_t result2 = ((FakeMessageQueue*)handle)->size();
+    MOCK_METHOD_END(size_t, result2)
 
-    MOCK_STATIC_METHOD_1(, size_t, STRING_length, STRING_HANDLE, s)
-    MOCK_METHOD_END(size_t, BASEIMPLEMENTATION::STRING_length(s))
+    MOCK_STATIC_METHOD_1(, size_t, MESSAGE_QUEUE_peak_size, MESSAGE_QUEUE_HANDLE, handle)
+    MOCK_METHOD_END(size_t, 7)
 
-    MOCK_STATIC_METHOD_2(, UNIQUEID_RESULT, UniqueId_Generate, char*, uid, size_t, bufferSize)
-        for (size_t i = 0; i < bufferSize; i++)
+    MOCK_STATIC_METHOD_5(, MESSAGE_HANDLE, MESSAGE_QUEUE_replace_if, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_QUEUE_PREDICATE, predicate, const void*, context, MESSAGE_HANDLE, element, size_t, priority)
+        MESSAGE_HANDLE result2 = NULL;
+        FakeMessageQueue* mq = (FakeMessageQueue*)handle;
+        for (size_t i = mq->size(); i > 0; i--)
         {
-            if (i == (bufferSize - 1))
-                uid[i] = '\0';
-            else
-                uid[i] = 'u';
+            if (mq->lanes[i - 1] == priority && predicate((*mq)[i - 1], context))
+            {
+                result2 = (*mq)[i - 1];
+                (*mq)[i - 1] = element;
+                break;
+            }
         }
-    MOCK_METHOD_END(UNIQUEID_RESULT, UNIQUEID_OK)
+    MOCK_METHOD_END(MESSAGE_HANDLE, result2)
 
+    // message.h properties
 
-    MOCK_STATIC_METHOD_2(, void *, nn_allocmsg, size_t, size, int, type)
-        nn_current_msg_size = size;
-    MOCK_METHOD_END(void*, malloc(size))
+    MOCK_STATIC_METHOD_2(, const char*, Message_GetPropertyValue, MESSAGE_HANDLE, message, const char*, key)
+    MOCK_METHOD_END(const char*, fake_property_value(message))
 
-    MOCK_STATIC_METHOD_1(, int, nn_freemsg, void*, msg)
-        free(msg);
-    MOCK_METHOD_END(int, 0)
+    MOCK_STATIC_METHOD_1(, MESSAGE_KEY, Message_InternKey, const char*, key)
+        MESSAGE_KEY result2;
+        ++currentMessage_InternKey_call;
+        if ((whenShallMessage_InternKey_fail > 0) &&
+            (currentMessage_InternKey_call == whenShallMessage_InternKey_fail))
+        {
+            result2 = MESSAGE_KEY_NONE;
+        }
+        else
+        {
+            result2 = fake_key(key);
+        }
+    MOCK_METHOD_END(MESSAGE_KEY, result2)
 
-    MOCK_STATIC_METHOD_2(, int, nn_socket, int, domain, int, protocol)
-        current_nn_socket_index++;
-        nn_socket_memory[current_nn_socket_index] = malloc(1);
-    MOCK_METHOD_END(int, current_nn_socket_index)
+    MOCK_STATIC_METHOD_2(, const char*, Message_GetPropertyValueByKey, MESSAGE_HANDLE, message, MESSAGE_KEY, key)
+    MOCK_METHOD_END(const char*, fake_property_value(message))
 
-    MOCK_STATIC_METHOD_1(, int, nn_close, int, s)
-        free(nn_socket_memory[s]);
-    MOCK_METHOD_END(int, 0)
+    // link_filter.h
 
-    MOCK_STATIC_METHOD_2(, int, nn_bind, int, s, const char *, addr)
-    MOCK_METHOD_END(int, 1)
+    MOCK_STATIC_METHOD_1(, LINK_FILTER_HANDLE, LinkFilter_Create, const char*, expression)
+        LINK_FILTER_HANDLE result2;
+        if (strcmp(expression, "bad") == 0)
+        {
+            result2 = NULL;
+        }
+        else
+        {
+            size_t length = strlen(expression) + 1;
+            result2 = (LINK_FILTER_HANDLE)malloc(length);
+            memcpy(result2, expression, length);
+        }
+    MOCK_METHOD_END(LINK_FILTER_HANDLE, result2)
 
-    MOCK_STATIC_METHOD_2(, int, nn_connect, int, s, const char *, addr)
-    MOCK_METHOD_END(int, 1)
+    MOCK_STATIC_METHOD_1(, void, LinkFilter_Destroy, LINK_FILTER_HANDLE, filter)
+        free(filter);
+    MOCK_VOID_METHOD_END()
 
-    MOCK_STATIC_METHOD_5(, int, nn_setsockopt, int, s, int, level, int, option, const void *, optval, size_t, optvallen)
-    MOCK_METHOD_END(int, 1)
+    /*a fake filter matches every message, unless its expression is "no match"*/
+    MOCK_STATIC_METHOD_3(, bool, LinkFilter_Matches, LINK_FILTER_HANDLE, filter, LINK_FILTER_LOOKUP, lookup, const void*, context)
+        bool result2 = strcmp((const char*)filter, "no match") != 0;
+    MOCK_METHOD_END(bool, result2)
 
+    // condition.h
 
-    MOCK_STATIC_METHOD_4(, int, nn_send, int, s, const void*, buf, size_t, len, int, flags)
-        int send_length;
-        if (len == NN_MSG)
+    MOCK_STATIC_METHOD_0(, COND_HANDLE, Condition_Init)
+        COND_HANDLE result2;
+        ++currentCondition_Init_call;
+        if ((whenShallCondition_Init_fail > 0) &&
+            (currentCondition_Init_call == whenShallCondition_Init_fail))
         {
-            send_length = (int)nn_current_msg_size;
-            free(*(void**)buf); // send is supposed to free auto created buffer on success
+            result2 = NULL;
         }
         else
         {
-            send_length = len;
+            result2 = (COND_HANDLE)malloc(1);
         }
-    MOCK_METHOD_END(int, send_length)
+    MOCK_METHOD_END(COND_HANDLE, result2)
+
+    MOCK_STATIC_METHOD_1(, void, Condition_Deinit, COND_HANDLE, handle)
+        free(handle);
+    MOCK_VOID_METHOD_END()
+
+    MOCK_STATIC_METHOD_1(, COND_RESULT, Condition_Post, COND_HANDLE, handle)
+    MOCK_METHOD_END(COND_RESULT, COND_OK)
 
-    MOCK_STATIC_METHOD_4(, int, nn_recv, int, s, void*, buf, size_t, len, int, flags)
-        int rcv_length;
-        if (len == NN_MSG)
+    MOCK_STATIC_METHOD_3(, COND_RESULT, Condition_Wait, COND_HANDLE, handle, LOCK_HANDLE, lock, int, timeout_milliseconds)
+        COND_RESULT result2;
+        ++currentCondition_Wait_call;
+        if ((whenShallCondition_Wait_fail > 0) &&
+            (currentCondition_Wait_call == whenShallCondition_Wait_fail))
         {
-            char * text = (char*)"nn_recv";
-            (*(void**)buf) = malloc(8);
-            memcpy((*(void**)buf), text, 8);
-            rcv_length = 8;
+            result2 = COND_ERROR;
         }
         else
         {
-            rcv_length = (int)len;
+            if (pop_on_Condition_Wait && last_created_mq != NULL && !last_created_mq->empty())
+            {
+                ((RefCountObject*)last_created_mq->take(0))->dec_ref();
+            }
+            result2 = COND_OK;
         }
-    MOCK_METHOD_END(int, rcv_length)
+    MOCK_METHOD_END(COND_RESULT, result2)
 };
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void*, gballoc_malloc, size_t, size);
@@ -594,12 +881,21 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , size_t, VECTOR_size, VECTOR_HANDLE,
 
 DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , THREADAPI_RESULT, ThreadAPI_Create, THREAD_HANDLE*, threadHandle, THREAD_START_FUNC, func, void*, arg);
 DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , THREADAPI_RESULT, ThreadAPI_Join, THREAD_HANDLE, threadHandle, int*, res);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, ThreadAPI_Sleep, unsigned int, milliseconds);
+
+DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , size_t, ProcessorCount_Get);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , int, ThreadScheduling_Apply, const THREAD_SCHEDULING_CONFIG*, config);
+DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , uint64_t, MonotonicClock_GetMicroseconds);
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , MESSAGE_HANDLE, Message_Create, const MESSAGE_CONFIG*, cfg);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , MESSAGE_HANDLE, Message_Clone, MESSAGE_HANDLE, message);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, Message_Destroy, MESSAGE_HANDLE, message);
 DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , MESSAGE_HANDLE, Message_CreateFromByteArray, const unsigned char*, source, int32_t, size);
 DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , int32_t, Message_ToByteArray, MESSAGE_HANDLE, messageHandle, unsigned char *, buffer, int32_t, size);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , const CONSTBUFFER*, Message_GetContent, MESSAGE_HANDLE, message);
+DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , bool, Message_IsExpired, MESSAGE_HANDLE, message, uint64_t, now);
+DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , void, Message_EnableThreadCache);
+DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , void, Message_DisableThreadCache);
 
 // singlylinkedlist.h
 DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , SINGLYLINKEDLIST_HANDLE, singlylinkedlist_create);
@@ -611,25 +907,32 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , LIST_ITEM_HANDLE, singlylinkedlist_
 DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , LIST_ITEM_HANDLE, singlylinkedlist_find, SINGLYLINKEDLIST_HANDLE, list, LIST_MATCH_FUNCTION, match_function, const void*, match_context);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , const void*, singlylinkedlist_item_get_value, LIST_ITEM_HANDLE, item_handle);
 
-//strings.h
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, STRING_delete, STRING_HANDLE, s)
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , STRING_HANDLE, STRING_construct, const char*, source)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, STRING_concat, STRING_HANDLE, s1, const char*, s2)
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , const char*, STRING_c_str, STRING_HANDLE, s)
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , size_t, STRING_length, STRING_HANDLE, s)
-
-// unique id
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , UNIQUEID_RESULT, UniqueId_Generate, char*, uid, size_t, bufferSize)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , void *, nn_allocmsg, size_t, size, int, type)
-// nn.h
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , int, nn_freemsg, void*, msg)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, nn_socket, int, domain, int, protocol)
-DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , int, nn_close, int, s)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, nn_bind, int, s, const char *, addr)
-DECLARE_GLOBAL_MOCK_METHOD_5(CBrokerMocks, , int, nn_setsockopt, int, s, int, level, int, option, const void *, optval, size_t, optvallen)
-DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , int, nn_connect, int, s, const char *, addr)
-DECLARE_GLOBAL_MOCK_METHOD_4(CBrokerMocks, , int, nn_send, int, s, const void*, buf, size_t, len, int, flags)
-DECLARE_GLOBAL_MOCK_METHOD_4(CBrokerMocks, , int, nn_recv, int, s, void*, buf, size_t, len, int, flags)
+// message_queue.h
+DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , MESSAGE_QUEUE_HANDLE, MESSAGE_QUEUE_create);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, MESSAGE_QUEUE_destroy, MESSAGE_QUEUE_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , int, MESSAGE_QUEUE_push_with_priority, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_HANDLE, element, size_t, priority);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , MESSAGE_HANDLE, MESSAGE_QUEUE_pop, MESSAGE_QUEUE_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , MESSAGE_HANDLE, MESSAGE_QUEUE_evict, MESSAGE_QUEUE_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , bool, MESSAGE_QUEUE_is_empty, MESSAGE_QUEUE_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , size_t, MESSAGE_QUEUE_size, MESSAGE_QUEUE_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , size_t, MESSAGE_QUEUE_peak_size, MESSAGE_QUEUE_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_5(CBrokerMocks, , MESSAGE_HANDLE, MESSAGE_QUEUE_replace_if, MESSAGE_QUEUE_HANDLE, handle, MESSAGE_QUEUE_PREDICATE, predicate, const void*, context, MESSAGE_HANDLE, element, size_t, priority);
+
+// message.h properties
+DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , const char*, Message_GetPropertyValue, MESSAGE_HANDLE, message, const char*, key);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , MESSAGE_KEY, Message_InternKey, const char*, key);
+DECLARE_GLOBAL_MOCK_METHOD_2(CBrokerMocks, , const char*, Message_GetPropertyValueByKey, MESSAGE_HANDLE, message, MESSAGE_KEY, key);
+
+// link_filter.h
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , LINK_FILTER_HANDLE, LinkFilter_Create, const char*, expression);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, LinkFilter_Destroy, LINK_FILTER_HANDLE, filter);
+DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , bool, LinkFilter_Matches, LINK_FILTER_HANDLE, filter, LINK_FILTER_LOOKUP, lookup, const void*, context);
+
+// condition.h
+DECLARE_GLOBAL_MOCK_METHOD_0(CBrokerMocks, , COND_HANDLE, Condition_Init);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , void, Condition_Deinit, COND_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBrokerMocks, , COND_RESULT, Condition_Post, COND_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_3(CBrokerMocks, , COND_RESULT, Condition_Wait, COND_HANDLE, handle, LOCK_HANDLE, lock, int, timeout_milliseconds);
 
 BEGIN_TEST_SUITE(broker_ut)
 
@@ -682,30 +985,41 @@ TEST_FUNCTION_INITIALIZE(TestMethodInitialize)
 
     currentUnlock_call = 0;
 
-    currentCond_Init_call = 0;
-    whenShallCond_Init_fail = 0;
+    currentCondition_Init_call = 0;
+    whenShallCondition_Init_fail = 0;
 
-    currentCond_Post_call = 0;
-    whenShallCond_Post_fail = 0;
+    currentCondition_Wait_call = 0;
+    whenShallCondition_Wait_fail = 0;
 
-    currentThreadAPI_Create_call = 0;
-    whenShallThreadAPI_Create_fail = 0;
+    currentMESSAGE_QUEUE_create_call = 0;
+    whenShallMESSAGE_QUEUE_create_fail = 0;
 
-    current_nn_socket_index = 0;
-    for (int l = 0; l < 10; l++)
-    {
-        nn_socket_memory[l] = NULL;
-    }
+    currentMessage_InternKey_call = 0;
+    whenShallMessage_InternKey_fail = 0;
+
+    currentMESSAGE_QUEUE_push_call = 0;
+    whenShallMESSAGE_QUEUE_push_fail = 0;
 
-    nn_current_msg_size = 0;
+    currentThreadAPI_Create_call = 0;
+    whenShallThreadAPI_Create_fail = 0;
 
     thread_func_to_call = NULL;
     thread_func_args = NULL;
+    run_worker_on_join = false;
 
+    fake_message_keys.clear();
+    fake_expired_message = NULL;
+    last_created_mq = NULL;
+    pop_on_Condition_Wait = false;
+    fake_clock = 0;
+    fake_clock_step = 0;
 
     call_status_for_FakeModule_Receive.messageHandle = NULL;
     call_status_for_FakeModule_Receive.module = NULL;
     call_status_for_FakeModule_Receive.was_called = false;
+
+    batches_for_FakeModule_ReceiveBatch.clear();
+    broker_for_FakeModule_ReceiveAndPublish = NULL;
 }
 
 TEST_FUNCTION_CLEANUP(TestMethodCleanup)
@@ -719,10 +1033,8 @@ TEST_FUNCTION_CLEANUP(TestMethodCleanup)
 //Tests_SRS_BROKER_13_001: [This API shall yield a BROKER_HANDLE representing the newly created message broker. This handle value shall not be equal to NULL when the API call is successful.]
 //Tests_SRS_BROKER_13_007: [Broker_Create shall initialize BROKER_HANDLE_DATA::modules with a valid VECTOR_HANDLE.]
 //Tests_SRS_BROKER_13_023: [Broker_Create shall initialize BROKER_HANDLE_DATA::modules_lock with a valid LOCK_HANDLE.]
-//Tests_SRS_BROKER_17_001: [ Broker_Create shall initialize a socket for publishing messages. ]
-//Tests_SRS_BROKER_17_002: [ Broker_Create shall create a unique id. ]
-//Tests_SRS_BROKER_17_003: [ Broker_Create shall initialize a url consisting of "inproc://" + unique id. ]
-//Tests_SRS_BROKER_17_004: [ Broker_Create shall bind the socket to the BROKER_HANDLE_DATA::url. ]
+//Tests_SRS_BROKER_30_027: [ Broker_Create shall set BROKER_HANDLE_DATA::topology_epoch and both BROKER_HANDLE_DATA::topology_readers to 0. ]
+//Tests_SRS_BROKER_30_016: [ Broker_Create shall initialize BROKER_HANDLE_DATA::topology with an empty topology. ]
 TEST_FUNCTION(Broker_Create_succeeds)
 {
     ///arrange
@@ -732,18 +1044,9 @@ TEST_FUNCTION(Broker_Create_succeeds)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct("inproc://"));
-    STRICT_EXPECTED_CALL(mocks, STRING_concat(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_bind(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the topology*/
         .IgnoreArgument(1);
+
     ///act
     auto r = Broker_Create();
 
@@ -825,13 +1128,12 @@ TEST_FUNCTION(Broker_Create_fails_when_Lock_Init_fails)
     ///cleanup
 }
 
-
 //Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_socket_fails)
+TEST_FUNCTION(Broker_Create_fails_when_topology_malloc_fails)
 {
     ///arrange
-    CBrokerMocks mocks;
 
+    CBrokerMocks mocks;
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
@@ -842,8 +1144,9 @@ TEST_FUNCTION(Broker_Create_fails_when_socket_fails)
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB))
-        .SetFailReturn(-1);
+    whenShallmalloc_fail = 2;
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the topology*/
+        .IgnoreArgument(1);
 
     ///act
     auto r = Broker_Create();
@@ -853,115 +1156,89 @@ TEST_FUNCTION(Broker_Create_fails_when_socket_fails)
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Broker_Destroy(r);
 }
 
-
-//Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_uuid_fails)
+//Tests_SRS_BROKER_30_050: [ Broker_Create shall create a broker that gives every module a thread of its own, as Broker_CreateWithScheduler does when scheduler is NULL. ]
+TEST_FUNCTION(Broker_CreateWithScheduler_without_scheduler_creates_no_workers)
 {
     ///arrange
     CBrokerMocks mocks;
 
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the topology*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1)
-        .SetFailReturn(UNIQUEID_ERROR);
 
     ///act
-    auto r = Broker_Create();
+    auto r = Broker_CreateWithScheduler(NULL);
 
     ///assert
-    ASSERT_IS_NULL(r);
+    ASSERT_IS_NOT_NULL(r);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
     Broker_Destroy(r);
 }
 
-
-//Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_url_create_fails)
+//Tests_SRS_BROKER_30_051: [ If scheduler is not NULL, Broker_CreateWithScheduler shall initialize BROKER_HANDLE_DATA::scheduler with a worker pool of scheduler->worker_count workers. ]
+//Tests_SRS_BROKER_30_053: [ Broker_CreateWithScheduler shall create a thread for each worker by calling ThreadAPI_Create using pool_worker as the thread callback. ]
+TEST_FUNCTION(Broker_CreateWithScheduler_succeeds)
 {
     ///arrange
     CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 2 };
 
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct("inproc://"))
-        .SetFailReturn((STRING_HANDLE)NULL);
-
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*structure, topology, pool and workers*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create()) /*modules and one ready list per worker*/
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, Lock_Init()) /*modules, idle and one ready lock per worker*/
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments()
+        .ExpectedTimesExactly(2);
 
     ///act
-    auto r = Broker_Create();
+    auto r = Broker_CreateWithScheduler(&scheduler);
 
     ///assert
-    ASSERT_IS_NULL(r);
+    ASSERT_IS_NOT_NULL(r);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
     Broker_Destroy(r);
 }
 
-//Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_url_concat_fails)
+//Tests_SRS_BROKER_30_052: [ If scheduler->worker_count is 0, the pool shall have one worker per processor core, as returned by ProcessorCount_Get. ]
+TEST_FUNCTION(Broker_CreateWithScheduler_uses_processor_count_when_worker_count_is_0)
 {
     ///arrange
     CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 0 };
 
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct("inproc://"));
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_concat(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn(1);
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create())
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, Lock_Init())
+        .ExpectedTimesExactly(5);
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, ProcessorCount_Get())
+        .SetReturn(3);
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments()
+        .ExpectedTimesExactly(3);
 
     ///act
-    auto r = Broker_Create();
+    auto r = Broker_CreateWithScheduler(&scheduler);
 
     ///assert
-    ASSERT_IS_NULL(r);
+    ASSERT_IS_NOT_NULL(r);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -969,47 +1246,53 @@ TEST_FUNCTION(Broker_Create_fails_when_url_concat_fails)
 }
 
 //Tests_SRS_BROKER_13_003: [This function shall return NULL if an underlying API call to the platform causes an error.]
-TEST_FUNCTION(Broker_Create_fails_when_bind_fails)
+//Tests_SRS_BROKER_30_066: [ Broker_Destroy shall set BROKER_SCHEDULER::quit_workers, signal BROKER_SCHEDULER::idle_cond and wait for every worker to exit by calling ThreadAPI_Join. ]
+TEST_FUNCTION(Broker_CreateWithScheduler_stops_started_workers_when_ThreadAPI_Create_fails)
 {
     ///arrange
     CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 2 };
 
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
-        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create());
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_create())
+        .ExpectedTimesExactly(3);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, Lock_Init())
+        .ExpectedTimesExactly(4);
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_PUB));
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
+    whenShallThreadAPI_Create_fail = 2;
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments()
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct("inproc://"));
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_concat(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_bind(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn(-1);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+
     ///act
-    auto r = Broker_Create();
+    auto r = Broker_CreateWithScheduler(&scheduler);
 
     ///assert
     ASSERT_IS_NULL(r);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Broker_Destroy(r);
 }
 
 //Tests_SRS_BROKER_99_013: [ If broker or module is NULL the function shall return BROKER_INVALIDARG. ]
@@ -1088,6 +1371,7 @@ TEST_FUNCTION(Broker_AddModule_fails_with_null_module_handle)
 
     ///cleanup
 }
+
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
 TEST_FUNCTION(Broker_AddModule_fails_when_alloc_module_info_fails)
 {
@@ -1096,8 +1380,6 @@ TEST_FUNCTION(Broker_AddModule_fails_when_alloc_module_info_fails)
     auto broker = Broker_Create();
     mocks.ResetAllCalls();
 
-
-
     // this is for the Broker_AddModule call
     whenShallmalloc_fail = currentmalloc_call + 1;
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
@@ -1145,7 +1427,7 @@ TEST_FUNCTION(Broker_AddModule_fails_when_module_struct_alloc_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_Lock_Init_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_MESSAGE_QUEUE_create_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1161,8 +1443,8 @@ TEST_FUNCTION(Broker_AddModule_fails_when_Lock_Init_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    whenShallLock_Init_fail = currentLock_Init_call + 1;
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    whenShallMESSAGE_QUEUE_create_fail = currentMESSAGE_QUEUE_create_call + 1;
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1176,7 +1458,7 @@ TEST_FUNCTION(Broker_AddModule_fails_when_Lock_Init_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_quit_uuid_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_Lock_Init_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1192,12 +1474,11 @@ TEST_FUNCTION(Broker_AddModule_fails_quit_uuid_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1)
-        .SetFailReturn(UNIQUEID_ERROR);
+    whenShallLock_Init_fail = currentLock_Init_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1211,7 +1492,7 @@ TEST_FUNCTION(Broker_AddModule_fails_quit_uuid_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_string_construct_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_Condition_Init_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1227,14 +1508,14 @@ TEST_FUNCTION(Broker_AddModule_fails_string_construct_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn((STRING_HANDLE)NULL);
+    whenShallCondition_Init_fail = currentCondition_Init_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Condition_Init());
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1248,7 +1529,7 @@ TEST_FUNCTION(Broker_AddModule_fails_string_construct_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_Lock_modules_lock_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_VECTOR_create_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1264,18 +1545,19 @@ TEST_FUNCTION(Broker_AddModule_fails_Lock_modules_lock_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
+        .ExpectedTimesExactly(2);
+    whenShallVECTOR_create_fail = currentVECTOR_create_call + 1;
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1289,7 +1571,7 @@ TEST_FUNCTION(Broker_AddModule_fails_Lock_modules_lock_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_singlylinkedlist_add_fails)
+TEST_FUNCTION(Broker_AddModule_fails_Lock_modules_lock_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1305,22 +1587,23 @@ TEST_FUNCTION(Broker_AddModule_fails_when_singlylinkedlist_add_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    whenShallsinglylinkedlist_add_fail = 1;
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
+        .IgnoreArgument(1)
+        .SetFailReturn(LOCK_ERROR);
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1333,9 +1616,8 @@ TEST_FUNCTION(Broker_AddModule_fails_when_singlylinkedlist_add_fails)
     Broker_Destroy(broker);
 }
 
-
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_nn_socket_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_singlylinkedlist_add_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1351,25 +1633,27 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_socket_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    whenShallsinglylinkedlist_add_fail = 1;
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB))
-        .SetFailReturn(-1);
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1383,7 +1667,7 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_socket_fails)
 }
 
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_nn_connect_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_ThreadAPI_Create_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1399,14 +1683,19 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_connect_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
@@ -1416,14 +1705,9 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_connect_fails)
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB));
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_connect(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments()
-        .SetFailReturn(-1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
+    whenShallThreadAPI_Create_fail = currentThreadAPI_Create_call + 1;
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
@@ -1436,8 +1720,17 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_connect_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_nn_setSocketOpts_fails)
+//Tests_SRS_BROKER_13_107: [The function shall assign the `module` handle to `BROKER_MODULEINFO::module`.]
+//Tests_SRS_BROKER_30_005: [ The function shall initialize BROKER_MODULEINFO::mq with a valid message queue. ]
+//Tests_SRS_BROKER_13_099: [The function shall initialize BROKER_MODULEINFO::mq_lock with a valid lock handle.]
+//Tests_SRS_BROKER_30_006: [ The function shall initialize BROKER_MODULEINFO::mq_cond with a valid condition handle. ]
+//Tests_SRS_BROKER_30_007: [ The function shall initialize BROKER_MODULEINFO::sources with an empty vector of BROKER_LINK_DATA. ]
+//Tests_SRS_BROKER_13_102 : [The function shall create a new thread for the module by calling ThreadAPI_Create using module_worker as the thread callback and using the newly allocated BROKER_MODULEINFO object as the thread context.]
+//Tests_SRS_BROKER_13_039 : [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]
+//Tests_SRS_BROKER_13_045 : [Broker_AddModule shall append the new instance of BROKER_MODULEINFO to BROKER_HANDLE_DATA::modules.]
+//Tests_SRS_BROKER_13_046 : [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]
+//Tests_SRS_BROKER_13_047 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_AddModule_succeeds)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1447,58 +1740,37 @@ TEST_FUNCTION(Broker_AddModule_fails_when_nn_setSocketOpts_fails)
     // this is for the Broker_AddModule call
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module struct*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB));
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_connect(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_length(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, 36))
-        .IgnoreArgument(1)
-        .IgnoreArgument(4)
-        .SetFailReturn(-1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
 
     ///act
     auto result = Broker_AddModule(broker, &fake_module);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
+//Tests_SRS_BROKER_30_035: [ The function shall initialize BROKER_MODULEINFO::space_cond with a valid condition handle. ]
 //Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_AddModule_fails_when_ThreadAPI_Create_fails)
+TEST_FUNCTION(Broker_AddModule_fails_when_space_cond_Condition_Init_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -1510,47 +1782,121 @@ TEST_FUNCTION(Broker_AddModule_fails_when_ThreadAPI_Create_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module struct*/
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock_Init());
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
+    whenShallCondition_Init_fail = currentCondition_Init_call + 2;
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+
+    ///act
+    auto result = Broker_AddModule(broker, &fake_module);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_031: [ Broker_AddModuleWithInbox shall meet every requirement of Broker_AddModule. ]
+//Tests_SRS_BROKER_99_013: [If `broker` or `module` is NULL the function shall return BROKER_INVALIDARG.]
+TEST_FUNCTION(Broker_AddModuleWithInbox_fails_with_null_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 16, BROKER_OVERFLOW_DROP_NEWEST, NULL };
+
+    ///act
+    auto result = Broker_AddModuleWithInbox((BROKER_HANDLE)0x1, NULL, &inbox);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_30_032: [ If inbox->overflow_policy is not a BROKER_OVERFLOW_POLICY value, or is BROKER_OVERFLOW_COALESCE_BY_KEY and inbox->coalesce_key is NULL, the function shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddModuleWithInbox_fails_with_unknown_overflow_policy)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 16, (BROKER_OVERFLOW_POLICY)42, NULL };
+
+    ///act
+    auto result = Broker_AddModuleWithInbox((BROKER_HANDLE)0x1, &fake_module, &inbox);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_30_032: [ If inbox->overflow_policy is not a BROKER_OVERFLOW_POLICY value, or is BROKER_OVERFLOW_COALESCE_BY_KEY and inbox->coalesce_key is NULL, the function shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddModuleWithInbox_fails_when_coalescing_without_key)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 16, BROKER_OVERFLOW_COALESCE_BY_KEY, NULL };
+
+    ///act
+    auto result = Broker_AddModuleWithInbox((BROKER_HANDLE)0x1, &fake_module, &inbox);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_13_047: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_AddModuleWithInbox_fails_when_the_coalesce_key_cannot_be_interned)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 16, BROKER_OVERFLOW_COALESCE_BY_KEY, "deviceId" };
+    auto broker = Broker_Create();
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module struct*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB));
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_connect(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_length(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, 36))
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(4);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    whenShallThreadAPI_Create_fail = 1;
-    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
+    whenShallMessage_InternKey_fail = currentMessage_InternKey_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Message_InternKey("deviceId"));
 
     ///act
-    auto result = Broker_AddModule(broker, &fake_module);
+    auto result = Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
 
     ///assert
     ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
@@ -1560,59 +1906,37 @@ TEST_FUNCTION(Broker_AddModule_fails_when_ThreadAPI_Create_fails)
     Broker_Destroy(broker);
 }
 
-
-
-//Tests_SRS_BROKER_13_107 : [The function shall assign the module handle to BROKER_MODULEINFO::module.]
-//Tests_SRS_BROKER_17_013: [ The function shall create a nanomsg socket for reception. ]
-//Tests_SRS_BROKER_17_014: [ The function shall bind the socket to the the BROKER_HANDLE_DATA::url. ]
-//Tests_SRS_BROKER_13_099: [ The function shall initialize BROKER_MODULEINFO::socket_lock with a valid lock handle. ]
-//Tests_SRS_BROKER_17_020: [ The function shall create a unique ID used as a quit signal. ]
-//Tests_SRS_BROKER_13_102 : [The function shall create a new thread for the module by calling ThreadAPI_Create using module_publish_worker as the thread callback and using the newly allocated BROKER_MODULEINFO object as the thread context.]
-//Tests_SRS_BROKER_13_039 : [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]
-//Tests_SRS_BROKER_13_045 : [Broker_AddModule shall append the new instance of BROKER_MODULEINFO to BROKER_HANDLE_DATA::modules.]
-//Tests_SRS_BROKER_13_046 : [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]
-//Tests_SRS_BROKER_13_047 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-//Tests_SRS_BROKER_17_028: [ The function shall subscribe BROKER_MODULEINFO::receive_socket to the quit signal GUID. ]
-TEST_FUNCTION(Broker_AddModule_succeeds)
+//Tests_SRS_BROKER_30_031: [ Broker_AddModuleWithInbox shall meet every requirement of Broker_AddModule. ]
+//Tests_SRS_BROKER_30_037: [ If the overflow policy is BROKER_OVERFLOW_COALESCE_BY_KEY, the function shall intern inbox->coalesce_key with Message_InternKey and keep the result in BROKER_MODULEINFO::coalesce_key. ]
+TEST_FUNCTION(Broker_AddModuleWithInbox_succeeds_with_coalesce_key)
 {
     ///arrange
     CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 16, BROKER_OVERFLOW_COALESCE_BY_KEY, "deviceId" };
     auto broker = Broker_Create();
     mocks.ResetAllCalls();
 
-    // this is for the Broker_AddModule call
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module struct*/
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
+    STRICT_EXPECTED_CALL(mocks, Message_InternKey("deviceId"));
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Lock_Init());
-    STRICT_EXPECTED_CALL(mocks, UniqueId_Generate(IGNORED_PTR_ARG, 37))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_construct(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_socket(AF_SP, NN_SUB));
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_connect(IGNORED_NUM_ARG, IGNORED_PTR_ARG))
-        .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_length(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, 36))
-        .IgnoreArgument(1)
-        .IgnoreArgument(4);
     STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
 
     ///act
-    auto result = Broker_AddModule(broker, &fake_module);
+    auto result = Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
 
     ///assert
     ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
@@ -1624,19 +1948,25 @@ TEST_FUNCTION(Broker_AddModule_succeeds)
 }
 
 //Tests_SRS_BROKER_13_026: [ This function shall assign user_data to a local variable called module_info of type BROKER_MODULEINFO*. ]
-//Tests_SRS_BROKER_13_089: [ This function shall acquire the lock on module_info->socket_lock. ]
-//Tests_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_message_guid is sent to the thread. ]
-//Tests_SRS_BROKER_13_091: [ The function shall unlock module_info->socket_lock. ]
-//Tests_SRS_BROKER_17_005: [ For every iteration of the loop, the function shall wait on the receive_socket for messages. ]
-//Tests_SRS_BROKER_17_017: [ The function shall deserialize the message received. ]
+//Tests_SRS_BROKER_30_001: [ This function shall acquire the lock on module_info->mq_lock. ]
+//Tests_SRS_BROKER_30_002: [ If module_info->quit_worker is false and module_info->mq is empty, this function shall wait on module_info->mq_cond. ]
+//Tests_SRS_BROKER_30_003: [ If waiting on module_info->mq_cond fails, then module_worker shall return. ]
+//Tests_SRS_BROKER_30_004: [ This function shall dequeue the oldest message from module_info->mq. ]
+//Tests_SRS_BROKER_13_091: [ The function shall unlock module_info->mq_lock before delivering the message. ]
 //Tests_SRS_BROKER_13_092: [ The function shall deliver the message to the module's callback function via module_info->module_apis. ]
 //Tests_SRS_BROKER_13_093: [ The function shall destroy the message that was dequeued by calling Message_Destroy. ]
-//Tests_SRS_BROKER_17_019: [ The function shall free the buffer received on the receive_socket. ]
-//Tests_SRS_BROKER_17_024: [ The function shall strip off the topic from the message. ]
-TEST_FUNCTION(module_publish_worker_calls_receive_once_then_exits_on_quit_msg)
+//Tests_SRS_BROKER_30_133: [ Before its loop, this function shall enable the message cache of its thread by calling Message_EnableThreadCache, and it shall call Message_DisableThreadCache before it returns. ]
+TEST_FUNCTION(module_worker_delivers_queued_message_then_exits_on_Condition_Wait_fail)
 {
     CBrokerMocks mocks;
     auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
 
     // setup fake module's validation data
     unsigned char fake;
@@ -1644,48 +1974,45 @@ TEST_FUNCTION(module_publish_worker_calls_receive_once_then_exits_on_quit_msg)
     auto message = Message_Create(&c);
     call_status_for_FakeModule_Receive.module = fake_module.module_handle;
     call_status_for_FakeModule_Receive.messageHandle = message;
-
-    (void)Broker_AddModule(broker, &fake_module);
+    (void)Broker_Publish(broker, fake_module_handle, message);
 
     mocks.ResetAllCalls();
 
     //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_CreateFromByteArray(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MonotonicClock_GetMicroseconds())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_IsExpired(message, IGNORED_NUM_ARG))
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
 
     //loop 2
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
+    whenShallCondition_Wait_fail = currentCondition_Wait_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetReturn(37);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    // buf from nn_recv will always be "nn_recv", so match this here to let it
-    // recognize quit message
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn("nn_recv");
-
+    STRICT_EXPECTED_CALL(mocks, Message_EnableThreadCache());
+    STRICT_EXPECTED_CALL(mocks, Message_DisableThreadCache());
 
+    ///act
     auto result = thread_func_to_call(thread_func_args);
 
+    ///assert
     ASSERT_ARE_EQUAL(int, result, 0);
+    ASSERT_IS_TRUE(call_status_for_FakeModule_Receive.was_called);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -1694,241 +2021,251 @@ TEST_FUNCTION(module_publish_worker_calls_receive_once_then_exits_on_quit_msg)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_02_004: [ If acquiring the lock fails, then module_publish_worker shall return. ]
-TEST_FUNCTION(module_publish_worker_exits_on_lock_fail)
+//Tests_SRS_BROKER_30_118: [ The function shall not deliver the messages that have expired, as told by Message_IsExpired, and shall count them in the module's expired counter the next time it holds module_info->mq_lock. ]
+//Tests_SRS_BROKER_13_093: [ The function shall destroy the message that was dequeued by calling Message_Destroy. ]
+TEST_FUNCTION(module_worker_drops_expired_message_then_exits_on_Condition_Wait_fail)
 {
     CBrokerMocks mocks;
     auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
 
-    // setup fake module's validation data
     unsigned char fake;
     MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
     auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
-
-    (void)Broker_AddModule(broker, &fake_module);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    fake_expired_message = message;
 
     mocks.ResetAllCalls();
 
     //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MonotonicClock_GetMicroseconds())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_IsExpired(message, IGNORED_NUM_ARG))
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
 
+    //loop 2
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    whenShallCondition_Wait_fail = currentCondition_Wait_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_EnableThreadCache());
+    STRICT_EXPECTED_CALL(mocks, Message_DisableThreadCache());
 
+    ///act
     auto result = thread_func_to_call(thread_func_args);
 
+    ///assert
     ASSERT_ARE_EQUAL(int, result, 0);
+    ASSERT_IS_FALSE(call_status_for_FakeModule_Receive.was_called);
     mocks.AssertActualAndExpectedCalls();
 
+    BROKER_MODULE_STATISTICS statistics;
+    (void)Broker_GetStatistics(broker, &fake_module, &statistics);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.messages_out);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.expired);
+
     ///cleanup
     Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_091: [ The function shall unlock module_info->socket_lock. ]
-//Tests_SRS_BROKER_17_016: [ If releasing the lock fails, then module_publish_worker shall return. ]
-TEST_FUNCTION(module_publish_worker_exits_on_Unlock_fail)
+//Tests_SRS_BROKER_30_067: [ If the module implements Module_ReceiveBatch, this function shall dequeue up to BROKER_RECEIVE_BATCH_SIZE messages instead. ]
+//Tests_SRS_BROKER_30_068: [ If the module implements Module_ReceiveBatch, the function shall deliver all the dequeued messages, in the order they were dequeued, in one call to Module_ReceiveBatch. ]
+TEST_FUNCTION(module_worker_delivers_queued_messages_in_one_batch)
 {
     CBrokerMocks mocks;
     auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_batch_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
 
-    // setup fake module's validation data
     unsigned char fake;
     MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
-
-    (void)Broker_AddModule(broker, &fake_module);
+    auto message1 = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    (void)Broker_Publish(broker, fake_module_handle, message1);
+    (void)Broker_Publish(broker, fake_module_handle, message2);
 
     mocks.ResetAllCalls();
 
     //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)) /*two messages, then none*/
         .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MonotonicClock_GetMicroseconds())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_IsExpired(message1, IGNORED_NUM_ARG))
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Message_IsExpired(message2, IGNORED_NUM_ARG))
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message1));
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message2));
+
+    //loop 2
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    whenShallCondition_Wait_fail = currentCondition_Wait_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_EnableThreadCache());
+    STRICT_EXPECTED_CALL(mocks, Message_DisableThreadCache());
 
-
+    ///act
     auto result = thread_func_to_call(thread_func_args);
 
+    ///assert
     ASSERT_ARE_EQUAL(int, result, 0);
+    ASSERT_IS_FALSE(call_status_for_FakeModule_Receive.was_called);
+    ASSERT_ARE_EQUAL(size_t, 1, batches_for_FakeModule_ReceiveBatch.size());
+    ASSERT_ARE_EQUAL(size_t, 2, batches_for_FakeModule_ReceiveBatch[0].size());
+    ASSERT_ARE_EQUAL(void_ptr, message1, batches_for_FakeModule_ReceiveBatch[0][0]);
+    ASSERT_ARE_EQUAL(void_ptr, message2, batches_for_FakeModule_ReceiveBatch[0][1]);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
-    Broker_RemoveModule(broker, &fake_module);
+    Message_Destroy(message1);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_batch_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_006: [ An error on receiving a message shall terminate the loop. ]
-TEST_FUNCTION(module_publish_worker_exits_on_nn_recv_error)
+//Tests_SRS_BROKER_02_004: [ If acquiring the lock fails, then module_worker shall return. ]
+TEST_FUNCTION(module_worker_exits_on_lock_fail)
 {
     CBrokerMocks mocks;
     auto broker = Broker_Create();
-
-    // setup fake module's validation data
-    unsigned char fake;
-    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
-
     (void)Broker_AddModule(broker, &fake_module);
 
     mocks.ResetAllCalls();
 
     //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn(-1);
-
+        .SetFailReturn(LOCK_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Message_EnableThreadCache());
+    STRICT_EXPECTED_CALL(mocks, Message_DisableThreadCache());
 
+    ///act
     auto result = thread_func_to_call(thread_func_args);
 
+    ///assert
     ASSERT_ARE_EQUAL(int, result, 0);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_message_guid is sent to the thread. ]
-TEST_FUNCTION(module_publish_worker_message_size_matches_but_not_quit_for_me)
+//Tests_SRS_BROKER_30_082: [ Before its loop, this function shall apply module_info->thread_scheduling to its thread by calling ThreadScheduling_Apply if it changes any setting; if that fails, the function shall continue. ]
+TEST_FUNCTION(module_worker_applies_thread_scheduling_and_continues_when_it_fails)
 {
     CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 0, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL, false, { 0x3, 5, 0 } };
     auto broker = Broker_Create();
-
-    // setup fake module's validation data
-    unsigned char fake;
-    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
-    auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
-
-    (void)Broker_AddModule(broker, &fake_module);
+    (void)Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
 
     mocks.ResetAllCalls();
 
-    //loop 1
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetReturn(37);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // buf from nn_recv will always be "nn_recv", so force a mismatch
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn("nn_send");
-    STRICT_EXPECTED_CALL(mocks, Message_CreateFromByteArray(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(mocks, ThreadScheduling_Apply(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-
-    //loop 2
+        .SetFailReturn(1);
+    //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetReturn(37);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // buf from nn_recv will always be "nn_recv", so match this here to let it
-    // recognize quit message
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .SetFailReturn("nn_recv");
-
+        .SetFailReturn(LOCK_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Message_EnableThreadCache());
+    STRICT_EXPECTED_CALL(mocks, Message_DisableThreadCache());
 
+    ///act
     auto result = thread_func_to_call(thread_func_args);
 
+    ///assert
     ASSERT_ARE_EQUAL(int, result, 0);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_018: [ If the deserialization is not successful, the message loop shall continue. ]
-TEST_FUNCTION(module_publish_worker_continue_on_CreateFromByteArray_fails)
+//Tests_SRS_BROKER_17_016: [ If releasing the lock fails, then module_worker shall return. ]
+TEST_FUNCTION(module_worker_exits_on_Unlock_fail_without_delivering)
 {
     CBrokerMocks mocks;
     auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
 
-    // setup fake module's validation data
     unsigned char fake;
     MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
     auto message = Message_Create(&c);
-    call_status_for_FakeModule_Receive.module = fake_module.module_handle;
-    call_status_for_FakeModule_Receive.messageHandle = message;
-
-    (void)Broker_AddModule(broker, &fake_module);
+    (void)Broker_Publish(broker, fake_module_handle, message);
 
     mocks.ResetAllCalls();
 
     //loop 1
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_CreateFromByteArray(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn((MESSAGE_HANDLE)NULL);
-
-    //loop 2
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_recv(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetReturn(37);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    // buf from nn_recv will always be "nn_recv", so match this here to let it
-    // recognize quit message
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn("nn_recv");
-
+        .SetFailReturn(LOCK_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
+    STRICT_EXPECTED_CALL(mocks, Message_EnableThreadCache());
+    STRICT_EXPECTED_CALL(mocks, Message_DisableThreadCache());
 
+    ///act
     auto result = thread_func_to_call(thread_func_args);
 
+    ///assert
     ASSERT_ARE_EQUAL(int, result, 0);
+    ASSERT_IS_FALSE(call_status_for_FakeModule_Receive.was_called);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -1937,6 +2274,39 @@ TEST_FUNCTION(module_publish_worker_continue_on_CreateFromByteArray_fails)
     Broker_Destroy(broker);
 }
 
+//Tests_SRS_BROKER_13_068: [ This function shall run a loop that keeps running until module_info->quit_worker is set to true. ]
+//Tests_SRS_BROKER_30_008: [ The function shall destroy all messages that are still queued for the module. ]
+TEST_FUNCTION(module_worker_exits_on_quit_and_queued_messages_are_destroyed)
+{
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+
+    run_worker_on_join = true;
+
+    ///act
+    auto result = Broker_RemoveModule(broker, &fake_module);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_IS_FALSE(call_status_for_FakeModule_Receive.was_called);
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_Destroy(broker);
+}
+
 //Tests_SRS_BROKER_13_048: [If broker or module is NULL the function shall return BROKER_INVALIDARG.]
 TEST_FUNCTION(Broker_RemoveModule_fails_with_null_broker)
 {
@@ -1969,15 +2339,15 @@ TEST_FUNCTION(Broker_RemoveModule_fails_with_null_module)
     ///cleanup
 }
 
-//Tests_SRS_BROKER_13_088 : [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]
-//Tests_SRS_BROKER_13_049 : [Broker_RemoveModule shall perform a linear search for module in BROKER_HANDLE_DATA::modules.]
-//Tests_SRS_BROKER_13_050 : [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
-//Tests_SRS_BROKER_13_052 : [The function shall remove the module from BROKER_HANDLE_DATA::modules.]
-//Tests_SRS_BROKER_13_054 : [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]
-//Tests_SRS_BROKER_17_021: [ This function shall send a quit signal to the worker thread by sending BROKER_MODULEINFO::quit_message_guid to the publish_socket. ]
-//Tests_SRS_BROKER_02_001: [ Broker_RemoveModule shall lock BROKER_MODULEINFO::socket_lock. ]
-//Tests_SRS_BROKER_17_015: [ This function shall close the BROKER_MODULEINFO::receive_socket. ]
-//Tests_SRS_BROKER_02_003: [ After closing the socket, Broker_RemoveModule shall unlock BROKER_MODULEINFO::info_lock. ]
+//Tests_SRS_BROKER_13_088: [This function shall acquire the lock on BROKER_HANDLE_DATA::modules_lock.]
+//Tests_SRS_BROKER_13_049: [Broker_RemoveModule shall perform a linear search for module in BROKER_HANDLE_DATA::modules.]
+//Tests_SRS_BROKER_13_052: [The function shall remove the module from BROKER_HANDLE_DATA::modules.]
+//Tests_SRS_BROKER_30_020: [ Broker_RemoveModule shall replace the topology with one that has no route to the module before stopping the module. ]
+//Tests_SRS_BROKER_30_028: [ A module shall stay allocated until it has been removed from the broker and no topology routes to it. ]
+//Tests_SRS_BROKER_13_054: [This function shall release the lock on BROKER_HANDLE_DATA::modules_lock.]
+//Tests_SRS_BROKER_02_001: [ Broker_RemoveModule shall lock BROKER_MODULEINFO::mq_lock. ]
+//Tests_SRS_BROKER_17_021: [ This function shall send a quit signal to the worker thread by setting BROKER_MODULEINFO::quit_worker to true and signaling BROKER_MODULEINFO::mq_cond. ]
+//Tests_SRS_BROKER_02_003: [ After signaling the worker, Broker_RemoveModule shall unlock BROKER_MODULEINFO::mq_lock. ]
 //Tests_SRS_BROKER_13_104 : [The function shall wait for the module's thread to exit by joining BROKER_MODULEINFO::thread via ThreadAPI_Join. ]
 //Tests_SRS_BROKER_13_057 : [The function shall free all members of the BROKER_MODULEINFO object.]
 //Tests_SRS_BROKER_13_053 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
@@ -2002,23 +2372,34 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG)) /*this is for the new topology*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_next_item(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*these are for the previous topology*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting mq_lock*/
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
@@ -2040,8 +2421,8 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_RemoveModule_fails_when_Lock_fails)
+//Tests_SRS_BROKER_30_009: [ If the lock cannot be acquired, Broker_RemoveModule shall still set BROKER_MODULEINFO::quit_worker and signal BROKER_MODULEINFO::mq_cond. ]
+TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_mq_Lock_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2050,25 +2431,67 @@ TEST_FUNCTION(Broker_RemoveModule_fails_when_Lock_fails)
     mocks.ResetAllCalls();
 
     // this is for the Broker_RemoveModule call
-    whenShallLock_fail = currentLock_call + 1;
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG)) /*this is for the new topology*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_next_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*these are for the previous topology*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    whenShallLock_fail = currentLock_call + 2;
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting mq_lock*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
 
     ///act
     result = Broker_RemoveModule(broker, &fake_module);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-
-//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
-TEST_FUNCTION(Broker_RemoveModule_fails_when_singlylinkedlist_find_fails)
+//Tests_SRS_BROKER_30_029: [ If the topology cannot be replaced, Broker_RemoveModule shall leave the module attached and return BROKER_ERROR. ]
+TEST_FUNCTION(Broker_RemoveModule_fails_when_topology_cannot_be_built)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2076,15 +2499,23 @@ TEST_FUNCTION(Broker_RemoveModule_fails_when_singlylinkedlist_find_fails)
     auto result = Broker_AddModule(broker, &fake_module);
     mocks.ResetAllCalls();
 
-    // this is for the Broker_RemoveModule call
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    whenShallsinglylinkedlist_find_fail = 1;
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_next_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    whenShallmalloc_fail = currentmalloc_call + 1;
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
 
     ///act
     result = Broker_RemoveModule(broker, &fake_module);
@@ -2094,12 +2525,13 @@ TEST_FUNCTION(Broker_RemoveModule_fails_when_singlylinkedlist_find_fails)
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    whenShallmalloc_fail = 0;
     Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
-//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
 
-TEST_FUNCTION(Broker_RemoveModule_succeeds_when_nn_send_fails)
+//Tests_SRS_BROKER_13_053: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_RemoveModule_fails_when_Lock_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2108,54 +2540,24 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds_when_nn_send_fails)
     mocks.ResetAllCalls();
 
     // this is for the Broker_RemoveModule call
+    whenShallLock_fail = currentLock_call + 1;
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn(-1);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
 
     ///act
     result = Broker_RemoveModule(broker, &fake_module);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.s]
-TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_Lock_fails)
+//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
+TEST_FUNCTION(Broker_RemoveModule_fails_when_singlylinkedlist_find_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2168,184 +2570,55 @@ TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_Lock_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-
+    whenShallsinglylinkedlist_find_fail = 1;
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting mq_lock*/
-        .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
 
     ///act
     result = Broker_RemoveModule(broker, &fake_module);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
-TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_nn_close_fails)
+//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddLink_null_broker_fails)
 {
     ///arrange
     CBrokerMocks mocks;
-    auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
-    mocks.ResetAllCalls();
-
-    // this is for the Broker_RemoveModule call
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting mq_lock*/
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1)
-        .SetReturn(-1);
-    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+    BROKER_HANDLE broker = NULL;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
 
     ///act
-    result = Broker_RemoveModule(broker, &fake_module);
+    auto result = Broker_AddLink(broker, &bld);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-    Broker_Destroy(broker);
-}
-
-//Tests_SRS_BROKER_13_050: [Broker_RemoveModule shall unlock BROKER_HANDLE_DATA::modules_lock and return BROKER_ERROR if the module is not found in BROKER_HANDLE_DATA::modules.]
-TEST_FUNCTION(Broker_RemoveModule_succeeds_even_when_unlock_fails)
-{
-    ///arrange
-    CBrokerMocks mocks;
-    auto broker = Broker_Create();
-    auto result = Broker_AddModule(broker, &fake_module);
-    mocks.ResetAllCalls();
-
-    // this is for the Broker_RemoveModule call
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
-
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, 37, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the lock protecting mq_lock*/
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Join(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-
-    ///act
-    result = Broker_RemoveModule(broker, &fake_module);
-
-    ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
-    mocks.AssertActualAndExpectedCalls();
 
-    ///cleanup
-    Broker_Destroy(broker);
 }
 
 //Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_AddLink_null_broker_fails)
+TEST_FUNCTION(Broker_AddLink_null_link_fails)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = NULL;
-    BROKER_LINK_DATA bld =
-    {
-        fake_module_handle,
-        fake_module_handle
-    };
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
 
     ///act
-    auto result = Broker_AddLink(broker, &bld);
+    auto result = Broker_AddLink(broker, NULL);
 
     ///assert
     ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
@@ -2356,14 +2629,19 @@ TEST_FUNCTION(Broker_AddLink_null_broker_fails)
 }
 
 //Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_AddLink_null_link_fails)
+TEST_FUNCTION(Broker_AddLink_null_source_fails)
 {
     ///arrange
     CBrokerMocks mocks;
     BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+    BROKER_LINK_DATA bld =
+    {
+        NULL,
+        fake_module_handle
+    };
 
     ///act
-    auto result = Broker_AddLink(broker, NULL);
+    auto result = Broker_AddLink(broker, &bld);
 
     ///assert
     ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
@@ -2374,15 +2652,15 @@ TEST_FUNCTION(Broker_AddLink_null_link_fails)
 }
 
 //Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_AddLink_null_source_fails)
+TEST_FUNCTION(Broker_AddLink_null_sink_fails)
 {
     ///arrange
     CBrokerMocks mocks;
     BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
     BROKER_LINK_DATA bld =
     {
-        NULL,
-        fake_module_handle
+        fake_module_handle,
+        NULL
     };
 
     ///act
@@ -2396,8 +2674,8 @@ TEST_FUNCTION(Broker_AddLink_null_source_fails)
 
 }
 
-//Tests_SRS_BROKER_17_029: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_AddLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_AddLink_null_sink_fails)
+//Tests_SRS_BROKER_30_077: [ If options->priority is not less than BROKER_LINK_PRIORITIES, Broker_AddLinkWithOptions shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_AddLinkWithOptions_out_of_range_priority_fails)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2405,11 +2683,16 @@ TEST_FUNCTION(Broker_AddLink_null_sink_fails)
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
-        NULL
+        fake_module_handle2
+    };
+    BROKER_LINK_OPTIONS options =
+    {
+        NULL,
+        BROKER_LINK_PRIORITIES
     };
 
     ///act
-    auto result = Broker_AddLink(broker, &bld);
+    auto result = Broker_AddLinkWithOptions(broker, &bld, &options);
 
     ///assert
     ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
@@ -2422,7 +2705,11 @@ TEST_FUNCTION(Broker_AddLink_null_sink_fails)
 //Tests_SRS_BROKER_17_030: [ Broker_AddLink shall lock the modules_lock. ]
 //Tests_SRS_BROKER_17_031: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_sink_handle. ]
 //Tests_SRS_BROKER_17_041: [ Broker_AddLink shall find the BROKER_HANDLE_DATA::module_info for link->module_source_handle. ]
-//Tests_SRS_BROKER_17_032: [ Broker_AddLink shall subscribe module_info->receive_socket to the link->module_source_handle module handle. ]
+//Tests_SRS_BROKER_17_032: [ Broker_AddLink shall add link->module_source_handle to module_info->sources. ]
+//Tests_SRS_BROKER_30_021: [ Broker_AddLink shall replace the topology with one built from the updated links. ]
+//Tests_SRS_BROKER_30_017: [ The routing table shall hold one entry per distinct source and sink pair, sorted by source. ]
+//Tests_SRS_BROKER_30_019: [ A new topology shall replace the current topology atomically, only once it is complete, without a lock that publishers take. ]
+//Tests_SRS_BROKER_30_026: [ The broker shall release its reference on the previous topology only once no publisher is between reading the topology pointer and taking a reference on it. ]
 //Tests_SRS_BROKER_17_033: [ Broker_AddLink shall unlock the modules_lock. ]
 TEST_FUNCTION(Broker_AddLink_succeeds)
 {
@@ -2452,9 +2739,35 @@ TEST_FUNCTION(Broker_AddLink_succeeds)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, sizeof(MODULE_HANDLE)))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the link statistics*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the sink's mq_lock*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_next_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*these are for the topology and its routes*/
         .IgnoreArgument(1)
-        .IgnoreArgument(4);
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*these are for the previous topology*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
 
     BROKER_LINK_DATA bld =
     {
@@ -2474,8 +2787,8 @@ TEST_FUNCTION(Broker_AddLink_succeeds)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
-TEST_FUNCTION(Broker_AddLink_fails_setsocketoption_fails)
+//Tests_SRS_BROKER_30_100: [ If options->filter is not NULL, Broker_AddLinkWithOptions shall compile it with LinkFilter_Create and keep a copy of it. ]
+TEST_FUNCTION(Broker_AddLinkWithOptions_with_filter_compiles_the_filter)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2483,6 +2796,10 @@ TEST_FUNCTION(Broker_AddLink_fails_setsocketoption_fails)
     auto result = Broker_AddModule(broker, &fake_module);
     mocks.ResetAllCalls();
 
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*these are for the filter and its copy of the expression*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, LinkFilter_Create("deviceFunction == 'register'"));
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
@@ -2503,22 +2820,51 @@ TEST_FUNCTION(Broker_AddLink_fails_setsocketoption_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_SUBSCRIBE, IGNORED_PTR_ARG, sizeof(MODULE_HANDLE)))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the link statistics*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the sink's mq_lock*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_next_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*these are for the topology and its routes*/
         .IgnoreArgument(1)
-        .IgnoreArgument(4)
-        .SetFailReturn(-1);
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*these are for the previous topology*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
 
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
         fake_module_handle
     };
+    BROKER_LINK_OPTIONS options =
+    {
+        "deviceFunction == 'register'"
+    };
 
     ///act
-    result = Broker_AddLink(broker, &bld);
+    result = Broker_AddLinkWithOptions(broker, &bld, &options);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -2526,8 +2872,8 @@ TEST_FUNCTION(Broker_AddLink_fails_setsocketoption_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
-TEST_FUNCTION(Broker_AddLink_fails_source_find_fails)
+//Tests_SRS_BROKER_30_101: [ If options->filter cannot be compiled or copied, Broker_AddLinkWithOptions shall return BROKER_ADD_LINK_ERROR. ]
+TEST_FUNCTION(Broker_AddLinkWithOptions_fails_when_the_filter_does_not_compile)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2535,32 +2881,26 @@ TEST_FUNCTION(Broker_AddLink_fails_source_find_fails)
     auto result = Broker_AddModule(broker, &fake_module);
     mocks.ResetAllCalls();
 
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, LinkFilter_Create("bad"));
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3)
-        .SetFailReturn((LIST_ITEM_HANDLE)NULL);
+        .ExpectedTimesExactly(2);
 
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
         fake_module_handle
     };
+    BROKER_LINK_OPTIONS options =
+    {
+        "bad"
+    };
 
     ///act
-    result = Broker_AddLink(broker, &bld);
+    result = Broker_AddLinkWithOptions(broker, &bld, &options);
 
     ///assert
     ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
@@ -2571,8 +2911,8 @@ TEST_FUNCTION(Broker_AddLink_fails_source_find_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
-TEST_FUNCTION(Broker_AddLink_fails_singlylinkedlist_find_fails)
+//Tests_SRS_BROKER_30_116: [ If options->coalesce_key has an empty name or more than BROKER_COALESCE_MAX_NAMES names, or cannot be copied or interned, Broker_AddLinkWithOptions shall return BROKER_ADD_LINK_ERROR. ]
+TEST_FUNCTION(Broker_AddLinkWithOptions_fails_when_the_coalesce_key_has_an_empty_name)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2580,24 +2920,28 @@ TEST_FUNCTION(Broker_AddLink_fails_singlylinkedlist_find_fails)
     auto result = Broker_AddModule(broker, &fake_module);
     mocks.ResetAllCalls();
 
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3)
-        .SetFailReturn((LIST_ITEM_HANDLE)NULL);
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_InternKey("macAddress"));
 
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
         fake_module_handle
     };
+    BROKER_LINK_OPTIONS options =
+    {
+        NULL,
+        0,
+        "macAddress, ,characteristicUUID"
+    };
 
     ///act
-    result = Broker_AddLink(broker, &bld);
+    result = Broker_AddLinkWithOptions(broker, &bld, &options);
 
     ///assert
     ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
@@ -2608,8 +2952,8 @@ TEST_FUNCTION(Broker_AddLink_fails_singlylinkedlist_find_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
-TEST_FUNCTION(Broker_AddLink_fails_lock_fails)
+//Tests_SRS_BROKER_30_116: [ If options->coalesce_key has an empty name or more than BROKER_COALESCE_MAX_NAMES names, or cannot be copied or interned, Broker_AddLinkWithOptions shall return BROKER_ADD_LINK_ERROR. ]
+TEST_FUNCTION(Broker_AddLinkWithOptions_fails_when_a_coalesce_key_name_cannot_be_interned)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2617,18 +2961,29 @@ TEST_FUNCTION(Broker_AddLink_fails_lock_fails)
     auto result = Broker_AddModule(broker, &fake_module);
     mocks.ResetAllCalls();
 
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
         .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_InternKey("macAddress"));
+    whenShallMessage_InternKey_fail = currentMessage_InternKey_call + 1;
 
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
         fake_module_handle
     };
+    BROKER_LINK_OPTIONS options =
+    {
+        NULL,
+        0,
+        "macAddress,characteristicUUID"
+    };
 
     ///act
-    result = Broker_AddLink(broker, &bld);
+    result = Broker_AddLinkWithOptions(broker, &bld, &options);
 
     ///assert
     ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
@@ -2639,12 +2994,40 @@ TEST_FUNCTION(Broker_AddLink_fails_lock_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_RemoveLink_null_broker_fails)
+//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
+TEST_FUNCTION(Broker_AddLink_fails_VECTOR_push_back_fails)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = NULL;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    whenShallVECTOR_push_back_fail = currentVECTOR_push_back_call + 1;
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
     BROKER_LINK_DATA bld =
     {
         fake_module_handle,
@@ -2652,29 +3035,240 @@ TEST_FUNCTION(Broker_RemoveLink_null_broker_fails)
     };
 
     ///act
-    auto result = Broker_RemoveLink(broker, &bld);
+    result = Broker_AddLink(broker, &bld);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
-
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
-TEST_FUNCTION(Broker_RemoveLink_null_link_fails)
+//Tests_SRS_BROKER_30_018: [ If the new topology cannot be built, the current topology shall be kept. ]
+//Tests_SRS_BROKER_30_022: [ If the topology cannot be replaced, Broker_AddLink shall remove link->module_source_handle from module_info->sources and return BROKER_ADD_LINK_ERROR. ]
+TEST_FUNCTION(Broker_AddLink_fails_when_topology_cannot_be_built)
 {
     ///arrange
     CBrokerMocks mocks;
-    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
-
-    ///act
-    auto result = Broker_RemoveLink(broker, NULL);
-
-    ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
-    mocks.AssertActualAndExpectedCalls();
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the link statistics*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the sink's mq_lock*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_next_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    whenShallmalloc_fail = currentmalloc_call + 2;
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
+TEST_FUNCTION(Broker_AddLink_fails_source_find_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3)
+        .SetFailReturn((LIST_ITEM_HANDLE)NULL);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
+TEST_FUNCTION(Broker_AddLink_fails_singlylinkedlist_find_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3)
+        .SetFailReturn((LIST_ITEM_HANDLE)NULL);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_034: [ Upon an error, Broker_AddLink shall return BROKER_ADD_LINK_ERROR ]
+TEST_FUNCTION(Broker_AddLink_fails_lock_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetFailReturn(LOCK_ERROR);
+
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    result = Broker_AddLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ADD_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_RemoveLink_null_broker_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_HANDLE broker = NULL;
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+
+    ///act
+    auto result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+
+}
+
+//Tests_SRS_BROKER_17_035: [ If broker, link, link->module_source_handle or link->module_sink_handle are NULL, Broker_RemoveLink shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_RemoveLink_null_link_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_HANDLE broker = (BROKER_HANDLE)0x01;
+
+    ///act
+    auto result = Broker_RemoveLink(broker, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
 
@@ -2729,7 +3323,8 @@ TEST_FUNCTION(Broker_RemoveLink_null_sink_fails)
 //Tests_SRS_BROKER_17_036: [ Broker_RemoveLink shall lock the modules_lock. ]
 //Tests_SRS_BROKER_17_037: [ Broker_RemoveLink shall find the module_info for link->module_sink_handle. ]
 //Tests_SRS_BROKER_17_042: [ Broker_RemoveLink shall find the module_info for link->module_source_handle. ]
-//Tests_SRS_BROKER_17_038: [ Broker_RemoveLink shall unsubscribe module_info->receive_socket from the link->module_source_handle module handle. ]
+//Tests_SRS_BROKER_30_023: [ Broker_RemoveLink shall replace the topology with one built without the link before removing it from module_info->sources. ]
+//Tests_SRS_BROKER_17_038: [ Broker_RemoveLink shall remove one occurrence of link->module_source_handle from module_info->sources. ]
 //Tests_SRS_BROKER_17_039: [ Broker_RemoveLink shall unlock the modules_lock. ]
 TEST_FUNCTION(Broker_RemoveLink_succeeds)
 {
@@ -2766,10 +3361,24 @@ TEST_FUNCTION(Broker_RemoveLink_succeeds)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_UNSUBSCRIBE, IGNORED_PTR_ARG, sizeof(MODULE_HANDLE)))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_next_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the topology*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)) /*these are for the previous topology*/
         .IgnoreArgument(1)
-        .IgnoreArgument(4);
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
 
     ///act
     result = Broker_RemoveLink(broker, &bld);
@@ -2784,7 +3393,7 @@ TEST_FUNCTION(Broker_RemoveLink_succeeds)
 }
 
 //Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
-TEST_FUNCTION(Broker_RemoveLink_fails_sockopt_fails)
+TEST_FUNCTION(Broker_RemoveLink_fails_when_link_not_found)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2795,7 +3404,6 @@ TEST_FUNCTION(Broker_RemoveLink_fails_sockopt_fails)
         fake_module_handle,
         fake_module_handle
     };
-    result = Broker_AddLink(broker, &bld);
 
     mocks.ResetAllCalls();
 
@@ -2819,10 +3427,8 @@ TEST_FUNCTION(Broker_RemoveLink_fails_sockopt_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_setsockopt(IGNORED_NUM_ARG, NN_SUB, NN_SUB_UNSUBSCRIBE, IGNORED_PTR_ARG, sizeof(MODULE_HANDLE)))
-        .IgnoreArgument(1)
-        .IgnoreArgument(4)
-        .SetFailReturn(-1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
 
     ///act
     result = Broker_RemoveLink(broker, &bld);
@@ -2836,7 +3442,8 @@ TEST_FUNCTION(Broker_RemoveLink_fails_sockopt_fails)
     Broker_Destroy(broker);
 }
 
-TEST_FUNCTION(Broker_RemoveLink_fails_source_find_fails)
+//Tests_SRS_BROKER_30_102: [ If options is not NULL, Broker_RemoveLinkWithOptions shall only remove a link whose filter is the same expression as options->filter, or that has no filter if options->filter is NULL. ]
+TEST_FUNCTION(Broker_RemoveLinkWithOptions_fails_when_the_filter_differs)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2847,7 +3454,15 @@ TEST_FUNCTION(Broker_RemoveLink_fails_source_find_fails)
         fake_module_handle,
         fake_module_handle
     };
-    result = Broker_AddLink(broker, &bld);
+    BROKER_LINK_OPTIONS filtered =
+    {
+        "deviceFunction == 'register'"
+    };
+    BROKER_LINK_OPTIONS unfiltered =
+    {
+        NULL
+    };
+    result = Broker_AddLinkWithOptions(broker, &bld, &filtered);
 
     mocks.ResetAllCalls();
 
@@ -2866,11 +3481,16 @@ TEST_FUNCTION(Broker_RemoveLink_fails_source_find_fails)
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .IgnoreArgument(2)
-        .IgnoreArgument(3)
-        .SetFailReturn(nullptr);
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
 
     ///act
-    result = Broker_RemoveLink(broker, &bld);
+    result = Broker_RemoveLinkWithOptions(broker, &bld, &unfiltered);
 
     ///assert
     ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
@@ -2881,9 +3501,9 @@ TEST_FUNCTION(Broker_RemoveLink_fails_source_find_fails)
     Broker_Destroy(broker);
 }
 
-
-//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
-TEST_FUNCTION(Broker_RemoveLink_fails_singlylinkedlist_find_fails)
+//Tests_SRS_BROKER_30_138: [ Broker_RemoveLink shall remove the link as Broker_RemoveLinkWithOptions does when options is NULL. ]
+//Tests_SRS_BROKER_17_038: [ Broker_RemoveLink shall remove one occurrence of link->module_source_handle from module_info->sources. ]
+TEST_FUNCTION(Broker_RemoveLink_removes_a_link_added_with_a_filter)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -2894,26 +3514,165 @@ TEST_FUNCTION(Broker_RemoveLink_fails_singlylinkedlist_find_fails)
         fake_module_handle,
         fake_module_handle
     };
-    result = Broker_AddLink(broker, &bld);
-
-    mocks.ResetAllCalls();
-
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .IgnoreArgument(3)
-        .SetFailReturn(nullptr);
+    BROKER_LINK_OPTIONS filtered =
+    {
+        "deviceFunction == 'register'"
+    };
+    result = Broker_AddLinkWithOptions(broker, &bld, &filtered);
 
     ///act
     result = Broker_RemoveLink(broker, &bld);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
-    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, Broker_RemoveLink(broker, &bld), BROKER_REMOVE_LINK_ERROR);
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_018: [ If the new topology cannot be built, the current topology shall be kept. ]
+//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
+TEST_FUNCTION(Broker_RemoveLink_fails_when_topology_cannot_be_built)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_next_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    whenShallmalloc_fail = currentmalloc_call + 1;
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+TEST_FUNCTION(Broker_RemoveLink_fails_source_find_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3)
+        .SetFailReturn(nullptr);
+
+    ///act
+    result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_17_040: [ Upon an error, Broker_RemoveLink shall return BROKER_REMOVE_LINK_ERROR. ]
+TEST_FUNCTION(Broker_RemoveLink_fails_singlylinkedlist_find_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
+
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3)
+        .SetFailReturn(nullptr);
+
+    ///act
+    result = Broker_RemoveLink(broker, &bld);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_REMOVE_LINK_ERROR);
+    mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
     Broker_RemoveModule(broker, &fake_module);
@@ -3046,16 +3805,13 @@ TEST_FUNCTION(Broker_Destroy_works)
     // these are for Broker_Destroy
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(3);
 
     ///act
     Broker_Destroy(broker);
@@ -3078,16 +3834,13 @@ TEST_FUNCTION(Broker_DecRef_works)
     // these are for Broker_Destroy
     STRICT_EXPECTED_CALL(mocks, Lock_Deinit(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_close(IGNORED_NUM_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, singlylinkedlist_destroy(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(3);
 
     ///act
     Broker_DecRef(broker);
@@ -3145,6 +3898,7 @@ TEST_FUNCTION(Broker_Publish_fails_with_null_source)
 
     ///cleanup
 }
+
 //Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
 TEST_FUNCTION(Broker_Publish_fails_when_Lock_fails)
 {
@@ -3159,13 +3913,22 @@ TEST_FUNCTION(Broker_Publish_fails_when_Lock_fails)
     auto message = Message_Create(&c);
 
     auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
 
     mocks.ResetAllCalls();
 
     // this is for Broker_Publish
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1)
-        .SetFailReturn(LOCK_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    whenShallLock_fail = currentLock_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the sink's mq_lock*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
 
     ///act
     result = Broker_Publish(broker, fake_module_handle, message);
@@ -3180,8 +3943,16 @@ TEST_FUNCTION(Broker_Publish_fails_when_Lock_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_Publish_fails_when_Message_ToByteArray_fails)
+//Tests_SRS_BROKER_30_024: [ Broker_Publish shall take a reference on BROKER_HANDLE_DATA::topology with topology_acquire, without taking a lock, and shall not take BROKER_HANDLE_DATA::modules_lock. ]
+//Tests_SRS_BROKER_30_014: [ Broker_Publish shall look up source in the routing table and enqueue the message for every sink routed from it. ]
+//Tests_SRS_BROKER_17_007: [ Broker_Publish shall clone the message handle for each sink; the message content is shared, not copied. ]
+//Tests_SRS_BROKER_30_010: [ Broker_Publish shall lock the sink's mq_lock. ]
+//Tests_SRS_BROKER_30_011: [ Broker_Publish shall push the cloned message on the sink's mq. ]
+//Tests_SRS_BROKER_30_012: [ Broker_Publish shall signal the sink's mq_cond. ]
+//Tests_SRS_BROKER_30_013: [ Broker_Publish shall unlock the sink's mq_lock. ]
+//Tests_SRS_BROKER_30_025: [ Broker_Publish shall release its reference on the topology. ]
+//Tests_SRS_BROKER_13_037 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
+TEST_FUNCTION(Broker_Publish_succeeds)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -3194,24 +3965,34 @@ TEST_FUNCTION(Broker_Publish_fails_when_Message_ToByteArray_fails)
     auto message = Message_Create(&c);
 
     auto result = Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
 
     mocks.ResetAllCalls();
 
     // this is for Broker_Publish
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, NULL, 0))
-        .SetFailReturn(-1);
 
     ///act
     result = Broker_Publish(broker, fake_module_handle, message);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
@@ -3220,8 +4001,8 @@ TEST_FUNCTION(Broker_Publish_fails_when_Message_ToByteArray_fails)
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_Publish_fails_when_allocmsg_fails)
+//Tests_SRS_BROKER_30_014: [ Broker_Publish shall look up source in the routing table and enqueue the message for every sink routed from it. ]
+TEST_FUNCTION(Broker_Publish_does_not_deliver_to_unlinked_module)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -3234,35 +4015,32 @@ TEST_FUNCTION(Broker_Publish_fails_when_allocmsg_fails)
     auto message = Message_Create(&c);
 
     auto result = Broker_AddModule(broker, &fake_module);
+    result = Broker_AddModule(broker, &fake_module2);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle2,
+        fake_module_handle
+    };
+    result = Broker_AddLink(broker, &bld);
 
     mocks.ResetAllCalls();
 
-    // this is for Broker_Publish
-    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(mocks, nn_allocmsg(1 + sizeof(MODULE_HANDLE), 0))
-        .SetFailReturn(nullptr);
-
     ///act
     result = Broker_Publish(broker, fake_module_handle, message);
 
     ///assert
-    ASSERT_ARE_EQUAL(int, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
     Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
+    Broker_RemoveModule(broker, &fake_module2);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_13_037: [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_Publish_fails_when_send_fails)
+//Tests_SRS_BROKER_17_007: [ Broker_Publish shall clone the message handle for each sink; the message content is shared, not copied. ]
+TEST_FUNCTION(Broker_Publish_delivers_same_handle_to_every_linked_sink)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -3275,53 +4053,59 @@ TEST_FUNCTION(Broker_Publish_fails_when_send_fails)
     auto message = Message_Create(&c);
 
     auto result = Broker_AddModule(broker, &fake_module);
+    result = Broker_AddModule(broker, &fake_module2);
+    BROKER_LINK_DATA bld1 =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_LINK_DATA bld2 =
+    {
+        fake_module_handle,
+        fake_module_handle2
+    };
+    result = Broker_AddLink(broker, &bld1);
+    result = Broker_AddLink(broker, &bld2);
 
     mocks.ResetAllCalls();
 
     // this is for Broker_Publish
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message))
+        .ExpectedTimesExactly(2);
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message, 0))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
     STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(mocks, nn_allocmsg(1 + sizeof(MODULE_HANDLE), 0))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, nn_freemsg(IGNORED_PTR_ARG))
-        .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
         .IgnoreArgument(1)
-        .IgnoreArgument(2)
-        .SetFailReturn((int)-1);
+        .ExpectedTimesExactly(2);
 
     ///act
     result = Broker_Publish(broker, fake_module_handle, message);
 
     ///assert
-    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
     mocks.AssertActualAndExpectedCalls();
 
     ///cleanup
     Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
+    Broker_RemoveModule(broker, &fake_module2);
     Broker_Destroy(broker);
 }
 
-//Tests_SRS_BROKER_17_022: [ Broker_Publish shall Lock the modules lock. ]
-//Tests_SRS_BROKER_17_007: [Broker_Publish shall clone the message.]
-//Tests_SRS_BROKER_17_008: [ Broker_Publish shall serialize the message. ]
-//Tests_SRS_BROKER_17_025: [ Broker_Publish shall allocate a nanomsg buffer the size of the serialized message + sizeof(MODULE_HANDLE). ]
-//Tests_SRS_BROKER_17_026: [ Broker_Publish shall copy source into the beginning of the nanomsg buffer. ]
-//Tests_SRS_BROKER_17_027: [ Broker_Publish shall serialize the message into the remainder of the nanomsg buffer. ]
-//Tests_SRS_BROKER_17_010: [ Broker_Publish shall send a message on the publish_socket. ]
-//Tests_SRS_BROKER_17_011: [ Broker_Publish shall free the serialized message data. ]
-//Tests_SRS_BROKER_17_012: [ Broker_Publish shall free the message. ]
-//Tests_SRS_BROKER_17_023: [ Broker_Publish shall Unlock the modules lock. ]
-//Tests_SRS_BROKER_13_037 : [This function shall return BROKER_ERROR if an underlying API call to the platform causes an error or BROKER_OK otherwise.]
-TEST_FUNCTION(Broker_Publish_succeeds)
+//Tests_SRS_BROKER_30_104: [ Broker_Publish shall only deliver the message to a sink on the highest priority link whose filter matches the message properties, as told by LinkFilter_Matches; a link without a filter matches every message. ]
+//Tests_SRS_BROKER_30_105: [ Broker_Publish shall evaluate the filters before it clones the message, reading the message properties with Message_GetPropertyValue rather than copying them. ]
+TEST_FUNCTION(Broker_Publish_skips_sink_whose_filter_does_not_match)
 {
     ///arrange
     CBrokerMocks mocks;
@@ -3334,25 +4118,47 @@ TEST_FUNCTION(Broker_Publish_succeeds)
     auto message = Message_Create(&c);
 
     auto result = Broker_AddModule(broker, &fake_module);
+    result = Broker_AddModule(broker, &fake_module2);
+    BROKER_LINK_DATA bld1 =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_LINK_DATA bld2 =
+    {
+        fake_module_handle,
+        fake_module_handle2
+    };
+    BROKER_LINK_OPTIONS options1 =
+    {
+        "no match"
+    };
+    BROKER_LINK_OPTIONS options2 =
+    {
+        "deviceFunction == 'register'"
+    };
+    result = Broker_AddLinkWithOptions(broker, &bld1, &options1);
+    result = Broker_AddLinkWithOptions(broker, &bld2, &options2);
 
     mocks.ResetAllCalls();
 
     // this is for Broker_Publish
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, LinkFilter_Matches(IGNORED_PTR_ARG, IGNORED_PTR_ARG, message))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
     STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
-    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, NULL, 0));
-    STRICT_EXPECTED_CALL(mocks, nn_allocmsg(1 + sizeof(MODULE_HANDLE), 0))
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Message_ToByteArray(message, IGNORED_PTR_ARG, 1))
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, nn_send(IGNORED_NUM_ARG, IGNORED_PTR_ARG, NN_MSG, 0))
-        .IgnoreArgument(1)
-        .IgnoreArgument(2);
-
 
     ///act
     result = Broker_Publish(broker, fake_module_handle, message);
@@ -3364,8 +4170,2000 @@ TEST_FUNCTION(Broker_Publish_succeeds)
     ///cleanup
     Message_Destroy(message);
     Broker_RemoveModule(broker, &fake_module);
+    Broker_RemoveModule(broker, &fake_module2);
     Broker_Destroy(broker);
 }
 
+//Tests_SRS_BROKER_30_015: [ If delivery to a sink fails, Broker_Publish shall still deliver to the remaining sinks and return BROKER_ERROR. ]
+TEST_FUNCTION(Broker_Publish_continues_when_MESSAGE_QUEUE_push_fails_and_returns_error)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    auto broker = Broker_Create();
+
+    // create a message to send
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+
+    auto result = Broker_AddModule(broker, &fake_module);
+    result = Broker_AddModule(broker, &fake_module2);
+    BROKER_LINK_DATA bld1 =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_LINK_DATA bld2 =
+    {
+        fake_module_handle,
+        fake_module_handle2
+    };
+    result = Broker_AddLink(broker, &bld1);
+    result = Broker_AddLink(broker, &bld2);
+
+    mocks.ResetAllCalls();
+
+    // this is for Broker_Publish
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message))
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    whenShallMESSAGE_QUEUE_push_fail = currentMESSAGE_QUEUE_push_call + 1;
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message, 0))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+
+    ///act
+    result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_RemoveModule(broker, &fake_module2);
+    Broker_Destroy(broker);
+}
+
+/*adds fake_module with a one message inbox, links it to itself and fills the inbox with first_message*/
+static BROKER_HANDLE create_broker_with_full_inbox(const BROKER_INBOX_CONFIG* inbox, MESSAGE_HANDLE first_message)
+{
+    auto broker = Broker_Create();
+    (void)Broker_AddModuleWithInbox(broker, &fake_module, inbox);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, first_message);
+    return broker;
+}
+
+//Tests_SRS_BROKER_30_040: [ If the sink's mq holds BROKER_MODULEINFO::inbox_capacity messages, Broker_Publish shall apply the sink's overflow policy. ]
+//Tests_SRS_BROKER_30_042: [ For BROKER_OVERFLOW_DROP_NEWEST, Broker_Publish shall destroy the clone. ]
+//Tests_SRS_BROKER_30_045: [ Broker_Publish shall increment the sink's drop_count for every message that is dropped or replaced because the sink's mq is full. ]
+TEST_FUNCTION(Broker_Publish_drops_newest_message_when_inbox_is_full)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 1, BROKER_OVERFLOW_DROP_NEWEST, NULL };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message1 = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    auto broker = create_broker_with_full_inbox(&inbox, message1);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message2));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message2));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message2));
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    size_t drop_count = 0;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, Broker_GetModuleDropCount(broker, &fake_module, &drop_count), BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 1, drop_count);
+    ASSERT_ARE_EQUAL(size_t, 1, last_created_mq->size());
+    ASSERT_ARE_EQUAL(void_ptr, message1, last_created_mq->front());
+
+    ///cleanup
+    Message_Destroy(message1);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_043: [ For BROKER_OVERFLOW_DROP_OLDEST, Broker_Publish shall dequeue and destroy the oldest message of the lowest priority lane of the sink's mq, then queue the clone. ]
+//Tests_SRS_BROKER_30_045: [ Broker_Publish shall increment the sink's drop_count for every message that is dropped or replaced because the sink's mq is full. ]
+TEST_FUNCTION(Broker_Publish_drops_oldest_message_when_inbox_is_full)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 1, BROKER_OVERFLOW_DROP_OLDEST, NULL };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message1 = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    auto broker = create_broker_with_full_inbox(&inbox, message1);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message2));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message2));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_evict(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message2, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message1));
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    size_t drop_count = 0;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, Broker_GetModuleDropCount(broker, &fake_module, &drop_count), BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 1, drop_count);
+    ASSERT_ARE_EQUAL(size_t, 1, last_created_mq->size());
+    ASSERT_ARE_EQUAL(void_ptr, message2, last_created_mq->front());
+
+    ///cleanup
+    Message_Destroy(message1);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_043: [ For BROKER_OVERFLOW_DROP_OLDEST, Broker_Publish shall dequeue and destroy the oldest message of the lowest priority lane of the sink's mq, then queue the clone. ]
+TEST_FUNCTION(Broker_Publish_drops_oldest_message_of_the_lowest_lane_when_inbox_is_full)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 2, BROKER_OVERFLOW_DROP_OLDEST, NULL };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto low = Message_Create(&c);
+    auto high1 = Message_Create(&c);
+    auto high2 = Message_Create(&c);
+    auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module2);
+    (void)Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
+    BROKER_LINK_DATA low_link =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_LINK_DATA high_link =
+    {
+        fake_module_handle2,
+        fake_module_handle
+    };
+    BROKER_LINK_OPTIONS high_options =
+    {
+        NULL,
+        2
+    };
+    (void)Broker_AddLink(broker, &low_link);
+    (void)Broker_AddLinkWithOptions(broker, &high_link, &high_options);
+    (void)Broker_Publish(broker, fake_module_handle, low);
+    (void)Broker_Publish(broker, fake_module_handle2, high1);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(high2));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(high2));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_evict(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, high2, 2))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(low));
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle2, high2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(size_t, 2, last_created_mq->size());
+    ASSERT_ARE_EQUAL(void_ptr, high1, last_created_mq->front());
+    ASSERT_ARE_EQUAL(void_ptr, high2, last_created_mq->back());
+
+    ///cleanup
+    Message_Destroy(low);
+    Message_Destroy(high1);
+    Message_Destroy(high2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_RemoveModule(broker, &fake_module2);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_044: [ For BROKER_OVERFLOW_COALESCE_BY_KEY, Broker_Publish shall put the clone in place of the most recently queued message of the clone's priority lane whose coalesce_key property has the same value, and destroy that message. If there is no such message, Broker_Publish shall destroy the clone. ]
+TEST_FUNCTION(Broker_Publish_coalesces_message_with_same_key_when_inbox_is_full)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 1, BROKER_OVERFLOW_COALESCE_BY_KEY, "deviceId" };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message1 = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    fake_message_keys[message1] = "sensor";
+    fake_message_keys[message2] = "sensor";
+    auto broker = create_broker_with_full_inbox(&inbox, message1);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message2));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message2));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(message2, fake_key("deviceId")));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_replace_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, message2, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(message1, fake_key("deviceId")));
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message1));
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    size_t drop_count = 0;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, Broker_GetModuleDropCount(broker, &fake_module, &drop_count), BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 1, drop_count);
+    ASSERT_ARE_EQUAL(size_t, 1, last_created_mq->size());
+    ASSERT_ARE_EQUAL(void_ptr, message2, last_created_mq->front());
+
+    ///cleanup
+    Message_Destroy(message1);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_044: [ For BROKER_OVERFLOW_COALESCE_BY_KEY, Broker_Publish shall put the clone in place of the most recently queued message of the clone's priority lane whose coalesce_key property has the same value, and destroy that message. If there is no such message, Broker_Publish shall destroy the clone. ]
+TEST_FUNCTION(Broker_Publish_drops_message_with_other_key_when_coalescing)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 1, BROKER_OVERFLOW_COALESCE_BY_KEY, "deviceId" };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message1 = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    fake_message_keys[message1] = "sensor";
+    fake_message_keys[message2] = "actuator";
+    auto broker = create_broker_with_full_inbox(&inbox, message1);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message2));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message2));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(message2, fake_key("deviceId")));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_replace_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, message2, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(message1, fake_key("deviceId")));
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message2));
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    size_t drop_count = 0;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, Broker_GetModuleDropCount(broker, &fake_module, &drop_count), BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 1, drop_count);
+    ASSERT_ARE_EQUAL(void_ptr, message1, last_created_mq->front());
+
+    ///cleanup
+    Message_Destroy(message1);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_115: [ If options->coalesce_key is not NULL, Broker_AddLinkWithOptions shall keep a copy of it and intern with Message_InternKey the property names it lists, separated by commas, ignoring the spaces around them. ]
+//Tests_SRS_BROKER_30_117: [ If the link has a coalesce key, Broker_Publish shall first put the clone in place of the most recently queued message of the link's priority lane of the sink's mq that has the same values for all the properties of the key, destroy that message and increment the coalesced counter of the link; the sink's mq does not grow and the overflow policy does not apply. ]
+TEST_FUNCTION(Broker_Publish_coalesces_message_with_same_key_on_a_coalescing_link)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 8, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message1 = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    fake_message_keys[message1] = "sensor";
+    fake_message_keys[message2] = "sensor";
+    auto broker = Broker_Create();
+    (void)Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_LINK_OPTIONS options =
+    {
+        NULL,
+        0,
+        " macAddress , characteristicUUID"
+    };
+    (void)Broker_AddLinkWithOptions(broker, &bld, &options);
+    (void)Broker_Publish(broker, fake_module_handle, message1);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message2));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message2));
+    STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(message2, fake_key("macAddress")));
+    STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(message2, fake_key("characteristicUUID")));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_replace_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, message2, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(message1, fake_key("macAddress")));
+    STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(message1, fake_key("characteristicUUID")));
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message1));
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    size_t drop_count = 0;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, Broker_GetModuleDropCount(broker, &fake_module, &drop_count), BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 0, drop_count);
+    BROKER_LINK_STATISTICS statistics;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, Broker_GetLinkStatistics(broker, &bld, &statistics), BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 2, (size_t)statistics.messages_in);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.coalesced);
+    ASSERT_ARE_EQUAL(size_t, 1, last_created_mq->size());
+    ASSERT_ARE_EQUAL(void_ptr, message2, last_created_mq->front());
+
+    ///cleanup
+    Message_Destroy(message1);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_041: [ For BROKER_OVERFLOW_BLOCK_PUBLISHER, Broker_Publish shall wait on the sink's space_cond until the sink's mq has room or the sink is being removed. ]
+TEST_FUNCTION(Broker_Publish_waits_for_room_when_inbox_is_full)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 1, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message1 = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    auto broker = create_broker_with_full_inbox(&inbox, message1);
+    pop_on_Condition_Wait = true;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message2));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message2));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message2, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    size_t drop_count = 42;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, Broker_GetModuleDropCount(broker, &fake_module, &drop_count), BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 0, drop_count);
+    ASSERT_ARE_EQUAL(void_ptr, message2, last_created_mq->front());
+
+    ///cleanup
+    Message_Destroy(message1);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_015: [ If delivery to a sink fails, Broker_Publish shall still deliver to the remaining sinks and return BROKER_ERROR. ]
+TEST_FUNCTION(Broker_Publish_fails_when_waiting_for_room_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 1, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message1 = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    auto broker = create_broker_with_full_inbox(&inbox, message1);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message2));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message2));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    whenShallCondition_Wait_fail = currentCondition_Wait_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message2));
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message1);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_046: [ If broker, module or drop_count is NULL, Broker_GetModuleDropCount shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_GetModuleDropCount_fails_with_null_params)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    size_t drop_count;
+
+    ///act
+    auto r1 = Broker_GetModuleDropCount(NULL, &fake_module, &drop_count);
+    auto r2 = Broker_GetModuleDropCount((BROKER_HANDLE)0x1, NULL, &drop_count);
+    auto r3 = Broker_GetModuleDropCount((BROKER_HANDLE)0x1, &fake_module, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r2, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r3, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_30_047: [ Broker_GetModuleDropCount shall lock BROKER_HANDLE_DATA::modules_lock and find module in BROKER_HANDLE_DATA::modules. ]
+//Tests_SRS_BROKER_30_049: [ Broker_GetModuleDropCount shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]
+TEST_FUNCTION(Broker_GetModuleDropCount_fails_when_module_is_not_attached)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    size_t drop_count;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    ///act
+    auto result = Broker_GetModuleDropCount(broker, &fake_module, &drop_count);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_049: [ Broker_GetModuleDropCount shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]
+TEST_FUNCTION(Broker_GetModuleDropCount_fails_when_Lock_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    size_t drop_count;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetFailReturn(LOCK_ERROR);
+
+    ///act
+    auto result = Broker_GetModuleDropCount(broker, &fake_module, &drop_count);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_047: [ Broker_GetModuleDropCount shall lock BROKER_HANDLE_DATA::modules_lock and find module in BROKER_HANDLE_DATA::modules. ]
+//Tests_SRS_BROKER_30_048: [ Broker_GetModuleDropCount shall read BROKER_MODULEINFO::drop_count under BROKER_MODULEINFO::mq_lock into drop_count and return BROKER_OK. ]
+TEST_FUNCTION(Broker_GetModuleDropCount_succeeds)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    size_t drop_count = 42;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_GetModuleDropCount(broker, &fake_module, &drop_count);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 0, drop_count);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_091: [ If broker, module or statistics is NULL, Broker_GetStatistics shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_GetStatistics_fails_with_null_params)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_MODULE_STATISTICS statistics;
+
+    ///act
+    auto r1 = Broker_GetStatistics(NULL, &fake_module, &statistics);
+    auto r2 = Broker_GetStatistics((BROKER_HANDLE)0x1, NULL, &statistics);
+    auto r3 = Broker_GetStatistics((BROKER_HANDLE)0x1, &fake_module, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r2, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r3, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_30_094: [ Broker_GetStatistics shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]
+TEST_FUNCTION(Broker_GetStatistics_fails_when_module_is_not_attached)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    BROKER_MODULE_STATISTICS statistics;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    ///act
+    auto result = Broker_GetStatistics(broker, &fake_module, &statistics);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_084: [ The function shall set every counter of BROKER_MODULEINFO::statistics to 0, and BROKER_MODULEINFO::link_statistics to an empty array. ]
+//Tests_SRS_BROKER_30_085: [ The function shall add the number of messages dequeued to the module's messages_out counter. ]
+//Tests_SRS_BROKER_30_086: [ The function shall measure the time the module takes to receive the messages with MonotonicClock_GetMicroseconds, and count it in the module's receive_latency histogram the next time it holds module_info->mq_lock. ]
+//Tests_SRS_BROKER_30_089: [ Broker_Publish shall add the messages and the size of their content to the messages_in and bytes_in counters of the sink and of the link, under the sink's mq_lock. ]
+//Tests_SRS_BROKER_30_092: [ Broker_GetStatistics shall lock BROKER_HANDLE_DATA::modules_lock and find module in BROKER_HANDLE_DATA::modules. ]
+//Tests_SRS_BROKER_30_093: [ Broker_GetStatistics shall copy BROKER_MODULEINFO::statistics under BROKER_MODULEINFO::mq_lock into statistics, fill in queue_depth and max_queue_depth from the module's mq and drops from BROKER_MODULEINFO::drop_count, and return BROKER_OK. ]
+TEST_FUNCTION(Broker_GetStatistics_counts_published_and_delivered_messages)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+
+    /*the module takes 3 microseconds to receive the message, the worker then fails to wait for the next one*/
+    fake_clock_step = 3;
+    whenShallCondition_Wait_fail = currentCondition_Wait_call + 1;
+    (void)thread_func_to_call(thread_func_args);
+    BROKER_MODULE_STATISTICS statistics;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &fake_module))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_peak_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_GetStatistics(broker, &fake_module, &statistics);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.messages_in);
+    ASSERT_ARE_EQUAL(size_t, 42, (size_t)statistics.bytes_in);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.messages_out);
+    ASSERT_ARE_EQUAL(size_t, 0, (size_t)statistics.drops);
+    ASSERT_ARE_EQUAL(size_t, 0, statistics.queue_depth);
+    ASSERT_ARE_EQUAL(size_t, 7, statistics.max_queue_depth);
+    ASSERT_ARE_EQUAL(size_t, 0, (size_t)statistics.receive_latency[1]);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.receive_latency[2]); /*[2, 4) microseconds*/
+    ASSERT_ARE_EQUAL(size_t, 0, (size_t)statistics.receive_latency[3]);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_139: [ If broker or module is NULL, Broker_ReportExpired shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_ReportExpired_fails_with_null_params)
+{
+    ///arrange
+    CBrokerMocks mocks;
+
+    ///act
+    auto r1 = Broker_ReportExpired(NULL, fake_module_handle, 1);
+    auto r2 = Broker_ReportExpired((BROKER_HANDLE)0x1, NULL, 1);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r2, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_30_142: [ Broker_ReportExpired shall return BROKER_ERROR if the module is not attached to the broker or if an underlying API call to the platform causes an error. ]
+TEST_FUNCTION(Broker_ReportExpired_fails_when_module_is_not_attached)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+
+    ///act
+    auto result = Broker_ReportExpired(broker, fake_module_handle, 1);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_140: [ Broker_ReportExpired shall lock BROKER_HANDLE_DATA::modules_lock and find module in BROKER_HANDLE_DATA::modules. ]
+//Tests_SRS_BROKER_30_141: [ Broker_ReportExpired shall add count to the expired counter of BROKER_MODULEINFO::statistics under BROKER_MODULEINFO::mq_lock and return BROKER_OK. ]
+TEST_FUNCTION(Broker_ReportExpired_adds_to_the_expired_statistics_of_the_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    (void)Broker_ReportExpired(broker, fake_module_handle, 2);
+    BROKER_MODULE_STATISTICS statistics;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_find(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_ReportExpired(broker, fake_module_handle, 1);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    (void)Broker_GetStatistics(broker, &fake_module, &statistics);
+    ASSERT_ARE_EQUAL(size_t, 3, (size_t)statistics.expired);
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+/*the calls the broker made to fake_health_changed*/
+static size_t health_changed_calls;
+static MODULE_HANDLE health_changed_module;
+static bool health_changed_slow;
+
+static void fake_health_changed(void* context, MODULE_HANDLE module, bool slow)
+{
+    ASSERT_ARE_EQUAL(void_ptr, &health_changed_calls, context);
+    health_changed_calls++;
+    health_changed_module = module;
+    health_changed_slow = slow;
+}
+
+/*adds fake_module, linked to itself, with an inbox of capacity messages that blocks the
+publisher and considers the module slow above 5 microseconds per message*/
+static BROKER_HANDLE create_broker_with_slow_threshold(size_t capacity)
+{
+    BROKER_INBOX_CONFIG inbox = { capacity, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL };
+    inbox.slow_receive_threshold = 5;
+    inbox.on_health_changed = fake_health_changed;
+    inbox.health_context = &health_changed_calls;
+    health_changed_calls = 0;
+    health_changed_module = NULL;
+    health_changed_slow = false;
+
+    auto broker = Broker_Create();
+    (void)Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    return broker;
+}
+
+/*publishes message count times and has the module's thread deliver them, each one taking
+latency microseconds, until the thread fails to wait for more*/
+static void deliver_messages_taking(BROKER_HANDLE broker, MESSAGE_HANDLE message, size_t count, uint64_t latency)
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        (void)Broker_Publish(broker, fake_module_handle, message);
+    }
+    call_status_for_FakeModule_Receive.module = fake_module_handle;
+    call_status_for_FakeModule_Receive.messageHandle = message;
+    fake_clock_step = latency;
+    whenShallCondition_Wait_fail = currentCondition_Wait_call + 1;
+    (void)thread_func_to_call(thread_func_args);
+}
+
+//Tests_SRS_BROKER_30_124: [ If module_info->slow_receive_threshold is not 0, the function shall compare the time the module took per message delivered with it. ]
+//Tests_SRS_BROKER_30_125: [ Once the module has taken longer than slow_receive_threshold per message for BROKER_SLOW_DELIVERIES deliveries in a row, the function shall mark it slow under module_info->mq_lock and signal module_info->space_cond if publishers are waiting for room in its mq. ]
+//Tests_SRS_BROKER_30_127: [ After marking the module slow or clearing the mark, the function shall call on_health_changed, if not NULL, with health_context, the module's handle and whether the module is slow, without holding any lock. ]
+//Tests_SRS_BROKER_30_128: [ The function shall copy inbox->slow_receive_threshold, inbox->on_health_changed and inbox->health_context into BROKER_MODULEINFO, or set them to 0 and NULL if inbox is NULL, and shall not mark the module slow. ]
+//Tests_SRS_BROKER_30_129: [ Broker_GetStatistics shall set slow to whether the module is marked slow. ]
+TEST_FUNCTION(module_worker_marks_module_slow_after_slow_deliveries_in_a_row)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = create_broker_with_slow_threshold(8);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    BROKER_MODULE_STATISTICS statistics;
+
+    /*one delivery short of the streak*/
+    deliver_messages_taking(broker, message, BROKER_SLOW_DELIVERIES - 1, 10);
+    ASSERT_ARE_EQUAL(size_t, 0, health_changed_calls);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, Broker_GetStatistics(broker, &fake_module, &statistics));
+    ASSERT_IS_FALSE(statistics.slow);
+
+    ///act
+    deliver_messages_taking(broker, message, 1, 10);
+
+    ///assert
+    ASSERT_ARE_EQUAL(size_t, 1, health_changed_calls);
+    ASSERT_ARE_EQUAL(void_ptr, fake_module_handle, health_changed_module);
+    ASSERT_IS_TRUE(health_changed_slow);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, Broker_GetStatistics(broker, &fake_module, &statistics));
+    ASSERT_IS_TRUE(statistics.slow);
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_124: [ If module_info->slow_receive_threshold is not 0, the function shall compare the time the module took per message delivered with it. ]
+TEST_FUNCTION(module_worker_does_not_mark_module_slow_when_a_fast_delivery_breaks_the_streak)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = create_broker_with_slow_threshold(8);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    BROKER_MODULE_STATISTICS statistics;
+    deliver_messages_taking(broker, message, BROKER_SLOW_DELIVERIES - 1, 10);
+    deliver_messages_taking(broker, message, 1, 2);
+
+    ///act
+    deliver_messages_taking(broker, message, BROKER_SLOW_DELIVERIES - 1, 10);
+
+    ///assert
+    ASSERT_ARE_EQUAL(size_t, 0, health_changed_calls);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, Broker_GetStatistics(broker, &fake_module, &statistics));
+    ASSERT_IS_FALSE(statistics.slow);
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_126: [ Once a slow module has taken no longer than slow_receive_threshold per message for BROKER_SLOW_DELIVERIES deliveries in a row, the function shall clear its slow mark under module_info->mq_lock. ]
+//Tests_SRS_BROKER_30_127: [ After marking the module slow or clearing the mark, the function shall call on_health_changed, if not NULL, with health_context, the module's handle and whether the module is slow, without holding any lock. ]
+TEST_FUNCTION(module_worker_clears_slow_mark_after_fast_deliveries_in_a_row)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = create_broker_with_slow_threshold(8);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    BROKER_MODULE_STATISTICS statistics;
+    deliver_messages_taking(broker, message, BROKER_SLOW_DELIVERIES, 10);
+
+    ///act
+    deliver_messages_taking(broker, message, BROKER_SLOW_DELIVERIES, 5);
+
+    ///assert
+    ASSERT_ARE_EQUAL(size_t, 2, health_changed_calls);
+    ASSERT_IS_FALSE(health_changed_slow);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, BROKER_OK, Broker_GetStatistics(broker, &fake_module, &statistics));
+    ASSERT_IS_FALSE(statistics.slow);
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_130: [ If the sink is marked slow, Broker_Publish shall apply BROKER_OVERFLOW_DROP_OLDEST instead of BROKER_OVERFLOW_BLOCK_PUBLISHER. ]
+TEST_FUNCTION(Broker_Publish_drops_oldest_message_when_a_slow_module_inbox_is_full)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = create_broker_with_slow_threshold(BROKER_SLOW_DELIVERIES);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    deliver_messages_taking(broker, message, BROKER_SLOW_DELIVERIES, 10);
+    size_t i;
+    for (i = 0; i < BROKER_SLOW_DELIVERIES; i++)
+    {
+        (void)Broker_Publish(broker, fake_module_handle, message);
+    }
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message2));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message2));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_evict(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message2, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    size_t drop_count = 0;
+    ASSERT_ARE_EQUAL(BROKER_RESULT, Broker_GetModuleDropCount(broker, &fake_module, &drop_count), BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 1, drop_count);
+    ASSERT_ARE_EQUAL(size_t, BROKER_SLOW_DELIVERIES, last_created_mq->size());
+    ASSERT_ARE_EQUAL(void_ptr, message2, last_created_mq->back());
+
+    ///cleanup
+    Message_Destroy(message);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_095: [ If broker, link, link->module_source_handle, link->module_sink_handle or statistics is NULL, Broker_GetLinkStatistics shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_GetLinkStatistics_fails_with_null_params)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_LINK_STATISTICS statistics;
+    BROKER_LINK_DATA bld = { fake_module_handle, fake_module_handle };
+    BROKER_LINK_DATA no_source = { NULL, fake_module_handle };
+    BROKER_LINK_DATA no_sink = { fake_module_handle, NULL };
+
+    ///act
+    auto r1 = Broker_GetLinkStatistics(NULL, &bld, &statistics);
+    auto r2 = Broker_GetLinkStatistics((BROKER_HANDLE)0x1, NULL, &statistics);
+    auto r3 = Broker_GetLinkStatistics((BROKER_HANDLE)0x1, &no_source, &statistics);
+    auto r4 = Broker_GetLinkStatistics((BROKER_HANDLE)0x1, &no_sink, &statistics);
+    auto r5 = Broker_GetLinkStatistics((BROKER_HANDLE)0x1, &bld, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r2, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r3, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r4, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r5, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_30_098: [ Broker_GetLinkStatistics shall return BROKER_ERROR if the sink is not attached to the broker, if it was never linked to the source, or if an underlying API call to the platform causes an error. ]
+TEST_FUNCTION(Broker_GetLinkStatistics_fails_when_sink_was_never_linked_to_source)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld = { fake_module_handle2, fake_module_handle };
+    BROKER_LINK_STATISTICS statistics;
+
+    ///act
+    auto result = Broker_GetLinkStatistics(broker, &bld, &statistics);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_087: [ Broker_AddLink shall add counters for link->module_source_handle to module_info->link_statistics, under module_info->mq_lock, unless the sink already keeps counters for that source. ]
+//Tests_SRS_BROKER_30_090: [ Broker_Publish shall increment the overflows counter of the link every time it finds the sink's mq full. ]
+//Tests_SRS_BROKER_30_096: [ Broker_GetLinkStatistics shall lock BROKER_HANDLE_DATA::modules_lock and find the BROKER_MODULEINFO for link->module_sink_handle. ]
+//Tests_SRS_BROKER_30_097: [ Broker_GetLinkStatistics shall copy the counters the sink keeps for link->module_source_handle into statistics, under the sink's mq_lock, and return BROKER_OK. ]
+TEST_FUNCTION(Broker_GetLinkStatistics_counts_overflows_of_the_link)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 1, BROKER_OVERFLOW_DROP_NEWEST, NULL };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message1 = Message_Create(&c);
+    auto message2 = Message_Create(&c);
+    auto broker = create_broker_with_full_inbox(&inbox, message1);
+    (void)Broker_Publish(broker, fake_module_handle, message2);
+    BROKER_LINK_DATA bld = { fake_module_handle, fake_module_handle };
+    BROKER_LINK_STATISTICS statistics;
+    BROKER_MODULE_STATISTICS module_statistics;
+
+    ///act
+    auto result = Broker_GetLinkStatistics(broker, &bld, &statistics);
+    auto module_result = Broker_GetStatistics(broker, &fake_module, &module_statistics);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 2, (size_t)statistics.messages_in);
+    ASSERT_ARE_EQUAL(size_t, 84, (size_t)statistics.bytes_in);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.overflows);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, module_result, BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)module_statistics.drops);
+    ASSERT_ARE_EQUAL(size_t, 1, module_statistics.queue_depth);
+
+    ///cleanup
+    Message_Destroy(message1);
+    Message_Destroy(message2);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_119: [ If broker, source or credit is NULL, Broker_GetPublishCredit shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_GetPublishCredit_fails_with_null_params)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    size_t credit;
+
+    ///act
+    auto r1 = Broker_GetPublishCredit(NULL, fake_module_handle, &credit);
+    auto r2 = Broker_GetPublishCredit((BROKER_HANDLE)0x1, NULL, &credit);
+    auto r3 = Broker_GetPublishCredit((BROKER_HANDLE)0x1, fake_module_handle, NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r1, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r2, BROKER_INVALIDARG);
+    ASSERT_ARE_EQUAL(BROKER_RESULT, r3, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_30_121: [ Broker_GetPublishCredit shall set credit to the smallest number of free places, inbox capacity minus queued messages, among the inboxes of the sinks routed from source, each read under the sink's mq_lock, or to SIZE_MAX if no sink is routed from source. ]
+TEST_FUNCTION(Broker_GetPublishCredit_returns_SIZE_MAX_without_links)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    (void)Broker_AddModule(broker, &fake_module);
+    size_t credit = 0;
+    mocks.ResetAllCalls();
+
+    ///act
+    auto result = Broker_GetPublishCredit(broker, fake_module_handle, &credit);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_IS_TRUE(credit == SIZE_MAX);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_120: [ Broker_GetPublishCredit shall take a reference on BROKER_HANDLE_DATA::topology with topology_acquire, without taking a lock, and shall not take BROKER_HANDLE_DATA::modules_lock. ]
+//Tests_SRS_BROKER_30_121: [ Broker_GetPublishCredit shall set credit to the smallest number of free places, inbox capacity minus queued messages, among the inboxes of the sinks routed from source, each read under the sink's mq_lock, or to SIZE_MAX if no sink is routed from source. ]
+//Tests_SRS_BROKER_30_123: [ Broker_GetPublishCredit shall release its reference on the topology. ]
+TEST_FUNCTION(Broker_GetPublishCredit_returns_the_free_places_of_the_sink_inbox)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 4, BROKER_OVERFLOW_DROP_NEWEST, NULL };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    auto broker = create_broker_with_full_inbox(&inbox, message);
+    size_t credit = 0;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the sink's mq_lock*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_GetPublishCredit(broker, fake_module_handle, &credit);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_ARE_EQUAL(size_t, 3, credit);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_122: [ Broker_GetPublishCredit shall return BROKER_ERROR if an underlying API call to the platform causes an error. ]
+TEST_FUNCTION(Broker_GetPublishCredit_fails_when_Lock_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 4, BROKER_OVERFLOW_DROP_NEWEST, NULL };
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    auto broker = create_broker_with_full_inbox(&inbox, message);
+    size_t credit = 42;
+    mocks.ResetAllCalls();
+
+    whenShallLock_fail = currentLock_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*this is the sink's mq_lock*/
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_GetPublishCredit(broker, fake_module_handle, &credit);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(size_t, 42, credit);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_054: [ If the broker has a worker pool and inbox is NULL or inbox->dedicated_thread is false, the module shall run on the worker pool. ]
+//Tests_SRS_BROKER_30_055: [ A module that runs on the worker pool shall not get a thread of its own. ]
+TEST_FUNCTION(Broker_AddModule_does_not_create_a_thread_for_a_pooled_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 1 };
+    auto broker = Broker_CreateWithScheduler(&scheduler);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module_info*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the module struct*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_AddModule(broker, &fake_module);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_054: [ If the broker has a worker pool and inbox is NULL or inbox->dedicated_thread is false, the module shall run on the worker pool. ]
+TEST_FUNCTION(Broker_AddModuleWithInbox_creates_a_thread_for_a_dedicated_thread_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 1 };
+    BROKER_INBOX_CONFIG inbox = { 0, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL, true };
+    auto broker = Broker_CreateWithScheduler(&scheduler);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+
+    ///act
+    auto result = Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_080: [ A module whose inbox->thread_scheduling changes any setting shall not run on the worker pool. ]
+TEST_FUNCTION(Broker_AddModuleWithInbox_creates_a_thread_for_a_module_with_thread_scheduling)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 1 };
+    BROKER_INBOX_CONFIG inbox = { 0, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL, false, { 0, 0, 10 } };
+    auto broker = Broker_CreateWithScheduler(&scheduler);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_create());
+    STRICT_EXPECTED_CALL(mocks, Lock_Init());
+    STRICT_EXPECTED_CALL(mocks, Condition_Init())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BROKER_SOURCE)));
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+
+    ///act
+    auto result = Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_083: [ Before it runs any module, a worker shall apply scheduler->thread_scheduling to its thread by calling ThreadScheduling_Apply if it changes any setting; if that fails, the worker shall continue. ]
+TEST_FUNCTION(pool_worker_applies_thread_scheduling_before_running_modules)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 1, { 0x1, 0, 0 } };
+    auto broker = Broker_CreateWithScheduler(&scheduler);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, ThreadScheduling_Apply(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetFailReturn(LOCK_ERROR);
+    STRICT_EXPECTED_CALL(mocks, Message_EnableThreadCache());
+    STRICT_EXPECTED_CALL(mocks, Message_DisableThreadCache());
+
+    ///act
+    auto result = thread_func_to_call(thread_func_args);
+
+    ///assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_057: [ If the sink runs on the worker pool and BROKER_MODULEINFO::scheduled is false, Broker_Publish shall set it and, once the sink's mq_lock is released, add the sink to a ready list. ]
+//Tests_SRS_BROKER_30_059: [ A module made ready by Broker_Publish shall be added to the ready lists of the workers in turn. ]
+TEST_FUNCTION(Broker_Publish_adds_pooled_sink_to_a_ready_list)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 1 };
+    auto broker = Broker_CreateWithScheduler(&scheduler);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*mq, idle and ready locks*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    /*the module is removed once a worker has delivered its message*/
+    call_status_for_FakeModule_Receive.module = fake_module_handle;
+    call_status_for_FakeModule_Receive.messageHandle = message;
+    whenShallCondition_Wait_fail = currentCondition_Wait_call + 1;
+    (void)thread_func_to_call(thread_func_args);
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_058: [ If the sink cannot be added to a ready list, Broker_Publish shall clear BROKER_MODULEINFO::scheduled and return BROKER_ERROR; the message stays queued. ]
+TEST_FUNCTION(Broker_Publish_fails_when_pooled_sink_cannot_be_made_ready)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 1 };
+    auto broker = Broker_CreateWithScheduler(&scheduler);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message, 0))
+        .IgnoreArgument(1);
+    whenShallsinglylinkedlist_add_fail = currentsinglylinkedlist_add_call + 1;
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    ASSERT_ARE_EQUAL(size_t, 1, last_created_mq->size());
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_079: [ Broker_Publish shall push the clone on the lane of the sink's mq given by the priority of the link. ]
+//Tests_SRS_BROKER_30_078: [ If a source and a sink are linked more than once, the entry shall have the highest priority of these links. ]
+TEST_FUNCTION(Broker_Publish_pushes_on_the_lane_of_the_highest_priority_link)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_LINK_OPTIONS low_options =
+    {
+        NULL,
+        1
+    };
+    BROKER_LINK_OPTIONS high_options =
+    {
+        NULL,
+        BROKER_LINK_PRIORITIES - 1
+    };
+    (void)Broker_AddLinkWithOptions(broker, &bld, &low_options);
+    (void)Broker_AddLinkWithOptions(broker, &bld, &high_options);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message, BROKER_LINK_PRIORITIES - 1))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_107: [ The function shall set BROKER_MODULEINFO::inline_delivery to inbox->inline_delivery, or to false if inbox is NULL. ]
+//Tests_SRS_BROKER_30_108: [ If the sink takes inline delivery, its mq is empty, BROKER_MODULEINFO::receiving is false and the sink is not being removed, Broker_Publish shall set BROKER_MODULEINFO::receiving, release the sink's mq_lock and deliver the message itself to the sink on the calling thread, without cloning or queuing it. ]
+//Tests_SRS_BROKER_30_110: [ Once the module returns, Broker_Publish shall clear BROKER_MODULEINFO::receiving and signal BROKER_MODULEINFO::mq_cond, or make the sink ready if it runs on the worker pool, if messages were queued for the sink meanwhile or the sink is being removed. ]
+//Tests_SRS_BROKER_30_114: [ Broker_Publish shall count a message delivered inline in the messages_in, bytes_in and messages_out counters of the sink, in the counters of the link and in the sink's receive_latency histogram. ]
+TEST_FUNCTION(Broker_Publish_delivers_inline_to_an_idle_inline_module)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    BROKER_INBOX_CONFIG inbox = { 0, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL, false, { 0, 0, 0 }, true };
+    (void)Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    call_status_for_FakeModule_Receive.module = fake_module_handle;
+    call_status_for_FakeModule_Receive.messageHandle = message;
+    fake_clock_step = 3;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*mq before and after the delivery*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MonotonicClock_GetMicroseconds())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_IsExpired(message, IGNORED_NUM_ARG))
+        .IgnoreArgument(2);
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_IS_TRUE(call_status_for_FakeModule_Receive.was_called);
+    mocks.AssertActualAndExpectedCalls();
+
+    BROKER_MODULE_STATISTICS statistics;
+    (void)Broker_GetStatistics(broker, &fake_module, &statistics);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.messages_in);
+    ASSERT_ARE_EQUAL(size_t, 42, (size_t)statistics.bytes_in);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.messages_out);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)statistics.receive_latency[2]); /*[2, 4) microseconds*/
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_108: [ If the sink takes inline delivery, its mq is empty, BROKER_MODULEINFO::receiving is false and the sink is not being removed, Broker_Publish shall set BROKER_MODULEINFO::receiving, release the sink's mq_lock and deliver the message itself to the sink on the calling thread, without cloning or queuing it. ]
+//Tests_SRS_BROKER_30_110: [ Once the module returns, Broker_Publish shall clear BROKER_MODULEINFO::receiving and signal BROKER_MODULEINFO::mq_cond, or make the sink ready if it runs on the worker pool, if messages were queued for the sink meanwhile or the sink is being removed. ]
+TEST_FUNCTION(Broker_Publish_queues_for_an_inline_module_that_is_receiving)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    BROKER_INBOX_CONFIG inbox = { 0, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL, false, { 0, 0, 0 }, true };
+    (void)Broker_AddModuleWithInbox(broker, &fake_republishing_module, &inbox);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    call_status_for_FakeModule_Receive.module = fake_module_handle;
+    call_status_for_FakeModule_Receive.messageHandle = message;
+    /*the module publishes the message back to itself from its receive function*/
+    broker_for_FakeModule_ReceiveAndPublish = broker;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*mq to deliver twice, to queue and after the delivery*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(message))
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MonotonicClock_GetMicroseconds())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_IsExpired(message, IGNORED_NUM_ARG))
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(message));
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, message, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG)) /*for the queued message, then once the delivery is over*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+
+    ///act
+    auto result = Broker_Publish(broker, fake_module_handle, message);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    ASSERT_IS_TRUE(call_status_for_FakeModule_Receive.was_called);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_republishing_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_069: [ If broker, source or messages is NULL, or any of the count messages is NULL, Broker_PublishBatch shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_PublishBatch_fails_with_null_broker)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    MESSAGE_HANDLE messages[] = { (MESSAGE_HANDLE)0x1 };
+
+    ///act
+    auto result = Broker_PublishBatch(NULL, fake_module_handle, messages, 1);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+}
+
+//Tests_SRS_BROKER_30_069: [ If broker, source or messages is NULL, or any of the count messages is NULL, Broker_PublishBatch shall return BROKER_INVALIDARG. ]
+TEST_FUNCTION(Broker_PublishBatch_fails_with_null_message_in_batch)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    MESSAGE_HANDLE messages[] = { (MESSAGE_HANDLE)0x1, NULL };
+    mocks.ResetAllCalls();
+
+    ///act
+    auto result = Broker_PublishBatch(broker, fake_module_handle, messages, 2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_INVALIDARG);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_070: [ If count is 0, Broker_PublishBatch shall return BROKER_OK. ]
+TEST_FUNCTION(Broker_PublishBatch_succeeds_with_empty_batch)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    MESSAGE_HANDLE messages[] = { (MESSAGE_HANDLE)0x1 };
+    mocks.ResetAllCalls();
+
+    ///act
+    auto result = Broker_PublishBatch(broker, fake_module_handle, messages, 0);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_072: [ If any platform call fails, Broker_PublishBatch shall return BROKER_ERROR. ]
+TEST_FUNCTION(Broker_PublishBatch_fails_when_malloc_fails)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    MESSAGE_HANDLE messages[] = { (MESSAGE_HANDLE)0x1 };
+    mocks.ResetAllCalls();
+
+    whenShallmalloc_fail = currentmalloc_call + 1;
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_PublishBatch(broker, fake_module_handle, messages, 1);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_ERROR);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_073: [ Broker_PublishBatch shall take a reference on BROKER_HANDLE_DATA::topology once for the whole batch, and release it when done. ]
+//Tests_SRS_BROKER_30_074: [ Broker_PublishBatch shall clone every message for every sink routed from source. ]
+//Tests_SRS_BROKER_30_075: [ Broker_PublishBatch shall queue the clones for a sink in the order of messages, as Broker_Publish does, while holding the sink's mq_lock once, and shall signal the sink once. ]
+TEST_FUNCTION(Broker_PublishBatch_queues_messages_in_order_and_signals_sink_once)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    MESSAGE_HANDLE messages[] = { Message_Create(&c), Message_Create(&c) };
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[0]));
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[1]));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[0]));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[1]));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, messages[0], 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, messages[1], 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_PublishBatch(broker, fake_module_handle, messages, 2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(size_t, 2, last_created_mq->size());
+    ASSERT_ARE_EQUAL(void_ptr, messages[0], last_created_mq->front());
+    ASSERT_ARE_EQUAL(void_ptr, messages[1], last_created_mq->back());
+
+    ///cleanup
+    Message_Destroy(messages[0]);
+    Message_Destroy(messages[1]);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_071: [ Before waiting for room, Broker_PublishBatch shall signal or make ready the sink for the messages of the batch it has already queued. ]
+TEST_FUNCTION(Broker_PublishBatch_signals_sink_before_waiting_for_room)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_INBOX_CONFIG inbox = { 1, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL };
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    MESSAGE_HANDLE messages[] = { Message_Create(&c), Message_Create(&c) };
+    (void)Broker_AddModuleWithInbox(broker, &fake_module, &inbox);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    pop_on_Condition_Wait = true;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[0]));
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[1]));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[0]));
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[1]));
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, messages[0], 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG)) /*for messages[0], before waiting*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, messages[1], 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG)) /*for messages[1]*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_PublishBatch(broker, fake_module_handle, messages, 2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(void_ptr, messages[1], last_created_mq->front());
+
+    ///cleanup
+    Message_Destroy(messages[0]);
+    Message_Destroy(messages[1]);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_106: [ Broker_PublishBatch shall only deliver each message to a sink on the links that Broker_Publish would deliver it on. ]
+//Tests_SRS_BROKER_30_135: [ Broker_PublishBatch shall evaluate the filters on the properties of the messages in place, as Broker_Publish does, without copying them for any message. ]
+TEST_FUNCTION(Broker_PublishBatch_evaluates_the_filters_without_copying_the_properties)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    auto broker = Broker_Create();
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    MESSAGE_HANDLE messages[] = { Message_Create(&c), Message_Create(&c) };
+    (void)Broker_AddModule(broker, &fake_module);
+    (void)Broker_AddModule(broker, &fake_module2);
+    BROKER_LINK_DATA bld1 =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    BROKER_LINK_DATA bld2 =
+    {
+        fake_module_handle,
+        fake_module_handle2
+    };
+    BROKER_LINK_OPTIONS options =
+    {
+        "deviceFunction == 'register'"
+    };
+    (void)Broker_AddLinkWithOptions(broker, &bld1, &options);
+    (void)Broker_AddLinkWithOptions(broker, &bld2, &options);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[0])) /*for the batch, then for each sink*/
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, Message_GetContent(messages[1]))
+        .ExpectedTimesExactly(3);
+    STRICT_EXPECTED_CALL(mocks, LinkFilter_Matches(IGNORED_PTR_ARG, IGNORED_PTR_ARG, messages[0]))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, LinkFilter_Matches(IGNORED_PTR_ARG, IGNORED_PTR_ARG, messages[1]))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[0]))
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Clone(messages[1]))
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*the mq_lock of each sink*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(4);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, messages[0], 0))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_push_with_priority(IGNORED_PTR_ARG, messages[1], 0))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    auto result = Broker_PublishBatch(broker, fake_module_handle, messages, 2);
+
+    ///assert
+    ASSERT_ARE_EQUAL(BROKER_RESULT, result, BROKER_OK);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(messages[0]);
+    Message_Destroy(messages[1]);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_RemoveModule(broker, &fake_module2);
+    Broker_Destroy(broker);
+}
+
+//Tests_SRS_BROKER_30_061: [ A worker shall wait on BROKER_SCHEDULER::idle_cond while no module is ready and BROKER_SCHEDULER::quit_workers is false. ]
+//Tests_SRS_BROKER_30_062: [ A worker shall dequeue the oldest message of the module's mq and deliver it to the module, as the module's own thread would, for up to BROKER_SCHEDULER_QUANTUM messages. ]
+//Tests_SRS_BROKER_30_063: [ A worker shall clear BROKER_MODULEINFO::scheduled once the module's mq is empty or the module is being removed, and shall signal BROKER_MODULEINFO::mq_cond if it is being removed. ]
+//Tests_SRS_BROKER_30_134: [ Before it runs any module, a worker shall enable the message cache of its thread by calling Message_EnableThreadCache, and it shall call Message_DisableThreadCache before it returns. ]
+TEST_FUNCTION(pool_worker_delivers_message_of_ready_module_then_exits_on_Condition_Wait_fail)
+{
+    ///arrange
+    CBrokerMocks mocks;
+    BROKER_SCHEDULER_CONFIG scheduler = { 1 };
+    auto broker = Broker_CreateWithScheduler(&scheduler);
+    unsigned char fake;
+    MESSAGE_CONFIG c = { 1, &fake, (MAP_HANDLE)&fake };
+    auto message = Message_Create(&c);
+    (void)Broker_AddModule(broker, &fake_module);
+    BROKER_LINK_DATA bld =
+    {
+        fake_module_handle,
+        fake_module_handle
+    };
+    (void)Broker_AddLink(broker, &bld);
+    (void)Broker_Publish(broker, fake_module_handle, message);
+    call_status_for_FakeModule_Receive.module = fake_module_handle;
+    call_status_for_FakeModule_Receive.messageHandle = message;
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG)) /*idle, ready, mq twice and idle again*/
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(5);
+    STRICT_EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(5);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, MESSAGE_QUEUE_pop(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, MonotonicClock_GetMicroseconds())
+        .ExpectedTimesExactly(2);
+    STRICT_EXPECTED_CALL(mocks, Message_IsExpired(message, IGNORED_NUM_ARG))
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Message_Destroy(message));
+    whenShallCondition_Wait_fail = currentCondition_Wait_call + 1;
+    STRICT_EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Message_EnableThreadCache());
+    STRICT_EXPECTED_CALL(mocks, Message_DisableThreadCache());
+
+    ///act
+    auto result = thread_func_to_call(thread_func_args);
+
+    ///assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_TRUE(call_status_for_FakeModule_Receive.was_called);
+    mocks.AssertActualAndExpectedCalls();
+
+    ///cleanup
+    Message_Destroy(message);
+    Broker_RemoveModule(broker, &fake_module);
+    Broker_Destroy(broker);
+}
 
 END_TEST_SUITE(broker_ut)
@@ -59,6 +59,9 @@ static void* last_context;
 static void* last_user_param;
 
 static VECTOR_HANDLE module_list;
+static VECTOR_HANDLE statistics_list;
+
+static THREAD_SCHEDULING_CONFIG last_thread_scheduling;
 
 struct ListNode
 {
@@ -200,6 +203,16 @@ public:
 
     MOCK_STATIC_METHOD_1(, void, Gateway_DestroyModuleList, VECTOR_HANDLE, vec);
     MOCK_VOID_METHOD_END();
+
+    MOCK_STATIC_METHOD_1(, VECTOR_HANDLE, Gateway_GetStatistics, GATEWAY_HANDLE, gw);
+    MOCK_METHOD_END(VECTOR_HANDLE, statistics_list);
+
+    MOCK_STATIC_METHOD_1(, void, Gateway_DestroyStatistics, VECTOR_HANDLE, vec);
+    MOCK_VOID_METHOD_END();
+
+    MOCK_STATIC_METHOD_1(, int, ThreadScheduling_Apply, const THREAD_SCHEDULING_CONFIG*, config);
+        last_thread_scheduling = *config;
+    MOCK_METHOD_END(int, 0);
         
 };
 
@@ -241,6 +254,9 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , void, Condition_Deinit, COND_H
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , VECTOR_HANDLE, Gateway_GetModuleList, GATEWAY_HANDLE, gw);
 DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , void, Gateway_DestroyModuleList, VECTOR_HANDLE, vec);
+DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , VECTOR_HANDLE, Gateway_GetStatistics, GATEWAY_HANDLE, gw);
+DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , void, Gateway_DestroyStatistics, VECTOR_HANDLE, vec);
+DECLARE_GLOBAL_MOCK_METHOD_1(CEventSystemMocks, , int, ThreadScheduling_Apply, const THREAD_SCHEDULING_CONFIG*, config);
 
 static void expectEventSystemDestroy(CEventSystemMocks &mocks, bool started_thread, int nodes_in_queue)
 {
@@ -322,7 +338,9 @@ TEST_FUNCTION_INITIALIZE(TestMethodInitialize)
     last_thread_arg = NULL;
     last_thread_func = NULL;
     module_list = NULL;
+    statistics_list = NULL;
     last_context = NULL;
+    last_thread_scheduling = THREAD_SCHEDULING_CONFIG();
 }
 
 TEST_FUNCTION_CLEANUP(TestMethodCleanup)
@@ -1122,6 +1140,60 @@ TEST_FUNCTION(EventSystem_ReportEvent_Modules_Pushback_Fails)
     EventSystem_Destroy(handle);
 }
 
+/* Tests_SRS_EVENTSYSTEM_30_001: [ This event shall provide `VECTOR_HANDLE` as returned from #Gateway_GetStatistics as the event context in callbacks ] */
+/* Tests_SRS_EVENTSYSTEM_30_002: [ This event shall clean up the `VECTOR_HANDLE` of #Gateway_GetStatistics after finishing all the callbacks ] */
+TEST_FUNCTION(EventSystem_ReportEvent_Statistics_Proper_List_Given)
+{
+    // Arrange
+    CEventSystemMocks mocks;
+    statistics_list = BASEIMPLEMENTATION::VECTOR_create(1);
+    EVENTSYSTEM_HANDLE handle = EventSystem_Init();
+    EventSystem_AddEventCallback(handle, GATEWAY_STATISTICS_REPORTED, catch_context_callback, NULL);
+    mocks.ResetAllCalls();
+
+    // Expect
+    EXPECTED_CALL(mocks, Lock(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(6);
+    EXPECTED_CALL(mocks, Unlock(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(6);
+    EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(2);
+    EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG));
+    EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+        .ExpectedTimesExactly(2);
+    EXPECTED_CALL(mocks, VECTOR_front(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, Gateway_GetStatistics(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(mocks, singlylinkedlist_add(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, Condition_Post(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    // simulated thread
+    EXPECTED_CALL(mocks, singlylinkedlist_get_head_item(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(3);
+    EXPECTED_CALL(mocks, singlylinkedlist_item_get_value(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, singlylinkedlist_remove(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+        .ExpectedTimesExactly(2);
+    EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .ExpectedTimesExactly(1);
+    EXPECTED_CALL(mocks, Gateway_DestroyStatistics(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, Condition_Wait(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+
+    // Act
+    EventSystem_ReportEvent(handle, NULL, GATEWAY_STATISTICS_REPORTED);
+    // simulate the thread running
+    last_thread_func(last_thread_arg);
+
+    // Assert
+    ASSERT_IS_TRUE(statistics_list == (VECTOR_HANDLE)last_context);
+    mocks.AssertActualAndExpectedCalls();
+
+    // Cleanup
+    BASEIMPLEMENTATION::VECTOR_destroy(statistics_list);
+    EventSystem_Destroy(handle);
+}
+
 TEST_FUNCTION(EventSystem_ReportEvent_user_param_is_passed)
 {
     // Arrange
@@ -1144,4 +1216,59 @@ TEST_FUNCTION(EventSystem_ReportEvent_user_param_is_passed)
     EventSystem_Destroy(handle);
 }
 
+/* Tests_SRS_EVENTSYSTEM_30_003: [ This function shall log a failure and do nothing else when either `event_system` or `thread_scheduling` parameters are NULL. ] */
+TEST_FUNCTION(EventSystem_SetThreadScheduling_NULLs)
+{
+    // Arrange
+    CEventSystemMocks mocks;
+    THREAD_SCHEDULING_CONFIG thread_scheduling = { 0x2, 5, 0 };
+    EVENTSYSTEM_HANDLE handle = EventSystem_Init();
+    mocks.ResetAllCalls();
+
+    // Act
+    EventSystem_SetThreadScheduling(NULL, &thread_scheduling);
+    EventSystem_SetThreadScheduling(handle, NULL);
+
+    // Assert
+    mocks.AssertActualAndExpectedCalls();
+
+    // Cleanup
+    EventSystem_Destroy(handle);
+}
+
+/* Tests_SRS_EVENTSYSTEM_30_004: [ This function shall keep a copy of `thread_scheduling` for the callback thread. ] */
+/* Tests_SRS_EVENTSYSTEM_30_005: [ Before it calls any callback, the callback thread shall apply the thread scheduling of the event system to itself by calling ThreadScheduling_Apply if it changes any setting; if that fails, the thread shall continue. ] */
+TEST_FUNCTION(EventSystem_callback_thread_applies_thread_scheduling_and_continues_when_it_fails)
+{
+    // Arrange
+    CEventSystemMocks mocks;
+    mocks.SetIgnoreUnexpectedCalls(true);
+    THREAD_SCHEDULING_CONFIG thread_scheduling = { 0x2, 5, 0 };
+    EVENTSYSTEM_HANDLE handle = EventSystem_Init();
+    EventSystem_SetThreadScheduling(handle, &thread_scheduling);
+    /* the event system shall keep its own copy */
+    thread_scheduling.cpu_affinity = 0;
+    EventSystem_AddEventCallback(handle, GATEWAY_STARTED, countingCallback, NULL);
+    mocks.ResetAllCalls();
+
+    // Expect
+    STRICT_EXPECTED_CALL(mocks, ThreadScheduling_Apply(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetFailReturn(1);
+
+    // Act
+    EventSystem_ReportEvent(handle, NULL, GATEWAY_STARTED);
+    // simulate the thread running
+    last_thread_func(last_thread_arg);
+
+    // Assert
+    mocks.AssertActualAndExpectedCalls();
+    ASSERT_ARE_EQUAL(int, 0x2, (int)last_thread_scheduling.cpu_affinity);
+    ASSERT_ARE_EQUAL(int, 5, last_thread_scheduling.nice);
+    ASSERT_ARE_EQUAL(int, 1, callback_per_event_count[GATEWAY_STARTED]);
+
+    // Cleanup
+    EventSystem_Destroy(handle);
+}
+
 END_TEST_SUITE(event_system_ut)
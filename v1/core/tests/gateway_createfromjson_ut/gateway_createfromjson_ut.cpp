@@ -126,6 +126,12 @@ public:
         }
         MOCK_METHOD_END(JSON_Object*, object1);
 
+    MOCK_STATIC_METHOD_2(, double, json_object_get_number, const JSON_Object*, object, const char*, name)
+    MOCK_METHOD_END(double, 0);
+
+    MOCK_STATIC_METHOD_2(, int, json_object_get_boolean, const JSON_Object*, object, const char*, name)
+    MOCK_METHOD_END(int, -1);
+
     MOCK_STATIC_METHOD_2(, JSON_Value*, json_object_get_value, const JSON_Object*, object, const char*, name)
         JSON_Value* value = NULL;
         if (object != NULL && name != NULL)
@@ -184,6 +190,11 @@ public:
         BROKER_HANDLE result1 = (BROKER_HANDLE)BASEIMPLEMENTATION::gballoc_malloc(1);
     MOCK_METHOD_END(BROKER_HANDLE, result1);
 
+    MOCK_STATIC_METHOD_1(, BROKER_HANDLE, Broker_CreateWithScheduler, const BROKER_SCHEDULER_CONFIG*, scheduler)
+        ++currentBroker_ref_count;
+        BROKER_HANDLE result1 = (BROKER_HANDLE)BASEIMPLEMENTATION::gballoc_malloc(1);
+    MOCK_METHOD_END(BROKER_HANDLE, result1);
+
     MOCK_STATIC_METHOD_1(, void, Broker_Destroy, BROKER_HANDLE, broker)
         if (currentBroker_ref_count > 0)
         {
@@ -213,13 +224,16 @@ public:
     MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_AddModule, BROKER_HANDLE, handle, const MODULE*, module)
     MOCK_METHOD_END(BROKER_RESULT, BROKER_OK);
 
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_AddModuleWithInbox, BROKER_HANDLE, handle, const MODULE*, module, const BROKER_INBOX_CONFIG*, inbox)
+    MOCK_METHOD_END(BROKER_RESULT, BROKER_OK);
+
     MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_RemoveModule, BROKER_HANDLE, handle, const MODULE*, module)
     MOCK_METHOD_END(BROKER_RESULT, BROKER_OK);
 
-    MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_AddLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link)
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_AddLinkWithOptions, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_OPTIONS*, options)
     MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
 
-    MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_RemoveLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link)
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_RemoveLinkWithOptions, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_OPTIONS*, options)
     MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
 
     /*ModuleLoader Mocks*/
@@ -293,6 +307,9 @@ public:
         BASEIMPLEMENTATION::gballoc_free(handle);
     MOCK_VOID_METHOD_END();
 
+    MOCK_STATIC_METHOD_2(, void, EventSystem_SetThreadScheduling, EVENTSYSTEM_HANDLE, event_system, const THREAD_SCHEDULING_CONFIG*, thread_scheduling)
+    MOCK_VOID_METHOD_END();
+
     /*Vector Mocks*/
     MOCK_STATIC_METHOD_1(, VECTOR_HANDLE, VECTOR_create, size_t, elementSize)
         VECTOR_HANDLE vector = BASEIMPLEMENTATION::VECTOR_create(elementSize);
@@ -374,6 +391,8 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , size_t, json_array_get_count, cons
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , JSON_Object*, json_array_get_object, const JSON_Array*, arr, size_t, index);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , const char*, json_object_get_string, const JSON_Object*, object, const char*, name);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , JSON_Object*, json_object_get_object, const JSON_Object*, object, const char*, name);
+DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , double, json_object_get_number, const JSON_Object*, object, const char*, name);
+DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , int, json_object_get_boolean, const JSON_Object*, object, const char*, name);
 
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , JSON_Value*, json_object_get_value, const JSON_Object*, object, const char*, name);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , char*, json_serialize_to_string, const JSON_Value*, value);
@@ -387,13 +406,15 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , GATEWAY_START_RESULT, Gateway_Star
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , int, Gateway_RemoveModuleByName, GATEWAY_HANDLE, gw, const char *, module_name);
 
 DECLARE_GLOBAL_MOCK_METHOD_0(CGatewayMocks, , BROKER_HANDLE, Broker_Create);
+DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , BROKER_HANDLE, Broker_CreateWithScheduler, const BROKER_SCHEDULER_CONFIG*, scheduler);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , void, Broker_Destroy, BROKER_HANDLE, broker);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , void, Broker_IncRef, BROKER_HANDLE, broker);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , void, Broker_DecRef, BROKER_HANDLE, broker);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , BROKER_RESULT, Broker_AddModule, BROKER_HANDLE, handle, const MODULE*, module);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayMocks, , BROKER_RESULT, Broker_AddModuleWithInbox, BROKER_HANDLE, handle, const MODULE*, module, const BROKER_INBOX_CONFIG*, inbox);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , BROKER_RESULT, Broker_RemoveModule, BROKER_HANDLE, handle, const MODULE*, module);
-DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , BROKER_RESULT, Broker_AddLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link);
-DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , BROKER_RESULT, Broker_RemoveLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayMocks, , BROKER_RESULT, Broker_AddLinkWithOptions, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_OPTIONS*, options);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayMocks, , BROKER_RESULT, Broker_RemoveLinkWithOptions, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_OPTIONS*, options);
 
 DECLARE_GLOBAL_MOCK_METHOD_0(CGatewayMocks, , const MODULE_LOADER_API*, DynamicLoader_GetApi);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , MODULE_LIBRARY_HANDLE, DynamicModuleLoader_Load, const struct MODULE_LOADER_TAG*, loader, const void*, entrypoint);
@@ -416,6 +437,7 @@ DECLARE_GLOBAL_MOCK_METHOD_0(CGatewayMocks, , EVENTSYSTEM_HANDLE, EventSystem_In
 DECLARE_GLOBAL_MOCK_METHOD_4(CGatewayMocks, , void, EventSystem_AddEventCallback, EVENTSYSTEM_HANDLE, event_system, GATEWAY_EVENT, event_type, GATEWAY_CALLBACK, callback, void*, user_param);
 DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayMocks, , void, EventSystem_ReportEvent, EVENTSYSTEM_HANDLE, event_system, GATEWAY_HANDLE, gw, GATEWAY_EVENT, event_type);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , void, EventSystem_Destroy, EVENTSYSTEM_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayMocks, , void, EventSystem_SetThreadScheduling, EVENTSYSTEM_HANDLE, event_system, const THREAD_SCHEDULING_CONFIG*, thread_scheduling);
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , VECTOR_HANDLE, VECTOR_create, size_t, elementSize);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayMocks, , void, VECTOR_destroy, VECTOR_HANDLE, handle);
@@ -634,7 +656,7 @@ static void setup_2module_gw(CGatewayMocks& mocks, char * path)
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)));
 }
 
 static void setup_parse_modules_entry(CGatewayMocks& mocks, size_t index, const char * modulename, const char* loadername = "loader1")
@@ -656,6 +678,12 @@ static void setup_parse_modules_entry(CGatewayMocks& mocks, size_t index, const
     STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "name"))
         .IgnoreArgument(1)
         .SetReturn(modulename);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "inbox"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
     STRICT_EXPECTED_CALL(mocks, json_object_get_value(IGNORED_PTR_ARG, "args"))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, json_serialize_to_string(IGNORED_PTR_ARG))
@@ -675,11 +703,33 @@ static void setup_links_entry(CGatewayMocks& mocks, size_t index, const char * s
     STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sink"))
         .IgnoreArgument(1)
         .SetReturn(sink);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "priority"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "filter"))
+        .IgnoreArgument(1)
+        .SetReturn((const char*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesce.key"))
+        .IgnoreArgument(1)
+        .SetReturn((const char*)NULL);
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
 }
 
+static void setup_no_scheduler(CGatewayMocks& mocks)
+{
+    STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "scheduler"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
+}
+
 static void add_a_module(CGatewayMocks& mocks, size_t index)
 {
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, index))
@@ -733,9 +783,10 @@ static void add_a_link(CGatewayMocks& mocks, size_t index)
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .IgnoreArgument(3);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2);
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
@@ -754,7 +805,7 @@ TEST_FUNCTION(Gateway_CreateFromJson_Returns_NULL_on_gateway_create_internal_fai
     setup_parse_modules_entry(mocks, 1, "module2");
 
     // links entry
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
@@ -762,6 +813,8 @@ TEST_FUNCTION(Gateway_CreateFromJson_Returns_NULL_on_gateway_create_internal_fai
     setup_links_entry(mocks, 0, "module1", "module2");
     setup_links_entry(mocks, 1, "module2", "module1");
 
+    setup_no_scheduler(mocks);
+
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(GATEWAY_HANDLE_DATA)))
         .SetFailReturn(nullptr);
 
@@ -826,7 +879,7 @@ TEST_FUNCTION(Gateway_CreateFromJson_Parses_Valid_JSON_Configuration_File)
     setup_parse_modules_entry(mocks, 1, "module2");
 
     // links entry
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
@@ -835,6 +888,8 @@ TEST_FUNCTION(Gateway_CreateFromJson_Parses_Valid_JSON_Configuration_File)
     setup_links_entry(mocks, 1, "module2", "module1");
 
 
+    setup_no_scheduler(mocks);
+
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(GATEWAY_HANDLE_DATA)));
     STRICT_EXPECTED_CALL(mocks, Broker_Create());
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_DATA*)));
@@ -898,6 +953,169 @@ TEST_FUNCTION(Gateway_CreateFromJson_Parses_Valid_JSON_Configuration_File)
     gateway_destroy_internal(gateway);
 }
 
+/*Tests_SRS_GATEWAY_JSON_30_004: [ If the JSON has a top level "scheduler" object, the function shall create the broker with a worker pool of "workers" threads; a missing or zero "workers" means one worker per processor. ]*/
+TEST_FUNCTION(Gateway_CreateFromJson_creates_broker_with_scheduler)
+{
+    //Arrange
+    CGatewayMocks mocks;
+
+    setup_2module_gw(mocks, (char *)VALID_JSON_PATH);
+
+    // modules array
+    setup_parse_modules_entry(mocks, 0, "module1");
+    setup_parse_modules_entry(mocks, 1, "module2");
+
+    // links entry
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetReturn(2);
+
+    setup_links_entry(mocks, 0, "module1", "module2");
+    setup_links_entry(mocks, 1, "module2", "module1");
+
+
+    STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "scheduler"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "workers"))
+        .IgnoreArgument(1)
+        .SetReturn(4);
+    STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
+
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(GATEWAY_HANDLE_DATA)));
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithScheduler(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_DATA*)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(LINK_DATA)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    //Adding module 1 (Success)
+    add_a_module(mocks, 0);
+    //Adding module 2 (Success)
+    add_a_module(mocks, 1);
+
+    //process the links
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    add_a_link(mocks, 0);
+    add_a_link(mocks, 1);
+
+
+    //Gateway start
+       STRICT_EXPECTED_CALL(mocks, EventSystem_Init());
+       STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_CREATED))
+           .IgnoreArgument(1)
+           .IgnoreArgument(2);
+       STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_MODULE_LIST_CHANGED))
+           .IgnoreArgument(1)
+           .IgnoreArgument(2);
+       STRICT_EXPECTED_CALL(mocks, Gateway_Start(IGNORED_PTR_ARG))
+           .IgnoreArgument(1);
+       STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+           .IgnoreArgument(1);
+       STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
+           .IgnoreArgument(1);
+	   STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeEntrypoint(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		   .IgnoreArgument(1)
+           .IgnoreArgument(2);
+       STRICT_EXPECTED_CALL(mocks, json_free_serialized_string((char*)"[serialized string]"));
+       STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
+           .IgnoreArgument(1);
+	   STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeEntrypoint(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		   .IgnoreArgument(1)
+           .IgnoreArgument(2);
+       STRICT_EXPECTED_CALL(mocks, json_free_serialized_string((char*)"[serialized string]"));
+       STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+           .IgnoreArgument(1);
+       STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+           .IgnoreArgument(1);
+       STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+           .IgnoreArgument(1);
+       STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+          .IgnoreArgument(1);
+
+    //Act
+    GATEWAY_HANDLE gateway = Gateway_CreateFromJson(VALID_JSON_PATH);
+
+    //Assert
+    ASSERT_IS_NOT_NULL(gateway);
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    gateway_destroy_internal(gateway);
+}
+
+/*Tests_SRS_GATEWAY_JSON_30_005: [ If "workers" is negative, the function shall fail and return NULL. ]*/
+TEST_FUNCTION(Gateway_CreateFromJson_Fails_For_Negative_Scheduler_Workers)
+{
+    //Arrange
+    CGatewayMocks mocks;
+
+    setup_2module_gw(mocks, (char *)VALID_JSON_PATH);
+
+    // modules array
+    setup_parse_modules_entry(mocks, 0, "module1");
+    setup_parse_modules_entry(mocks, 1, "module2");
+
+    // links entry
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetReturn(2);
+
+    setup_links_entry(mocks, 0, "module1", "module2");
+    setup_links_entry(mocks, 1, "module2", "module1");
+
+    STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "scheduler"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "workers"))
+        .IgnoreArgument(1)
+        .SetReturn(-1);
+
+    STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_free_serialized_string((char *)"[serialized string]"));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_free_serialized_string((char *)"[serialized string]"));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeEntrypoint(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeEntrypoint(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
+
+
+    //Act
+    GATEWAY_HANDLE gateway = Gateway_CreateFromJson(VALID_JSON_PATH);
+
+    //Assert
+    ASSERT_IS_NULL(gateway);
+    mocks.AssertActualAndExpectedCalls();
+
+}
+
 //Tests_SRS_GATEWAY_JSON_17_002: [ This function shall return NULL if starting the gateway fails. ]
 TEST_FUNCTION(Gateway_Create_Start_fails_returns_null)
 {
@@ -911,7 +1129,7 @@ TEST_FUNCTION(Gateway_Create_Start_fails_returns_null)
     setup_parse_modules_entry(mocks, 1, "module2");
 
     // links entry
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
@@ -920,6 +1138,8 @@ TEST_FUNCTION(Gateway_Create_Start_fails_returns_null)
     setup_links_entry(mocks, 1, "module2", "module1");
 
 
+    setup_no_scheduler(mocks);
+
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(GATEWAY_HANDLE_DATA)));
     STRICT_EXPECTED_CALL(mocks, Broker_Create());
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_DATA*)));
@@ -996,12 +1216,14 @@ TEST_FUNCTION(Gateway_Create_Start_fails_returns_null)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG,IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG,IGNORED_PTR_ARG))
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(1)
-        .IgnoreArgument(2);
+        .IgnoreArgument(2)
+        .IgnoreArgument(3);
     STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG,IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
@@ -1104,6 +1326,12 @@ TEST_FUNCTION(Gateway_CreateFromJson_Traverses_JSON_Push_Back_Fail)
     STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "name"))
         .IgnoreArgument(1)
         .SetReturn("Module2");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "inbox"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
     STRICT_EXPECTED_CALL(mocks, json_object_get_value(IGNORED_PTR_ARG, "args"))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, json_serialize_to_string(IGNORED_PTR_ARG))
@@ -1166,7 +1394,7 @@ TEST_FUNCTION(Gateway_CreateFromJson_Traverses_JSON_Value_NULL_Modules_Array)
     STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "links"))
         .IgnoreArgument(1);
 
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
@@ -1207,14 +1435,14 @@ TEST_FUNCTION(Gateway_CreateFromJson_Traverses_JSON_Value_NULL_Loaders_Array_suc
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)));
 
     // modules array
     setup_parse_modules_entry(mocks, 0, "module1");
     setup_parse_modules_entry(mocks, 1, "module2");
 
     // links entry
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
@@ -1222,6 +1450,8 @@ TEST_FUNCTION(Gateway_CreateFromJson_Traverses_JSON_Value_NULL_Loaders_Array_suc
     setup_links_entry(mocks, 0, "module1", "module2");
     setup_links_entry(mocks, 1, "module2", "module1");
 
+    setup_no_scheduler(mocks);
+
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(GATEWAY_HANDLE_DATA)));
     STRICT_EXPECTED_CALL(mocks, Broker_Create());
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_DATA*)));
@@ -1338,7 +1568,7 @@ TEST_FUNCTION(Gateway_CreateFromJson_Traverses_JSON_Value_VECTOR_Create_Fail)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "links"))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)))
         .SetFailReturn((VECTOR_HANDLE)NULL);
 
     STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
@@ -1366,7 +1596,7 @@ TEST_FUNCTION(Gateway_CreateFromJson_Traverses_JSON_Value_VECTOR_Create_for_link
     setup_parse_modules_entry(mocks, 0, "module0");
     setup_parse_modules_entry(mocks, 1, "module0");
 
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)))
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)))
         .SetFailReturn((VECTOR_HANDLE)NULL);
 
     STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
@@ -1484,6 +1714,215 @@ TEST_FUNCTION(Gateway_CreateFromJson_Fails_For_Missing_Info_In_JSON_Configuratio
     mocks.AssertActualAndExpectedCalls();
 }
 
+/*Tests_SRS_GATEWAY_JSON_30_002: [ The function shall read the inbox "capacity", "overflow", "coalesce.key" and "dedicated.thread" values; a missing "capacity" means the default capacity, a missing "overflow" means "block-publisher" and a missing "dedicated.thread" means false. ]*/
+/*Tests_SRS_GATEWAY_JSON_30_013: [ The function shall set the inbox `inline_delivery` to the inbox "inline" value; a missing "inline" means false. ]*/
+/*Tests_SRS_GATEWAY_JSON_30_003: [ If "capacity" or "slow.threshold" is negative, "overflow" is not a known policy, or "overflow" is "coalesce-by-key" without a "coalesce.key", the function shall fail and return NULL. ]*/
+TEST_FUNCTION(Gateway_CreateFromJson_Fails_For_Unknown_Inbox_Overflow_Policy)
+{
+    //Arrange
+    CGatewayMocks mocks;
+
+    setup_2module_gw(mocks, (char*)VALID_JSON_PATH);
+
+    STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "loader"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)0x42);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "name"))
+        .IgnoreArgument(1)
+        .SetReturn("loader1");
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_FindByName("loader1"));
+    STRICT_EXPECTED_CALL(mocks, json_object_get_value(IGNORED_PTR_ARG, "entrypoint"))
+        .IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_ParseEntrypointFromJson(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "name"))
+        .IgnoreArgument(1)
+        .SetReturn("module1");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "inbox"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)0x42);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "capacity"))
+        .IgnoreArgument(1)
+        .SetReturn(16);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "overflow"))
+        .IgnoreArgument(1)
+        .SetReturn("drop-everything");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesce.key"))
+        .IgnoreArgument(1)
+        .SetReturn((char*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_boolean(IGNORED_PTR_ARG, "dedicated.thread"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_boolean(IGNORED_PTR_ARG, "inline"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "slow.threshold"))
+        .IgnoreArgument(1);
+
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeEntrypoint(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
+
+    //Act
+    GATEWAY_HANDLE gateway = Gateway_CreateFromJson(VALID_JSON_PATH);
+
+    //Assert
+    ASSERT_IS_NULL(gateway);
+    mocks.AssertActualAndExpectedCalls();
+}
+
+/*Tests_SRS_GATEWAY_JSON_30_015: [ The function shall set the inbox `slow_receive_threshold` to the inbox "slow.threshold" value, in milliseconds, converted to microseconds; a missing "slow.threshold" means 0, and the inbox shall have no `on_health_changed`. ]*/
+/*Tests_SRS_GATEWAY_JSON_30_003: [ If "capacity" or "slow.threshold" is negative, "overflow" is not a known policy, or "overflow" is "coalesce-by-key" without a "coalesce.key", the function shall fail and return NULL. ]*/
+TEST_FUNCTION(Gateway_CreateFromJson_Fails_For_Negative_Inbox_Slow_Threshold)
+{
+    //Arrange
+    CGatewayMocks mocks;
+
+    setup_2module_gw(mocks, (char*)VALID_JSON_PATH);
+
+    STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "loader"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)0x42);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "name"))
+        .IgnoreArgument(1)
+        .SetReturn("loader1");
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_FindByName("loader1"));
+    STRICT_EXPECTED_CALL(mocks, json_object_get_value(IGNORED_PTR_ARG, "entrypoint"))
+        .IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_ParseEntrypointFromJson(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "name"))
+        .IgnoreArgument(1)
+        .SetReturn("module1");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "inbox"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)0x42);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "capacity"))
+        .IgnoreArgument(1)
+        .SetReturn(16);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "overflow"))
+        .IgnoreArgument(1)
+        .SetReturn("drop-oldest");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesce.key"))
+        .IgnoreArgument(1)
+        .SetReturn((char*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_boolean(IGNORED_PTR_ARG, "dedicated.thread"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_boolean(IGNORED_PTR_ARG, "inline"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "slow.threshold"))
+        .IgnoreArgument(1)
+        .SetReturn(-1);
+
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeEntrypoint(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
+
+    //Act
+    GATEWAY_HANDLE gateway = Gateway_CreateFromJson(VALID_JSON_PATH);
+
+    //Assert
+    ASSERT_IS_NULL(gateway);
+    mocks.AssertActualAndExpectedCalls();
+}
+
+/*Tests_SRS_GATEWAY_JSON_30_008: [ The function shall read the "cpus", "nice" and "fifo.priority" values of a "thread" object; a missing value leaves that setting of the thread unchanged. ]*/
+/*Tests_SRS_GATEWAY_JSON_30_009: [ If a "cpus" entry is not a CPU number below THREAD_SCHEDULING_MAX_CPUS, "nice" is not a whole number from THREAD_SCHEDULING_MIN_NICE to THREAD_SCHEDULING_MAX_NICE, or "fifo.priority" is not a whole number from 0 to THREAD_SCHEDULING_MAX_FIFO_PRIORITY, the function shall fail and return NULL. ]*/
+/*Tests_SRS_GATEWAY_JSON_30_010: [ If a module has a "thread" object, the function shall set the thread_scheduling of the module's inbox configuration to the settings it describes, giving the module a default inbox configuration if it has no "inbox" object. ]*/
+TEST_FUNCTION(Gateway_CreateFromJson_Fails_For_Out_Of_Range_Module_Thread_Nice)
+{
+    //Arrange
+    CGatewayMocks mocks;
+
+    setup_2module_gw(mocks, (char*)VALID_JSON_PATH);
+
+    STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "loader"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)0x42);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "name"))
+        .IgnoreArgument(1)
+        .SetReturn("loader1");
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_FindByName("loader1"));
+    STRICT_EXPECTED_CALL(mocks, json_object_get_value(IGNORED_PTR_ARG, "entrypoint"))
+        .IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_ParseEntrypointFromJson(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "name"))
+        .IgnoreArgument(1)
+        .SetReturn("module1");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "inbox"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)0x42);
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(BROKER_INBOX_CONFIG)));
+    STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "cpus"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Array*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "nice"))
+        .IgnoreArgument(1)
+        .SetReturn(-42);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "fifo.priority"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeEntrypoint(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
+
+    //Act
+    GATEWAY_HANDLE gateway = Gateway_CreateFromJson(VALID_JSON_PATH);
+
+    //Assert
+    ASSERT_IS_NULL(gateway);
+    mocks.AssertActualAndExpectedCalls();
+}
+
 //Tests_SRS_GATEWAY_JSON_13_001: [ If loader.name is not found in the JSON then the gateway assumes that the loader name is native. ]
 TEST_FUNCTION(Gateway_CreateFromJson_uses_native_loader_when_loader_name_is_missing)
 {
@@ -1497,7 +1936,7 @@ TEST_FUNCTION(Gateway_CreateFromJson_uses_native_loader_when_loader_name_is_miss
     setup_parse_modules_entry(mocks, 1, "module2", NULL);
 
     // links entry
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
@@ -1505,6 +1944,8 @@ TEST_FUNCTION(Gateway_CreateFromJson_uses_native_loader_when_loader_name_is_miss
     setup_links_entry(mocks, 0, "module1", "module2");
     setup_links_entry(mocks, 1, "module2", "module1");
 
+    setup_no_scheduler(mocks);
+
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(GATEWAY_HANDLE_DATA)));
     STRICT_EXPECTED_CALL(mocks, Broker_Create());
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_DATA*)));
@@ -1630,6 +2071,12 @@ TEST_FUNCTION(Gateway_CreateFromJson_fails_with_no_entry_point)
     STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "name"))
         .IgnoreArgument(1)
         .SetReturn("module1");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "inbox"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+        .IgnoreArgument(1)
+        .SetReturn((JSON_Object*)NULL);
     STRICT_EXPECTED_CALL(mocks, json_object_get_value(IGNORED_PTR_ARG, "args"))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, json_serialize_to_string(IGNORED_PTR_ARG))
@@ -1641,7 +2088,7 @@ TEST_FUNCTION(Gateway_CreateFromJson_fails_with_no_entry_point)
     setup_parse_modules_entry(mocks, 1, "module2");
 
     // links entry
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
@@ -1650,6 +2097,8 @@ TEST_FUNCTION(Gateway_CreateFromJson_fails_with_no_entry_point)
     setup_links_entry(mocks, 1, "module2", "module1");
 
     // Create gateway until 1st module fails immediately
+    setup_no_scheduler(mocks);
+
     STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(GATEWAY_HANDLE_DATA)));
     STRICT_EXPECTED_CALL(mocks, Broker_Create());
     STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(MODULE_DATA*)));
@@ -1770,7 +2219,7 @@ TEST_FUNCTION(Gateway_CreateFromJson_Fails_links_parsing_no_source)
     setup_parse_modules_entry(mocks, 1, "module2");
 
     // links entry
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
@@ -1784,6 +2233,83 @@ TEST_FUNCTION(Gateway_CreateFromJson_Fails_links_parsing_no_source)
     STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sink"))
         .IgnoreArgument(1)
         .SetReturn("module1");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "priority"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "filter"))
+        .IgnoreArgument(1)
+        .SetReturn((const char*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesce.key"))
+        .IgnoreArgument(1)
+        .SetReturn((const char*)NULL);
+
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
+        .IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeEntrypoint(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, json_free_serialized_string((char *)"[serialized string]"));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeEntrypoint(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, json_free_serialized_string((char *)"[serialized string]"));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_Destroy());
+
+    //Act
+    GATEWAY_HANDLE gateway = Gateway_CreateFromJson(VALID_JSON_PATH);
+
+    //Assert
+    ASSERT_IS_NULL(gateway);
+    mocks.AssertActualAndExpectedCalls();
+}
+
+/*Tests_SRS_GATEWAY_JSON_30_007: [ If "priority" is not a whole number less than `BROKER_LINK_PRIORITIES`, the function shall fail and return NULL. ]*/
+TEST_FUNCTION(Gateway_CreateFromJson_Fails_links_parsing_priority_out_of_range)
+{
+    //Arrange
+    CGatewayMocks mocks;
+
+    setup_2module_gw(mocks, (char*)VALID_JSON_PATH);
+
+    // modules array
+    setup_parse_modules_entry(mocks, 0, "module1");
+    setup_parse_modules_entry(mocks, 1, "module2");
+
+    // links entry
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .SetReturn(2);
+
+    setup_links_entry(mocks, 0, "module1", "module2");
+    STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "source"))
+        .IgnoreArgument(1)
+        .SetReturn("module2");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sink"))
+        .IgnoreArgument(1)
+        .SetReturn("module1");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "priority"))
+        .IgnoreArgument(1)
+        .SetReturn((double)BROKER_LINK_PRIORITIES);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "filter"))
+        .IgnoreArgument(1)
+        .SetReturn((const char*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesce.key"))
+        .IgnoreArgument(1)
+        .SetReturn((const char*)NULL);
 
     STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
@@ -1830,7 +2356,7 @@ TEST_FUNCTION(Gateway_CreateFromJson_Fails_links_parsing_pushback_fails)
     setup_parse_modules_entry(mocks, 1, "module2");
 
     // links entry
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
@@ -1844,6 +2370,14 @@ TEST_FUNCTION(Gateway_CreateFromJson_Fails_links_parsing_pushback_fails)
     STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sink"))
         .IgnoreArgument(1)
         .SetReturn("module1");
+    STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "priority"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "filter"))
+        .IgnoreArgument(1)
+        .SetReturn((const char*)NULL);
+    STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesce.key"))
+        .IgnoreArgument(1)
+        .SetReturn((const char*)NULL);
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2)
@@ -2004,7 +2538,7 @@ static void setup_2module_update_gw(CGatewayMocks& mocks, char * json_content)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "links"))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)));
 
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
@@ -2030,7 +2564,7 @@ TEST_FUNCTION(Gateway_UpdateFromJson_Parses_Valid_JSON_Configuration_File_Succee
     setup_parse_modules_entry(mocks, 1, "module2");
 
     //// links entry
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
         .SetReturn(2);
@@ -2040,8 +2574,8 @@ TEST_FUNCTION(Gateway_UpdateFromJson_Parses_Valid_JSON_Configuration_File_Succee
 
 
     //Vector to track the successfull added link.
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)));
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
 
     STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
@@ -2139,7 +2673,7 @@ TEST_FUNCTION(Gateway_UpdateFromJson_Parses_JSON_WithJustModule_Configuration_Fi
     STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "links"))
         .IgnoreArgument(1)
         .SetFailReturn((JSON_Array *)NULL);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)));
 
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
@@ -2152,8 +2686,8 @@ TEST_FUNCTION(Gateway_UpdateFromJson_Parses_JSON_WithJustModule_Configuration_Fi
     setup_parse_modules_entry(mocks, 1, "module2");
 
     //Vector to track the successfull added link.
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)));
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
 
     STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
@@ -2240,7 +2774,7 @@ TEST_FUNCTION(Gateway_UpdateFromJson_Parses_JSON_WithJustLinks_Configuration_Fil
     STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "links"))
         .IgnoreArgument(1)
         .SetFailReturn((JSON_Array *)NULL);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)));
 
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
@@ -2251,8 +2785,8 @@ TEST_FUNCTION(Gateway_UpdateFromJson_Parses_JSON_WithJustLinks_Configuration_Fil
     setup_parse_modules_entry(mocks, 1, "module2");
 
     //Vector to track the successfull added link.
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)));
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
 
     STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
@@ -2322,7 +2856,7 @@ TEST_FUNCTION(Gateway_UpdateFromJson_Parses_JSON_WithJustLinks_Configuration_Fil
         .SetFailReturn((JSON_Array *)NULL);
     STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "links"))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
 
     STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
         .IgnoreArgument(1)
@@ -2332,8 +2866,8 @@ TEST_FUNCTION(Gateway_UpdateFromJson_Parses_JSON_WithJustLinks_Configuration_Fil
     setup_links_entry(mocks, 1, "module2", "module1");
 
     //Vector to track the successfull added link.
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULES_ENTRY)));
-    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_LINK_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_MODULES_ENTRY)));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_JSON_LINK_ENTRY)));
 
     STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
@@ -61,7 +61,11 @@ static size_t whenShallBroker_RemoveModule_fail;
 static size_t currentBroker_Create_call;
 static size_t whenShallBroker_Create_fail;
 static size_t currentBroker_module_count;
+static BROKER_INBOX_CONFIG inbox_for_Broker_AddModuleWithInbox;
 static size_t currentBroker_ref_count;
+static const char* last_link_filter;
+static size_t last_link_priority;
+static const char* last_link_coalesce_key;
 
 static size_t currentModuleLoader_Load_call;
 static size_t whenShallModuleLoader_Load_fail;
@@ -132,6 +136,11 @@ public:
     }
     MOCK_METHOD_END(BROKER_HANDLE, result1);
 
+    MOCK_STATIC_METHOD_1(, BROKER_HANDLE, Broker_CreateWithScheduler, const BROKER_SCHEDULER_CONFIG*, scheduler)
+        ++currentBroker_ref_count;
+        BROKER_HANDLE result1 = (BROKER_HANDLE)BASEIMPLEMENTATION::gballoc_malloc(1);
+    MOCK_METHOD_END(BROKER_HANDLE, result1);
+
     MOCK_STATIC_METHOD_1(, void, Broker_Destroy, BROKER_HANDLE, broker)
         if (currentBroker_ref_count > 0)
         {
@@ -156,6 +165,16 @@ public:
         }
     MOCK_METHOD_END(BROKER_RESULT, result1);
 
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_AddModuleWithInbox, BROKER_HANDLE, handle, const MODULE*, module, const BROKER_INBOX_CONFIG*, inbox)
+        BROKER_RESULT result1 = BROKER_ERROR;
+        if (handle != NULL && module != NULL && inbox != NULL)
+        {
+            ++currentBroker_module_count;
+            inbox_for_Broker_AddModuleWithInbox = *inbox;
+            result1 = BROKER_OK;
+        }
+    MOCK_METHOD_END(BROKER_RESULT, result1);
+
     MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_RemoveModule, BROKER_HANDLE, handle, const MODULE*, module)
         currentBroker_RemoveModule_call++;
         BROKER_RESULT result1 = BROKER_ERROR;
@@ -166,10 +185,18 @@ public:
         }
     MOCK_METHOD_END(BROKER_RESULT, result1);
 
-    MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_AddLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link)
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_AddLinkWithOptions, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_OPTIONS*, options)
+        last_link_filter = (options == NULL) ? NULL : options->filter;
+        last_link_priority = (options == NULL) ? 0 : options->priority;
+        last_link_coalesce_key = (options == NULL) ? NULL : options->coalesce_key;
+    MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
+
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_RemoveLinkWithOptions, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_OPTIONS*, options)
     MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
 
-    MOCK_STATIC_METHOD_2(, BROKER_RESULT, Broker_RemoveLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link)
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_GetStatistics, BROKER_HANDLE, broker, const MODULE*, module, BROKER_MODULE_STATISTICS*, statistics)
+        memset(statistics, 0, sizeof(BROKER_MODULE_STATISTICS));
+        statistics->messages_in = 5;
     MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
 
     MOCK_STATIC_METHOD_2(, MODULE_LIBRARY_HANDLE, DynamicModuleLoader_Load, const struct MODULE_LOADER_TAG*, loader, const void*, entrypoint)
@@ -245,6 +272,10 @@ public:
         BASEIMPLEMENTATION::gballoc_free(handle);
     MOCK_VOID_METHOD_END();
 
+    MOCK_STATIC_METHOD_2(, void, EventSystem_SetThreadScheduling, EVENTSYSTEM_HANDLE, event_system, const THREAD_SCHEDULING_CONFIG*, thread_scheduling)
+        // no-op
+    MOCK_VOID_METHOD_END();
+
     MOCK_STATIC_METHOD_1(, VECTOR_HANDLE, VECTOR_create, size_t, elementSize)
         currentVECTOR_create_call++;
         VECTOR_HANDLE vector = NULL;
@@ -340,11 +371,14 @@ DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , void, mock_Module_Receive, MODUL
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, mock_Module_Start, MODULE_HANDLE, moduleHandle);
 
 DECLARE_GLOBAL_MOCK_METHOD_0(CGatewayLLMocks, , BROKER_HANDLE, Broker_Create);
+DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , BROKER_HANDLE, Broker_CreateWithScheduler, const BROKER_SCHEDULER_CONFIG*, scheduler);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, Broker_Destroy, BROKER_HANDLE, broker);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , BROKER_RESULT, Broker_AddModule, BROKER_HANDLE, handle, const MODULE*, module);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , BROKER_RESULT, Broker_AddModuleWithInbox, BROKER_HANDLE, handle, const MODULE*, module, const BROKER_INBOX_CONFIG*, inbox);
 DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , BROKER_RESULT, Broker_RemoveModule, BROKER_HANDLE, handle, const MODULE*, module);
-DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , BROKER_RESULT, Broker_AddLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link);
-DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , BROKER_RESULT, Broker_RemoveLink, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , BROKER_RESULT, Broker_AddLinkWithOptions, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_OPTIONS*, options);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , BROKER_RESULT, Broker_RemoveLinkWithOptions, BROKER_HANDLE, handle, const BROKER_LINK_DATA*, link, const BROKER_LINK_OPTIONS*, options);
+DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , BROKER_RESULT, Broker_GetStatistics, BROKER_HANDLE, broker, const MODULE*, module, BROKER_MODULE_STATISTICS*, statistics);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, Broker_IncRef, BROKER_HANDLE, broker);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, Broker_DecRef, BROKER_HANDLE, broker);
 
@@ -366,6 +400,7 @@ DECLARE_GLOBAL_MOCK_METHOD_0(CGatewayLLMocks, , EVENTSYSTEM_HANDLE, EventSystem_
 DECLARE_GLOBAL_MOCK_METHOD_4(CGatewayLLMocks, , void, EventSystem_AddEventCallback, EVENTSYSTEM_HANDLE, event_system, GATEWAY_EVENT, event_type, GATEWAY_CALLBACK, callback, void*, user_param);
 DECLARE_GLOBAL_MOCK_METHOD_3(CGatewayLLMocks, , void, EventSystem_ReportEvent, EVENTSYSTEM_HANDLE, event_system, GATEWAY_HANDLE, gw, GATEWAY_EVENT, event_type);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, EventSystem_Destroy, EVENTSYSTEM_HANDLE, handle);
+DECLARE_GLOBAL_MOCK_METHOD_2(CGatewayLLMocks, , void, EventSystem_SetThreadScheduling, EVENTSYSTEM_HANDLE, event_system, const THREAD_SCHEDULING_CONFIG*, thread_scheduling);
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , VECTOR_HANDLE, VECTOR_create, size_t, elementSize);
 DECLARE_GLOBAL_MOCK_METHOD_1(CGatewayLLMocks, , void, VECTOR_destroy, VECTOR_HANDLE, handle);
@@ -490,6 +525,10 @@ TEST_FUNCTION_INITIALIZE(TestMethodInitialize)
     currentVECTOR_find_if_call = 0;
     whenShallVECTOR_find_if_fail = 0;
 
+    last_link_filter = NULL;
+    last_link_priority = 0;
+    last_link_coalesce_key = NULL;
+
     dummyAPIs =
     {
         {MODULE_API_VERSION_1},
@@ -542,6 +581,7 @@ TEST_FUNCTION_CLEANUP(TestMethodCleanup)
 /*Tests_SRS_GATEWAY_17_018: [ The function shall construct module configuration from module's entrypoint and module's module_configuration. ]*/
 /*Tests_SRS_GATEWAY_17_020: [ The function shall clean up any constructed resources. ]*/
 /*Tests_SRS_GATEWAY_14_009: [ The function shall use each of GATEWAY_PROPERTIES's gateway_modules to create and add a module to the gateway's message broker. ]*/
+/*Tests_SRS_GATEWAY_30_023: [ Gateway_Create shall create the gateway as Gateway_CreateWithOptions does with NULL options. ]*/
 
 TEST_FUNCTION(Gateway_Create_Creates_Handle_Success)
 {
@@ -570,6 +610,86 @@ TEST_FUNCTION(Gateway_Create_Creates_Handle_Success)
     Gateway_Destroy(gateway);
 }
 
+/*Tests_SRS_GATEWAY_30_002: [ If options is not NULL and options->broker_scheduler is not NULL, the function shall create the BROKER_HANDLE with Broker_CreateWithScheduler instead. ]*/
+TEST_FUNCTION(Gateway_CreateWithOptions_creates_broker_with_scheduler)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+
+    BROKER_SCHEDULER_CONFIG scheduler = { 2 };
+    GATEWAY_PROPERTIES props;
+    props.gateway_modules = NULL;
+    props.gateway_links = NULL;
+    GATEWAY_OPTIONS options;
+    options.broker_scheduler = &scheduler;
+    options.thread_scheduling = NULL;
+
+    //Expectations
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_Initialize());
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Broker_CreateWithScheduler(&scheduler));
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    expectEventSystemInit(mocks);
+
+    //Act
+    GATEWAY_HANDLE gateway = Gateway_CreateWithOptions(&props, &options);
+
+    //Assert
+    ASSERT_IS_NOT_NULL(gateway);
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    Gateway_Destroy(gateway);
+}
+
+/*Tests_SRS_GATEWAY_30_024: [ If options->thread_scheduling is not NULL, the function shall give it to the event system with EventSystem_SetThreadScheduling before reporting any event. ]*/
+TEST_FUNCTION(Gateway_CreateWithOptions_gives_the_thread_scheduling_to_the_event_system)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+
+    THREAD_SCHEDULING_CONFIG thread_scheduling = { 0x4, 10, 0 };
+    GATEWAY_PROPERTIES props;
+    props.gateway_modules = NULL;
+    props.gateway_links = NULL;
+    GATEWAY_OPTIONS options;
+    options.broker_scheduler = NULL;
+    options.thread_scheduling = &thread_scheduling;
+
+    //Expectations
+    STRICT_EXPECTED_CALL(mocks, ModuleLoader_Initialize());
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Broker_Create());
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_Init());
+    STRICT_EXPECTED_CALL(mocks, EventSystem_SetThreadScheduling(IGNORED_PTR_ARG, &thread_scheduling))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_CREATED))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_MODULE_LIST_CHANGED))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    //Act
+    GATEWAY_HANDLE gateway = Gateway_CreateWithOptions(&props, &options);
+
+    //Assert
+    ASSERT_IS_NOT_NULL(gateway);
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    Gateway_Destroy(gateway);
+}
+
 /*Tests_SRS_GATEWAY_14_011: [ If gw, entry, or GATEWAY_MODULES_ENTRY's loader_configuration or loader_api is NULL the function shall return NULL. ]*/
 /*Tests_SRS_GATEWAY_17_017: [ This function shall destroy the default module loaders upon any failure. ]*/
 /*Tests_SRS_GATEWAY_27_027: [ Launch - This function shall join any spawned threads upon any failure. ]*/
@@ -1453,7 +1573,7 @@ TEST_FUNCTION(Gateway_Create_Adds_All_Modules_And_All_Links_In_Props_Success)
         .IgnoreAllArguments(); //Check if Source Module exists.
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments(); //Check if Sink Module exists.
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
@@ -1705,6 +1825,7 @@ TEST_FUNCTION(Gateway_Destroy_Continues_Unloading_If_Broker_RemoveModule_Fails)
 /*Tests_SRS_GATEWAY_04_014: [ The function shall remove each link in GATEWAY_HANDLE_DATA's links vector and destroy GATEWAY_HANDLE_DATA's link. ]*/
 /*Tests_SRS_GATEWAY_17_019: [ The function shall destroy the module loader list. ]*/
 /*Tests_SRS_GATEWAY_27_040: [ Launch - `Gateway_Destroy` shall join any spawned threads. ]*/
+/*Tests_SRS_GATEWAY_30_019: [ This function shall destroy the Gateway Events callback system only after removing the modules, which may report GATEWAY_MODULE_HEALTH_CHANGED until then. ]*/
 TEST_FUNCTION(Gateway_Destroy_Removes_All_Modules_And_Destroys_Vector_Success)
 {
     //Arrange
@@ -1788,7 +1909,7 @@ TEST_FUNCTION(Gateway_Destroy_Removes_All_Modules_And_Destroys_Vector_Success)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_front(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
@@ -1964,6 +2085,192 @@ TEST_FUNCTION(Gateway_AddModule_Loads_Module_From_Library_Path)
     Gateway_Destroy(gw);
 }
 
+/*Tests_SRS_GATEWAY_30_001: [ If module_inbox is not NULL, the function shall attach the module using a call to Broker_AddModuleWithInbox with module_inbox instead. ]*/
+TEST_FUNCTION(Gateway_AddModuleWithInbox_attaches_module_with_its_inbox)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+
+    GATEWAY_HANDLE gw = Gateway_Create(NULL);
+    BROKER_INBOX_CONFIG inbox = { 8, BROKER_OVERFLOW_DROP_OLDEST, NULL };
+    GATEWAY_MODULES_ENTRY entry = *(GATEWAY_MODULES_ENTRY*)BASEIMPLEMENTATION::VECTOR_front(dummyProps->gateway_modules);
+    mocks.ResetAllCalls();
+
+    //Expectations
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_Load(IGNORED_PTR_ARG, dummyLoaderInfo.entrypoint))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_GetModuleApi(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_BuildModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithInbox(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &inbox))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, gw, GATEWAY_MODULE_LIST_CHANGED))
+        .IgnoreArgument(1);
+
+    //Act
+    MODULE_HANDLE handle = Gateway_AddModuleWithInbox(gw, &entry, &inbox);
+
+    //Assert
+    ASSERT_IS_NOT_NULL(handle);
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    Gateway_Destroy(gw);
+}
+
+/*Tests_SRS_GATEWAY_30_005: [ If options->thread_scheduling is not NULL and options->broker_scheduler is NULL, the function shall keep a copy of options->thread_scheduling for the modules it adds. ]*/
+/*Tests_SRS_GATEWAY_30_006: [ If the gateway keeps a thread scheduling for its modules and module_inbox is NULL or does not set a thread_scheduling, the function shall attach the module with a copy of module_inbox, or of the default inbox, whose thread_scheduling is the gateway's. ]*/
+/*Tests_SRS_GATEWAY_30_022: [ Gateway_AddModule shall add the module as Gateway_AddModuleWithInbox does when inbox is NULL. ]*/
+TEST_FUNCTION(Gateway_AddModule_attaches_module_with_the_gateway_thread_scheduling)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+
+    THREAD_SCHEDULING_CONFIG thread_scheduling = { 0x4, 10, 0 };
+    GATEWAY_PROPERTIES props;
+    props.gateway_modules = NULL;
+    props.gateway_links = NULL;
+    GATEWAY_OPTIONS options;
+    options.broker_scheduler = NULL;
+    options.thread_scheduling = &thread_scheduling;
+    GATEWAY_HANDLE gw = Gateway_CreateWithOptions(&props, &options);
+    GATEWAY_MODULES_ENTRY entry = *(GATEWAY_MODULES_ENTRY*)BASEIMPLEMENTATION::VECTOR_front(dummyProps->gateway_modules);
+    mocks.ResetAllCalls();
+
+    //Expectations
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_Load(IGNORED_PTR_ARG, dummyLoaderInfo.entrypoint))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_GetModuleApi(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_BuildModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithInbox(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, gw, GATEWAY_MODULE_LIST_CHANGED))
+        .IgnoreArgument(1);
+
+    //Act
+    MODULE_HANDLE handle = Gateway_AddModule(gw, &entry);
+
+    //Assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, 0, inbox_for_Broker_AddModuleWithInbox.capacity);
+    ASSERT_ARE_EQUAL(int, 0x4, (int)inbox_for_Broker_AddModuleWithInbox.thread_scheduling.cpu_affinity);
+    ASSERT_ARE_EQUAL(int, 10, inbox_for_Broker_AddModuleWithInbox.thread_scheduling.nice);
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    Gateway_Destroy(gw);
+}
+
+/*Tests_SRS_GATEWAY_30_017: [ If module_inbox has a slow_receive_threshold and no on_health_changed, the function shall attach the module with a copy of module_inbox whose on_health_changed reports GATEWAY_MODULE_HEALTH_CHANGED for the gateway. ]*/
+/*Tests_SRS_GATEWAY_30_018: [ When the broker marks a module slow or the module recovers, the gateway shall report the GATEWAY_MODULE_HEALTH_CHANGED event. ]*/
+TEST_FUNCTION(Gateway_AddModuleWithInbox_reports_health_changes_of_a_module_with_a_slow_threshold)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+
+    GATEWAY_HANDLE gw = Gateway_Create(NULL);
+    BROKER_INBOX_CONFIG inbox = { 8, BROKER_OVERFLOW_BLOCK_PUBLISHER, NULL };
+    inbox.slow_receive_threshold = 1000;
+    GATEWAY_MODULES_ENTRY entry = *(GATEWAY_MODULES_ENTRY*)BASEIMPLEMENTATION::VECTOR_front(dummyProps->gateway_modules);
+    mocks.ResetAllCalls();
+
+    //Expectations
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_Load(IGNORED_PTR_ARG, dummyLoaderInfo.entrypoint))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_GetModuleApi(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_BuildModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(mocks, DynamicModuleLoader_FreeModuleConfiguration(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+		.IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, mock_Module_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, Broker_AddModuleWithInbox(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, Broker_IncRef(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, gw, GATEWAY_MODULE_LIST_CHANGED))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, gw, GATEWAY_MODULE_HEALTH_CHANGED))
+        .IgnoreArgument(1);
+
+    //Act
+    MODULE_HANDLE handle = Gateway_AddModuleWithInbox(gw, &entry, &inbox);
+    ASSERT_IS_NOT_NULL((void*)inbox_for_Broker_AddModuleWithInbox.on_health_changed);
+    inbox_for_Broker_AddModuleWithInbox.on_health_changed(inbox_for_Broker_AddModuleWithInbox.health_context, handle, true);
+
+    //Assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, 8, inbox_for_Broker_AddModuleWithInbox.capacity);
+    ASSERT_ARE_EQUAL(int, 1000, (int)inbox_for_Broker_AddModuleWithInbox.slow_receive_threshold);
+    ASSERT_IS_NULL((void*)inbox.on_health_changed);
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    Gateway_Destroy(gw);
+}
+
 /*Tests_SRS_GATEWAY_14_031: [ If unsuccessful, the function shall return NULL. ]*/
 TEST_FUNCTION(Gateway_AddModule_Malloc_data_Fails)
 {
@@ -2682,7 +2989,7 @@ TEST_FUNCTION(Gateway_RemoveLink_Finds_Link_Data_Success)
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &dummyLink2))
         .IgnoreArgument(1)
         .IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
@@ -2998,6 +3305,106 @@ TEST_FUNCTION(Gateway_GetModuleList_push_back_fail)
     Gateway_Destroy(gw);
 }
 
+/*Tests_SRS_GATEWAY_30_008: [ This function shall return a snapshot copy of the statistics `Broker_GetStatistics` returns for every module, in the order the modules were added. ]*/
+TEST_FUNCTION(Gateway_GetStatistics_Basic)
+{
+    // Arrange
+    CGatewayLLMocks mocks;
+    GATEWAY_HANDLE gw = Gateway_Create(dummyProps);
+    mocks.ResetAllCalls();
+
+    // Expect
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULE_STATISTICS)));
+    EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(mocks, Broker_GetStatistics(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1));
+
+    // Act
+    VECTOR_HANDLE statistics = Gateway_GetStatistics(gw);
+
+    // Assert
+    ASSERT_IS_NOT_NULL(statistics);
+    ASSERT_ARE_EQUAL(int, BASEIMPLEMENTATION::VECTOR_size(statistics), 1);
+    GATEWAY_MODULE_STATISTICS* module_statistics = (GATEWAY_MODULE_STATISTICS*)BASEIMPLEMENTATION::VECTOR_element(statistics, 0);
+    ASSERT_ARE_EQUAL(int, 0, strcmp(module_statistics->module_name, "dummy module"));
+    ASSERT_ARE_EQUAL(size_t, 5, (size_t)module_statistics->statistics.messages_in);
+    mocks.AssertActualAndExpectedCalls();
+
+    // Cleanup
+    Gateway_DestroyStatistics(statistics);
+    Gateway_Destroy(gw);
+    mocks.ResetAllCalls();
+}
+
+/*Tests_SRS_GATEWAY_30_007: [ If the `gw` parameter is NULL, the function shall return NULL handle and not allocate any data. ]*/
+TEST_FUNCTION(Gateway_GetStatistics_NULL_Gateway)
+{
+    // Arrange
+    CGatewayLLMocks mocks;
+
+    // Expectations
+    // Empty
+
+    // Act
+    VECTOR_HANDLE statistics = Gateway_GetStatistics(NULL);
+
+    // Assert
+    ASSERT_IS_NULL(statistics);
+    mocks.AssertActualAndExpectedCalls();
+}
+
+/*Tests_SRS_GATEWAY_30_009: [ This function shall return a NULL handle should any internal callbacks fail. ]*/
+TEST_FUNCTION(Gateway_GetStatistics_Broker_Fail)
+{
+    // Arrange
+    CGatewayLLMocks mocks;
+    GATEWAY_HANDLE gw = Gateway_Create(dummyProps);
+    mocks.ResetAllCalls();
+
+    // Expectations
+    STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(GATEWAY_MODULE_STATISTICS)));
+    EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(mocks, Broker_GetStatistics(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .SetFailReturn(BROKER_ERROR);
+    EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG));
+
+    // Act
+    VECTOR_HANDLE statistics = Gateway_GetStatistics(gw);
+
+    // Assert
+    ASSERT_IS_NULL(statistics);
+    mocks.AssertActualAndExpectedCalls();
+
+    // Cleanup
+    Gateway_Destroy(gw);
+}
+
+/*Tests_SRS_GATEWAY_30_011: [ This function shall log a failure and do nothing else when `gw` parameter is NULL. ]*/
+/*Tests_SRS_GATEWAY_30_012: [ This function shall report `GATEWAY_STATISTICS_REPORTED` event. ]*/
+TEST_FUNCTION(Gateway_ReportStatistics_Reports_Event)
+{
+    // Arrange
+    CGatewayLLMocks mocks;
+    GATEWAY_HANDLE gw = Gateway_Create(NULL);
+    mocks.ResetAllCalls();
+
+    // Expectations
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, gw, GATEWAY_STATISTICS_REPORTED))
+        .IgnoreArgument(1);
+
+    // Act
+    Gateway_ReportStatistics(NULL);
+    Gateway_ReportStatistics(gw);
+
+    // Assert
+    mocks.AssertActualAndExpectedCalls();
+
+    // Cleanup
+    Gateway_Destroy(gw);
+}
+
 TEST_FUNCTION(Gateway_AddEventCallback_Forwards)
 {
     // Arrange
@@ -3195,6 +3602,7 @@ TEST_FUNCTION(Gateway_AddLink_NonExistingSinkModule_Fail)
 
 /*Tests_SRS_GATEWAY_04_012: [ This function shall add the entryLink to the gw->links ] */
 /*Tests_SRS_GATEWAY_04_013: [If adding the link succeed this function shall return GATEWAY_ADD_LINK_SUCCESS]*/
+/*Tests_SRS_GATEWAY_30_020: [ Gateway_AddLink shall add the link as Gateway_AddLinkWithOptions does when options is NULL. ]*/
 TEST_FUNCTION(Gateway_AddLink_Succeeds)
 {
     //Arrange
@@ -3224,7 +3632,7 @@ TEST_FUNCTION(Gateway_AddLink_Succeeds)
         .IgnoreAllArguments();//Check Source Module.
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();//Check Sink Module.
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
@@ -3237,6 +3645,127 @@ TEST_FUNCTION(Gateway_AddLink_Succeeds)
 
     //Assert
     ASSERT_ARE_EQUAL(GATEWAY_ADD_LINK_RESULT, GATEWAY_ADD_LINK_SUCCESS, result);
+    ASSERT_IS_NULL(last_link_filter);
+
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    Gateway_Destroy(gateway);
+}
+
+/*Tests_SRS_GATEWAY_30_013: [ The function shall add every broker link made for the entryLink with Broker_AddLinkWithOptions and `options->filter`. ]*/
+/*Tests_SRS_GATEWAY_30_014: [ The function shall keep a copy of `options->filter` with the link. ]*/
+/*Tests_SRS_GATEWAY_30_003: [ The function shall add every broker link made for the entryLink with `options->priority`. ]*/
+TEST_FUNCTION(Gateway_AddLinkWithOptions_passes_the_filter_and_the_priority_to_the_broker)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+
+    GATEWAY_MODULES_ENTRY dummyEntry2 = {
+        "dummy module 2",
+		dummyLoaderInfo,
+        NULL
+    };
+
+    GATEWAY_LINK_ENTRY dummyLink = {
+        "dummy module",
+        "dummy module 2"
+    };
+
+    BROKER_LINK_OPTIONS options = {
+        "deviceFunction == 'register'",
+        2
+    };
+
+    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry2, 1);
+
+    GATEWAY_HANDLE gateway = Gateway_Create(dummyProps);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();//Check link
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();//Check Source Module.
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();//Check Sink Module.
+    STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, "deviceFunction == 'register'"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_MODULE_LIST_CHANGED))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    //Act
+    GATEWAY_ADD_LINK_RESULT result = Gateway_AddLinkWithOptions(gateway, &dummyLink, &options);
+
+    //Assert
+    ASSERT_ARE_EQUAL(GATEWAY_ADD_LINK_RESULT, GATEWAY_ADD_LINK_SUCCESS, result);
+    ASSERT_ARE_EQUAL(char_ptr, "deviceFunction == 'register'", last_link_filter);
+    ASSERT_ARE_EQUAL(size_t, 2, last_link_priority);
+
+    mocks.AssertActualAndExpectedCalls();
+
+    //Cleanup
+    Gateway_Destroy(gateway);
+}
+
+/*Tests_SRS_GATEWAY_30_015: [ The function shall add every broker link made for the entryLink with `options->coalesce_key`. ]*/
+/*Tests_SRS_GATEWAY_30_016: [ The function shall keep a copy of `options->coalesce_key` with the link. ]*/
+TEST_FUNCTION(Gateway_AddLinkWithOptions_passes_the_coalesce_key_to_the_broker)
+{
+    //Arrange
+    CGatewayLLMocks mocks;
+
+    GATEWAY_MODULES_ENTRY dummyEntry2 = {
+        "dummy module 2",
+		dummyLoaderInfo,
+        NULL
+    };
+
+    GATEWAY_LINK_ENTRY dummyLink = {
+        "dummy module",
+        "dummy module 2"
+    };
+
+    BROKER_LINK_OPTIONS options = {
+        NULL,
+        0,
+        "macAddress, characteristicUUID"
+    };
+
+    BASEIMPLEMENTATION::VECTOR_push_back(dummyProps->gateway_modules, &dummyEntry2, 1);
+
+    GATEWAY_HANDLE gateway = Gateway_Create(dummyProps);
+    mocks.ResetAllCalls();
+
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();//Check link
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();//Check Source Module.
+    STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();//Check Sink Module.
+    STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, "macAddress, characteristicUUID"))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreAllArguments();
+    STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_MODULE_LIST_CHANGED))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+
+    //Act
+    GATEWAY_ADD_LINK_RESULT result = Gateway_AddLinkWithOptions(gateway, &dummyLink, &options);
+
+    //Assert
+    ASSERT_ARE_EQUAL(GATEWAY_ADD_LINK_RESULT, GATEWAY_ADD_LINK_SUCCESS, result);
+    ASSERT_IS_NULL(last_link_filter);
+    ASSERT_ARE_EQUAL(char_ptr, "macAddress, characteristicUUID", last_link_coalesce_key);
 
     mocks.AssertActualAndExpectedCalls();
 
@@ -3273,13 +3802,13 @@ TEST_FUNCTION(Gateway_AddLink_pushback_fails)
         .IgnoreAllArguments();//Check Source Module.
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();//Check Sink Module.
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .SetFailReturn(100);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     GATEWAY_ADD_LINK_RESULT result = Gateway_AddLink(gateway, &dummyLink);
 
@@ -3321,7 +3850,7 @@ TEST_FUNCTION(Gateway_AddLink_broker_add_fails)
         .IgnoreAllArguments();//Check Source Module.
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();//Check Sink Module.
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_ADD_LINK_ERROR);
 
@@ -3385,9 +3914,9 @@ TEST_FUNCTION(Gateway_AddLink_star_2nd_addbroker_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_ADD_LINK_ERROR);
 
@@ -3402,9 +3931,9 @@ TEST_FUNCTION(Gateway_AddLink_star_2nd_addbroker_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 2))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
@@ -3551,14 +4080,14 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_with_star_links)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     // 2nd broadcast link
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, gateway, GATEWAY_MODULE_LIST_CHANGED))
         .IgnoreArgument(1);
@@ -3647,14 +4176,14 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_star_2nd_addLink_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     // 2nd broadcast link
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_ADD_LINK_ERROR);
 
@@ -3665,13 +4194,13 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_star_2nd_addLink_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     // and remove the rest.
     STRICT_EXPECTED_CALL(mocks, Broker_RemoveModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -3775,7 +4304,7 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_star_2nd_find_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     // 2nd broadcast link
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
@@ -3792,14 +4321,14 @@ TEST_FUNCTION(Gateway_AddModule_Creates_Module_star_2nd_find_fails)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_REMOVE_LINK_ERROR);
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     // and remove the rest.
     STRICT_EXPECTED_CALL(mocks, Broker_RemoveModule(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -3882,11 +4411,11 @@ TEST_FUNCTION(Gateway_AddLink_star_success)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 2))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_MODULE_LIST_CHANGED))
         .IgnoreArgument(1)
@@ -4008,7 +4537,7 @@ TEST_FUNCTION(Gateway_AddLink_star_failure_to_add)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_ADD_LINK_ERROR);
 
@@ -4021,12 +4550,12 @@ TEST_FUNCTION(Gateway_AddLink_star_failure_to_add)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_REMOVE_LINK_ERROR);
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 2))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_back(IGNORED_PTR_ARG))
         .IgnoreArgument(1);
@@ -4092,14 +4621,14 @@ TEST_FUNCTION(Gateway_RemoveModule_with_star_links)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     // 2nd broadcast link
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     // and the rest of the remove...
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -4188,7 +4717,7 @@ TEST_FUNCTION(Gateway_RemoveModule_with_star_links_has_errors)
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_REMOVE_LINK_ERROR);
     // and the rest of the remove...
@@ -4275,11 +4804,11 @@ TEST_FUNCTION(Gateway_RemoveLink_star_link_success)
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments();
     STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 2))
         .IgnoreArgument(1);
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_REMOVE_LINK_ERROR);
     STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
@@ -4341,7 +4870,7 @@ TEST_FUNCTION(Gateway_RemoveLink_nostar_link_success)
     //Expectations
     STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &dummyLink3))
         .IgnoreAllArguments();
-    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    STRICT_EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreAllArguments()
         .SetFailReturn(BROKER_REMOVE_LINK_ERROR);
     STRICT_EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
@@ -5095,7 +5624,7 @@ TEST_FUNCTION(Gateway_RemoveModule_removes_links)
     auto gw = Gateway_Create(&props);
     
     // Expect
-    EXPECTED_CALL(mocks, Broker_RemoveLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    EXPECTED_CALL(mocks, Broker_RemoveLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .ExpectedTimesExactly(2);
     // remove from gw->links + remove module
     EXPECTED_CALL(mocks, VECTOR_erase(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
@@ -5153,7 +5682,7 @@ TEST_FUNCTION(Gateway_AddLink_no_report_on_fail)
     };
 
     // Expect
-    EXPECTED_CALL(mocks, Broker_AddLink(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+    EXPECTED_CALL(mocks, Broker_AddLinkWithOptions(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .SetFailReturn(BROKER_ADD_LINK_ERROR);
     STRICT_EXPECTED_CALL(mocks, EventSystem_ReportEvent(IGNORED_PTR_ARG, IGNORED_PTR_ARG, GATEWAY_MODULE_LIST_CHANGED))
         .IgnoreArgument(1)
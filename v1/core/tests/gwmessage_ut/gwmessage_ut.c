@@ -4,6 +4,8 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 #include "testrunnerswitcher.h"
 #include "umock_c.h"
 #include "umocktypes_charptr.h"
@@ -31,7 +33,14 @@ static size_t whenShallConstMap_Clone_fail;
 
 static size_t currentCONSTBUFFER_Create_call;
 static size_t whenShallCONSTBUFFER_Create_fail;
-static size_t currentCONSTBUFFER_refCount;
+
+/*a message can hold several buffers (its content and its serializations), so
+each fake buffer counts its own references*/
+typedef struct FAKE_CONSTBUFFER_TAG
+{
+    CONSTBUFFER content;
+    size_t refCount;
+}FAKE_CONSTBUFFER;
 
 static size_t currentCONSTBUFFER_Clone_call;
 static size_t whenShallCONSTBUFFER_Clone_fail;
@@ -105,6 +114,14 @@ static void my_ConstMap_Destroy(CONSTMAP_HANDLE map)
         free(map);
 }
 
+static size_t released_buffer_count;
+
+static void test_release_buffer(void* buffer)
+{
+    released_buffer_count++;
+    free(buffer);
+}
+
 static CONSTBUFFER_HANDLE my_CONSTBUFFER_Create(const unsigned char* source, size_t size)
 {
     CONSTBUFFER_HANDLE result1;
@@ -115,7 +132,7 @@ static CONSTBUFFER_HANDLE my_CONSTBUFFER_Create(const unsigned char* source, siz
     }
     else
     {
-        result1 = (CONSTBUFFER_HANDLE)malloc(sizeof(CONSTBUFFER));
+        result1 = (CONSTBUFFER_HANDLE)malloc(sizeof(FAKE_CONSTBUFFER));
         (*(CONSTBUFFER*)result1).size = size;
         if (size == 0)
         {
@@ -127,7 +144,7 @@ static CONSTBUFFER_HANDLE my_CONSTBUFFER_Create(const unsigned char* source, siz
             memcpy(temp, source, size);
             (*(CONSTBUFFER*)result1).buffer = temp;
         }
-        currentCONSTBUFFER_refCount = 1;
+        ((FAKE_CONSTBUFFER*)result1)->refCount = 1;
     }
     return result1;
 }
@@ -143,7 +160,7 @@ static CONSTBUFFER_HANDLE my_CONSTBUFFER_Clone(CONSTBUFFER_HANDLE constbufferHan
     else
     {
         result2 = constbufferHandle;
-        currentCONSTBUFFER_refCount++;
+        ((FAKE_CONSTBUFFER*)constbufferHandle)->refCount++;
     }
     return result2;
 }
@@ -156,8 +173,7 @@ static const CONSTBUFFER* my_CONSTBUFFER_GetContent(CONSTBUFFER_HANDLE constbuff
 
 static void my_CONSTBUFFER_Destroy(CONSTBUFFER_HANDLE constbufferHandle)
 {
-    --currentCONSTBUFFER_refCount;
-    if (currentCONSTBUFFER_refCount == 0)
+    if (--((FAKE_CONSTBUFFER*)constbufferHandle)->refCount == 0)
     {
         CONSTBUFFER * fakeBuffer = (CONSTBUFFER*)constbufferHandle;
         if (fakeBuffer->buffer != NULL)
@@ -271,6 +287,38 @@ static const unsigned char notFail__2Property_2bytes[] =
     '3', '4'
 };
 
+static const unsigned char notFail__2Property_2bytes_v2[] =
+{
+    0xA1, 0x62,             /*header*/
+    0x00, 0x00, 0x00, 42,   /*size of this array*/
+    0x02,                   /*two properties*/
+    0x05,                   /*key dictionary entry 2 (deviceName)*/
+    0x05, 'r','o','c','k','s',
+    0x18,                   /*a key of 12 bytes*/
+    'B','l','e','e','d','i','n','g','E','d','g','e',
+    0x07, 'a','w','e','s','o','m','e',
+    0x02,                   /*2 message content size*/
+    0x00, 0x00, 0x00, 0x00, /*the content starts at 40*/
+    '3', '4'
+};
+
+static const unsigned char notFail__2Property_2bytes_v2_expiry[] =
+{
+    0xA1, 0x63,             /*header of a message that expires*/
+    0x00, 0x00, 0x00, 58,   /*size of this array*/
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, /*creation time*/
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xF4, /*time to live of 500*/
+    0x02,                   /*two properties*/
+    0x05,                   /*key dictionary entry 2 (deviceName)*/
+    0x05, 'r','o','c','k','s',
+    0x18,                   /*a key of 12 bytes*/
+    'B','l','e','e','d','i','n','g','E','d','g','e',
+    0x07, 'a','w','e','s','o','m','e',
+    0x02,                   /*2 message content size*/
+    0x00, 0x00, 0x00, 0x00, /*the content starts at 56*/
+    '3', '4'
+};
+
 static const unsigned char fail_____firstByteNot0xA1[] =
 {
     0xA2, 0x60,             /*header - wrong*/
@@ -407,7 +455,6 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         whenShallConstMap_Clone_fail = 0;
         currentCONSTBUFFER_Create_call = 0;
         whenShallCONSTBUFFER_Create_fail = 0;
-        currentCONSTBUFFER_refCount = 0;
         currentCONSTBUFFER_Clone_call = 0;
         whenShallCONSTBUFFER_Clone_fail = 0;
 
@@ -727,6 +774,7 @@ BEGIN_TEST_SUITE(gwmessage_ut)
     /*Tests_SRS_MESSAGE_17_014: [On success, Message_CreateFromBuffer shall return a non-NULL handle and set the internal ref count to "1".]*/
     /*Tests_SRS_MESSAGE_17_012: [Message_CreateFromBuffer shall copy the sourceProperties to a readonly CONSTMAP.]*/
     /*Tests_SRS_MESSAGE_17_013: [Message_CreateFromBuffer shall clone the CONSTBUFFER sourceBuffer.]*/
+    /*Tests_SRS_MESSAGE_30_002: [ Message_CreateFromBuffer shall create a message that never expires. ]*/
     TEST_FUNCTION(Message_CreateFromBuffer_Success)
     {
         ///arrange
@@ -754,6 +802,7 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         ///assert
         ASSERT_IS_NOT_NULL(r);
         ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_ARE_EQUAL(size_t, 0, (size_t)Message_GetTimeToLive(r));
 
         ///cleanup
         Message_Destroy(r);
@@ -1135,6 +1184,106 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         CONSTBUFFER_Destroy(content);
     }
 
+    /*Tests_SRS_MESSAGE_30_003: [ If message is NULL then Message_GetCreationTime shall return 0. ]*/
+    /*Tests_SRS_MESSAGE_30_005: [ If message is NULL then Message_GetTimeToLive shall return 0. ]*/
+    /*Tests_SRS_MESSAGE_30_007: [ If message is NULL then Message_IsExpired shall return false. ]*/
+    TEST_FUNCTION(Message_time_to_live_getters_with_NULL_message_return_0)
+    {
+        ///arrange
+
+        ///act
+        uint64_t creationTime = Message_GetCreationTime(NULL);
+        uint64_t timeToLive = Message_GetTimeToLive(NULL);
+        bool expired = Message_IsExpired(NULL, 1000);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 0, (size_t)creationTime);
+        ASSERT_ARE_EQUAL(size_t, 0, (size_t)timeToLive);
+        ASSERT_IS_FALSE(expired);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_085: [ If cfg is NULL then Message_CreateWithTimeToLive shall return NULL. ]*/
+    TEST_FUNCTION(Message_CreateWithTimeToLive_with_NULL_parameter_fails)
+    {
+        ///arrange
+
+        ///act
+        MESSAGE_HANDLE msg = Message_CreateWithTimeToLive(NULL);
+
+        ///assert
+        ASSERT_IS_NULL(msg);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_086: [ Otherwise, Message_CreateWithTimeToLive shall create the message as Message_Create does from messageConfig, and fail the same way. ]*/
+    TEST_FUNCTION(Message_CreateWithTimeToLive_fails_when_Message_Create_would)
+    {
+        ///arrange
+        MESSAGE_TIME_TO_LIVE_CONFIG c = { { 1, NULL, (MAP_HANDLE)&c }, 1000, 500 };
+
+        ///act
+        MESSAGE_HANDLE msg = Message_CreateWithTimeToLive(&c);
+
+        ///assert
+        ASSERT_IS_NULL(msg);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_086: [ Otherwise, Message_CreateWithTimeToLive shall create the message as Message_Create does from messageConfig, and fail the same way. ]*/
+    /*Tests_SRS_MESSAGE_30_087: [ Message_CreateWithTimeToLive shall keep the creationTime and timeToLive of cfg with the message. ]*/
+    /*Tests_SRS_MESSAGE_30_004: [ Otherwise, Message_GetCreationTime shall return the creationTime the message was created with. ]*/
+    /*Tests_SRS_MESSAGE_30_006: [ Otherwise, Message_GetTimeToLive shall return the timeToLive the message was created with. ]*/
+    /*Tests_SRS_MESSAGE_30_008: [ Message_IsExpired shall return true if the timeToLive of the message is not 0 and now is at least timeToLive past its creationTime, and false otherwise. ]*/
+    TEST_FUNCTION(Message_IsExpired_once_time_to_live_has_passed)
+    {
+        ///arrange
+        MESSAGE_TIME_TO_LIVE_CONFIG c = { { 0, NULL, (MAP_HANDLE)&c }, 1000, 500 };
+        MESSAGE_HANDLE msg = Message_CreateWithTimeToLive(&c);
+        umock_c_reset_all_calls();
+
+        ///act
+        uint64_t creationTime = Message_GetCreationTime(msg);
+        uint64_t timeToLive = Message_GetTimeToLive(msg);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 1000, (size_t)creationTime);
+        ASSERT_ARE_EQUAL(size_t, 500, (size_t)timeToLive);
+        ASSERT_IS_FALSE(Message_IsExpired(msg, 900));
+        ASSERT_IS_FALSE(Message_IsExpired(msg, 1499));
+        ASSERT_IS_TRUE(Message_IsExpired(msg, 1500));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(msg);
+    }
+
+    /*Tests_SRS_MESSAGE_30_001: [ Message_Create shall create a message that never expires. ]*/
+    /*Tests_SRS_MESSAGE_30_008: [ Message_IsExpired shall return true if the timeToLive of the message is not 0 and now is at least timeToLive past its creationTime, and false otherwise. ]*/
+    TEST_FUNCTION(Message_IsExpired_is_false_without_time_to_live)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE msg = Message_Create(&c);
+        umock_c_reset_all_calls();
+
+        ///act
+        bool expired = Message_IsExpired(msg, UINT64_MAX);
+
+        ///assert
+        ASSERT_IS_FALSE(expired);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(msg);
+    }
+
     /*Tests_SRS_MESSAGE_02_017: [If message is NULL then Message_Destroy shall do nothing.] */
     TEST_FUNCTION(Message_Destroy_with_NULL_argument_does_nothing)
     {
@@ -1178,6 +1327,71 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         ///cleanup
     }
 
+    /*Tests_SRS_MESSAGE_30_009: [ Message_EnableThreadCache shall make the calling thread keep the blocks of up to MESSAGE_THREAD_CACHE_SIZE messages it frees in its message cache instead of freeing them. ]*/
+    /*Tests_SRS_MESSAGE_30_010: [ Message_Create, Message_CreateFromBuffer and Message_CreateFromByteArray shall take the block of the message from the message cache of the calling thread when it is not empty, instead of allocating it, and set its ref count to "1". ]*/
+    TEST_FUNCTION(Message_Create_reuses_the_block_of_a_message_destroyed_with_the_thread_cache_enabled)
+    {
+        ///arrange
+        char t = '3';
+        MESSAGE_CONFIG c = { sizeof(t), (unsigned char*)&t, (MAP_HANDLE)&c };
+        Message_EnableThreadCache();
+        MESSAGE_HANDLE destroyed = Message_Create(&c);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_Destroy(IGNORED_PTR_ARG)) /*this is the map, the handle is kept*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG)) /*this is the buffer*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Create((unsigned char*)&t, sizeof(t))); /*no malloc for the handle*/
+        STRICT_EXPECTED_CALL(ConstMap_Create((MAP_HANDLE)&c));
+
+        ///act
+        Message_Destroy(destroyed);
+        MESSAGE_HANDLE msg = Message_Create(&c);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(msg);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)destroyed, (void*)msg);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(msg);
+        Message_DisableThreadCache();
+    }
+
+    /*Tests_SRS_MESSAGE_30_012: [ Message_DisableThreadCache shall free the blocks in the message cache of the calling thread and stop keeping blocks in it. ]*/
+    /*Tests_SRS_MESSAGE_30_011: [ When the message cache of the calling thread is not enabled or is full, freeing a message shall free its block. ]*/
+    TEST_FUNCTION(Message_DisableThreadCache_frees_the_cached_blocks)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        Message_EnableThreadCache();
+        Message_Destroy(Message_Create(&c));
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the cached handle*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*the cache is empty*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(NULL, 0));
+        STRICT_EXPECTED_CALL(ConstMap_Create((MAP_HANDLE)&c));
+        STRICT_EXPECTED_CALL(ConstMap_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the cache is disabled*/
+            .IgnoreArgument(1);
+
+        ///act
+        Message_DisableThreadCache();
+        Message_Destroy(Message_Create(&c));
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
     /*Tests_SRS_MESSAGE_02_022: [ If source is NULL then Message_CreateFromByteArray shall fail and return NULL. ]*/
     TEST_FUNCTION(Message_CreateFromByteArray_with_NULL_source_fails)
     {
@@ -2150,4 +2364,1682 @@ BEGIN_TEST_SUITE(gwmessage_ut)
         Message_Destroy(messageHandle);
     }
 
+    /*Tests_SRS_MESSAGE_30_013: [ If the first two bytes of source are 0xA1 0x62, Message_CreateFromByteArray shall parse source as a GATEWAY_MESSAGE_VERSION_2 serialization instead, and fail and return NULL if size is smaller than 8. ]*/
+    /*Tests_SRS_MESSAGE_30_015: [ A key whose varint k is odd shall be the entry k >> 1 of the key dictionary, otherwise the k >> 1 bytes that follow; values shall be a varint length followed by as many bytes. ]*/
+    /*Tests_SRS_MESSAGE_30_016: [ The content shall start at the first position, after the content size, that is a multiple of 8 from the start of the array, and shall end at the end of the array. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArray_notFail__2Property_2bytes_v2)
+    {
+        ///arrange
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
+            .IgnoreArgument_mapFilterFunc()
+            .SetReturn(TEST_MAP_HANDLE);
+        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreAllCalls();
+        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "deviceName", "rocks"));
+        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "BleedingEdge", "awesome"));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(notFail__2Property_2bytes_v2 + 40, 2));
+        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the property scratch buffer*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__2Property_2bytes_v2, sizeof(notFail__2Property_2bytes_v2));
+
+        ///assert
+        ASSERT_IS_NOT_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(handle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_014: [ If the size embedded in a version 2 serialization is not size, if a read would occur past the end of the array, if a varint is longer than 5 bytes or does not fit in 32 bits, or if a key refers to an entry past the end of the key dictionary, Message_CreateFromByteArray shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArray_v2_with_an_unknown_key_dictionary_entry_fails)
+    {
+        ///arrange
+        unsigned char source[sizeof(notFail__2Property_2bytes_v2)];
+        (void)memcpy(source, notFail__2Property_2bytes_v2, sizeof(source));
+        source[7] = 0x7F; /*key dictionary entry 63*/
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
+            .IgnoreArgument_mapFilterFunc()
+            .SetReturn(TEST_MAP_HANDLE);
+        STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(source)));
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArray(source, sizeof(source));
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_014: [ If the size embedded in a version 2 serialization is not size, if a read would occur past the end of the array, if a varint is longer than 5 bytes or does not fit in 32 bits, or if a key refers to an entry past the end of the key dictionary, Message_CreateFromByteArray shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArray_v2_with_size_mismatch_fails)
+    {
+        ///arrange
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__2Property_2bytes_v2, sizeof(notFail__2Property_2bytes_v2) - 1);
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_089: [ If the second byte of source is 0x63, the array size shall be followed by the creation time and the time to live of the message, 8 bytes each, most significant byte first. ]*/
+    /*Tests_SRS_MESSAGE_30_090: [ The message shall have the creation time and time to live of the serialization, and never expire when it has none. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArray_v2_restores_the_expiry)
+    {
+        ///arrange
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
+            .IgnoreArgument_mapFilterFunc()
+            .SetReturn(TEST_MAP_HANDLE);
+        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreAllCalls();
+        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "deviceName", "rocks"));
+        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "BleedingEdge", "awesome"));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(notFail__2Property_2bytes_v2_expiry + 56, 2));
+        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*this is the property scratch buffer*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArray(notFail__2Property_2bytes_v2_expiry, sizeof(notFail__2Property_2bytes_v2_expiry));
+
+        ///assert
+        ASSERT_IS_NOT_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_IS_TRUE(Message_GetCreationTime(handle) == 0x0102030405060708ULL);
+        ASSERT_ARE_EQUAL(size_t, 500, (size_t)Message_GetTimeToLive(handle));
+
+        ///cleanup
+        Message_Destroy(handle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_014: [ If the size embedded in a version 2 serialization is not size, if a read would occur past the end of the array, if a varint is longer than 5 bytes or does not fit in 32 bits, or if a key refers to an entry past the end of the key dictionary, Message_CreateFromByteArray shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArray_v2_with_a_truncated_expiry_fails)
+    {
+        ///arrange
+        static const unsigned char source[] =
+        {
+            0xA1, 0x63,             /*header of a message that expires*/
+            0x00, 0x00, 0x00, 12,   /*size of this array*/
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00 /*6 of the 16 bytes of the expiry*/
+        };
+        umock_c_reset_all_calls();
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArray(source, sizeof(source));
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_018: [ If version is neither GATEWAY_MESSAGE_VERSION_1 nor GATEWAY_MESSAGE_VERSION_2, Message_ToByteArrayWithVersion shall fail and return -1. ]*/
+    TEST_FUNCTION(Message_ToByteArrayWithVersion_fails_with_an_unknown_version)
+    {
+        ///arrange
+        umock_c_reset_all_calls();
+
+        ///act
+        int32_t size = Message_ToByteArrayWithVersion(TEST_MESSAGE_HANDLE, 3, NULL, 0);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int32_t, -1, size);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_019: [ For GATEWAY_MESSAGE_VERSION_2, Message_ToByteArrayWithVersion shall write the layout of a version 2 serialization, writing a key as its index in the key dictionary when the key is in it. ]*/
+    TEST_FUNCTION(Message_ToByteArrayWithVersion_2_with_properties_and_content_happy_path)
+    {
+        ///arrange
+        char t[] = { '3', '4' };
+        MESSAGE_CONFIG c = { sizeof(t), (unsigned char*)t, TEST_MAP_HANDLE };
+        MESSAGE_HANDLE messageHandle = Message_Create(&c);
+        unsigned char buf[sizeof(notFail__2Property_2bytes_v2)];
+        umock_c_reset_all_calls();
+
+        size_t two = 2;
+        const char* keys[] = { "deviceName", "BleedingEdge" };
+        const char* values[] = { "rocks", "awesome" };
+        const char* const* *pkeys = (const char* const* *)&keys;
+        const char* const* *pvalues = (const char* const* *)&values;
+
+        const CONSTBUFFER bufferContent = { (const unsigned char*)"34", 2 };
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .CopyOutArgumentBuffer(2, &pkeys, sizeof(char**))
+            .CopyOutArgumentBuffer(3, &pvalues, sizeof(char**))
+            .CopyOutArgumentBuffer(4, &two, sizeof(two));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
+            .IgnoreArgument_constbufferHandle()
+            .SetReturn(&bufferContent);
+
+        ///act
+        int32_t nbytes = Message_ToByteArrayWithVersion(messageHandle, GATEWAY_MESSAGE_VERSION_2, buf, sizeof(buf));
+
+        ///assert
+        ASSERT_ARE_EQUAL(int32_t, sizeof(notFail__2Property_2bytes_v2), nbytes);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(buf, notFail__2Property_2bytes_v2, sizeof(buf)));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_091: [ For GATEWAY_MESSAGE_VERSION_2, Message_ToByteArrayWithVersion shall write the creation time and time to live of a message that expires, starting the serialization with 0xA1 0x63. ]*/
+    TEST_FUNCTION(Message_ToByteArrayWithVersion_2_writes_the_expiry_of_a_message_that_expires)
+    {
+        ///arrange
+        char t[] = { '3', '4' };
+        MESSAGE_TIME_TO_LIVE_CONFIG c = { { sizeof(t), (unsigned char*)t, TEST_MAP_HANDLE }, 0x0102030405060708ULL, 500 };
+        MESSAGE_HANDLE messageHandle = Message_CreateWithTimeToLive(&c);
+        unsigned char buf[sizeof(notFail__2Property_2bytes_v2_expiry)];
+        umock_c_reset_all_calls();
+
+        size_t two = 2;
+        const char* keys[] = { "deviceName", "BleedingEdge" };
+        const char* values[] = { "rocks", "awesome" };
+        const char* const* *pkeys = (const char* const* *)&keys;
+        const char* const* *pvalues = (const char* const* *)&values;
+
+        const CONSTBUFFER bufferContent = { (const unsigned char*)"34", 2 };
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .CopyOutArgumentBuffer(2, &pkeys, sizeof(char**))
+            .CopyOutArgumentBuffer(3, &pvalues, sizeof(char**))
+            .CopyOutArgumentBuffer(4, &two, sizeof(two));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
+            .IgnoreArgument_constbufferHandle()
+            .SetReturn(&bufferContent);
+
+        ///act
+        int32_t nbytes = Message_ToByteArrayWithVersion(messageHandle, GATEWAY_MESSAGE_VERSION_2, buf, sizeof(buf));
+
+        ///assert
+        ASSERT_ARE_EQUAL(int32_t, sizeof(notFail__2Property_2bytes_v2_expiry), nbytes);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(buf, notFail__2Property_2bytes_v2_expiry, sizeof(buf)));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(messageHandle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_020: [ If message is NULL or version is neither GATEWAY_MESSAGE_VERSION_1 nor GATEWAY_MESSAGE_VERSION_2, Message_GetSerialization shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_GetSerialization_with_NULL_message_or_unknown_version_fails)
+    {
+        ///arrange
+        umock_c_reset_all_calls();
+
+        ///act
+        CONSTBUFFER_HANDLE s1 = Message_GetSerialization(NULL, GATEWAY_MESSAGE_VERSION_1);
+        CONSTBUFFER_HANDLE s2 = Message_GetSerialization(TEST_MESSAGE_HANDLE, 3);
+
+        ///assert
+        ASSERT_IS_NULL(s1);
+        ASSERT_IS_NULL(s2);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_021: [ The first time a version is asked for, Message_GetSerialization shall serialize message as Message_ToByteArrayWithVersion does into a new CONSTBUFFER and keep it with the message. ]*/
+    /*Tests_SRS_MESSAGE_30_025: [ Otherwise Message_GetSerialization shall return a clone of the serialization kept with the message, which the caller destroys with CONSTBUFFER_Destroy. ]*/
+    TEST_FUNCTION(Message_GetSerialization_serializes_the_message_once)
+    {
+        ///arrange
+        static const unsigned char expected[] =
+        {
+            0xA1, 0x60,             /*header*/
+            0x00, 0x00, 0x00, 15,   /*size of this array*/
+            0x00, 0x00, 0x00, 0x00, /*zero properties*/
+            0x00, 0x00, 0x00, 0x01, /*1 message content size*/
+            '3'
+        };
+        char t = '3';
+        MESSAGE_CONFIG c = { sizeof(t), (unsigned char*)&t, TEST_MAP_HANDLE };
+        MESSAGE_HANDLE msg = Message_Create(&c);
+        umock_c_reset_all_calls();
+
+        size_t zero = 0;
+        const char* const* noStrings = NULL;
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .CopyOutArgumentBuffer(2, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(3, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(expected)));
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .CopyOutArgumentBuffer(2, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(3, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, sizeof(expected)))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(IGNORED_PTR_ARG)) /*the second time, the message is not serialized again*/
+            .IgnoreArgument(1);
+
+        ///act
+        CONSTBUFFER_HANDLE s1 = Message_GetSerialization(msg, GATEWAY_MESSAGE_VERSION_1);
+        CONSTBUFFER_HANDLE s2 = Message_GetSerialization(msg, GATEWAY_MESSAGE_VERSION_1);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(s1);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)s1, (void*)s2);
+        ASSERT_ARE_EQUAL(size_t, sizeof(expected), CONSTBUFFER_GetContent(s1)->size);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(expected, CONSTBUFFER_GetContent(s1)->buffer, sizeof(expected)));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        CONSTBUFFER_Destroy(s1);
+        CONSTBUFFER_Destroy(s2);
+        Message_Destroy(msg);
+    }
+
+    /*Tests_SRS_MESSAGE_30_024: [ When the ref count of the message reaches zero, Message_Destroy shall destroy the serializations kept with the message. ]*/
+    TEST_FUNCTION(Message_Destroy_destroys_the_kept_serialization)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, TEST_MAP_HANDLE };
+        MESSAGE_HANDLE msg = Message_Create(&c);
+        size_t zero = 0;
+        const char* const* noStrings = NULL;
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .CopyOutArgumentBuffer(2, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(3, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .CopyOutArgumentBuffer(2, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(3, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        CONSTBUFFER_Destroy(Message_GetSerialization(msg, GATEWAY_MESSAGE_VERSION_1));
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG)) /*this is the content*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG)) /*this is the serialization*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        Message_Destroy(msg);
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_026: [ If release is NULL, Message_CreateFromByteArrayWithRelease shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArrayWithRelease_with_NULL_release_fails)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(notFail__2Property_2bytes));
+        memcpy(source, notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        umock_c_reset_all_calls();
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayWithRelease(source, sizeof(notFail__2Property_2bytes), NULL);
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        free(source);
+    }
+
+    /*Tests_SRS_MESSAGE_30_027: [ Message_CreateFromByteArrayWithRelease shall parse source as Message_CreateFromByteArray does, but the content of the message shall point into source instead of being copied, and fail and return NULL, leaving source to the caller, where Message_CreateFromByteArray would. ]*/
+    /*Tests_SRS_MESSAGE_30_028: [ On success, the message shall own source. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArrayWithRelease_does_not_copy_the_content)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(notFail__2Property_2bytes));
+        memcpy(source, notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        released_buffer_count = 0;
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(Map_Create(IGNORED_PTR_ARG))
+            .IgnoreArgument_mapFilterFunc()
+            .SetReturn(TEST_MAP_HANDLE);
+        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "BleedingEdge", "rocks"));
+        STRICT_EXPECTED_CALL(Map_Add(TEST_MAP_HANDLE, "Azure IoT Gateway is", "awesome"));
+        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreAllCalls();
+        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayWithRelease(source, sizeof(notFail__2Property_2bytes), test_release_buffer);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(handle);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_ARE_EQUAL(void_ptr, (void*)(source + sizeof(notFail__2Property_2bytes) - 2), (void*)Message_GetContent(handle)->buffer);
+        ASSERT_ARE_EQUAL(size_t, 2, Message_GetContent(handle)->size);
+        ASSERT_ARE_EQUAL(size_t, 0, released_buffer_count);
+
+        ///cleanup
+        Message_Destroy(handle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_027: [ Message_CreateFromByteArrayWithRelease shall parse source as Message_CreateFromByteArray does, but the content of the message shall point into source instead of being copied, and fail and return NULL, leaving source to the caller, where Message_CreateFromByteArray would. ]*/
+    TEST_FUNCTION(Message_CreateFromByteArrayWithRelease_leaves_the_byte_array_to_the_caller_when_it_fails)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(notFail__2Property_2bytes));
+        memcpy(source, notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        source[1] = 0x61;
+        released_buffer_count = 0;
+        umock_c_reset_all_calls();
+
+        ///act
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayWithRelease(source, sizeof(notFail__2Property_2bytes), test_release_buffer);
+
+        ///assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_ARE_EQUAL(size_t, 0, released_buffer_count);
+
+        ///cleanup
+        free(source);
+    }
+
+    /*Tests_SRS_MESSAGE_30_029: [ When the ref count of the message reaches zero, Message_Destroy shall call release with the byte array given to Message_CreateFromByteArrayWithRelease. ]*/
+    TEST_FUNCTION(Message_Destroy_releases_the_owned_byte_array_with_the_last_reference)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(notFail__2Property_2bytes));
+        memcpy(source, notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        released_buffer_count = 0;
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayWithRelease(source, sizeof(notFail__2Property_2bytes), test_release_buffer);
+        MESSAGE_HANDLE clone = Message_Clone(handle);
+        umock_c_reset_all_calls();
+
+        ///act
+        Message_Destroy(clone);
+        size_t released_after_clone = released_buffer_count;
+        Message_Destroy(handle);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 0, released_after_clone);
+        ASSERT_ARE_EQUAL(size_t, 1, released_buffer_count);
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_030: [ If the content of message points into a byte array it owns, Message_GetContentHandle shall return a new CONSTBUFFER_HANDLE with a copy of the content. ]*/
+    TEST_FUNCTION(Message_GetContentHandle_copies_the_content_of_an_owned_byte_array)
+    {
+        ///arrange
+        unsigned char* source = (unsigned char*)malloc(sizeof(notFail__2Property_2bytes));
+        memcpy(source, notFail__2Property_2bytes, sizeof(notFail__2Property_2bytes));
+        MESSAGE_HANDLE handle = Message_CreateFromByteArrayWithRelease(source, sizeof(notFail__2Property_2bytes), test_release_buffer);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(source + sizeof(notFail__2Property_2bytes) - 2, 2));
+
+        ///act
+        CONSTBUFFER_HANDLE content = Message_GetContentHandle(handle);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(content);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        CONSTBUFFER_Destroy(content);
+        Message_Destroy(handle);
+    }
+
+    /*Tests_SRS_MESSAGE_30_031: [ If base is NULL, if adds is NULL and addCount is not zero, if removes is NULL and removeCount is not zero, or if any key, value or name to remove is NULL, Message_CreateDerived shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerived_with_NULL_base_fails)
+    {
+        ///arrange
+        MESSAGE_PROPERTY adds[] = { { "deviceName", "d" } };
+        umock_c_reset_all_calls();
+
+        ///act
+        MESSAGE_HANDLE derived = Message_CreateDerived(NULL, adds, 1, NULL, 0);
+
+        ///assert
+        ASSERT_IS_NULL(derived);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_MESSAGE_30_031: [ If base is NULL, if adds is NULL and addCount is not zero, if removes is NULL and removeCount is not zero, or if any key, value or name to remove is NULL, Message_CreateDerived shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerived_with_NULL_value_fails)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_PROPERTY adds[] = { { "deviceName", "d" }, { "deviceKey", NULL } };
+        umock_c_reset_all_calls();
+
+        ///act
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, adds, 2, NULL, 0);
+
+        ///assert
+        ASSERT_IS_NULL(derived);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_034: [ If any allocation fails, Message_CreateDerived shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerived_fails_when_the_overlay_cannot_be_allocated)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_PROPERTY adds[] = { { "deviceName", "d" } };
+        umock_c_reset_all_calls();
+
+        whenShallmalloc_fail = currentmalloc_call + 1;
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, adds, 1, NULL, 0);
+
+        ///assert
+        ASSERT_IS_NULL(derived);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_032: [ Otherwise, Message_CreateDerived shall return a non-NULL handle with its ref count set to "1", which keeps a clone of base and shares its content and properties, storing only copies of adds and removes. ]*/
+    /*Tests_SRS_MESSAGE_30_033: [ Message_CreateDerived shall give the message the creationTime and timeToLive of base. ]*/
+    TEST_FUNCTION(Message_CreateDerived_shares_the_content_and_properties_of_its_base)
+    {
+        ///arrange
+        unsigned char content[] = { 1, 2, 3 };
+        MESSAGE_TIME_TO_LIVE_CONFIG c = { { sizeof(content), content, (MAP_HANDLE)&c }, 1000, 500 };
+        MESSAGE_HANDLE base = Message_CreateWithTimeToLive(&c);
+        MESSAGE_PROPERTY adds[] = { { "deviceName", "d" } };
+        const char* removes[] = { "macAddress" };
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*the overlay*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*the message*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(ConstMap_Clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, adds, 1, removes, 1);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(derived);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_ARE_EQUAL(void_ptr, (void*)Message_GetContent(base)->buffer, (void*)Message_GetContent(derived)->buffer);
+        ASSERT_ARE_EQUAL(size_t, sizeof(content), Message_GetContent(derived)->size);
+        ASSERT_ARE_EQUAL(size_t, 1000, (size_t)Message_GetCreationTime(derived));
+        ASSERT_ARE_EQUAL(size_t, 500, (size_t)Message_GetTimeToLive(derived));
+
+        ///cleanup
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_035: [ The properties of the message shall be the ones of base, without the ones named in removes, and with the ones in adds, the last one winning when a key is added more than once. ]*/
+    /*Tests_SRS_MESSAGE_30_041: [ Otherwise, Message_GetPropertyValue shall return the value of the property key of message, or NULL if it does not have it, without cloning its properties. ]*/
+    TEST_FUNCTION(Message_GetPropertyValue_looks_through_the_overlay_of_a_derived_message)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_PROPERTY adds[] = { { "deviceName", "d1" }, { "macAddress", "m" }, { "deviceName", "d2" } };
+        const char* removes[] = { "macAddress", "deviceKey" };
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, adds, 3, removes, 2);
+        size_t one = 1;
+        const char* keys[] = { "source" };
+        const char* values[] = { "ble" };
+        const char* const* *pkeys = (const char* const* *)&keys;
+        const char* const* *pvalues = (const char* const* *)&values;
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .CopyOutArgumentBuffer(2, &pkeys, sizeof(char**))
+            .CopyOutArgumentBuffer(3, &pvalues, sizeof(char**))
+            .CopyOutArgumentBuffer(4, &one, sizeof(one));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*the index of the base*/
+            .IgnoreArgument(1);
+
+        ///act
+        const char* deviceName = Message_GetPropertyValue(derived, "deviceName");
+        const char* macAddress = Message_GetPropertyValue(derived, "macAddress");
+        const char* deviceKey = Message_GetPropertyValue(derived, "deviceKey");
+        const char* source = Message_GetPropertyValue(derived, "source");
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, "d2", deviceName);
+        ASSERT_ARE_EQUAL(char_ptr, "m", macAddress);
+        ASSERT_IS_NULL(deviceKey);
+        ASSERT_ARE_EQUAL(char_ptr, "ble", source);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_042: [ The first time Message_GetPropertyValue looks up a property of a message, it shall build a hash index over the keys of its properties and keep it with the message; if another thread kept one first, the index built shall be freed and the one kept used instead. ]*/
+    /*Tests_SRS_MESSAGE_30_043: [ Message_GetPropertyValue shall find the property through the hash index of the message, comparing the interned keys as integers, and by name among the properties whose keys were not interned when the index was built. ]*/
+    /*Tests_SRS_MESSAGE_30_046: [ Building the index of a message shall index the keys of its properties that are in the key table of the process, without adding any key to it; the other properties shall be compared by name. ]*/
+    TEST_FUNCTION(Message_GetPropertyValue_builds_the_property_index_once)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE aMessage = Message_Create(&c);
+        size_t count = 20;
+        const char* keys[] = {
+            "source", "macAddress", "deviceName", "deviceKey", "deviceFunction",
+            "timestamp", "characteristicUUID", "k7", "k8", "k9",
+            "k10", "k11", "k12", "k13", "k14",
+            "k15", "k16", "k17", "k18", "k19" };
+        const char* values[] = {
+            "v0", "v1", "v2", "v3", "v4",
+            "v5", "v6", "v7", "v8", "v9",
+            "v10", "v11", "v12", "v13", "v14",
+            "v15", "v16", "v17", "v18", "v19" };
+        const char* const* *pkeys = (const char* const* *)&keys;
+        const char* const* *pvalues = (const char* const* *)&values;
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .CopyOutArgumentBuffer(2, &pkeys, sizeof(char**))
+            .CopyOutArgumentBuffer(3, &pvalues, sizeof(char**))
+            .CopyOutArgumentBuffer(4, &count, sizeof(count));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*the index*/
+            .IgnoreArgument(1);
+
+        ///act
+        const char* first = Message_GetPropertyValue(aMessage, "source");
+        MESSAGE_HANDLE clone = Message_Clone(aMessage);
+        const char* last = Message_GetPropertyValue(clone, "k19");
+        const char* deviceKey = Message_GetPropertyValue(aMessage, "deviceKey");
+        const char* missing = Message_GetPropertyValue(aMessage, "k20");
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, "v0", first);
+        ASSERT_ARE_EQUAL(char_ptr, "v19", last);
+        ASSERT_ARE_EQUAL(char_ptr, "v3", deviceKey);
+        ASSERT_IS_NULL(missing);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_ARE_EQUAL(char_ptr, "v19", Message_GetPropertyValueByKey(aMessage, Message_InternKey("k19")));
+
+        ///cleanup
+        Message_Destroy(clone);
+        Message_Destroy(aMessage);
+    }
+
+    /*Tests_SRS_MESSAGE_30_044: [ If the index cannot be built, Message_GetPropertyValue shall look the property up in the CONSTMAP of the message. ]*/
+    /*Tests_SRS_MESSAGE_30_047: [ If the index of a message cannot be built, the message shall be marked as having no index, and the index shall not be built again. ]*/
+    TEST_FUNCTION(Message_GetPropertyValue_looks_in_the_properties_when_the_index_cannot_be_built)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE aMessage = Message_Create(&c);
+        size_t zero = 0;
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .IgnoreArgument_keys()
+            .IgnoreArgument_values()
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        whenShallmalloc_fail = currentmalloc_call + 1;
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(ConstMap_GetValue(IGNORED_PTR_ARG, "source"))
+            .IgnoreArgument(1)
+            .SetReturn("ble");
+        STRICT_EXPECTED_CALL(ConstMap_GetValue(IGNORED_PTR_ARG, "deviceName"))
+            .IgnoreArgument(1)
+            .SetReturn("d");
+
+        ///act
+        const char* source = Message_GetPropertyValue(aMessage, "source");
+        const char* deviceName = Message_GetPropertyValue(aMessage, "deviceName");
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, "ble", source);
+        ASSERT_ARE_EQUAL(char_ptr, "d", deviceName);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(aMessage);
+    }
+
+    /*Tests_SRS_MESSAGE_30_045: [ When the ref count of the message reaches zero, Message_Destroy shall free the property index kept with the message. ]*/
+    TEST_FUNCTION(Message_Destroy_frees_the_property_index)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE aMessage = Message_Create(&c);
+        size_t zero = 0;
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .IgnoreArgument_keys()
+            .IgnoreArgument_values()
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        (void)Message_GetPropertyValue(aMessage, "source");
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the index*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the message*/
+            .IgnoreArgument(1);
+
+        ///act
+        Message_Destroy(aMessage);
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    }
+
+    /*Tests_SRS_MESSAGE_30_049: [ If key is NULL then Message_InternKey shall return MESSAGE_KEY_NONE. ]*/
+    TEST_FUNCTION(Message_InternKey_with_NULL_key_returns_MESSAGE_KEY_NONE)
+    {
+        ///arrange
+
+        ///act
+        MESSAGE_KEY key = Message_InternKey(NULL);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, (size_t)MESSAGE_KEY_NONE, (size_t)key);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    }
+
+    /*Tests_SRS_MESSAGE_30_051: [ The well-known keys shall have the MESSAGE_KEY_* values declared in message.h. ]*/
+    TEST_FUNCTION(Message_InternKey_returns_the_well_known_keys)
+    {
+        ///arrange
+
+        ///act
+        MESSAGE_KEY source = Message_InternKey("source");
+        MESSAGE_KEY deviceName = Message_InternKey("deviceName");
+        MESSAGE_KEY deliveryStatus = Message_InternKey("iotHubMessageDeliveryStatus");
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, (size_t)MESSAGE_KEY_SOURCE, (size_t)source);
+        ASSERT_ARE_EQUAL(size_t, (size_t)MESSAGE_KEY_DEVICE_NAME, (size_t)deviceName);
+        ASSERT_ARE_EQUAL(size_t, (size_t)MESSAGE_KEY_IOTHUB_MESSAGE_DELIVERY_STATUS, (size_t)deliveryStatus);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    }
+
+    /*Tests_SRS_MESSAGE_30_050: [ Otherwise, Message_InternKey shall return the MESSAGE_KEY of key, the same for all the calls with the same name, adding key to the key table of the process if it is not there. ]*/
+    TEST_FUNCTION(Message_InternKey_returns_the_same_key_for_the_same_name)
+    {
+        ///arrange
+        char name[] = "internedOnce";
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*the entry of the key*/
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_KEY first = Message_InternKey(name);
+        MESSAGE_KEY second = Message_InternKey("internedOnce");
+        MESSAGE_KEY other = Message_InternKey("source");
+
+        ///assert
+        ASSERT_ARE_NOT_EQUAL(size_t, (size_t)MESSAGE_KEY_NONE, (size_t)first);
+        ASSERT_ARE_EQUAL(size_t, (size_t)first, (size_t)second);
+        ASSERT_ARE_NOT_EQUAL(size_t, (size_t)first, (size_t)other);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    }
+
+    /*Tests_SRS_MESSAGE_30_052: [ If key cannot be allocated, or none of the MESSAGE_KEY_MAX_PROBES slots of the key table it may go in is free, Message_InternKey shall return MESSAGE_KEY_NONE. ]*/
+    TEST_FUNCTION(Message_InternKey_fails_when_the_key_cannot_be_allocated)
+    {
+        ///arrange
+        whenShallmalloc_fail = currentmalloc_call + 1;
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_KEY key = Message_InternKey("neverInterned");
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, (size_t)MESSAGE_KEY_NONE, (size_t)key);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    }
+
+    /*Tests_SRS_MESSAGE_30_052: [ If key cannot be allocated, or none of the MESSAGE_KEY_MAX_PROBES slots of the key table it may go in is free, Message_InternKey shall return MESSAGE_KEY_NONE. ]*/
+    /*Tests_SRS_MESSAGE_30_088: [ Looking a key up in the key table of the process shall compare it with at most MESSAGE_KEY_MAX_PROBES keys. ]*/
+    TEST_FUNCTION(Message_InternKey_fails_when_the_slots_of_the_key_are_taken)
+    {
+        ///arrange
+        char names[MESSAGE_KEY_MAX_PROBES + 1][16];
+        size_t found = 0;
+        unsigned int candidate;
+        /*the key table hashes the names with 32-bit FNV-1a; collect names that all start probing at the same slot*/
+        for (candidate = 0; found < MESSAGE_KEY_MAX_PROBES + 1; candidate++)
+        {
+            char name[16];
+            uint32_t hash = 2166136261u;
+            const char* c;
+            (void)sprintf(name, "probe%u", candidate);
+            for (c = name; *c != '\0'; c++)
+            {
+                hash ^= (unsigned char)*c;
+                hash *= 16777619u;
+            }
+            if ((hash & (MESSAGE_KEY_TABLE_SIZE - 1)) == 0)
+            {
+                (void)strcpy(names[found], name);
+                found++;
+            }
+        }
+        for (found = 0; found < MESSAGE_KEY_MAX_PROBES; found++)
+        {
+            (void)Message_InternKey(names[found]);
+        }
+        umock_c_reset_all_calls();
+
+        ///act
+        MESSAGE_KEY key = Message_InternKey(names[MESSAGE_KEY_MAX_PROBES]);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, (size_t)MESSAGE_KEY_NONE, (size_t)key);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    }
+
+    /*Tests_SRS_MESSAGE_30_054: [ Otherwise, Message_GetPropertyValueByKey shall return the value of the property key of message as Message_GetPropertyValue does. ]*/
+    /*Tests_SRS_MESSAGE_30_048: [ Message_CreateDerived shall look the keys of adds and removes up in the key table of the process, without adding them to it; the keys that are not there shall be compared by name. ]*/
+    TEST_FUNCTION(Message_GetPropertyValueByKey_finds_the_property)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_PROPERTY adds[] = { { "byKeyName", "v" } };
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, adds, 1, NULL, 0);
+        size_t one = 1;
+        const char* keys[] = { "source" };
+        const char* values[] = { "ble" };
+        const char* const* *pkeys = (const char* const* *)&keys;
+        const char* const* *pvalues = (const char* const* *)&values;
+        MESSAGE_KEY byKeyName = Message_InternKey("byKeyName");
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .CopyOutArgumentBuffer(2, &pkeys, sizeof(char**))
+            .CopyOutArgumentBuffer(3, &pvalues, sizeof(char**))
+            .CopyOutArgumentBuffer(4, &one, sizeof(one));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*the index of the base*/
+            .IgnoreArgument(1);
+
+        ///act
+        const char* name = Message_GetPropertyValueByKey(derived, byKeyName);
+        const char* source = Message_GetPropertyValueByKey(derived, MESSAGE_KEY_SOURCE);
+        const char* deviceName = Message_GetPropertyValueByKey(derived, MESSAGE_KEY_DEVICE_NAME);
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, "v", name);
+        ASSERT_ARE_EQUAL(char_ptr, "ble", source);
+        ASSERT_IS_NULL(deviceName);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_053: [ If message is NULL or key was not returned by Message_InternKey then Message_GetPropertyValueByKey shall return NULL. ]*/
+    TEST_FUNCTION(Message_GetPropertyValueByKey_with_a_key_never_interned_returns_NULL)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE aMessage = Message_Create(&c);
+        umock_c_reset_all_calls();
+
+        ///act
+        const char* none = Message_GetPropertyValueByKey(aMessage, MESSAGE_KEY_NONE);
+        const char* unknown = Message_GetPropertyValueByKey(aMessage, (MESSAGE_KEY)(MESSAGE_KEY_TABLE_SIZE + 100));
+
+        ///assert
+        ASSERT_IS_NULL(none);
+        ASSERT_IS_NULL(unknown);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(aMessage);
+    }
+
+    /*Tests_SRS_MESSAGE_30_055: [ If base is NULL, if adds is NULL and addCount is not zero, if removes is NULL and removeCount is not zero, if any key or name to remove is NULL, or if any value has an unknown type, is a NULL string or NULL bytes of non-zero size, Message_CreateDerivedWithValues shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerivedWithValues_with_invalid_values_fails)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_TYPED_PROPERTY nullString[1];
+        MESSAGE_TYPED_PROPERTY nullBytes[1];
+        nullString[0].key = "deviceName";
+        nullString[0].value.type = MESSAGE_VALUE_STRING;
+        nullString[0].value.value.string = NULL;
+        nullBytes[0].key = "deviceKey";
+        nullBytes[0].value.type = MESSAGE_VALUE_BYTES;
+        nullBytes[0].value.value.bytes.buffer = NULL;
+        nullBytes[0].value.value.bytes.size = 1;
+        umock_c_reset_all_calls();
+
+        ///act
+        MESSAGE_HANDLE withNullBase = Message_CreateDerivedWithValues(NULL, NULL, 0, NULL, 0);
+        MESSAGE_HANDLE withNullString = Message_CreateDerivedWithValues(base, nullString, 1, NULL, 0);
+        MESSAGE_HANDLE withNullBytes = Message_CreateDerivedWithValues(base, nullBytes, 1, NULL, 0);
+
+        ///assert
+        ASSERT_IS_NULL(withNullBase);
+        ASSERT_IS_NULL(withNullString);
+        ASSERT_IS_NULL(withNullBytes);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_057: [ If any allocation fails, Message_CreateDerivedWithValues shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateDerivedWithValues_fails_when_the_overlay_cannot_be_allocated)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_TYPED_PROPERTY adds[1];
+        adds[0].key = "timestamp";
+        adds[0].value.type = MESSAGE_VALUE_TIMESTAMP;
+        adds[0].value.value.timestamp = 0;
+        umock_c_reset_all_calls();
+
+        whenShallmalloc_fail = currentmalloc_call + 1;
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE derived = Message_CreateDerivedWithValues(base, adds, 1, NULL, 0);
+
+        ///assert
+        ASSERT_IS_NULL(derived);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_056: [ Otherwise, Message_CreateDerivedWithValues shall create a message as Message_CreateDerived does, keeping the values of adds in their types, with copies of their strings and bytes. ]*/
+    /*Tests_SRS_MESSAGE_30_062: [ If the property was set by Message_CreateDerivedWithValues, Message_GetPropertyTypedValue shall set value to its value, in the type it was set with, without converting it, and return 0. ]*/
+    TEST_FUNCTION(Message_GetPropertyTypedValue_returns_the_values_in_their_types)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        unsigned char bytes[] = { 1, 2, 3 };
+        MESSAGE_TYPED_PROPERTY adds[2];
+        MESSAGE_VALUE timestamp;
+        MESSAGE_VALUE key;
+        adds[0].key = "timestamp";
+        adds[0].value.type = MESSAGE_VALUE_TIMESTAMP;
+        adds[0].value.value.timestamp = 1478511000000250;
+        adds[1].key = "deviceKey";
+        adds[1].value.type = MESSAGE_VALUE_BYTES;
+        adds[1].value.value.bytes.buffer = bytes;
+        adds[1].value.value.bytes.size = sizeof(bytes);
+        MESSAGE_HANDLE derived = Message_CreateDerivedWithValues(base, adds, 2, NULL, 0);
+        bytes[0] = 0;
+        umock_c_reset_all_calls();
+
+        ///act
+        int timestampResult = Message_GetPropertyTypedValue(derived, MESSAGE_KEY_TIMESTAMP, &timestamp);
+        int keyResult = Message_GetPropertyTypedValue(derived, MESSAGE_KEY_DEVICE_KEY, &key);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int, 0, timestampResult);
+        ASSERT_ARE_EQUAL(int, MESSAGE_VALUE_TIMESTAMP, timestamp.type);
+        ASSERT_IS_TRUE(timestamp.value.timestamp == 1478511000000250);
+        ASSERT_ARE_EQUAL(int, 0, keyResult);
+        ASSERT_ARE_EQUAL(int, MESSAGE_VALUE_BYTES, key.type);
+        ASSERT_ARE_EQUAL(size_t, sizeof(bytes), key.value.bytes.size);
+        ASSERT_ARE_EQUAL(int, 1, (int)key.value.bytes.buffer[0]);
+        ASSERT_ARE_EQUAL(int, 3, (int)key.value.bytes.buffer[2]);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_061: [ If message does not have the property key, Message_GetPropertyTypedValue shall return a non-zero value. ]*/
+    /*Tests_SRS_MESSAGE_30_063: [ Otherwise, Message_GetPropertyTypedValue shall set value to a MESSAGE_VALUE_STRING holding the value of the property and return 0. ]*/
+    TEST_FUNCTION(Message_GetPropertyTypedValue_returns_the_other_properties_as_strings)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_PROPERTY adds[] = { { "deviceName", "d" } };
+        const char* removes[] = { "macAddress" };
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, adds, 1, removes, 1);
+        size_t two = 2;
+        const char* keys[] = { "source", "macAddress" };
+        const char* values[] = { "ble", "m" };
+        const char* const* *pkeys = (const char* const* *)&keys;
+        const char* const* *pvalues = (const char* const* *)&values;
+        MESSAGE_VALUE deviceName;
+        MESSAGE_VALUE source;
+        MESSAGE_VALUE macAddress;
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument_handle()
+            .CopyOutArgumentBuffer(2, &pkeys, sizeof(char**))
+            .CopyOutArgumentBuffer(3, &pvalues, sizeof(char**))
+            .CopyOutArgumentBuffer(4, &two, sizeof(two));
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*the index of the base*/
+            .IgnoreArgument(1);
+
+        ///act
+        int deviceNameResult = Message_GetPropertyTypedValue(derived, MESSAGE_KEY_DEVICE_NAME, &deviceName);
+        int sourceResult = Message_GetPropertyTypedValue(derived, MESSAGE_KEY_SOURCE, &source);
+        int macAddressResult = Message_GetPropertyTypedValue(derived, MESSAGE_KEY_MAC_ADDRESS, &macAddress);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int, 0, deviceNameResult);
+        ASSERT_ARE_EQUAL(int, MESSAGE_VALUE_STRING, deviceName.type);
+        ASSERT_ARE_EQUAL(char_ptr, "d", deviceName.value.string);
+        ASSERT_ARE_EQUAL(int, 0, sourceResult);
+        ASSERT_ARE_EQUAL(int, MESSAGE_VALUE_STRING, source.type);
+        ASSERT_ARE_EQUAL(char_ptr, "ble", source.value.string);
+        ASSERT_ARE_NOT_EQUAL(int, 0, macAddressResult);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_060: [ If message or value is NULL, or if key was not returned by Message_InternKey, Message_GetPropertyTypedValue shall fail and return a non-zero value. ]*/
+    TEST_FUNCTION(Message_GetPropertyTypedValue_with_NULL_value_fails)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE aMessage = Message_Create(&c);
+        MESSAGE_VALUE value;
+        umock_c_reset_all_calls();
+
+        ///act
+        int withNullValue = Message_GetPropertyTypedValue(aMessage, MESSAGE_KEY_SOURCE, NULL);
+        int withNullMessage = Message_GetPropertyTypedValue(NULL, MESSAGE_KEY_SOURCE, &value);
+        int withNoKey = Message_GetPropertyTypedValue(aMessage, MESSAGE_KEY_NONE, &value);
+
+        ///assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, withNullValue);
+        ASSERT_ARE_NOT_EQUAL(int, 0, withNullMessage);
+        ASSERT_ARE_NOT_EQUAL(int, 0, withNoKey);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(aMessage);
+    }
+
+    /*Tests_SRS_MESSAGE_30_058: [ The first time a property set by Message_CreateDerivedWithValues is needed as a string, its value shall be converted to a string kept with the message: an int64 in decimal, a double with 17 significant digits, a bool as "true" or "false", bytes in base64 and a timestamp in ISO 8601 in UTC with microseconds, as in "2016-11-07T09:30:00.000250Z"; if another thread kept one first, the string converted shall be freed and the one kept used instead. ]*/
+    TEST_FUNCTION(Message_GetPropertyValue_converts_the_typed_values_once)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        unsigned char bytes[] = { 'f', 'o', 'o', 'b' };
+        MESSAGE_TYPED_PROPERTY adds[5];
+        adds[0].key = "timestamp";
+        adds[0].value.type = MESSAGE_VALUE_TIMESTAMP;
+        adds[0].value.value.timestamp = -1;
+        adds[1].key = "deviceKey";
+        adds[1].value.type = MESSAGE_VALUE_BYTES;
+        adds[1].value.value.bytes.buffer = bytes;
+        adds[1].value.value.bytes.size = sizeof(bytes);
+        adds[2].key = "bleControllerIndex";
+        adds[2].value.type = MESSAGE_VALUE_INT64;
+        adds[2].value.value.integer = -9000000000;
+        adds[3].key = "iotHubMessageId";
+        adds[3].value.type = MESSAGE_VALUE_DOUBLE;
+        adds[3].value.value.real = 0.5;
+        adds[4].key = "deviceFunction";
+        adds[4].value.type = MESSAGE_VALUE_BOOL;
+        adds[4].value.value.boolean = false;
+        MESSAGE_HANDLE derived = Message_CreateDerivedWithValues(base, adds, 5, NULL, 0);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        const char* timestamp = Message_GetPropertyValue(derived, "timestamp");
+        const char* deviceKey = Message_GetPropertyValue(derived, "deviceKey");
+        const char* index = Message_GetPropertyValue(derived, "bleControllerIndex");
+        const char* messageId = Message_GetPropertyValue(derived, "iotHubMessageId");
+        const char* function = Message_GetPropertyValue(derived, "deviceFunction");
+        const char* timestampAgain = Message_GetPropertyValue(derived, "timestamp");
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, "1969-12-31T23:59:59.999999Z", timestamp);
+        ASSERT_ARE_EQUAL(char_ptr, "Zm9vYg==", deviceKey);
+        ASSERT_ARE_EQUAL(char_ptr, "-9000000000", index);
+        ASSERT_ARE_EQUAL(char_ptr, "0.5", messageId);
+        ASSERT_ARE_EQUAL(char_ptr, "false", function);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)timestamp, (void*)timestampAgain);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_059: [ If the value cannot be converted, the property shall be missing from the strings of the message. ]*/
+    TEST_FUNCTION(Message_GetPropertyValue_returns_NULL_when_a_typed_value_cannot_be_converted)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_TYPED_PROPERTY adds[1];
+        adds[0].key = "bleControllerIndex";
+        adds[0].value.type = MESSAGE_VALUE_INT64;
+        adds[0].value.value.integer = 1;
+        MESSAGE_HANDLE derived = Message_CreateDerivedWithValues(base, adds, 1, NULL, 0);
+        umock_c_reset_all_calls();
+
+        whenShallmalloc_fail = currentmalloc_call + 1;
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        const char* index = Message_GetPropertyValue(derived, "bleControllerIndex");
+
+        ///assert
+        ASSERT_IS_NULL(index);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_040: [ If message or key is NULL then Message_GetPropertyValue shall return NULL. ]*/
+    TEST_FUNCTION(Message_GetPropertyValue_with_NULL_key_returns_NULL)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE aMessage = Message_Create(&c);
+        umock_c_reset_all_calls();
+
+        ///act
+        const char* value = Message_GetPropertyValue(aMessage, NULL);
+
+        ///assert
+        ASSERT_IS_NULL(value);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(aMessage);
+    }
+
+    /*Tests_SRS_MESSAGE_30_036: [ The first time all the properties of a message made by Message_CreateDerived are needed, they shall be merged into a new CONSTMAP kept with the message; if another thread kept one first, the merged CONSTMAP shall be destroyed and the one kept used instead. ]*/
+    TEST_FUNCTION(Message_GetProperties_merges_the_properties_of_a_derived_message_once)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_PROPERTY adds[] = { { "deviceName", "d" } };
+        const char* removes[] = { "macAddress" };
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, adds, 1, removes, 1);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_CloneWriteable(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .SetReturn(TEST_MAP_HANDLE);
+        STRICT_EXPECTED_CALL(Map_Delete(TEST_MAP_HANDLE, "macAddress"))
+            .SetReturn(MAP_KEYNOTFOUND);
+        STRICT_EXPECTED_CALL(Map_AddOrUpdate(TEST_MAP_HANDLE, "deviceName", "d"));
+        STRICT_EXPECTED_CALL(ConstMap_Create(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+        STRICT_EXPECTED_CALL(ConstMap_Clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(ConstMap_Clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        CONSTMAP_HANDLE first = Message_GetProperties(derived);
+        CONSTMAP_HANDLE second = Message_GetProperties(derived);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(first);
+        ASSERT_ARE_EQUAL(void_ptr, first, second);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        ConstMap_Destroy(first);
+        ConstMap_Destroy(second);
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_037: [ If merging the properties fails, Message_GetProperties shall return NULL. ]*/
+    TEST_FUNCTION(Message_GetProperties_of_a_derived_message_fails_when_merging_fails)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_PROPERTY adds[] = { { "deviceName", "d" } };
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, adds, 1, NULL, 0);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_CloneWriteable(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .SetReturn(TEST_MAP_HANDLE);
+        STRICT_EXPECTED_CALL(Map_AddOrUpdate(TEST_MAP_HANDLE, "deviceName", "d"))
+            .SetReturn(MAP_ERROR);
+        STRICT_EXPECTED_CALL(Map_Destroy(TEST_MAP_HANDLE));
+
+        ///act
+        CONSTMAP_HANDLE properties = Message_GetProperties(derived);
+
+        ///assert
+        ASSERT_IS_NULL(properties);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_038: [ If message was made by Message_CreateDerived, Message_GetContentHandle shall return the CONSTBUFFER_HANDLE of its base message. ]*/
+    TEST_FUNCTION(Message_GetContentHandle_of_a_derived_message_clones_the_content_of_its_base)
+    {
+        ///arrange
+        unsigned char content[] = { 1, 2, 3 };
+        MESSAGE_CONFIG c = { sizeof(content), content, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, NULL, 0, NULL, 0);
+        CONSTBUFFER_HANDLE baseContent = Message_GetContentHandle(base);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(baseContent));
+
+        ///act
+        CONSTBUFFER_HANDLE derivedContent = Message_GetContentHandle(derived);
+
+        ///assert
+        ASSERT_ARE_EQUAL(void_ptr, baseContent, derivedContent);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        CONSTBUFFER_Destroy(derivedContent);
+        CONSTBUFFER_Destroy(baseContent);
+        Message_Destroy(derived);
+        Message_Destroy(base);
+    }
+
+    /*Tests_SRS_MESSAGE_30_039: [ When the ref count of a message made by Message_CreateDerived reaches zero, Message_Destroy shall destroy its merged properties, free its overlay and destroy its base message. ]*/
+    TEST_FUNCTION(Message_Destroy_of_a_derived_message_destroys_its_base)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_PROPERTY adds[] = { { "deviceName", "d" } };
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, adds, 1, NULL, 0);
+        Message_Destroy(base);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the overlay*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(ConstMap_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the base message*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the derived message*/
+            .IgnoreArgument(1);
+
+        ///act
+        Message_Destroy(derived);
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+
+    /*Tests_SRS_MESSAGE_30_064: [ When the ref count of a message made by Message_CreateDerivedWithValues reaches zero, Message_Destroy shall free the strings its typed values were converted to. ]*/
+    TEST_FUNCTION(Message_Destroy_of_a_derived_message_frees_its_converted_values)
+    {
+        ///arrange
+        MESSAGE_CONFIG c = { 0, NULL, (MAP_HANDLE)&c };
+        MESSAGE_HANDLE base = Message_Create(&c);
+        MESSAGE_TYPED_PROPERTY adds[1];
+        adds[0].key = "bleControllerIndex";
+        adds[0].value.type = MESSAGE_VALUE_INT64;
+        adds[0].value.value.integer = 1;
+        MESSAGE_HANDLE derived = Message_CreateDerivedWithValues(base, adds, 1, NULL, 0);
+        (void)Message_GetPropertyValue(derived, "bleControllerIndex");
+        Message_Destroy(base);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the converted value*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the overlay*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(ConstMap_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the base message*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the derived message*/
+            .IgnoreArgument(1);
+
+        ///act
+        Message_Destroy(derived);
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+    }
+
+
+    /*Tests_SRS_MESSAGE_30_065: [ If cfg is NULL, if its field segments is NULL or holds a NULL segment, if its field segmentCount is zero or greater than MESSAGE_MAX_CONTENT_SEGMENTS, or if its field sourceProperties is NULL, Message_CreateFromSegments shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateFromSegments_with_invalid_arguments_fails)
+    {
+        ///arrange
+        unsigned char fake = 1;
+        CONSTBUFFER_HANDLE segments[MESSAGE_MAX_CONTENT_SEGMENTS + 1];
+        size_t i;
+        for (i = 0; i < MESSAGE_MAX_CONTENT_SEGMENTS + 1; i++)
+        {
+            segments[i] = CONSTBUFFER_Create(&fake, 1);
+        }
+        CONSTBUFFER_HANDLE withNULL[] = { segments[0], NULL };
+        MESSAGE_SEGMENTS_CONFIG noSegments = { NULL, 1, (MAP_HANDLE)&fake };
+        MESSAGE_SEGMENTS_CONFIG zeroSegments = { segments, 0, (MAP_HANDLE)&fake };
+        MESSAGE_SEGMENTS_CONFIG tooManySegments = { segments, MESSAGE_MAX_CONTENT_SEGMENTS + 1, (MAP_HANDLE)&fake };
+        MESSAGE_SEGMENTS_CONFIG NULLSegment = { withNULL, 2, (MAP_HANDLE)&fake };
+        MESSAGE_SEGMENTS_CONFIG noProperties = { segments, 1, NULL };
+        umock_c_reset_all_calls();
+
+        ///act
+        MESSAGE_HANDLE r1 = Message_CreateFromSegments(NULL);
+        MESSAGE_HANDLE r2 = Message_CreateFromSegments(&noSegments);
+        MESSAGE_HANDLE r3 = Message_CreateFromSegments(&zeroSegments);
+        MESSAGE_HANDLE r4 = Message_CreateFromSegments(&tooManySegments);
+        MESSAGE_HANDLE r5 = Message_CreateFromSegments(&NULLSegment);
+        MESSAGE_HANDLE r6 = Message_CreateFromSegments(&noProperties);
+
+        ///assert
+        ASSERT_IS_NULL(r1);
+        ASSERT_IS_NULL(r2);
+        ASSERT_IS_NULL(r3);
+        ASSERT_IS_NULL(r4);
+        ASSERT_IS_NULL(r5);
+        ASSERT_IS_NULL(r6);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        for (i = 0; i < MESSAGE_MAX_CONTENT_SEGMENTS + 1; i++)
+        {
+            CONSTBUFFER_Destroy(segments[i]);
+        }
+    }
+
+    /*Tests_SRS_MESSAGE_30_066: [ Message_CreateFromSegments shall copy the sourceProperties to a readonly CONSTMAP. ]*/
+    /*Tests_SRS_MESSAGE_30_068: [ Otherwise, Message_CreateFromSegments shall return a non-NULL handle with its ref count set to "1", which keeps a clone of each segment, the content of the message being the bytes of the segments one after the other. ]*/
+    /*Tests_SRS_MESSAGE_30_069: [ Message_CreateFromSegments shall create a message that never expires. ]*/
+    /*Tests_SRS_MESSAGE_30_077: [ Otherwise, Message_GetContentSegmentCount shall return the number of segments of a message made by Message_CreateFromSegments, or of the message it was derived from, and 1 for any other message. ]*/
+    /*Tests_SRS_MESSAGE_30_079: [ Otherwise, Message_GetContentSegment shall return the content of the segment index of message, without copying it, the content of a message not made of segments being its only segment. ]*/
+    TEST_FUNCTION(Message_CreateFromSegments_clones_the_segments)
+    {
+        ///arrange
+        unsigned char fake;
+        CONSTBUFFER_HANDLE segments[] = { CONSTBUFFER_Create((const unsigned char*)"123", 3), CONSTBUFFER_Create((const unsigned char*)"45", 2) };
+        MESSAGE_SEGMENTS_CONFIG cfg = { segments, 2, (MAP_HANDLE)&fake };
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(2 * sizeof(CONSTBUFFER_HANDLE))); /*this is for the segments*/
+        STRICT_EXPECTED_CALL(ConstMap_Create((MAP_HANDLE)&fake)); /*this is copying the properties*/
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(segments[0]));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(segments[1]));
+
+        ///act
+        MESSAGE_HANDLE r = Message_CreateFromSegments(&cfg);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(r);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_ARE_EQUAL(size_t, 2, Message_GetContentSegmentCount(r));
+        ASSERT_ARE_EQUAL(void_ptr, (void*)CONSTBUFFER_GetContent(segments[0]), (void*)Message_GetContentSegment(r, 0));
+        ASSERT_ARE_EQUAL(void_ptr, (void*)CONSTBUFFER_GetContent(segments[1]), (void*)Message_GetContentSegment(r, 1));
+        ASSERT_ARE_EQUAL(size_t, 0, (size_t)Message_GetTimeToLive(r));
+
+        ///cleanup
+        Message_Destroy(r);
+        CONSTBUFFER_Destroy(segments[0]);
+        CONSTBUFFER_Destroy(segments[1]);
+    }
+
+    /*Tests_SRS_MESSAGE_30_067: [ If any allocation fails, Message_CreateFromSegments shall fail and return NULL. ]*/
+    TEST_FUNCTION(Message_CreateFromSegments_fails_when_the_properties_cannot_be_copied)
+    {
+        ///arrange
+        unsigned char fake;
+        CONSTBUFFER_HANDLE segment = CONSTBUFFER_Create(&fake, 1);
+        MESSAGE_SEGMENTS_CONFIG cfg = { &segment, 1, (MAP_HANDLE)&fake };
+        whenShallConstMap_Create_fail = 1;
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(CONSTBUFFER_HANDLE))); /*this is for the segments*/
+        STRICT_EXPECTED_CALL(ConstMap_Create((MAP_HANDLE)&fake));
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the segments*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the structure*/
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE r = Message_CreateFromSegments(&cfg);
+
+        ///assert
+        ASSERT_IS_NULL(r);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        CONSTBUFFER_Destroy(segment);
+    }
+
+    /*Tests_SRS_MESSAGE_30_076: [ If message is NULL then Message_GetContentSegmentCount shall return 0. ]*/
+    /*Tests_SRS_MESSAGE_30_078: [ If message is NULL or index is not less than the number of segments of message, Message_GetContentSegment shall return NULL. ]*/
+    /*Tests_SRS_MESSAGE_30_079: [ Otherwise, Message_GetContentSegment shall return the content of the segment index of message, without copying it, the content of a message not made of segments being its only segment. ]*/
+    TEST_FUNCTION(Message_GetContentSegment_of_a_message_not_made_of_segments_returns_its_content)
+    {
+        ///arrange
+        char t = '3';
+        MESSAGE_CONFIG c = { sizeof(t), (unsigned char*)&t, TEST_MAP_HANDLE };
+        MESSAGE_HANDLE msg = Message_Create(&c);
+
+        ///act
+        size_t count = Message_GetContentSegmentCount(msg);
+        const CONSTBUFFER* segment = Message_GetContentSegment(msg, 0);
+        const CONSTBUFFER* pastTheEnd = Message_GetContentSegment(msg, 1);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 0, Message_GetContentSegmentCount(NULL));
+        ASSERT_IS_NULL(Message_GetContentSegment(NULL, 0));
+        ASSERT_ARE_EQUAL(size_t, 1, count);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)Message_GetContent(msg), (void*)segment);
+        ASSERT_IS_NULL(pastTheEnd);
+
+        ///cleanup
+        Message_Destroy(msg);
+    }
+
+    /*Tests_SRS_MESSAGE_30_081: [ Message_ToByteArrayWithVersion shall write the content of a message made of segments from each segment in turn, without copying them into one buffer first. ]*/
+    TEST_FUNCTION(Message_ToByteArray_writes_the_segments_in_turn)
+    {
+        ///arrange
+        static const unsigned char expected[] =
+        {
+            0xA1, 0x60,             /*header*/
+            0x00, 0x00, 0x00, 19,   /*size of this array*/
+            0x00, 0x00, 0x00, 0x00, /*zero properties*/
+            0x00, 0x00, 0x00, 0x05, /*5 message content size*/
+            '1', '2', '3', '4', '5'
+        };
+        unsigned char fake;
+        CONSTBUFFER_HANDLE segments[] = { CONSTBUFFER_Create((const unsigned char*)"123", 3), CONSTBUFFER_Create((const unsigned char*)"45", 2) };
+        MESSAGE_SEGMENTS_CONFIG cfg = { segments, 2, (MAP_HANDLE)&fake };
+        MESSAGE_HANDLE msg = Message_CreateFromSegments(&cfg);
+        unsigned char buf[sizeof(expected)];
+        umock_c_reset_all_calls();
+
+        size_t zero = 0;
+        const char* const* noStrings = NULL;
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .CopyOutArgumentBuffer(2, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(3, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(segments[0]));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(segments[1]));
+
+        ///act
+        int32_t nbytes = Message_ToByteArray(msg, buf, sizeof(buf));
+
+        ///assert
+        ASSERT_ARE_EQUAL(int32_t, sizeof(expected), nbytes);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(expected, buf, sizeof(expected)));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(msg);
+        CONSTBUFFER_Destroy(segments[0]);
+        CONSTBUFFER_Destroy(segments[1]);
+    }
+
+    /*Tests_SRS_MESSAGE_30_071: [ If message is made of more than one segment, Message_GetContent shall copy the segments one after the other into one buffer the first time it is called, keep the copy with the message and return it, or return NULL if the copy cannot be allocated. ]*/
+    TEST_FUNCTION(Message_GetContent_copies_the_segments_once)
+    {
+        ///arrange
+        unsigned char fake;
+        CONSTBUFFER_HANDLE segments[] = { CONSTBUFFER_Create((const unsigned char*)"123", 3), CONSTBUFFER_Create((const unsigned char*)"45", 2) };
+        MESSAGE_SEGMENTS_CONFIG cfg = { segments, 2, (MAP_HANDLE)&fake };
+        MESSAGE_HANDLE msg = Message_CreateFromSegments(&cfg);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(segments[0]));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(segments[1]));
+        STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(CONSTBUFFER) + 5));
+
+        ///act
+        const CONSTBUFFER* content1 = Message_GetContent(msg);
+        const CONSTBUFFER* content2 = Message_GetContent(msg);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(content1);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)content1, (void*)content2);
+        ASSERT_ARE_EQUAL(size_t, 5, content1->size);
+        ASSERT_ARE_EQUAL(int, 0, memcmp("12345", content1->buffer, 5));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        Message_Destroy(msg);
+        CONSTBUFFER_Destroy(segments[0]);
+        CONSTBUFFER_Destroy(segments[1]);
+    }
+
+    /*Tests_SRS_MESSAGE_30_082: [ If message is NULL or version is neither GATEWAY_MESSAGE_VERSION_1 nor GATEWAY_MESSAGE_VERSION_2, Message_GetSerializationHeader shall fail and return NULL. ]*/
+    /*Tests_SRS_MESSAGE_30_083: [ Otherwise, Message_GetSerializationHeader shall return the bytes that Message_GetSerialization returns before the content of message, made, kept with the message and cloned as Message_GetSerialization does the serialization. ]*/
+    TEST_FUNCTION(Message_GetSerializationHeader_returns_the_bytes_before_the_content)
+    {
+        ///arrange
+        static const unsigned char expected[] =
+        {
+            0xA1, 0x60,             /*header*/
+            0x00, 0x00, 0x00, 19,   /*size of the whole array*/
+            0x00, 0x00, 0x00, 0x00, /*zero properties*/
+            0x00, 0x00, 0x00, 0x05  /*5 message content size*/
+        };
+        unsigned char fake;
+        CONSTBUFFER_HANDLE segments[] = { CONSTBUFFER_Create((const unsigned char*)"123", 3), CONSTBUFFER_Create((const unsigned char*)"45", 2) };
+        MESSAGE_SEGMENTS_CONFIG cfg = { segments, 2, (MAP_HANDLE)&fake };
+        MESSAGE_HANDLE msg = Message_CreateFromSegments(&cfg);
+        umock_c_reset_all_calls();
+
+        size_t zero = 0;
+        const char* const* noStrings = NULL;
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .CopyOutArgumentBuffer(2, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(3, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(segments[0]));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(segments[1]));
+        STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(expected)));
+        STRICT_EXPECTED_CALL(ConstMap_GetInternals(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .CopyOutArgumentBuffer(2, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(3, &noStrings, sizeof(noStrings))
+            .CopyOutArgumentBuffer(4, &zero, sizeof(zero));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(segments[0]));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(segments[1]));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Create(IGNORED_PTR_ARG, sizeof(expected)))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Clone(IGNORED_PTR_ARG)) /*the second time, the header is not made again*/
+            .IgnoreArgument(1);
+
+        ///act
+        CONSTBUFFER_HANDLE s1 = Message_GetSerializationHeader(msg, GATEWAY_MESSAGE_VERSION_1);
+        CONSTBUFFER_HANDLE s2 = Message_GetSerializationHeader(msg, GATEWAY_MESSAGE_VERSION_1);
+
+        ///assert
+        ASSERT_IS_NULL(Message_GetSerializationHeader(NULL, GATEWAY_MESSAGE_VERSION_1));
+        ASSERT_IS_NULL(Message_GetSerializationHeader(msg, 3));
+        ASSERT_IS_NOT_NULL(s1);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)s1, (void*)s2);
+        ASSERT_ARE_EQUAL(size_t, sizeof(expected), CONSTBUFFER_GetContent(s1)->size);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(expected, CONSTBUFFER_GetContent(s1)->buffer, sizeof(expected)));
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        CONSTBUFFER_Destroy(s1);
+        CONSTBUFFER_Destroy(s2);
+        Message_Destroy(msg);
+        CONSTBUFFER_Destroy(segments[0]);
+        CONSTBUFFER_Destroy(segments[1]);
+    }
+
+    /*Tests_SRS_MESSAGE_30_073: [ A message derived from a message made of segments shall share its segments. ]*/
+    TEST_FUNCTION(Message_CreateDerived_shares_the_segments_of_its_base)
+    {
+        ///arrange
+        unsigned char fake;
+        CONSTBUFFER_HANDLE segments[] = { CONSTBUFFER_Create((const unsigned char*)"123", 3), CONSTBUFFER_Create((const unsigned char*)"45", 2) };
+        MESSAGE_SEGMENTS_CONFIG cfg = { segments, 2, (MAP_HANDLE)&fake };
+        MESSAGE_HANDLE base = Message_CreateFromSegments(&cfg);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the structure*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(ConstMap_Clone(IGNORED_PTR_ARG)) /*the base is cloned*/
+            .IgnoreArgument(1);
+
+        ///act
+        MESSAGE_HANDLE derived = Message_CreateDerived(base, NULL, 0, NULL, 0);
+
+        ///assert
+        ASSERT_IS_NOT_NULL(derived);
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+        ASSERT_ARE_EQUAL(size_t, 2, Message_GetContentSegmentCount(derived));
+        ASSERT_ARE_EQUAL(void_ptr, (void*)CONSTBUFFER_GetContent(segments[1]), (void*)Message_GetContentSegment(derived, 1));
+
+        ///cleanup
+        Message_Destroy(base);
+        Message_Destroy(derived);
+        CONSTBUFFER_Destroy(segments[0]);
+        CONSTBUFFER_Destroy(segments[1]);
+    }
+
+    /*Tests_SRS_MESSAGE_30_080: [ When the ref count of a message made by Message_CreateFromSegments reaches zero, Message_Destroy shall destroy its segments. When the ref count of a message made of more than one segment reaches zero, Message_Destroy shall free the copy of its segments. ]*/
+    TEST_FUNCTION(Message_Destroy_destroys_the_segments)
+    {
+        ///arrange
+        unsigned char fake;
+        CONSTBUFFER_HANDLE segments[] = { CONSTBUFFER_Create((const unsigned char*)"123", 3), CONSTBUFFER_Create((const unsigned char*)"45", 2) };
+        MESSAGE_SEGMENTS_CONFIG cfg = { segments, 2, (MAP_HANDLE)&fake };
+        MESSAGE_HANDLE msg = Message_CreateFromSegments(&cfg);
+        (void)Message_GetContent(msg);
+        umock_c_reset_all_calls();
+
+        STRICT_EXPECTED_CALL(ConstMap_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the copy of the segments*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(segments[0]));
+        STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(segments[1]));
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the segments*/
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the structure*/
+            .IgnoreArgument(1);
+
+        ///act
+        Message_Destroy(msg);
+
+        ///assert
+        ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+        ///cleanup
+        CONSTBUFFER_Destroy(segments[0]);
+        CONSTBUFFER_Destroy(segments[1]);
+    }
+
 END_TEST_SUITE(gwmessage_ut)
@@ -0,0 +1,529 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+static bool malloc_will_fail = false;
+static size_t malloc_fail_count = 0;
+static size_t malloc_count = 0;
+
+void* my_gballoc_malloc(size_t size)
+{
+    ++malloc_count;
+
+    void* result;
+    if (malloc_will_fail == true && malloc_count == malloc_fail_count)
+    {
+        result = NULL;
+    }
+    else
+    {
+        result = malloc(size);
+    }
+
+    return result;
+}
+
+void my_gballoc_free(void* ptr)
+{
+    free(ptr);
+}
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umock_c_negative_tests.h"
+#include "umocktypes_charptr.h"
+#include "umocktypes_bool.h"
+#include "umocktypes_stdint.h"
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/vector.h"
+#include "azure_c_shared_utility/gballoc.h"
+
+#undef ENABLE_MOCKS
+
+#include "link_filter.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+VECTOR_HANDLE real_VECTOR_create(size_t elementSize);
+VECTOR_HANDLE real_VECTOR_move(VECTOR_HANDLE handle);
+void real_VECTOR_destroy(VECTOR_HANDLE handle);
+
+/* insertion */
+int real_VECTOR_push_back(VECTOR_HANDLE handle, const void* elements, size_t numElements);
+
+/* removal */
+void real_VECTOR_erase(VECTOR_HANDLE handle, void* elements, size_t numElements);
+void real_VECTOR_clear(VECTOR_HANDLE handle);
+
+/* access */
+void* real_VECTOR_element(const VECTOR_HANDLE handle, size_t index);
+void* real_VECTOR_front(const VECTOR_HANDLE handle);
+void* real_VECTOR_back(const VECTOR_HANDLE handle);
+void* real_VECTOR_find_if(const VECTOR_HANDLE handle, PREDICATE_FUNCTION pred, const void* value);
+
+/* capacity */
+size_t real_VECTOR_size(const VECTOR_HANDLE handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+static size_t lookup_count;
+static const void* last_lookup_context;
+
+/*the fake message properties are a NULL terminated array of names and values*/
+static const char* lookup_property(const void* context, const char* key)
+{
+    const char* const* properties = (const char* const*)context;
+    const char* result = NULL;
+    lookup_count++;
+    last_lookup_context = context;
+    while (result == NULL && properties[0] != NULL)
+    {
+        if (strcmp(properties[0], key) == 0)
+        {
+            result = properties[1];
+        }
+        properties += 2;
+    }
+    return result;
+}
+
+static const char* registration[] =
+{
+    "deviceFunction", "register",
+    "macAddress", "01:01:01:01:01:01",
+    "source.name", "sensor-7",
+    NULL
+};
+
+static const char* telemetry[] =
+{
+    "deviceFunction", "telemetry",
+    "source.name", "gateway",
+    NULL
+};
+
+static bool filter_matches(const char* expression, const char** properties)
+{
+    LINK_FILTER_HANDLE filter = LinkFilter_Create(expression);
+    ASSERT_IS_NOT_NULL_WITH_MSG(filter, expression);
+    bool result = LinkFilter_Matches(filter, lookup_property, properties);
+    LinkFilter_Destroy(filter);
+    return result;
+}
+
+//=============================================================================
+//Globals
+//=============================================================================
+
+static TEST_MUTEX_HANDLE g_dllByDll;
+static TEST_MUTEX_HANDLE g_testByTest;
+
+void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    (void)error_code;
+    ASSERT_FAIL("umock_c reported error");
+}
+
+BEGIN_TEST_SUITE(link_filter_ut)
+
+TEST_SUITE_INITIALIZE(TestClassInitialize)
+{
+    TEST_INITIALIZE_MEMORY_DEBUG(g_dllByDll);
+    g_testByTest = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(g_testByTest);
+
+    umock_c_init(on_umock_c_error);
+    umocktypes_charptr_register_types();
+    umocktypes_stdint_register_types();
+
+    REGISTER_UMOCK_ALIAS_TYPE(VECTOR_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(const VECTOR_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(PREDICATE_FUNCTION, void*);
+
+    // malloc/free hooks
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+
+    // Vector hooks
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_create, real_VECTOR_create);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_destroy, real_VECTOR_destroy);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_push_back, real_VECTOR_push_back);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_front, real_VECTOR_front);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_size, real_VECTOR_size);
+}
+
+TEST_SUITE_CLEANUP(TestClassCleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(g_testByTest);
+    TEST_DEINITIALIZE_MEMORY_DEBUG(g_dllByDll);
+}
+
+TEST_FUNCTION_INITIALIZE(TestMethodInitialize)
+{
+    if (TEST_MUTEX_ACQUIRE(g_testByTest) != 0)
+    {
+        ASSERT_FAIL("our mutex is ABANDONED. Failure in test framework");
+    }
+
+    umock_c_reset_all_calls();
+    malloc_will_fail = false;
+    malloc_fail_count = 0;
+    malloc_count = 0;
+    lookup_count = 0;
+    last_lookup_context = NULL;
+}
+
+TEST_FUNCTION_CLEANUP(TestMethodCleanup)
+{
+    TEST_MUTEX_RELEASE(g_testByTest);
+}
+
+/*Tests_SRS_LINK_FILTER_30_001: [ If expression is NULL, LinkFilter_Create shall return NULL. ]*/
+TEST_FUNCTION(LinkFilter_Create_returns_NULL_for_NULL_expression)
+{
+    ///arrange
+    ///act
+    LINK_FILTER_HANDLE filter = LinkFilter_Create(NULL);
+
+    ///assert
+    ASSERT_IS_NULL(filter);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_LINK_FILTER_30_006: [ Otherwise, LinkFilter_Create shall return a non-NULL handle. ]*/
+TEST_FUNCTION(LinkFilter_Create_succeeds)
+{
+    ///arrange
+    STRICT_EXPECTED_CALL(VECTOR_create(IGNORED_NUM_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the property name*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+        .IgnoreArgument(1)
+        .IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is for the filter*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)) /*this is for its terms*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(VECTOR_front(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(VECTOR_destroy(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+
+    ///act
+    LINK_FILTER_HANDLE filter = LinkFilter_Create("exists(macAddress)");
+
+    ///assert
+    ASSERT_IS_NOT_NULL(filter);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    ///ablutions
+    LinkFilter_Destroy(filter);
+}
+
+/*Tests_SRS_LINK_FILTER_30_005: [ If any allocation fails, LinkFilter_Create shall return NULL. ]*/
+TEST_FUNCTION(LinkFilter_Create_returns_NULL_when_VECTOR_create_fails)
+{
+    ///arrange
+    STRICT_EXPECTED_CALL(VECTOR_create(IGNORED_NUM_ARG))
+        .IgnoreArgument(1)
+        .SetReturn(NULL);
+
+    ///act
+    LINK_FILTER_HANDLE filter = LinkFilter_Create("exists(macAddress)");
+
+    ///assert
+    ASSERT_IS_NULL(filter);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_LINK_FILTER_30_005: [ If any allocation fails, LinkFilter_Create shall return NULL. ]*/
+TEST_FUNCTION(LinkFilter_Create_returns_NULL_when_malloc_fails)
+{
+    size_t i;
+    for (i = 1; i <= 3; i++)
+    {
+        ///arrange
+        malloc_will_fail = true;
+        malloc_fail_count = i;
+        malloc_count = 0;
+
+        ///act
+        LINK_FILTER_HANDLE filter = LinkFilter_Create("exists(macAddress)");
+
+        ///assert
+        ASSERT_IS_NULL(filter);
+    }
+}
+
+/*Tests_SRS_LINK_FILTER_30_004: [ If expression is not well formed, nests parentheses and negations deeper than LINK_FILTER_MAX_DEPTH or has more than LINK_FILTER_MAX_TERMS comparisons and operators, LinkFilter_Create shall return NULL. ]*/
+TEST_FUNCTION(LinkFilter_Create_returns_NULL_for_malformed_expressions)
+{
+    static const char* malformed[] =
+    {
+        "",
+        "deviceFunction",
+        "deviceFunction ==",
+        "deviceFunction == register",
+        "deviceFunction == 'register",
+        "deviceFunction = 'register'",
+        "deviceFunction == 'register' &&",
+        "deviceFunction == 'register' macAddress",
+        "(deviceFunction == 'register'",
+        "deviceFunction == 'register')",
+        "exists()",
+        "exists(macAddress",
+        "prefix(macAddress)",
+        "prefix(macAddress, 01)",
+        "!",
+        "&& exists(macAddress)"
+    };
+    size_t i;
+    for (i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+    {
+        ///act
+        LINK_FILTER_HANDLE filter = LinkFilter_Create(malformed[i]);
+
+        ///assert
+        ASSERT_IS_NULL_WITH_MSG(filter, malformed[i]);
+    }
+}
+
+/*Tests_SRS_LINK_FILTER_30_004: [ If expression is not well formed, nests parentheses and negations deeper than LINK_FILTER_MAX_DEPTH or has more than LINK_FILTER_MAX_TERMS comparisons and operators, LinkFilter_Create shall return NULL. ]*/
+TEST_FUNCTION(LinkFilter_Create_returns_NULL_when_nested_too_deep)
+{
+    ///arrange
+    char expression[LINK_FILTER_MAX_DEPTH * 2 + 32];
+    size_t i;
+    size_t length = 0;
+    for (i = 0; i <= LINK_FILTER_MAX_DEPTH; i++)
+    {
+        expression[length++] = '!';
+    }
+    strcpy(expression + length, "exists(macAddress)");
+
+    ///act
+    LINK_FILTER_HANDLE filter = LinkFilter_Create(expression);
+
+    ///assert
+    ASSERT_IS_NULL(filter);
+
+    ///act
+    filter = LinkFilter_Create(expression + 1);
+
+    ///assert
+    ASSERT_IS_NOT_NULL(filter);
+
+    ///ablutions
+    LinkFilter_Destroy(filter);
+}
+
+/*Tests_SRS_LINK_FILTER_30_004: [ If expression is not well formed, nests parentheses and negations deeper than LINK_FILTER_MAX_DEPTH or has more than LINK_FILTER_MAX_TERMS comparisons and operators, LinkFilter_Create shall return NULL. ]*/
+TEST_FUNCTION(LinkFilter_Create_returns_NULL_with_too_many_terms)
+{
+    ///arrange
+    /*every "exists(a) || " but the first adds two terms*/
+    char expression[LINK_FILTER_MAX_TERMS * 8 + 16];
+    size_t i;
+    strcpy(expression, "exists(a)");
+    for (i = 1; i <= LINK_FILTER_MAX_TERMS / 2; i++)
+    {
+        strcat(expression, "||exists(a)");
+    }
+
+    ///act
+    LINK_FILTER_HANDLE filter = LinkFilter_Create(expression);
+
+    ///assert
+    ASSERT_IS_NULL(filter);
+}
+
+/*Tests_SRS_LINK_FILTER_30_007: [ If filter is NULL, LinkFilter_Destroy shall do nothing. ]*/
+TEST_FUNCTION(LinkFilter_Destroy_does_nothing_with_NULL)
+{
+    ///arrange
+    ///act
+    LinkFilter_Destroy(NULL);
+
+    ///assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_LINK_FILTER_30_008: [ LinkFilter_Destroy shall free all resources of filter. ]*/
+TEST_FUNCTION(LinkFilter_Destroy_frees_the_filter)
+{
+    ///arrange
+    LINK_FILTER_HANDLE filter = LinkFilter_Create("deviceFunction == 'register'");
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the name and value of the comparison*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the terms*/
+        .IgnoreArgument(1);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG)) /*the filter*/
+        .IgnoreArgument(1);
+
+    ///act
+    LinkFilter_Destroy(filter);
+
+    ///assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_LINK_FILTER_30_009: [ If filter or lookup is NULL, LinkFilter_Matches shall return false. ]*/
+TEST_FUNCTION(LinkFilter_Matches_returns_false_for_NULL_filter)
+{
+    ///arrange
+    ///act
+    bool result = LinkFilter_Matches(NULL, lookup_property, registration);
+
+    ///assert
+    ASSERT_IS_FALSE(result);
+    ASSERT_ARE_EQUAL(size_t, 0, lookup_count);
+}
+
+/*Tests_SRS_LINK_FILTER_30_009: [ If filter or lookup is NULL, LinkFilter_Matches shall return false. ]*/
+TEST_FUNCTION(LinkFilter_Matches_returns_false_for_NULL_lookup)
+{
+    ///arrange
+    LINK_FILTER_HANDLE filter = LinkFilter_Create("deviceFunction != 'register'");
+
+    ///act
+    bool result = LinkFilter_Matches(filter, NULL, registration);
+
+    ///assert
+    ASSERT_IS_FALSE(result);
+
+    ///ablutions
+    LinkFilter_Destroy(filter);
+}
+
+/*Tests_SRS_LINK_FILTER_30_010: [ `name == 'value'` shall be true if the message has the property `name` and its value is `value`. ]*/
+TEST_FUNCTION(LinkFilter_Matches_equals)
+{
+    ///act
+    ///assert
+    ASSERT_IS_TRUE(filter_matches("deviceFunction == 'register'", registration));
+    ASSERT_IS_FALSE(filter_matches("deviceFunction == 'register'", telemetry));
+    ASSERT_IS_FALSE(filter_matches("macAddress == ''", telemetry));
+}
+
+/*Tests_SRS_LINK_FILTER_30_011: [ `name != 'value'` shall be true if the message does not have the property `name` or its value is not `value`. ]*/
+TEST_FUNCTION(LinkFilter_Matches_not_equals)
+{
+    ///act
+    ///assert
+    ASSERT_IS_FALSE(filter_matches("deviceFunction != 'register'", registration));
+    ASSERT_IS_TRUE(filter_matches("deviceFunction != 'register'", telemetry));
+    ASSERT_IS_TRUE(filter_matches("macAddress != '01:01:01:01:01:01'", telemetry));
+}
+
+/*Tests_SRS_LINK_FILTER_30_012: [ `prefix(name, 'value')` shall be true if the message has the property `name` and its value starts with `value`. ]*/
+TEST_FUNCTION(LinkFilter_Matches_prefix)
+{
+    ///act
+    ///assert
+    ASSERT_IS_TRUE(filter_matches("prefix(source.name, 'sensor-')", registration));
+    ASSERT_IS_FALSE(filter_matches("prefix(source.name, 'sensor-')", telemetry));
+    ASSERT_IS_TRUE(filter_matches("prefix(source.name, '')", telemetry));
+    ASSERT_IS_FALSE(filter_matches("prefix(macAddress, '')", telemetry));
+}
+
+/*Tests_SRS_LINK_FILTER_30_013: [ `exists(name)` shall be true if the message has the property `name`. ]*/
+TEST_FUNCTION(LinkFilter_Matches_exists)
+{
+    ///act
+    ///assert
+    ASSERT_IS_TRUE(filter_matches("exists(macAddress)", registration));
+    ASSERT_IS_FALSE(filter_matches("exists(macAddress)", telemetry));
+}
+
+/*Tests_SRS_LINK_FILTER_30_002: [ LinkFilter_Create shall compile expression, made of the comparisons `name == 'value'`, `name != 'value'`, `prefix(name, 'value')` and `exists(name)`, combined with `!`, `&&`, `||` and parentheses, where `!` binds tighter than `&&`, which binds tighter than `||`. ]*/
+/*Tests_SRS_LINK_FILTER_30_014: [ `!`, `&&` and `||` shall be the boolean not, and and or of their operands; `&&` and `||` shall not evaluate their right operand when the left one decides the result. ]*/
+TEST_FUNCTION(LinkFilter_Matches_combines_comparisons)
+{
+    ///act
+    ///assert
+    ASSERT_IS_TRUE(filter_matches("deviceFunction == 'register' && exists(macAddress)", registration));
+    ASSERT_IS_FALSE(filter_matches("deviceFunction == 'register' && !exists(macAddress)", registration));
+    ASSERT_IS_FALSE(filter_matches("deviceFunction == 'register' || exists(macAddress)", telemetry));
+    ASSERT_IS_TRUE(filter_matches("exists(nothing) && exists(nothing) || exists(macAddress)", registration));
+    ASSERT_IS_FALSE(filter_matches("exists(nothing) && (exists(nothing) || exists(macAddress))", registration));
+    ASSERT_IS_TRUE(filter_matches("!(deviceFunction == 'telemetry' || exists(nothing))", registration));
+    ASSERT_IS_TRUE(filter_matches("!!exists(macAddress)", registration));
+}
+
+/*Tests_SRS_LINK_FILTER_30_014: [ `!`, `&&` and `||` shall be the boolean not, and and or of their operands; `&&` and `||` shall not evaluate their right operand when the left one decides the result. ]*/
+TEST_FUNCTION(LinkFilter_Matches_short_circuits)
+{
+    ///arrange
+    LINK_FILTER_HANDLE filter = LinkFilter_Create("exists(macAddress) || exists(nothing)");
+
+    ///act
+    bool result = LinkFilter_Matches(filter, lookup_property, registration);
+
+    ///assert
+    ASSERT_IS_TRUE(result);
+    ASSERT_ARE_EQUAL(size_t, 1, lookup_count);
+
+    ///ablutions
+    LinkFilter_Destroy(filter);
+}
+
+/*Tests_SRS_LINK_FILTER_30_003: [ A property name shall be either a run of letters, digits, '_', '.', '-' and ':', or a quoted string; a value shall be a quoted string. Strings shall be enclosed in single or double quotes and have no escapes. ]*/
+TEST_FUNCTION(LinkFilter_Matches_quoted_names_and_values)
+{
+    ///act
+    ///assert
+    ASSERT_IS_TRUE(filter_matches("'deviceFunction' == \"register\"", registration));
+    ASSERT_IS_TRUE(filter_matches("\"source.name\" == 'sensor-7'", registration));
+    ASSERT_IS_TRUE(filter_matches("deviceFunction==\"register\"&&exists(macAddress)", registration));
+}
+
+/*Tests_SRS_LINK_FILTER_30_015: [ LinkFilter_Matches shall get the value of the property name by calling lookup with context and name; NULL shall mean that the message does not have the property. ]*/
+TEST_FUNCTION(LinkFilter_Matches_reads_properties_with_lookup)
+{
+    ///arrange
+    static const char* no_properties[] = { NULL };
+    LINK_FILTER_HANDLE equals = LinkFilter_Create("deviceFunction == 'register'");
+    LINK_FILTER_HANDLE not_equals = LinkFilter_Create("deviceFunction != 'register'");
+    umock_c_reset_all_calls();
+
+    ///act
+    bool equals_result = LinkFilter_Matches(equals, lookup_property, no_properties);
+    bool not_equals_result = LinkFilter_Matches(not_equals, lookup_property, no_properties);
+
+    ///assert
+    ASSERT_IS_FALSE(equals_result);
+    ASSERT_IS_TRUE(not_equals_result);
+    ASSERT_ARE_EQUAL(size_t, 2, lookup_count);
+    ASSERT_ARE_EQUAL(void_ptr, (void*)no_properties, (void*)last_lookup_context);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    ///ablutions
+    LinkFilter_Destroy(equals);
+    LinkFilter_Destroy(not_equals);
+}
+
+END_TEST_SUITE(link_filter_ut)
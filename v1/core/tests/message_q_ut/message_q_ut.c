@@ -311,6 +311,7 @@ TEST_FUNCTION(MESSAGE_QUEUE_push_does_nothing_with_null_params)
 }
 
 /*Tests_SRS_MESSAGE_QUEUE_17_008: [ MESSAGE_QUEUE_push shall return zero on success. ]*/
+/*Tests_SRS_MESSAGE_QUEUE_30_007: [ MESSAGE_QUEUE_push shall push element on lane 0. ]*/
 TEST_FUNCTION(MESSAGE_QUEUE_push_success)
 {
 	///arrange
@@ -567,6 +568,381 @@ TEST_FUNCTION(MESSAGE_QUEUE_front_returns_null_empty_queue)
 	MESSAGE_QUEUE_destroy(mq);
 }
 
+static bool match_message(MESSAGE_HANDLE message, const void* context)
+{
+	return message == (MESSAGE_HANDLE)context;
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_001: [ MESSAGE_QUEUE_replace_if shall return NULL if handle, predicate or element are NULL, or if priority is not less than MESSAGE_QUEUE_PRIORITIES. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_replace_if_returns_null_with_null_params)
+{
+	///arrange
+	MESSAGE_HANDLE mh = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	umock_c_reset_all_calls();
+
+	///act
+	MESSAGE_HANDLE r1 = MESSAGE_QUEUE_replace_if(NULL, match_message, mh, mh, 0);
+	MESSAGE_HANDLE r2 = MESSAGE_QUEUE_replace_if(mq, NULL, mh, mh, 0);
+	MESSAGE_HANDLE r3 = MESSAGE_QUEUE_replace_if(mq, match_message, mh, NULL, 0);
+	MESSAGE_HANDLE r4 = MESSAGE_QUEUE_replace_if(mq, match_message, mh, mh, MESSAGE_QUEUE_PRIORITIES);
+
+	///assert
+	ASSERT_IS_NULL(r1);
+	ASSERT_IS_NULL(r2);
+	ASSERT_IS_NULL(r3);
+	ASSERT_IS_NULL(r4);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_002: [ MESSAGE_QUEUE_replace_if shall call predicate with each message queued on lane priority and context, starting with the most recently pushed one. ]*/
+/*Tests_SRS_MESSAGE_QUEUE_30_003: [ MESSAGE_QUEUE_replace_if shall put element in place of the first message for which predicate returns true, and return that message. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_replace_if_replaces_message_in_place)
+{
+	///arrange
+	MESSAGE_HANDLE mh1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mh2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_HANDLE mh3 = (MESSAGE_HANDLE)(0x44);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	MESSAGE_QUEUE_push(mq, mh1);
+	MESSAGE_QUEUE_push(mq, mh2);
+	umock_c_reset_all_calls();
+
+	///act
+	MESSAGE_HANDLE replaced = MESSAGE_QUEUE_replace_if(mq, match_message, mh1, mh3, 0);
+
+	///assert
+	ASSERT_IS_TRUE((replaced == mh1));
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(size_t, 2, MESSAGE_QUEUE_size(mq));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == mh3));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == mh2));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_004: [ If predicate returns false for every queued message, MESSAGE_QUEUE_replace_if shall leave the queue unchanged and return NULL. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_replace_if_returns_null_when_nothing_matches)
+{
+	///arrange
+	MESSAGE_HANDLE mh1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mh2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	MESSAGE_QUEUE_push(mq, mh1);
+	umock_c_reset_all_calls();
+
+	///act
+	MESSAGE_HANDLE replaced = MESSAGE_QUEUE_replace_if(mq, match_message, mh2, mh2, 0);
+
+	///assert
+	ASSERT_IS_NULL(replaced);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_ARE_EQUAL(size_t, 1, MESSAGE_QUEUE_size(mq));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_front(mq) == mh1));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_005: [ MESSAGE_QUEUE_size shall return 0 if handle is NULL. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_size_returns_0_with_null)
+{
+	///arrange
+	///act
+	size_t size = MESSAGE_QUEUE_size(NULL);
+	///assert
+	ASSERT_ARE_EQUAL(size_t, 0, size);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	///ablutions
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_006: [ MESSAGE_QUEUE_size shall return the number of messages on the queue. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_size_counts_pushed_and_popped_messages)
+{
+	///arrange
+	MESSAGE_HANDLE mh1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mh2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+
+	///act
+	size_t empty_size = MESSAGE_QUEUE_size(mq);
+	MESSAGE_QUEUE_push(mq, mh1);
+	MESSAGE_QUEUE_push(mq, mh2);
+	size_t full_size = MESSAGE_QUEUE_size(mq);
+	(void)MESSAGE_QUEUE_pop(mq);
+	size_t popped_size = MESSAGE_QUEUE_size(mq);
+
+	///assert
+	ASSERT_ARE_EQUAL(size_t, 0, empty_size);
+	ASSERT_ARE_EQUAL(size_t, 2, full_size);
+	ASSERT_ARE_EQUAL(size_t, 1, popped_size);
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_008: [ MESSAGE_QUEUE_push_with_priority shall return a non-zero value if handle or element are NULL, or if priority is not less than MESSAGE_QUEUE_PRIORITIES. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_push_with_priority_fails_with_bad_params)
+{
+	///arrange
+	MESSAGE_HANDLE element = (MESSAGE_HANDLE)0x42;
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	umock_c_reset_all_calls();
+
+	///act
+	int mp1 = MESSAGE_QUEUE_push_with_priority(NULL, element, 0);
+	int mp2 = MESSAGE_QUEUE_push_with_priority(mq, NULL, 0);
+	int mp3 = MESSAGE_QUEUE_push_with_priority(mq, element, MESSAGE_QUEUE_PRIORITIES);
+
+	///assert
+	ASSERT_ARE_NOT_EQUAL(int, 0, mp1);
+	ASSERT_ARE_NOT_EQUAL(int, 0, mp2);
+	ASSERT_ARE_NOT_EQUAL(int, 0, mp3);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_IS_TRUE(MESSAGE_QUEUE_is_empty(mq));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_009: [ MESSAGE_QUEUE_pop shall remove the oldest message of the highest priority lane that has messages. ]*/
+/*Tests_SRS_MESSAGE_QUEUE_30_012: [ MESSAGE_QUEUE_front shall look at the lane MESSAGE_QUEUE_pop would remove a message from. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_pop_takes_higher_priority_messages_first)
+{
+	///arrange
+	MESSAGE_HANDLE low1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE low2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_HANDLE high1 = (MESSAGE_HANDLE)(0x44);
+	MESSAGE_HANDLE high2 = (MESSAGE_HANDLE)(0x45);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	(void)MESSAGE_QUEUE_push(mq, low1);
+	(void)MESSAGE_QUEUE_push_with_priority(mq, high1, MESSAGE_QUEUE_PRIORITIES - 1);
+	(void)MESSAGE_QUEUE_push_with_priority(mq, low2, 0);
+	(void)MESSAGE_QUEUE_push_with_priority(mq, high2, MESSAGE_QUEUE_PRIORITIES - 1);
+
+	///act
+	size_t size = MESSAGE_QUEUE_size(mq);
+	MESSAGE_HANDLE front = MESSAGE_QUEUE_front(mq);
+	MESSAGE_HANDLE mh1 = MESSAGE_QUEUE_pop(mq);
+	MESSAGE_HANDLE mh2 = MESSAGE_QUEUE_pop(mq);
+	MESSAGE_HANDLE mh3 = MESSAGE_QUEUE_pop(mq);
+	MESSAGE_HANDLE mh4 = MESSAGE_QUEUE_pop(mq);
+
+	///assert
+	ASSERT_ARE_EQUAL(size_t, 4, size);
+	ASSERT_IS_TRUE((front == high1));
+	ASSERT_IS_TRUE((mh1 == high1));
+	ASSERT_IS_TRUE((mh2 == high2));
+	ASSERT_IS_TRUE((mh3 == low1));
+	ASSERT_IS_TRUE((mh4 == low2));
+	ASSERT_IS_TRUE(MESSAGE_QUEUE_is_empty(mq));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_010: [ If a lower lane that has messages has been passed over MESSAGE_QUEUE_STARVATION_LIMIT times in a row, MESSAGE_QUEUE_pop shall remove the oldest message of the lowest such lane instead. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_pop_does_not_starve_lower_priority_messages)
+{
+	///arrange
+	MESSAGE_HANDLE low = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE high = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	size_t i;
+	(void)MESSAGE_QUEUE_push(mq, low);
+	for (i = 0; i < MESSAGE_QUEUE_STARVATION_LIMIT + 1; i++)
+	{
+		(void)MESSAGE_QUEUE_push_with_priority(mq, high, 1);
+	}
+
+	///act
+	size_t high_popped = 0;
+	while (MESSAGE_QUEUE_pop(mq) == high)
+	{
+		high_popped++;
+	}
+
+	///assert
+	ASSERT_ARE_EQUAL(size_t, MESSAGE_QUEUE_STARVATION_LIMIT, high_popped);
+	ASSERT_ARE_EQUAL(size_t, 1, MESSAGE_QUEUE_size(mq));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == high));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_002: [ MESSAGE_QUEUE_replace_if shall call predicate with each message queued on lane priority and context, starting with the most recently pushed one. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_replace_if_replaces_message_on_its_lane)
+{
+	///arrange
+	MESSAGE_HANDLE mh = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE low = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_HANDLE replacement = (MESSAGE_HANDLE)(0x44);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	(void)MESSAGE_QUEUE_push(mq, mh);
+	(void)MESSAGE_QUEUE_push(mq, low);
+	(void)MESSAGE_QUEUE_push_with_priority(mq, mh, 2);
+
+	///act
+	MESSAGE_HANDLE replaced = MESSAGE_QUEUE_replace_if(mq, match_message, mh, replacement, 0);
+	MESSAGE_HANDLE not_replaced = MESSAGE_QUEUE_replace_if(mq, match_message, low, replacement, 1);
+
+	///assert
+	ASSERT_IS_TRUE((replaced == mh));
+	ASSERT_IS_NULL(not_replaced);
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == mh));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == replacement));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == low));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_015: [ MESSAGE_QUEUE_evict shall return NULL on a NULL or empty message queue. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_evict_returns_null_with_null_or_empty_queue)
+{
+	///arrange
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	umock_c_reset_all_calls();
+
+	///act
+	MESSAGE_HANDLE r1 = MESSAGE_QUEUE_evict(NULL);
+	MESSAGE_HANDLE r2 = MESSAGE_QUEUE_evict(mq);
+
+	///assert
+	ASSERT_IS_NULL(r1);
+	ASSERT_IS_NULL(r2);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_016: [ MESSAGE_QUEUE_evict shall remove the oldest message of the lowest priority lane that has messages. ]*/
+/*Tests_SRS_MESSAGE_QUEUE_30_017: [ MESSAGE_QUEUE_evict shall not change the order in which MESSAGE_QUEUE_pop removes the remaining messages. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_evict_removes_oldest_message_of_lowest_lane)
+{
+	///arrange
+	MESSAGE_HANDLE low = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mid1 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_HANDLE mid2 = (MESSAGE_HANDLE)(0x44);
+	MESSAGE_HANDLE high = (MESSAGE_HANDLE)(0x45);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	size_t i;
+	(void)MESSAGE_QUEUE_push_with_priority(mq, high, 3);
+	(void)MESSAGE_QUEUE_push_with_priority(mq, mid1, 1);
+	(void)MESSAGE_QUEUE_push(mq, low);
+	(void)MESSAGE_QUEUE_push_with_priority(mq, mid2, 1);
+	for (i = 0; i < MESSAGE_QUEUE_STARVATION_LIMIT; i++)
+	{
+		(void)MESSAGE_QUEUE_push_with_priority(mq, high, 3);
+	}
+
+	///act
+	MESSAGE_HANDLE popped = MESSAGE_QUEUE_pop(mq);
+	MESSAGE_HANDLE evicted1 = MESSAGE_QUEUE_evict(mq);
+	MESSAGE_HANDLE evicted2 = MESSAGE_QUEUE_evict(mq);
+	size_t high_popped = 0;
+	while (MESSAGE_QUEUE_front(mq) == high)
+	{
+		(void)MESSAGE_QUEUE_pop(mq);
+		high_popped++;
+	}
+
+	///assert
+	ASSERT_IS_TRUE((popped == high));
+	ASSERT_IS_TRUE((evicted1 == low));
+	ASSERT_IS_TRUE((evicted2 == mid1));
+	ASSERT_ARE_EQUAL(size_t, MESSAGE_QUEUE_STARVATION_LIMIT - 1, high_popped);
+	ASSERT_ARE_EQUAL(size_t, 2, MESSAGE_QUEUE_size(mq));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == mid2));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == high));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_018: [ When MESSAGE_QUEUE_pop or MESSAGE_QUEUE_evict removes the last message of a lane, the count of pops that passed over the lane shall start over at 0. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_evict_of_a_starved_lane_resets_its_starvation)
+{
+	///arrange
+	MESSAGE_HANDLE low1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE low2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_HANDLE high = (MESSAGE_HANDLE)(0x44);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+	size_t i;
+	(void)MESSAGE_QUEUE_push(mq, low1);
+	for (i = 0; i < 2 * MESSAGE_QUEUE_STARVATION_LIMIT + 1; i++)
+	{
+		(void)MESSAGE_QUEUE_push_with_priority(mq, high, 1);
+	}
+	for (i = 0; i < MESSAGE_QUEUE_STARVATION_LIMIT; i++)
+	{
+		(void)MESSAGE_QUEUE_pop(mq);
+	}
+
+	///act
+	MESSAGE_HANDLE evicted = MESSAGE_QUEUE_evict(mq);
+	(void)MESSAGE_QUEUE_push(mq, low2);
+	size_t high_popped = 0;
+	while (MESSAGE_QUEUE_front(mq) == high)
+	{
+		(void)MESSAGE_QUEUE_pop(mq);
+		high_popped++;
+	}
+
+	///assert
+	ASSERT_IS_TRUE((evicted == low1));
+	ASSERT_ARE_EQUAL(size_t, MESSAGE_QUEUE_STARVATION_LIMIT, high_popped);
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == low2));
+	ASSERT_IS_TRUE((MESSAGE_QUEUE_pop(mq) == high));
+	ASSERT_IS_TRUE(MESSAGE_QUEUE_is_empty(mq));
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_013: [ MESSAGE_QUEUE_peak_size shall return 0 if handle is NULL. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_peak_size_returns_0_with_null)
+{
+	///arrange
+	///act
+	size_t size = MESSAGE_QUEUE_peak_size(NULL);
+	///assert
+	ASSERT_ARE_EQUAL(size_t, 0, size);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	///ablutions
+}
+
+/*Tests_SRS_MESSAGE_QUEUE_30_014: [ MESSAGE_QUEUE_peak_size shall return the largest number of messages the queue has held since it was created. ]*/
+TEST_FUNCTION(MESSAGE_QUEUE_peak_size_keeps_the_largest_size)
+{
+	///arrange
+	MESSAGE_HANDLE mh1 = (MESSAGE_HANDLE)(0x42);
+	MESSAGE_HANDLE mh2 = (MESSAGE_HANDLE)(0x43);
+	MESSAGE_QUEUE_HANDLE mq = MESSAGE_QUEUE_create();
+
+	///act
+	size_t empty_peak = MESSAGE_QUEUE_peak_size(mq);
+	MESSAGE_QUEUE_push(mq, mh1);
+	(void)MESSAGE_QUEUE_push_with_priority(mq, mh2, 1);
+	(void)MESSAGE_QUEUE_pop(mq);
+	(void)MESSAGE_QUEUE_pop(mq);
+	MESSAGE_QUEUE_push(mq, mh1);
+	size_t peak = MESSAGE_QUEUE_peak_size(mq);
+
+	///assert
+	ASSERT_ARE_EQUAL(size_t, 0, empty_peak);
+	ASSERT_ARE_EQUAL(size_t, 2, peak);
+
+	///ablutions
+	MESSAGE_QUEUE_destroy(mq);
+}
+
 ///arrange
 ///act
 ///assert
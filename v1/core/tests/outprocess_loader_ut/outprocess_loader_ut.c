@@ -121,6 +121,7 @@ static pfModuleLoader_FreeModuleConfiguration OutprocessModuleLoader_FreeModuleC
 MOCKABLE_FUNCTION(, void, json_free_serialized_string, char*, string);
 MOCKABLE_FUNCTION(, size_t, json_array_get_count, const JSON_Array*, array);
 MOCKABLE_FUNCTION(, const char*, json_array_get_string, const JSON_Array*, array, size_t, size);
+MOCKABLE_FUNCTION(, double, json_array_get_number, const JSON_Array*, array, size_t, index);
 MOCKABLE_FUNCTION(, char*, json_serialize_to_string, const JSON_Value*, value);
 MOCKABLE_FUNCTION(, JSON_Array*, json_object_get_array, const JSON_Object*, object, const char*, name);
 MOCKABLE_FUNCTION(, JSON_Object*, json_object_get_object, const JSON_Object*, object, const char*, name);
@@ -181,6 +182,9 @@ MOCK_FUNCTION_END(0)
 MOCK_FUNCTION_WITH_CODE(, const char*, json_array_get_string, const JSON_Array*, array, size_t, size)
 MOCK_FUNCTION_END(NULL)
 
+MOCK_FUNCTION_WITH_CODE(, double, json_array_get_number, const JSON_Array*, array, size_t, index)
+MOCK_FUNCTION_END(0)
+
 MOCK_FUNCTION_WITH_CODE(, JSON_Array*, json_object_get_array, const JSON_Object*, object, const char*, name)
 MOCK_FUNCTION_END(NULL)
 
@@ -1022,6 +1026,7 @@ TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_succeeds)
 	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_LOADER_ENTRYPOINT)));
 	STRICT_EXPECTED_CALL(STRING_construct(control_id));
     expected_calls_update_entrypoint_with_launch_object();
+	STRICT_EXPECTED_CALL(json_object_get_object((JSON_Object*)0x43, "thread"));
 	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "timeout"))
 		.SetReturn(2000);
 	STRICT_EXPECTED_CALL(STRING_construct(NULL));
@@ -1035,6 +1040,96 @@ TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_succeeds)
 	OutprocessModuleLoader_FreeEntrypoint(NULL, result);
 }
 
+/*Tests_SRS_OUTPROCESS_LOADER_30_001: [ If `json` has a "thread" object, this function shall read its "cpus", "nice" and "fifo.priority" values into the entrypoint `thread_scheduling`; a missing value leaves that setting of the proxy module threads unchanged. ]*/
+TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_reads_thread_scheduling)
+{
+	// arrange
+	char * activation_type = "none";
+	char * control_id = "a url";
+
+	STRICT_EXPECTED_CALL(json_value_get_type((JSON_Value*)0x42))
+		.SetReturn(JSONObject);
+	STRICT_EXPECTED_CALL(json_value_get_object((JSON_Value*)0x42))
+		.SetReturn((JSON_Object*)0x43);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "activation.type"))
+		.SetReturn(activation_type);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "control.id"))
+		.SetReturn(control_id);
+	STRICT_EXPECTED_CALL(json_object_get_object((JSON_Object*)0x43, "launch"));
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.id"))
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_LOADER_ENTRYPOINT)));
+	STRICT_EXPECTED_CALL(STRING_construct(control_id));
+	STRICT_EXPECTED_CALL(json_object_get_object((JSON_Object*)0x43, "thread"))
+		.SetReturn((JSON_Object*)0x45);
+	STRICT_EXPECTED_CALL(json_object_get_array((JSON_Object*)0x45, "cpus"))
+		.SetReturn((JSON_Array*)0x46);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x45, "nice"))
+		.SetReturn(5);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x45, "fifo.priority"));
+	STRICT_EXPECTED_CALL(json_array_get_count((JSON_Array*)0x46))
+		.SetReturn(2);
+	STRICT_EXPECTED_CALL(json_array_get_number((JSON_Array*)0x46, 0))
+		.SetReturn(1);
+	STRICT_EXPECTED_CALL(json_array_get_number((JSON_Array*)0x46, 1))
+		.SetReturn(3);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x43, "timeout"));
+	STRICT_EXPECTED_CALL(STRING_construct(NULL));
+
+	// act
+	OUTPROCESS_LOADER_ENTRYPOINT* result = (OUTPROCESS_LOADER_ENTRYPOINT*)OutprocessModuleLoader_ParseEntrypointFromJson(NULL, (JSON_Value*)0x42);
+
+	// assert
+	ASSERT_IS_NOT_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	ASSERT_IS_TRUE(result->thread_scheduling.cpu_affinity == 0xA);
+	ASSERT_ARE_EQUAL(int, 5, result->thread_scheduling.nice);
+	ASSERT_ARE_EQUAL(int, 0, result->thread_scheduling.fifo_priority);
+
+	// cleanup
+	OutprocessModuleLoader_FreeEntrypoint(NULL, result);
+}
+
+/*Tests_SRS_OUTPROCESS_LOADER_30_002: [ This function shall return `NULL` if a "cpus" entry is not a CPU number below `THREAD_SCHEDULING_MAX_CPUS`, "nice" is not a whole number from `THREAD_SCHEDULING_MIN_NICE` to `THREAD_SCHEDULING_MAX_NICE`, or "fifo.priority" is not a whole number from 0 to `THREAD_SCHEDULING_MAX_FIFO_PRIORITY`. ]*/
+/*Tests_SRS_OUTPROCESS_LOADER_17_021: [ This function shall return NULL if any calls fails. ]*/
+TEST_FUNCTION(OutprocessModuleLoader_ParseEntrypointFromJson_returns_NULL_when_thread_is_misconfigured)
+{
+	// arrange
+	char * activation_type = "none";
+	char * control_id = "a url";
+
+	STRICT_EXPECTED_CALL(json_value_get_type((JSON_Value*)0x42))
+		.SetReturn(JSONObject);
+	STRICT_EXPECTED_CALL(json_value_get_object((JSON_Value*)0x42))
+		.SetReturn((JSON_Object*)0x43);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "activation.type"))
+		.SetReturn(activation_type);
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "control.id"))
+		.SetReturn(control_id);
+	STRICT_EXPECTED_CALL(json_object_get_object((JSON_Object*)0x43, "launch"));
+	STRICT_EXPECTED_CALL(json_object_get_string((JSON_Object*)0x43, "message.id"))
+		.SetReturn(NULL);
+	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(OUTPROCESS_LOADER_ENTRYPOINT)));
+	STRICT_EXPECTED_CALL(STRING_construct(control_id));
+	STRICT_EXPECTED_CALL(json_object_get_object((JSON_Object*)0x43, "thread"))
+		.SetReturn((JSON_Object*)0x45);
+	STRICT_EXPECTED_CALL(json_object_get_array((JSON_Object*)0x45, "cpus"));
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x45, "nice"))
+		.SetReturn(THREAD_SCHEDULING_MAX_NICE + 1);
+	STRICT_EXPECTED_CALL(json_object_get_number((JSON_Object*)0x45, "fifo.priority"));
+	STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG))
+		.IgnoreArgument(1);
+
+	// act
+	void* result = OutprocessModuleLoader_ParseEntrypointFromJson(NULL, (JSON_Value*)0x42);
+
+	// assert
+	ASSERT_IS_NULL(result);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
 /*Tests_SRS_OUTPROCESS_LOADER_17_023: [ This function shall release all resources allocated by OutprocessModuleLoader_ParseEntrypointFromJson. ]*/
 TEST_FUNCTION(OutprocessModuleLoader_FreeEntrypoint_does_nothing_when_entrypoint_is_NULL)
 {
@@ -1135,6 +1230,7 @@ TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_returns_null_on_nu
 /*Tests_SRS_OUTPROCESS_LOADER_17_034: [ This function shall allocate and copy the module_configuration string and assign it the OUTPROCESS_MODULE_CONFIG::outprocess_module_args field. ]*/
 /*Tests_SRS_OUTPROCESS_LOADER_17_035: [ Upon success, this function shall return a valid pointer to an OUTPROCESS_MODULE_CONFIG structure. ]*/
 /*Tests_SRS_OUTPROCESS_LOADER_17_027: [ This function shall allocate a OUTPROCESS_MODULE_CONFIG structure. ]*/
+/*Tests_SRS_OUTPROCESS_LOADER_30_003: [ This function shall copy the entrypoint `thread_scheduling` to the `OUTPROCESS_MODULE_CONFIG::thread_scheduling` field. ]*/
 TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_success_with_msg_url)
 {
 	//arrange
@@ -1145,7 +1241,8 @@ TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_success_with_msg_u
 		STRING_construct("message_id"),
 		0,
 		NULL,
-		0
+		0,
+		{ 0x3, 5, 0 }
 	};
 	STRING_HANDLE mc = STRING_construct("message config");
 
@@ -1166,6 +1263,8 @@ TEST_FUNCTION(OutprocessModuleLoader_BuildModuleConfiguration_success_with_msg_u
 	ASSERT_ARE_EQUAL(char_ptr, STRING_c_str(omc->control_uri), "ipc://control_id");
 	ASSERT_ARE_EQUAL(char_ptr, STRING_c_str(omc->message_uri), "ipc://message_id");
 	ASSERT_ARE_EQUAL(char_ptr, STRING_c_str(omc->outprocess_module_args), STRING_c_str(mc));
+	ASSERT_IS_TRUE(omc->thread_scheduling.cpu_affinity == 0x3);
+	ASSERT_ARE_EQUAL(int, 5, omc->thread_scheduling.nice);
 
 	//cleanup
 	OutprocessModuleLoader_FreeModuleConfiguration(NULL, result);
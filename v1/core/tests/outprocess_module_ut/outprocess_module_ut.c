@@ -59,6 +59,8 @@ void my_gballoc_free(void* ptr)
 #include "broker.h"
 #include "module_loader.h"
 #include "message_queue.h"
+#include "monotonic_clock.h"
+#include "thread_scheduling.h"
 
 #undef ENABLE_MOCKS
 #include "control_message.h"
@@ -158,6 +160,23 @@ MOCK_FUNCTION_WITH_CODE(, int, nn_send, int, s, const void *, buf, size_t, len,
 	}
 MOCK_FUNCTION_END(send_length)
 
+MOCK_FUNCTION_WITH_CODE(, int, nn_sendmsg, int, s, const struct nn_msghdr *, msghdr, int, flags)
+	int send_length = 0;
+	current_nn_send_index++;
+	if (should_nn_send_fail || (current_nn_send_index == when_shall_nn_send_fail))
+	{
+		send_length = -1;
+	}
+	else
+	{
+		int i;
+		for (i = 0; i < msghdr->msg_iovlen; i++)
+		{
+			send_length += (int)msghdr->msg_iov[i].iov_len;
+		}
+	}
+MOCK_FUNCTION_END(send_length)
+
 static bool should_nn_recv_fail = false;
 static int current_nn_recv_index;
 static int when_shall_nn_recv_fail;
@@ -330,21 +349,81 @@ uint8_t *counter = (uint8_t*)m2;
 *counter = 1;
 MOCK_FUNCTION_END(m2)
 
+/*the message made from a received buffer, which releases it when destroyed*/
+static MESSAGE_HANDLE owning_message;
+static void* owned_buffer;
+static MESSAGE_BUFFER_RELEASE owned_buffer_release;
+
+MOCK_FUNCTION_WITH_CODE(, MESSAGE_HANDLE, Message_CreateFromByteArrayWithRelease, unsigned char*, source, int32_t, size, MESSAGE_BUFFER_RELEASE, release)
+MESSAGE_HANDLE m3 = (MESSAGE_HANDLE)my_gballoc_malloc(size);
+if (m3 != NULL)
+{
+	uint8_t *counter = (uint8_t*)m3;
+	*counter = 1;
+	owning_message = m3;
+	owned_buffer = source;
+	owned_buffer_release = release;
+}
+MOCK_FUNCTION_END(m3)
+
 MOCK_FUNCTION_WITH_CODE(, int32_t, Message_ToByteArray, MESSAGE_HANDLE, messageHandle, unsigned char*, buf, int32_t, size)
 int32_t array_size = default_serialized_size;
 MOCK_FUNCTION_END(array_size)
 
+MOCK_FUNCTION_WITH_CODE(, int32_t, Message_ToByteArrayWithVersion, MESSAGE_HANDLE, messageHandle, uint8_t, version, unsigned char*, buf, int32_t, size)
+int32_t array_size = default_serialized_size;
+MOCK_FUNCTION_END(array_size)
+
+MOCK_FUNCTION_WITH_CODE(, CONSTBUFFER_HANDLE, Message_GetSerializationHeader, MESSAGE_HANDLE, message, uint8_t, version)
+CONSTBUFFER_HANDLE header = (CONSTBUFFER_HANDLE)my_gballoc_malloc(1);
+MOCK_FUNCTION_END(header)
+
+MOCK_FUNCTION_WITH_CODE(, size_t, Message_GetContentSegmentCount, MESSAGE_HANDLE, message)
+MOCK_FUNCTION_END(1)
+
+/*the content of the messages sent is all in their serialization header*/
+static CONSTBUFFER content_segment;
+
+MOCK_FUNCTION_WITH_CODE(, const CONSTBUFFER*, Message_GetContentSegment, MESSAGE_HANDLE, message, size_t, index)
+content_segment.buffer = NULL;
+content_segment.size = 0;
+MOCK_FUNCTION_END(&content_segment)
+
+static CONSTBUFFER serialized_content;
+
+MOCK_FUNCTION_WITH_CODE(, const CONSTBUFFER*, CONSTBUFFER_GetContent, CONSTBUFFER_HANDLE, constbufferHandle)
+serialized_content.buffer = NULL;
+serialized_content.size = default_serialized_size;
+MOCK_FUNCTION_END(&serialized_content)
+
+MOCK_FUNCTION_WITH_CODE(, void, CONSTBUFFER_Destroy, CONSTBUFFER_HANDLE, constbufferHandle)
+my_gballoc_free(constbufferHandle);
+MOCK_FUNCTION_END()
+
+MOCK_FUNCTION_WITH_CODE(, bool, Message_IsExpired, MESSAGE_HANDLE, message, uint64_t, now)
+MOCK_FUNCTION_END(false)
+
 MOCK_FUNCTION_WITH_CODE(, void, Message_Destroy, MESSAGE_HANDLE, message)
 uint8_t *counter = (uint8_t*)message;
 --(*counter);
 if (*counter == 0)
+{
+	if (message == owning_message)
+	{
+		owning_message = NULL;
+		owned_buffer_release(owned_buffer);
+	}
 	my_gballoc_free(message);
+}
 MOCK_FUNCTION_END()
 
 
 MOCK_FUNCTION_WITH_CODE(, BROKER_RESULT, Broker_Publish, BROKER_HANDLE, broker, MODULE_HANDLE, source, MESSAGE_HANDLE, message)
 MOCK_FUNCTION_END(BROKER_OK)
 
+MOCK_FUNCTION_WITH_CODE(, BROKER_RESULT, Broker_ReportExpired, BROKER_HANDLE, broker, MODULE_HANDLE, module, size_t, count)
+MOCK_FUNCTION_END(BROKER_OK)
+
 BEGIN_TEST_SUITE(OutprocessModule_UnitTests)
 
 TEST_SUITE_INITIALIZE(TestClassInitialize)
@@ -362,6 +441,9 @@ TEST_SUITE_INITIALIZE(TestClassInitialize)
 	REGISTER_UMOCK_ALIAS_TYPE(MODULE_HANDLE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(BROKER_HANDLE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_HANDLE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(CONSTBUFFER_HANDLE, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(const struct nn_msghdr *, void*);
+	REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_BUFFER_RELEASE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_QUEUE_HANDLE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(LOCK_HANDLE, void*);
 	REGISTER_UMOCK_ALIAS_TYPE(LOCK_RESULT, int);
@@ -370,6 +452,7 @@ TEST_SUITE_INITIALIZE(TestClassInitialize)
 	REGISTER_UMOCK_ALIAS_TYPE(MODULE_API_VERSION, int);
 	REGISTER_UMOCK_ALIAS_TYPE(BROKER_RESULT, int);
 	REGISTER_UMOCK_ALIAS_TYPE(THREADAPI_RESULT, int);
+	REGISTER_UMOCK_ALIAS_TYPE(const THREAD_SCHEDULING_CONFIG*, void*);
 
 	// STRING
 	REGISTER_GLOBAL_MOCK_HOOK(STRING_construct, real_STRING_construct);
@@ -658,6 +741,8 @@ TEST_FUNCTION(Outprocess_Create_success)
 		.IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(nn_freemsg(IGNORED_PTR_ARG))
 		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(ControlMessage_Destroy(IGNORED_PTR_ARG))
 		.IgnoreArgument(1);
 
@@ -734,6 +819,8 @@ TEST_FUNCTION(Outprocess_Create_success_on_2nd_recv)
 		.IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(nn_freemsg(IGNORED_PTR_ARG))
 		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(ControlMessage_Destroy(IGNORED_PTR_ARG))
 		.IgnoreArgument(1);
 
@@ -3020,6 +3107,9 @@ TEST_FUNCTION(Outprocess_outgoing_thread_does_nothing_with_nothing)
 /*Tests_SRS_OUTPROCESS_MODULE_17_024: [ This function shall send the message on the message channel. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_055: [ This function shall Destroy the message once successfully transmitted. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_025: [ This function shall free any resources created. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_003: [ This function shall serialize the message in the version kept from the last successful Create Response, GATEWAY_MESSAGE_VERSION_1 until there is one. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_004: [ This function shall use the serialization kept with the message, so that a message sent on several links is serialized once. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_006: [ This function shall send the serialization without the content, then each segment of the content of the message, in one gather write with `nn_sendmsg`, without first assembling a contiguous serialization; nanomsg copies the segments into its message chunk. ]*/
 TEST_FUNCTION(Outprocess_outgoing_thread_success)
 {
 	// arrange
@@ -3039,11 +3129,65 @@ TEST_FUNCTION(Outprocess_outgoing_thread_success)
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(msg);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(Message_ToByteArray(msg, NULL, 0));
-	STRICT_EXPECTED_CALL(nn_allocmsg(default_serialized_size, 0));
-	STRICT_EXPECTED_CALL(Message_ToByteArray(msg, IGNORED_PTR_ARG, default_serialized_size))
-		.IgnoreArgument(2);
-	STRICT_EXPECTED_CALL(nn_send(1, IGNORED_PTR_ARG, NN_MSG, 0)).IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(MonotonicClock_GetMicroseconds());
+	STRICT_EXPECTED_CALL(Message_IsExpired(msg, 0));
+	STRICT_EXPECTED_CALL(Message_GetSerializationHeader(msg, GATEWAY_MESSAGE_VERSION_1));
+	STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Message_GetContentSegmentCount(msg));
+	STRICT_EXPECTED_CALL(Message_GetContentSegment(msg, 0));
+	STRICT_EXPECTED_CALL(nn_sendmsg(1, IGNORED_PTR_ARG, 0)).IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Message_Destroy(msg));
+	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(LOCK_ERROR);
+
+	// act
+	//third thread created is outgoing message thread
+	thread_func_to_call[3](thread_func_args[3]);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_002: [ On a successful Create Response, this function shall keep GATEWAY_MESSAGE_VERSION_2 as the version of the messages sent to the module host if the gateway_message_version of the reply is at least GATEWAY_MESSAGE_VERSION_2, and GATEWAY_MESSAGE_VERSION_1 otherwise. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_003: [ This function shall serialize the message in the version kept from the last successful Create Response, GATEWAY_MESSAGE_VERSION_1 until there is one. ]*/
+TEST_FUNCTION(Outprocess_outgoing_thread_serializes_in_the_version_of_the_create_reply)
+{
+	// arrange
+	global_control_msg.base.type = CONTROL_MESSAGE_TYPE_MODULE_REPLY;
+	global_control_msg.base.version = CONTROL_MESSAGE_VERSION_CURRENT;
+	((CONTROL_MESSAGE_MODULE_REPLY*)&global_control_msg)->status = 0;
+	((CONTROL_MESSAGE_MODULE_REPLY*)&global_control_msg)->gateway_message_version = 3;
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+
+	call_thread_function_on_join[1] = 1;
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE msg = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(false);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(msg);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MonotonicClock_GetMicroseconds());
+	STRICT_EXPECTED_CALL(Message_IsExpired(msg, 0));
+	STRICT_EXPECTED_CALL(Message_GetSerializationHeader(msg, GATEWAY_MESSAGE_VERSION_2));
+	STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Message_GetContentSegmentCount(msg));
+	STRICT_EXPECTED_CALL(Message_GetContentSegment(msg, 0));
+	STRICT_EXPECTED_CALL(nn_sendmsg(1, IGNORED_PTR_ARG, 0)).IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Message_Destroy(msg));
 	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1)
@@ -3061,6 +3205,82 @@ TEST_FUNCTION(Outprocess_outgoing_thread_success)
 	cleanup_create_config(&config);
 }
 
+/*Tests_SRS_OUTPROCESS_MODULE_30_001: [ If the message has expired, as told by `Message_IsExpired` at `MonotonicClock_GetMicroseconds`, this function shall not send it and shall count it in the module's expired messages. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_009: [ This function shall report an expired message it does not send with `Broker_ReportExpired`, so that it is counted in the `expired` statistics of the module, and shall carry on if that fails. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_17_055: [ This function shall Destroy the message once successfully transmitted. ]*/
+TEST_FUNCTION(Outprocess_outgoing_thread_drops_expired_message)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	MESSAGE_HANDLE msg = Message_Create((const MESSAGE_CONFIG*)(0x42));
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_is_empty(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(false);
+	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(msg);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(MonotonicClock_GetMicroseconds())
+		.SetReturn(2000);
+	STRICT_EXPECTED_CALL(Message_IsExpired(msg, 2000))
+		.SetReturn(true);
+	STRICT_EXPECTED_CALL(Broker_ReportExpired((BROKER_HANDLE)0x42, module, 1))
+		.SetReturn(BROKER_ERROR);
+	STRICT_EXPECTED_CALL(Message_Destroy(msg));
+	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(LOCK_ERROR);
+
+	// act
+	//third thread created is outgoing message thread
+	thread_func_to_call[3](thread_func_args[3]);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
+/*Tests_SRS_OUTPROCESS_MODULE_30_007: [ This function shall keep the `thread_scheduling` of the configuration for the threads of the module. ]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_008: [ Each thread of the module shall first apply the `thread_scheduling` of the module configuration to itself with `ThreadScheduling_Apply` if it changes any setting, and shall carry on if that fails. ]*/
+TEST_FUNCTION(Outprocess_outgoing_thread_applies_thread_scheduling_and_continues_when_it_fails)
+{
+	// arrange
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+	config.thread_scheduling.cpu_affinity = 0x3;
+	config.thread_scheduling.nice = 5;
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(ThreadScheduling_Apply(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(1);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1)
+		.SetReturn(LOCK_ERROR);
+
+	// act
+	//third thread created is outgoing message thread
+	thread_func_to_call[3](thread_func_args[3]);
+
+	// assert 
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	//ablution
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
 /*Tests_SRS_OUTPROCESS_MODULE_17_053: [ This thread shall ensure thread safety on the module data. ]*/
 TEST_FUNCTION(Outprocess_outgoing_thread_nn_send_1st_unlock_fails)
 {
@@ -3081,15 +3301,17 @@ TEST_FUNCTION(Outprocess_outgoing_thread_nn_send_1st_unlock_fails)
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(msg);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(Message_ToByteArray(msg, NULL, 0));
-	STRICT_EXPECTED_CALL(nn_allocmsg(default_serialized_size, 0));
-	STRICT_EXPECTED_CALL(Message_ToByteArray(msg, IGNORED_PTR_ARG, default_serialized_size))
-		.IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(MonotonicClock_GetMicroseconds());
+	STRICT_EXPECTED_CALL(Message_IsExpired(msg, 0));
+	STRICT_EXPECTED_CALL(Message_GetSerializationHeader(msg, GATEWAY_MESSAGE_VERSION_1));
+	STRICT_EXPECTED_CALL(CONSTBUFFER_GetContent(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Message_GetContentSegmentCount(msg));
+	STRICT_EXPECTED_CALL(Message_GetContentSegment(msg, 0));
 	should_nn_send_fail = true;
 	current_nn_send_index = 0;
 	when_shall_nn_send_fail = 1;
-	STRICT_EXPECTED_CALL(nn_send(1, IGNORED_PTR_ARG, NN_MSG, 0)).IgnoreArgument(2);
-	STRICT_EXPECTED_CALL(nn_freemsg(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(nn_sendmsg(1, IGNORED_PTR_ARG, 0)).IgnoreArgument(2);
+	STRICT_EXPECTED_CALL(CONSTBUFFER_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Message_Destroy(msg));
 	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -3109,7 +3331,7 @@ TEST_FUNCTION(Outprocess_outgoing_thread_nn_send_1st_unlock_fails)
 }
 
 /*Tests_SRS_OUTPROCESS_MODULE_17_053: [ This thread shall ensure thread safety on the module data. ]*/
-TEST_FUNCTION(Outprocess_outgoing_thread_nn_alloc_2nd_lock_fails)
+TEST_FUNCTION(Outprocess_outgoing_thread_serialization_alloc_2nd_lock_fails)
 {
 	// arrange
 	OUTPROCESS_MODULE_CONFIG config;
@@ -3128,10 +3350,11 @@ TEST_FUNCTION(Outprocess_outgoing_thread_nn_alloc_2nd_lock_fails)
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(msg);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(Message_ToByteArray(msg, NULL, 0));
+	STRICT_EXPECTED_CALL(MonotonicClock_GetMicroseconds());
+	STRICT_EXPECTED_CALL(Message_IsExpired(msg, 0));
 	malloc_will_fail = true;
 	malloc_fail_count = malloc_count + 1;
-	STRICT_EXPECTED_CALL(nn_allocmsg(default_serialized_size, 0));
+	STRICT_EXPECTED_CALL(Message_GetSerializationHeader(msg, GATEWAY_MESSAGE_VERSION_1));
 	STRICT_EXPECTED_CALL(Message_Destroy(msg));
 	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -3171,7 +3394,9 @@ TEST_FUNCTION(Outprocess_outgoing_thread_serialize_2nd_unlock_fails)
 	STRICT_EXPECTED_CALL(MESSAGE_QUEUE_pop(IGNORED_PTR_ARG)).IgnoreArgument(1)
 		.SetReturn(msg);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
-	STRICT_EXPECTED_CALL(Message_ToByteArray(msg, NULL, 0)).SetReturn(-1);
+	STRICT_EXPECTED_CALL(MonotonicClock_GetMicroseconds());
+	STRICT_EXPECTED_CALL(Message_IsExpired(msg, 0));
+	STRICT_EXPECTED_CALL(Message_GetSerializationHeader(msg, GATEWAY_MESSAGE_VERSION_1)).SetReturn(NULL);
 	STRICT_EXPECTED_CALL(Message_Destroy(msg));
 	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
@@ -3388,6 +3613,7 @@ TEST_FUNCTION(Outprocess_incoming_thread_ends_nn_recv_fails)
 /*Tests_SRS_OUTPROCESS_MODULE_17_038: [ This function shall read from the message channel for gateway messages from the module host. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_039: [ Upon successful receiving a gateway message, this function shall deserialize the message. ]*/
 /*Tests_SRS_OUTPROCESS_MODULE_17_040: [This function shall publish any successfully created gateway message to the broker.]*/
+/*Tests_SRS_OUTPROCESS_MODULE_30_005: [ The message shall take ownership of the received buffer, so that its content is not copied, and the buffer shall be freed with nn_freemsg when the message is destroyed, or right away if the message cannot be deserialized. ]*/
 TEST_FUNCTION(Outprocess_messaging_thread_ends_one_loop_then_fails)
 {
 	OUTPROCESS_MODULE_CONFIG config;
@@ -3403,7 +3629,7 @@ TEST_FUNCTION(Outprocess_messaging_thread_ends_one_loop_then_fails)
 	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(nn_recv(1, IGNORED_PTR_ARG, NN_MSG, 0)).IgnoreArgument(2);
-	STRICT_EXPECTED_CALL(Message_CreateFromByteArray(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
+	STRICT_EXPECTED_CALL(Message_CreateFromByteArrayWithRelease(IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG))
 		.IgnoreAllArguments();
 	STRICT_EXPECTED_CALL(Broker_Publish(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
 		.IgnoreAllArguments();
@@ -3423,6 +3649,41 @@ TEST_FUNCTION(Outprocess_messaging_thread_ends_one_loop_then_fails)
 	cleanup_create_config(&config);
 }
 
+/*Tests_SRS_OUTPROCESS_MODULE_30_005: [ The message shall take ownership of the received buffer, so that its content is not copied, and the buffer shall be freed with nn_freemsg when the message is destroyed, or right away if the message cannot be deserialized. ]*/
+TEST_FUNCTION(Outprocess_messaging_thread_frees_the_buffer_when_the_message_cannot_be_deserialized)
+{
+	OUTPROCESS_MODULE_CONFIG config;
+	setup_create_config(&config);
+
+	MODULE_HANDLE module = Module_Create((BROKER_HANDLE)0x42, &config);
+	Module_Start(module);
+
+	umock_c_reset_all_calls();
+
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(nn_recv(1, IGNORED_PTR_ARG, NN_MSG, 0)).IgnoreArgument(2);
+	malloc_will_fail = true;
+	malloc_fail_count = malloc_count + 2; /*nn_recv allocates first*/
+	STRICT_EXPECTED_CALL(Message_CreateFromByteArrayWithRelease(IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG))
+		.IgnoreAllArguments();
+	STRICT_EXPECTED_CALL(nn_freemsg(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(ThreadAPI_Sleep(1));
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1).SetReturn(LOCK_ERROR);
+
+	int function_result = (*thread_func_to_call[2])(thread_func_args[2]);
+
+	// assert
+	ASSERT_ARE_EQUAL(int, function_result, 0);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	// ablution
+	Module_Destroy(module);
+	cleanup_create_config(&config);
+}
+
 TEST_FUNCTION(Outprocess_control_thread_does_nothing_with_nothing)
 {
 	// arrange
@@ -3538,6 +3799,8 @@ TEST_FUNCTION(Outprocess_control_thread_restart_success)
 		.IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(nn_freemsg(IGNORED_PTR_ARG))
 		.IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Lock(IGNORED_PTR_ARG)).IgnoreArgument(1);
+	STRICT_EXPECTED_CALL(Unlock(IGNORED_PTR_ARG)).IgnoreArgument(1);
 	STRICT_EXPECTED_CALL(ControlMessage_Destroy(IGNORED_PTR_ARG))
 		.IgnoreArgument(1);
     setup_start_or_destroy_message();
@@ -4,6 +4,7 @@
 #include <string>
 #include <map>
 #include <exception>
+#include <stdexcept>
 
 #include <parson.h>
 
@@ -84,8 +85,57 @@ typedef struct METRICS_MODULE_HANDLE_TAG
     Counter non_conforming_messages;
     SimpleAccumulator<MicroSeconds> latency;
     PerDeviceMap *per_device_metrics;
+    MESSAGE_KEY sequence_number_key;
+    MESSAGE_KEY device_id_key;
 } METRICS_MODULE_HANDLE;
 
+#define SEQUENCE_NUMBER_PROPERTY "sequence number"
+#define DEVICE_ID_PROPERTY "deviceId"
+
+/* the key is MESSAGE_KEY_NONE when the key table of the process was full, the property is then looked up by name, as a string */
+static int get_property(MESSAGE_HANDLE messageHandle, MESSAGE_KEY key, const char* name, MESSAGE_VALUE* value)
+{
+    int result;
+    if (key != MESSAGE_KEY_NONE)
+    {
+        result = Message_GetPropertyTypedValue(messageHandle, key, value);
+    }
+    else
+    {
+        const char* text = Message_GetPropertyValue(messageHandle, name);
+        if (text == NULL)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            value->type = MESSAGE_VALUE_STRING;
+            value->value.string = text;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+/* the simulator sets its counters as integers, they are only strings when they went through a serialization */
+static Counter property_as_counter(const MESSAGE_VALUE& value)
+{
+    Counter result;
+    if (value.type == MESSAGE_VALUE_INT64)
+    {
+        result = value.value.integer;
+    }
+    else if (value.type == MESSAGE_VALUE_STRING)
+    {
+        result = std::stoll(value.value.string);
+    }
+    else
+    {
+        throw std::invalid_argument("property is not an integer");
+    }
+    return result;
+}
+
 
 static void* MetricsModule_ParseConfigurationFromJson(const char* configuration)
 {
@@ -127,6 +177,13 @@ static MODULE_HANDLE MetricsModule_Create(BROKER_HANDLE broker, const void* conf
             module->non_conforming_messages = init_count;
             module->latency = init_accumulator;
             module->per_device_metrics = new PerDeviceMap();
+            module->sequence_number_key = Message_InternKey(SEQUENCE_NUMBER_PROPERTY);
+            module->device_id_key = Message_InternKey(DEVICE_ID_PROPERTY);
+            if ((module->sequence_number_key == MESSAGE_KEY_NONE) ||
+                (module->device_id_key == MESSAGE_KEY_NONE))
+            {
+                LogInfo("the key table is full, properties will be looked up by name");
+            }
         }
     }
     return (MODULE_HANDLE)module;
@@ -150,60 +207,46 @@ static void MetricsModule_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE mes
         METRICS_MODULE_HANDLE * module = (METRICS_MODULE_HANDLE *)moduleHandle;
         module->all_messages_received++;
 
-        CONSTMAP_HANDLE message_properties = Message_GetProperties(messageHandle);
-        if (message_properties == NULL)
+        MESSAGE_VALUE timestamp_property;
+        MESSAGE_VALUE seq_num_property;
+        MESSAGE_VALUE deviceId_property;
+        if ((Message_GetPropertyTypedValue(messageHandle, MESSAGE_KEY_TIMESTAMP, &timestamp_property) != 0) ||
+            (get_property(messageHandle, module->sequence_number_key, SEQUENCE_NUMBER_PROPERTY, &seq_num_property) != 0) ||
+            (get_property(messageHandle, module->device_id_key, DEVICE_ID_PROPERTY, &deviceId_property) != 0) ||
+            (deviceId_property.type != MESSAGE_VALUE_STRING))
         {
             module->non_conforming_messages++;
         }
         else
         {
-            const char * timestamp_property = ConstMap_GetValue(message_properties, "timestamp");
-            const char * seq_num_property = ConstMap_GetValue(message_properties, "sequence number");
-            const char * deviceId_property = ConstMap_GetValue(message_properties, "deviceId");
-            if ((timestamp_property == NULL) || (seq_num_property == NULL) || (deviceId_property == NULL))
+            try
             {
-                module->non_conforming_messages++;
-            }
-            else
-            {
-                try
-                {
-                    MicroSeconds timestamp_duration(std::stoll(timestamp_property));
-                    HrTime timestamp(timestamp_duration);
-                    MicroSeconds current_latency = received_time - timestamp;
-                    module->latency.add(current_latency);
+                MicroSeconds timestamp_duration(property_as_counter(timestamp_property));
+                HrTime timestamp(timestamp_duration);
+                MicroSeconds current_latency = received_time - timestamp;
+                module->latency.add(current_latency);
 
-                    if (deviceId_property == NULL)
-                    {
-                        module->non_conforming_messages++;
-                    }
-                    else
-                    {
-                        std::string deviceId(deviceId_property);
-                        METRICS_PER_DEVICE& per_device = (*module->per_device_metrics)[deviceId];
-                        per_device.messages_received++;
-                        per_device.seqence_number++;
+                std::string deviceId(deviceId_property.value.string);
+                METRICS_PER_DEVICE& per_device = (*module->per_device_metrics)[deviceId];
+                per_device.messages_received++;
+                per_device.seqence_number++;
 
-                        Counter sequence_number(std::stoll(seq_num_property));
-                        if (sequence_number != per_device.seqence_number)
-                        {
-                            per_device.out_of_sequence_messages++;
-                            if (sequence_number > per_device.seqence_number)
-                            {
-                                per_device.messages_lost += (sequence_number - per_device.seqence_number);
-                            }
-                            per_device.seqence_number = sequence_number;
-                        }
-                    }
-                }
-                catch (std::exception & e)
+                Counter sequence_number(property_as_counter(seq_num_property));
+                if (sequence_number != per_device.seqence_number)
                 {
-                    LogError("non-conforming message: exception caught: %s", e.what());
-                    module->non_conforming_messages++;
+                    per_device.out_of_sequence_messages++;
+                    if (sequence_number > per_device.seqence_number)
+                    {
+                        per_device.messages_lost += (sequence_number - per_device.seqence_number);
+                    }
+                    per_device.seqence_number = sequence_number;
                 }
             }
-
-            ConstMap_Destroy(message_properties);
+            catch (std::exception & e)
+            {
+                LogError("non-conforming message: exception caught: %s", e.what());
+                module->non_conforming_messages++;
+            }
         }
     }
 }
@@ -290,32 +290,31 @@ static int SimulatorModule_thread(void * context)
         using MicroSeconds = std::chrono::microseconds;
         long long time_to_wait = module->message_delay * 1000;
 
-        size_t messages_produced = 0;
-        thread_result = 0;
-        while (module->thread_flag)
+        /* every message is derived from this one, with its own timestamp and sequence number */
+        MESSAGE_HANDLE base_message = Message_Create(&message_to_send);
+        if (base_message == NULL)
         {
-            std::chrono::time_point<HrClock, MicroSeconds> t1 = std::chrono::time_point_cast<MicroSeconds>(HrClock::now());
-            auto t1_as_int = t1.time_since_epoch().count();
-            std::string t1_as_string = std::to_string(t1_as_int);
-            messages_produced++;
-            std::string messages_produced_as_string = std::to_string(messages_produced);
-            if (Map_AddOrUpdate(message_to_send.sourceProperties, "timestamp", t1_as_string.c_str()) != MAP_OK)
-            {
-                LogError("Unable to update timestamp in message");
-                module->thread_flag = false;
-                thread_result = -__LINE__;
-                break;
-            }
-            else if (Map_AddOrUpdate(message_to_send.sourceProperties, "sequence number", messages_produced_as_string.c_str()) != MAP_OK)
-            {
-                LogError("Unable to update sequence number in message");
-                module->thread_flag = false;
-                thread_result = -__LINE__;
-                break;
-            }
-            else
+            LogError("Unable to create the base message");
+            module->thread_flag = false;
+            thread_result = -__LINE__;
+        }
+        else
+        {
+            size_t messages_produced = 0;
+            MESSAGE_TYPED_PROPERTY counters[2];
+            counters[0].key = "timestamp";
+            counters[0].value.type = MESSAGE_VALUE_INT64;
+            counters[1].key = "sequence number";
+            counters[1].value.type = MESSAGE_VALUE_INT64;
+            thread_result = 0;
+            while (module->thread_flag)
             {
-                MESSAGE_HANDLE next_message = Message_Create(&message_to_send);
+                std::chrono::time_point<HrClock, MicroSeconds> t1 = std::chrono::time_point_cast<MicroSeconds>(HrClock::now());
+                auto t1_as_int = t1.time_since_epoch().count();
+                messages_produced++;
+                counters[0].value.value.integer = static_cast<int64_t>(t1_as_int);
+                counters[1].value.value.integer = static_cast<int64_t>(messages_produced);
+                MESSAGE_HANDLE next_message = Message_CreateDerivedWithValues(base_message, counters, 2, NULL, 0);
                 if (next_message == NULL)
                 {
                     LogError("Unable to create next message");
@@ -328,6 +327,7 @@ static int SimulatorModule_thread(void * context)
                     if (Broker_Publish(module->broker, module, next_message) != BROKER_OK)
                     {
                         LogError("Unable to publish message");
+                        Message_Destroy(next_message);
                         module->thread_flag = false;
                         thread_result = -__LINE__;
                         break;
@@ -345,6 +345,7 @@ static int SimulatorModule_thread(void * context)
                     }
                 }
             }
+            Message_Destroy(base_message);
         }
         if (message_to_send.sourceProperties != NULL)
         {
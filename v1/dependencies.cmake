@@ -22,7 +22,7 @@ findAndInstall(azure_c_shared_utility 1.0.25
     -Drun_unittests=${run_unittests}
     -Dbuild_as_dynamic=ON
     -Duse_default_uuid=${use_xplat_uuid}
-    -Duse_condition=${enable_event_system}
+    -Duse_condition=ON
     ${PASSVARS}
     -G "${CMAKE_GENERATOR}")
 set(SHARED_UTIL_INC_FOLDER ${AZURE_C_SHARED_UTILITY_INCLUDE_DIR} CACHE INTERNAL "this is what needs to be included if using sharedLib lib" FORCE)
@@ -8,6 +8,7 @@
 #include "azure_c_shared_utility/strings.h"
 
 #include "module.h"
+#include "thread_scheduling.h"
 
 #include "ble_gatt_io.h"
 #include "bleio_seq.h"
@@ -49,6 +50,7 @@ typedef struct BLE_CONFIG_TAG
 {
     BLE_DEVICE_CONFIG   device_config;  // BLE device information
     VECTOR_HANDLE       instructions;   // array of BLE_INSTRUCTION objects to be executed
+    THREAD_SCHEDULING_CONFIG thread_scheduling; // CPU affinity and scheduling of the event dispatcher thread
 }BLE_CONFIG;
 
 MODULE_EXPORT const MODULE_API* MODULE_STATIC_GETAPI(BLE_MODULE)(MODULE_API_VERSION gateway_api_version);
@@ -11,8 +11,11 @@
 #include "ble_gatt_io.h"
 
 #ifdef __cplusplus
+#include <cstdbool>
 extern "C"
 {
+#else
+#include <stdbool.h>
 #endif
 
 typedef struct BLEIO_SEQ_HANDLE_DATA_TAG* BLEIO_SEQ_HANDLE;
@@ -93,6 +96,14 @@ typedef void(*ON_BLEIO_SEQ_WRITE_COMPLETE)(
 */
 typedef void(*ON_BLEIO_SEQ_DESTROY_COMPLETE)(BLEIO_SEQ_HANDLE bleio_seq_handle, void* context);
 
+/**
+ * Callback invoked before each read of a READ_PERIODIC instruction. When it
+ * returns false the read is skipped and the instruction runs again at its
+ * next interval, which lets the caller slow down polling while it cannot use
+ * the data.
+ */
+typedef bool(*ON_BLEIO_SEQ_CAN_READ)(BLEIO_SEQ_HANDLE bleio_seq_handle, void* context);
+
 extern BLEIO_SEQ_HANDLE BLEIO_Seq_Create(
     BLEIO_GATT_HANDLE bleio_gatt_handle,
     VECTOR_HANDLE instructions,
@@ -113,6 +124,12 @@ extern BLEIO_SEQ_RESULT BLEIO_Seq_AddInstruction(
     BLEIO_SEQ_INSTRUCTION* instruction
 );
 
+extern void BLEIO_Seq_SetReadGate(
+    BLEIO_SEQ_HANDLE bleio_seq_handle,
+    ON_BLEIO_SEQ_CAN_READ can_read,
+    void* context
+);
+
 #ifdef __cplusplus
 }
 #endif
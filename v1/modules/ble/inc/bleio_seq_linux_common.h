@@ -24,6 +24,8 @@ typedef struct BLEIO_SEQ_HANDLE_DATA_TAG {
     ON_BLEIO_SEQ_WRITE_COMPLETE     on_write_complete;
     ON_BLEIO_SEQ_DESTROY_COMPLETE   on_destroy_complete;
     void*                           destroy_context;
+    ON_BLEIO_SEQ_CAN_READ           can_read;
+    void*                           can_read_context;
 }BLEIO_SEQ_HANDLE_DATA;
 
 /**
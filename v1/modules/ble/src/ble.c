@@ -43,6 +43,7 @@ typedef struct BLE_HANDLE_DATA_TAG
 #if __linux__
     GMainLoop*          main_loop;
     THREAD_HANDLE       event_thread;
+    THREAD_SCHEDULING_CONFIG thread_scheduling;
 #endif
 }BLE_HANDLE_DATA;
 
@@ -197,6 +198,7 @@ static MODULE_HANDLE BLE_Create(BROKER_HANDLE broker, const void* configuration)
                         result->is_destroy_complete = false;
 
 #if __linux__
+                        result->thread_scheduling = config->thread_scheduling;
                         if (init_glib_loop(result) == false)
                         {
                             LogError("init_glib_loop returned false");
@@ -242,6 +244,54 @@ static MODULE_HANDLE BLE_Create(BROKER_HANDLE broker, const void* configuration)
     return (MODULE_HANDLE)result;
 }
 
+static bool parse_thread_scheduling(JSON_Object* thread_json, THREAD_SCHEDULING_CONFIG* thread_scheduling)
+{
+    bool result = true;
+
+    memset(thread_scheduling, 0, sizeof(THREAD_SCHEDULING_CONFIG));
+    if (thread_json != NULL)
+    {
+        /*Codes_SRS_BLE_30_003: [ If the JSON has a thread object, BLE_ParseConfigurationFromJson shall read its cpus, nice and fifo.priority values into the thread_scheduling field of the BLE_CONFIG. ]*/
+        JSON_Array* cpus = json_object_get_array(thread_json, "cpus");
+        double nice = json_object_get_number(thread_json, "nice");
+        double fifo_priority = json_object_get_number(thread_json, "fifo.priority");
+
+        if (cpus != NULL)
+        {
+            size_t cpu_count = json_array_get_count(cpus);
+            for (size_t cpu_index = 0; cpu_index < cpu_count; ++cpu_index)
+            {
+                double cpu = json_array_get_number(cpus, cpu_index);
+                if (cpu < 0 || cpu >= THREAD_SCHEDULING_MAX_CPUS || cpu != (double)(size_t)cpu)
+                {
+                    result = false;
+                    break;
+                }
+                else
+                {
+                    thread_scheduling->cpu_affinity |= ((uint64_t)1 << (size_t)cpu);
+                }
+            }
+        }
+
+        /*Codes_SRS_BLE_30_004: [ BLE_ParseConfigurationFromJson shall return NULL if a cpus entry is not a CPU number below THREAD_SCHEDULING_MAX_CPUS, nice is not a whole number from THREAD_SCHEDULING_MIN_NICE to THREAD_SCHEDULING_MAX_NICE, or fifo.priority is not a whole number from 0 to THREAD_SCHEDULING_MAX_FIFO_PRIORITY. ]*/
+        if (result == false ||
+            nice < THREAD_SCHEDULING_MIN_NICE || nice > THREAD_SCHEDULING_MAX_NICE || nice != (double)(int)nice ||
+            fifo_priority < 0 || fifo_priority > THREAD_SCHEDULING_MAX_FIFO_PRIORITY || fifo_priority != (double)(int)fifo_priority)
+        {
+            LogError("Invalid 'thread' specified");
+            result = false;
+        }
+        else
+        {
+            thread_scheduling->nice = (int)nice;
+            thread_scheduling->fifo_priority = (int)fifo_priority;
+        }
+    }
+
+    return result;
+}
+
 static void* BLE_ParseConfigurationFromJson(const char* configuration)
 {
 	BLE_CONFIG *result;
@@ -320,6 +370,17 @@ static void* BLE_ParseConfigurationFromJson(const char* configuration)
                                     VECTOR_destroy(ble_instructions);
                                     result = NULL;
                                 }
+                                else if (parse_thread_scheduling(
+                                        json_object_get_object(root, "thread"),
+                                        &(ble_config.thread_scheduling)
+                                    ) == false)
+                                {
+                                    /*Codes_SRS_BLE_30_004: [ BLE_ParseConfigurationFromJson shall return NULL if a cpus entry is not a CPU number below THREAD_SCHEDULING_MAX_CPUS, nice is not a whole number from THREAD_SCHEDULING_MIN_NICE to THREAD_SCHEDULING_MAX_NICE, or fifo.priority is not a whole number from 0 to THREAD_SCHEDULING_MAX_FIFO_PRIORITY. ]*/
+                                    LogError("parse_thread_scheduling returned false");
+                                    free_instructions(ble_instructions);
+                                    VECTOR_destroy(ble_instructions);
+                                    result = NULL;
+                                }
                                 else
                                 {
                                     ble_config.device_config.ble_controller_index = controller_index;
@@ -402,6 +463,14 @@ static bool init_glib_loop(BLE_HANDLE_DATA* handle_data)
 static int event_dispatcher(void * user_data)
 {
     BLE_HANDLE_DATA* handle_data = (BLE_HANDLE_DATA*)user_data;
+
+    /*Codes_SRS_BLE_30_005: [ On Linux, the thread that runs the GLib main loop of the module shall first apply the thread_scheduling of the configuration to itself with ThreadScheduling_Apply if it changes any setting, and shall carry on if that fails. ]*/
+    if (THREAD_SCHEDULING_IS_SET(&(handle_data->thread_scheduling)) &&
+        ThreadScheduling_Apply(&(handle_data->thread_scheduling)) != 0)
+    {
+        LogError("ThreadScheduling_Apply failed");
+    }
+
     g_main_loop_run(handle_data->main_loop);
     g_main_loop_unref(handle_data->main_loop);
     return 0;
@@ -520,6 +589,20 @@ static VECTOR_HANDLE ble_instr_to_bleioseq_instr(BLE_HANDLE_DATA* module, VECTOR
     return result;
 }
 
+static bool can_publish_read(BLEIO_SEQ_HANDLE bleio_seq_handle, void* context)
+{
+    (void)bleio_seq_handle;
+    // this MUST NOT be NULL
+    BLE_HANDLE_DATA* handle_data = (BLE_HANDLE_DATA*)context;
+    size_t credit;
+
+    /*Codes_SRS_BLE_30_002: [ The read gate shall return false if Broker_GetPublishCredit succeeds and reports no credit for the module, and true otherwise. ]*/
+    return !(
+        Broker_GetPublishCredit(handle_data->broker, (MODULE_HANDLE)handle_data, &credit) == BROKER_OK &&
+        credit == 0
+    );
+}
+
 static void on_connect_complete(
     BLEIO_GATT_HANDLE bleio_gatt_handle,
     void* context,
@@ -537,6 +620,9 @@ static void on_connect_complete(
     {
         handle_data->is_connected = true;
 
+        /*Codes_SRS_BLE_30_001: [ Before it runs the sequence, the module shall set a read gate on the bleio_seq field from BLE_HANDLE_DATA by calling BLEIO_Seq_SetReadGate, so that periodic reads are skipped while the modules it publishes to have no room for them. ]*/
+        BLEIO_Seq_SetReadGate(handle_data->bleio_seq, can_publish_read, handle_data);
+
         /*Codes_SRS_BLE_13_014: [ If the asynchronous call to  BLEIO_gatt_connect  is successful then the  BLEIO_Seq_Run  function shall be called on the  bleio_seq  field from  BLE_HANDLE_DATA . ]*/
         if (BLEIO_Seq_Run(handle_data->bleio_seq) != BLEIO_SEQ_OK)
         {
@@ -66,6 +66,8 @@ BLEIO_SEQ_HANDLE BLEIO_Seq_Create(
                 result->on_write_complete = on_write_complete;
                 result->on_destroy_complete = NULL;
                 result->destroy_context = NULL;
+                result->can_read = NULL;
+                result->can_read_context = NULL;
             }
             else
             {
@@ -454,3 +456,23 @@ BLEIO_SEQ_RESULT BLEIO_Seq_AddInstruction(
 
     return result;
 }
+
+void BLEIO_Seq_SetReadGate(
+    BLEIO_SEQ_HANDLE bleio_seq_handle,
+    ON_BLEIO_SEQ_CAN_READ can_read,
+    void* context
+)
+{
+    /*Codes_SRS_BLEIO_SEQ_30_001: [ If bleio_seq_handle is NULL then BLEIO_Seq_SetReadGate shall do nothing. ]*/
+    if (bleio_seq_handle == NULL)
+    {
+        LogError("Invalid input");
+    }
+    else
+    {
+        /*Codes_SRS_BLEIO_SEQ_30_002: [ BLEIO_Seq_SetReadGate shall replace the read gate of the sequence with can_read and context; a NULL can_read removes it. ]*/
+        BLEIO_SEQ_HANDLE_DATA* handle_data = (BLEIO_SEQ_HANDLE_DATA*)bleio_seq_handle;
+        handle_data->can_read = can_read;
+        handle_data->can_read_context = context;
+    }
+}
@@ -32,26 +32,40 @@ static gboolean on_timer(gpointer user_data)
 
     if (result == G_SOURCE_CONTINUE)
     {
-        BLEIO_SEQ_RESULT read_result = schedule_read(
-            context->handle_data,
-            context->instruction,
-            NULL
-        );
-        if (read_result == BLEIO_SEQ_ERROR)
-        {
-            LogError("An error occurred while scheduling instruction of type %d for characteristic %s",
-                context->instruction->instruction_type,
-                STRING_c_str(context->instruction->characteristic_uuid)
-            );
-
-            context->handle_data->on_read_complete(
+        /*Codes_SRS_BLEIO_SEQ_30_003: [ If a read gate is set and it returns false, the READ_PERIODIC instruction shall not be read at that interval and its timer shall keep running. ]*/
+        if (
+            context->handle_data->can_read != NULL &&
+            context->handle_data->can_read(
                 (BLEIO_SEQ_HANDLE)context->handle_data,
-                context->instruction->context,
-                STRING_c_str(context->instruction->characteristic_uuid),
-                context->instruction->instruction_type,
-                read_result,
+                context->handle_data->can_read_context
+            ) == false
+           )
+        {
+            /* skip this reading, the timer fires again at the next interval */
+        }
+        else
+        {
+            BLEIO_SEQ_RESULT read_result = schedule_read(
+                context->handle_data,
+                context->instruction,
                 NULL
             );
+            if (read_result == BLEIO_SEQ_ERROR)
+            {
+                LogError("An error occurred while scheduling instruction of type %d for characteristic %s",
+                    context->instruction->instruction_type,
+                    STRING_c_str(context->instruction->characteristic_uuid)
+                );
+
+                context->handle_data->on_read_complete(
+                    (BLEIO_SEQ_HANDLE)context->handle_data,
+                    context->instruction->context,
+                    STRING_c_str(context->instruction->characteristic_uuid),
+                    context->instruction->instruction_type,
+                    read_result,
+                    NULL
+                );
+            }
         }
     }
     else
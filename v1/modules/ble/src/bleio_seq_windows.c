@@ -45,4 +45,13 @@ BLEIO_SEQ_RESULT BLEIO_Seq_AddInstruction(
 {
     /*Codes_SRS_BLEIO_SEQ_13_044: [ On Windows this function shall return BLEIO_SEQ_ERROR. ]*/
     return BLEIO_SEQ_ERROR;
+}
+
+void BLEIO_Seq_SetReadGate(
+    BLEIO_SEQ_HANDLE bleio_seq_handle,
+    ON_BLEIO_SEQ_CAN_READ can_read,
+    void* context
+)
+{
+    /*Codes_SRS_BLEIO_SEQ_30_004: [ On Windows this function shall do nothing. ]*/
 }
\ No newline at end of file
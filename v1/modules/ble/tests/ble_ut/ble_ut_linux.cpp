@@ -179,6 +179,10 @@ namespace BASEIMPLEMENTATION
 static bool g_call_on_read_complete = false;
 static BLEIO_SEQ_RESULT g_read_result = BLEIO_SEQ_OK;
 
+static ON_BLEIO_SEQ_CAN_READ g_can_read = NULL;
+static void* g_can_read_context = NULL;
+static size_t g_publish_credit = SIZE_MAX;
+
 static bool shouldThreadAPI_Create_invoke_callback = false;
 static bool should_g_main_loop_quit_call_thread_func = false;
 static THREAD_START_FUNC thread_start_func = NULL;
@@ -470,9 +474,18 @@ public:
         auto result2 = seq->run();
     MOCK_METHOD_END(BLEIO_SEQ_RESULT, result2)
     
+    MOCK_STATIC_METHOD_3(, void, BLEIO_Seq_SetReadGate, BLEIO_SEQ_HANDLE, bleio_seq_handle, ON_BLEIO_SEQ_CAN_READ, can_read, void*, context)
+        g_can_read = can_read;
+        g_can_read_context = context;
+    MOCK_VOID_METHOD_END()
+
     MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_Publish, BROKER_HANDLE, broker, MODULE_HANDLE, source, MESSAGE_HANDLE, message)
         auto result2 = BROKER_OK;
     MOCK_METHOD_END(BROKER_RESULT, result2)
+
+    MOCK_STATIC_METHOD_3(, BROKER_RESULT, Broker_GetPublishCredit, BROKER_HANDLE, broker, MODULE_HANDLE, source, size_t*, credit)
+        *credit = g_publish_credit;
+    MOCK_METHOD_END(BROKER_RESULT, BROKER_OK)
     
     MOCK_STATIC_METHOD_1(, CONSTMAP_HANDLE, ConstMap_Create, MAP_HANDLE, sourceMap)
         auto result2 = BASEIMPLEMENTATION::ConstMap_Create(sourceMap);
@@ -609,6 +622,10 @@ public:
     MOCK_STATIC_METHOD_1(, void, g_main_loop_run, GMainLoop*, loop)
     MOCK_VOID_METHOD_END()
 
+    MOCK_STATIC_METHOD_1(, int, ThreadScheduling_Apply, const THREAD_SCHEDULING_CONFIG*, config)
+        int result2 = 0;
+    MOCK_METHOD_END(int, result2);
+
     MOCK_STATIC_METHOD_1(, void, g_main_loop_quit, GMainLoop*, loop)
         if (should_g_main_loop_quit_call_thread_func && thread_start_func != NULL)
         {
@@ -681,6 +698,14 @@ public:
         }
     MOCK_METHOD_END(JSON_Array*, arr);
 
+    MOCK_STATIC_METHOD_2(, JSON_Object*, json_object_get_object, const JSON_Object*, object, const char*, name)
+        JSON_Object* object2 = NULL;
+    MOCK_METHOD_END(JSON_Object*, object2);
+
+    MOCK_STATIC_METHOD_2(, double, json_array_get_number, const JSON_Array*, arr, size_t, index)
+        double result2 = 0;
+    MOCK_METHOD_END(double, result2);
+
     MOCK_STATIC_METHOD_2(, JSON_Object*, json_array_get_object, const JSON_Array*, arr, size_t, index)
         JSON_Object* object = NULL;
         if (arr != NULL)
@@ -772,8 +797,10 @@ DECLARE_GLOBAL_MOCK_METHOD_4(CBLEMocks, , BLEIO_SEQ_HANDLE, BLEIO_Seq_Create, BL
 DECLARE_GLOBAL_MOCK_METHOD_3(CBLEMocks, , void, BLEIO_Seq_Destroy, BLEIO_SEQ_HANDLE, bleio_seq_handle, ON_BLEIO_SEQ_DESTROY_COMPLETE, on_destroy_complete, void*, context);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , BLEIO_SEQ_RESULT, BLEIO_Seq_Run, BLEIO_SEQ_HANDLE, bleio_seq_handle);
 DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , BLEIO_SEQ_RESULT, BLEIO_Seq_AddInstruction, BLEIO_SEQ_HANDLE, bleio_seq_handle, BLEIO_SEQ_INSTRUCTION*, instruction);
+DECLARE_GLOBAL_MOCK_METHOD_3(CBLEMocks, , void, BLEIO_Seq_SetReadGate, BLEIO_SEQ_HANDLE, bleio_seq_handle, ON_BLEIO_SEQ_CAN_READ, can_read, void*, context);
 
 DECLARE_GLOBAL_MOCK_METHOD_3(CBLEMocks, , BROKER_RESULT, Broker_Publish, BROKER_HANDLE, broker, MODULE_HANDLE, source, MESSAGE_HANDLE, message);
+DECLARE_GLOBAL_MOCK_METHOD_3(CBLEMocks, , BROKER_RESULT, Broker_GetPublishCredit, BROKER_HANDLE, broker, MODULE_HANDLE, source, size_t*, credit);
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , time_t, gb_time, time_t*, timer);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , struct tm*, gb_localtime, const time_t*, timer);
@@ -787,6 +814,7 @@ DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , gboolean, g_main_context_iteration, GM
 DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , GMainLoop*, g_main_loop_new, GMainContext*, context, gboolean, is_running);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , void, g_main_loop_unref, GMainLoop*, loop);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , void, g_main_loop_run, GMainLoop*, loop);
+DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , int, ThreadScheduling_Apply, const THREAD_SCHEDULING_CONFIG*, config);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , gboolean, g_main_loop_is_running, GMainLoop*, loop);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , void, g_main_loop_quit, GMainLoop*, loop);
 
@@ -795,6 +823,8 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , JSON_Object*, json_value_get_object, c
 DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , double, json_object_get_number, const JSON_Object*, value, const char*, name);
 DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , const char*, json_object_get_string, const JSON_Object*, object, const char*, name);
 DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , JSON_Array*, json_object_get_array, const JSON_Object*, object, const char*, name);
+DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , JSON_Object*, json_object_get_object, const JSON_Object*, object, const char*, name);
+DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , double, json_array_get_number, const JSON_Array*, arr, size_t, index);
 DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , JSON_Object*, json_array_get_object, const JSON_Array*, arr, size_t, index);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , size_t, json_array_get_count, const JSON_Array*, arr);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , void, json_value_free, JSON_Value*, value);
@@ -830,6 +860,9 @@ BEGIN_TEST_SUITE(ble_ut)
 
         g_call_on_read_complete = false;
         g_read_result = BLEIO_SEQ_OK;
+        g_can_read = NULL;
+        g_can_read_context = NULL;
+        g_publish_credit = SIZE_MAX;
         shouldThreadAPI_Create_invoke_callback = false;
         thread_start_func = NULL;
         should_g_main_loop_quit_call_thread_func = false;
@@ -1818,6 +1851,8 @@ BEGIN_TEST_SUITE(ble_ut)
             .IgnoreArgument(1)
             .IgnoreArgument(2);
 
+        STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(BLE_CONFIG)));
 
         STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
@@ -1835,6 +1870,98 @@ BEGIN_TEST_SUITE(ble_ut)
         BLE_FreeConfiguration(result);
     }
 
+    /*Tests_SRS_BLE_30_003: [ If the JSON has a thread object, BLE_ParseConfigurationFromJson shall read its cpus, nice and fifo.priority values into the thread_scheduling field of the BLE_CONFIG. ]*/
+    TEST_FUNCTION(BLE_ParseConfigurationFromJson_reads_thread_scheduling)
+    {
+        ///arrange
+        CBLEMocks mocks;
+
+        STRICT_EXPECTED_CALL(mocks, json_parse_string(FAKE_CONFIG));
+        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "controller_index"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "device_mac_address"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "instructions"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BLE_INSTRUCTION)));
+        STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 0))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "type"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "characteristic_uuid"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_construct("00002A24-0000-1000-8000-00805F9B34FB"));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "type"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "characteristic_uuid"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_construct("00002A24-0000-1000-8000-00805F9B34FB"));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 2))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "type"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "characteristic_uuid"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_construct("00002A24-0000-1000-8000-00805F9B34FB"));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 3))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "type"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "characteristic_uuid"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_construct("00002A24-0000-1000-8000-00805F9B34FB"));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+            .IgnoreArgument(1)
+            .SetReturn((JSON_Object*)0x43);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_array((JSON_Object*)0x43, "cpus"));
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number((JSON_Object*)0x43, "nice"))
+            .SetReturn((double)5);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number((JSON_Object*)0x43, "fifo.priority"));
+        STRICT_EXPECTED_CALL(mocks, json_array_get_count((JSON_Array*)0x42))
+            .SetReturn((size_t)2);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_number((JSON_Array*)0x42, 0))
+            .SetReturn((double)1);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_number((JSON_Array*)0x42, 1))
+            .SetReturn((double)3);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(BLE_CONFIG)));
+
+        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        auto result = BLE_ParseConfigurationFromJson(FAKE_CONFIG);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+        ASSERT_IS_NOT_NULL(result);
+        ASSERT_IS_TRUE(((BLE_CONFIG*)result)->thread_scheduling.cpu_affinity == 0xA);
+        ASSERT_ARE_EQUAL(int, 5, ((BLE_CONFIG*)result)->thread_scheduling.nice);
+        ASSERT_ARE_EQUAL(int, 0, ((BLE_CONFIG*)result)->thread_scheduling.fifo_priority);
+
+        ///cleanup
+        should_g_main_loop_quit_call_thread_func = true;
+        BLE_FreeConfiguration(result);
+    }
+
     /*Tests_SRS_BLE_17_001: [ BLE_ParseConfigurationFromJson shall allocate a new BLE_CONFIG structure containing BLE instructions and configuration as parsed from the JSON input. ]*/
     TEST_FUNCTION(BLE_ParseConfigurationFromJson_returns_NULL_when_malloc_fails)
     {
@@ -1894,6 +2021,8 @@ BEGIN_TEST_SUITE(ble_ut)
             .IgnoreArgument(1)
             .IgnoreArgument(2);
 
+        STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(BLE_CONFIG)))
             .SetFailReturn(nullptr);
         STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
@@ -1931,6 +2060,108 @@ BEGIN_TEST_SUITE(ble_ut)
         ///cleanup
     }
 
+    /*Tests_SRS_BLE_30_004: [ BLE_ParseConfigurationFromJson shall return NULL if a cpus entry is not a CPU number below THREAD_SCHEDULING_MAX_CPUS, nice is not a whole number from THREAD_SCHEDULING_MIN_NICE to THREAD_SCHEDULING_MAX_NICE, or fifo.priority is not a whole number from 0 to THREAD_SCHEDULING_MAX_FIFO_PRIORITY. ]*/
+    TEST_FUNCTION(BLE_ParseConfigurationFromJson_returns_NULL_when_thread_is_misconfigured)
+    {
+        ///arrange
+        CBLEMocks mocks;
+
+        STRICT_EXPECTED_CALL(mocks, json_parse_string(FAKE_CONFIG));
+        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number(IGNORED_PTR_ARG, "controller_index"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "device_mac_address"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "instructions"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_count(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BLE_INSTRUCTION)));
+        STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 0))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "type"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "characteristic_uuid"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_construct("00002A24-0000-1000-8000-00805F9B34FB"));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "type"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "characteristic_uuid"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_construct("00002A24-0000-1000-8000-00805F9B34FB"));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 2))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "type"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "characteristic_uuid"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_construct("00002A24-0000-1000-8000-00805F9B34FB"));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, json_array_get_object(IGNORED_PTR_ARG, 3))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "type"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "characteristic_uuid"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, STRING_construct("00002A24-0000-1000-8000-00805F9B34FB"));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_object(IGNORED_PTR_ARG, "thread"))
+            .IgnoreArgument(1)
+            .SetReturn((JSON_Object*)0x43);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_array((JSON_Object*)0x43, "cpus"))
+            .SetReturn((JSON_Array*)NULL);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number((JSON_Object*)0x43, "nice"))
+            .SetReturn((double)(THREAD_SCHEDULING_MAX_NICE + 1));
+        STRICT_EXPECTED_CALL(mocks, json_object_get_number((JSON_Object*)0x43, "fifo.priority"));
+        STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        
+        STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))
+            .IgnoreArgument(1); 
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1); 
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 2))
+            .IgnoreArgument(1); 
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 3))
+            .IgnoreArgument(1); 
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+
+        ///act
+        auto result = BLE_ParseConfigurationFromJson(FAKE_CONFIG);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+        ASSERT_IS_NULL(result);
+
+        ///cleanup
+    }
+
     /*Tests_SRS_BLE_17_002: [ BLE_FreeConfiguration shall do nothing if configuration is NULL. ]*/
     /*Tests_SRS_BLE_17_003: [ BLE_FreeConfiguration shall release all resources allocated in the BLE_CONFIG structure and release configuration. ]*/
     TEST_FUNCTION(BLE_FreeConfiguration_does_nothing_with_null)
@@ -2538,6 +2769,101 @@ BEGIN_TEST_SUITE(ble_ut)
         STRING_delete(instr1.characteristic_uuid);
     }
 
+    /*Tests_SRS_BLE_30_005: [ On Linux, the thread that runs the GLib main loop of the module shall first apply the thread_scheduling of the configuration to itself with ThreadScheduling_Apply if it changes any setting, and shall carry on if that fails. ]*/
+    TEST_FUNCTION(BLE_Create_event_dispatcher_applies_thread_scheduling_and_continues_when_it_fails)
+    {
+        ///arrange
+        CBLEMocks mocks;
+        VECTOR_HANDLE instructions = VECTOR_create(sizeof(BLE_INSTRUCTION));
+        BLE_INSTRUCTION instr1 =
+        {
+            READ_PERIODIC,
+            STRING_construct("fake_char_id"),
+            { 500 }
+        };
+        VECTOR_push_back(instructions, &instr1, 1);
+        BLE_CONFIG config =
+        {
+            { { 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF }, 0 },
+            instructions,
+            { 0x3, 5, 0 }
+        };
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, BLEIO_gatt_create(&(config.device_config)));
+        STRICT_EXPECTED_CALL(mocks, BLEIO_gatt_destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Destroy(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_gatt_connect(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .SetFailReturn((int)1);
+
+        STRICT_EXPECTED_CALL(mocks, VECTOR_create(sizeof(BLEIO_SEQ_INSTRUCTION)));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_destroy(IGNORED_PTR_ARG))       // in ~CBLEIOSequence()
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_size(config.instructions));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_size(config.instructions));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_size(IGNORED_PTR_ARG))          // in ~CBLEIOSequence()
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, VECTOR_element(instructions, 0));
+        STRICT_EXPECTED_CALL(mocks, VECTOR_element(IGNORED_PTR_ARG, 0))    // in ~CBLEIOSequence()
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, STRING_clone(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);                 
+
+        STRICT_EXPECTED_CALL(mocks, VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(1)
+            .IgnoreArgument(2);
+
+        STRICT_EXPECTED_CALL(mocks, STRING_delete(IGNORED_PTR_ARG))
+             .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, g_main_loop_new(NULL, FALSE));
+        STRICT_EXPECTED_CALL(mocks, g_get_monotonic_time());
+        STRICT_EXPECTED_CALL(mocks, g_get_monotonic_time());
+        STRICT_EXPECTED_CALL(mocks, g_main_loop_get_context(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, ThreadScheduling_Apply(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .SetFailReturn((int)1);
+        STRICT_EXPECTED_CALL(mocks, g_main_loop_run(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, g_main_loop_is_running(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, g_main_loop_is_running(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, g_main_loop_unref(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, g_main_loop_quit(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments()
+            .SetReturn((THREADAPI_RESULT)THREADAPI_OK);
+
+        should_g_main_loop_quit_call_thread_func = true;
+
+        ///act
+        auto result = BLE_Create((BROKER_HANDLE)0x42, &config);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+        ASSERT_IS_NULL(result);
+
+        ///cleanup
+        VECTOR_destroy(config.instructions);
+        STRING_delete(instr1.characteristic_uuid);
+    }
+
     TEST_FUNCTION(BLE_Create_returns_NULL_when_BUFFER_clone_fails)
     {
         ///arrange
@@ -2633,6 +2959,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -2669,6 +2997,51 @@ BEGIN_TEST_SUITE(ble_ut)
         STRING_delete(instr1.characteristic_uuid);
     }
 
+    /*Tests_SRS_BLE_30_001: [ Before it runs the sequence, the module shall set a read gate on the bleio_seq field from BLE_HANDLE_DATA by calling BLEIO_Seq_SetReadGate, so that periodic reads are skipped while the modules it publishes to have no room for them. ]*/
+    /*Tests_SRS_BLE_30_002: [ The read gate shall return false if Broker_GetPublishCredit succeeds and reports no credit for the module, and true otherwise. ]*/
+    TEST_FUNCTION(BLE_read_gate_skips_reads_while_the_module_has_no_publish_credit)
+    {
+        ///arrange
+        CBLEMocks mocks;
+        VECTOR_HANDLE instructions = VECTOR_create(sizeof(BLE_INSTRUCTION));
+        BLE_INSTRUCTION instr1 =
+        {
+            READ_PERIODIC,
+            STRING_construct("fake_char_id"),
+            { 500 }
+        };
+        VECTOR_push_back(instructions, &instr1, 1);
+        BLE_CONFIG config =
+        {
+            { { 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF }, 0 },
+            instructions
+        };
+        auto module = BLE_Create((BROKER_HANDLE)0x42, &config);
+        ASSERT_IS_NOT_NULL(g_can_read);
+        mocks.ResetAllCalls();
+
+        STRICT_EXPECTED_CALL(mocks, Broker_GetPublishCredit((BROKER_HANDLE)0x42, module, IGNORED_PTR_ARG))
+            .IgnoreArgument(3)
+            .ExpectedTimesExactly(2);
+
+        ///act
+        g_publish_credit = 0;
+        bool result1 = g_can_read(NULL, g_can_read_context);
+        g_publish_credit = 3;
+        bool result2 = g_can_read(NULL, g_can_read_context);
+
+        ///assert
+        ASSERT_IS_FALSE(result1);
+        ASSERT_IS_TRUE(result2);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        should_g_main_loop_quit_call_thread_func = true;
+        BLE_Destroy(module);
+        VECTOR_destroy(instructions);
+        STRING_delete(instr1.characteristic_uuid);
+    }
+
     /*Tests_SRS_BLE_13_006: [ BLE_Create shall return a non-NULL MODULE_HANDLE when successful. ]*/
     /*Tests_SRS_BLE_13_009: [ BLE_Create shall allocate memory for an instance of the BLE_HANDLE_DATA structure and use that as the backing structure for the module handle. ]*/
     /*Tests_SRS_BLE_13_008: [ BLE_Create shall create and initialize the bleio_gatt field in the BLE_HANDLE_DATA object by calling BLEIO_gatt_create. ]*/
@@ -2704,6 +3077,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -2776,6 +3151,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -2856,6 +3233,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -2939,6 +3318,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -3026,6 +3407,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -3115,6 +3498,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -3205,6 +3590,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -3298,6 +3685,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -3398,6 +3787,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -3505,6 +3896,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -3619,6 +4012,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -3739,6 +4134,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -3867,6 +4264,8 @@ BEGIN_TEST_SUITE(ble_ut)
 
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
+        STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_SetReadGate(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, BLEIO_Seq_Run(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -207,6 +207,9 @@ public:
         CBLEIOSequence* seq = (CBLEIOSequence*)bleio_seq_handle;
         auto result2 = seq->run();
     MOCK_METHOD_END(BLEIO_SEQ_RESULT, result2)
+
+    MOCK_STATIC_METHOD_3(, void, BLEIO_Seq_SetReadGate, BLEIO_SEQ_HANDLE, bleio_seq_handle, ON_BLEIO_SEQ_CAN_READ, can_read, void*, context)
+    MOCK_VOID_METHOD_END()
 };
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , void*, gballoc_malloc, size_t, size);
@@ -225,6 +228,7 @@ DECLARE_GLOBAL_MOCK_METHOD_4(CBLEMocks, , BLEIO_SEQ_HANDLE, BLEIO_Seq_Create, BL
 DECLARE_GLOBAL_MOCK_METHOD_3(CBLEMocks, , void, BLEIO_Seq_Destroy, BLEIO_SEQ_HANDLE, bleio_seq_handle, ON_BLEIO_SEQ_DESTROY_COMPLETE, on_destroy_complete, void*, context);
 DECLARE_GLOBAL_MOCK_METHOD_1(CBLEMocks, , BLEIO_SEQ_RESULT, BLEIO_Seq_Run, BLEIO_SEQ_HANDLE, bleio_seq_handle);
 DECLARE_GLOBAL_MOCK_METHOD_2(CBLEMocks, , BLEIO_SEQ_RESULT, BLEIO_Seq_AddInstruction, BLEIO_SEQ_HANDLE, bleio_seq_handle, BLEIO_SEQ_INSTRUCTION*, instruction);
+DECLARE_GLOBAL_MOCK_METHOD_3(CBLEMocks, , void, BLEIO_Seq_SetReadGate, BLEIO_SEQ_HANDLE, bleio_seq_handle, ON_BLEIO_SEQ_CAN_READ, can_read, void*, context);
 
 BEGIN_TEST_SUITE(ble_ut)
 TEST_SUITE_INITIALIZE(TestClassInitialize)
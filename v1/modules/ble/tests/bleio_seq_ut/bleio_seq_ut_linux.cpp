@@ -73,6 +73,13 @@ gboolean g_expected_timer_return_value = TRUE;
 GSourceFunc g_timer_callback = NULL;
 gpointer g_timer_data = NULL;
 
+static bool deny_read(BLEIO_SEQ_HANDLE bleio_seq_handle, void* context)
+{
+    (void)bleio_seq_handle;
+    (*(int*)context)++;
+    return false;
+}
+
 TYPED_MOCK_CLASS(CBLEIOSeqMocks, CGlobalMock)
 {
 public:
@@ -3311,4 +3318,76 @@ BEGIN_TEST_SUITE(bleio_seq_ut)
         BUFFER_delete(instruction2.data.buffer);
     }
 
+    /*Tests_SRS_BLEIO_SEQ_30_001: [ If bleio_seq_handle is NULL then BLEIO_Seq_SetReadGate shall do nothing. ]*/
+    TEST_FUNCTION(BLEIO_Seq_SetReadGate_does_nothing_with_NULL_handle)
+    {
+        ///arrange
+        CBLEIOSeqMocks mocks;
+        int gate_calls = 0;
+
+        ///act
+        BLEIO_Seq_SetReadGate(NULL, deny_read, &gate_calls);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+        ASSERT_ARE_EQUAL(int, 0, gate_calls);
+
+        ///cleanup
+    }
+
+    /*Tests_SRS_BLEIO_SEQ_30_002: [ BLEIO_Seq_SetReadGate shall replace the read gate of the sequence with can_read and context; a NULL can_read removes it. ]*/
+    /*Tests_SRS_BLEIO_SEQ_30_003: [ If a read gate is set and it returns false, the READ_PERIODIC instruction shall not be read at that interval and its timer shall keep running. ]*/
+    TEST_FUNCTION(BLEIO_Seq_timer_function_skips_the_read_when_the_read_gate_returns_false)
+    {
+        ///arrange
+        CBLEIOSeqMocks mocks;
+        VECTOR_HANDLE instructions = VECTOR_create(sizeof(BLEIO_SEQ_INSTRUCTION));
+        BLEIO_SEQ_INSTRUCTION instruction =
+        {
+            WRITE_ONCE,
+            STRING_construct("fake_char_id"),
+            NULL,
+            { .buffer = BUFFER_create((const unsigned char*)"data", 4) }
+        };
+        VECTOR_push_back(instructions, &instruction, 1);
+        auto sequence = BLEIO_Seq_Create((BLEIO_GATT_HANDLE)0x42, instructions, on_read_complete, on_write_complete);
+        (void)BLEIO_Seq_Run(sequence);
+
+        BLEIO_SEQ_INSTRUCTION instruction2 =
+        {
+            READ_PERIODIC,
+            STRING_construct("fake_char_id"),
+            NULL,
+            { 500 }
+        };
+
+        // cause BLEIO_gatt_read_char_by_uuid to succeed
+        BLEIO_gatt_read_char_by_uuid_results.result = BLEIO_GATT_OK;
+        BLEIO_gatt_read_char_by_uuid_results.buffer = (const unsigned char*)"data";
+        BLEIO_gatt_read_char_by_uuid_results.size = 4;
+
+        // the assertion is in the g_timeout_add mock implementation
+        g_expected_timer_return_value = G_SOURCE_CONTINUE;
+
+        (void)BLEIO_Seq_AddInstruction(sequence, &instruction2);
+        int gate_calls = 0;
+        BLEIO_Seq_SetReadGate(sequence, deny_read, &gate_calls);
+        mocks.ResetAllCalls();
+
+        ///act
+        auto result = g_timer_callback(g_timer_data);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+        ASSERT_ARE_EQUAL(int, G_SOURCE_CONTINUE, result);
+        ASSERT_ARE_EQUAL(int, 1, gate_calls);
+
+        ///cleanup
+        BLEIO_Seq_Destroy(sequence, NULL, NULL);
+
+        // call the timer callback once more to cancel the timer
+        g_expected_timer_return_value = G_SOURCE_REMOVE;
+        g_timer_callback(g_timer_data);
+    }
+
 END_TEST_SUITE(bleio_seq_ut)
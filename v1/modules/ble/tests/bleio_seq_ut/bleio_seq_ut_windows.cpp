@@ -157,4 +157,19 @@ BEGIN_TEST_SUITE(bleio_seq_ut)
         ///cleanup
     }
 
+    /*Tests_SRS_BLEIO_SEQ_30_004: [ On Windows this function shall do nothing. ]*/
+    TEST_FUNCTION(BLEIO_Seq_SetReadGate_does_nothing)
+    {
+        ///arrange
+        CBLEIOSeqMocks mocks;
+
+        ///act
+        BLEIO_Seq_SetReadGate((BLEIO_SEQ_HANDLE)0x42, NULL, NULL);
+
+        ///assert
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+    }
+
 END_TEST_SUITE(bleio_seq_ut)
@@ -81,6 +81,12 @@ static size_t whenShallVectorElement_fail;
 
 static size_t currentMessage_call;
 static size_t whenShallMessage_fail;
+
+#define MAX_DERIVED_PROPERTIES 4
+static MESSAGE_PROPERTY derivedAdds[MAX_DERIVED_PROPERTIES];
+static size_t derivedAddCount;
+static const char* derivedRemoves[MAX_DERIVED_PROPERTIES];
+static size_t derivedRemoveCount;
 static CONSTBUFFER messageContent;
 
 class RefCountObject
@@ -217,21 +223,21 @@ TYPED_MOCK_CLASS(CIdentitymapMocks, CGlobalMock)
         ((RefCountObject*)map)->dec_ref();
     MOCK_VOID_METHOD_END()
 
-    MOCK_STATIC_METHOD_2(, const char*, ConstMap_GetValue, CONSTMAP_HANDLE, handle, const char*, key)
+    MOCK_STATIC_METHOD_2(, const char*, Message_GetPropertyValueByKey, MESSAGE_HANDLE, message, MESSAGE_KEY, key)
         const char * result5 = VALID_VALUE;
-        if (strcmp(GW_MAC_ADDRESS_PROPERTY, key) == 0)
+        if (key == MESSAGE_KEY_MAC_ADDRESS)
         {
             result5 = macAddressProperties;
         }
-        else if (strcmp(GW_SOURCE_PROPERTY, key) == 0)
+        else if (key == MESSAGE_KEY_SOURCE)
         {
             result5 = sourceProperties;
         }
-        else if (strcmp(GW_DEVICENAME_PROPERTY, key) == 0)
+        else if (key == MESSAGE_KEY_DEVICE_NAME)
         {
             result5 = deviceNameProperties;
         }
-        else if (strcmp(GW_DEVICEKEY_PROPERTY, key) == 0)
+        else if (key == MESSAGE_KEY_DEVICE_KEY)
         {
             result5 = deviceKeyProperties;
         }
@@ -317,6 +323,29 @@ TYPED_MOCK_CLASS(CIdentitymapMocks, CGlobalMock)
         }
     MOCK_METHOD_END(MESSAGE_HANDLE, result1)
 
+    MOCK_STATIC_METHOD_5(, MESSAGE_HANDLE, Message_CreateDerived, MESSAGE_HANDLE, base, const MESSAGE_PROPERTY*, adds, size_t, addCount, const char* const*, removes, size_t, removeCount)
+        MESSAGE_HANDLE result1;
+        currentMessage_call++;
+        if (currentMessage_call == whenShallMessage_fail)
+        {
+            result1 = NULL;
+        }
+        else
+        {
+            derivedAddCount = addCount;
+            for (size_t i = 0; i < addCount && i < MAX_DERIVED_PROPERTIES; i++)
+            {
+                derivedAdds[i] = adds[i];
+            }
+            derivedRemoveCount = removeCount;
+            for (size_t i = 0; i < removeCount && i < MAX_DERIVED_PROPERTIES; i++)
+            {
+                derivedRemoves[i] = removes[i];
+            }
+            result1 = (MESSAGE_HANDLE)(new RefCountObject());
+        }
+    MOCK_METHOD_END(MESSAGE_HANDLE, result1)
+
     MOCK_STATIC_METHOD_1(, MESSAGE_HANDLE, Message_Clone, MESSAGE_HANDLE, message)
         ((RefCountObject*)message)->inc_ref();
     MOCK_METHOD_END(MESSAGE_HANDLE, message)
@@ -501,7 +530,7 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , CONSTMAP_HANDLE, ConstMap_Crea
 DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , CONSTMAP_HANDLE, ConstMap_Clone, CONSTMAP_HANDLE, handle);
 DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , void, ConstMap_Destroy, CONSTMAP_HANDLE, map);
 DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , MAP_HANDLE, ConstMap_CloneWriteable, CONSTMAP_HANDLE, handle);
-DECLARE_GLOBAL_MOCK_METHOD_2(CIdentitymapMocks, , const char*, ConstMap_GetValue, CONSTMAP_HANDLE, handle, const char *, key);
+DECLARE_GLOBAL_MOCK_METHOD_2(CIdentitymapMocks, , const char*, Message_GetPropertyValueByKey, MESSAGE_HANDLE, message, MESSAGE_KEY, key);
 
 DECLARE_GLOBAL_MOCK_METHOD_2(CIdentitymapMocks, , CONSTBUFFER_HANDLE, CONSTBUFFER_Create, const unsigned char*, source, size_t, size);
 DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , CONSTBUFFER_HANDLE, CONSTBUFFER_Clone, CONSTBUFFER_HANDLE, constbufferHandle);
@@ -514,6 +543,7 @@ DECLARE_GLOBAL_MOCK_METHOD_2(CIdentitymapMocks, , MAP_RESULT, Map_Delete, MAP_HA
 
 DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , MESSAGE_HANDLE, Message_Create, const MESSAGE_CONFIG*, cfg);
 DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , MESSAGE_HANDLE, Message_CreateFromBuffer, const MESSAGE_BUFFER_CONFIG*, cfg);
+DECLARE_GLOBAL_MOCK_METHOD_5(CIdentitymapMocks, , MESSAGE_HANDLE, Message_CreateDerived, MESSAGE_HANDLE, base, const MESSAGE_PROPERTY*, adds, size_t, addCount, const char* const*, removes, size_t, removeCount);
 DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , MESSAGE_HANDLE, Message_Clone, MESSAGE_HANDLE, message);
 DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , CONSTMAP_HANDLE, Message_GetProperties, MESSAGE_HANDLE, message);
 DECLARE_GLOBAL_MOCK_METHOD_1(CIdentitymapMocks, , const CONSTBUFFER*, Message_GetContent, MESSAGE_HANDLE, message);
@@ -2069,11 +2099,7 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
 
 
         ///Act
@@ -2106,13 +2132,8 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_MAC_ADDRESS));
         STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
 
@@ -2151,20 +2172,13 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_MAC_ADDRESS));
         STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_KEY));
 
 
         ///Act
@@ -2201,20 +2215,13 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_MAC_ADDRESS));
         STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_KEY));
 
 
         ///Act
@@ -2251,20 +2258,13 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_MAC_ADDRESS));
         STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_KEY));
 
 
 
@@ -2301,20 +2301,13 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_MAC_ADDRESS));
         STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_KEY));
 
 
         ///Act
@@ -2330,12 +2323,13 @@ BEGIN_TEST_SUITE(idmap_ut)
 
     }
 
-    /*Tests_SRS_IDMAP_17_021: [If messageHandle properties does not contain "macAddress" property, then the function shall return.]*/
-    TEST_FUNCTION(IdentityMap_Receive_D2C_get_properties_2_fail)
+    /*Tests_SRS_IDMAP_17_027: [If Message_CreateDerived fails, IdentityMap_Receive shall deallocate any resources and return.]*/
+    TEST_FUNCTION(IdentityMap_Receive_D2C_Message_CreateDerived_fail)
     {
         ///Arrange
         CIdentitymapMocks mocks;
         const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
+        
 
         unsigned char fake;
         BROKER_HANDLE broker = Broker_Create();
@@ -2349,21 +2343,17 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_MAC_ADDRESS));
         STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-
-        whenShallMessage_fail = 2;
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
+        whenShallMessage_fail = 1;
+        STRICT_EXPECTED_CALL(mocks, Message_CreateDerived(m, IGNORED_PTR_ARG, 3, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(2)
+            .IgnoreArgument(4);
 
 
         ///Act
@@ -2379,12 +2369,13 @@ BEGIN_TEST_SUITE(idmap_ut)
 
     }
 
-    /*Tests_SRS_IDMAP_17_027: [If ConstMap_CloneWriteable fails, IdentityMap_Receive shall deallocate any resources and return.]*/
-    TEST_FUNCTION(IdentityMap_Receive_D2C_CloneWriteable_fails)
+    /*Tests_SRS_IDMAP_17_038: [IdentityMap_Receive shall call Broker_Publish with broker and new message.]*/
+    TEST_FUNCTION(IdentityMap_Receive_D2C_Broker_Publish_fail)
     {
         ///Arrange
         CIdentitymapMocks mocks;
         const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
+        
 
         unsigned char fake;
         BROKER_HANDLE broker = Broker_Create();
@@ -2399,23 +2390,20 @@ BEGIN_TEST_SUITE(idmap_ut)
         mocks.ResetAllCalls();
 
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_MAC_ADDRESS));
         STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        whenShallConstMap_CloneWriteable_fail = 1;
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
+        STRICT_EXPECTED_CALL(mocks, Message_CreateDerived(m, IGNORED_PTR_ARG, 3, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(2)
+            .IgnoreArgument(4);
+        STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
+        currentBrokerResult = BROKER_ERROR;
+        STRICT_EXPECTED_CALL(mocks, Broker_Publish(broker, n, IGNORED_PTR_ARG))
+            .IgnoreArgument(3);
 
 
         ///Act
@@ -2431,47 +2419,66 @@ BEGIN_TEST_SUITE(idmap_ut)
 
     }
 
-    /*Tests_SRS_IDMAP_17_029: [If adding deviceName fails,IdentityMap_Receive shall deallocate all resources and return.]*/
-    TEST_FUNCTION(IdentityMap_Receive_D2C_MapAdd1_fail)
+    /*Tests_SRS_IDMAP_17_026: [On a D2C message received, IdentityMap_Receive shall create the message to send by calling Message_CreateDerived on messageHandle.]*/
+    /*Tests_SRS_IDMAP_17_028: [IdentityMap_Receive shall add the property "deviceName" with the value of found deviceId.]*/
+    /*Tests_SRS_IDMAP_17_032: [IdentityMap_Receive shall add the property "source" with the value "mapping".]*/
+    /*Tests_SRS_IDMAP_17_030: [IdentityMap_Receive shall add the property "deviceKey" with the value of found deviceKey.]*/
+    /*Tests_SRS_IDMAP_17_053: [ IdentityMap_Receive shall remove the "macAddress" property. ]*/
+    /*Tests_SRS_IDMAP_17_036: [The new message shall share the content and the other properties of messageHandle instead of copying them.]*/
+    /*Tests_SRS_IDMAP_17_038: [IdentityMap_Receive shall call Broker_Publish with broker and new message.]*/
+    /*Tests_SRS_IDMAP_17_039: [IdentityMap_Receive will destroy all resources it created.]*/
+    TEST_FUNCTION(IdentityMap_Receive_D2C_Success)
     {
         ///Arrange
         CIdentitymapMocks mocks;
         const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
+        
 
         unsigned char fake;
-        BROKER_HANDLE broker = Broker_Create();
-        auto n = MODULE_CREATE(theAPIS)(broker, testVector2);
+        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
+        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
+
+        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
+        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
+        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
+        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
+        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
+        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
+        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
+        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
+        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
+        VECTOR_push_back(v, &c1, 1);
+        VECTOR_push_back(v, &c2, 1);
+        VECTOR_push_back(v, &c3, 1);
+        VECTOR_push_back(v, &c4, 1);
+        VECTOR_push_back(v, &c5, 1);
+        VECTOR_push_back(v, &c6, 1);
+        VECTOR_push_back(v, &c7, 1);
+        VECTOR_push_back(v, &c8, 1);
+        VECTOR_push_back(v, &c9, 1);
+        auto n = MODULE_CREATE(theAPIS)(broker, v);
 
         MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
         auto m = Message_Create(&cfg);
 
-        macAddressProperties = "aa:aa:bb:bb:cc:cc";
+        macAddressProperties = "07:07:07:07:07:07";
         sourceProperties = GW_SOURCE_BLE_TELEMETRY;
 
         mocks.ResetAllCalls();
 
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_MAC_ADDRESS));
         STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreAllArguments();
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        whenShallMap_fail = 1;
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY, "aNiceDevice")).IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
+        STRICT_EXPECTED_CALL(mocks, Message_CreateDerived(m, IGNORED_PTR_ARG, 3, IGNORED_PTR_ARG, 1))
+            .IgnoreArgument(2)
+            .IgnoreArgument(4);
+        STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Broker_Publish((BROKER_HANDLE)&fake, n, IGNORED_PTR_ARG))
+            .IgnoreArgument(3);
 
 
         ///Act
@@ -2479,16 +2486,31 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         ///Assert
         mocks.AssertActualAndExpectedCalls();
+        ASSERT_ARE_EQUAL(size_t, (size_t)3, derivedAddCount);
+        ASSERT_ARE_EQUAL(char_ptr, GW_DEVICENAME_PROPERTY, derivedAdds[0].key);
+        ASSERT_ARE_EQUAL(char_ptr, "Sensor7", derivedAdds[0].value);
+        ASSERT_ARE_EQUAL(char_ptr, GW_DEVICEKEY_PROPERTY, derivedAdds[1].key);
+        ASSERT_ARE_EQUAL(char_ptr, "theKeyFor7", derivedAdds[1].value);
+        ASSERT_ARE_EQUAL(char_ptr, GW_SOURCE_PROPERTY, derivedAdds[2].key);
+        ASSERT_ARE_EQUAL(char_ptr, GW_IDMAP_MODULE, derivedAdds[2].value);
+        ASSERT_ARE_EQUAL(size_t, (size_t)1, derivedRemoveCount);
+        ASSERT_ARE_EQUAL(char_ptr, GW_MAC_ADDRESS_PROPERTY, derivedRemoves[0]);
 
         ///Ablution
         Message_Destroy(m);
+        VECTOR_destroy(v);
         MODULE_DESTROY(theAPIS)(n);
-        Broker_Destroy(broker);
 
     }
 
-    /*Tests_SRS_IDMAP_17_031: [If adding deviceKey fails, IdentityMap_Receive shall deallocate all resources and return.]*/
-    TEST_FUNCTION(IdentityMap_Receive_D2C_MapAdd2_fail)
+    //Tests_SRS_IDMAP_17_049: [ On a C2D message received, IdentityMap_Receive shall create the message to send by calling Message_CreateDerived on messageHandle. ]
+    //Tests_SRS_IDMAP_17_051: [ IdentityMap_Receive shall add the property "macAddress" with the value of found macAddress. ]
+    //Tests_SRS_IDMAP_17_055: [ IdentityMap_Receive shall remove the "deviceName" property. ]
+    //Tests_SRS_IDMAP_17_057: [ IdentityMap_Receive shall remove the "deviceKey" property. ]
+    //Tests_SRS_IDMAP_17_032: [IdentityMap_Receive shall add the property "source" with the value "mapping".]
+    //Tests_SRS_IDMAP_17_036: [The new message shall share the content and the other properties of messageHandle instead of copying them.]
+    //Tests_SRS_IDMAP_17_038: [IdentityMap_Receive shall call Broker_Publish with broker and new message.]
+    TEST_FUNCTION(IdentityMap_Receive_C2D_Success)
     {
         ///Arrange
         CIdentitymapMocks mocks;
@@ -2496,39 +2518,47 @@ BEGIN_TEST_SUITE(idmap_ut)
         
 
         unsigned char fake;
-        BROKER_HANDLE broker = Broker_Create();
-        auto n = MODULE_CREATE(theAPIS)(broker, testVector2);
+        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
+        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
+
+        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
+        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
+        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
+        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
+        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
+        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
+        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
+        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
+        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
+        VECTOR_push_back(v, &c1, 1);
+        VECTOR_push_back(v, &c2, 1);
+        VECTOR_push_back(v, &c3, 1);
+        VECTOR_push_back(v, &c4, 1);
+        VECTOR_push_back(v, &c5, 1);
+        VECTOR_push_back(v, &c6, 1);
+        VECTOR_push_back(v, &c7, 1);
+        VECTOR_push_back(v, &c8, 1);
+        VECTOR_push_back(v, &c9, 1);
+        auto n = MODULE_CREATE(theAPIS)(broker, v);
 
         MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
         auto m = Message_Create(&cfg);
 
-        macAddressProperties = "aa:aa:bb:bb:cc:cc";
-        sourceProperties = GW_SOURCE_BLE_TELEMETRY;
+        deviceNameProperties = "Sensor7";
+        sourceProperties = GW_IOTHUB_MODULE;
 
         mocks.ResetAllCalls();
 
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        whenShallMap_fail = 2;
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY, "aNiceDevice")).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY, "aNiceKey")).IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
+            
+        STRICT_EXPECTED_CALL(mocks, Message_CreateDerived(m, IGNORED_PTR_ARG, 2, IGNORED_PTR_ARG, 2))
+            .IgnoreArgument(2)
+            .IgnoreArgument(4);
+        STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Broker_Publish((BROKER_HANDLE)&fake, n, IGNORED_PTR_ARG))
+            .IgnoreArgument(3);
 
 
         ///Act
@@ -2536,16 +2566,24 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         ///Assert
         mocks.AssertActualAndExpectedCalls();
+        ASSERT_ARE_EQUAL(size_t, (size_t)2, derivedAddCount);
+        ASSERT_ARE_EQUAL(char_ptr, GW_MAC_ADDRESS_PROPERTY, derivedAdds[0].key);
+        ASSERT_ARE_EQUAL(char_ptr, "07:07:07:07:07:07", derivedAdds[0].value);
+        ASSERT_ARE_EQUAL(char_ptr, GW_SOURCE_PROPERTY, derivedAdds[1].key);
+        ASSERT_ARE_EQUAL(char_ptr, GW_IDMAP_MODULE, derivedAdds[1].value);
+        ASSERT_ARE_EQUAL(size_t, (size_t)2, derivedRemoveCount);
+        ASSERT_ARE_EQUAL(char_ptr, GW_DEVICENAME_PROPERTY, derivedRemoves[0]);
+        ASSERT_ARE_EQUAL(char_ptr, GW_DEVICEKEY_PROPERTY, derivedRemoves[1]);
 
         ///Ablution
         Message_Destroy(m);
+        VECTOR_destroy(v);
         MODULE_DESTROY(theAPIS)(n);
-        Broker_Destroy(broker);
 
     }
 
-    /*Tests_SRS_IDMAP_17_033: [If adding source fails, IdentityMap_Receive shall deallocate all resources and return.]*/
-    TEST_FUNCTION(IdentityMap_Receive_D2C_MapAdd3_fail)
+    //Tests_SRS_IDMAP_17_050: [ If Message_CreateDerived fails, IdentityMap_Receive shall deallocate any resources and return. ]
+    TEST_FUNCTION(IdentityMap_Receive_C2D_Message_CreateDerived_fail)
     {
         ///Arrange
         CIdentitymapMocks mocks;
@@ -2553,39 +2591,45 @@ BEGIN_TEST_SUITE(idmap_ut)
         
 
         unsigned char fake;
-        BROKER_HANDLE broker = Broker_Create();
-        auto n = MODULE_CREATE(theAPIS)(broker, testVector2);
+        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
+        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
+
+        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
+        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
+        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
+        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
+        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
+        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
+        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
+        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
+        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
+        VECTOR_push_back(v, &c1, 1);
+        VECTOR_push_back(v, &c2, 1);
+        VECTOR_push_back(v, &c3, 1);
+        VECTOR_push_back(v, &c4, 1);
+        VECTOR_push_back(v, &c5, 1);
+        VECTOR_push_back(v, &c6, 1);
+        VECTOR_push_back(v, &c7, 1);
+        VECTOR_push_back(v, &c8, 1);
+        VECTOR_push_back(v, &c9, 1);
+        auto n = MODULE_CREATE(theAPIS)(broker, v);
 
         MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
         auto m = Message_Create(&cfg);
 
-        macAddressProperties = "aa:aa:bb:bb:cc:cc";
-        sourceProperties = GW_SOURCE_BLE_TELEMETRY;
+        deviceNameProperties = "Sensor7";
+        sourceProperties = GW_IOTHUB_MODULE;
 
         mocks.ResetAllCalls();
 
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        whenShallMap_fail = 3;
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY, "aNiceDevice")).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY, "aNiceKey")).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE)).IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
+            
+        whenShallMessage_fail = 1;
+        STRICT_EXPECTED_CALL(mocks, Message_CreateDerived(m, IGNORED_PTR_ARG, 2, IGNORED_PTR_ARG, 2))
+            .IgnoreArgument(2)
+            .IgnoreArgument(4);
 
 
         ///Act
@@ -2596,13 +2640,13 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         ///Ablution
         Message_Destroy(m);
+        VECTOR_destroy(v);
         MODULE_DESTROY(theAPIS)(n);
-        Broker_Destroy(broker);
 
     }
 
-    /*Tests_SRS_IDMAP_17_035: [If cloning message content fails, IdentityMap_Receive shall deallocate all resources and return.]*/
-    TEST_FUNCTION(IdentityMap_Receive_D2C_Message_GetContent_fail)
+    //Tests_SRS_IDMAP_17_048: [ If the deviceName of the message is not found in deviceToMacArray, then the message shall not be marked as a C2D message. ]
+    TEST_FUNCTION(IdentityMap_Receive_C2D_id_no_match_no_new_msg)
     {
         ///Arrange
         CIdentitymapMocks mocks;
@@ -2610,43 +2654,40 @@ BEGIN_TEST_SUITE(idmap_ut)
         
 
         unsigned char fake;
-        BROKER_HANDLE broker = Broker_Create();
-        auto n = MODULE_CREATE(theAPIS)(broker, testVector2);
+        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
+        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
+
+        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
+        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
+        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
+        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
+        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
+        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
+        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
+        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
+        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
+        VECTOR_push_back(v, &c1, 1);
+        VECTOR_push_back(v, &c2, 1);
+        VECTOR_push_back(v, &c3, 1);
+        VECTOR_push_back(v, &c4, 1);
+        VECTOR_push_back(v, &c5, 1);
+        VECTOR_push_back(v, &c6, 1);
+        VECTOR_push_back(v, &c7, 1);
+        VECTOR_push_back(v, &c8, 1);
+        VECTOR_push_back(v, &c9, 1);
+        auto n = MODULE_CREATE(theAPIS)(broker, v);
 
         MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
         auto m = Message_Create(&cfg);
 
-        macAddressProperties = "aa:aa:bb:bb:cc:cc";
-        sourceProperties = GW_SOURCE_BLE_TELEMETRY;
+        deviceNameProperties = "Sensor13";
+        sourceProperties = GW_IOTHUB_MODULE;
 
         mocks.ResetAllCalls();
 
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY, "aNiceDevice")).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY, "aNiceKey")).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        whenShallMessage_fail = 3;
-        STRICT_EXPECTED_CALL(mocks, Message_GetContentHandle(m));
-
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
 
         ///Act
         MODULE_RECEIVE(theAPIS)(n, m);
@@ -2656,13 +2697,14 @@ BEGIN_TEST_SUITE(idmap_ut)
 
         ///Ablution
         Message_Destroy(m);
+        VECTOR_destroy(v);
         MODULE_DESTROY(theAPIS)(n);
-        Broker_Destroy(broker);
 
     }
 
-    /*Tests_SRS_IDMAP_17_037: [If creating new message fails, IdentityMap_Receive shall deallocate all resources and return.]*/
-    TEST_FUNCTION(IdentityMap_Receive_D2C_Message_CreateFromBuffer_fail)
+    //Tests_SRS_IDMAP_17_048: [ If the deviceName of the message is not found in deviceToMacArray, then the message shall not be marked as a C2D message. ]
+    //Tests_SRS_IDMAP_17_045: [ If messageHandle properties does not contain "deviceName" property, then the message shall not be marked as a C2D message. ]
+    TEST_FUNCTION(IdentityMap_Receive_C2D_no_id_no_new_msg)
     {
         ///Arrange
         CIdentitymapMocks mocks;
@@ -2670,1042 +2712,40 @@ BEGIN_TEST_SUITE(idmap_ut)
         
 
         unsigned char fake;
-        BROKER_HANDLE broker = Broker_Create();
-        auto n = MODULE_CREATE(theAPIS)(broker, testVector2);
+        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
+        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
+
+        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
+        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
+        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
+        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
+        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
+        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
+        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
+        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
+        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
+        VECTOR_push_back(v, &c1, 1);
+        VECTOR_push_back(v, &c2, 1);
+        VECTOR_push_back(v, &c3, 1);
+        VECTOR_push_back(v, &c4, 1);
+        VECTOR_push_back(v, &c5, 1);
+        VECTOR_push_back(v, &c6, 1);
+        VECTOR_push_back(v, &c7, 1);
+        VECTOR_push_back(v, &c8, 1);
+        VECTOR_push_back(v, &c9, 1);
+        auto n = MODULE_CREATE(theAPIS)(broker, v);
 
         MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
         auto m = Message_Create(&cfg);
 
-        macAddressProperties = "aa:aa:bb:bb:cc:cc";
-        sourceProperties = GW_SOURCE_BLE_TELEMETRY;
+        deviceNameProperties = NULL;
+        sourceProperties = GW_IOTHUB_MODULE;
 
         mocks.ResetAllCalls();
 
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY, "aNiceDevice"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY, "aNiceKey"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetContentHandle(m));
-        whenShallMessage_fail = 4;
-        STRICT_EXPECTED_CALL(mocks, Message_CreateFromBuffer(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Create(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        MODULE_DESTROY(theAPIS)(n);
-        Broker_Destroy(broker);
-
-    }
-
-    /*Tests_SRS_IDMAP_17_038: [IdentityMap_Receive shall call Broker_Publish with broker and new message.]*/
-    TEST_FUNCTION(IdentityMap_Receive_D2C_Broker_Publish_fail)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = Broker_Create();
-        auto n = MODULE_CREATE(theAPIS)(broker, testVector2);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        macAddressProperties = "aa:aa:bb:bb:cc:cc";
-        sourceProperties = GW_SOURCE_BLE_TELEMETRY;
-
-        mocks.ResetAllCalls();
-
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY, "aNiceDevice"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY, "aNiceKey"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetContentHandle(m));
-        STRICT_EXPECTED_CALL(mocks, Message_CreateFromBuffer(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Create(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        currentBrokerResult = BROKER_ERROR;
-        STRICT_EXPECTED_CALL(mocks, Broker_Publish(broker, n, IGNORED_PTR_ARG))
-            .IgnoreArgument(3);
-
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        MODULE_DESTROY(theAPIS)(n);
-        Broker_Destroy(broker);
-
-    }
-
-    //Tests_SRS_IDMAP_17_054: [ If deleting the MAC Address fails, IdentityMap_Receive shall deallocate all resources and return. ]
-    TEST_FUNCTION(IdentityMap_Receive_D2C_macaddress_delete_fails)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        macAddressProperties = "07:07:07:07:07:07";
-        sourceProperties = GW_SOURCE_BLE_TELEMETRY;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY, "Sensor7"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY, "theKeyFor7"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1)
-            .SetFailReturn((MAP_RESULT)MAP_KEYNOTFOUND);
-
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    /*Tests_SRS_IDMAP_17_026: [On a message which passes all checks, IdentityMap_Receive shall call ConstMap_CloneWriteable on the message properties.]*/
-    /*Tests_SRS_IDMAP_17_028: [IdentityMap_Receive shall call Map_AddOrUpdate with key of "deviceName" and value of found deviceId.]*/
-    /*Tests_SRS_IDMAP_17_032: [IdentityMap_Receive shall call Map_AddOrUpdate with key of "source" and value of "mapping".]*/
-    /*Tests_SRS_IDMAP_17_030: [IdentityMap_Receive shall call Map_AddOrUpdate with key of "deviceKey" and value of found deviceKey.]*/
-    /*Tests_SRS_IDMAP_17_053: [ IdentityMap_Receive shall call Map_Delete to remove the "macAddress" property. ]*/
-    /*Tests_SRS_IDMAP_17_034: [IdentityMap_Receive shall clone message content.]*/
-    /*Tests_SRS_IDMAP_17_036: [IdentityMap_Receive shall create a new message by calling Message_Create with new map and cloned content.]*/
-    /*Tests_SRS_IDMAP_17_038: [IdentityMap_Receive shall call Broker_Publish with broker and new message.]*/
-    /*Tests_SRS_IDMAP_17_039: [IdentityMap_Receive will destroy all resources it created.]*/
-    TEST_FUNCTION(IdentityMap_Receive_D2C_Success)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        macAddressProperties = "07:07:07:07:07:07";
-        sourceProperties = GW_SOURCE_BLE_TELEMETRY;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, mallocAndStrcpy_s(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY, "Sensor7"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY, "theKeyFor7"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetContentHandle(m));
-        STRICT_EXPECTED_CALL(mocks, Message_CreateFromBuffer(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Create(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Broker_Publish((BROKER_HANDLE)&fake, n, IGNORED_PTR_ARG))
-            .IgnoreArgument(3);
-
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_049: [ On a C2D message received, IdentityMap_Receive shall call ConstMap_CloneWriteable on the message properties. ]
-    //Tests_SRS_IDMAP_17_051: [ IdentityMap_Receive shall call Map_AddOrUpdate with key of "macAddress" and value of found macAddress. ]
-    //Tests_SRS_IDMAP_17_055: [ IdentityMap_Receive shall call Map_Delete to remove the "deviceName" property. ]
-    //Tests_SRS_IDMAP_17_057: [ IdentityMap_Receive shall call Map_Delete to remove the "deviceKey" property. ]
-    //Tests_SRS_IDMAP_17_032: [IdentityMap_Receive shall call Map_AddOrUpdate with key of "source" and value of "mapping".]
-    //Tests_SRS_IDMAP_17_034: [IdentityMap_Receive shall clone message content.]
-    //Tests_SRS_IDMAP_17_036: [IdentityMap_Receive shall create a new message by calling Message_CreateFromBuffer with new map and cloned content.]
-    //Tests_SRS_IDMAP_17_038: [IdentityMap_Receive shall call Broker_Publish with broker and new message.]
-    TEST_FUNCTION(IdentityMap_Receive_C2D_Success)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = "Sensor7";
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-            
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY, "07:07:07:07:07:07"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_GetContentHandle(m));
-        STRICT_EXPECTED_CALL(mocks, Message_CreateFromBuffer(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Create(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Broker_Publish((BROKER_HANDLE)&fake, n, IGNORED_PTR_ARG))
-            .IgnoreArgument(3);
-
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_057: [ IdentityMap_Receive shall call Map_Delete to remove the "deviceKey" property. ]
-    TEST_FUNCTION(IdentityMap_Receive_C2D_no_key_key_delete)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = "Sensor7";
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY, "07:07:07:07:07:07"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY))
-            .IgnoreArgument(1)
-            .SetFailReturn((MAP_RESULT)MAP_KEYNOTFOUND);
-        STRICT_EXPECTED_CALL(mocks, Message_GetContentHandle(m));
-        STRICT_EXPECTED_CALL(mocks, Message_CreateFromBuffer(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Create(IGNORED_PTR_ARG, IGNORED_NUM_ARG))
-            .IgnoreAllArguments();
-        STRICT_EXPECTED_CALL(mocks, CONSTBUFFER_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Broker_Publish((BROKER_HANDLE)&fake, n, IGNORED_PTR_ARG))
-            .IgnoreArgument(3);
-
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_058: [ If deleting the device key does not return MAP_OK or MAP_KEYNOTFOUND, IdentityMap_Receive shall deallocate all resources and return. ]
-    TEST_FUNCTION(IdentityMap_Receive_C2D_key_delete_fails)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = "Sensor7";
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY, "07:07:07:07:07:07"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_DEVICEKEY_PROPERTY))
-            .IgnoreArgument(1)
-            .SetFailReturn((MAP_RESULT)MAP_INVALIDARG);
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_056: [ If deleting the device name fails, IdentityMap_Receive shall deallocate all resources and return. ]
-    TEST_FUNCTION(IdentityMap_Receive_C2D_devicename_delete_fails)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = "Sensor7";
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY, "07:07:07:07:07:07"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Delete(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1)
-            .SetFailReturn((MAP_RESULT)MAP_INVALIDARG);
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_044: [ If messageHandle properties contains a "source" property that is set to "mapping", the message shall not be marked as a D2C message. ] 
-    TEST_FUNCTION(IdentityMap_Receive_C2D_MapUpdate_source_fails)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = "Sensor7";
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY, "07:07:07:07:07:07"))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY, GW_IDMAP_MODULE))
-            .IgnoreArgument(1)
-            .SetFailReturn(MAP_ERROR);
-
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_052: [ If adding macAddress fails, IdentityMap_Receive shall deallocate all resources and return. ]
-
-    TEST_FUNCTION(IdentityMap_Receive_C2D_MapUpdate_mac_fails)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = "Sensor7";
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, GW_MAC_ADDRESS_PROPERTY, "07:07:07:07:07:07"))
-            .IgnoreArgument(1)
-            .SetFailReturn(MAP_ERROR);
-
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_050: [ If ConstMap_CloneWriteable fails, IdentityMap_Receive shall deallocate any resources and return. ]
-    TEST_FUNCTION(IdentityMap_Receive_C2D_clone_writeable_fails)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = "Sensor7";
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_CloneWriteable(IGNORED_PTR_ARG))
-            .IgnoreArgument(1)
-            .SetFailReturn((MAP_HANDLE)NULL);
-
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_046: [ If messageHandle properties does not contain a "source" property, then the message shall not be marked as a C2D message. ]
-    TEST_FUNCTION(IdentityMap_Receive_C2D_getproperties_fails)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = "Sensor7";
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m))
-            .SetFailReturn((CONSTMAP_HANDLE)NULL);
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_048: [ If the deviceName of the message is not found in deviceToMacArray, then the message shall not be marked as a C2D message. ]
-    TEST_FUNCTION(IdentityMap_Receive_C2D_id_no_match_no_new_msg)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = "Sensor13";
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
-
-        ///Act
-        MODULE_RECEIVE(theAPIS)(n, m);
-
-        ///Assert
-        mocks.AssertActualAndExpectedCalls();
-
-        ///Ablution
-        Message_Destroy(m);
-        VECTOR_destroy(v);
-        MODULE_DESTROY(theAPIS)(n);
-
-    }
-
-    //Tests_SRS_IDMAP_17_048: [ If the deviceName of the message is not found in deviceToMacArray, then the message shall not be marked as a C2D message. ]
-    //Tests_SRS_IDMAP_17_045: [ If messageHandle properties does not contain "deviceName" property, then the message shall not be marked as a C2D message. ]
-    TEST_FUNCTION(IdentityMap_Receive_C2D_no_id_no_new_msg)
-    {
-        ///Arrange
-        CIdentitymapMocks mocks;
-        const MODULE_API* theAPIS= Module_GetApi(MODULE_API_VERSION_1);
-        
-
-        unsigned char fake;
-        BROKER_HANDLE broker = (BROKER_HANDLE)&fake;
-        VECTOR_HANDLE v = VECTOR_create(sizeof(IDENTITY_MAP_CONFIG));
-
-        IDENTITY_MAP_CONFIG c1 = { "01:01:01:01:01:01", "Sensor1", "theKeyFor1" };
-        IDENTITY_MAP_CONFIG c2 = { "02:02:02:02:02:02", "Sensor2", "theKeyFor2" };
-        IDENTITY_MAP_CONFIG c3 = { "03:03:03:03:03:03", "Sensor3", "theKeyFor3" };
-        IDENTITY_MAP_CONFIG c4 = { "04:04:04:04:04:04", "Sensor4", "theKeyFor4" };
-        IDENTITY_MAP_CONFIG c5 = { "05:05:05:05:05:05", "Sensor5", "theKeyFor5" };
-        IDENTITY_MAP_CONFIG c6 = { "06:06:06:06:06:06", "Sensor6", "theKeyFor6" };
-        IDENTITY_MAP_CONFIG c7 = { "07:07:07:07:07:07", "Sensor7", "theKeyFor7" };
-        IDENTITY_MAP_CONFIG c8 = { "08:08:08:08:08:08", "Sensor8", "theKeyFor8" };
-        IDENTITY_MAP_CONFIG c9 = { "09:09:09:09:09:09", "Sensor9", "theKeyFor9" };
-        VECTOR_push_back(v, &c1, 1);
-        VECTOR_push_back(v, &c2, 1);
-        VECTOR_push_back(v, &c3, 1);
-        VECTOR_push_back(v, &c4, 1);
-        VECTOR_push_back(v, &c5, 1);
-        VECTOR_push_back(v, &c6, 1);
-        VECTOR_push_back(v, &c7, 1);
-        VECTOR_push_back(v, &c8, 1);
-        VECTOR_push_back(v, &c9, 1);
-        auto n = MODULE_CREATE(theAPIS)(broker, v);
-
-        MESSAGE_CONFIG cfg = { 1, &fake, (MAP_HANDLE)&fake };
-        auto m = Message_Create(&cfg);
-
-        deviceNameProperties = NULL;
-        sourceProperties = GW_IOTHUB_MODULE;
-
-        mocks.ResetAllCalls();
-
-
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_DEVICENAME_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_DEVICE_NAME));
 
         ///Act
         MODULE_RECEIVE(theAPIS)(n, m);
@@ -3761,11 +2801,7 @@ BEGIN_TEST_SUITE(idmap_ut)
         mocks.ResetAllCalls();
 
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
 
 
         ///Act
@@ -3824,11 +2860,7 @@ BEGIN_TEST_SUITE(idmap_ut)
         mocks.ResetAllCalls();
 
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(m));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Create(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG)).IgnoreArgument(1);
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, GW_SOURCE_PROPERTY))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(m, MESSAGE_KEY_SOURCE));
 
 
         ///Act
@@ -59,11 +59,7 @@ typedef struct IOTHUB_HANDLE_DATA_TAG
 
 } MESSAGE_DELIVERED_CALLBACK_CONTEXT;
 
-#define SOURCE "source"
 #define MAPPING "mapping"
-#define DEVICENAME "deviceName"
-#define DEVICEKEY "deviceKey"
-#define DEVICEFUNCTION "deviceFunction"
 #define DEVICE_REGISTER "register"
 #define SUFFIX "IoTHubSuffix"
 #define HUBNAME "IoTHubName"
@@ -843,9 +839,8 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
     }
     else
     {
-        CONSTMAP_HANDLE properties = Message_GetProperties(messageHandle);
-        const char* source = ConstMap_GetValue(properties, SOURCE); /*properties is !=NULL by contract of Message*/
-        const char* deviceFunction = ConstMap_GetValue(properties, DEVICEFUNCTION); /*properties is !=NULL by contract of Message*/
+        const char* source = Message_GetPropertyValueByKey(messageHandle, MESSAGE_KEY_SOURCE);
+        const char* deviceFunction = Message_GetPropertyValueByKey(messageHandle, MESSAGE_KEY_DEVICE_FUNCTION);
 
         /*Codes_SRS_IOTHUBMODULE_02_010: [ If message properties do not contain a property called "source" set to "mapping" or "deviceFunction" set to "register" then IotHub_Receive shall do nothing.. ]*/
         if (source == NULL && deviceFunction == NULL)
@@ -862,7 +857,7 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
         else
         {
             /*Codes_SRS_IOTHUBMODULE_02_011: [ If message properties do not contain a property called "deviceName" having a non-`NULL` value then `IotHub_Receive` shall do nothing. ]*/
-            const char* deviceName = ConstMap_GetValue(properties, DEVICENAME);
+            const char* deviceName = Message_GetPropertyValueByKey(messageHandle, MESSAGE_KEY_DEVICE_NAME);
             if (deviceName == NULL)
             {
                 /*do nothing, not a message for this module*/
@@ -870,7 +865,7 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
             else
             {
                 /*Codes_SRS_IOTHUBMODULE_02_012: [ If message properties do not contain a property called "deviceKey" having a non-`NULL` value then `IotHub_Receive` shall do nothing. ]*/
-                const char* deviceKey = ConstMap_GetValue(properties, DEVICEKEY);
+                const char* deviceKey = Message_GetPropertyValueByKey(messageHandle, MESSAGE_KEY_DEVICE_KEY);
                 if (deviceKey == NULL)
                 {
                     /*do nothing, missing device key*/
@@ -908,7 +903,7 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
 
                                 /*Codes_SRS_IOTHUBMODULE_99_004: [ If the message contains a property "iotHubMessageId" then callback function `receiveMessageConfirmation` and userContext is given to `IoTHubClient_SendEventAsync` as parameters ]*/
                                 /*Codes_SRS_IOTHUBMODULE_99_005: [ If the message does not contain property "iotHubMessageId" then no callback function is given to `IoTHubClient_SendEventAsync` as a parameter ]*/
-                                const char* iotHubMessageId = ConstMap_GetValue(properties, GW_IOTHUB_MESSAGE_ID);
+                                const char* iotHubMessageId = Message_GetPropertyValueByKey(messageHandle, MESSAGE_KEY_IOTHUB_MESSAGE_ID);
                                 if (iotHubMessageId)
                                 {
                                     userContextCallback = malloc(sizeof(MESSAGE_DELIVERED_CALLBACK_CONTEXT));
@@ -917,7 +912,6 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
                                         /*Codes_SRS_IOTHUBMODULE_99_008: [ If memory allocation fail when handling "iotHubMessageId" property, `IoTHubClient_SendEventAsync` returns without sending the message ]*/
                                         LogError("Failed to create MESSAGE_DELIVERED_CALLBACK_CONTEXT");
                                         IoTHubMessage_Destroy(iotHubMessage);
-                                        ConstMap_Destroy(properties);
                                         return;
                                     }
 
@@ -927,7 +921,6 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
                                         LogError("Failed to allocate/copy iotHubMessageId");
                                         free(userContextCallback);
                                         IoTHubMessage_Destroy(iotHubMessage);
-                                        ConstMap_Destroy(properties);
                                         return;
                                     }
 
@@ -952,7 +945,6 @@ static void IotHub_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHan
                 }
             }
         }
-        ConstMap_Destroy(properties);
     }
     /*Codes_SRS_IOTHUBMODULE_02_022: [ If `IoTHubClient_SendEventAsync` succeeds then `IotHub_Receive` shall return. ]*/
 }
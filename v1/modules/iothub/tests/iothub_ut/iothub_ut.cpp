@@ -397,8 +397,16 @@ public:
         }
     MOCK_METHOD_END(CONSTMAP_HANDLE, result2)
 
-    MOCK_STATIC_METHOD_2(, const char*, ConstMap_GetValue, CONSTMAP_HANDLE, handle, const char*, key)
+    MOCK_STATIC_METHOD_2(, const char*, Message_GetPropertyValueByKey, MESSAGE_HANDLE, message, MESSAGE_KEY, messageKey)
         const char* result2;
+        CONSTMAP_HANDLE handle = (CONSTMAP_HANDLE)message; /*the test messages and their properties have the same values*/
+        const char* key =
+            (messageKey == MESSAGE_KEY_SOURCE) ? "source" :
+            (messageKey == MESSAGE_KEY_DEVICE_FUNCTION) ? "deviceFunction" :
+            (messageKey == MESSAGE_KEY_DEVICE_NAME) ? "deviceName" :
+            (messageKey == MESSAGE_KEY_DEVICE_KEY) ? "deviceKey" :
+            (messageKey == MESSAGE_KEY_IOTHUB_MESSAGE_ID) ? "iotHubMessageId" :
+            "";
         if (handle == CONSTMAP_HANDLE_WITHOUT_SOURCE)
         {
             result2 = NULL;
@@ -636,7 +644,7 @@ DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, IoTHubClient_Destroy, IOTHUB_C
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , CONSTMAP_HANDLE, Message_GetProperties, MESSAGE_HANDLE, message)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , MESSAGE_HANDLE, Message_Create, const MESSAGE_CONFIG*, cfg)
 DECLARE_GLOBAL_MOCK_METHOD_1(IotHubMocks, , void, Message_Destroy, MESSAGE_HANDLE, message)
-DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , const char*, ConstMap_GetValue, CONSTMAP_HANDLE, handle, const char*, key)
+DECLARE_GLOBAL_MOCK_METHOD_2(IotHubMocks, , const char*, Message_GetPropertyValueByKey, MESSAGE_HANDLE, message, MESSAGE_KEY, messageKey)
 DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , MAP_RESULT, Map_AddOrUpdate, MAP_HANDLE, handle, const char*, key, const char*, value);
 DECLARE_GLOBAL_MOCK_METHOD_3(IotHubMocks, , MAP_RESULT, Map_Add, MAP_HANDLE, handle, const char*, key, const char*, value);
 DECLARE_GLOBAL_MOCK_METHOD_4(IotHubMocks, , CONSTMAP_RESULT, ConstMap_GetInternals, CONSTMAP_HANDLE, handle, const char*const**, keys, const char*const**, values, size_t*, count)
@@ -2015,17 +2023,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -2113,9 +2117,8 @@ BEGIN_TEST_SUITE(iothub_ut)
         }
 
         /*Check iotHubMessageId property*/
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreArgument(1)
-            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(IGNORED_PTR_ARG, MESSAGE_KEY_IOTHUB_MESSAGE_ID))
+            .IgnoreArgument(1);
 
         /*finally, send the message*/
         STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
@@ -2142,19 +2145,15 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE))
             .SetReturn((const char*)NULL);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION))
             .SetReturn("register");
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -2297,17 +2296,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Receive(module, MESSAGE_HANDLE_VALID_1);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. One in this test*/
         STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
@@ -2355,9 +2350,8 @@ BEGIN_TEST_SUITE(iothub_ut)
         }
 
         /*Check iotHubMessageId property*/
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(IGNORED_PTR_ARG, MESSAGE_KEY_IOTHUB_MESSAGE_ID))
             .IgnoreArgument(1)
-            .IgnoreArgument(2)
             .SetReturn((const char*)NULL);
 
         /*finally, send the message*/
@@ -2384,17 +2378,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -2482,9 +2472,8 @@ BEGIN_TEST_SUITE(iothub_ut)
         }
 
         /*Check iotHubMessageId property*/
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(IGNORED_PTR_ARG, MESSAGE_KEY_IOTHUB_MESSAGE_ID))
             .IgnoreArgument(1)
-            .IgnoreArgument(2)
             .SetReturn("messageId1234");
 
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(MESSAGE_DELIVERED_CALLBACK_CONTEXT)))
@@ -2510,17 +2499,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Receive(module, MESSAGE_HANDLE_VALID_1);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. One in this test*/
         STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
@@ -2568,9 +2553,8 @@ BEGIN_TEST_SUITE(iothub_ut)
         }
 
         /*Check iotHubMessageId property*/
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(IGNORED_PTR_ARG, MESSAGE_KEY_IOTHUB_MESSAGE_ID))
             .IgnoreArgument(1)
-            .IgnoreArgument(2)
             .SetReturn((const char*)"messageId0123");
 
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(sizeof(MESSAGE_DELIVERED_CALLBACK_CONTEXT)));
@@ -2603,17 +2587,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Receive(module, MESSAGE_HANDLE_VALID_1);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. One in this test*/
         STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
@@ -2661,9 +2641,8 @@ BEGIN_TEST_SUITE(iothub_ut)
         }
 
         /*Check iotHubMessageId property*/
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(IGNORED_PTR_ARG, MESSAGE_KEY_IOTHUB_MESSAGE_ID))
             .IgnoreArgument(1)
-            .IgnoreArgument(2)
             .SetReturn((const char*)"messageId0123");
 
         MESSAGE_DELIVERED_CALLBACK_CONTEXT callbackContext;
@@ -3224,17 +3203,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         Module_Receive(module, MESSAGE_HANDLE_VALID_1);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_2));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_2, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_2, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_2, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_2, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_2, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_2, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_2, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_2, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. One in this test*/
         STRICT_EXPECTED_CALL(mocks, STRING_c_str(IGNORED_PTR_ARG))
@@ -3321,9 +3296,8 @@ BEGIN_TEST_SUITE(iothub_ut)
         }
 
         /*Check iotHubMessageId property*/
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-            .IgnoreArgument(1)
-            .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(IGNORED_PTR_ARG, MESSAGE_KEY_IOTHUB_MESSAGE_ID))
+            .IgnoreArgument(1);
 
         /*finally, send the message*/
         STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
@@ -3350,17 +3324,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -3448,9 +3418,8 @@ BEGIN_TEST_SUITE(iothub_ut)
         }
 
         /*Check iotHubMessageId property*/
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
-                .IgnoreArgument(1)
-                .IgnoreArgument(2);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(IGNORED_PTR_ARG, MESSAGE_KEY_IOTHUB_MESSAGE_ID))
+                .IgnoreArgument(1);
 
         /*finally, send the message*/
         STRICT_EXPECTED_CALL(mocks, IoTHubClient_SendEventAsync(IGNORED_PTR_ARG, IGNORED_PTR_ARG, NULL, NULL))
@@ -3478,17 +3447,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -3597,17 +3562,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -3712,17 +3673,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -3821,17 +3778,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -3910,17 +3863,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -3994,17 +3943,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -4043,17 +3988,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -4111,17 +4052,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -4185,17 +4122,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -4264,17 +4197,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -4317,17 +4246,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY));
 
         /*VECTOR_find_if incurs a STRING_c_str until it find the deviceName. None in this test*/
         STRICT_EXPECTED_CALL(mocks, VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
@@ -4360,17 +4285,13 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceKey"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_KEY))
             .SetReturn((const char*)NULL);
 
         ///act
@@ -4392,15 +4313,11 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceName"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_NAME))
             .SetReturn((const char*)NULL);
 
         ///act
@@ -4422,14 +4339,10 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE))
             .SetReturn((const char*)NULL);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"));
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION));
 
         ///act
         Module_Receive(module, MESSAGE_HANDLE_VALID_1);
@@ -4450,14 +4363,10 @@ BEGIN_TEST_SUITE(iothub_ut)
         auto module = Module_Create(BROKER_HANDLE_VALID, config);
         mocks.ResetAllCalls();
 
-        STRICT_EXPECTED_CALL(mocks, Message_GetProperties(MESSAGE_HANDLE_VALID_1));
-        STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
-            .IgnoreArgument(1);
-
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "source"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_SOURCE))
             .SetReturn((const char*)NULL);
 
-        STRICT_EXPECTED_CALL(mocks, ConstMap_GetValue(CONSTMAP_HANDLE_VALID_1, "deviceFunction"))
+        STRICT_EXPECTED_CALL(mocks, Message_GetPropertyValueByKey(MESSAGE_HANDLE_VALID_1, MESSAGE_KEY_DEVICE_FUNCTION))
             .SetReturn("not register");
 
         ///act
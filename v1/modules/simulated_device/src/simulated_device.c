@@ -109,6 +109,14 @@ static int simulated_device_worker(void * user_data)
         {
             ThreadAPI_Sleep(module_data -> messagePeriod);
 
+            size_t credit;
+            if (Broker_GetPublishCredit(module_data->broker, (MODULE_HANDLE)module_data, &credit) == BROKER_OK &&
+                credit == 0)
+            {
+                /* the modules we publish to are full, skip this reading rather than wait on them */
+                continue;
+            }
+
             MESSAGE_CONFIG newMessageCfg;
             MAP_HANDLE newProperties = Map_Create(NULL);
             if (newProperties == NULL)
@@ -87,6 +87,11 @@ static size_t strnlen_(const char* s, size_t max)
     return i;
 }
 
+static void release_module_message(void* buffer)
+{
+    (void)nn_freemsg(buffer);
+}
+
 REMOTE_MODULE_HANDLE
 ProxyGateway_Attach (
     const MODULE_API * module_apis,
@@ -295,18 +300,19 @@ ProxyGateway_DoWork (
             } else {
                 MESSAGE_HANDLE structured_module_message;
 
-                /* Codes_SRS_PROXY_GATEWAY_027_040: [Message Channel - If a module message was received, then `ProxyGateway_DoWork` will parse that message by calling `MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char * source, int32_t size)` with the buffer received from `nn_recv` as `source` and return value from `nn_recv` as `size`] */
-                if (NULL == (structured_module_message = Message_CreateFromByteArray((const unsigned char *)module_message, bytes_received))) {
+                /* Codes_SRS_PROXY_GATEWAY_027_040: [Message Channel - If a module message was received, then `ProxyGateway_DoWork` will parse that message by calling `MESSAGE_HANDLE Message_CreateFromByteArrayWithRelease(unsigned char * source, int32_t size, MESSAGE_BUFFER_RELEASE release)` with the buffer received from `nn_recv` as `source`, return value from `nn_recv` as `size` and a function calling `nn_freemsg` as `release`] */
+                if (NULL == (structured_module_message = Message_CreateFromByteArrayWithRelease((unsigned char *)module_message, bytes_received, release_module_message))) {
                     /* Codes_SRS_PROXY_GATEWAY_027_041: [Message Channel - If unable to parse the module message, then `ProxyGateway_DoWork` shall free any previously allocated memory and abandon the message channel request] */
                     LogError("%s: Unable to parse control message!", __FUNCTION__);
+                    /* Codes_SRS_PROXY_GATEWAY_027_044: [Message Channel - If unable to parse the module message, then `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
+                    (void)nn_freemsg(module_message);
                 } else {
                     /* Codes_SRS_PROXY_GATEWAY_027_042: [Message Channel - `ProxyGateway_DoWork` shall pass the structured message to the module by calling `void Module_Receive(MODULE_HANDLE moduleHandle)` using the parsed message as `moduleHandle`] */
                     ((MODULE_API_1 *)remote_module->module.module_apis)->Module_Receive(remote_module->module.module_handle, structured_module_message);
                     /* Codes_SRS_PROXY_GATEWAY_027_043: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed module message by calling `void Message_Destroy(MESSAGE_HANDLE * message)` using the parsed module message as `message`] */
+                    /* Codes_SRS_PROXY_GATEWAY_30_001: [Message Channel - The parsed module message shall own the buffer received from `nn_recv`, which is freed by `nn_freemsg` when the last reference to the message is destroyed] */
                     Message_Destroy(structured_module_message);
                 }
-                /* Codes_SRS_PROXY_GATEWAY_027_044: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
-                (void)nn_freemsg(module_message);
             }
         }
     }
@@ -633,6 +639,8 @@ send_control_reply (
             .version = CONTROL_MESSAGE_VERSION_1,
         },
         .status = response,
+        /* Message_CreateFromByteArray parses the compact serialization, so the gateway may use it */
+        .gateway_message_version = GATEWAY_MESSAGE_VERSION_2,
     };
     unsigned char * message_buffer = NULL;
     int32_t message_size;
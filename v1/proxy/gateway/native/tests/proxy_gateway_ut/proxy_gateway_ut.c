@@ -565,6 +565,7 @@ TEST_SUITE_INITIALIZE(suite_init)
 	REGISTER_UMOCK_ALIAS_TYPE(BROKER_RESULT, int);
     REGISTER_UMOCK_ALIAS_TYPE(LOCK_HANDLE, void *);
     REGISTER_UMOCK_ALIAS_TYPE(LOCK_RESULT, int);
+    REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_BUFFER_RELEASE, void *);
     REGISTER_UMOCK_ALIAS_TYPE(MESSAGE_HANDLE, void *);
     REGISTER_UMOCK_ALIAS_TYPE(MODULE_HANDLE, void *);
     REGISTER_UMOCK_ALIAS_TYPE(REMOTE_MODULE_HANDLE, void *);
@@ -1041,10 +1042,10 @@ TEST_FUNCTION(doWork_SCENARIO_NULL_handle)
 /* Tests_SRS_PROXY_GATEWAY_027_035: [Control Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed control message by calling `void ControlMessage_Destroy(CONTROL_MESSAGE * message)` using the parsed control message as `message`] */
 /* Tests_SRS_PROXY_GATEWAY_027_036: [Control Channel - `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
 /* Tests_SRS_PROXY_GATEWAY_027_038: [Message Channel - `ProxyGateway_DoWork` shall poll the gateway message channel by calling `int nn_recv(int s, void * buf, size_t len, int flags)` with each message socket for `s`, `NULL` for `buf`, `NN_MSG` for `len` and NN_DONTWAIT for `flags`] */
-/* Tests_SRS_PROXY_GATEWAY_027_040: [Message Channel - If a module message was received, then `ProxyGateway_DoWork` will parse that message by calling `MESSAGE_HANDLE Message_CreateFromByteArray(const unsigned char * source, int32_t size)` with the buffer received from `nn_recv` as `source` and return value from `nn_recv` as `size`] */
+/* Tests_SRS_PROXY_GATEWAY_027_040: [Message Channel - If a module message was received, then `ProxyGateway_DoWork` will parse that message by calling `MESSAGE_HANDLE Message_CreateFromByteArrayWithRelease(unsigned char * source, int32_t size, MESSAGE_BUFFER_RELEASE release)` with the buffer received from `nn_recv` as `source`, return value from `nn_recv` as `size` and a function calling `nn_freemsg` as `release`] */
 /* Tests_SRS_PROXY_GATEWAY_027_042: [Message Channel - `ProxyGateway_DoWork` shall pass the structured message to the module by calling `void Module_Receive(MODULE_HANDLE moduleHandle)` using the parsed message as `moduleHandle`] */
 /* Tests_SRS_PROXY_GATEWAY_027_043: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the parsed module message by calling `void Message_Destroy(MESSAGE_HANDLE * message)` using the parsed module message as `message`] */
-/* Tests_SRS_PROXY_GATEWAY_027_044: [Message Channel - `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
+/* Tests_SRS_PROXY_GATEWAY_30_001: [Message Channel - The parsed module message shall own the buffer received from `nn_recv`, which is freed by `nn_freemsg` when the last reference to the message is destroyed] */
 TEST_FUNCTION(doWork_SCENARIO_create_message_success)
 {
     // Arrange
@@ -1099,12 +1100,12 @@ TEST_FUNCTION(doWork_SCENARIO_create_message_success)
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .SetReturn(NN_MESSAGE_SIZE);
-    STRICT_EXPECTED_CALL(Message_CreateFromByteArray((const unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_CreateFromByteArrayWithRelease((unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(2)
+        .IgnoreArgument(3)
         .SetReturn((MESSAGE_HANDLE)&CREATE_MESSAGE);
     STRICT_EXPECTED_CALL(mock_receive(MOCK_MODULE, (MESSAGE_HANDLE)&CREATE_MESSAGE));
     STRICT_EXPECTED_CALL(Message_Destroy((MESSAGE_HANDLE)&CREATE_MESSAGE));
-    STRICT_EXPECTED_CALL(nn_freemsg((void *)NN_MESSAGE_BUFFER));
 
     // Act
     ProxyGateway_DoWork(remote_module);
@@ -1188,13 +1189,13 @@ TEST_FUNCTION(doWork_SCENARIO_start_message_success)
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .SetReturn(NN_MESSAGE_SIZE);
-    STRICT_EXPECTED_CALL(Message_CreateFromByteArray((const unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_CreateFromByteArrayWithRelease((unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(2)
+        .IgnoreArgument(3)
         .SetReturn((MESSAGE_HANDLE)&START_MESSAGE);
     STRICT_EXPECTED_CALL(mock_receive(IGNORED_PTR_ARG, (MESSAGE_HANDLE)&START_MESSAGE))
         .IgnoreArgument(1);
     STRICT_EXPECTED_CALL(Message_Destroy((MESSAGE_HANDLE)&START_MESSAGE));
-    STRICT_EXPECTED_CALL(nn_freemsg((void *)NN_MESSAGE_BUFFER));
 
     // Act
     ProxyGateway_DoWork(remote_module);
@@ -1417,6 +1418,7 @@ TEST_FUNCTION(doWork_SCENARIO_gateway_message_not_available)
 }
 
 /* Tests_SRS_PROXY_GATEWAY_027_041: [Message Channel - If unable to parse the module message, then `ProxyGateway_DoWork` shall free any previously allocated memory and abandon the message channel request] */
+/* Tests_SRS_PROXY_GATEWAY_027_044: [Message Channel - If unable to parse the module message, then `ProxyGateway_DoWork` shall free the resources held by the gateway message by calling `int nn_freemsg(void * msg)` with the resulting buffer from the previous call to `nn_recv`] */
 TEST_FUNCTION(doWork_SCENARIO_gateway_message_bad_parse)
 {
     // Arrange
@@ -1465,8 +1467,9 @@ TEST_FUNCTION(doWork_SCENARIO_gateway_message_bad_parse)
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .SetReturn(NN_MESSAGE_SIZE);
-    STRICT_EXPECTED_CALL(Message_CreateFromByteArray((const unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_CreateFromByteArrayWithRelease((unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(2)
+        .IgnoreArgument(3)
         .SetReturn(NULL);
     STRICT_EXPECTED_CALL(nn_freemsg((void *)NN_MESSAGE_BUFFER));
 
@@ -2551,12 +2554,12 @@ TEST_FUNCTION(publish_SCENARIO_create_message_success)
         .IgnoreArgument(1)
         .IgnoreArgument(2)
         .SetReturn(NN_MESSAGE_SIZE);
-    STRICT_EXPECTED_CALL(Message_CreateFromByteArray((const unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG))
+    STRICT_EXPECTED_CALL(Message_CreateFromByteArrayWithRelease((unsigned char *)NN_MESSAGE_BUFFER, IGNORED_NUM_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(2)
+        .IgnoreArgument(3)
         .SetReturn((MESSAGE_HANDLE)&CREATE_MESSAGE);
     STRICT_EXPECTED_CALL(mock_receive(MOCK_MODULE, (MESSAGE_HANDLE)&CREATE_MESSAGE));
     STRICT_EXPECTED_CALL(Message_Destroy((MESSAGE_HANDLE)&CREATE_MESSAGE));
-    STRICT_EXPECTED_CALL(nn_freemsg((void *)NN_MESSAGE_BUFFER));
 
     // Act
     ProxyGateway_DoWork(remote_module);
@@ -112,6 +112,13 @@ typedef struct CONTROL_MESSAGE_MODULE_REPLY_TAG
      *          indicate success and the value 0 to indicate failure.
      */
     uint8_t status;
+
+    /** @brief  The highest version of gateway message the module host parses.
+     *          It is only serialized when larger than
+     *          GATEWAY_MESSAGE_VERSION_1, so a reply without it is read as
+     *          GATEWAY_MESSAGE_VERSION_1.
+     */
+    uint8_t gateway_message_version;
 }CONTROL_MESSAGE_MODULE_REPLY;
 
 
@@ -276,6 +276,11 @@ CONTROL_MESSAGE * ControlMessage_CreateFromByteArray(const unsigned char* source
 							/*Codes_SRS_CONTROL_MESSAGE_17_021: [ This function shall read the status from the byte stream. ]*/
                             ((CONTROL_MESSAGE_MODULE_REPLY*)result)->status = 
                                 (uint8_t)source[currentPosition];
+                            /*Codes_SRS_CONTROL_MESSAGE_30_001: [ This function shall read the gateway_message_version that follows the status, or set it to GATEWAY_MESSAGE_VERSION_1 if the message ends with the status. ]*/
+                            ((CONTROL_MESSAGE_MODULE_REPLY*)result)->gateway_message_version =
+                                (size > BASE_CREATE_REPLY_SIZE) ?
+                                (uint8_t)source[currentPosition + 1] :
+                                GATEWAY_MESSAGE_VERSION_1;
                         }
                     }
                 }
@@ -412,6 +417,10 @@ int32_t ControlMessage_ToByteArray(CONTROL_MESSAGE * message, unsigned char* buf
         {
             result = 0;
             byteArraySize += 1; /* status */
+            if (((CONTROL_MESSAGE_MODULE_REPLY*)message)->gateway_message_version > GATEWAY_MESSAGE_VERSION_1)
+            {
+                byteArraySize += 1; /* gateway message version */
+            }
         }
         else if (
                  (message->type == CONTROL_MESSAGE_TYPE_MODULE_START) || 
@@ -467,6 +476,11 @@ int32_t ControlMessage_ToByteArray(CONTROL_MESSAGE * message, unsigned char* buf
                     CONTROL_MESSAGE_MODULE_REPLY * reply_msg = 
                             (CONTROL_MESSAGE_MODULE_REPLY*)message;
                     buf[currentPosition++] = (reply_msg->status);
+                    /*Codes_SRS_CONTROL_MESSAGE_30_002: [ For a CONTROL_MESSAGE_MODULE_REPLY, this function shall write gateway_message_version after the status only when it is larger than GATEWAY_MESSAGE_VERSION_1. ]*/
+                    if (reply_msg->gateway_message_version > GATEWAY_MESSAGE_VERSION_1)
+                    {
+                        buf[currentPosition++] = (reply_msg->gateway_message_version);
+                    }
                 }
 				/*Codes_SRS_CONTROL_MESSAGE_17_035: [ Upon success this function shall return the byte array size.*/
                 result = byteArraySize;
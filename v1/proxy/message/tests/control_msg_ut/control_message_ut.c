@@ -87,6 +87,13 @@ static const unsigned char notFail____minimalMessageCreateReply[] =
 	0x00, 0x00, 0x00, 9,    /*size of this array*/
 	0x00
 };
+static const unsigned char notFail____messageCreateReplyVersion2[] =
+{
+	0xA1, 0x6C, 0x01, 2,    /*header, version, type */
+	0x00, 0x00, 0x00, 10,   /*size of this array*/
+	0x00,                   /*status*/
+	0x02                    /*gateway message version*/
+};
 static const unsigned char notFail____minimalMessageStart[] =
 {
 	0xA1, 0x6C, 0x01, 3,    /*header, version, type */
@@ -251,6 +258,7 @@ TEST_FUNCTION(ControlMessage_CreateFromByteArray_with_header_fail)
 /*Tests_SRS_CONTROL_MESSAGE_17_024: [ Upon valid reading of the byte stream, this function shall assign the message version and type into the CONTROL_MESSAGE base structure. ]*/
 /*Tests_SRS_CONTROL_MESSAGE_17_025: [ Upon success, this function shall return a valid pointer to the CONTROL_MESSAGE base. ]*/
 /*Tests_SRS_CONTROL_MESSAGE_17_037: [ This function shall read the gateway_message_version. ]*/
+/*Tests_SRS_CONTROL_MESSAGE_30_001: [ This function shall read the gateway_message_version that follows the status, or set it to GATEWAY_MESSAGE_VERSION_1 if the message ends with the status. ]*/
 TEST_FUNCTION(ControlMessage_CreateFromByteArray_success)
 {
 	///arrange
@@ -287,6 +295,7 @@ TEST_FUNCTION(ControlMessage_CreateFromByteArray_success)
 	ASSERT_IS_NULL(rc->args);
 	ASSERT_IS_NULL(rc->uri.uri);
 	ASSERT_ARE_EQUAL(uint8_t, rcr->status, 0);
+	ASSERT_ARE_EQUAL(uint8_t, rcr->gateway_message_version, 0x01);
 	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
 	///cleanup
@@ -763,4 +772,47 @@ TEST_FUNCTION(ControlMessage_ToByteArray_create_reply_correct)
 	///cleanup
 }
 
+/*Tests_SRS_CONTROL_MESSAGE_30_001: [ This function shall read the gateway_message_version that follows the status, or set it to GATEWAY_MESSAGE_VERSION_1 if the message ends with the status. ]*/
+TEST_FUNCTION(ControlMessage_CreateFromByteArray_reply_with_gateway_message_version)
+{
+	///arrange
+	STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(CONTROL_MESSAGE_MODULE_REPLY)));
+
+	///act
+	CONTROL_MESSAGE * r1 = ControlMessage_CreateFromByteArray(notFail____messageCreateReplyVersion2, sizeof(notFail____messageCreateReplyVersion2));
+
+	///assert
+	ASSERT_IS_NOT_NULL(r1);
+	ASSERT_ARE_EQUAL(uint8_t, ((CONTROL_MESSAGE_MODULE_REPLY*)r1)->status, 0);
+	ASSERT_ARE_EQUAL(uint8_t, ((CONTROL_MESSAGE_MODULE_REPLY*)r1)->gateway_message_version, 0x02);
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+	///cleanup
+	ControlMessage_Destroy(r1);
+}
+
+/*Tests_SRS_CONTROL_MESSAGE_30_002: [ For a CONTROL_MESSAGE_MODULE_REPLY, this function shall write gateway_message_version after the status only when it is larger than GATEWAY_MESSAGE_VERSION_1. ]*/
+TEST_FUNCTION(ControlMessage_ToByteArray_create_reply_with_gateway_message_version)
+{
+	///arrange
+	CONTROL_MESSAGE_MODULE_REPLY m1 =
+	{
+		{
+			0x01,
+			CONTROL_MESSAGE_TYPE_MODULE_REPLY
+		},
+		0,
+		0x02
+	};
+	unsigned char buf[10];
+
+	///act
+	int32_t c1 = ControlMessage_ToByteArray((CONTROL_MESSAGE*)&m1, buf, 10);
+	///assert
+	ASSERT_ARE_EQUAL(int32_t, c1, 10);
+	ASSERT_ARE_EQUAL(int, 0, memcmp(buf, notFail____messageCreateReplyVersion2, sizeof(buf)));
+	ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+	///cleanup
+}
+
 END_TEST_SUITE(control_message_ut)
@@ -16,6 +16,7 @@
 
 #include "module.h"
 #include "module_loader.h"
+#include "thread_scheduling.h"
 #include "gateway_export.h"
 
 #ifdef __cplusplus
@@ -53,6 +54,8 @@ typedef struct OUTPROCESS_LOADER_ENTRYPOINT_TAG
     char ** process_argv;
     /** @brief controls timeout for ipc retries. */
 	unsigned int remote_message_wait;
+    /** @brief CPU affinity and scheduling of the proxy module threads. */
+    THREAD_SCHEDULING_CONFIG thread_scheduling;
 } OUTPROCESS_LOADER_ENTRYPOINT;
 
 /** @brief      The API for the out of process proxy module loader. */
@@ -10,6 +10,7 @@
 #define OUTPROCESS_MODULE_H
 
 #include "module.h"
+#include "thread_scheduling.h"
 #include "azure_c_shared_utility/macro_utils.h"
 
 #ifdef __cplusplus
@@ -35,6 +36,8 @@ typedef struct OUTPROCESS_MODULE_CONFIG_DATA
     STRING_HANDLE outprocess_module_args;
 	/** @brief controls timeout for ipc retries. */
 	unsigned int remote_message_wait;
+	/** @brief CPU affinity and scheduling of the threads of this module. */
+	THREAD_SCHEDULING_CONFIG thread_scheduling;
 } OUTPROCESS_MODULE_CONFIG;
 
 /** @brief the API fr this module */
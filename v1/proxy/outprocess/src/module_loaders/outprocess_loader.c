@@ -456,6 +456,54 @@ static void OutprocessModuleLoader_Unload(const struct MODULE_LOADER_TAG* loader
     }
 }
 
+static int parse_thread_scheduling(JSON_Object* thread_json, THREAD_SCHEDULING_CONFIG* thread_scheduling)
+{
+    int result = 0;
+
+    memset(thread_scheduling, 0, sizeof(THREAD_SCHEDULING_CONFIG));
+    if (thread_json != NULL)
+    {
+        /*Codes_SRS_OUTPROCESS_LOADER_30_001: [ If `json` has a "thread" object, this function shall read its "cpus", "nice" and "fifo.priority" values into the entrypoint `thread_scheduling`; a missing value leaves that setting of the proxy module threads unchanged. ]*/
+        JSON_Array* cpus = json_object_get_array(thread_json, "cpus");
+        double nice = json_object_get_number(thread_json, "nice");
+        double fifo_priority = json_object_get_number(thread_json, "fifo.priority");
+
+        if (cpus != NULL)
+        {
+            size_t cpu_count = json_array_get_count(cpus);
+            for (size_t cpu_index = 0; cpu_index < cpu_count; ++cpu_index)
+            {
+                double cpu = json_array_get_number(cpus, cpu_index);
+                if (cpu < 0 || cpu >= THREAD_SCHEDULING_MAX_CPUS || cpu != (double)(size_t)cpu)
+                {
+                    result = __LINE__;
+                    break;
+                }
+                else
+                {
+                    thread_scheduling->cpu_affinity |= ((uint64_t)1 << (size_t)cpu);
+                }
+            }
+        }
+
+        /*Codes_SRS_OUTPROCESS_LOADER_30_002: [ This function shall return `NULL` if a "cpus" entry is not a CPU number below `THREAD_SCHEDULING_MAX_CPUS`, "nice" is not a whole number from `THREAD_SCHEDULING_MIN_NICE` to `THREAD_SCHEDULING_MAX_NICE`, or "fifo.priority" is not a whole number from 0 to `THREAD_SCHEDULING_MAX_FIFO_PRIORITY`. ]*/
+        if (result != 0 ||
+            nice < THREAD_SCHEDULING_MIN_NICE || nice > THREAD_SCHEDULING_MAX_NICE || nice != (double)(int)nice ||
+            fifo_priority < 0 || fifo_priority > THREAD_SCHEDULING_MAX_FIFO_PRIORITY || fifo_priority != (double)(int)fifo_priority)
+        {
+            LogError("JSON has a misconfigured 'thread'.");
+            result = __LINE__;
+        }
+        else
+        {
+            thread_scheduling->nice = (int)nice;
+            thread_scheduling->fifo_priority = (int)fifo_priority;
+        }
+    }
+
+    return result;
+}
+
 static void* OutprocessModuleLoader_ParseEntrypointFromJson(const struct MODULE_LOADER_TAG* loader, const JSON_Value* json)
 {
     (void)loader;
@@ -553,6 +601,22 @@ static void* OutprocessModuleLoader_ParseEntrypointFromJson(const struct MODULE_
                 free(config);
                 config = NULL;
             }
+            else if (parse_thread_scheduling(json_object_get_object(entrypoint, "thread"), &config->thread_scheduling) != 0)
+            {
+                /*Codes_SRS_OUTPROCESS_LOADER_17_021: [ This function shall return NULL if any calls fails. ] */
+                LogError("Unable to parse the thread scheduling of the entrypoint");
+                STRING_delete(config->control_id);
+                if (config->process_argv != NULL)
+                {
+                    for (size_t i = 0; i < config->process_argc; ++i)
+                    {
+                        free(config->process_argv[i]);
+                    }
+                    free(config->process_argv);
+                }
+                free(config);
+                config = NULL;
+            }
             else
             {
                 /*Codes_SRS_OUTPROCESS_LOADER_17_043: [ This function shall read the "timeout" value. ]*/
@@ -704,6 +768,8 @@ static void* OutprocessModuleLoader_BuildModuleConfiguration(
         {
             /*Codes_SRS_OUTPROCESS_LOADER_17_035: [ Upon success, this function shall return a valid pointer to an OUTPROCESS_MODULE_CONFIG structure. ]*/
             fullModuleConfiguration->remote_message_wait = ep->remote_message_wait;
+            /*Codes_SRS_OUTPROCESS_LOADER_30_003: [ This function shall copy the entrypoint `thread_scheduling` to the `OUTPROCESS_MODULE_CONFIG::thread_scheduling` field. ]*/
+            fullModuleConfiguration->thread_scheduling = ep->thread_scheduling;
             fullModuleConfiguration->lifecycle_model = OUTPROCESS_LIFECYCLE_SYNC;
         }
     }
@@ -10,6 +10,8 @@
 #include "module.h"
 #include "message.h"
 #include "message_queue.h"
+#include "monotonic_clock.h"
+#include "thread_scheduling.h"
 #include "control_message.h"
 #include "module_loaders/outprocess_module.h"
 #include "azure_c_shared_utility/strings.h"
@@ -39,6 +41,9 @@ typedef struct OUTPROCESS_HANDLE_DATA_TAG
 	OUTPROCESS_MODULE_LIFECYCLE lifecyle_model;
 	BROKER_HANDLE broker;
 	unsigned int remote_message_wait;
+	THREAD_SCHEDULING_CONFIG thread_scheduling;
+	size_t expired_messages;
+	uint8_t message_version;
 
 	THREAD_CONTROL message_receive_thread;
 	THREAD_CONTROL message_send_thread;
@@ -50,6 +55,21 @@ typedef struct OUTPROCESS_HANDLE_DATA_TAG
 static void* construct_create_message(OUTPROCESS_HANDLE_DATA* handleData, int32_t * creationMessageSize);
 static void send_start_message(OUTPROCESS_HANDLE_DATA* handleData);
 
+/*releases a message buffer received with NN_MSG once the message made from it is destroyed*/
+static void release_received_message(void* buffer)
+{
+	(void)nn_freemsg(buffer);
+}
+
+static void apply_thread_scheduling(OUTPROCESS_HANDLE_DATA* handleData)
+{
+	/*Codes_SRS_OUTPROCESS_MODULE_30_008: [ Each thread of the module shall first apply the `thread_scheduling` of the module configuration to itself with `ThreadScheduling_Apply` if it changes any setting, and shall carry on if that fails. ]*/
+	if (THREAD_SCHEDULING_IS_SET(&handleData->thread_scheduling) &&
+		ThreadScheduling_Apply(&handleData->thread_scheduling) != 0)
+	{
+		LogError("unable to apply the thread scheduling to an outprocess module thread");
+	}
+}
 
 int outprocessIncomingMessageThread(void *param)
 {
@@ -62,6 +82,7 @@ int outprocessIncomingMessageThread(void *param)
 	else
 	{
 		int should_continue = 1;
+		apply_thread_scheduling(handleData);
 
 		while (should_continue)
 		{
@@ -112,15 +133,18 @@ int outprocessIncomingMessageThread(void *param)
 			else
 			{
 				/*Codes_SRS_OUTPROCESS_MODULE_17_039: [ Upon successful receiving a gateway message, this function shall deserialize the message. ]*/
-				const unsigned char*buf_bytes = (const unsigned char*)buf;
-				MESSAGE_HANDLE msg = Message_CreateFromByteArray(buf_bytes, nbytes);
-				if (msg != NULL)
+				/*Codes_SRS_OUTPROCESS_MODULE_30_005: [ The message shall take ownership of the received buffer, so that its content is not copied, and the buffer shall be freed with nn_freemsg when the message is destroyed, or right away if the message cannot be deserialized. ]*/
+				MESSAGE_HANDLE msg = Message_CreateFromByteArrayWithRelease(buf, nbytes, release_received_message);
+				if (msg == NULL)
+				{
+					nn_freemsg(buf);
+				}
+				else
 				{
 					/*Codes_SRS_OUTPROCESS_MODULE_17_040: [ This function shall publish any successfully created gateway message to the broker. ]*/
 					Broker_Publish(handleData->broker, (MODULE_HANDLE)handleData, msg);
 					Message_Destroy(msg);
 				}
-				nn_freemsg(buf);
 			}
 			ThreadAPI_Sleep(1);
 		}
@@ -138,6 +162,7 @@ static int outprocessOutgoingMessagesThread(void * param)
 	else
 	{
 		int should_continue = 1;
+		apply_thread_scheduling(handleData);
 
 		while (should_continue)
 		{
@@ -167,6 +192,7 @@ static int outprocessOutgoingMessagesThread(void * param)
 				should_continue = 0;
 				break;
 			}
+			uint8_t message_version = handleData->message_version;
 			
 			if (MESSAGE_QUEUE_is_empty(handleData->outgoing_messages))
 			{
@@ -193,31 +219,56 @@ static int outprocessOutgoingMessagesThread(void * param)
 			/* forward message to remote */
 			if (messageHandle != NULL)
 			{
-				/*Codes_SRS_OUTPROCESS_MODULE_17_023: [ This function shall serialize the message for transmission on the message channel. ]*/
-				int32_t msg_size = Message_ToByteArray(messageHandle, NULL, 0);
-				if (msg_size < 0)
+				/*Codes_SRS_OUTPROCESS_MODULE_30_001: [ If the message has expired, as told by `Message_IsExpired` at `MonotonicClock_GetMicroseconds`, this function shall not send it and shall count it in the module's expired messages. ]*/
+				if (Message_IsExpired(messageHandle, MonotonicClock_GetMicroseconds()))
 				{
-					LogError("unable to serialize outgoing message [%p]", messageHandle);
+					handleData->expired_messages++;
+					/*Codes_SRS_OUTPROCESS_MODULE_30_009: [ This function shall report an expired message it does not send with `Broker_ReportExpired`, so that it is counted in the `expired` statistics of the module, and shall carry on if that fails. ]*/
+					if (Broker_ReportExpired(handleData->broker, (MODULE_HANDLE)handleData, 1) != BROKER_OK)
+					{
+						LogError("unable to report an expired message to the broker");
+					}
 				}
 				else
 				{
-					void* result = nn_allocmsg(msg_size, 0);
-					if (result == NULL)
+					/*Codes_SRS_OUTPROCESS_MODULE_17_023: [ This function shall serialize the message for transmission on the message channel. ]*/
+					/*Codes_SRS_OUTPROCESS_MODULE_30_003: [ This function shall serialize the message in the version kept from the last successful Create Response, GATEWAY_MESSAGE_VERSION_1 until there is one. ]*/
+					/*Codes_SRS_OUTPROCESS_MODULE_30_004: [ This function shall use the serialization kept with the message, so that a message sent on several links is serialized once. ]*/
+					CONSTBUFFER_HANDLE header = Message_GetSerializationHeader(messageHandle, message_version);
+					if (header == NULL)
 					{
-						LogError("unable to allocate buffer for outgoing message [%p]", messageHandle);
+						LogError("unable to serialize outgoing message [%p]", messageHandle);
 					}
 					else
 					{
-						unsigned char *nn_msg_bytes = (unsigned char *)result;
-						Message_ToByteArray(messageHandle, nn_msg_bytes, msg_size);
+						/*Codes_SRS_OUTPROCESS_MODULE_30_006: [ This function shall send the serialization without the content, then each segment of the content of the message, in one gather write with `nn_sendmsg`, without first assembling a contiguous serialization; nanomsg copies the segments into its message chunk. ]*/
+						const CONSTBUFFER* serialized = CONSTBUFFER_GetContent(header);
+						size_t segmentCount = Message_GetContentSegmentCount(messageHandle);
+						struct nn_iovec iov[1 + MESSAGE_MAX_CONTENT_SEGMENTS];
+						struct nn_msghdr hdr;
+						size_t size = serialized->size;
+						size_t i;
+						iov[0].iov_base = (void*)serialized->buffer;
+						iov[0].iov_len = serialized->size;
+						for (i = 0; i < segmentCount; i++)
+						{
+							const CONSTBUFFER* segment = Message_GetContentSegment(messageHandle, i);
+							iov[1 + i].iov_base = (void*)segment->buffer;
+							iov[1 + i].iov_len = segment->size;
+							size += segment->size;
+						}
+						hdr.msg_iov = iov;
+						hdr.msg_iovlen = (int)(1 + segmentCount);
+						hdr.msg_control = NULL;
+						hdr.msg_controllen = 0;
 						/*Codes_SRS_OUTPROCESS_MODULE_17_024: [ This function shall send the message on the message channel. ]*/
-						int nbytes = nn_send(handleData->message_socket, &result, NN_MSG, 0);
-						if (nbytes != msg_size)
+						int nbytes = nn_sendmsg(handleData->message_socket, &hdr, 0);
+						if (nbytes != (int)size)
 						{
 							LogError("unable to send buffer to remote for message [%p]", messageHandle);
-							/*Codes_SRS_OUTPROCESS_MODULE_17_025: [ This function shall free any resources created. ]*/
-							nn_freemsg(result);
 						}
+						/*Codes_SRS_OUTPROCESS_MODULE_17_025: [ This function shall free any resources created. ]*/
+						CONSTBUFFER_Destroy(header);
 					}
 				}
 				// We are finally finished with this message
@@ -241,6 +292,7 @@ static int outprocessCreate(void *param)
 	}
 	else
 	{
+		apply_thread_scheduling(handleData);
 		/*Codes_SRS_OUTPROCESS_MODULE_17_056: [ This thread shall ensure thread safety on the module data. ]*/
 		if (Lock(handleData->handle_lock) != LOCK_OK)
 		{
@@ -335,8 +387,21 @@ static int outprocessCreate(void *param)
 										else
 										{
 											/*Codes_SRS_OUTPROCESS_MODULE_17_015: [ This function shall expect a successful result from the Create Response to consider the module creation a success. ]*/
-											// complete success!
-											thread_return = 1;
+											/*Codes_SRS_OUTPROCESS_MODULE_30_002: [ On a successful Create Response, this function shall keep GATEWAY_MESSAGE_VERSION_2 as the version of the messages sent to the module host if the gateway_message_version of the reply is at least GATEWAY_MESSAGE_VERSION_2, and GATEWAY_MESSAGE_VERSION_1 otherwise. ]*/
+											if (Lock(handleData->handle_lock) != LOCK_OK)
+											{
+												LogError("unable to Lock handle data");
+												thread_return = -1;
+											}
+											else
+											{
+												handleData->message_version = (resp_msg->gateway_message_version >= GATEWAY_MESSAGE_VERSION_2) ?
+													GATEWAY_MESSAGE_VERSION_2 :
+													GATEWAY_MESSAGE_VERSION_1;
+												(void)Unlock(handleData->handle_lock);
+												// complete success!
+												thread_return = 1;
+											}
 										}
 									}
 									ControlMessage_Destroy(msg);
@@ -362,6 +427,7 @@ int outprocessControlThread(void *param)
 	{
 		int should_continue = 1;
 		int needs_to_attach = 0;
+		apply_thread_scheduling(handleData);
 
 		while (should_continue)
 		{
@@ -761,6 +827,10 @@ static MODULE_HANDLE Outprocess_Create(BROKER_HANDLE broker, const void* configu
 						};
 						module->broker = broker;
 						module->remote_message_wait = config->remote_message_wait;
+						/*Codes_SRS_OUTPROCESS_MODULE_30_007: [ This function shall keep the `thread_scheduling` of the configuration for the threads of the module. ]*/
+						module->thread_scheduling = config->thread_scheduling;
+						module->expired_messages = 0;
+						module->message_version = GATEWAY_MESSAGE_VERSION_1;
 						module->message_receive_thread = default_thread;
 						module->message_send_thread = default_thread;
 						module->control_thread = default_thread;
@@ -974,6 +1044,11 @@ static void Outprocess_Destroy(MODULE_HANDLE moduleHandle)
 		shutdown_a_thread(&(handleData->control_thread));
 		shutdown_a_thread(&(handleData->async_create_thread));
 
+		if (handleData->expired_messages > 0)
+		{
+			LogInfo("dropped %zu expired outgoing messages", handleData->expired_messages);
+		}
+
 		/* Free remaining resources */
 		/*Codes_SRS_OUTPROCESS_MODULE_17_034: [ This function shall release all resources created by this module. ]*/
 		delete_strings(handleData);